@@ -0,0 +1,120 @@
+using Newtonsoft.Json.Linq;
+
+namespace motorcontrolfunctionappV420240317141003
+{
+    // Decodes compressed telemetry frames (CONFIG_DTMC_TELEMETRY_COMPRESSION) into the same
+    // columns as the JSON frame. Layout is documented in python_scripts/telemetry_codec.py.
+    public static class telemetry_codec
+    {
+        private const byte FRAME_VERSION = 1;
+
+        private const byte COLUMN_UINT64 = 0;
+        private const byte COLUMN_FLOAT32 = 1;
+
+        private const byte FILTER_DELTA = 1;
+        private const byte FILTER_XOR = 2;
+
+        public static bool is_frame(byte[] body)
+        {
+            return body.Length >= 4 && body[0] == (byte)'D' && body[1] == (byte)'T';
+        }
+
+        // Batches of many stations' frames from an edge gateway, kept for cold storage like frames
+        public static bool is_batch(byte[] body)
+        {
+            return body.Length >= 4 && body[0] == (byte)'D' && body[1] == (byte)'B';
+        }
+
+        public static JObject decode(byte[] body)
+        {
+            if (!is_frame(body) || body[2] != FRAME_VERSION)
+                throw new FormatException($"Not a version {FRAME_VERSION} telemetry frame");
+
+            byte[] columns = decompress(body, 4, body[3] >> 4, body[3] & 0x0F);
+            int count = BitConverter.ToUInt16(columns, 0);
+            int column_count = columns[2];
+            int offset = 3;
+            JObject frame = new JObject();
+
+            for (int column = 0; column < column_count; column++)
+            {
+                int key_length = columns[offset];
+                string key = System.Text.Encoding.ASCII.GetString(columns, offset + 1, key_length);
+                offset += 1 + key_length;
+                byte type = columns[offset];
+                byte filter = columns[offset + 1];
+                offset += 2;
+
+                JArray values = new JArray();
+                ulong previous = 0;
+                for (int i = 0; i < count; i++)
+                {
+                    ulong value;
+                    if (type == COLUMN_UINT64)
+                    {
+                        value = BitConverter.ToUInt64(columns, offset);
+                        offset += sizeof(ulong);
+                    }
+                    else
+                    {
+                        value = BitConverter.ToUInt32(columns, offset);
+                        offset += sizeof(uint);
+                    }
+
+                    if (filter == FILTER_DELTA)
+                        value = type == COLUMN_UINT64 ? value + previous : (uint)(value + previous);
+                    else if (filter == FILTER_XOR)
+                        value ^= previous;
+                    previous = value;
+
+                    if (type == COLUMN_FLOAT32)
+                        values.Add((double)BitConverter.Int32BitsToSingle((int)(uint)value));
+                    else
+                        values.Add((long)value);
+                }
+                frame[key] = values;
+            }
+
+            return frame;
+        }
+
+        // LZSS stream in the heatshrink format: a 1 bit and a literal byte, or a 0 bit,
+        // distance - 1 and length - 1 of a back-reference
+        private static byte[] decompress(byte[] input, int start, int window_bits, int lookahead_bits)
+        {
+            List<byte> output = new List<byte>(input.Length * 4);
+            long position = (long)start * 8;
+            long end = (long)input.Length * 8;
+
+            int read(int count)
+            {
+                int value = 0;
+                for (int i = 0; i < count; i++, position++)
+                    value = (value << 1) | ((input[position >> 3] >> (7 - (int)(position & 7))) & 1);
+                return value;
+            }
+
+            while (end - position >= 1 + 8)
+            {
+                if (read(1) == 1)
+                {
+                    output.Add((byte)read(8));
+                    continue;
+                }
+
+                // Trailing zero padding is shorter than a back-reference
+                if (end - position < window_bits + lookahead_bits)
+                    break;
+                int distance = read(window_bits) + 1;
+                int length = read(lookahead_bits) + 1;
+                if (distance > output.Count)
+                    throw new FormatException("Back-reference before the start of the stream");
+
+                for (int i = 0; i < length; i++)
+                    output.Add(output[output.Count - distance]);
+            }
+
+            return output.ToArray();
+        }
+    }
+}
@@ -29,45 +29,46 @@ namespace motorcontrolfunctionappV420240317141003
                 {
                     if (@event.SystemProperties.TryGetValue("iothub-connection-device-id", out var temp_device_id))
                     {
-                        string telemetry_string = @event.EventBody.ToString();
-
-                        _logger.LogWarning("Telemetry");
-                        _logger.LogWarning(telemetry_string);
+                        byte[] telemetry_body = @event.EventBody.ToArray();
 
-                        string device_id = (string)temp_device_id;
+                        // Full-rate frames are kept for cold storage, the twin follows the per-frame summaries
+                        if (telemetry_codec.is_frame(telemetry_body) || telemetry_codec.is_batch(telemetry_body))
+                            continue;
 
+                        string telemetry_string = @event.EventBody.ToString();
                         JObject telemetry_json = JObject.Parse(telemetry_string);
-                        long[] timestamp_array = telemetry_json["timestamp"].ToObject<long[]>();
-                        int[] direction_array = telemetry_json["direction"].ToObject<int[]>();
-                        double[] duty_cycle_array = telemetry_json["duty_cycle"].ToObject<double[]>();
-                        double[] velocity_array = telemetry_json["velocity"].ToObject<double[]>();
-                        double[] position_array = telemetry_json["position"].ToObject<double[]>();
-                        double[] current_array = telemetry_json["current"].ToObject<double[]>();
-
-                        JsonPatchDocument digital_twin_patch = new JsonPatchDocument();
-                        DateTime unix_epoch = new DateTime(1970, 1, 1, 0, 0, 0, DateTimeKind.Utc);
-                        DateTime timestamp;
+                        string device_id = (string)temp_device_id;
 
                         var credentials = new ManagedIdentityCredential(CLIENT_ID, default);
                         var client = new DigitalTwinsClient(new Uri(ADT_SERVICE_URL), credentials);
 
-                        Parallel.For(0, timestamp_array.Length - 1, i =>
+                        // An edge gateway sends the latest state of every station that changed in one message
+                        if (telemetry_json["twins"] is JArray twins)
                         {
-                            digital_twin_patch = new JsonPatchDocument();
-                            timestamp = unix_epoch.AddMilliseconds(timestamp_array[i]);
+                            _logger.LogInformation($"Gateway patch of {twins.Count} twins");
+
+                            foreach (JObject twin in twins.OfType<JObject>())
+                            {
+                                JsonPatchDocument twin_patch = twin["summary"] is JObject twin_summary
+                                    ? summary_patch(twin_summary)
+                                    : latest_patch((JObject)twin["latest"]);
+
+                                if (twin_patch != null)
+                                    await client.UpdateDigitalTwinAsync(twin_id(twin["device"].Value<string>(), twin["motor"]), twin_patch);
+                            }
+                            continue;
+                        }
 
-                            digital_twin_patch.AppendReplace("/duty_cycle", duty_cycle_array[i]);
-                            digital_twin_patch.AppendReplace("/velocity", velocity_array[i]);
-                            digital_twin_patch.AppendReplace("/position", position_array[i]);
-                            digital_twin_patch.AppendReplace("/current", current_array[i]);
+                        if (telemetry_json["summary"] is not JObject summary)
+                            continue;
 
-                            digital_twin_patch.AppendReplace("/$metadata/duty_cycle/sourceTime", timestamp);
-                            digital_twin_patch.AppendReplace("/$metadata/velocity/sourceTime", timestamp);
-                            digital_twin_patch.AppendReplace("/$metadata/position/sourceTime", timestamp);
-                            digital_twin_patch.AppendReplace("/$metadata/current/sourceTime", timestamp);
+                        _logger.LogInformation("Summary");
+                        _logger.LogInformation(telemetry_string);
 
-                            client.UpdateDigitalTwinAsync(device_id, digital_twin_patch);
-                        });
+                        @event.Properties.TryGetValue("motor", out var motor);
+
+                        // One write per frame instead of one per sample
+                        await client.UpdateDigitalTwinAsync(twin_id(device_id, motor), summary_patch(summary));
                     }
                 }
                 catch (Exception ex)
@@ -76,5 +77,61 @@ namespace motorcontrolfunctionappV420240317141003
                 }
             }
         }
+
+        // Motors after the first are twins of their own, named after the device's component
+        private static string twin_id(string device_id, object motor)
+        {
+            string motor_id = motor?.ToString();
+            return string.IsNullOrEmpty(motor_id) || motor_id == "0" ? device_id : $"{device_id}-motor{motor_id}";
+        }
+
+        private static JsonPatchDocument summary_patch(JObject summary)
+        {
+            JsonPatchDocument digital_twin_patch = new JsonPatchDocument();
+            DateTime unix_epoch = new DateTime(1970, 1, 1, 0, 0, 0, DateTimeKind.Utc);
+            DateTime timestamp = unix_epoch.AddMilliseconds(summary["end"].Value<long>());
+
+            foreach (string channel in new[] { "duty_cycle", "velocity", "position", "current" })
+            {
+                JObject channel_summary = (JObject)summary[channel];
+
+                digital_twin_patch.AppendReplace($"/{channel}", channel_summary["last"].Value<double>());
+                digital_twin_patch.AppendReplace($"/{channel}_summary", new Dictionary<string, double>
+                {
+                    ["min"] = channel_summary["min"].Value<double>(),
+                    ["max"] = channel_summary["max"].Value<double>(),
+                    ["mean"] = channel_summary["mean"].Value<double>(),
+                    ["rms"] = channel_summary["rms"].Value<double>(),
+                });
+
+                digital_twin_patch.AppendReplace($"/$metadata/{channel}/sourceTime", timestamp);
+                digital_twin_patch.AppendReplace($"/$metadata/{channel}_summary/sourceTime", timestamp);
+            }
+
+            digital_twin_patch.AppendReplace("/mode", summary["mode"].Value<int>());
+            digital_twin_patch.AppendReplace("/position_sp", summary["position_sp"].Value<double>());
+            digital_twin_patch.AppendReplace("/velocity_sp", summary["velocity_sp"].Value<double>());
+
+            return digital_twin_patch;
+        }
+
+        // Stations without summaries still report the last sample of their latest frame
+        private static JsonPatchDocument latest_patch(JObject latest)
+        {
+            if (latest == null)
+                return null;
+
+            JsonPatchDocument digital_twin_patch = new JsonPatchDocument();
+            DateTime unix_epoch = new DateTime(1970, 1, 1, 0, 0, 0, DateTimeKind.Utc);
+            DateTime timestamp = unix_epoch.AddMilliseconds(latest["time"].Value<long>());
+
+            foreach (string channel in new[] { "duty_cycle", "velocity", "position", "current" })
+            {
+                digital_twin_patch.AppendReplace($"/{channel}", latest[channel].Value<double>());
+                digital_twin_patch.AppendReplace($"/$metadata/{channel}/sourceTime", timestamp);
+            }
+
+            return digital_twin_patch;
+        }
     }
 }
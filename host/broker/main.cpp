@@ -0,0 +1,87 @@
+// Includes
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mqtt_broker.hpp"
+#include "esp_log.h"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_signal(int signal)
+{
+  (void)signal;
+  stop_requested = 1;
+}
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --port N          Port to listen on, 0 picks a free one (default 1883)\n"
+          "  --any             Listen on every interface instead of loopback only\n"
+          "  --ack-delay-ms N  Hold PUBACKs back to stand in for the hub round trip (default 0)\n"
+          "  --stats           Print publish rates every second\n"
+          "  --verbose         Log connections\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  uint16_t port = 1883;
+  uint32_t ack_delay_ms = 0;
+  bool any_address = false;
+  bool print_stats = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+      port = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--ack-delay-ms") == 0 && i + 1 < argc)
+      ack_delay_ms = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--any") == 0)
+      any_address = true;
+    else if (strcmp(argv[i], "--stats") == 0)
+      print_stats = true;
+    else if (strcmp(argv[i], "--verbose") == 0)
+      esp_log_level_set("*", ESP_LOG_DEBUG);
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  MqttBroker broker;
+  if (!broker.start(port, ack_delay_ms, any_address))
+    return 1;
+
+  // The port goes to stdout so scripts can start the broker on port 0
+  printf("%u\n", broker.get_port());
+  fflush(stdout);
+
+  broker_stats prev = broker.get_stats();
+
+  while (!stop_requested)
+  {
+    sleep(1);
+
+    broker_stats stats = broker.get_stats();
+    if (print_stats)
+      fprintf(stderr, "%u clients, %llu publishes/s, %.1f kB/s, %llu acks/s, %llu forwarded/s\n",
+              stats.connections,
+              (unsigned long long)(stats.publishes - prev.publishes),
+              (stats.payload_bytes - prev.payload_bytes) / 1000.0,
+              (unsigned long long)(stats.acks - prev.acks),
+              (unsigned long long)(stats.forwarded - prev.forwarded));
+    prev = stats;
+  }
+
+  broker.stop();
+  return 0;
+}
@@ -0,0 +1,679 @@
+// Includes
+#include "mqtt_broker.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "esp_log.h"
+
+static constexpr char *TAG = "Broker";
+
+// MQTT control packet types, the high nibble of the fixed header
+static constexpr uint8_t PACKET_CONNECT = 1;
+static constexpr uint8_t PACKET_CONNACK = 2;
+static constexpr uint8_t PACKET_PUBLISH = 3;
+static constexpr uint8_t PACKET_PUBACK = 4;
+static constexpr uint8_t PACKET_SUBSCRIBE = 8;
+static constexpr uint8_t PACKET_SUBACK = 9;
+static constexpr uint8_t PACKET_UNSUBSCRIBE = 10;
+static constexpr uint8_t PACKET_UNSUBACK = 11;
+static constexpr uint8_t PACKET_PINGREQ = 12;
+static constexpr uint8_t PACKET_PINGRESP = 13;
+static constexpr uint8_t PACKET_DISCONNECT = 14;
+
+// Forwards to a subscriber that stopped reading are dropped past this much queued output
+static constexpr size_t MAX_QUEUED_OUTPUT = 8 * 1024 * 1024;
+
+static constexpr char TWIN_GET_TOPIC[] = "$iothub/twin/GET/?$rid=";
+static constexpr char TWIN_PATCH_TOPIC[] = "$iothub/twin/PATCH/properties/reported/?$rid=";
+static constexpr char TWIN_DOCUMENT[] = "{\"desired\":{\"$version\":1},\"reported\":{\"$version\":1}}";
+
+static uint16_t read_u16(const uint8_t *data)
+{
+  return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+MqttBroker::MqttBroker()
+{
+  listen_fd = -1;
+  epoll_fd = -1;
+  wakeup_fd = -1;
+  port = 0;
+  ack_delay_us = 0;
+  twin_version = 1;
+  next_connection_id = 1;
+
+  running = false;
+  dropping = false;
+
+  connection_count = 0;
+  publish_count = 0;
+  payload_bytes = 0;
+  ack_count = 0;
+  forward_count = 0;
+  twin_count = 0;
+}
+
+MqttBroker::~MqttBroker()
+{
+  stop();
+}
+
+uint64_t MqttBroker::now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+bool MqttBroker::start(uint16_t port, uint32_t ack_delay_ms, bool any_address)
+{
+  struct sockaddr_in address = {};
+  socklen_t address_length = sizeof(address);
+  int enable = 1;
+
+  listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (listen_fd < 0)
+  {
+    ESP_LOGE(TAG, "Failed to create the listening socket, errno %d.", errno);
+    return false;
+  }
+
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(any_address ? INADDR_ANY : INADDR_LOOPBACK);
+
+  if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0 ||
+      getsockname(listen_fd, (struct sockaddr *)&address, &address_length) != 0)
+  {
+    ESP_LOGE(TAG, "Failed to listen on port %u, errno %d.", port, errno);
+    close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+
+  this->port = ntohs(address.sin_port);
+  ack_delay_us = ack_delay_ms * 1000;
+
+  epoll_fd = epoll_create1(0);
+  wakeup_fd = eventfd(0, EFD_NONBLOCK);
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = listen_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+  event.data.fd = wakeup_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &event);
+
+  running = true;
+  thread = std::thread(&MqttBroker::run, this);
+
+  ESP_LOGI(TAG, "Listening on port %u.", this->port);
+  return true;
+}
+
+void MqttBroker::stop()
+{
+  if (!running)
+    return;
+
+  uint64_t signal = 1;
+  running = false;
+  (void)write(wakeup_fd, &signal, sizeof(signal));
+  thread.join();
+
+  while (!connections.empty())
+    close_client(connections.begin()->first);
+
+  close(listen_fd);
+  close(wakeup_fd);
+  close(epoll_fd);
+  listen_fd = wakeup_fd = epoll_fd = -1;
+}
+
+void MqttBroker::set_observer(publish_observer observer)
+{
+  this->observer = observer;
+}
+
+void MqttBroker::publish(const std::string &topic, const uint8_t *payload, uint32_t length)
+{
+  uint64_t signal = 1;
+
+  {
+    std::lock_guard<std::mutex> guard(injected_mutex);
+    injected.push_back({topic, std::vector<uint8_t>(payload, payload + length)});
+  }
+  (void)write(wakeup_fd, &signal, sizeof(signal));
+}
+
+void MqttBroker::drop_clients()
+{
+  uint64_t signal = 1;
+
+  dropping = true;
+  (void)write(wakeup_fd, &signal, sizeof(signal));
+}
+
+uint16_t MqttBroker::get_port()
+{
+  return port;
+}
+
+broker_stats MqttBroker::get_stats()
+{
+  return {
+      .connections = connection_count,
+      .publishes = publish_count,
+      .payload_bytes = payload_bytes,
+      .acks = ack_count,
+      .forwarded = forward_count,
+      .twin_requests = twin_count,
+  };
+}
+
+// MQTT 3.1.1 topic filter matching, + is one level and a trailing # the rest
+bool MqttBroker::topic_matches(const std::string &filter, const std::string &topic)
+{
+  size_t f = 0;
+  size_t t = 0;
+
+  // Wildcards do not match topics starting with $ unless the filter names them
+  if (!topic.empty() && topic[0] == '$' && !filter.empty() && (filter[0] == '+' || filter[0] == '#'))
+    return false;
+
+  while (f < filter.size())
+  {
+    if (filter[f] == '#')
+      return true;
+
+    if (filter[f] == '+')
+    {
+      while (t < topic.size() && topic[t] != '/')
+        t++;
+      f++;
+    }
+    else
+    {
+      if (t >= topic.size() || filter[f] != topic[t])
+        return false;
+      f++;
+      t++;
+    }
+
+    // "a/#" also matches "a"
+    if (t == topic.size() && f + 1 < filter.size() && filter[f] == '/' && filter[f + 1] == '#')
+      return true;
+  }
+
+  return t == topic.size();
+}
+
+void MqttBroker::run()
+{
+  struct epoll_event events[MAX_EVENTS];
+
+  while (running)
+  {
+    int timeout_ms = 100;
+
+    if (!pending_acks.empty())
+    {
+      uint64_t now = now_us();
+      uint64_t due = pending_acks.top().due_us;
+      timeout_ms = due > now ? (int)((due - now + 999) / 1000) : 0;
+    }
+
+    int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+
+    for (int i = 0; i < count; i++)
+    {
+      int fd = events[i].data.fd;
+
+      if (fd == listen_fd)
+      {
+        accept_clients();
+        continue;
+      }
+      if (fd == wakeup_fd)
+      {
+        forward_injected();
+        continue;
+      }
+
+      auto found = connections.find(fd);
+      if (found == connections.end())
+        continue;
+
+      if (events[i].events & (EPOLLHUP | EPOLLERR))
+      {
+        close_client(fd);
+        continue;
+      }
+      if (events[i].events & EPOLLOUT)
+        flush(found->second);
+      if (events[i].events & EPOLLIN)
+        read_client(found->second);
+    }
+
+    flush_acks();
+
+    if (dropping.exchange(false))
+    {
+      ESP_LOGI(TAG, "Dropping %zu connections.", connections.size());
+      while (!connections.empty())
+        close_client(connections.begin()->first);
+    }
+  }
+}
+
+void MqttBroker::accept_clients()
+{
+  int enable = 1;
+
+  while (true)
+  {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0)
+      break;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    connection &client = connections[fd];
+    client.id = next_connection_id++;
+    client.fd = fd;
+    client.connected = false;
+    client.output_offset = 0;
+    client.output_blocked = false;
+    connection_fds[client.id] = fd;
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  }
+}
+
+void MqttBroker::read_client(connection &client)
+{
+  uint8_t buffer[64 * 1024];
+  int fd = client.fd;
+
+  while (true)
+  {
+    ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+
+    if (received > 0)
+    {
+      client.input.insert(client.input.end(), buffer, buffer + received);
+      if (received < (ssize_t)sizeof(buffer))
+        break;
+    }
+    else if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      break;
+    else
+    {
+      close_client(fd);
+      return;
+    }
+  }
+
+  size_t offset = 0;
+
+  while (client.input.size() - offset >= 2)
+  {
+    const uint8_t *packet = client.input.data() + offset;
+    size_t available = client.input.size() - offset;
+    uint32_t length = 0;
+    uint32_t multiplier = 1;
+    size_t header = 1;
+    bool complete = false;
+
+    // Remaining length, up to four 7 bit groups
+    while (header < available && header <= 4)
+    {
+      uint8_t digit = packet[header++];
+      length += (digit & 0x7F) * multiplier;
+      multiplier *= 128;
+      if ((digit & 0x80) == 0)
+      {
+        complete = true;
+        break;
+      }
+    }
+
+    if (!complete)
+    {
+      if (header > 4)
+      {
+        ESP_LOGW(TAG, "Malformed remaining length from %s, closing.", client.client_id.c_str());
+        close_client(fd);
+        return;
+      }
+      break;
+    }
+    if (length > MAX_PACKET_SIZE)
+    {
+      ESP_LOGW(TAG, "Packet of %lu bytes from %s exceeds the limit, closing.", (unsigned long)length, client.client_id.c_str());
+      close_client(fd);
+      return;
+    }
+    if (available < header + length)
+      break;
+
+    if (!process_packet(client, packet[0], packet + header, length))
+    {
+      close_client(fd);
+      return;
+    }
+    offset += header + length;
+  }
+
+  client.input.erase(client.input.begin(), client.input.begin() + offset);
+}
+
+// Returns false if the connection should be closed
+bool MqttBroker::process_packet(connection &client, uint8_t type, const uint8_t *body, uint32_t length)
+{
+  uint8_t packet_type = type >> 4;
+
+  if (!client.connected && packet_type != PACKET_CONNECT)
+    return false;
+
+  switch (packet_type)
+  {
+  case PACKET_CONNECT:
+    handle_connect(client, body, length);
+    break;
+
+  case PACKET_SUBSCRIBE:
+    handle_subscribe(client, body, length);
+    break;
+
+  case PACKET_UNSUBSCRIBE:
+  {
+    if (length < 2)
+      return false;
+
+    uint8_t unsuback[] = {body[0], body[1]};
+    send_packet(client, PACKET_UNSUBACK << 4, unsuback, sizeof(unsuback));
+    break;
+  }
+
+  case PACKET_PUBLISH:
+    handle_publish(client, type & 0x0F, body, length);
+    break;
+
+  case PACKET_PUBACK:
+    break;
+
+  case PACKET_PINGREQ:
+    send_packet(client, PACKET_PINGRESP << 4, NULL, 0);
+    break;
+
+  case PACKET_DISCONNECT:
+    return false;
+
+  default:
+    ESP_LOGW(TAG, "Unsupported packet type %u from %s.", packet_type, client.client_id.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+void MqttBroker::handle_connect(connection &client, const uint8_t *body, uint32_t length)
+{
+  // Protocol name, level, flags and keep alive come before the client identifier
+  uint32_t offset = 2 + read_u16(body) + 1 + 1 + 2;
+
+  if (offset + 2 <= length)
+  {
+    uint16_t id_length = read_u16(&body[offset]);
+    if (offset + 2 + id_length <= length)
+      client.client_id.assign((const char *)&body[offset + 2], id_length);
+  }
+
+  client.connected = true;
+  connection_count++;
+
+  // No session is kept, so session present is always clear
+  uint8_t connack[] = {0x00, 0x00};
+  send_packet(client, PACKET_CONNACK << 4, connack, sizeof(connack));
+
+  ESP_LOGD(TAG, "Client %s connected.", client.client_id.c_str());
+}
+
+void MqttBroker::handle_subscribe(connection &client, const uint8_t *body, uint32_t length)
+{
+  std::vector<uint8_t> suback(body, body + 2);
+  uint32_t offset = 2;
+
+  while (offset + 2 <= length)
+  {
+    uint16_t filter_length = read_u16(&body[offset]);
+    if (offset + 2 + filter_length + 1 > length)
+      break;
+
+    client.subscriptions.emplace_back((const char *)&body[offset + 2], filter_length);
+    uint8_t qos = body[offset + 2 + filter_length];
+    suback.push_back(qos > 1 ? 1 : qos);
+    offset += 2 + filter_length + 1;
+  }
+
+  send_packet(client, PACKET_SUBACK << 4, suback.data(), suback.size());
+}
+
+void MqttBroker::handle_publish(connection &client, uint8_t flags, const uint8_t *body, uint32_t length)
+{
+  uint8_t qos = (flags >> 1) & 0x03;
+  uint16_t topic_length = length >= 2 ? read_u16(body) : 0;
+  uint32_t offset = 2 + topic_length;
+  uint16_t packet_id = 0;
+
+  if (length < 2 || offset + (qos > 0 ? 2 : 0) > length)
+    return;
+
+  std::string topic((const char *)&body[2], topic_length);
+
+  if (qos > 0)
+  {
+    packet_id = read_u16(&body[offset]);
+    offset += 2;
+  }
+
+  publish_count++;
+  payload_bytes += length - offset;
+
+  if (qos > 0)
+  {
+    if (ack_delay_us > 0)
+      pending_acks.push({now_us() + ack_delay_us, client.id, packet_id});
+    else
+      send_puback(client, packet_id);
+  }
+
+  if (topic.compare(0, 13, "$iothub/twin/") == 0)
+    answer_twin(client, topic);
+  else
+  {
+    if (observer)
+      observer(topic, &body[offset], length - offset);
+    forward(topic, &body[offset], length - offset);
+  }
+}
+
+// IoT Hub answers a GET with the twin document and a reported PATCH with the new version
+void MqttBroker::answer_twin(connection &client, const std::string &topic)
+{
+  std::string response;
+
+  if (topic.compare(0, sizeof(TWIN_GET_TOPIC) - 1, TWIN_GET_TOPIC) == 0)
+  {
+    response = "$iothub/twin/res/200/?$rid=" + topic.substr(sizeof(TWIN_GET_TOPIC) - 1);
+    send_publish(client, response, (const uint8_t *)TWIN_DOCUMENT, sizeof(TWIN_DOCUMENT) - 1);
+  }
+  else if (topic.compare(0, sizeof(TWIN_PATCH_TOPIC) - 1, TWIN_PATCH_TOPIC) == 0)
+  {
+    response = "$iothub/twin/res/204/?$rid=" + topic.substr(sizeof(TWIN_PATCH_TOPIC) - 1) +
+               "&$version=" + std::to_string(++twin_version);
+    send_publish(client, response, NULL, 0);
+  }
+  else
+    return;
+
+  twin_count++;
+}
+
+void MqttBroker::forward(const std::string &topic, const uint8_t *payload, uint32_t length)
+{
+  for (auto &entry : connections)
+  {
+    connection &subscriber = entry.second;
+
+    for (const std::string &filter : subscriber.subscriptions)
+    {
+      if (!topic_matches(filter, topic))
+        continue;
+
+      if (subscriber.output.size() - subscriber.output_offset < MAX_QUEUED_OUTPUT)
+      {
+        send_publish(subscriber, topic, payload, length);
+        forward_count++;
+      }
+      break;
+    }
+  }
+}
+
+void MqttBroker::send_puback(connection &client, uint16_t packet_id)
+{
+  uint8_t puback[] = {(uint8_t)(packet_id >> 8), (uint8_t)packet_id};
+  send_packet(client, PACKET_PUBACK << 4, puback, sizeof(puback));
+  ack_count++;
+}
+
+// Always QoS 0, nothing the broker sends needs an acknowledgement
+void MqttBroker::send_publish(connection &client, const std::string &topic, const uint8_t *payload, uint32_t length)
+{
+  std::vector<uint8_t> body;
+  body.reserve(2 + topic.size() + length);
+  body.push_back(topic.size() >> 8);
+  body.push_back(topic.size() & 0xFF);
+  body.insert(body.end(), topic.begin(), topic.end());
+  if (length > 0)
+    body.insert(body.end(), payload, payload + length);
+
+  send_packet(client, PACKET_PUBLISH << 4, body.data(), body.size());
+}
+
+void MqttBroker::send_packet(connection &client, uint8_t type, const uint8_t *body, uint32_t length)
+{
+  uint32_t remaining = length;
+
+  client.output.push_back(type);
+  do
+  {
+    uint8_t digit = remaining % 128;
+    remaining /= 128;
+    client.output.push_back(remaining > 0 ? digit | 0x80 : digit);
+  } while (remaining > 0);
+
+  if (length > 0)
+    client.output.insert(client.output.end(), body, body + length);
+
+  flush(client);
+}
+
+void MqttBroker::flush(connection &client)
+{
+  while (client.output_offset < client.output.size())
+  {
+    ssize_t sent = send(client.fd, client.output.data() + client.output_offset,
+                        client.output.size() - client.output_offset, MSG_NOSIGNAL);
+    if (sent <= 0)
+      break;
+    client.output_offset += sent;
+  }
+
+  bool blocked = client.output_offset < client.output.size();
+  if (!blocked)
+  {
+    client.output.clear();
+    client.output_offset = 0;
+  }
+
+  // Only watch for writability while output is queued
+  if (blocked != client.output_blocked)
+  {
+    client.output_blocked = blocked;
+    struct epoll_event event = {};
+    event.events = blocked ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.fd = client.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client.fd, &event);
+  }
+}
+
+void MqttBroker::flush_acks()
+{
+  uint64_t now = now_us();
+
+  while (!pending_acks.empty() && pending_acks.top().due_us <= now)
+  {
+    delayed_ack ack = pending_acks.top();
+    pending_acks.pop();
+
+    // The connection may have closed while its acknowledgement was held back
+    auto found = connection_fds.find(ack.connection_id);
+    if (found != connection_fds.end())
+      send_puback(connections[found->second], ack.packet_id);
+  }
+}
+
+void MqttBroker::forward_injected()
+{
+  std::vector<injected_publish> publishes;
+  uint64_t signal;
+
+  (void)read(wakeup_fd, &signal, sizeof(signal));
+  {
+    std::lock_guard<std::mutex> guard(injected_mutex);
+    publishes.swap(injected);
+  }
+
+  for (const injected_publish &publish : publishes)
+  {
+    if (observer)
+      observer(publish.topic, publish.payload.data(), publish.payload.size());
+    forward(publish.topic, publish.payload.data(), publish.payload.size());
+  }
+}
+
+void MqttBroker::close_client(int fd)
+{
+  auto found = connections.find(fd);
+  if (found == connections.end())
+    return;
+
+  if (found->second.connected)
+  {
+    connection_count--;
+    ESP_LOGD(TAG, "Client %s disconnected.", found->second.client_id.c_str());
+  }
+
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+  connection_fds.erase(found->second.id);
+  connections.erase(found);
+}
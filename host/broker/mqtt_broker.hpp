@@ -0,0 +1,142 @@
+#ifndef MQTT_BROKER_H_
+#define MQTT_BROKER_H_
+
+// Includes
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Local stand-in for the IoT Hub MQTT endpoint, enough of MQTT 3.1.1 for the device-side
+// stack: CONNECT, SUBSCRIBE, PUBLISH at QoS 0 and 1, PINGREQ and DISCONNECT. Twin GET and
+// reported PATCH requests are answered as IoT Hub does, every other publish is acknowledged
+// and forwarded to matching subscribers at QoS 0. Tests publish as the service side would,
+// e.g. direct methods. One epoll thread serves every connection.
+
+typedef struct
+{
+  uint32_t connections;   // Currently connected clients
+  uint64_t publishes;     // PUBLISH packets received
+  uint64_t payload_bytes; // Payload bytes of those packets
+  uint64_t acks;          // PUBACKs sent
+  uint64_t forwarded;     // Publishes forwarded to subscribers
+  uint64_t twin_requests; // Twin GET and PATCH requests answered
+} broker_stats;
+
+// Sees every publish the broker forwards, on the broker thread
+typedef std::function<void(const std::string &topic, const uint8_t *payload, uint32_t length)> publish_observer;
+
+class MqttBroker
+{
+private:
+  // Class variables
+  static constexpr uint32_t MAX_PACKET_SIZE = 16 * 1024 * 1024;
+  static constexpr int MAX_EVENTS = 256;
+
+  typedef struct
+  {
+    uint64_t id; // Never reused, unlike the descriptor
+    int fd;
+    bool connected;
+    std::string client_id;
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> output;
+    size_t output_offset;
+    bool output_blocked; // Watching for writability
+    std::vector<std::string> subscriptions;
+  } connection;
+
+  typedef struct
+  {
+    uint64_t due_us;
+    uint64_t connection_id;
+    uint16_t packet_id;
+  } delayed_ack;
+
+  struct later_ack
+  {
+    bool operator()(const delayed_ack &a, const delayed_ack &b) const { return a.due_us > b.due_us; }
+  };
+
+  typedef struct
+  {
+    std::string topic;
+    std::vector<uint8_t> payload;
+  } injected_publish;
+
+  int listen_fd;
+  int epoll_fd;
+  int wakeup_fd;
+  uint16_t port;
+  uint32_t ack_delay_us;
+  uint32_t twin_version;
+  uint64_t next_connection_id;
+
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<bool> dropping; // drop_clients() was called
+  publish_observer observer;
+
+  std::unordered_map<int, connection> connections;
+  std::unordered_map<uint64_t, int> connection_fds;
+  std::priority_queue<delayed_ack, std::vector<delayed_ack>, later_ack> pending_acks;
+
+  std::mutex injected_mutex;
+  std::vector<injected_publish> injected; // From publish(), guarded by injected_mutex
+
+  std::atomic<uint32_t> connection_count;
+  std::atomic<uint64_t> publish_count;
+  std::atomic<uint64_t> payload_bytes;
+  std::atomic<uint64_t> ack_count;
+  std::atomic<uint64_t> forward_count;
+  std::atomic<uint64_t> twin_count;
+
+  static uint64_t now_us();
+
+  void run();
+  void accept_clients();
+  void read_client(connection &client);
+  bool process_packet(connection &client, uint8_t type, const uint8_t *body, uint32_t length);
+  void handle_connect(connection &client, const uint8_t *body, uint32_t length);
+  void handle_subscribe(connection &client, const uint8_t *body, uint32_t length);
+  void handle_publish(connection &client, uint8_t flags, const uint8_t *body, uint32_t length);
+  void answer_twin(connection &client, const std::string &topic);
+  void forward(const std::string &topic, const uint8_t *payload, uint32_t length);
+  void send_puback(connection &client, uint16_t packet_id);
+  void send_publish(connection &client, const std::string &topic, const uint8_t *payload, uint32_t length);
+  void send_packet(connection &client, uint8_t type, const uint8_t *body, uint32_t length);
+  void flush(connection &client);
+  void flush_acks();
+  void forward_injected();
+  void close_client(int fd);
+
+public:
+  MqttBroker();
+  ~MqttBroker();
+
+  // Listens on the loopback interface, port 0 picks a free one. Acknowledgements can be
+  // held back to stand in for the round trip to a hub.
+  bool start(uint16_t port, uint32_t ack_delay_ms = 0, bool any_address = false);
+  void stop();
+
+  // Set before start(), stands in for a subscriber in tests
+  void set_observer(publish_observer observer);
+
+  // Forwards to matching subscribers from the broker thread, callable from any thread
+  void publish(const std::string &topic, const uint8_t *payload, uint32_t length);
+
+  // Closes every client connection as a lost network would, callable from any thread
+  void drop_clients();
+
+  uint16_t get_port();
+  broker_stats get_stats();
+
+  static bool topic_matches(const std::string &filter, const std::string &topic);
+};
+
+#endif // MQTT_BROKER_H_
@@ -0,0 +1,265 @@
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "station.hpp"
+#include "mqtt_broker.hpp"
+#include "esp_log.h"
+
+extern "C"
+{
+#include "azure_iot.h"
+}
+
+static constexpr char *TAG = "Fleet";
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --stations N         Virtual stations to run (default 100)\n"
+          "  --host H             Broker host (default 127.0.0.1)\n"
+          "  --port N             Broker port (default 1883)\n"
+          "  --embedded-broker    Run the broker stand-in in this process on a free port\n"
+          "  --ack-delay-ms N     PUBACK delay of the embedded broker (default 0)\n"
+          "  --encoding E         Frame encoding, json or compressed (default json)\n"
+          "  --rate N             Samples per second per station (default 1000)\n"
+          "  --samples N          Samples per frame (default 500)\n"
+          "  --no-summaries       Do not send a summary after each frame\n"
+          "  --duration S         Seconds to publish for (default 10)\n"
+          "  --csv FILE           Write per-station results to FILE\n"
+          "  --verbose            Log the middleware and transport\n",
+          name);
+}
+
+// Resident set size of the process, from /proc
+static uint64_t get_rss_bytes()
+{
+  unsigned long size = 0;
+  unsigned long resident = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+
+  if (statm == NULL)
+    return 0;
+  if (fscanf(statm, "%lu %lu", &size, &resident) != 2)
+    resident = 0;
+  fclose(statm);
+
+  return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double fraction)
+{
+  if (sorted.empty())
+    return 0;
+
+  size_t rank = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+  return sorted[rank];
+}
+
+int main(int argc, char **argv)
+{
+  station_config config = {
+      .host = "127.0.0.1",
+      .port = 1883,
+      .encoding = ENCODING_JSON,
+      .sample_rate = 1000,
+      .frame_samples = 500,
+      .summaries = true,
+      .duration_ms = 10000,
+  };
+  uint32_t station_count = 100;
+  long frame_samples = config.frame_samples;
+  bool embedded_broker = false;
+  uint32_t ack_delay_ms = 0;
+  const char *csv_path = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--stations") == 0 && has_value)
+      station_count = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--host") == 0 && has_value)
+      config.host = argv[++i];
+    else if (strcmp(argv[i], "--port") == 0 && has_value)
+      config.port = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--embedded-broker") == 0)
+      embedded_broker = true;
+    else if (strcmp(argv[i], "--ack-delay-ms") == 0 && has_value)
+      ack_delay_ms = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--encoding") == 0 && has_value && strcmp(argv[i + 1], "json") == 0)
+      config.encoding = ENCODING_JSON, i++;
+    else if (strcmp(argv[i], "--encoding") == 0 && has_value && strcmp(argv[i + 1], "compressed") == 0)
+      config.encoding = ENCODING_COMPRESSED, i++;
+    else if (strcmp(argv[i], "--rate") == 0 && has_value)
+      config.sample_rate = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--samples") == 0 && has_value)
+      frame_samples = atol(argv[++i]);
+    else if (strcmp(argv[i], "--no-summaries") == 0)
+      config.summaries = false;
+    else if (strcmp(argv[i], "--duration") == 0 && has_value)
+      config.duration_ms = (uint32_t)(atof(argv[++i]) * 1000);
+    else if (strcmp(argv[i], "--csv") == 0 && has_value)
+      csv_path = argv[++i];
+    else if (strcmp(argv[i], "--verbose") == 0)
+      esp_log_level_set("*", ESP_LOG_INFO);
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (station_count == 0 || config.sample_rate == 0 || config.sample_rate > 1000000 ||
+      frame_samples <= 0 || frame_samples > UINT16_MAX)
+  {
+    print_usage(argv[0]);
+    return 2;
+  }
+  config.frame_samples = frame_samples;
+
+  if (AzureIoT_Init() != eAzureIoTSuccess)
+    return 1;
+
+  MqttBroker broker;
+  if (embedded_broker)
+  {
+    if (!broker.start(0, ack_delay_ms))
+      return 1;
+    config.host = "127.0.0.1";
+    config.port = broker.get_port();
+  }
+
+  uint64_t base_rss = get_rss_bytes();
+
+  std::vector<std::unique_ptr<Station>> stations;
+  for (uint32_t i = 0; i < station_count; i++)
+    stations.emplace_back(new Station(i, config));
+
+  ESP_LOGI(TAG, "Starting %lu stations against %s:%u.", (unsigned long)station_count, config.host.c_str(), config.port);
+
+  for (auto &station : stations)
+    station->start();
+
+  // Sample the resident set while every station is publishing
+  usleep(std::min<uint64_t>(config.duration_ms / 2, 5000) * 1000);
+  uint64_t running_rss = get_rss_bytes();
+
+  for (auto &station : stations)
+    station->join();
+
+  broker_stats broker_totals = broker.get_stats();
+  broker.stop();
+
+  // Fleet totals
+  uint32_t connected = 0;
+  uint32_t failed = 0;
+  uint64_t frames = 0;
+  uint64_t frame_bytes = 0;
+  uint64_t summaries = 0;
+  uint64_t summary_bytes = 0;
+  uint64_t dropped = 0;
+  uint64_t late = 0;
+  uint64_t acks = 0;
+  uint64_t encode_ns = 0;
+  uint64_t run_ns = 0;
+  uint64_t footprint = 0;
+  double cpu_sum = 0;
+  double cpu_max = 0;
+  std::vector<uint32_t> latencies;
+  std::vector<uint32_t> connect_times;
+  std::vector<uint32_t> twin_times;
+
+  FILE *csv = csv_path != NULL ? fopen(csv_path, "w") : NULL;
+  if (csv != NULL)
+    fprintf(csv, "station,connected,failed,connect_us,twin_us,frames,frame_bytes,summaries,dropped,late,acks,"
+                 "latency_p50_us,latency_p99_us,cpu_percent,encode_us_per_frame,footprint_bytes\n");
+
+  for (uint32_t i = 0; i < station_count; i++)
+  {
+    const station_stats &stats = stations[i]->get_stats();
+    double cpu_percent = stats.run_ns > 0 ? 100.0 * stats.cpu_ns / stats.run_ns : 0;
+    std::vector<uint32_t> station_latencies = stats.latency_us;
+
+    std::sort(station_latencies.begin(), station_latencies.end());
+
+    if (stats.connected)
+    {
+      connected++;
+      connect_times.push_back(stats.connect_us);
+      if (stats.twin_us > 0)
+        twin_times.push_back(stats.twin_us);
+      cpu_sum += cpu_percent;
+      cpu_max = std::max(cpu_max, cpu_percent);
+      run_ns = std::max(run_ns, stats.run_ns);
+    }
+    failed += stats.failed;
+    frames += stats.frames;
+    frame_bytes += stats.frame_bytes;
+    summaries += stats.summaries;
+    summary_bytes += stats.summary_bytes;
+    dropped += stats.dropped;
+    late += stats.late;
+    acks += stats.acks;
+    encode_ns += stats.encode_ns;
+    footprint += stations[i]->get_footprint();
+    latencies.insert(latencies.end(), stats.latency_us.begin(), stats.latency_us.end());
+
+    if (csv != NULL)
+      fprintf(csv, "%lu,%d,%d,%lu,%lu,%llu,%llu,%llu,%llu,%llu,%llu,%lu,%lu,%.3f,%.1f,%lu\n",
+              (unsigned long)i, stats.connected, stats.failed,
+              (unsigned long)stats.connect_us, (unsigned long)stats.twin_us,
+              (unsigned long long)stats.frames, (unsigned long long)stats.frame_bytes,
+              (unsigned long long)stats.summaries, (unsigned long long)stats.dropped,
+              (unsigned long long)stats.late, (unsigned long long)stats.acks,
+              (unsigned long)percentile(station_latencies, 0.5), (unsigned long)percentile(station_latencies, 0.99),
+              cpu_percent, stats.frames > 0 ? stats.encode_ns / 1000.0 / stats.frames : 0.0,
+              (unsigned long)stations[i]->get_footprint());
+  }
+  if (csv != NULL)
+    fclose(csv);
+
+  std::sort(latencies.begin(), latencies.end());
+  std::sort(connect_times.begin(), connect_times.end());
+  std::sort(twin_times.begin(), twin_times.end());
+
+  double seconds = run_ns / 1e9;
+  uint64_t publishes = frames + summaries;
+
+  printf("Fleet: %lu stations, %s frames of %u samples at %lu Hz, summaries %s, %.1f s\n",
+         (unsigned long)station_count, config.encoding == ENCODING_COMPRESSED ? "compressed" : "JSON",
+         config.frame_samples, (unsigned long)config.sample_rate, config.summaries ? "on" : "off", config.duration_ms / 1000.0);
+  printf("Connected:   %lu of %lu, %lu failed, connect p50 %.1f ms p99 %.1f ms, twin GET p50 %.1f ms\n",
+         (unsigned long)connected, (unsigned long)station_count, (unsigned long)failed,
+         percentile(connect_times, 0.5) / 1000.0, percentile(connect_times, 0.99) / 1000.0,
+         percentile(twin_times, 0.5) / 1000.0);
+  printf("Published:   %llu frames (%.1f kB each), %llu summaries, %llu dropped, %llu late\n",
+         (unsigned long long)frames, frames > 0 ? frame_bytes / 1000.0 / frames : 0.0,
+         (unsigned long long)summaries, (unsigned long long)dropped, (unsigned long long)late);
+  printf("Throughput:  %.1f publishes/s, %.2f MB/s payload, %.2f frames/s per station\n",
+         seconds > 0 ? publishes / seconds : 0, seconds > 0 ? (frame_bytes + summary_bytes) / 1e6 / seconds : 0,
+         seconds > 0 && connected > 0 ? frames / seconds / connected : 0);
+  printf("PUBACK:      %llu of %llu, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+         (unsigned long long)acks, (unsigned long long)publishes,
+         percentile(latencies, 0.5) / 1000.0, percentile(latencies, 0.9) / 1000.0,
+         percentile(latencies, 0.99) / 1000.0, latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+  printf("CPU/device:  mean %.3f%% max %.3f%% of a core, encode %.1f us per frame\n",
+         connected > 0 ? cpu_sum / connected : 0, cpu_max, frames > 0 ? encode_ns / 1000.0 / frames : 0.0);
+  printf("Memory/device: %.1f kB held, %.1f kB resident\n",
+         footprint / 1000.0 / station_count,
+         running_rss > base_rss ? (running_rss - base_rss) / 1000.0 / station_count : 0.0);
+  if (embedded_broker)
+    printf("Broker:      %llu publishes, %.2f MB payload, %llu acks, %llu twin requests\n",
+           (unsigned long long)broker_totals.publishes, broker_totals.payload_bytes / 1e6,
+           (unsigned long long)broker_totals.acks, (unsigned long long)broker_totals.twin_requests);
+
+  AzureIoT_Deinit();
+
+  return connected == station_count && failed == 0 ? 0 : 1;
+}
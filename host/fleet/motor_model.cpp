@@ -0,0 +1,83 @@
+// Includes
+#include "motor_model.hpp"
+
+#include <cmath>
+
+MotorModel::MotorModel(uint32_t seed)
+{
+  offset_rpm = OFFSET_RPM;
+
+  velocity_sp = 0;
+  velocity = 0;
+  position = 0;
+  integral = 0;
+  duty_cycle = 0;
+  current = 0;
+
+  noise_state = seed * 2654435761u + 1;
+}
+
+// Uniform in [-1, 1], a per-station LCG so runs repeat
+float MotorModel::noise()
+{
+  noise_state = noise_state * 1664525u + 1013904223u;
+  return (float)(noise_state >> 8) / (1 << 23) - 1;
+}
+
+void MotorModel::set_velocity_sp(float velocity_sp)
+{
+  this->velocity_sp = velocity_sp;
+}
+
+void MotorModel::set_dead_zone(float dead_zone_rpm)
+{
+  offset_rpm = -dead_zone_rpm;
+}
+
+void MotorModel::step(float period)
+{
+  float error = velocity_sp - velocity;
+
+  integral = fminf(fmaxf(integral + KI * error * period, -1), 1);
+  duty_cycle = fminf(fmaxf(KP * error + integral, -1), 1);
+
+  float direction = duty_cycle < 0 ? -1 : 1;
+  float target = direction * fmaxf(GAIN_RPM * fabsf(duty_cycle) + offset_rpm, 0);
+
+  velocity += period * (target - velocity) / TAU;
+  position = fmodf(position + velocity * 6 * period + 360, 360); // RPM to degrees per second
+
+  // Armature current from the voltage left after the back EMF, in mA
+  float back_emf = SUPPLY_V * velocity / GAIN_RPM;
+  current = 1000 * (SUPPLY_V * duty_cycle - back_emf) / RESISTANCE + NOISE_MA * noise();
+}
+
+float MotorModel::get_gain()
+{
+  return KP;
+}
+
+float MotorModel::get_velocity_sp()
+{
+  return velocity_sp;
+}
+
+float MotorModel::get_duty_cycle()
+{
+  return duty_cycle;
+}
+
+float MotorModel::get_velocity()
+{
+  return velocity;
+}
+
+float MotorModel::get_position()
+{
+  return position;
+}
+
+float MotorModel::get_current()
+{
+  return current;
+}
@@ -0,0 +1,52 @@
+#ifndef MOTOR_MODEL_H_
+#define MOTOR_MODEL_H_
+
+// Includes
+#include <stdint.h>
+
+// First-order DC motor from duty cycle to RPM with a dead zone, the same plant as
+// python_scripts/relay_tuner.py, under a PI velocity loop. Produces the columns a
+// station's update task samples: duty cycle, velocity, position and current.
+class MotorModel
+{
+private:
+  // Class variables
+  static constexpr float GAIN_RPM = 200;    // RPM per unit duty cycle
+  static constexpr float TAU = 0.12;        // Time constant in seconds
+  static constexpr float OFFSET_RPM = -40;  // Default dead zone, the motor stalls below it
+  static constexpr float SUPPLY_V = 12;
+  static constexpr float RESISTANCE = 8;    // Winding resistance in ohms
+  static constexpr float NOISE_MA = 5;      // Current sensor noise, peak
+
+  static constexpr float KP = 0.002;
+  static constexpr float KI = 0.02;
+
+  float offset_rpm; // Dead zone, grows with friction as the gearbox wears
+
+  float velocity_sp;
+  float velocity;
+  float position;
+  float integral;
+  float duty_cycle;
+  float current;
+
+  uint32_t noise_state;
+
+  float noise();
+
+public:
+  MotorModel(uint32_t seed);
+
+  void set_velocity_sp(float velocity_sp);
+  void set_dead_zone(float dead_zone_rpm);
+  void step(float period);
+
+  float get_gain();
+  float get_velocity_sp();
+  float get_duty_cycle();
+  float get_velocity();
+  float get_position();
+  float get_current();
+};
+
+#endif // MOTOR_MODEL_H_
@@ -0,0 +1,595 @@
+// Includes
+#include "station.hpp"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+extern "C"
+{
+#include "azure_iot_json_reader.h"
+}
+
+static constexpr char *TAG = "Station";
+
+// Message properties of the sample application, see sample_azure_iot.c
+static constexpr char JSON_CONTENT_TYPE[] = "text%2Fplain";
+static constexpr char JSON_CONTENT_ENCODING[] = "us-ascii";
+static constexpr char COMPRESSED_CONTENT_TYPE[] = "application%2Foctet-stream";
+static constexpr char COMPRESSED_CONTENT_ENCODING[] = "heatshrink";
+static constexpr char SUMMARY_CONTENT_TYPE[] = "application%2Fjson";
+static constexpr char SUMMARY_CONTENT_ENCODING[] = "utf-8";
+static constexpr char SUMMARY_TYPE[] = "summary";
+
+static constexpr int32_t MODE_AUTO_VELOCITY = 3;        // MotorController's AUTO_VELOCITY
+static constexpr float VELOCITY_SP_LOW = 60;            // RPM
+static constexpr float VELOCITY_SP_HIGH = 120;          // RPM
+static constexpr uint64_t VELOCITY_SP_PERIOD_US = 4000000;
+
+// Direct method of the sample application that updates the set points, e.g. {"velocity": 30}
+static constexpr char COMMAND_SET_SETPOINT[] = "set_setpoint";
+static constexpr char COMMAND_VELOCITY[] = "velocity";
+static constexpr uint32_t COMMAND_STATUS_OK = 200;
+static constexpr uint32_t COMMAND_STATUS_BAD_REQUEST = 400;
+static constexpr uint32_t COMMAND_STATUS_NOT_FOUND = 404;
+
+// Worst-case text of one sample, a timestamp and five values with their separators
+static constexpr uint32_t JSON_SAMPLE_SIZE = 21 + 5 * (MAX_FIELD_SIZE + 1);
+static constexpr uint32_t JSON_OVERHEAD = 128;
+
+thread_local Station *Station::current_station = nullptr;
+
+Station::Station(uint32_t index, const station_config &config)
+    : config(config), motor(index)
+{
+  this->index = index;
+  device_id = "dtmc-" + std::to_string(index);
+  sample_time_us = 0;
+  start_unix_ms = 0;
+
+  memset(&client, 0, sizeof(client));
+  network_context.pParams = &tls_params;
+  memset(&tls_params, 0, sizeof(tls_params));
+  memset(&credentials, 0, sizeof(credentials));
+  memset(&transport, 0, sizeof(transport));
+  network_buffer.resize(NETWORK_BUFFER_SIZE);
+  NetworkRequests_Init(&requests, eventfd(0, EFD_NONBLOCK));
+
+  timestamp.resize(config.frame_samples);
+  gain.resize(config.frame_samples);
+  duty_cycle.resize(config.frame_samples);
+  velocity.resize(config.frame_samples);
+  position.resize(config.frame_samples);
+  current.resize(config.frame_samples);
+
+  if (config.encoding == ENCODING_COMPRESSED)
+  {
+    compressor_buffer.resize(StreamCompressor::BUFFER_SIZE);
+    compressor.init(compressor_buffer.data());
+    frame.resize(FRAME_HEADER_SIZE + StreamCompressor::bound(frame_columns_size(config.frame_samples)));
+  }
+  else
+    frame.resize(JSON_OVERHEAD + config.frame_samples * JSON_SAMPLE_SIZE);
+
+  frame_length = 0;
+  frame_offset = 0;
+  summary_string.resize(SUMMARY_STRING_SIZE);
+
+  pending_count = 0;
+  twin_request_us = 0;
+
+  commanded = false;
+
+  stats = {};
+}
+
+Station::~Station()
+{
+  join();
+  close(requests.lWakeupFd);
+}
+
+uint64_t Station::now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+uint64_t Station::thread_cpu_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint64_t Station::get_unix_time()
+{
+  return (uint64_t)time(NULL);
+}
+
+// The middleware reports PUBACKs by packet id only, the station is the one running this thread
+void Station::handle_puback(uint16_t packet_id)
+{
+  Station *station = current_station;
+  uint64_t now = now_us();
+
+  for (uint8_t i = 0; i < station->pending_count; i++)
+  {
+    if (station->pending[i].packet_id != packet_id)
+      continue;
+
+    station->stats.latency_us.push_back(now - station->pending[i].sent_us);
+    station->stats.acks++;
+    station->pending[i] = station->pending[--station->pending_count];
+    return;
+  }
+}
+
+// The sample only logs cloud to device messages
+void Station::handle_cloud_message(AzureIoTHubClientCloudToDeviceMessageRequest_t *message, void *context)
+{
+  (void)message;
+  (void)context;
+}
+
+// Reads a top-level number of a command payload, as the sample's prvGetCommandDouble does
+static bool read_command_double(const AzureIoTHubClientCommandRequest_t *message, const char *name, double *value)
+{
+  AzureIoTJSONReader_t reader;
+  AzureIoTJSONTokenType_t token_type;
+
+  if (message->ulPayloadLength == 0 ||
+      AzureIoTJSONReader_Init(&reader, (const uint8_t *)message->pvMessagePayload, message->ulPayloadLength) != eAzureIoTSuccess ||
+      AzureIoTJSONReader_NextToken(&reader) != eAzureIoTSuccess ||
+      AzureIoTJSONReader_TokenType(&reader, &token_type) != eAzureIoTSuccess ||
+      token_type != eAzureIoTJSONTokenBEGIN_OBJECT)
+    return false;
+
+  while (AzureIoTJSONReader_NextToken(&reader) == eAzureIoTSuccess &&
+         AzureIoTJSONReader_TokenType(&reader, &token_type) == eAzureIoTSuccess &&
+         token_type == eAzureIoTJSONTokenPROPERTY_NAME)
+  {
+    bool match = AzureIoTJSONReader_TokenIsTextEqual(&reader, (const uint8_t *)name, strlen(name));
+
+    if (AzureIoTJSONReader_NextToken(&reader) != eAzureIoTSuccess)
+      return false;
+    if (match)
+      return AzureIoTJSONReader_GetTokenDouble(&reader, value) == eAzureIoTSuccess;
+    if (AzureIoTJSONReader_SkipChildren(&reader) != eAzureIoTSuccess)
+      return false;
+  }
+
+  return false;
+}
+
+// Actuates before answering, as the sample's prvHandleCommand does
+void Station::handle_command(AzureIoTHubClientCommandRequest_t *message, void *context)
+{
+  Station *station = static_cast<Station *>(context);
+  uint32_t status = COMMAND_STATUS_NOT_FOUND;
+  double velocity;
+
+  if (message->usCommandNameLength == sizeof(COMMAND_SET_SETPOINT) - 1 &&
+      memcmp(message->pucCommandName, COMMAND_SET_SETPOINT, sizeof(COMMAND_SET_SETPOINT) - 1) == 0)
+  {
+    status = COMMAND_STATUS_BAD_REQUEST;
+    if (read_command_double(message, COMMAND_VELOCITY, &velocity))
+    {
+      station->commanded = true;
+      station->motor.set_velocity_sp(velocity);
+      station->stats.actuated_us.push_back(now_us());
+      status = COMMAND_STATUS_OK;
+    }
+  }
+
+  if (AzureIoTHubClient_SendCommandResponse(&station->client, message, status, NULL, 0) != eAzureIoTSuccess)
+    ESP_LOGW(TAG, "%s failed to answer a command.", station->device_id.c_str());
+  else
+    station->stats.commands++;
+}
+
+void Station::handle_properties(AzureIoTHubClientPropertiesResponse_t *message, void *context)
+{
+  Station *station = static_cast<Station *>(context);
+
+  if (message->xMessageType == eAzureIoTHubPropertiesRequestedMessage && station->stats.twin_us == 0)
+    station->stats.twin_us = now_us() - station->twin_request_us;
+}
+
+size_t Station::produce_frame(void *context, uint8_t *buffer, size_t size)
+{
+  Station *station = static_cast<Station *>(context);
+  size_t length = station->frame_length - station->frame_offset;
+
+  if (length > size)
+    length = size;
+
+  memcpy(buffer, &station->frame[station->frame_offset], length);
+  station->frame_offset += length;
+  return length;
+}
+
+bool Station::connect()
+{
+  AzureIoTHubClientOptions_t options;
+  AzureIoTResult_t result;
+  bool session_present;
+
+  if (TLS_Socket_Connect(&network_context, config.host.c_str(), config.port, &credentials,
+                         RECV_TIMEOUT_MS, SEND_RECV_TIMEOUT_MS) != eTLSTransportSuccess)
+    return false;
+
+  transport.pxNetworkContext = &network_context;
+  transport.xSend = TLS_Socket_Send;
+  transport.xRecv = TLS_Socket_Recv;
+
+  result = AzureIoTHubClient_OptionsInit(&options);
+  options.xTelemetryCallback = handle_puback;
+
+  if (result == eAzureIoTSuccess)
+    result = AzureIoTHubClient_Init(&client,
+                                    (const uint8_t *)config.host.c_str(), config.host.size(),
+                                    (const uint8_t *)device_id.c_str(), device_id.size(),
+                                    &options,
+                                    network_buffer.data(), network_buffer.size(),
+                                    get_unix_time,
+                                    &transport);
+  if (result == eAzureIoTSuccess)
+    result = AzureIoTHubClient_Connect(&client, true, &session_present, CONNACK_TIMEOUT_MS);
+  // Pipelined as the sample does, the properties subscribe waits for all three SUBACKs
+  if (result == eAzureIoTSuccess)
+    result = AzureIoTHubClient_SubscribeCloudToDeviceMessage(&client, handle_cloud_message, this, 0);
+  if (result == eAzureIoTSuccess)
+    result = AzureIoTHubClient_SubscribeCommand(&client, handle_command, this, 0);
+  if (result == eAzureIoTSuccess)
+    result = AzureIoTHubClient_SubscribeProperties(&client, handle_properties, this, SUBSCRIBE_TIMEOUT_MS);
+  if (result == eAzureIoTSuccess)
+  {
+    twin_request_us = now_us();
+    result = AzureIoTHubClient_RequestPropertiesAsync(&client);
+  }
+  if (result == eAzureIoTSuccess)
+    result = init_properties() ? eAzureIoTSuccess : eAzureIoTErrorOutOfMemory;
+
+  if (result != eAzureIoTSuccess)
+  {
+    ESP_LOGE(TAG, "%s failed to connect, result 0x%08x.", device_id.c_str(), result);
+    TLS_Socket_Disconnect(&network_context);
+    return false;
+  }
+
+  return true;
+}
+
+// Connects again once the connection broke, as the sample's outer loop does but without its delay
+// before the first attempt. Publishes still unacknowledged are lost with the connection.
+bool Station::reconnect(uint64_t end_time)
+{
+  uint64_t start_time = now_us();
+
+  if (!config.reconnect)
+    return false;
+
+  TLS_Socket_Disconnect(&network_context);
+  AzureIoTHubClient_Deinit(&client);
+  pending_count = 0;
+
+  while (!connect())
+  {
+    if (now_us() >= end_time)
+      return false;
+    usleep(RECONNECT_DELAY_MS * 1000);
+  }
+
+  stats.reconnects++;
+  stats.reconnect_us.push_back(now_us() - start_time);
+  return true;
+}
+
+bool Station::init_properties()
+{
+  bool compressed = config.encoding == ENCODING_COMPRESSED;
+  const char *content_type = compressed ? COMPRESSED_CONTENT_TYPE : JSON_CONTENT_TYPE;
+  const char *content_encoding = compressed ? COMPRESSED_CONTENT_ENCODING : JSON_CONTENT_ENCODING;
+
+  return AzureIoTMessage_PropertiesInit(&frame_properties, frame_property_buffer, 0, sizeof(frame_property_buffer)) == eAzureIoTSuccess &&
+         AzureIoTMessage_PropertiesAppend(&frame_properties,
+                                          (const uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE) - 1,
+                                          (const uint8_t *)content_type, strlen(content_type)) == eAzureIoTSuccess &&
+         AzureIoTMessage_PropertiesAppend(&frame_properties,
+                                          (const uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING) - 1,
+                                          (const uint8_t *)content_encoding, strlen(content_encoding)) == eAzureIoTSuccess &&
+         AzureIoTMessage_PropertiesAppend(&frame_properties, (const uint8_t *)"motor", 5, (const uint8_t *)"0", 1) == eAzureIoTSuccess &&
+         AzureIoTMessage_PropertiesInit(&summary_properties, summary_property_buffer, 0, sizeof(summary_property_buffer)) == eAzureIoTSuccess &&
+         AzureIoTMessage_PropertiesAppend(&summary_properties,
+                                          (const uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE) - 1,
+                                          (const uint8_t *)SUMMARY_CONTENT_TYPE, sizeof(SUMMARY_CONTENT_TYPE) - 1) == eAzureIoTSuccess &&
+         AzureIoTMessage_PropertiesAppend(&summary_properties,
+                                          (const uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING) - 1,
+                                          (const uint8_t *)SUMMARY_CONTENT_ENCODING, sizeof(SUMMARY_CONTENT_ENCODING) - 1) == eAzureIoTSuccess &&
+         AzureIoTMessage_PropertiesAppend(&summary_properties, (const uint8_t *)"type", 4,
+                                          (const uint8_t *)SUMMARY_TYPE, sizeof(SUMMARY_TYPE) - 1) == eAzureIoTSuccess &&
+         AzureIoTMessage_PropertiesAppend(&summary_properties, (const uint8_t *)"motor", 5, (const uint8_t *)"0", 1) == eAzureIoTSuccess;
+}
+
+// Runs the motor through one frame of samples, reducing the summary as the update task does
+void Station::simulate_frame()
+{
+  float period = 1.0f / config.sample_rate;
+  uint64_t period_us = 1000000 / config.sample_rate;
+
+  summary.duty_cycle.reset();
+  summary.velocity.reset();
+  summary.position.reset();
+  summary.current.reset();
+
+  for (uint16_t i = 0; i < config.frame_samples; i++)
+  {
+    // Square wave set point, offset per station so the fleet does not step together
+    if (!commanded)
+    {
+      uint64_t phase = (sample_time_us + index * 997 * 1000) % VELOCITY_SP_PERIOD_US;
+      motor.set_velocity_sp(phase < VELOCITY_SP_PERIOD_US / 2 ? VELOCITY_SP_LOW : VELOCITY_SP_HIGH);
+    }
+    motor.step(period);
+    sample_time_us += period_us;
+
+    timestamp[i] = start_unix_ms + sample_time_us / 1000;
+    gain[i] = motor.get_gain();
+    duty_cycle[i] = motor.get_duty_cycle();
+    velocity[i] = motor.get_velocity();
+    position[i] = motor.get_position();
+    current[i] = motor.get_current();
+
+    summary.duty_cycle.add(duty_cycle[i]);
+    summary.velocity.add(velocity[i]);
+    summary.position.add(position[i]);
+    summary.current.add(current[i]);
+  }
+
+  summary.start_time = timestamp[0];
+  summary.end_time = timestamp[config.frame_samples - 1];
+  summary.mode = MODE_AUTO_VELOCITY;
+  summary.gain = motor.get_gain();
+  summary.freq = 0;
+  summary.position_sp = 0;
+  summary.velocity_sp = motor.get_velocity_sp();
+}
+
+bool Station::encode_frame()
+{
+  uint64_t start_time = thread_cpu_ns();
+  frame_columns columns = {
+      .timestamp = timestamp.data(),
+      .gain = gain.data(),
+      .duty_cycle = duty_cycle.data(),
+      .velocity = velocity.data(),
+      .position = position.data(),
+      .current = current.data(),
+  };
+
+  if (config.encoding == ENCODING_COMPRESSED)
+    frame_length = compress_frame(compressor, frame.data(), frame.size(), columns, config.frame_samples);
+  else
+    frame_length = format_frame(frame.data(), frame.size(), columns, config.frame_samples);
+
+  stats.encode_ns += thread_cpu_ns() - start_time;
+
+  if (frame_length == 0)
+    ESP_LOGW(TAG, "Frame exceeds %lu bytes, dropping frame.", (unsigned long)frame.size());
+  return frame_length > 0;
+}
+
+// Publishes the frame or its summary at QoS 1, returns false if the connection broke
+bool Station::publish(bool is_frame)
+{
+  AzureIoTResult_t result;
+  uint16_t packet_id = 0;
+  uint64_t start_time = now_us();
+  uint32_t summary_length = 0;
+
+  if (!is_frame)
+  {
+    summary_length = format_summary(summary_string.data(), summary_string.size(), summary);
+    if (summary_length == 0)
+      return true;
+  }
+
+  // Unacknowledged publishes hold MQTT state records, a slow broker costs frames rather than the connection
+  if (pending_count >= MAX_PENDING)
+  {
+    stats.dropped++;
+    return true;
+  }
+
+  if (is_frame)
+  {
+    frame_offset = 0;
+    result = AzureIoTHubClient_SendTelemetryStream(&client, frame_length, produce_frame, this,
+                                                   &frame_properties, eAzureIoTHubMessageQoS1, &packet_id);
+  }
+  else
+    result = AzureIoTHubClient_SendTelemetry(&client, (const uint8_t *)summary_string.data(), summary_length,
+                                             &summary_properties, eAzureIoTHubMessageQoS1, &packet_id);
+
+  if (result != eAzureIoTSuccess)
+  {
+    ESP_LOGE(TAG, "%s failed to publish, result 0x%08x.", device_id.c_str(), result);
+    return false;
+  }
+
+  pending[pending_count++] = {packet_id, start_time};
+
+  if (is_frame)
+  {
+    stats.frames++;
+    stats.frame_bytes += frame_length;
+  }
+  else
+  {
+    stats.summaries++;
+    stats.summary_bytes += summary_length;
+  }
+
+  return true;
+}
+
+// Sends every queued request, as the sample's prvProcessNetworkRequests does. Returns false if the
+// connection broke.
+bool Station::process_requests()
+{
+  NetworkRequest_t request;
+
+  while (NetworkRequests_Receive(&requests, &request))
+  {
+    bool sent;
+
+    switch (request.xType)
+    {
+    case AZURE_REQUEST_TELEMETRY:
+      simulate_frame();
+      sent = !encode_frame() || publish(true);
+      break;
+
+    case AZURE_REQUEST_SUMMARY:
+      sent = publish(false);
+      break;
+
+    default:
+      ESP_LOGW(TAG, "%s does not send request %d.", device_id.c_str(), request.xType);
+      continue;
+    }
+
+    if (!sent)
+      return false;
+
+    stats.requests++;
+    stats.request_us.push_back(esp_timer_get_time() - request.llRequestTime);
+  }
+
+  return true;
+}
+
+// The network loop of sample_azure_iot.c, with frames due on a timer unless they are queued
+void Station::run()
+{
+  current_station = this;
+
+  uint64_t connect_time = now_us();
+  if (!connect())
+    return;
+  stats.connect_us = now_us() - connect_time;
+  stats.connected = true;
+
+  // Sample timestamps follow the simulated clock from here, as the update task's do
+  struct timespec unix_time;
+  clock_gettime(CLOCK_REALTIME, &unix_time);
+  start_unix_ms = (uint64_t)unix_time.tv_sec * 1000 + unix_time.tv_nsec / 1000000;
+
+  uint64_t frame_period_us = (uint64_t)config.frame_samples * 1000000 / config.sample_rate;
+  uint64_t start_time = now_us();
+  uint64_t end_time = start_time + (uint64_t)config.duration_ms * 1000;
+  uint64_t start_cpu = thread_cpu_ns();
+
+  // Stations start their frames spread over one period, as a lab powered up by hand would
+  uint64_t next_frame = start_time + frame_period_us * (index % 16) / 16;
+
+  while (true)
+  {
+    uint64_t now = now_us();
+    if (now >= end_time)
+      break;
+
+    uint64_t due = next_frame < end_time && !config.queued_frames ? next_frame : end_time;
+    uint32_t wait_ms = due > now ? (uint32_t)((due - now + 999) / 1000) : 0;
+    if (wait_ms > IDLE_TIMEOUT_MS)
+      wait_ms = IDLE_TIMEOUT_MS;
+
+    int32_t status = TLS_Socket_Wait(&network_context, requests.lWakeupFd, wait_ms);
+    if (status > 0 && (status & tlsWAIT_WAKEUP))
+      NetworkRequests_ClearWakeup(&requests);
+
+    // An idle timeout also runs the process loop so keep-alive pings go out
+    bool broken = status < 0;
+    if (!broken && ((status & tlsWAIT_READABLE) || status == 0))
+      broken = AzureIoTHubClient_ProcessLoop(&client, 0) != eAzureIoTSuccess;
+
+    if (!broken)
+      broken = !process_requests();
+
+    now = now_us();
+    if (!broken && !config.queued_frames && now >= next_frame && next_frame < end_time)
+    {
+      if (now > next_frame + frame_period_us)
+        stats.late++;
+      next_frame += frame_period_us;
+
+      simulate_frame();
+      broken = (encode_frame() && !publish(true)) || (config.summaries && !publish(false));
+    }
+
+    if (broken && !reconnect(end_time))
+    {
+      stats.failed = true;
+      break;
+    }
+  }
+
+  // Collect the acknowledgements still in flight
+  uint64_t drain_end = now_us() + SEND_RECV_TIMEOUT_MS * 1000;
+  while (!stats.failed && pending_count > 0 && now_us() < drain_end)
+  {
+    if (TLS_Socket_Wait(&network_context, -1, 10) > 0 &&
+        AzureIoTHubClient_ProcessLoop(&client, 0) != eAzureIoTSuccess)
+      break;
+  }
+
+  stats.run_ns = (now_us() - start_time) * 1000;
+  stats.cpu_ns = thread_cpu_ns() - start_cpu;
+
+  // A failed reconnect has already closed the transport
+  if (!stats.failed)
+    AzureIoTHubClient_Disconnect(&client);
+  if (tls_params.xSSLContext != NULL)
+    TLS_Socket_Disconnect(&network_context);
+  AzureIoTHubClient_Deinit(&client);
+}
+
+void Station::start()
+{
+  thread = std::thread(&Station::run, this);
+}
+
+bool Station::request(azure_request_t type)
+{
+  return NetworkRequests_Send(&requests, type, nullptr, 0);
+}
+
+void Station::join()
+{
+  if (thread.joinable())
+    thread.join();
+}
+
+const station_stats &Station::get_stats()
+{
+  return stats;
+}
+
+// Bytes held by the station for its lifetime, the counterpart of its RAM on the device
+uint32_t Station::get_footprint()
+{
+  return sizeof(Station) +
+         network_buffer.capacity() +
+         timestamp.capacity() * sizeof(uint64_t) +
+         (gain.capacity() + duty_cycle.capacity() + velocity.capacity() +
+          position.capacity() + current.capacity()) * sizeof(float) +
+         compressor_buffer.capacity() +
+         frame.capacity() +
+         summary_string.capacity();
+}
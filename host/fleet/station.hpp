@@ -0,0 +1,174 @@
+#ifndef STATION_H_
+#define STATION_H_
+
+// Includes
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "motor_model.hpp"
+#include "compressor.hpp"
+#include "summary.hpp"
+#include "frame_format.hpp"
+
+extern "C"
+{
+#include "azure_iot_hub_client.h"
+#include "transport_tls_socket.h"
+#include "network_context.h"
+#include "sample_azure_iot_requests.h"
+}
+
+enum FrameEncoding
+{
+  ENCODING_JSON = 0,
+  ENCODING_COMPRESSED = 1,
+};
+
+typedef struct
+{
+  std::string host;
+  uint16_t port;
+  FrameEncoding encoding;
+  uint32_t sample_rate;   // Samples per second
+  uint16_t frame_samples; // Samples per telemetry frame
+  bool summaries;         // Send the frame summary after each frame
+  uint32_t duration_ms;   // Time spent publishing, after connecting
+  bool reconnect;         // Connect again when the connection breaks instead of stopping
+  bool queued_frames;     // Frames go out when request() asks for them, as the firmware's do, not on a timer
+} station_config;
+
+typedef struct
+{
+  bool connected;
+  bool failed; // The connection broke while publishing and was not restored
+  uint32_t connect_us;
+  uint32_t reconnects;
+  std::vector<uint32_t> reconnect_us; // Broken connection noticed to subscribed again
+  uint32_t twin_us; // Properties GET round trip, 0 if it never arrived
+
+  uint64_t frames;
+  uint64_t frame_bytes;
+  uint64_t summaries;
+  uint64_t summary_bytes;
+  uint64_t dropped; // Frames not sent while too many publishes were unacknowledged
+  uint64_t late;    // Frames sent more than a frame period after they were due
+  uint64_t acks;
+
+  uint64_t encode_ns;
+  uint64_t cpu_ns; // Thread CPU time spent publishing
+  uint64_t run_ns; // Wall time spent publishing
+
+  std::vector<uint32_t> latency_us; // Send to PUBACK of every acknowledged publish
+
+  uint64_t requests;                 // Publish requests taken off the queue
+  std::vector<uint32_t> request_us;  // Queued to sent of every request
+
+  uint64_t commands;                 // Direct methods answered
+  std::vector<uint64_t> actuated_us; // Monotonic time each set point command was applied
+} station_stats;
+
+// One virtual DTMC station: a motor model feeding the same frame encoders as the firmware,
+// published through the device-side AzureIoTHubClient on its own thread, like the network task.
+class Station
+{
+private:
+  // Class variables
+  static constexpr uint32_t NETWORK_BUFFER_SIZE = 5120;   // CONFIG_NETWORK_BUFFER_SIZE default
+  static constexpr uint32_t SUMMARY_STRING_SIZE = 1024;
+  static constexpr uint8_t MAX_PENDING = 8;               // Leaves MQTT_STATE_ARRAY_MAX_COUNT room for the twin
+  static constexpr uint32_t SEND_RECV_TIMEOUT_MS = 2000;  // sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS
+  static constexpr uint32_t RECV_TIMEOUT_MS = 10;         // sampleazureiotTRANSPORT_RECV_TIMEOUT_MS
+  static constexpr uint32_t CONNACK_TIMEOUT_MS = 10000;
+  static constexpr uint32_t SUBSCRIBE_TIMEOUT_MS = 10000;
+  static constexpr uint32_t RECONNECT_DELAY_MS = 100;     // Between failed attempts
+  static constexpr uint32_t IDLE_TIMEOUT_MS = 1000;       // sampleazureiotNETWORK_IDLE_TIMEOUT_MS
+
+  typedef struct
+  {
+    uint16_t packet_id;
+    uint64_t sent_us;
+  } pending_publish;
+
+  uint32_t index;
+  std::string device_id;
+  const station_config &config;
+
+  MotorModel motor;
+  uint64_t sample_time_us;
+  uint64_t start_unix_ms;
+
+  AzureIoTHubClient_t client;
+  NetworkContext network_context;
+  TlsTransportParams_t tls_params;
+  NetworkCredentials_t credentials;
+  AzureIoTTransportInterface_t transport;
+  std::vector<uint8_t> network_buffer;
+  NetworkRequests_t requests; // sample_azure_iot_requests.c, as the network task's
+
+  uint8_t frame_property_buffer[96];
+  uint8_t summary_property_buffer[96];
+  AzureIoTMessageProperties_t frame_properties;
+  AzureIoTMessageProperties_t summary_properties;
+
+  std::vector<uint64_t> timestamp;
+  std::vector<float> gain;
+  std::vector<float> duty_cycle;
+  std::vector<float> velocity;
+  std::vector<float> position;
+  std::vector<float> current;
+  frame_summary summary;
+
+  std::vector<uint8_t> compressor_buffer;
+  StreamCompressor compressor;
+  std::vector<char> frame;
+  uint32_t frame_length;
+  uint32_t frame_offset;
+  std::vector<char> summary_string;
+
+  pending_publish pending[MAX_PENDING];
+  uint8_t pending_count;
+  uint64_t twin_request_us;
+
+  bool commanded; // A command set the velocity, the square wave stops
+
+  station_stats stats;
+  std::thread thread;
+
+  static thread_local Station *current_station;
+
+  static uint64_t now_us();
+  static uint64_t thread_cpu_ns();
+  static uint64_t get_unix_time();
+  static void handle_puback(uint16_t packet_id);
+  static void handle_cloud_message(AzureIoTHubClientCloudToDeviceMessageRequest_t *message, void *context);
+  static void handle_command(AzureIoTHubClientCommandRequest_t *message, void *context);
+  static void handle_properties(AzureIoTHubClientPropertiesResponse_t *message, void *context);
+  static size_t produce_frame(void *context, uint8_t *buffer, size_t size);
+
+  bool connect();
+  bool reconnect(uint64_t end_time);
+  bool init_properties();
+  void simulate_frame();
+  bool encode_frame();
+  bool publish(bool is_frame);
+  bool process_requests();
+  void run();
+
+public:
+  Station(uint32_t index, const station_config &config);
+  ~Station();
+
+  void start();
+  void join();
+
+  // Queues a publish for the station's thread from any other, as the firmware's tasks do through
+  // azure_request_publish(). Telemetry and summaries only, false if the queue is full.
+  bool request(azure_request_t type);
+
+  const station_stats &get_stats();
+  uint32_t get_footprint();
+};
+
+#endif // STATION_H_
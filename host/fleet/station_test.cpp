@@ -0,0 +1,198 @@
+// Includes
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "mqtt_broker.hpp"
+#include "station.hpp"
+
+extern "C"
+{
+#include "azure_iot.h"
+}
+
+// Integration test: a station publishes to a local broker standing in for the hub, which sends it
+// set point direct methods as the service would. Every command must be applied within the latency
+// bound of being sent and answered, while another thread keeps queueing the station's frames and
+// summaries through the firmware's request queue, whose eventfd must wake the station for each.
+// Halfway the broker drops the connection, the station must be connected and subscribed again
+// within the reconnect bound and keep taking commands. Only the connect and the pipelined subscribes
+// to the same broker are measured, the DPS cache and its fallback are covered by host/sim's dps_cache.
+
+static constexpr uint32_t DURATION_MS = 4000;
+static constexpr uint32_t CONNECT_TIMEOUT_MS = 1000;
+static constexpr uint32_t COMMAND_COUNT = 50; // Before the drop and as many after
+static constexpr uint32_t COMMAND_INTERVAL_MS = 20;
+static constexpr uint32_t FRAME_INTERVAL_MS = 7; // Out of step with the commands
+static constexpr uint32_t MEDIAN_LATENCY_US = 5000;
+static constexpr uint32_t MAX_LATENCY_US = 50000;
+static constexpr uint32_t MAX_RECONNECT_US = 100000;
+static constexpr uint32_t MEDIAN_REQUEST_US = 5000; // Queued to sent, well under the command interval
+
+static constexpr char METHOD_TOPIC[] = "$iothub/methods/POST/";
+static constexpr char RESPONSE_TOPIC[] = "$iothub/methods/res/";
+
+static uint64_t now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void send_command(MqttBroker &hub, const std::string &name, uint32_t request_id, const std::string &payload)
+{
+  std::string topic = METHOD_TOPIC + name + "/?$rid=" + std::to_string(request_id);
+  hub.publish(topic, (const uint8_t *)payload.data(), payload.size());
+}
+
+int main()
+{
+  std::mutex response_mutex;
+  std::map<uint32_t, uint32_t> responses; // Status by request ID
+
+  if (AzureIoT_Init() != eAzureIoTSuccess)
+    return 1;
+
+  // Responses are published on $iothub/methods/res/{status}/?$rid={request ID}
+  MqttBroker hub;
+  hub.set_observer([&](const std::string &topic, const uint8_t *payload, uint32_t length)
+                   {
+                     (void)payload;
+                     (void)length;
+
+                     size_t rid = topic.find("?$rid=");
+                     if (topic.compare(0, sizeof(RESPONSE_TOPIC) - 1, RESPONSE_TOPIC) != 0 || rid == std::string::npos)
+                       return;
+
+                     std::lock_guard<std::mutex> lock(response_mutex);
+                     responses[std::stoul(topic.substr(rid + 6))] = std::stoul(topic.substr(sizeof(RESPONSE_TOPIC) - 1));
+                   });
+  if (!hub.start(0))
+    return 1;
+
+  station_config config = {
+      .host = "127.0.0.1",
+      .port = hub.get_port(),
+      .encoding = ENCODING_COMPRESSED,
+      .sample_rate = 1000,
+      .frame_samples = 100,
+      .summaries = true,
+      .duration_ms = DURATION_MS,
+      .reconnect = true,
+      .queued_frames = true,
+  };
+  Station station(0, config);
+  station.start();
+
+  // Stands in for the update task, which queues each frame and its summary as it completes
+  std::atomic<bool> publishing(true);
+  uint64_t rejected = 0;
+  std::thread publisher([&]()
+                        {
+                          while (publishing)
+                          {
+                            if (!station.request(AZURE_REQUEST_TELEMETRY) || !station.request(AZURE_REQUEST_SUMMARY))
+                              rejected++;
+                            usleep(FRAME_INTERVAL_MS * 1000);
+                          }
+                        });
+
+  // The station asks for its twin once its subscriptions are acknowledged
+  for (uint32_t waited = 0; waited < CONNECT_TIMEOUT_MS && hub.get_stats().twin_requests == 0; waited += 10)
+    usleep(10000);
+  check(hub.get_stats().twin_requests > 0, "station connects and subscribes");
+
+  std::vector<uint64_t> sent_us;
+  for (uint32_t i = 0; i < COMMAND_COUNT; i++)
+  {
+    sent_us.push_back(now_us());
+    send_command(hub, "set_setpoint", i + 1, "{\"velocity\":" + std::to_string(60 + i) + "}");
+    usleep(COMMAND_INTERVAL_MS * 1000);
+  }
+  send_command(hub, "set_setpoint", 2 * COMMAND_COUNT + 1, "{\"position\":90}");
+  send_command(hub, "unknown", 2 * COMMAND_COUNT + 2, "{}");
+
+  // Answered before the drop, a command lost with the connection is not resent
+  for (uint32_t waited = 0; waited < CONNECT_TIMEOUT_MS; waited += 10)
+  {
+    {
+      std::lock_guard<std::mutex> lock(response_mutex);
+      if (responses.count(2 * COMMAND_COUNT + 2) > 0)
+        break;
+    }
+    usleep(10000);
+  }
+
+  // The station asks for its twin again once it is subscribed again
+  uint64_t twin_requests = hub.get_stats().twin_requests;
+  uint64_t drop_time = now_us();
+  hub.drop_clients();
+  while (hub.get_stats().twin_requests == twin_requests && now_us() - drop_time < CONNECT_TIMEOUT_MS * 1000)
+    usleep(100);
+  uint64_t outage_us = now_us() - drop_time;
+  check(hub.get_stats().twin_requests > twin_requests, "station reconnects after the broker drops it");
+
+  for (uint32_t i = COMMAND_COUNT; i < 2 * COMMAND_COUNT; i++)
+  {
+    sent_us.push_back(now_us());
+    send_command(hub, "set_setpoint", i + 1, "{\"velocity\":" + std::to_string(60 + i) + "}");
+    usleep(COMMAND_INTERVAL_MS * 1000);
+  }
+
+  publishing = false;
+  publisher.join();
+  station.join();
+  hub.stop();
+
+  const station_stats &stats = station.get_stats();
+  check(stats.connected && !stats.failed, "station publishes throughout");
+  check(stats.frames > 0 && stats.summaries > 0, "frames and summaries queued from another thread are sent");
+
+  std::vector<uint32_t> request_us = stats.request_us;
+  std::sort(request_us.begin(), request_us.end());
+  uint32_t request_median_us = request_us.empty() ? UINT32_MAX : request_us[request_us.size() / 2];
+  check(request_median_us <= MEDIAN_REQUEST_US, "median queued publish is sent within 5 ms, the eventfd wakes the station");
+  check(stats.reconnects == 1, "station reconnects once");
+  check(outage_us <= MAX_RECONNECT_US && !stats.reconnect_us.empty() && stats.reconnect_us[0] <= MAX_RECONNECT_US,
+        "station is subscribed again within 100 ms of the drop");
+  check(stats.commands == 2 * COMMAND_COUNT + 2, "station answers every command");
+  check(stats.actuated_us.size() == 2 * COMMAND_COUNT, "every set point command is applied");
+
+  bool all_ok = true;
+  for (uint32_t i = 1; i <= 2 * COMMAND_COUNT; i++)
+    all_ok = all_ok && responses.count(i) > 0 && responses[i] == 200;
+  check(all_ok, "set point commands are answered with 200");
+  check(responses.count(2 * COMMAND_COUNT + 1) > 0 && responses[2 * COMMAND_COUNT + 1] == 400,
+        "a command without a velocity is answered with 400");
+  check(responses.count(2 * COMMAND_COUNT + 2) > 0 && responses[2 * COMMAND_COUNT + 2] == 404,
+        "an unknown command is answered with 404");
+
+  // Commands arrive in order over the one connection
+  std::vector<uint64_t> latency_us;
+  for (uint32_t i = 0; i < stats.actuated_us.size() && i < sent_us.size(); i++)
+    latency_us.push_back(stats.actuated_us[i] - sent_us[i]);
+  std::sort(latency_us.begin(), latency_us.end());
+
+  uint64_t median_us = latency_us.empty() ? UINT64_MAX : latency_us[latency_us.size() / 2];
+  uint64_t max_us = latency_us.empty() ? UINT64_MAX : latency_us.back();
+  check(median_us <= MEDIAN_LATENCY_US, "median command to actuation latency is within 5 ms");
+  check(max_us <= MAX_LATENCY_US, "every command is actuated within 50 ms");
+
+  printf("%zu commands, command to actuation median %llu us, max %llu us, %llu frames, %llu requests queued to sent "
+         "median %u us (%llu rejected while reconnecting), reconnected in %llu us (%llu us seen by the broker)\n",
+         latency_us.size(), (unsigned long long)median_us, (unsigned long long)max_us,
+         (unsigned long long)stats.frames, (unsigned long long)stats.requests, request_median_us,
+         (unsigned long long)rejected,
+         (unsigned long long)(stats.reconnect_us.empty() ? 0 : stats.reconnect_us[0]), (unsigned long long)outage_us);
+
+  AzureIoT_Deinit();
+  return check_summary();
+}
@@ -0,0 +1,369 @@
+// Includes
+#include "frame_decoder.hpp"
+
+#include <string.h>
+#include <cmath>
+#include <type_traits>
+
+typedef struct
+{
+  const char *text;
+  size_t length;
+  size_t position;
+} json_cursor;
+
+static const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                                       1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+
+// Column keys in frame order, the timestamp first and then the float columns
+static const char *COLUMN_KEYS[FRAME_COLUMN_COUNT] = {"timestamp", "gain", "duty_cycle", "velocity", "position", "current"};
+static constexpr uint8_t ALL_COLUMNS = (1 << FRAME_COLUMN_COUNT) - 1;
+
+static int8_t find_column(const char *key, size_t length)
+{
+  for (uint8_t i = 0; i < FRAME_COLUMN_COUNT; i++)
+    if (strlen(COLUMN_KEYS[i]) == length && memcmp(key, COLUMN_KEYS[i], length) == 0)
+      return i;
+
+  return -1;
+}
+
+frame_columns get_frame_columns(const decoded_frame &frame)
+{
+  return {frame.timestamp.data(), frame.gain.data(), frame.duty_cycle.data(),
+          frame.velocity.data(), frame.position.data(), frame.current.data()};
+}
+
+bool is_compressed_frame(const uint8_t *data, size_t length)
+{
+  return length >= FRAME_HEADER_SIZE && data[0] == 'D' && data[1] == 'T';
+}
+
+static void skip_space(json_cursor &json)
+{
+  while (json.position < json.length &&
+         (json.text[json.position] == ' ' || json.text[json.position] == '\t' ||
+          json.text[json.position] == '\r' || json.text[json.position] == '\n'))
+    json.position++;
+}
+
+static bool expect(json_cursor &json, char token)
+{
+  skip_space(json);
+  if (json.position >= json.length || json.text[json.position] != token)
+    return false;
+
+  json.position++;
+  return true;
+}
+
+// Numbers as the firmware formats them, integers or fixed-point, parsed without a copy
+// since the payload is not terminated. Exponents are accepted from other writers.
+static bool parse_number(json_cursor &json, double *value, uint64_t *integer)
+{
+  uint64_t mantissa = 0;
+  int32_t exponent = 0;
+  uint8_t digits = 0;
+  bool negative = false;
+
+  skip_space(json);
+  if (json.position < json.length && json.text[json.position] == '-')
+  {
+    negative = true;
+    json.position++;
+  }
+
+  while (json.position < json.length && json.text[json.position] >= '0' && json.text[json.position] <= '9')
+  {
+    if (digits < 19)
+      mantissa = mantissa * 10 + (json.text[json.position] - '0');
+    else
+      exponent++;
+    digits++;
+    json.position++;
+  }
+  if (digits == 0)
+    return false;
+  if (integer != NULL)
+    *integer = mantissa;
+
+  if (json.position < json.length && json.text[json.position] == '.')
+  {
+    json.position++;
+    while (json.position < json.length && json.text[json.position] >= '0' && json.text[json.position] <= '9')
+    {
+      if (digits < 19)
+      {
+        mantissa = mantissa * 10 + (json.text[json.position] - '0');
+        exponent--;
+      }
+      digits++;
+      json.position++;
+    }
+  }
+
+  if (json.position < json.length && (json.text[json.position] == 'e' || json.text[json.position] == 'E'))
+  {
+    int32_t written = 0;
+    bool negative_exponent = false;
+
+    json.position++;
+    if (json.position < json.length && (json.text[json.position] == '-' || json.text[json.position] == '+'))
+      negative_exponent = json.text[json.position++] == '-';
+    while (json.position < json.length && json.text[json.position] >= '0' && json.text[json.position] <= '9')
+    {
+      if (written < 10000)
+        written = written * 10 + (json.text[json.position] - '0');
+      json.position++;
+    }
+    exponent += negative_exponent ? -written : written;
+  }
+
+  double result = (double)mantissa;
+  if (exponent < 0 && exponent > -19)
+    result /= POWERS_OF_TEN[-exponent];
+  else if (exponent > 0 && exponent < 19)
+    result *= POWERS_OF_TEN[exponent];
+  else if (exponent != 0)
+    result *= std::pow(10.0, exponent);
+
+  *value = negative ? -result : result;
+  return true;
+}
+
+template <typename T>
+static bool parse_column(json_cursor &json, std::vector<T> &values)
+{
+  values.clear();
+  if (!expect(json, '['))
+    return false;
+
+  skip_space(json);
+  if (json.position < json.length && json.text[json.position] == ']')
+  {
+    json.position++;
+    return true;
+  }
+
+  do
+  {
+    double value;
+    uint64_t integer;
+
+    if (!parse_number(json, &value, &integer))
+      return false;
+    if constexpr (std::is_same_v<T, uint64_t>)
+      values.push_back(integer);
+    else
+      values.push_back((T)value);
+  } while (expect(json, ','));
+
+  return expect(json, ']');
+}
+
+bool decode_json_frame(const char *text, size_t length, decoded_frame &frame)
+{
+  json_cursor json = {text, length, 0};
+  std::vector<float> *float_columns[] = {&frame.gain, &frame.duty_cycle, &frame.velocity, &frame.position, &frame.current};
+  uint8_t found = 0;
+
+  if (!expect(json, '{'))
+    return false;
+
+  do
+  {
+    if (!expect(json, '"'))
+      return false;
+
+    const char *key = &json.text[json.position];
+    const char *end = (const char *)memchr(key, '"', json.length - json.position);
+    if (end == NULL)
+      return false;
+    size_t key_length = end - key;
+    json.position += key_length + 1;
+
+    if (!expect(json, ':'))
+      return false;
+
+    int8_t column = find_column(key, key_length);
+    bool parsed;
+    if (column == 0)
+      parsed = parse_column(json, frame.timestamp);
+    else if (column > 0)
+      parsed = parse_column(json, *float_columns[column - 1]);
+    else
+      return false;
+
+    if (!parsed)
+      return false;
+    found |= 1 << column;
+  } while (expect(json, ','));
+
+  if (!expect(json, '}') || found != ALL_COLUMNS)
+    return false;
+
+  size_t count = frame.timestamp.size();
+  if (count > UINT16_MAX || frame.gain.size() != count || frame.duty_cycle.size() != count ||
+      frame.velocity.size() != count || frame.position.size() != count || frame.current.size() != count)
+    return false;
+  frame.count = count;
+
+  return true;
+}
+
+bool decompress(const uint8_t *data, size_t length, uint8_t window_bits, uint8_t lookahead_bits,
+                size_t max_length, std::vector<uint8_t> &output)
+{
+  uint64_t position = 0;
+  uint64_t end = (uint64_t)length * 8;
+
+  output.clear();
+
+  // The parameters come from the message, only the firmware's are decoded
+  if (window_bits == 0 || lookahead_bits == 0 || lookahead_bits >= window_bits ||
+      window_bits != StreamCompressor::WINDOW_BITS || lookahead_bits != StreamCompressor::LOOKAHEAD_BITS)
+    return false;
+
+  auto read = [&](uint8_t count)
+  {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < count; i++, position++)
+      value = (value << 1) | ((data[position >> 3] >> (7 - (position & 7))) & 1);
+    return value;
+  };
+
+  while (end - position >= 1 + 8)
+  {
+    if (read(1) == 1)
+    {
+      if (output.size() >= max_length)
+        return false;
+      output.push_back(read(8));
+      continue;
+    }
+
+    // Trailing zero padding is shorter than a back-reference
+    if (end - position < (uint64_t)window_bits + lookahead_bits)
+      break;
+    uint32_t distance = read(window_bits) + 1;
+    uint32_t count = read(lookahead_bits) + 1;
+    if (distance > output.size() || count > max_length - output.size())
+      return false;
+
+    for (uint32_t i = 0; i < count; i++)
+      output.push_back(output[output.size() - distance]);
+  }
+
+  return true;
+}
+
+template <typename T>
+static bool read_bytes(const uint8_t *data, size_t length, size_t *offset, T *value)
+{
+  if (*offset + sizeof(T) > length)
+    return false;
+
+  memcpy(value, &data[*offset], sizeof(T));
+  *offset += sizeof(T);
+  return true;
+}
+
+// Undoes the delta or XOR filter of one column
+template <typename T, typename Bits>
+static bool decode_column(const uint8_t *data, size_t length, size_t *offset, uint8_t filter,
+                          uint16_t count, std::vector<T> &values)
+{
+  Bits previous = 0;
+
+  if (*offset + (size_t)count * sizeof(Bits) > length)
+    return false;
+
+  values.resize(count);
+  for (uint16_t i = 0; i < count; i++)
+  {
+    Bits bits;
+    memcpy(&bits, &data[*offset], sizeof(bits));
+    *offset += sizeof(bits);
+
+    if (filter == 1) // Delta
+      bits += previous;
+    else if (filter == 2) // XOR
+      bits ^= previous;
+    previous = bits;
+    memcpy(&values[i], &bits, sizeof(bits));
+  }
+
+  return true;
+}
+
+bool decode_columns(const uint8_t *data, size_t length, size_t *offset, decoded_frame &frame)
+{
+  std::vector<float> *float_columns[] = {&frame.gain, &frame.duty_cycle, &frame.velocity, &frame.position, &frame.current};
+  uint16_t count;
+  uint8_t column_count;
+  uint8_t found = 0;
+
+  if (!read_bytes(data, length, offset, &count) || !read_bytes(data, length, offset, &column_count))
+    return false;
+
+  for (uint8_t column = 0; column < column_count; column++)
+  {
+    uint8_t key_length;
+    uint8_t type;
+    uint8_t filter;
+
+    if (!read_bytes(data, length, offset, &key_length) || *offset + key_length + 2 > length)
+      return false;
+
+    const char *key = (const char *)&data[*offset];
+    *offset += key_length;
+    type = data[(*offset)++];
+    filter = data[(*offset)++];
+
+    int8_t index = find_column(key, key_length);
+    bool decoded;
+    if (index == 0 && type == 0)
+      decoded = decode_column<uint64_t, uint64_t>(data, length, offset, filter, count, frame.timestamp);
+    else if (index > 0 && type == 1)
+      decoded = decode_column<float, uint32_t>(data, length, offset, filter, count, *float_columns[index - 1]);
+    else
+      return false;
+
+    if (!decoded)
+      return false;
+    found |= 1 << index;
+  }
+
+  frame.count = count;
+  return found == ALL_COLUMNS;
+}
+
+bool decode_compressed_frame(const uint8_t *data, size_t length, decoded_frame &frame)
+{
+  thread_local std::vector<uint8_t> columns;
+  size_t offset = 0;
+
+  if (!is_compressed_frame(data, length) || data[2] != FRAME_VERSION)
+    return false;
+  if (!decompress(&data[FRAME_HEADER_SIZE], length - FRAME_HEADER_SIZE, data[3] >> 4, data[3] & 0x0F,
+                  MAX_FRAME_COLUMNS_SIZE, columns))
+    return false;
+
+  return decode_columns(columns.data(), columns.size(), &offset, frame);
+}
+
+bool find_json_number(const char *text, size_t length, const char *key, double *value)
+{
+  size_t key_length = strlen(key);
+
+  for (size_t i = 0; i + key_length + 3 <= length; i++)
+  {
+    if (text[i] != '"' || memcmp(&text[i + 1], key, key_length) != 0 || text[i + 1 + key_length] != '"')
+      continue;
+
+    json_cursor json = {text, length, i + key_length + 2};
+    return expect(json, ':') && parse_number(json, value, NULL);
+  }
+
+  return false;
+}
@@ -0,0 +1,53 @@
+#ifndef FRAME_DECODER_H_
+#define FRAME_DECODER_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "frame_format.hpp"
+
+// Decoders for what frame_format.hpp encodes: JSON and compressed frames, and the
+// end time and controller state of a summary. The host counterpart of
+// python_scripts/telemetry_codec.py.
+
+typedef struct
+{
+  uint16_t count;
+  std::vector<uint64_t> timestamp;
+  std::vector<float> gain;
+  std::vector<float> duty_cycle;
+  std::vector<float> velocity;
+  std::vector<float> position;
+  std::vector<float> current;
+} decoded_frame;
+
+// Columns pointing into a decoded frame, for the frame_format encoders
+frame_columns get_frame_columns(const decoded_frame &frame);
+
+// A compressed frame starts with "DT", anything else is text
+bool is_compressed_frame(const uint8_t *data, size_t length);
+
+// Each returns false if the message is not a complete frame of the firmware's six columns
+bool decode_json_frame(const char *text, size_t length, decoded_frame &frame);
+bool decode_compressed_frame(const uint8_t *data, size_t length, decoded_frame &frame);
+
+// Reads the column section written by compress_columns() at offset, advancing it past the section
+bool decode_columns(const uint8_t *data, size_t length, size_t *offset, decoded_frame &frame);
+
+// Largest column section a frame can expand to: every column 8 bytes a sample at the most samples
+// a frame counts, and the section's header
+static constexpr size_t MAX_FRAME_COLUMNS_SIZE = (size_t)FRAME_COLUMN_COUNT * UINT16_MAX * sizeof(uint64_t) +
+                                                 frame_columns_size(0);
+
+// Expands a heatshrink stream into output. Returns false unless the parameters are the firmware
+// compressor's, on a reference before the start, or if the output would exceed max_length.
+bool decompress(const uint8_t *data, size_t length, uint8_t window_bits, uint8_t lookahead_bits,
+                size_t max_length, std::vector<uint8_t> &output);
+
+// Finds "key":number in a JSON object, returns false if it is missing
+bool find_json_number(const char *text, size_t length, const char *key, double *value);
+
+#endif // FRAME_DECODER_H_
@@ -0,0 +1,827 @@
+// Includes
+#include "gateway.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string_view>
+
+#include "esp_log.h"
+
+static constexpr char *TAG = "Gateway";
+
+static constexpr char EVENTS_FILTER[] = "devices/+/messages/events/#";
+static constexpr char DEVICES_PREFIX[] = "devices/";
+static constexpr char EVENTS_INFIX[] = "/messages/events/";
+
+// Upstream message properties, URL encoded as the sample application's
+static constexpr char PATCH_PROPERTIES[] = "%24.ct=application%2Fjson&%24.ce=utf-8&type=twins";
+static constexpr char BATCH_PROPERTIES[] = "%24.ct=application%2Foctet-stream&%24.ce=heatshrink&type=batch";
+
+static constexpr uint32_t MAX_ENTRY_SIZE = 2048; // One twin of a patch, its summary included
+static constexpr uint32_t BATCH_ENTRY_OVERHEAD = 1 + UINT8_MAX + 1;
+
+thread_local Gateway *Gateway::current_gateway = nullptr;
+
+Gateway::Gateway(const gateway_config &config)
+{
+  this->config = config;
+
+  // A batch, however full, must compress into one device-to-cloud message
+  uint32_t max_batch_bytes = (MAX_MESSAGE_SIZE - FRAME_HEADER_SIZE) * 8 / 9 - sizeof(uint16_t) - 8;
+  if (this->config.batch_bytes == 0 || this->config.batch_bytes > max_batch_bytes)
+    this->config.batch_bytes = max_batch_bytes;
+  if (this->config.patch_interval_ms == 0)
+    this->config.patch_interval_ms = 1;
+
+  running = false;
+  local_connected = false;
+  hub_connected = false;
+
+  memset(&local_mqtt, 0, sizeof(local_mqtt));
+  local_context.pParams = &local_tls_params;
+  memset(&local_tls_params, 0, sizeof(local_tls_params));
+  memset(&local_transport, 0, sizeof(local_transport));
+  local_buffer.resize(LOCAL_BUFFER_SIZE);
+
+  memset(&hub_client, 0, sizeof(hub_client));
+  hub_context.pParams = &hub_tls_params;
+  memset(&hub_tls_params, 0, sizeof(hub_tls_params));
+  memset(&hub_transport, 0, sizeof(hub_transport));
+  hub_buffer.resize(HUB_BUFFER_SIZE);
+  pending_count = 0;
+
+  compressor_buffer.resize(StreamCompressor::BUFFER_SIZE);
+  compressor.init(compressor_buffer.data());
+  patch.resize(MAX_MESSAGE_SIZE);
+  stream_data = NULL;
+  stream_length = 0;
+  stream_offset = 0;
+
+  batch_size = 0;
+  batch_start_ms = 0;
+  stats = {};
+}
+
+Gateway::~Gateway()
+{
+  stop();
+}
+
+uint64_t Gateway::now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+uint64_t Gateway::thread_cpu_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint32_t Gateway::get_time_ms()
+{
+  return (uint32_t)now_ms();
+}
+
+uint64_t Gateway::get_unix_time()
+{
+  return (uint64_t)time(NULL);
+}
+
+// Value of name in a URL encoded property string, empty if it is missing
+static std::string get_property(const char *properties, size_t length, const char *name)
+{
+  size_t name_length = strlen(name);
+  size_t start = 0;
+
+  while (start < length)
+  {
+    const char *separator = (const char *)memchr(&properties[start], '&', length - start);
+    size_t end = separator != NULL ? separator - properties : length;
+
+    if (end - start > name_length && properties[start + name_length] == '=' &&
+        memcmp(&properties[start], name, name_length) == 0)
+      return std::string(&properties[start + name_length + 1], end - start - name_length - 1);
+
+    start = end + 1;
+  }
+
+  return std::string();
+}
+
+/*-----------------------------------------------------------*/
+// Ingest, stations to latest state and batches
+
+void Gateway::handle_local_event(AzureIoTMQTTHandle_t context, AzureIoTMQTTPacketInfo_t *packet,
+                                 AzureIoTMQTTDeserializedInfo_t *info)
+{
+  (void)context;
+
+  if ((packet->ucType & 0xF0U) != azureiotmqttPACKET_TYPE_PUBLISH || info->pxPublishInfo == NULL)
+    return;
+
+  AzureIoTMQTTPublishInfo_t *publish = info->pxPublishInfo;
+  current_gateway->receive((const char *)publish->pcTopicName, publish->usTopicNameLength,
+                           (const uint8_t *)publish->pvPayload, publish->xPayloadLength);
+}
+
+bool Gateway::connect_local()
+{
+  AzureIoTMQTTConnectInfo_t connect_info = {};
+  AzureIoTMQTTSubscribeInfo_t subscription = {};
+  NetworkCredentials_t credentials = {};
+  std::string client_id = config.device_id + "-ingest";
+  bool session_present;
+
+  if (TLS_Socket_Connect(&local_context, config.local_host.c_str(), config.local_port, &credentials,
+                         RECV_TIMEOUT_MS, SEND_RECV_TIMEOUT_MS) != eTLSTransportSuccess)
+    return false;
+
+  local_transport.pxNetworkContext = &local_context;
+  local_transport.xSend = TLS_Socket_Send;
+  local_transport.xRecv = TLS_Socket_Recv;
+
+  connect_info.xCleanSession = true;
+  connect_info.usKeepAliveSeconds = KEEP_ALIVE_S;
+  connect_info.pcClientIdentifier = (const uint8_t *)client_id.c_str();
+  connect_info.usClientIdentifierLength = client_id.size();
+
+  subscription.xQoS = eAzureIoTMQTTQoS0;
+  subscription.pcTopicFilter = (const uint8_t *)EVENTS_FILTER;
+  subscription.usTopicFilterLength = sizeof(EVENTS_FILTER) - 1;
+
+  if (AzureIoTMQTT_Init(&local_mqtt, &local_transport, get_time_ms, handle_local_event,
+                        local_buffer.data(), local_buffer.size()) != eAzureIoTMQTTSuccess ||
+      AzureIoTMQTT_Connect(&local_mqtt, &connect_info, NULL, CONNACK_TIMEOUT_MS, &session_present) != eAzureIoTMQTTSuccess ||
+      AzureIoTMQTT_Subscribe(&local_mqtt, &subscription, 1, AzureIoTMQTT_GetPacketId(&local_mqtt)) != eAzureIoTMQTTSuccess)
+  {
+    ESP_LOGE(TAG, "Failed to subscribe to %s:%u.", config.local_host.c_str(), config.local_port);
+    TLS_Socket_Disconnect(&local_context);
+    return false;
+  }
+
+  ESP_LOGI(TAG, "Subscribed to station telemetry on %s:%u.", config.local_host.c_str(), config.local_port);
+  return true;
+}
+
+// Stations publish devices/{id}/messages/events/{properties}, frames without a type property
+void Gateway::receive(const char *topic, size_t topic_length, const uint8_t *payload, size_t length)
+{
+  const size_t prefix_length = sizeof(DEVICES_PREFIX) - 1;
+  const size_t infix_length = sizeof(EVENTS_INFIX) - 1;
+  std::string_view topic_view(topic, topic_length);
+
+  size_t infix = topic_view.find(EVENTS_INFIX, prefix_length);
+  if (topic_view.compare(0, prefix_length, DEVICES_PREFIX) != 0 || infix == std::string_view::npos)
+    return;
+
+  std::string device_id(&topic[prefix_length], infix - prefix_length);
+  const char *properties = &topic[infix + infix_length];
+  size_t properties_length = topic_length - infix - infix_length;
+  std::string type = get_property(properties, properties_length, "type");
+  uint8_t motor = atoi(get_property(properties, properties_length, "motor").c_str());
+
+  if (device_id.empty() || device_id.size() > UINT8_MAX)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    stats.ingress_messages++;
+    stats.ingress_bytes += length;
+  }
+
+  if (type.empty())
+  {
+    uint64_t start_time = thread_cpu_ns();
+    bool decoded = is_compressed_frame(payload, length)
+                       ? decode_compressed_frame(payload, length, frame)
+                       : decode_json_frame((const char *)payload, length, frame);
+    uint64_t decode_ns = thread_cpu_ns() - start_time;
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    stats.decode_ns += decode_ns;
+    if (decoded && frame.count > 0)
+      add_frame(device_id, motor);
+    else
+      stats.decode_errors++;
+  }
+  else if (type == "summary")
+  {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    add_summary(device_id, motor, (const char *)payload, length);
+  }
+  else
+  {
+    std::string forwarded(properties, properties_length);
+    forwarded += (properties_length > 0 ? "&device=" : "device=") + device_id;
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    if (passthrough.size() < MAX_PASSTHROUGH && forwarded.size() < MAX_PROPERTIES_SIZE)
+    {
+      passthrough.push_back({forwarded, std::vector<uint8_t>(payload, payload + length)});
+      stats.passthrough++;
+    }
+    else
+      stats.dropped++;
+  }
+}
+
+static twin_state &get_twin(std::unordered_map<std::string, twin_state> &twins, const std::string &device_id, uint8_t motor)
+{
+  std::string key = device_id + "/" + std::to_string(motor);
+  auto entry = twins.find(key);
+
+  if (entry == twins.end())
+  {
+    twin_state twin = {};
+    twin.device_id = device_id;
+    twin.motor = motor;
+    entry = twins.emplace(key, twin).first;
+  }
+
+  return entry->second;
+}
+
+// Called with the state locked, the decoded frame is in frame
+void Gateway::add_frame(const std::string &device_id, uint8_t motor)
+{
+  twin_state &twin = get_twin(twins, device_id, motor);
+  uint16_t last = frame.count - 1;
+
+  twin.dirty = true;
+  twin.frames++;
+  twin.has_sample = true;
+  twin.time = frame.timestamp[last];
+  twin.duty_cycle = frame.duty_cycle[last];
+  twin.velocity = frame.velocity[last];
+  twin.position = frame.position[last];
+  twin.current = frame.current[last];
+
+  stats.frames++;
+  stats.samples += frame.count;
+
+  uint32_t entry_size = BATCH_ENTRY_OVERHEAD + frame_columns_size(frame.count);
+  if (entry_size > config.batch_bytes)
+  {
+    stats.dropped++;
+    return;
+  }
+
+  // A full batch waits for the uplink, the oldest is lost if it falls too far behind
+  if (batch_size + entry_size > config.batch_bytes)
+  {
+    if (ready_batches.size() >= MAX_READY_BATCHES)
+    {
+      stats.dropped += ready_batches.front().size();
+      ready_batches.erase(ready_batches.begin());
+    }
+    ready_batches.push_back(std::move(batch));
+    batch.clear();
+    batch_size = 0;
+  }
+
+  if (batch.empty())
+    batch_start_ms = now_ms();
+  batch.push_back({device_id, motor, frame});
+  batch_size += entry_size;
+}
+
+// Keeps the summary object of {"summary":{...}} for the next patch
+void Gateway::add_summary(const std::string &device_id, uint8_t motor, const char *text, size_t length)
+{
+  static constexpr char PREFIX[] = "{\"summary\":";
+  const size_t prefix_length = sizeof(PREFIX) - 1;
+  double end_time;
+
+  while (length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r' || text[length - 1] == '\0'))
+    length--;
+
+  if (length < prefix_length + 2 || memcmp(text, PREFIX, prefix_length) != 0 || text[length - 1] != '}' ||
+      length - prefix_length - 1 > MAX_ENTRY_SIZE / 2 || !find_json_number(text, length, "end", &end_time))
+  {
+    stats.decode_errors++;
+    return;
+  }
+
+  twin_state &twin = get_twin(twins, device_id, motor);
+  twin.summary.assign(&text[prefix_length], length - prefix_length - 1);
+  twin.dirty = true;
+  stats.summaries++;
+}
+
+void Gateway::ingest()
+{
+  uint64_t cpu_time = thread_cpu_ns();
+  current_gateway = this;
+
+  while (running)
+  {
+    if (!local_connected)
+    {
+      local_connected = connect_local();
+      if (!local_connected)
+      {
+        usleep(RECONNECT_DELAY_MS * 1000);
+        continue;
+      }
+    }
+
+    int32_t status = TLS_Socket_Wait(&local_context, -1, 100);
+    if (status >= 0 && ((status & tlsWAIT_READABLE) || status == 0) &&
+        AzureIoTMQTT_ProcessLoop(&local_mqtt, 0) != eAzureIoTMQTTSuccess)
+      status = -1;
+
+    if (status < 0)
+    {
+      ESP_LOGW(TAG, "Lost the local broker, reconnecting.");
+      TLS_Socket_Disconnect(&local_context);
+      local_connected = false;
+    }
+
+    uint64_t now = thread_cpu_ns();
+    std::lock_guard<std::mutex> lock(state_mutex);
+    stats.cpu_ns += now - cpu_time;
+    cpu_time = now;
+  }
+
+  if (local_connected)
+  {
+    AzureIoTMQTT_Disconnect(&local_mqtt);
+    TLS_Socket_Disconnect(&local_context);
+    local_connected = false;
+  }
+}
+
+/*-----------------------------------------------------------*/
+// Uplink, coalesced patches and batches to the hub
+
+void Gateway::handle_puback(uint16_t packet_id)
+{
+  Gateway *gateway = current_gateway;
+
+  for (uint8_t i = 0; i < gateway->pending_count; i++)
+  {
+    if (gateway->pending[i] != packet_id)
+      continue;
+
+    gateway->pending[i] = gateway->pending[--gateway->pending_count];
+    std::lock_guard<std::mutex> lock(gateway->state_mutex);
+    gateway->stats.acks++;
+    return;
+  }
+}
+
+size_t Gateway::produce_payload(void *context, uint8_t *buffer, size_t size)
+{
+  Gateway *gateway = static_cast<Gateway *>(context);
+  size_t length = gateway->stream_length - gateway->stream_offset;
+
+  if (length > size)
+    length = size;
+
+  memcpy(buffer, &gateway->stream_data[gateway->stream_offset], length);
+  gateway->stream_offset += length;
+  return length;
+}
+
+bool Gateway::connect_hub()
+{
+  AzureIoTHubClientOptions_t options;
+  NetworkCredentials_t credentials = {};
+  AzureIoTResult_t result;
+  bool session_present;
+
+  if (TLS_Socket_Connect(&hub_context, config.hub_host.c_str(), config.hub_port, &credentials,
+                         RECV_TIMEOUT_MS, SEND_RECV_TIMEOUT_MS) != eTLSTransportSuccess)
+    return false;
+
+  hub_transport.pxNetworkContext = &hub_context;
+  hub_transport.xSend = TLS_Socket_Send;
+  hub_transport.xRecv = TLS_Socket_Recv;
+
+  result = AzureIoTHubClient_OptionsInit(&options);
+  options.xTelemetryCallback = handle_puback;
+
+  if (result == eAzureIoTSuccess)
+    result = AzureIoTHubClient_Init(&hub_client,
+                                    (const uint8_t *)config.hub_host.c_str(), config.hub_host.size(),
+                                    (const uint8_t *)config.device_id.c_str(), config.device_id.size(),
+                                    &options,
+                                    hub_buffer.data(), hub_buffer.size(),
+                                    get_unix_time,
+                                    &hub_transport);
+  if (result == eAzureIoTSuccess)
+    result = AzureIoTHubClient_Connect(&hub_client, true, &session_present, CONNACK_TIMEOUT_MS);
+
+  if (result != eAzureIoTSuccess)
+  {
+    ESP_LOGE(TAG, "Failed to connect to the hub as %s, result 0x%08x.", config.device_id.c_str(), result);
+    TLS_Socket_Disconnect(&hub_context);
+    return false;
+  }
+
+  pending_count = 0;
+  ESP_LOGI(TAG, "Connected to %s:%u as %s.", config.hub_host.c_str(), config.hub_port, config.device_id.c_str());
+  return true;
+}
+
+// Publishes at QoS 1, streamed so the network buffer does not bound the message
+bool Gateway::send(const uint8_t *payload, size_t length, const char *properties)
+{
+  AzureIoTMessageProperties_t message_properties;
+  uint8_t property_buffer[MAX_PROPERTIES_SIZE];
+  uint32_t properties_length = strlen(properties);
+  uint16_t packet_id = 0;
+
+  if (properties_length >= sizeof(property_buffer))
+    return true;
+  memcpy(property_buffer, properties, properties_length);
+
+  stream_data = payload;
+  stream_length = length;
+  stream_offset = 0;
+
+  if (AzureIoTMessage_PropertiesInit(&message_properties, property_buffer, properties_length, sizeof(property_buffer)) != eAzureIoTSuccess ||
+      AzureIoTHubClient_SendTelemetryStream(&hub_client, length, produce_payload, this, &message_properties,
+                                            eAzureIoTHubMessageQoS1, &packet_id) != eAzureIoTSuccess)
+  {
+    ESP_LOGE(TAG, "Failed to publish %lu bytes upstream.", (unsigned long)length);
+    return false;
+  }
+
+  pending[pending_count++] = packet_id;
+
+  std::lock_guard<std::mutex> lock(state_mutex);
+  stats.egress_messages++;
+  stats.egress_bytes += length;
+  return true;
+}
+
+static bool append_twin(char *buffer, uint32_t size, uint32_t *length, const twin_state &twin)
+{
+  bool complete = append_text(buffer, size, length, "{\"device\":\"") &&
+                  append_text(buffer, size, length, twin.device_id.c_str()) &&
+                  append_text(buffer, size, length, "\",") &&
+                  append_field(buffer, size, length, "motor", (uint64_t)twin.motor) &&
+                  append_text(buffer, size, length, ",") &&
+                  append_field(buffer, size, length, "frames", twin.frames);
+
+  if (complete && twin.has_sample)
+    complete = append_text(buffer, size, length, ",\"latest\":{") &&
+               append_field(buffer, size, length, "time", twin.time) &&
+               append_text(buffer, size, length, ",") &&
+               append_field(buffer, size, length, "duty_cycle", twin.duty_cycle) &&
+               append_text(buffer, size, length, ",") &&
+               append_field(buffer, size, length, "velocity", twin.velocity) &&
+               append_text(buffer, size, length, ",") &&
+               append_field(buffer, size, length, "position", twin.position) &&
+               append_text(buffer, size, length, ",") &&
+               append_field(buffer, size, length, "current", twin.current) &&
+               append_text(buffer, size, length, "}");
+
+  if (complete && !twin.summary.empty())
+    complete = append_text(buffer, size, length, ",\"summary\":") &&
+               append_text(buffer, size, length, twin.summary.c_str());
+
+  return complete && append_text(buffer, size, length, "}");
+}
+
+// One message of every twin that changed, split only if it outgrows a device-to-cloud message
+bool Gateway::send_patches(uint64_t now)
+{
+  static constexpr char OPEN[] = "{\"twins\":[";
+  static constexpr char CLOSE[] = "]}";
+  char entry[MAX_ENTRY_SIZE];
+  std::vector<std::string> messages;
+  uint32_t length = 0;
+  uint32_t updates = 0;
+
+  // Twins stay dirty while acknowledgements are behind, and coalesce into the next patch
+  if (pending_count >= MAX_PENDING)
+    return true;
+
+  {
+    std::lock_guard<std::mutex> lock(state_mutex);
+
+    for (auto &item : twins)
+    {
+      twin_state &twin = item.second;
+      uint32_t entry_length = 0;
+
+      if (!twin.dirty || now < twin.last_patch_ms + config.patch_interval_ms)
+        continue;
+      if (!append_twin(entry, sizeof(entry), &entry_length, twin))
+        continue;
+
+      if (length > 0 && length + 1 + entry_length + sizeof(CLOSE) > patch.size())
+      {
+        append_text(patch.data(), patch.size(), &length, CLOSE);
+        messages.emplace_back(patch.data(), length);
+        length = 0;
+      }
+      append_text(patch.data(), patch.size(), &length, length == 0 ? OPEN : ",");
+      memcpy(&patch[length], entry, entry_length);
+      length += entry_length;
+
+      twin.dirty = false;
+      twin.frames = 0;
+      twin.last_patch_ms = now;
+      updates++;
+    }
+
+    if (length > 0)
+    {
+      append_text(patch.data(), patch.size(), &length, CLOSE);
+      messages.emplace_back(patch.data(), length);
+    }
+  }
+
+  for (const std::string &message : messages)
+  {
+    if (pending_count >= MAX_PENDING)
+    {
+      std::lock_guard<std::mutex> lock(state_mutex);
+      stats.dropped++;
+      continue;
+    }
+    if (!send((const uint8_t *)message.data(), message.size(), PATCH_PROPERTIES))
+      return false;
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    stats.patches++;
+  }
+
+  std::lock_guard<std::mutex> lock(state_mutex);
+  stats.twin_updates += updates;
+  return true;
+}
+
+// Sends completed batches, and the open one once it is old enough or when flushing
+bool Gateway::send_batches(uint64_t now, bool flush)
+{
+  while (pending_count < MAX_PENDING)
+  {
+    std::vector<batch_entry> entries;
+
+    {
+      std::lock_guard<std::mutex> lock(state_mutex);
+
+      if (!ready_batches.empty())
+      {
+        entries = std::move(ready_batches.front());
+        ready_batches.erase(ready_batches.begin());
+      }
+      else if (!batch.empty() && (flush || now >= batch_start_ms + config.batch_interval_ms))
+      {
+        entries = std::move(batch);
+        batch.clear();
+        batch_size = 0;
+      }
+      else
+        return true;
+    }
+
+    uint64_t start_time = thread_cpu_ns();
+    uint32_t length = compress_batch(compressor, blob, entries);
+    uint64_t compress_ns = thread_cpu_ns() - start_time;
+
+    if (length == 0 || !send(blob.data(), length, BATCH_PROPERTIES))
+    {
+      std::lock_guard<std::mutex> lock(state_mutex);
+      stats.dropped += entries.size();
+      if (length > 0)
+        return false;
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    stats.batches++;
+    stats.batch_frames += entries.size();
+    stats.batch_bytes += length;
+    stats.compress_ns += compress_ns;
+  }
+
+  return true;
+}
+
+bool Gateway::send_passthrough()
+{
+  while (pending_count < MAX_PENDING)
+  {
+    passthrough_message message;
+
+    {
+      std::lock_guard<std::mutex> lock(state_mutex);
+      if (passthrough.empty())
+        return true;
+
+      message = std::move(passthrough.front());
+      passthrough.erase(passthrough.begin());
+    }
+
+    if (!send(message.payload.data(), message.payload.size(), message.properties.c_str()))
+    {
+      std::lock_guard<std::mutex> lock(state_mutex);
+      stats.dropped++;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void Gateway::uplink()
+{
+  uint64_t cpu_time = thread_cpu_ns();
+  uint64_t next_patch = now_ms() + config.patch_interval_ms;
+  current_gateway = this;
+
+  while (running)
+  {
+    if (!hub_connected)
+    {
+      hub_connected = connect_hub();
+      if (!hub_connected)
+      {
+        usleep(RECONNECT_DELAY_MS * 1000);
+        continue;
+      }
+    }
+
+    uint64_t now = now_ms();
+    uint32_t wait_ms = next_patch > now ? (uint32_t)(next_patch - now) : 0;
+    bool healthy = true;
+
+    // Woken at least every 100 ms for batches, passthrough and stopping
+    int32_t status = TLS_Socket_Wait(&hub_context, -1, wait_ms < 100 ? wait_ms : 100);
+    if (status < 0)
+      healthy = false;
+    else if (((status & tlsWAIT_READABLE) || status == 0) &&
+             AzureIoTHubClient_ProcessLoop(&hub_client, 0) != eAzureIoTSuccess)
+      healthy = false;
+
+    now = now_ms();
+    if (healthy && now >= next_patch)
+    {
+      healthy = send_patches(now);
+      next_patch += config.patch_interval_ms;
+      if (next_patch <= now)
+        next_patch = now + config.patch_interval_ms;
+    }
+    healthy = healthy && send_batches(now, false) && send_passthrough();
+
+    if (!healthy)
+    {
+      ESP_LOGW(TAG, "Lost the hub, reconnecting.");
+      TLS_Socket_Disconnect(&hub_context);
+      AzureIoTHubClient_Deinit(&hub_client);
+      hub_connected = false;
+    }
+
+    uint64_t cpu_now = thread_cpu_ns();
+    std::lock_guard<std::mutex> lock(state_mutex);
+    stats.cpu_ns += cpu_now - cpu_time;
+    cpu_time = cpu_now;
+  }
+
+  if (!hub_connected)
+    return;
+
+  // Everything received goes out before disconnecting, then the acknowledgements are collected
+  uint64_t now = now_ms();
+  bool healthy = send_patches(now + config.patch_interval_ms);
+  uint64_t drain_end = now + SEND_RECV_TIMEOUT_MS;
+
+  while (healthy && now_ms() < drain_end)
+  {
+    bool done;
+    {
+      std::lock_guard<std::mutex> lock(state_mutex);
+      done = batch.empty() && ready_batches.empty() && passthrough.empty();
+    }
+    if (done && pending_count == 0)
+      break;
+
+    healthy = send_batches(now_ms(), true) && send_passthrough();
+    if (healthy && TLS_Socket_Wait(&hub_context, -1, 10) > 0 &&
+        AzureIoTHubClient_ProcessLoop(&hub_client, 0) != eAzureIoTSuccess)
+      healthy = false;
+  }
+
+  if (healthy)
+    AzureIoTHubClient_Disconnect(&hub_client);
+  TLS_Socket_Disconnect(&hub_context);
+  AzureIoTHubClient_Deinit(&hub_client);
+  hub_connected = false;
+
+  std::lock_guard<std::mutex> lock(state_mutex);
+  stats.cpu_ns += thread_cpu_ns() - cpu_time;
+}
+
+/*-----------------------------------------------------------*/
+
+void Gateway::start()
+{
+  if (running)
+    return;
+
+  running = true;
+  ingest_thread = std::thread(&Gateway::ingest, this);
+  uplink_thread = std::thread(&Gateway::uplink, this);
+}
+
+// Stops taking telemetry, then flushes what was received upstream
+void Gateway::stop()
+{
+  if (!running)
+    return;
+
+  running = false;
+  ingest_thread.join();
+  uplink_thread.join();
+}
+
+gateway_stats Gateway::get_stats()
+{
+  std::lock_guard<std::mutex> lock(state_mutex);
+  gateway_stats current = stats;
+
+  current.twins = twins.size();
+  current.connected = local_connected && hub_connected;
+  return current;
+}
+
+/*-----------------------------------------------------------*/
+
+// Compressor sink growing the blob
+static bool append_blob(void *context, const uint8_t *data, uint32_t length)
+{
+  std::vector<uint8_t> *blob = static_cast<std::vector<uint8_t> *>(context);
+
+  blob->insert(blob->end(), data, data + length);
+  return true;
+}
+
+uint32_t compress_batch(StreamCompressor &compressor, std::vector<uint8_t> &dest, const std::vector<batch_entry> &entries)
+{
+  uint16_t count = entries.size();
+  bool complete = entries.size() <= UINT16_MAX;
+
+  dest.assign({'D', 'B', BATCH_VERSION, (StreamCompressor::WINDOW_BITS << 4) | StreamCompressor::LOOKAHEAD_BITS});
+  compressor.begin(append_blob, &dest);
+  complete = complete && compressor.write(&count, sizeof(count));
+
+  for (const batch_entry &entry : entries)
+  {
+    uint8_t id_length = entry.device_id.size();
+
+    complete = complete &&
+               compressor.write(&id_length, sizeof(id_length)) &&
+               compressor.write(entry.device_id.data(), id_length) &&
+               compressor.write(&entry.motor, sizeof(entry.motor)) &&
+               compress_columns(compressor, get_frame_columns(entry.frame), entry.frame.count);
+  }
+
+  complete = compressor.finish() && complete;
+  return complete ? dest.size() : 0;
+}
+
+bool decode_batch(const uint8_t *data, size_t length, std::vector<batch_entry> &entries)
+{
+  std::vector<uint8_t> body;
+  size_t offset = sizeof(uint16_t);
+  uint16_t count;
+
+  entries.clear();
+  if (length < FRAME_HEADER_SIZE || data[0] != 'D' || data[1] != 'B' || data[2] != BATCH_VERSION)
+    return false;
+  // Batches are cut to compress into one message, uncompressed they are smaller than one too
+  if (!decompress(&data[FRAME_HEADER_SIZE], length - FRAME_HEADER_SIZE, data[3] >> 4, data[3] & 0x0F,
+                  Gateway::MAX_MESSAGE_SIZE, body) ||
+      body.size() < sizeof(count))
+    return false;
+
+  memcpy(&count, body.data(), sizeof(count));
+  entries.resize(count);
+
+  for (batch_entry &entry : entries)
+  {
+    if (offset >= body.size() || offset + 1 + body[offset] + 1 > body.size())
+      return false;
+
+    uint8_t id_length = body[offset];
+    entry.device_id.assign((const char *)&body[offset + 1], id_length);
+    entry.motor = body[offset + 1 + id_length];
+    offset += 1 + id_length + 1;
+
+    if (!decode_columns(body.data(), body.size(), &offset, entry.frame))
+      return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,207 @@
+#ifndef GATEWAY_H_
+#define GATEWAY_H_
+
+// Includes
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "compressor.hpp"
+#include "frame_decoder.hpp"
+
+extern "C"
+{
+#include "azure_iot_hub_client.h"
+#include "azure_iot_mqtt.h"
+#include "transport_tls_socket.h"
+#include "network_context.h"
+}
+
+// Edge aggregation gateway for a lab of stations. Frames and summaries the stations publish to a
+// local broker are decoded into the latest state of each twin and a cold-path batch. Upstream, one
+// device connection carries a coalesced patch of the twins that changed, at most once per patch
+// interval, and batches of every frame as one compressed blob. Other telemetry, such as captures,
+// is passed through with the station's properties and a "device" property naming the station.
+//
+// Batch layout, decoded by python_scripts/telemetry_codec.py:
+// "DB", version, window bits << 4 | lookahead bits, then compressed: frame count (u16) and per
+// frame the device id length (u8), device id, motor (u8) and the frame's column section, as
+// written by compress_columns().
+
+static constexpr uint8_t BATCH_VERSION = 1;
+
+typedef struct
+{
+  std::string local_host; // Broker the stations publish to
+  uint16_t local_port;
+  std::string hub_host;   // Upstream, IoT Hub or a stand-in
+  uint16_t hub_port;
+  std::string device_id;  // Identity of the gateway upstream
+  uint32_t patch_interval_ms;
+  uint32_t batch_interval_ms; // Longest a frame waits in a batch
+  uint32_t batch_bytes;       // Column bytes that complete a batch early
+} gateway_config;
+
+typedef struct
+{
+  uint64_t frames;        // Frames received from stations
+  uint64_t samples;
+  uint64_t summaries;
+  uint64_t passthrough;   // Other telemetry received and forwarded
+  uint64_t decode_errors; // Messages that were not what their properties said
+  uint64_t ingress_bytes;
+  uint64_t ingress_messages;
+
+  uint64_t patches;       // Coalesced twin patch messages sent
+  uint64_t twin_updates;  // Twin entries in those patches
+  uint64_t batches;
+  uint64_t batch_frames;
+  uint64_t batch_bytes;   // Compressed size of the batches
+  uint64_t egress_bytes;
+  uint64_t egress_messages;
+  uint64_t acks;
+  uint64_t dropped;       // Messages lost while upstream was unavailable or behind
+
+  uint64_t decode_ns;
+  uint64_t compress_ns;
+  uint64_t cpu_ns;        // CPU time of both gateway threads
+  uint32_t twins;
+  bool connected;         // Both connections are up
+} gateway_stats;
+
+// Latest state of one twin, a station's motor
+typedef struct
+{
+  std::string device_id;
+  uint8_t motor;
+  bool dirty;
+  uint64_t last_patch_ms;
+  uint64_t frames; // Since the last patch
+
+  // Last sample of the latest frame
+  bool has_sample;
+  uint64_t time;
+  float duty_cycle;
+  float velocity;
+  float position;
+  float current;
+
+  std::string summary; // Latest summary object as the station sent it, empty before the first
+} twin_state;
+
+typedef struct
+{
+  std::string device_id;
+  uint8_t motor;
+  decoded_frame frame;
+} batch_entry;
+
+typedef struct
+{
+  std::string properties; // Station properties with the device appended
+  std::vector<uint8_t> payload;
+} passthrough_message;
+
+class Gateway
+{
+private:
+  // Class variables
+  static constexpr uint32_t LOCAL_BUFFER_SIZE = 256 * 1024; // Holds the largest station publish
+  static constexpr uint32_t HUB_BUFFER_SIZE = 5120;         // Blobs are streamed, not buffered
+  static constexpr uint32_t MAX_PROPERTIES_SIZE = 256;
+  static constexpr uint8_t MAX_PENDING = 8;                 // Leaves MQTT_STATE_ARRAY_MAX_COUNT room
+  static constexpr uint8_t MAX_READY_BATCHES = 4;
+  static constexpr uint32_t MAX_PASSTHROUGH = 64;
+  static constexpr uint32_t SEND_RECV_TIMEOUT_MS = 2000;
+  static constexpr uint32_t RECV_TIMEOUT_MS = 10;
+  static constexpr uint32_t CONNACK_TIMEOUT_MS = 10000;
+  static constexpr uint32_t RECONNECT_DELAY_MS = 1000;
+  static constexpr uint16_t KEEP_ALIVE_S = 60;
+
+  gateway_config config;
+
+  std::atomic<bool> running;
+  std::atomic<bool> local_connected;
+  std::atomic<bool> hub_connected;
+  std::thread ingest_thread;
+  std::thread uplink_thread;
+
+  // Local subscriber, the ingest thread only
+  AzureIoTMQTT_t local_mqtt;
+  NetworkContext local_context;
+  TlsTransportParams_t local_tls_params;
+  AzureIoTTransportInterface_t local_transport;
+  std::vector<uint8_t> local_buffer;
+  decoded_frame frame;
+
+  // Upstream device, the uplink thread only
+  AzureIoTHubClient_t hub_client;
+  NetworkContext hub_context;
+  TlsTransportParams_t hub_tls_params;
+  AzureIoTTransportInterface_t hub_transport;
+  std::vector<uint8_t> hub_buffer;
+  uint16_t pending[MAX_PENDING];
+  uint8_t pending_count;
+  std::vector<uint8_t> compressor_buffer;
+  StreamCompressor compressor;
+  std::vector<uint8_t> blob;
+  std::vector<char> patch;
+  const uint8_t *stream_data;
+  size_t stream_length;
+  size_t stream_offset;
+
+  // Shared by both threads
+  std::mutex state_mutex;
+  std::unordered_map<std::string, twin_state> twins;
+  std::vector<batch_entry> batch;
+  uint32_t batch_size;
+  uint64_t batch_start_ms;
+  std::vector<std::vector<batch_entry>> ready_batches;
+  std::vector<passthrough_message> passthrough;
+  gateway_stats stats;
+
+  static thread_local Gateway *current_gateway;
+
+  static uint64_t now_ms();
+  static uint64_t thread_cpu_ns();
+  static uint32_t get_time_ms();
+  static uint64_t get_unix_time();
+  static void handle_local_event(AzureIoTMQTTHandle_t context, AzureIoTMQTTPacketInfo_t *packet,
+                                 AzureIoTMQTTDeserializedInfo_t *info);
+  static void handle_puback(uint16_t packet_id);
+  static size_t produce_payload(void *context, uint8_t *buffer, size_t size);
+
+  bool connect_local();
+  void receive(const char *topic, size_t topic_length, const uint8_t *payload, size_t length);
+  void add_frame(const std::string &device_id, uint8_t motor);
+  void add_summary(const std::string &device_id, uint8_t motor, const char *text, size_t length);
+  void ingest();
+
+  bool connect_hub();
+  bool send(const uint8_t *payload, size_t length, const char *properties);
+  bool send_patches(uint64_t now);
+  bool send_batches(uint64_t now, bool flush);
+  bool send_passthrough();
+  void uplink();
+
+public:
+  static constexpr uint32_t MAX_MESSAGE_SIZE = 256 * 1024; // IoT Hub device-to-cloud limit
+
+  Gateway(const gateway_config &config);
+  ~Gateway();
+
+  void start();
+  void stop();
+
+  gateway_stats get_stats();
+};
+
+// Compressed batch of frames, and its decoder for tools and tests
+uint32_t compress_batch(StreamCompressor &compressor, std::vector<uint8_t> &dest, const std::vector<batch_entry> &entries);
+bool decode_batch(const uint8_t *data, size_t length, std::vector<batch_entry> &entries);
+
+#endif // GATEWAY_H_
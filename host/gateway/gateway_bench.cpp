@@ -0,0 +1,281 @@
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+
+#include "gateway.hpp"
+#include "motor_model.hpp"
+#include "mqtt_broker.hpp"
+#include "station.hpp"
+
+extern "C"
+{
+#include "azure_iot.h"
+}
+
+// Gateway throughput: decoding and batching on their own, then a lab of stations through the
+// gateway into a hub stand-in, compared with the same stations publishing to the hub directly.
+
+static constexpr uint16_t FRAME_SAMPLES = 500;
+static constexpr uint32_t BATCH_FRAMES = 16;
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --stations N            Stations behind the gateway (default 30)\n"
+          "  --duration S            Seconds the stations publish for (default 10)\n"
+          "  --encoding E            Frame encoding, json or compressed (default json)\n"
+          "  --patch-interval-ms N   Gateway patch interval (default 1000)\n"
+          "  --iterations N          Decode iterations of the single-thread benchmarks (default 2000)\n",
+          name);
+}
+
+static uint64_t now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// One frame of a motor stepping between set points, as a station would sample it
+static void make_frame(decoded_frame &frame, uint32_t seed)
+{
+  MotorModel motor(seed);
+
+  frame.count = FRAME_SAMPLES;
+  frame.timestamp.resize(FRAME_SAMPLES);
+  frame.gain.resize(FRAME_SAMPLES);
+  frame.duty_cycle.resize(FRAME_SAMPLES);
+  frame.velocity.resize(FRAME_SAMPLES);
+  frame.position.resize(FRAME_SAMPLES);
+  frame.current.resize(FRAME_SAMPLES);
+
+  for (uint16_t i = 0; i < FRAME_SAMPLES; i++)
+  {
+    motor.set_velocity_sp(i < FRAME_SAMPLES / 2 ? 60 : 120);
+    motor.step(0.001f);
+    frame.timestamp[i] = 1700000000000ULL + i;
+    frame.gain[i] = motor.get_gain();
+    frame.duty_cycle[i] = motor.get_duty_cycle();
+    frame.velocity[i] = motor.get_velocity();
+    frame.position[i] = motor.get_position();
+    frame.current[i] = motor.get_current();
+  }
+}
+
+static void bench_codecs(uint32_t iterations)
+{
+  std::vector<uint8_t> compressor_buffer(StreamCompressor::BUFFER_SIZE);
+  StreamCompressor compressor;
+  decoded_frame source;
+  decoded_frame decoded;
+  std::vector<char> json(256 * 1024);
+  std::vector<char> compressed(FRAME_HEADER_SIZE + StreamCompressor::bound(frame_columns_size(FRAME_SAMPLES)));
+
+  compressor.init(compressor_buffer.data());
+  make_frame(source, 1);
+
+  uint32_t json_length = format_frame(json.data(), json.size(), get_frame_columns(source), FRAME_SAMPLES);
+  uint32_t compressed_length = compress_frame(compressor, compressed.data(), compressed.size(),
+                                              get_frame_columns(source), FRAME_SAMPLES);
+
+  uint64_t start = now_ns();
+  for (uint32_t i = 0; i < iterations; i++)
+    decode_json_frame(json.data(), json_length, decoded);
+  double json_s = (now_ns() - start) / 1e9;
+
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; i++)
+    decode_compressed_frame((const uint8_t *)compressed.data(), compressed_length, decoded);
+  double compressed_s = (now_ns() - start) / 1e9;
+
+  std::vector<batch_entry> entries;
+  for (uint32_t i = 0; i < BATCH_FRAMES; i++)
+  {
+    entries.push_back({"dtmc-" + std::to_string(i), 0, {}});
+    make_frame(entries.back().frame, i);
+  }
+
+  std::vector<uint8_t> blob;
+  uint32_t batch_iterations = iterations / BATCH_FRAMES > 0 ? iterations / BATCH_FRAMES : 1;
+  uint32_t blob_length = 0;
+  start = now_ns();
+  for (uint32_t i = 0; i < batch_iterations; i++)
+    blob_length = compress_batch(compressor, blob, entries);
+  double batch_s = (now_ns() - start) / 1e9;
+
+  std::vector<batch_entry> batch_decoded;
+  start = now_ns();
+  for (uint32_t i = 0; i < batch_iterations; i++)
+    decode_batch(blob.data(), blob_length, batch_decoded);
+  double unbatch_s = (now_ns() - start) / 1e9;
+
+  uint32_t raw_frame = frame_columns_size(FRAME_SAMPLES);
+  printf("Frames of %u samples, one thread\n", FRAME_SAMPLES);
+  printf("  JSON decode:        %8.0f frames/s, %7.1f MB/s (%u bytes)\n",
+         iterations / json_s, iterations * (double)json_length / json_s / 1e6, json_length);
+  printf("  Compressed decode:  %8.0f frames/s, %7.1f MB/s (%u bytes)\n",
+         iterations / compressed_s, iterations * (double)compressed_length / compressed_s / 1e6, compressed_length);
+  printf("  Batch compress:     %8.0f frames/s, %7.1f MB/s of columns, %u frames in %u bytes (%.1fx)\n",
+         batch_iterations * BATCH_FRAMES / batch_s, batch_iterations * BATCH_FRAMES * (double)raw_frame / batch_s / 1e6,
+         BATCH_FRAMES, blob_length, BATCH_FRAMES * (double)raw_frame / blob_length);
+  printf("  Batch decode:       %8.0f frames/s\n", batch_iterations * BATCH_FRAMES / unbatch_s);
+}
+
+typedef struct
+{
+  uint64_t messages;
+  uint64_t frames;
+  uint64_t summaries;
+  uint64_t bytes;
+  bool connected;
+} lab_result;
+
+static lab_result run_stations(const station_config &config, uint32_t count)
+{
+  std::vector<std::unique_ptr<Station>> stations;
+  lab_result result = {0, 0, 0, 0, true};
+
+  for (uint32_t i = 0; i < count; i++)
+    stations.emplace_back(new Station(i, config));
+  for (auto &station : stations)
+    station->start();
+  for (auto &station : stations)
+  {
+    station->join();
+    const station_stats &stats = station->get_stats();
+    result.connected = result.connected && stats.connected && !stats.failed;
+    result.frames += stats.frames;
+    result.summaries += stats.summaries;
+    result.messages += stats.frames + stats.summaries;
+    result.bytes += stats.frame_bytes + stats.summary_bytes;
+  }
+
+  return result;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t station_count = 30;
+  uint32_t duration_ms = 10000;
+  uint32_t patch_interval_ms = 1000;
+  uint32_t iterations = 2000;
+  FrameEncoding encoding = ENCODING_JSON;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--stations") == 0 && has_value)
+      station_count = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--duration") == 0 && has_value)
+      duration_ms = (uint32_t)(atof(argv[++i]) * 1000);
+    else if (strcmp(argv[i], "--encoding") == 0 && has_value && strcmp(argv[i + 1], "json") == 0)
+      encoding = ENCODING_JSON, i++;
+    else if (strcmp(argv[i], "--encoding") == 0 && has_value && strcmp(argv[i + 1], "compressed") == 0)
+      encoding = ENCODING_COMPRESSED, i++;
+    else if (strcmp(argv[i], "--patch-interval-ms") == 0 && has_value)
+      patch_interval_ms = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--iterations") == 0 && has_value)
+      iterations = atoi(argv[++i]);
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (station_count == 0 || iterations == 0)
+  {
+    print_usage(argv[0]);
+    return 2;
+  }
+
+  bench_codecs(iterations);
+
+  if (AzureIoT_Init() != eAzureIoTSuccess)
+    return 1;
+
+  MqttBroker hub;
+  MqttBroker local;
+  if (!hub.start(0) || !local.start(0))
+    return 1;
+
+  station_config config = {
+      .host = "127.0.0.1",
+      .port = hub.get_port(),
+      .encoding = encoding,
+      .sample_rate = 1000,
+      .frame_samples = FRAME_SAMPLES,
+      .summaries = true,
+      .duration_ms = duration_ms,
+  };
+
+  // Every station straight to the hub, what IoT Hub and the Function App see today
+  lab_result direct = run_stations(config, station_count);
+  broker_stats direct_hub = hub.get_stats();
+
+  gateway_config gateway_settings = {
+      .local_host = "127.0.0.1",
+      .local_port = local.get_port(),
+      .hub_host = "127.0.0.1",
+      .hub_port = hub.get_port(),
+      .device_id = "dtmc-gateway",
+      .patch_interval_ms = patch_interval_ms,
+      .batch_interval_ms = 10000,
+      .batch_bytes = 224 * 1024,
+  };
+  Gateway gateway(gateway_settings);
+  gateway.start();
+  for (uint32_t i = 0; i < 100 && !gateway.get_stats().connected; i++)
+    usleep(10000);
+
+  config.port = local.get_port();
+  uint64_t start = now_ns();
+  lab_result gated = run_stations(config, station_count);
+
+  for (uint32_t waited = 0; waited < 5000; waited += 10)
+  {
+    gateway_stats stats = gateway.get_stats();
+    if (stats.frames + stats.summaries + stats.decode_errors >= gated.messages)
+      break;
+    usleep(10000);
+  }
+  gateway.stop();
+  double seconds = (now_ns() - start) / 1e9;
+
+  gateway_stats stats = gateway.get_stats();
+  broker_stats gated_hub = hub.get_stats();
+  local.stop();
+  hub.stop();
+  AzureIoT_Deinit();
+
+  double duration_s = duration_ms / 1000.0;
+  uint64_t hub_messages = gated_hub.publishes - direct_hub.publishes;
+  uint64_t hub_bytes = gated_hub.payload_bytes - direct_hub.payload_bytes;
+
+  printf("\n%u stations, %s frames of %u samples at 1000 Hz, %.1f s\n", station_count,
+         encoding == ENCODING_COMPRESSED ? "compressed" : "JSON", FRAME_SAMPLES, duration_s);
+  printf("  Direct:   %7.1f hub messages/s, %7.1f kB/s, %7.1f twin writes/s\n",
+         direct.messages / duration_s, direct.bytes / 1e3 / duration_s, direct.summaries / duration_s);
+  printf("  Gateway:  %7.1f hub messages/s, %7.1f kB/s, %7.1f twin writes/s (%llu patches, %llu batches)\n",
+         hub_messages / duration_s, hub_bytes / 1e3 / duration_s, stats.twin_updates / duration_s,
+         (unsigned long long)stats.patches, (unsigned long long)stats.batches);
+  printf("  Reduction: %.1fx messages, %.1fx bytes, %.1fx twin writes\n",
+         hub_messages > 0 ? (double)direct.messages / hub_messages : 0,
+         hub_bytes > 0 ? (double)direct.bytes / hub_bytes : 0,
+         stats.twin_updates > 0 ? (double)direct.summaries / stats.twin_updates : 0);
+  printf("  Gateway:  %llu of %llu frames batched, %llu dropped, %llu undecodable, CPU %.2f%% of a core\n",
+         (unsigned long long)stats.batch_frames, (unsigned long long)gated.frames,
+         (unsigned long long)stats.dropped, (unsigned long long)stats.decode_errors, 100.0 * stats.cpu_ns / 1e9 / seconds);
+  printf("            decode %.1f us per frame, compress %.1f us per frame\n",
+         stats.frames > 0 ? stats.decode_ns / 1e3 / stats.frames : 0.0,
+         stats.batch_frames > 0 ? stats.compress_ns / 1e3 / stats.batch_frames : 0.0);
+
+  return direct.connected && gated.connected && stats.batch_frames == gated.frames ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+// Includes
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "check.hpp"
+#include "frame_decoder.hpp"
+#include "gateway.hpp"
+#include "mqtt_broker.hpp"
+#include "station.hpp"
+
+extern "C"
+{
+#include "azure_iot.h"
+}
+
+// Integration test: stations with JSON and compressed frames publish to a local broker, the gateway
+// aggregates them and a second broker stands in for the hub. Every frame must reach the hub exactly
+// once in a batch, each twin must be patched with its latest summary, and far fewer messages may
+// leave the gateway than arrived. Compressed frames are first decoded on their own: heatshrink
+// parameters other than the firmware's, and a stream that expands past the largest frame, must be
+// refused.
+
+static constexpr uint32_t STATION_COUNT = 6;
+static constexpr uint32_t DURATION_MS = 2000;
+static constexpr uint32_t PATCH_INTERVAL_MS = 250;
+static constexpr uint32_t BATCH_INTERVAL_MS = 500;
+static constexpr uint32_t SETTLE_TIMEOUT_MS = 5000;
+
+typedef struct
+{
+  std::string topic;
+  std::vector<uint8_t> payload;
+} upstream_message;
+
+// Heatshrink stream writer, most significant bit first
+typedef struct
+{
+  std::vector<uint8_t> bytes;
+  uint64_t bits;
+} bit_writer;
+
+static void write_bits(bit_writer &writer, uint32_t value, uint8_t count)
+{
+  for (int8_t i = count - 1; i >= 0; i--, writer.bits++)
+  {
+    if ((writer.bits & 7) == 0)
+      writer.bytes.push_back(0);
+    writer.bytes.back() |= ((value >> i) & 1) << (7 - (writer.bits & 7));
+  }
+}
+
+static void check_malformed_frames()
+{
+  std::vector<float> zeros(1, 0);
+  uint64_t timestamp = 1;
+  frame_columns columns = {&timestamp, zeros.data(), zeros.data(), zeros.data(), zeros.data(), zeros.data()};
+  std::vector<uint8_t> compressor_buffer(StreamCompressor::BUFFER_SIZE);
+  std::vector<uint8_t> frame(FRAME_HEADER_SIZE + StreamCompressor::bound(frame_columns_size(1)));
+  StreamCompressor compressor;
+  decoded_frame decoded;
+
+  compressor.init(compressor_buffer.data());
+  uint32_t length = compress_frame(compressor, (char *)frame.data(), frame.size(), columns, 1);
+  frame.resize(length);
+  check(length > 0 && decode_compressed_frame(frame.data(), frame.size(), decoded) && decoded.count == 1,
+        "a compressed frame decodes");
+
+  // Window and lookahead bits are the high and low nibble of the fourth byte
+  bool refused = true;
+  for (uint8_t parameters : {0x00, 0x80, 0x04, 0x48, 0x88, 0xF4, 0x83, 0x94, 0xFF})
+  {
+    frame[3] = parameters;
+    refused = refused && !decode_compressed_frame(frame.data(), frame.size(), decoded);
+  }
+  check(refused, "frames with other heatshrink parameters are refused");
+
+  // One literal and then back-references of 16 bytes to it, about 3 MB past the largest frame
+  bit_writer bomb = {{'D', 'T', FRAME_VERSION, (StreamCompressor::WINDOW_BITS << 4) | StreamCompressor::LOOKAHEAD_BITS}, 32};
+  write_bits(bomb, 1, 1);
+  write_bits(bomb, 0, 8);
+  for (size_t expanded = 1; expanded <= 2 * MAX_FRAME_COLUMNS_SIZE; expanded += StreamCompressor::LOOKAHEAD_SIZE)
+  {
+    write_bits(bomb, 0, 1);
+    write_bits(bomb, 0, StreamCompressor::WINDOW_BITS);
+    write_bits(bomb, StreamCompressor::LOOKAHEAD_SIZE - 1, StreamCompressor::LOOKAHEAD_BITS);
+  }
+
+  std::vector<uint8_t> output;
+  bool expanded = decompress(&bomb.bytes[FRAME_HEADER_SIZE], bomb.bytes.size() - FRAME_HEADER_SIZE,
+                             StreamCompressor::WINDOW_BITS, StreamCompressor::LOOKAHEAD_BITS, MAX_FRAME_COLUMNS_SIZE,
+                             output);
+  check(!expanded && output.size() <= MAX_FRAME_COLUMNS_SIZE, "decompression stops at the largest frame");
+  check(!decode_compressed_frame(bomb.bytes.data(), bomb.bytes.size(), decoded),
+        "a frame that expands past the largest frame is refused");
+}
+
+int main()
+{
+  std::mutex upstream_mutex;
+  std::vector<upstream_message> upstream;
+
+  check_malformed_frames();
+
+  if (AzureIoT_Init() != eAzureIoTSuccess)
+    return 1;
+
+  MqttBroker hub;
+  MqttBroker local;
+  hub.set_observer([&](const std::string &topic, const uint8_t *payload, uint32_t length)
+                   {
+                     std::lock_guard<std::mutex> lock(upstream_mutex);
+                     upstream.push_back({topic, std::vector<uint8_t>(payload, payload + length)});
+                   });
+  if (!hub.start(0) || !local.start(0))
+    return 1;
+
+  gateway_config config = {
+      .local_host = "127.0.0.1",
+      .local_port = local.get_port(),
+      .hub_host = "127.0.0.1",
+      .hub_port = hub.get_port(),
+      .device_id = "dtmc-gateway",
+      .patch_interval_ms = PATCH_INTERVAL_MS,
+      .batch_interval_ms = BATCH_INTERVAL_MS,
+      .batch_bytes = 64 * 1024,
+  };
+  Gateway gateway(config);
+  gateway.start();
+
+  for (uint32_t i = 0; i < 100 && !gateway.get_stats().connected; i++)
+    usleep(10000);
+  check(gateway.get_stats().connected, "gateway connects to the local broker and the hub");
+
+  station_config json_config = {
+      .host = "127.0.0.1",
+      .port = local.get_port(),
+      .encoding = ENCODING_JSON,
+      .sample_rate = 1000,
+      .frame_samples = 100,
+      .summaries = true,
+      .duration_ms = DURATION_MS,
+  };
+  station_config compressed_config = json_config;
+  compressed_config.encoding = ENCODING_COMPRESSED;
+
+  std::vector<std::unique_ptr<Station>> stations;
+  for (uint32_t i = 0; i < STATION_COUNT; i++)
+    stations.emplace_back(new Station(i, i % 2 == 0 ? json_config : compressed_config));
+  for (auto &station : stations)
+    station->start();
+  for (auto &station : stations)
+    station->join();
+
+  uint64_t sent_frames = 0;
+  uint64_t sent_summaries = 0;
+  uint64_t sent_messages = 0;
+  bool all_connected = true;
+  for (auto &station : stations)
+  {
+    const station_stats &stats = station->get_stats();
+    all_connected = all_connected && stats.connected && !stats.failed;
+    sent_frames += stats.frames;
+    sent_summaries += stats.summaries;
+    sent_messages += stats.frames + stats.summaries;
+  }
+  check(all_connected, "every station connects and publishes");
+  check(sent_frames > 0, "stations publish frames");
+
+  // The local broker forwards at QoS 0, wait for the gateway to take everything in
+  for (uint32_t waited = 0; waited < SETTLE_TIMEOUT_MS; waited += 10)
+  {
+    gateway_stats stats = gateway.get_stats();
+    if (stats.frames + stats.summaries + stats.decode_errors >= sent_messages)
+      break;
+    usleep(10000);
+  }
+  gateway.stop();
+  local.stop();
+  hub.stop();
+
+  gateway_stats stats = gateway.get_stats();
+  check(stats.frames == sent_frames, "gateway decodes every frame");
+  check(stats.summaries == sent_summaries, "gateway takes every summary");
+  check(stats.decode_errors == 0, "no decode errors");
+  check(stats.dropped == 0, "nothing dropped");
+  check(stats.twins == STATION_COUNT, "one twin per station");
+  check(stats.acks == stats.egress_messages, "hub acknowledges every upstream message");
+
+  // Batches carry every frame once, in order per station
+  std::map<std::string, uint64_t> last_timestamp;
+  std::map<std::string, std::string> last_patch;
+  uint64_t batch_frames = 0;
+  uint64_t batch_samples = 0;
+  uint32_t patches = 0;
+  bool batches_decode = true;
+  bool in_order = true;
+
+  for (const upstream_message &message : upstream)
+  {
+    if (message.topic.find("type=batch") != std::string::npos)
+    {
+      std::vector<batch_entry> entries;
+      batches_decode = batches_decode && decode_batch(message.payload.data(), message.payload.size(), entries);
+
+      for (const batch_entry &entry : entries)
+      {
+        uint64_t &last = last_timestamp[entry.device_id];
+        for (uint16_t i = 0; i < entry.frame.count; i++)
+        {
+          in_order = in_order && entry.frame.timestamp[i] >= last;
+          last = entry.frame.timestamp[i];
+        }
+        batch_frames++;
+        batch_samples += entry.frame.count;
+      }
+    }
+    else if (message.topic.find("type=twins") != std::string::npos)
+    {
+      std::string text(message.payload.begin(), message.payload.end());
+      patches++;
+
+      for (uint32_t i = 0; i < STATION_COUNT; i++)
+      {
+        std::string device = "\"device\":\"dtmc-" + std::to_string(i) + "\"";
+        size_t start = text.find(device);
+        if (start != std::string::npos)
+          last_patch[device] = text.substr(start, text.find("}}}", start) - start);
+      }
+    }
+  }
+
+  check(batches_decode, "every batch decodes");
+  check(batch_frames == sent_frames, "batches hold every frame exactly once");
+  check(batch_samples == sent_frames * json_config.frame_samples, "batches hold every sample");
+  check(in_order, "batched timestamps are in order per station");
+  check(last_timestamp.size() == STATION_COUNT, "every station is batched");
+
+  bool all_patched = last_patch.size() == STATION_COUNT;
+  for (auto &entry : last_patch)
+    all_patched = all_patched && entry.second.find("\"summary\":{") != std::string::npos &&
+                  entry.second.find("\"latest\":{") != std::string::npos;
+  check(all_patched, "every twin is patched with its latest sample and summary");
+  check(patches <= DURATION_MS / PATCH_INTERVAL_MS + 4, "patches are bounded by the patch interval");
+  check(stats.egress_messages * 4 < sent_messages, "gateway sends a quarter of the messages it receives or fewer");
+
+  printf("%llu station messages in, %llu messages out (%u patches, %llu batches), %.1f kB in, %.1f kB out\n",
+         (unsigned long long)sent_messages, (unsigned long long)stats.egress_messages, patches,
+         (unsigned long long)stats.batches, stats.ingress_bytes / 1000.0, stats.egress_bytes / 1000.0);
+
+  AzureIoT_Deinit();
+  return check_summary();
+}
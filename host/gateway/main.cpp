@@ -0,0 +1,147 @@
+// Includes
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gateway.hpp"
+#include "mqtt_broker.hpp"
+#include "esp_log.h"
+
+extern "C"
+{
+#include "azure_iot.h"
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_signal(int signal)
+{
+  (void)signal;
+  stop_requested = 1;
+}
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --listen-port N         Port of the stations' broker, run in this process (default 1883)\n"
+          "  --local-host H          Subscribe to an existing broker instead of running one\n"
+          "  --local-port N          Port of that broker (default 1883)\n"
+          "  --hub-host H            Upstream host (default 127.0.0.1)\n"
+          "  --hub-port N            Upstream port (default 1884)\n"
+          "  --device-id ID          Identity of the gateway upstream (default dtmc-gateway)\n"
+          "  --patch-interval-ms N   Shortest time between patches of one twin (default 1000)\n"
+          "  --batch-interval-ms N   Longest a frame waits for its batch (default 10000)\n"
+          "  --batch-kb N            Frame data that completes a batch early (default 224)\n"
+          "  --stats                 Print ingress and egress rates every second\n"
+          "  --verbose               Log connections\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  gateway_config config = {
+      .local_host = "127.0.0.1",
+      .local_port = 1883,
+      .hub_host = "127.0.0.1",
+      .hub_port = 1884,
+      .device_id = "dtmc-gateway",
+      .patch_interval_ms = 1000,
+      .batch_interval_ms = 10000,
+      .batch_bytes = 224 * 1024,
+  };
+  bool embedded_broker = true;
+  bool print_stats = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--listen-port") == 0 && has_value)
+      config.local_port = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--local-host") == 0 && has_value)
+      config.local_host = argv[++i], embedded_broker = false;
+    else if (strcmp(argv[i], "--local-port") == 0 && has_value)
+      config.local_port = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--hub-host") == 0 && has_value)
+      config.hub_host = argv[++i];
+    else if (strcmp(argv[i], "--hub-port") == 0 && has_value)
+      config.hub_port = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--device-id") == 0 && has_value)
+      config.device_id = argv[++i];
+    else if (strcmp(argv[i], "--patch-interval-ms") == 0 && has_value)
+      config.patch_interval_ms = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--batch-interval-ms") == 0 && has_value)
+      config.batch_interval_ms = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--batch-kb") == 0 && has_value)
+      config.batch_bytes = atoi(argv[++i]) * 1024;
+    else if (strcmp(argv[i], "--stats") == 0)
+      print_stats = true;
+    else if (strcmp(argv[i], "--verbose") == 0)
+      esp_log_level_set("*", ESP_LOG_INFO);
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  if (AzureIoT_Init() != eAzureIoTSuccess)
+    return 1;
+
+  // The lab's stations connect to the gateway, which answers their twin requests as the hub would
+  MqttBroker broker;
+  if (embedded_broker)
+  {
+    if (!broker.start(config.local_port, 0, true))
+      return 1;
+    config.local_host = "127.0.0.1";
+    config.local_port = broker.get_port();
+
+    // The port goes to stdout so scripts can start the gateway on port 0
+    printf("%u\n", config.local_port);
+    fflush(stdout);
+  }
+
+  Gateway gateway(config);
+  gateway.start();
+
+  gateway_stats prev = gateway.get_stats();
+
+  while (!stop_requested)
+  {
+    sleep(1);
+
+    gateway_stats stats = gateway.get_stats();
+    if (print_stats)
+      fprintf(stderr, "%s, %u twins, in %llu msg/s %.1f kB/s, out %llu msg/s %.1f kB/s, %llu patches/s, %llu dropped\n",
+              stats.connected ? "connected" : "connecting", stats.twins,
+              (unsigned long long)(stats.ingress_messages - prev.ingress_messages),
+              (stats.ingress_bytes - prev.ingress_bytes) / 1000.0,
+              (unsigned long long)(stats.egress_messages - prev.egress_messages),
+              (stats.egress_bytes - prev.egress_bytes) / 1000.0,
+              (unsigned long long)(stats.patches - prev.patches),
+              (unsigned long long)stats.dropped);
+    prev = stats;
+  }
+
+  gateway.stop();
+  broker.stop();
+
+  gateway_stats stats = gateway.get_stats();
+  printf("In:  %llu frames, %llu summaries, %llu other, %llu undecodable, %.2f MB\n",
+         (unsigned long long)stats.frames, (unsigned long long)stats.summaries,
+         (unsigned long long)stats.passthrough, (unsigned long long)stats.decode_errors, stats.ingress_bytes / 1e6);
+  printf("Out: %llu patches of %llu twin updates, %llu batches of %llu frames, %.2f MB, %llu dropped\n",
+         (unsigned long long)stats.patches, (unsigned long long)stats.twin_updates,
+         (unsigned long long)stats.batches, (unsigned long long)stats.batch_frames,
+         stats.egress_bytes / 1e6, (unsigned long long)stats.dropped);
+
+  AzureIoT_Deinit();
+  return 0;
+}
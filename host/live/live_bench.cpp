@@ -0,0 +1,218 @@
+// Includes
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "live_station.hpp"
+#include "ws_client.hpp"
+
+// Live server load on loopback: a simulated station at 1 kHz per motor serves many reading
+// clients and some that connect and never read. Reports each reading client's rate, the latency
+// from a sample's timestamp to its receipt (the timestamps have ms resolution), and whether the
+// stalled clients cost the others any samples.
+
+static constexpr uint32_t READ_TIMEOUT_MS = 100;
+static constexpr int STALLED_BUFFER = 4096; // So a stalled client falls behind within the run
+
+typedef struct
+{
+  bool connected;
+  uint64_t messages;
+  uint64_t samples;
+  uint64_t skipped; // Reported by the server in the messages' headers
+  uint64_t gaps;    // Sequences missing without being reported skipped
+  uint16_t max_decimation;
+  std::vector<uint32_t> latency_us;
+} client_stats;
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --clients N     Reading clients (default 100)\n"
+          "  --slow N        Clients that never read (default 10)\n"
+          "  --motors N      Simulated motors, clients are spread over them (default 2)\n"
+          "  --decimate N    Every Nth sample (default 1)\n"
+          "  --flush-ms N    Send period (default 20)\n"
+          "  --duration S    Seconds to stream for (default 5)\n",
+          name);
+}
+
+static uint64_t now_unix_us()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double fraction)
+{
+  if (sorted.empty())
+    return 0;
+
+  size_t rank = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+  return sorted[rank];
+}
+
+static void read_client(uint16_t port, uint8_t motor, uint32_t decimation, const std::atomic<bool> &running,
+                        client_stats *stats)
+{
+  char path[64];
+  uint8_t opcode;
+  std::vector<uint8_t> payload;
+  live_message message;
+  uint32_t expected = UINT32_MAX;
+
+  snprintf(path, sizeof(path), "/live?motor=%u&decimate=%u", motor, decimation);
+  int fd = ws_open(port, path, READ_TIMEOUT_MS * 20);
+  stats->connected = fd >= 0;
+  if (fd < 0)
+    return;
+
+  while (running)
+  {
+    if (!ws_read(fd, &opcode, &payload))
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        continue;
+      break;
+    }
+    if (opcode != 0x2 || !ws_decode_live(payload, &message) || message.samples.empty())
+      continue;
+
+    uint64_t received = now_unix_us();
+    stats->latency_us.push_back((uint32_t)(received - message.samples.back().timestamp * 1000));
+    stats->messages++;
+    stats->samples += message.samples.size();
+    stats->skipped += message.skipped;
+    stats->max_decimation = std::max(stats->max_decimation, message.decimation);
+
+    // Samples not sent are counted in skipped, anything else missing is a gap
+    if (expected != UINT32_MAX && message.skipped == 0 && message.sequence != expected)
+      stats->gaps++;
+    expected = message.sequence + (uint32_t)message.samples.size() * message.decimation;
+  }
+
+  close(fd);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t client_count = 100;
+  uint32_t slow_count = 10;
+  uint32_t motor_count = 2;
+  uint32_t decimation = 1;
+  uint32_t flush_ms = 20;
+  double duration = 5;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--clients") == 0 && has_value)
+      client_count = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--slow") == 0 && has_value)
+      slow_count = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--motors") == 0 && has_value)
+      motor_count = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--decimate") == 0 && has_value)
+      decimation = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--flush-ms") == 0 && has_value)
+      flush_ms = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--duration") == 0 && has_value)
+      duration = atof(argv[++i]);
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  // select() bounds the descriptors the server can take
+  if (client_count + slow_count == 0 || client_count + slow_count > 900 || motor_count == 0 ||
+      motor_count > LIVE_MAX_MOTORS || decimation == 0 || decimation > LiveServer::MAX_DECIMATION ||
+      flush_ms == 0 || duration <= 0)
+  {
+    print_usage(argv[0]);
+    return 2;
+  }
+
+  LiveStation station(motor_count, client_count + slow_count, flush_ms);
+  if (!station.start(0, false))
+    return 1;
+
+  std::atomic<bool> running(true);
+  std::vector<client_stats> stats(client_count);
+  std::vector<std::thread> readers;
+  std::vector<int> slow_fds;
+
+  for (uint32_t i = 0; i < slow_count; i++)
+  {
+    char path[64];
+    snprintf(path, sizeof(path), "/live?motor=%u&decimate=%u", i % motor_count, decimation);
+    slow_fds.push_back(ws_open(station.get_port(), path, 2000, STALLED_BUFFER));
+  }
+  for (uint32_t i = 0; i < client_count; i++)
+    readers.emplace_back(read_client, station.get_port(), i % motor_count, decimation, std::cref(running), &stats[i]);
+
+  live_stats start = station.get_stats();
+  uint64_t produced = station.get_produced();
+  usleep((useconds_t)(duration * 1e6));
+  live_stats end = station.get_stats();
+  produced = station.get_produced() - produced;
+
+  running = false;
+  for (std::thread &reader : readers)
+    reader.join();
+  for (int fd : slow_fds)
+    if (fd >= 0)
+      close(fd);
+  station.stop();
+
+  // Totals over the reading clients
+  uint32_t connected = 0;
+  uint64_t samples = 0;
+  uint64_t skipped = 0;
+  uint64_t gaps = 0;
+  uint16_t max_decimation = 0;
+  std::vector<uint32_t> latencies;
+
+  for (client_stats &client : stats)
+  {
+    connected += client.connected;
+    samples += client.samples;
+    skipped += client.skipped;
+    gaps += client.gaps;
+    max_decimation = std::max(max_decimation, client.max_decimation);
+    latencies.insert(latencies.end(), client.latency_us.begin(), client.latency_us.end());
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  uint32_t slow_connected = std::count_if(slow_fds.begin(), slow_fds.end(), [](int fd) { return fd >= 0; });
+  double expected_rate = produced / duration / decimation;
+
+  printf("Live server: %u reading and %u stalled clients on %u motors, every %u of %.0f samples/s, "
+         "flushed every %u ms, %.1f s\n",
+         connected, slow_connected, motor_count, decimation, produced / duration, flush_ms, duration);
+  printf("  per reading client: %.0f samples/s (%.0f expected), latency p50 %.1f ms, p99 %.1f ms, "
+         "max %.1f ms\n",
+         connected > 0 ? samples / duration / connected : 0, expected_rate,
+         percentile(latencies, 0.5) / 1000.0, percentile(latencies, 0.99) / 1000.0,
+         latencies.empty() ? 0 : latencies.back() / 1000.0);
+  printf("  reading clients: %llu samples skipped, %llu gaps, decimation up to %u\n",
+         (unsigned long long)skipped, (unsigned long long)gaps, max_decimation);
+  printf("  server: %llu messages/s, %.1f MB/s, %llu samples skipped for stalled clients, "
+         "%llu dropped from full rings\n",
+         (unsigned long long)((end.messages - start.messages) / duration),
+         (end.bytes - start.bytes) / duration / 1e6,
+         (unsigned long long)(end.skipped - start.skipped - skipped),
+         (unsigned long long)station.get_dropped());
+
+  return connected == client_count && slow_connected == slow_count ? 0 : 1;
+}
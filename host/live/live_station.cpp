@@ -0,0 +1,135 @@
+// Includes
+#include "live_station.hpp"
+
+#include <chrono>
+
+LiveStation::LiveStation(uint8_t motor_count, uint16_t max_clients, uint32_t flush_ms)
+    : ring_storage(motor_count * RING_SIZE), rings(new LiveRing[motor_count]), pool(max_clients),
+      batch(LiveServer::BATCH_SIZE)
+{
+  this->flush_ms = flush_ms;
+  running = false;
+  produced = 0;
+
+  server.init(pool.data(), max_clients, batch.data());
+  for (uint8_t i = 0; i < motor_count; i++)
+  {
+    motors.emplace_back(i);
+    motors[i].set_velocity_sp(60 + 30 * i);
+    rings[i].init(&ring_storage[i * RING_SIZE], RING_SIZE);
+    server.attach(i, &rings[i]);
+  }
+  server.set_command_callback(command_received, this);
+}
+
+LiveStation::~LiveStation()
+{
+  stop();
+}
+
+bool LiveStation::start(uint16_t port, bool any_address)
+{
+  if (!server.start(port, any_address))
+    return false;
+
+  running = true;
+  producer = std::thread(&LiveStation::produce, this);
+  serving = std::thread(&LiveStation::serve, this);
+  return true;
+}
+
+void LiveStation::stop()
+{
+  if (!running)
+    return;
+
+  running = false;
+  producer.join();
+  serving.join();
+  server.stop();
+}
+
+// The update task: one sample per motor each period, timestamped as it is taken
+void LiveStation::produce()
+{
+  auto next = std::chrono::steady_clock::now();
+
+  while (running)
+  {
+    next += std::chrono::microseconds(PERIOD_US);
+    std::this_thread::sleep_until(next);
+
+    uint64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::system_clock::now().time_since_epoch())
+                             .count();
+
+    std::lock_guard<std::mutex> guard(motor_lock);
+    for (uint8_t i = 0; i < motors.size(); i++)
+    {
+      MotorModel &motor = motors[i];
+      motor.step(PERIOD_US / 1e6);
+      rings[i].push({timestamp, motor.get_duty_cycle(), motor.get_velocity(), motor.get_position(),
+                     motor.get_current()});
+    }
+    produced++;
+  }
+}
+
+// The live task
+void LiveStation::serve()
+{
+  while (running)
+  {
+    server.flush();
+    server.poll(flush_ms);
+  }
+}
+
+// The models only follow a velocity set point
+bool LiveStation::command_received(const live_command &command, void *context)
+{
+  LiveStation *station = static_cast<LiveStation *>(context);
+  std::lock_guard<std::mutex> guard(station->motor_lock);
+
+  switch (command.command)
+  {
+  case LIVE_COMMAND_MODE:
+    if (command.value != 0)
+      return false;
+    station->motors[command.motor].set_velocity_sp(0);
+    return true;
+  case LIVE_COMMAND_VELOCITY:
+    station->motors[command.motor].set_velocity_sp(command.value);
+    return true;
+  case LIVE_COMMAND_POSITION:
+    return false;
+  case LIVE_COMMAND_STOP:
+    for (MotorModel &motor : station->motors)
+      motor.set_velocity_sp(0);
+    return true;
+  }
+  return false;
+}
+
+uint16_t LiveStation::get_port()
+{
+  return server.get_port();
+}
+
+live_stats LiveStation::get_stats()
+{
+  return server.get_stats();
+}
+
+uint64_t LiveStation::get_produced()
+{
+  return produced;
+}
+
+uint64_t LiveStation::get_dropped()
+{
+  uint64_t dropped = 0;
+  for (uint8_t i = 0; i < motors.size(); i++)
+    dropped += rings[i].get_dropped();
+  return dropped;
+}
@@ -0,0 +1,56 @@
+#ifndef LIVE_STATION_H_
+#define LIVE_STATION_H_
+
+// Includes
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "live_server.hpp"
+#include "motor_model.hpp"
+
+// The station's live telemetry on Linux: motor models stepped at 1 kHz in real time push their
+// samples into the same rings the update task fills, and a second thread flushes and polls the
+// server like the live task. Commands change the models' velocity set points.
+class LiveStation
+{
+private:
+  // Class variables
+  static constexpr uint32_t RING_SIZE = 256; // LIVE_RING_SIZE
+  static constexpr uint32_t PERIOD_US = 1000;
+
+  uint32_t flush_ms;
+  std::vector<MotorModel> motors;
+  std::vector<live_sample> ring_storage;
+  std::unique_ptr<LiveRing[]> rings;
+  std::vector<live_client> pool;
+  std::vector<live_sample> batch;
+  LiveServer server;
+
+  std::mutex motor_lock;
+  std::atomic<bool> running;
+  std::atomic<uint64_t> produced;
+  std::thread producer;
+  std::thread serving;
+
+  void produce();
+  void serve();
+  static bool command_received(const live_command &command, void *context);
+
+public:
+  LiveStation(uint8_t motor_count, uint16_t max_clients, uint32_t flush_ms);
+  ~LiveStation();
+
+  bool start(uint16_t port, bool any_address);
+  void stop();
+
+  uint16_t get_port();
+  live_stats get_stats();
+  uint64_t get_produced();
+  uint64_t get_dropped(); // Samples the rings had no room for
+};
+
+#endif // LIVE_STATION_H_
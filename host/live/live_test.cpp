@@ -0,0 +1,379 @@
+// Includes
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "live_server.hpp"
+#include "ws_client.hpp"
+
+// The live server on loopback, served from its own thread like the station's live task while
+// this one fills the rings as the update task would: the handshake and HTTP routing, message
+// contents and decimation, commands, the connection pool, ping and close, and a client that
+// stops reading falling back to fewer samples without costing a reading client any.
+
+static constexpr uint8_t MOTOR_COUNT = 2;
+static constexpr uint32_t RING_SIZE = 4096;
+static constexpr uint16_t POOL_SIZE = 4;
+static constexpr uint32_t FLUSH_MS = 2;
+static constexpr uint32_t TIMEOUT_MS = 2000;
+static constexpr uint64_t START_MS = 1700000000000ULL;
+static constexpr uint32_t STALL_SAMPLES = 64000; // Well past what loopback buffers hold for a stalled client
+static constexpr uint32_t BURST_SAMPLES = 64;   // Pushed each ms while stalled, 64 times the update task's rate
+
+static std::atomic<uint32_t> command_calls(0);
+static live_command last_command;
+
+static bool command_received(const live_command &command, void *context)
+{
+  last_command = command;
+  command_calls++;
+  return command.command != LIVE_COMMAND_POSITION;
+}
+
+static live_sample sample_at(uint8_t motor, uint32_t i)
+{
+  return {START_MS + i, 0.001f * (i % 1000), (float)i, (float)(i % 360), 100.0f * motor};
+}
+
+// Retries while the ring is full, the server drains it every FLUSH_MS
+static void push(LiveRing &ring, const live_sample &sample)
+{
+  while (!ring.push(sample))
+    usleep(100);
+}
+
+static std::string http_get(uint16_t port, const std::string &request)
+{
+  std::string response;
+
+  int fd = ws_connect(port, TIMEOUT_MS);
+  if (fd < 0)
+    return response;
+
+  ws_send_all(fd, request.data(), request.size());
+  ws_read_response(fd, &response);
+  close(fd);
+  return response;
+}
+
+static bool read_text(int fd, std::string *text)
+{
+  uint8_t opcode;
+  std::vector<uint8_t> payload;
+
+  // Sample messages may come first
+  while (ws_read(fd, &opcode, &payload))
+  {
+    if (opcode == 0x1)
+    {
+      text->assign(payload.begin(), payload.end());
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool command(int fd, const char *text)
+{
+  std::string reply;
+  return ws_send_text(fd, text) && read_text(fd, &reply) && reply == "{\"ok\":true}";
+}
+
+static void check_handshake()
+{
+  char accept[29];
+
+  // RFC 6455, section 1.3
+  LiveServer::accept_key("dGhlIHNhbXBsZSBub25jZQ==", 24, accept);
+  check(strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0, "the accept key matches the RFC's example");
+}
+
+static void check_routes(uint16_t port)
+{
+  std::string page = http_get(port, "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  check(page.compare(0, 15, "HTTP/1.1 200 OK") == 0 && page.find("text/html") != std::string::npos,
+        "the page is served at /");
+
+  check(http_get(port, "GET /nothing HTTP/1.1\r\n\r\n").compare(0, 12, "HTTP/1.1 404") == 0,
+        "other paths are not found");
+  check(http_get(port, "GET /live HTTP/1.1\r\n\r\n").compare(0, 12, "HTTP/1.1 400") == 0,
+        "/live without an upgrade is a bad request");
+  check(http_get(port, "GET /live?motor=5 HTTP/1.1\r\nUpgrade: websocket\r\nSec-WebSocket-Key: a\r\n\r\n")
+                .compare(0, 12, "HTTP/1.1 404") == 0,
+        "a motor that is not attached is not found");
+  check(http_get(port, "POST / HTTP/1.1\r\nContent-Length: 0\r\n\r\n").compare(0, 12, "HTTP/1.1 405") == 0,
+        "only GET is allowed");
+
+  // A NUL in a header line must not lead the parser past the request
+  static constexpr char NUL_HEADER[] = "GET /live HTTP/1.1\r\nA\0:b\r\nHost: x\r\n\r\n";
+  check(http_get(port, std::string(NUL_HEADER, sizeof(NUL_HEADER) - 1)).compare(0, 12, "HTTP/1.1 400") == 0,
+        "a request holding a NUL is a bad request");
+  check(http_get(port, "GET / HTTP/1.1\r\n\r\n").compare(0, 15, "HTTP/1.1 200 OK") == 0,
+        "the server still answers after a malformed request");
+}
+
+static void check_stream(uint16_t port, LiveRing *rings, uint32_t *pushed)
+{
+  static constexpr uint32_t DECIMATION = 4;
+  static constexpr uint32_t SAMPLES = 1000;
+  uint8_t opcode;
+  std::vector<uint8_t> payload;
+  live_message message;
+
+  int fd = ws_open(port, "/live?motor=1&decimate=4", TIMEOUT_MS);
+  check(fd >= 0, "/live upgrades to a WebSocket");
+  if (fd < 0)
+    return;
+
+  // The first sequence after the upgrade depends on when the server drained the ring last
+  usleep(10 * FLUSH_MS * 1000);
+  uint32_t first = pushed[1];
+  for (uint32_t i = 0; i < SAMPLES; i++)
+    push(rings[1], sample_at(1, pushed[1]++));
+
+  uint32_t received = 0;
+  uint32_t expected = (first + DECIMATION - 1) / DECIMATION * DECIMATION;
+  bool headers = true;
+  bool sequence = true;
+  bool values = true;
+  while (received < SAMPLES / DECIMATION && ws_read(fd, &opcode, &payload))
+  {
+    if (opcode != 0x2 || !ws_decode_live(payload, &message))
+    {
+      headers = false;
+      break;
+    }
+
+    headers &= message.version == LIVE_VERSION && message.motor == 1 && message.decimation == DECIMATION &&
+               message.skipped == 0;
+    sequence &= message.sequence == expected && message.sequence % DECIMATION == 0;
+    for (uint32_t i = 0; i < message.samples.size(); i++)
+    {
+      live_sample sample = sample_at(1, message.sequence + i * DECIMATION);
+      values &= memcmp(&message.samples[i], &sample, sizeof(sample)) == 0;
+    }
+
+    expected = message.sequence + message.samples.size() * DECIMATION;
+    received += message.samples.size();
+  }
+
+  check(headers, "messages carry the version, motor and decimation");
+  check(received == SAMPLES / DECIMATION && sequence, "every 4th sample arrives in sequence");
+  check(values, "samples arrive as they were pushed");
+
+  close(fd);
+}
+
+static void check_commands(uint16_t port)
+{
+  std::string reply;
+
+  int fd = ws_open(port, "/live?motor=1", TIMEOUT_MS);
+  if (fd < 0)
+  {
+    check(false, "a client connects for commands");
+    return;
+  }
+
+  check(command(fd, "{\"velocity\":90}") && command_calls == 1 && last_command.motor == 1 &&
+            last_command.command == LIVE_COMMAND_VELOCITY && last_command.value == 90,
+        "a velocity command reaches the callback for the client's motor");
+  check(command(fd, "{ \"motor\": 0, \"mode\": 3 }") && command_calls == 2 && last_command.motor == 0 &&
+            last_command.command == LIVE_COMMAND_MODE && last_command.value == 3,
+        "a command names another motor");
+  check(command(fd, "{\"stop\":1}") && last_command.command == LIVE_COMMAND_STOP, "stop reaches the callback");
+  check(!command(fd, "{\"position\":180}") && command_calls == 4, "a refused command is answered false");
+  check(!command(fd, "{\"speed\":1}") && !command(fd, "{\"decimate\":0}") && !command(fd, "velocity=1") &&
+            !command(fd, "{\"motor\":7}") && command_calls == 4,
+        "malformed commands are answered false without a call");
+
+  // Ping is answered with its payload
+  uint8_t opcode = 0;
+  std::vector<uint8_t> payload;
+  ws_send(fd, 0x9, "live", 4);
+  while (ws_read(fd, &opcode, &payload) && opcode == 0x2)
+    ;
+  check(opcode == 0xA && std::string(payload.begin(), payload.end()) == "live", "a ping is answered with a pong");
+
+  // The close is echoed and the server closes the connection
+  uint8_t status[2] = {0x03, 0xE8};
+  ws_send(fd, 0x8, status, sizeof(status));
+  while (ws_read(fd, &opcode, &payload) && opcode == 0x2)
+    ;
+  uint8_t byte;
+  check(opcode == 0x8 && payload.size() == 2 && payload[0] == 0x03 && payload[1] == 0xE8 && recv(fd, &byte, 1, 0) == 0,
+        "a close is echoed and the connection closed");
+  close(fd);
+
+  fd = ws_open(port, "/live", TIMEOUT_MS);
+  ws_send(fd, 0x1, "{}", 2, false);
+  while (ws_read(fd, &opcode, &payload) && opcode == 0x2)
+    ;
+  check(opcode == 0x8 && payload.size() == 2 && (payload[0] << 8 | payload[1]) == 1002,
+        "an unmasked frame closes with a protocol error");
+  close(fd);
+}
+
+static void check_pool(uint16_t port, LiveServer &server)
+{
+  std::vector<int> fds;
+  std::string response;
+
+  for (uint16_t i = 0; i < POOL_SIZE; i++)
+    fds.push_back(ws_open(port, "/live", TIMEOUT_MS));
+
+  uint64_t rejected = server.get_stats().rejected;
+  int fd = ws_connect(port, TIMEOUT_MS);
+  ws_read_response(fd, &response);
+  close(fd);
+
+  bool opened = true;
+  for (int open_fd : fds)
+    opened &= open_fd >= 0;
+  check(opened && response.compare(0, 12, "HTTP/1.1 503") == 0 && server.get_stats().rejected == rejected + 1,
+        "a connection beyond the pool is turned away");
+
+  for (int open_fd : fds)
+    close(open_fd);
+}
+
+static void check_stalled(uint16_t port, LiveServer &server, LiveRing *rings, uint32_t *pushed)
+{
+  uint8_t opcode;
+  std::vector<uint8_t> payload;
+  live_message message;
+
+  int stalled = ws_open(port, "/live?motor=0", TIMEOUT_MS);
+  int reader = ws_open(port, "/live?motor=0", TIMEOUT_MS);
+  check(stalled >= 0 && reader >= 0, "a stalled and a reading client connect");
+
+  // The reader drains its socket on a thread of its own while the ring is filled
+  uint64_t skipped_before = server.get_stats().skipped;
+  std::atomic<uint32_t> received(0);
+  std::atomic<bool> reading(true);
+  bool clean = true;
+  std::thread drain([&]() {
+    uint8_t drain_opcode;
+    std::vector<uint8_t> drain_payload;
+    live_message drain_message;
+    uint32_t expected = UINT32_MAX;
+
+    while (reading || received < STALL_SAMPLES)
+    {
+      if (!ws_read(reader, &drain_opcode, &drain_payload))
+        break;
+      if (drain_opcode != 0x2 || !ws_decode_live(drain_payload, &drain_message))
+        continue;
+      clean &= drain_message.decimation == 1 && drain_message.skipped == 0 &&
+               (expected == UINT32_MAX || drain_message.sequence == expected);
+      expected = drain_message.sequence + drain_message.samples.size();
+      received += drain_message.samples.size();
+    }
+  });
+
+  usleep(10 * FLUSH_MS * 1000);
+  for (uint32_t i = 0; i < STALL_SAMPLES; i++)
+  {
+    push(rings[0], sample_at(0, pushed[0]++));
+    if (i % BURST_SAMPLES == BURST_SAMPLES - 1)
+      usleep(1000);
+  }
+  reading = false;
+  drain.join();
+
+  uint64_t skipped = server.get_stats().skipped - skipped_before;
+  printf("    stalled client skipped %llu of %u samples\n", (unsigned long long)skipped, STALL_SAMPLES);
+  check(received == STALL_SAMPLES && clean, "the reading client gets every sample in sequence");
+  check(skipped > 0, "the stalled client's samples are skipped");
+
+  // Reading again, past what its socket held, the stalled client is told what it missed at a
+  // raised decimation, then recovers its own
+  uint16_t first_decimation = 0;
+  uint32_t first_skipped = 0;
+  uint16_t last_decimation = 0;
+  for (uint32_t round = 0; round < 400 && (first_decimation == 0 || last_decimation != 1); round++)
+  {
+    for (uint32_t i = 0; i < 64; i++)
+      push(rings[0], sample_at(0, pushed[0]++));
+
+    while (true)
+    {
+      struct timeval timeout = {.tv_sec = 0, .tv_usec = 5000};
+      setsockopt(stalled, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      if (!ws_read(stalled, &opcode, &payload))
+        break;
+      if (opcode != 0x2 || !ws_decode_live(payload, &message))
+        continue;
+      if (first_decimation == 0 && message.skipped > 0)
+      {
+        first_decimation = message.decimation;
+        first_skipped = message.skipped;
+      }
+      last_decimation = message.decimation;
+    }
+  }
+
+  printf("    resumed at decimation %u after %u skipped\n", first_decimation, first_skipped);
+  check(first_decimation > 1 && first_skipped > 0, "the stalled client resumes at a raised decimation");
+  check(last_decimation == 1, "a client that keeps up recovers its own decimation");
+
+  close(stalled);
+  close(reader);
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<live_sample> storage(MOTOR_COUNT * RING_SIZE);
+  LiveRing rings[MOTOR_COUNT];
+  std::vector<live_client> pool(POOL_SIZE);
+  std::vector<live_sample> batch(LiveServer::BATCH_SIZE);
+  uint32_t pushed[MOTOR_COUNT] = {};
+  LiveServer server;
+
+  server.init(pool.data(), POOL_SIZE, batch.data());
+  for (uint8_t i = 0; i < MOTOR_COUNT; i++)
+  {
+    rings[i].init(&storage[i * RING_SIZE], RING_SIZE);
+    server.attach(i, &rings[i]);
+  }
+  server.set_command_callback(command_received, nullptr);
+
+  check_handshake();
+  if (!server.start(0, false))
+  {
+    check(false, "the server listens");
+    return 1;
+  }
+
+  std::atomic<bool> running(true);
+  std::thread serving([&]() {
+    while (running)
+    {
+      server.flush();
+      server.poll(FLUSH_MS);
+    }
+  });
+
+  uint16_t port = server.get_port();
+  check_routes(port);
+  check_stream(port, rings, pushed);
+  check_commands(port);
+  check_pool(port, server);
+  check_stalled(port, server, rings, pushed);
+
+  running = false;
+  serving.join();
+  server.stop();
+
+  live_stats stats = server.get_stats();
+  check(stats.clients == 0 && stats.streams == 0, "stopping closes every connection");
+
+  return check_summary();
+}
@@ -0,0 +1,103 @@
+// Includes
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "live_station.hpp"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_signal(int signal)
+{
+  (void)signal;
+  stop_requested = 1;
+}
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --port N          Port to listen on, 0 picks a free one (default 8080)\n"
+          "  --any             Listen on every interface instead of loopback only\n"
+          "  --motors N        Simulated motors (default 2)\n"
+          "  --clients N       Connections served at once (default 4)\n"
+          "  --flush-ms N      Send period (default 20)\n"
+          "  --stats           Print send rates every second\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  uint16_t port = 8080;
+  bool any_address = false;
+  uint32_t motor_count = 2;
+  uint32_t max_clients = 4;
+  uint32_t flush_ms = 20;
+  bool print_stats = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--port") == 0 && has_value)
+      port = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--any") == 0)
+      any_address = true;
+    else if (strcmp(argv[i], "--motors") == 0 && has_value)
+      motor_count = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--clients") == 0 && has_value)
+      max_clients = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--flush-ms") == 0 && has_value)
+      flush_ms = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--stats") == 0)
+      print_stats = true;
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (motor_count == 0 || motor_count > LIVE_MAX_MOTORS || max_clients == 0 || max_clients > UINT16_MAX ||
+      flush_ms == 0)
+  {
+    print_usage(argv[0]);
+    return 2;
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  LiveStation station(motor_count, max_clients, flush_ms);
+  if (!station.start(port, any_address))
+  {
+    fprintf(stderr, "Cannot listen on port %u\n", port);
+    return 1;
+  }
+
+  // The port goes to stdout so scripts can start the server on port 0
+  printf("%u\n", station.get_port());
+  fflush(stdout);
+
+  live_stats prev = station.get_stats();
+
+  while (!stop_requested)
+  {
+    sleep(1);
+
+    live_stats stats = station.get_stats();
+    if (print_stats)
+      fprintf(stderr, "%u clients, %u streams, %llu messages/s, %llu samples/s, %llu skipped/s, %.1f kB/s\n",
+              stats.clients, stats.streams,
+              (unsigned long long)(stats.messages - prev.messages),
+              (unsigned long long)(stats.samples - prev.samples),
+              (unsigned long long)(stats.skipped - prev.skipped),
+              (stats.bytes - prev.bytes) / 1000.0);
+    prev = stats;
+  }
+
+  station.stop();
+  return 0;
+}
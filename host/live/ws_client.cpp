@@ -0,0 +1,212 @@
+// Includes
+#include "ws_client.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+static constexpr char REQUEST_KEY[] = "dGhlIHNhbXBsZSBub25jZQ==";
+static constexpr uint32_t MAX_RESPONSE_SIZE = 64 * 1024;
+
+// Once a frame has started, a timeout waits on for the rest of it rather than losing its place
+static bool recv_all(int fd, void *dest, size_t length, bool started)
+{
+  uint8_t *bytes = static_cast<uint8_t *>(dest);
+
+  while (length > 0)
+  {
+    ssize_t received = recv(fd, bytes, length, 0);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && (started || bytes != dest))
+      continue;
+    if (received <= 0)
+      return false;
+    bytes += received;
+    length -= received;
+  }
+  return true;
+}
+
+static uint32_t read_le(const uint8_t *data, uint32_t size)
+{
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < size; i++)
+    value |= (uint32_t)data[i] << (8 * i);
+  return value;
+}
+
+int ws_connect(uint16_t port, uint32_t timeout_ms, int receive_buffer)
+{
+  struct sockaddr_in address = {};
+  struct timeval timeout = {
+      .tv_sec = (time_t)(timeout_ms / 1000),
+      .tv_usec = (suseconds_t)(timeout_ms % 1000 * 1000),
+  };
+  int enable = 1;
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  if (receive_buffer > 0)
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+bool ws_send_all(int fd, const void *data, size_t length)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+  while (length > 0)
+  {
+    ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+    if (sent <= 0)
+      return false;
+    bytes += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+bool ws_read_response(int fd, std::string *response)
+{
+  char c;
+
+  response->clear();
+  while (response->size() < MAX_RESPONSE_SIZE)
+  {
+    if (recv(fd, &c, 1, 0) != 1)
+      return false;
+    response->push_back(c);
+    if (response->size() >= 4 && response->compare(response->size() - 4, 4, "\r\n\r\n") == 0)
+      return true;
+  }
+  return false;
+}
+
+int ws_open(uint16_t port, const char *path, uint32_t timeout_ms, int receive_buffer)
+{
+  char accept[29];
+  std::string response;
+
+  int fd = ws_connect(port, timeout_ms, receive_buffer);
+  if (fd < 0)
+    return -1;
+
+  std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+                        "Connection: Upgrade\r\nSec-WebSocket-Key: " + REQUEST_KEY + "\r\n"
+                        "Sec-WebSocket-Version: 13\r\n\r\n";
+  LiveServer::accept_key(REQUEST_KEY, strlen(REQUEST_KEY), accept);
+
+  if (!ws_send_all(fd, request.data(), request.size()) || !ws_read_response(fd, &response) ||
+      response.compare(0, 12, "HTTP/1.1 101") != 0 || response.find(accept) == std::string::npos)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+bool ws_send(int fd, uint8_t opcode, const void *payload, size_t length, bool masked)
+{
+  static constexpr uint8_t MASK[4] = {0x37, 0xFA, 0x21, 0x3D};
+  std::vector<uint8_t> frame;
+
+  frame.push_back(0x80 | opcode);
+  if (length < 126)
+    frame.push_back((masked ? 0x80 : 0) | (uint8_t)length);
+  else
+  {
+    frame.push_back((masked ? 0x80 : 0) | 126);
+    frame.push_back((uint8_t)(length >> 8));
+    frame.push_back((uint8_t)length);
+  }
+
+  for (uint32_t i = 0; masked && i < 4; i++)
+    frame.push_back(MASK[i]);
+  for (size_t i = 0; i < length; i++)
+    frame.push_back(static_cast<const uint8_t *>(payload)[i] ^ (masked ? MASK[i % 4] : 0));
+
+  return ws_send_all(fd, frame.data(), frame.size());
+}
+
+bool ws_send_text(int fd, const char *text)
+{
+  return ws_send(fd, 0x1, text, strlen(text));
+}
+
+bool ws_read(int fd, uint8_t *opcode, std::vector<uint8_t> *payload)
+{
+  uint8_t header[4];
+
+  if (!recv_all(fd, header, 2, false))
+    return false;
+
+  uint32_t length = header[1] & 0x7F;
+  if (length == 126)
+  {
+    if (!recv_all(fd, header + 2, 2, true))
+      return false;
+    length = (uint32_t)header[2] << 8 | header[3];
+  }
+  else if (length == 127)
+    return false;
+
+  *opcode = header[0] & 0x0F;
+  payload->resize(length);
+  return length == 0 || recv_all(fd, payload->data(), length, true);
+}
+
+bool ws_decode_live(const std::vector<uint8_t> &payload, live_message *message)
+{
+  const uint8_t *data = payload.data();
+
+  if (payload.size() < LIVE_HEADER_SIZE || data[0] != 'D' || data[1] != 'L')
+    return false;
+
+  uint16_t count = read_le(data + 6, 2);
+  if (payload.size() != LIVE_HEADER_SIZE + count * LIVE_SAMPLE_SIZE)
+    return false;
+
+  message->version = data[2];
+  message->motor = data[3];
+  message->decimation = read_le(data + 4, 2);
+  message->sequence = read_le(data + 8, 4);
+  message->skipped = read_le(data + 12, 4);
+  message->samples.resize(count);
+
+  const uint8_t *sample = data + LIVE_HEADER_SIZE;
+  for (live_sample &dest : message->samples)
+  {
+    uint32_t values[4];
+    for (uint32_t i = 0; i < 4; i++)
+      values[i] = read_le(sample + 8 + 4 * i, 4);
+
+    dest.timestamp = (uint64_t)read_le(sample + 4, 4) << 32 | read_le(sample, 4);
+    memcpy(&dest.duty_cycle, &values[0], sizeof(float));
+    memcpy(&dest.velocity, &values[1], sizeof(float));
+    memcpy(&dest.position, &values[2], sizeof(float));
+    memcpy(&dest.current, &values[3], sizeof(float));
+    sample += LIVE_SAMPLE_SIZE;
+  }
+
+  return true;
+}
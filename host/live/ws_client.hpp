@@ -0,0 +1,41 @@
+#ifndef WS_CLIENT_H_
+#define WS_CLIENT_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "live_server.hpp"
+
+// Blocking WebSocket client on loopback for the live server's test and benchmark. Reads time out
+// after the timeout given when connecting.
+
+typedef struct
+{
+  uint8_t version;
+  uint8_t motor;
+  uint16_t decimation;
+  uint32_t sequence; // Of the first sample
+  uint32_t skipped;
+  std::vector<live_sample> samples;
+} live_message;
+
+// Connected socket, or -1. A receive buffer in bytes, set before connecting, bounds the window.
+int ws_connect(uint16_t port, uint32_t timeout_ms, int receive_buffer = 0);
+bool ws_send_all(int fd, const void *data, size_t length);
+
+// HTTP response headers, up to and including the empty line
+bool ws_read_response(int fd, std::string *response);
+
+// Connected and upgraded to a WebSocket on path, or -1
+int ws_open(uint16_t port, const char *path, uint32_t timeout_ms, int receive_buffer = 0);
+
+bool ws_send(int fd, uint8_t opcode, const void *payload, size_t length, bool masked = true);
+bool ws_send_text(int fd, const char *text);
+bool ws_read(int fd, uint8_t *opcode, std::vector<uint8_t> *payload);
+
+bool ws_decode_live(const std::vector<uint8_t> &payload, live_message *message);
+
+#endif // WS_CLIENT_H_
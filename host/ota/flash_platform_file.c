@@ -0,0 +1,278 @@
+/*
+ * ADU flash platform on a file, for running the download engine on the host. Keeps
+ * the NOR behaviour of the ESP32 implementation: sectors are erased to 0xFF ahead of
+ * the writes with the same bookkeeping, and a write can only clear bits. Writes are
+ * held to a configurable rate to stand in for the flash's own speed.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "azure_iot_flash_platform.h"
+#include "flash_platform_file.h"
+
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+static const char * TAG = "flash_platform";
+
+#define flashplatformSECTOR_SIZE         ( 4096U )
+#define flashplatformVERIFY_BUFFER_SIZE  ( 512U )
+#define flashplatformSHA256_SIZE         ( 32U )
+
+#define flashplatformALIGN_DOWN( x )     ( ( x ) & ~( flashplatformSECTOR_SIZE - 1U ) )
+#define flashplatformALIGN_UP( x )       flashplatformALIGN_DOWN( ( x ) + flashplatformSECTOR_SIZE - 1U )
+
+static int lBankFile = -1;
+static uint32_t ulBankSize;
+static volatile uint32_t ulWriteRate;
+static volatile bool xEnabled;
+
+/*-----------------------------------------------------------*/
+
+bool FlashFile_Configure( const char * pcPath,
+                          uint32_t ulSize,
+                          uint32_t ulRate )
+{
+    if( lBankFile >= 0 )
+    {
+        close( lBankFile );
+    }
+
+    lBankFile = open( pcPath, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+
+    if( ( lBankFile < 0 ) || ( ftruncate( lBankFile, ulSize ) != 0 ) )
+    {
+        ESP_LOGE( TAG, "Failed to create the boot bank file %s.", pcPath );
+        return false;
+    }
+
+    ulBankSize = ulSize;
+    ulWriteRate = ulRate;
+    xEnabled = false;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+void FlashFile_SetWriteRate( uint32_t ulRate )
+{
+    ulWriteRate = ulRate;
+}
+/*-----------------------------------------------------------*/
+
+bool FlashFile_IsEnabled( void )
+{
+    return xEnabled;
+}
+/*-----------------------------------------------------------*/
+
+static void prvHoldToRate( uint64_t ullStartUs,
+                           uint32_t ulLength )
+{
+    uint32_t ulRate = ulWriteRate;
+    struct timespec xNow;
+    uint64_t ullDueUs;
+    uint64_t ullNowUs;
+
+    if( ulRate == 0 )
+    {
+        return;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &xNow );
+    ullNowUs = ( uint64_t ) xNow.tv_sec * 1000000U + ( uint64_t ) xNow.tv_nsec / 1000U;
+    ullDueUs = ullStartUs + ( uint64_t ) ulLength * 1000000U / ulRate;
+
+    if( ullDueUs > ullNowUs )
+    {
+        usleep( ( useconds_t ) ( ullDueUs - ullNowUs ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
+{
+    if( lBankFile < 0 )
+    {
+        ESP_LOGE( TAG, "No boot bank file, call FlashFile_Configure() first." );
+        return eAzureIoTErrorFailed;
+    }
+
+    pxAduImage->lFile = lBankFile;
+    pxAduImage->ulCurrentOffset = 0;
+    pxAduImage->ulErasedOffset = 0;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+int64_t AzureIoTPlatform_GetSingleFlashBootBankSize()
+{
+    return ( int64_t ) ulBankSize;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage,
+                                              uint32_t ulOffset,
+                                              uint8_t * const pData,
+                                              uint32_t ulBlockSize )
+{
+    static uint8_t ucSector[ flashplatformSECTOR_SIZE ];
+    struct timespec xStart;
+    uint32_t ulEraseStart;
+    uint32_t ulEraseEnd;
+    uint32_t ulDone;
+    uint32_t i;
+
+    clock_gettime( CLOCK_MONOTONIC, &xStart );
+
+    if( ( uint64_t ) ulOffset + ulBlockSize > ulBankSize )
+    {
+        ESP_LOGE( TAG, "Block at %lu exceeds the partition.", ( unsigned long ) ulOffset );
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    /* Same erase bookkeeping as flash_platform_esp32.c. */
+    ulEraseStart = flashplatformALIGN_DOWN( ulOffset );
+
+    if( ( ulOffset >= pxAduImage->ulCurrentOffset ) && ( pxAduImage->ulErasedOffset > ulEraseStart ) )
+    {
+        ulEraseStart = pxAduImage->ulErasedOffset;
+    }
+
+    ulEraseEnd = flashplatformALIGN_UP( ulOffset + ulBlockSize );
+
+    if( ulEraseEnd > ulEraseStart )
+    {
+        memset( ucSector, 0xFF, sizeof( ucSector ) );
+
+        for( i = ulEraseStart; i < ulEraseEnd; i += flashplatformSECTOR_SIZE )
+        {
+            if( pwrite( pxAduImage->lFile, ucSector, sizeof( ucSector ), i ) != ( ssize_t ) sizeof( ucSector ) )
+            {
+                ESP_LOGE( TAG, "Erase failed at %lu.", ( unsigned long ) i );
+                return eAzureIoTErrorFailed;
+            }
+        }
+
+        pxAduImage->ulErasedOffset = ulEraseEnd;
+    }
+
+    /* NOR flash only clears bits, writing over unerased bytes corrupts them as it would on the device. */
+    for( ulDone = 0; ulDone < ulBlockSize; ulDone += i )
+    {
+        uint32_t ulLength = ulBlockSize - ulDone;
+        uint32_t j;
+
+        i = ( ulLength > sizeof( ucSector ) ) ? sizeof( ucSector ) : ulLength;
+
+        if( pread( pxAduImage->lFile, ucSector, i, ulOffset + ulDone ) != ( ssize_t ) i )
+        {
+            ESP_LOGE( TAG, "Write failed at %lu.", ( unsigned long ) ( ulOffset + ulDone ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        for( j = 0; j < i; j++ )
+        {
+            ucSector[ j ] &= pData[ ulDone + j ];
+        }
+
+        if( pwrite( pxAduImage->lFile, ucSector, i, ulOffset + ulDone ) != ( ssize_t ) i )
+        {
+            ESP_LOGE( TAG, "Write failed at %lu.", ( unsigned long ) ( ulOffset + ulDone ) );
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    pxAduImage->ulCurrentOffset = ulOffset + ulBlockSize;
+
+    prvHoldToRate( ( uint64_t ) xStart.tv_sec * 1000000U + ( uint64_t ) xStart.tv_nsec / 1000U, ulBlockSize );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_ReadBlock( AzureADUImage_t * const pxAduImage,
+                                             uint32_t ulOffset,
+                                             uint8_t * const pData,
+                                             uint32_t ulBlockSize )
+{
+    if( pread( pxAduImage->lFile, pData, ulBlockSize, ulOffset ) != ( ssize_t ) ulBlockSize )
+    {
+        ESP_LOGE( TAG, "Read failed at %lu.", ( unsigned long ) ulOffset );
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_VerifyImage( AzureADUImage_t * const pxAduImage,
+                                               uint8_t * pucSHA256Hash,
+                                               uint32_t ulSHA256HashLength )
+{
+    uint8_t ucBuffer[ flashplatformVERIFY_BUFFER_SIZE ];
+    uint8_t ucCalculatedHash[ flashplatformSHA256_SIZE ];
+    mbedtls_sha256_context xContext;
+    uint32_t ulOffset;
+    uint32_t ulLength;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    if( ulSHA256HashLength != flashplatformSHA256_SIZE )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    mbedtls_sha256_init( &xContext );
+    mbedtls_sha256_starts( &xContext, 0 );
+
+    for( ulOffset = 0; ulOffset < pxAduImage->ulImageFileSize; ulOffset += ulLength )
+    {
+        ulLength = pxAduImage->ulImageFileSize - ulOffset;
+        ulLength = ( ulLength > sizeof( ucBuffer ) ) ? sizeof( ucBuffer ) : ulLength;
+
+        if( AzureIoTPlatform_ReadBlock( pxAduImage, ulOffset, ucBuffer, ulLength ) != eAzureIoTSuccess )
+        {
+            xResult = eAzureIoTErrorFailed;
+            break;
+        }
+
+        mbedtls_sha256_update( &xContext, ucBuffer, ulLength );
+    }
+
+    mbedtls_sha256_finish( &xContext, ucCalculatedHash );
+    mbedtls_sha256_free( &xContext );
+
+    if( ( xResult == eAzureIoTSuccess ) &&
+        ( memcmp( ucCalculatedHash, pucSHA256Hash, flashplatformSHA256_SIZE ) != 0 ) )
+    {
+        ESP_LOGE( TAG, "Image hash does not match." );
+        xResult = eAzureIoTErrorFailed;
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_EnableImage( AzureADUImage_t * const pxAduImage )
+{
+    ( void ) pxAduImage;
+
+    xEnabled = true;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_ResetDevice( AzureADUImage_t * const pxAduImage )
+{
+    ( void ) pxAduImage;
+
+    ESP_LOGI( TAG, "A restart into the new image was requested, the host keeps running." );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,41 @@
+/*
+ * Host hooks of the file-backed ADU flash platform in flash_platform_file.c.
+ */
+
+#ifndef FLASH_PLATFORM_FILE_H
+#define FLASH_PLATFORM_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Stand the inactive boot bank in with the file at \p pcPath, created empty.
+ *
+ * @param ulBankSize Size reported as the boot bank's.
+ * @param ulWriteRate Bytes per second the writes are held to, 0 for the file's own pace.
+ *
+ * @return false if the file could not be created.
+ */
+bool FlashFile_Configure( const char * pcPath,
+                          uint32_t ulBankSize,
+                          uint32_t ulWriteRate );
+
+/**
+ * @brief Change the write rate, callable while an update runs.
+ */
+void FlashFile_SetWriteRate( uint32_t ulWriteRate );
+
+/**
+ * @brief Whether an image was enabled since the bank was configured.
+ */
+bool FlashFile_IsEnabled( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLASH_PLATFORM_FILE_H */
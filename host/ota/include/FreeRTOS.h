@@ -0,0 +1,14 @@
+/*
+ * The kernel header of the firmware update host build. ESP-IDF's FreeRTOS.h pulls in
+ * sdkconfig.h, which the download engine relies on, so this one does too before the
+ * host/port stand-in.
+ */
+
+#ifndef HOST_OTA_FREERTOS_H
+#define HOST_OTA_FREERTOS_H
+
+#include "sdkconfig.h"
+
+#include_next <FreeRTOS.h>
+
+#endif /* HOST_OTA_FREERTOS_H */
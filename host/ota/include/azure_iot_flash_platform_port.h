@@ -0,0 +1,22 @@
+/*
+ * Host stand-in for the ADU image context: the inactive boot bank is a file, see
+ * host/ota/flash_platform_file.c.
+ */
+
+#ifndef AZURE_IOT_FLASH_PLATFORM_PORT_H
+#define AZURE_IOT_FLASH_PLATFORM_PORT_H
+
+#include <stdint.h>
+
+/**
+ * @brief The image being written to the file standing in for the inactive bank.
+ */
+typedef struct AzureADUImage
+{
+    int lFile;                /**< The bank's file, open while an update runs. */
+    uint32_t ulImageFileSize; /**< Size of the image being downloaded. */
+    uint32_t ulCurrentOffset; /**< End of the last block written. */
+    uint32_t ulErasedOffset;  /**< Erased from the resume point up to here. */
+} AzureADUImage_t;
+
+#endif /* AZURE_IOT_FLASH_PLATFORM_PORT_H */
@@ -0,0 +1,11 @@
+/*
+ * The ESP-IDF path of the FreeRTOS header, for memory_budget.h.
+ */
+
+#ifndef HOST_OTA_FREERTOS_FREERTOS_H
+#define HOST_OTA_FREERTOS_FREERTOS_H
+
+/* ../FreeRTOS.h, found through the include path rather than this directory */
+#include <FreeRTOS.h>
+
+#endif /* HOST_OTA_FREERTOS_FREERTOS_H */
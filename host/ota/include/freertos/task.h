@@ -0,0 +1,11 @@
+/*
+ * The ESP-IDF path of the task header, for memory_budget.h.
+ */
+
+#ifndef HOST_OTA_FREERTOS_TASK_H
+#define HOST_OTA_FREERTOS_TASK_H
+
+/* ../task.h, found through the include path rather than this directory */
+#include <task.h>
+
+#endif /* HOST_OTA_FREERTOS_TASK_H */
@@ -0,0 +1,10 @@
+/*
+ * Host stand-in for the lwIP resolver header.
+ */
+
+#ifndef HOST_OTA_LWIP_NETDB_H
+#define HOST_OTA_LWIP_NETDB_H
+
+#include <netdb.h>
+
+#endif /* HOST_OTA_LWIP_NETDB_H */
@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for the lwIP BSD socket header, which the ESP32 socket transport
+ * uses with the same names as POSIX.
+ */
+
+#ifndef HOST_OTA_LWIP_SOCKETS_H
+#define HOST_OTA_LWIP_SOCKETS_H
+
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#endif /* HOST_OTA_LWIP_SOCKETS_H */
@@ -0,0 +1,37 @@
+/*
+ * Host stand-in for the mbedTLS SHA-256 calls the download engine makes, so the
+ * host build needs no crypto library. is224 must be 0.
+ */
+
+#ifndef HOST_OTA_MBEDTLS_SHA256_H
+#define HOST_OTA_MBEDTLS_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mbedtls_sha256_context
+{
+    uint32_t state[ 8 ];
+    uint64_t total;
+    uint8_t buffer[ 64 ];
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init( mbedtls_sha256_context * ctx );
+void mbedtls_sha256_free( mbedtls_sha256_context * ctx );
+int mbedtls_sha256_starts( mbedtls_sha256_context * ctx,
+                           int is224 );
+int mbedtls_sha256_update( mbedtls_sha256_context * ctx,
+                           const unsigned char * input,
+                           size_t ilen );
+int mbedtls_sha256_finish( mbedtls_sha256_context * ctx,
+                           unsigned char * output );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_OTA_MBEDTLS_SHA256_H */
@@ -0,0 +1,12 @@
+/*
+ * Configuration of the firmware update host build, the subset of main/sdkconfig
+ * that the download engine reads.
+ */
+
+#ifndef HOST_OTA_SDKCONFIG_H
+#define HOST_OTA_SDKCONFIG_H
+
+#define CONFIG_ENABLE_ADU_SAMPLE    1
+#define CONFIG_OTA_CHUNK_SIZE       8192
+
+#endif /* HOST_OTA_SDKCONFIG_H */
@@ -0,0 +1,36 @@
+/*
+ * Host stand-in for the FreeRTOS task API with tasks on POSIX threads. Replaces
+ * host/port/task.h for the download engine, which also creates its tasks. Priorities
+ * and stack depths are ignored, the host schedules the threads.
+ */
+
+#ifndef HOST_OTA_TASK_H
+#define HOST_OTA_TASK_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define tskIDLE_PRIORITY    ( ( UBaseType_t ) 0U )
+
+typedef struct HostTask * TaskHandle_t;
+typedef void (* TaskFunction_t)( void * );
+
+BaseType_t xTaskCreate( TaskFunction_t pxTaskCode,
+                        const char * pcName,
+                        uint32_t ulStackDepth,
+                        void * pvParameters,
+                        UBaseType_t uxPriority,
+                        TaskHandle_t * pxCreatedTask );
+
+/* From host/port/host_port.c */
+TickType_t xTaskGetTickCount( void );
+void vTaskDelay( TickType_t xTicksToDelay );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_OTA_TASK_H */
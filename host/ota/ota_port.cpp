@@ -0,0 +1,143 @@
+// Includes
+#include <pthread.h>
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "memory_budget.h"
+#include "nvs.h"
+#include "task.h"
+
+// Stand-ins for the task, NVS and arena calls of the download engine, the queues and the timer are
+// host/port's. The engine's tasks never return, they are detached and end with the process.
+
+struct HostTask
+{
+  pthread_t thread;
+  TaskFunction_t code;
+  void *parameters;
+};
+
+static std::mutex nvs_mutex;
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> nvs_namespaces;
+static std::vector<std::pair<std::string, nvs_open_mode_t>> nvs_handles;
+
+static void *run_task(void *context)
+{
+  HostTask *task = static_cast<HostTask *>(context);
+
+  task->code(task->parameters);
+  return nullptr;
+}
+
+extern "C" BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                                  UBaseType_t priority, TaskHandle_t *created)
+{
+  HostTask *task = new HostTask{{}, code, parameters};
+
+  (void)name;
+  (void)stack_depth;
+  (void)priority;
+
+  if (pthread_create(&task->thread, nullptr, run_task, task) != 0)
+  {
+    delete task;
+    return pdFAIL;
+  }
+
+  pthread_detach(task->thread);
+  if (created != nullptr)
+    *created = task;
+  return pdPASS;
+}
+
+// The arenas only bound the firmware's static memory, the host allocates
+extern "C" void *memory_reserve(memory_arena_t arena, size_t size)
+{
+  (void)arena;
+  return malloc(size);
+}
+
+extern "C" esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *handle)
+{
+  std::lock_guard<std::mutex> lock(nvs_mutex);
+
+  if (open_mode == NVS_READONLY && nvs_namespaces.find(name) == nvs_namespaces.end())
+    return ESP_ERR_NVS_NOT_FOUND;
+
+  nvs_namespaces[name];
+  nvs_handles.push_back({name, open_mode});
+  *handle = nvs_handles.size();
+  return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+  std::lock_guard<std::mutex> lock(nvs_mutex);
+  auto &values = nvs_namespaces[nvs_handles[handle - 1].first];
+  auto value = values.find(key);
+
+  if (value == values.end())
+    return ESP_ERR_NVS_NOT_FOUND;
+  if (out_value == nullptr)
+  {
+    *length = value->second.size();
+    return ESP_OK;
+  }
+  if (*length < value->second.size())
+    return ESP_ERR_INVALID_SIZE;
+
+  memcpy(out_value, value->second.data(), value->second.size());
+  *length = value->second.size();
+  return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+  std::lock_guard<std::mutex> lock(nvs_mutex);
+
+  if (nvs_handles[handle - 1].second != NVS_READWRITE)
+    return ESP_ERR_INVALID_STATE;
+
+  const uint8_t *bytes = static_cast<const uint8_t *>(value);
+  nvs_namespaces[nvs_handles[handle - 1].first][key].assign(bytes, bytes + length);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+  size_t length = sizeof(*out_value);
+  esp_err_t result = nvs_get_blob(handle, key, out_value, &length);
+
+  return result == ESP_OK && length != sizeof(*out_value) ? ESP_ERR_NVS_NOT_FOUND : result;
+}
+
+extern "C" esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+  return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+extern "C" esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+  std::lock_guard<std::mutex> lock(nvs_mutex);
+
+  if (nvs_handles[handle - 1].second != NVS_READWRITE)
+    return ESP_ERR_INVALID_STATE;
+
+  nvs_namespaces[nvs_handles[handle - 1].first].clear();
+  return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_commit(nvs_handle_t handle)
+{
+  (void)handle;
+  return ESP_OK;
+}
+
+extern "C" void nvs_close(nvs_handle_t handle)
+{
+  (void)handle;
+}
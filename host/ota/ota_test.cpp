@@ -0,0 +1,228 @@
+// Includes
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "range_server.hpp"
+
+extern "C"
+{
+#include "sdkconfig.h"
+#include "azure_iot_flash_platform.h"
+#include "flash_platform_file.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+#include "sample_azure_iot_ota.h"
+}
+
+// The firmware download engine against a local range server, with the inactive boot bank in a
+// file: an image written whole over one kept-alive connection, the network and the flash paced
+// alike to show the download of one chunk overlapping the write of the one before, a connection
+// dropped part way, a download resumed from the progress a reboot left in NVS, and an image
+// that does not match its hash. Prints the throughput of each.
+
+static constexpr uint32_t IMAGE_SIZE = 1024 * 1024 + 1234; // A short last chunk
+static constexpr uint32_t BANK_SIZE = 2 * 1024 * 1024;
+static constexpr uint32_t CHUNK_SIZE = CONFIG_OTA_CHUNK_SIZE;
+static constexpr uint32_t PACED_RATE = 2 * 1024 * 1024;   // Bytes per second, for both the network and flash
+static constexpr double MAX_PIPELINED_SHARE = 0.8;        // Of the time a network then flash download would take
+static constexpr uint32_t RESUME_OFFSET = 64 * CHUNK_SIZE; // Written before the "reboot"
+static constexpr uint32_t TIMEOUT_MS = 20000;
+
+static constexpr char IMAGE_PATH[] = "/firmware.bin";
+static constexpr char BANK_FILE[] = "dtmc_ota_bank.bin";
+
+// The engine's OTAProgressRecord_t, which NVS keeps under "ota"/"image"
+typedef struct
+{
+  uint8_t sha256[32];
+  uint32_t size;
+} progress_record;
+
+static std::atomic<bool> finished(false);
+static std::atomic<int> finished_result(-1);
+
+static void update_complete(OTAResult_t result)
+{
+  finished_result = result;
+  finished = true;
+}
+
+static uint64_t now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void sha256(const uint8_t *data, size_t length, uint8_t *hash)
+{
+  mbedtls_sha256_context context;
+
+  mbedtls_sha256_init(&context);
+  mbedtls_sha256_starts(&context, 0);
+  mbedtls_sha256_update(&context, data, length);
+  mbedtls_sha256_finish(&context, hash);
+  mbedtls_sha256_free(&context);
+}
+
+static bool bank_holds(const std::vector<uint8_t> &image)
+{
+  std::vector<uint8_t> contents(image.size());
+  FILE *file = fopen(BANK_FILE, "rb");
+
+  if (file == nullptr)
+    return false;
+  size_t read = fread(contents.data(), 1, contents.size(), file);
+  fclose(file);
+  return read == image.size() && contents == image;
+}
+
+// Starts an update from the server and waits for it, returns the result and the elapsed time
+static OTAResult_t run_update(RangeServer &server, const uint8_t *sha256, uint64_t &elapsed_us)
+{
+  OTAImage_t image = {};
+  std::string url = "http://127.0.0.1:" + std::to_string(server.get_port()) + IMAGE_PATH;
+
+  if (!OTA_ParseUrl((const uint8_t *)url.data(), url.size(), &image))
+    return eOTAResultFailed;
+  image.ulSize = IMAGE_SIZE;
+  memcpy(image.ucSHA256, sha256, sizeof(image.ucSHA256));
+
+  finished = false;
+  uint64_t start = now_us();
+  if (!OTA_Start(&image))
+    return eOTAResultFailed;
+
+  while (!finished && now_us() - start < TIMEOUT_MS * 1000ULL)
+    usleep(1000);
+  elapsed_us = now_us() - start;
+
+  return finished ? (OTAResult_t)finished_result.load() : eOTAResultFailed;
+}
+
+static void print_throughput(const char *name, uint64_t bytes, uint64_t elapsed_us)
+{
+  printf("%s: %llu bytes in %llu ms, %llu KB/s\n", name, (unsigned long long)bytes,
+         (unsigned long long)(elapsed_us / 1000), (unsigned long long)(elapsed_us > 0 ? bytes * 1000 / elapsed_us : 0));
+}
+
+int main()
+{
+  std::vector<uint8_t> image(IMAGE_SIZE);
+  std::mt19937 random(42);
+  for (uint8_t &byte : image)
+    byte = (uint8_t)random();
+
+  uint8_t hash[32];
+  sha256(image.data(), image.size(), hash);
+
+  OTA_Init(update_complete);
+
+  // Whole image, unpaced
+  {
+    RangeServer server;
+    if (!server.start(image, IMAGE_PATH) || !FlashFile_Configure(BANK_FILE, BANK_SIZE, 0))
+      return 1;
+
+    uint64_t elapsed_us = 0;
+    OTAResult_t result = run_update(server, hash, elapsed_us);
+    range_server_stats stats = server.get_stats();
+
+    check(result == eOTAResultSuccess, "an update completes");
+    check(bank_holds(image), "the boot bank holds the image");
+    check(FlashFile_IsEnabled(), "the image is enabled");
+    check(stats.connections == 1, "every range is fetched over one connection");
+    check(stats.requests == (IMAGE_SIZE + CHUNK_SIZE - 1) / CHUNK_SIZE, "the image is fetched a chunk per request");
+    print_throughput("unpaced", IMAGE_SIZE, elapsed_us);
+  }
+
+  // Network and flash at the same rate, one chunk is downloaded while the last is written
+  {
+    RangeServer server;
+    if (!server.start(image, IMAGE_PATH) || !FlashFile_Configure(BANK_FILE, BANK_SIZE, PACED_RATE))
+      return 1;
+    server.set_rate(PACED_RATE);
+
+    uint64_t elapsed_us = 0;
+    OTAResult_t result = run_update(server, hash, elapsed_us);
+    uint64_t serial_us = 2ULL * IMAGE_SIZE * 1000000 / PACED_RATE;
+
+    check(result == eOTAResultSuccess && bank_holds(image), "a paced update completes");
+    check(elapsed_us < serial_us * MAX_PIPELINED_SHARE,
+          "the download overlaps the flash writes, under 80% of their sum");
+    print_throughput("paced", IMAGE_SIZE, elapsed_us);
+    printf("paced: network then flash would take %llu ms\n", (unsigned long long)(serial_us / 1000));
+  }
+
+  // Connection lost half way, the engine reconnects after its first backoff and carries on
+  {
+    RangeServer server;
+    if (!server.start(image, IMAGE_PATH) || !FlashFile_Configure(BANK_FILE, BANK_SIZE, 0))
+      return 1;
+    server.drop_after(IMAGE_SIZE / 2);
+
+    uint64_t elapsed_us = 0;
+    OTAResult_t result = run_update(server, hash, elapsed_us);
+
+    check(result == eOTAResultSuccess && bank_holds(image) && FlashFile_IsEnabled(),
+          "an update survives a dropped connection");
+    check(server.get_stats().connections == 2, "the engine reconnects once");
+    print_throughput("dropped", IMAGE_SIZE, elapsed_us);
+  }
+
+  // A reboot part way: the first chunks are in flash and their offset in NVS
+  {
+    RangeServer server;
+    if (!server.start(image, IMAGE_PATH) || !FlashFile_Configure(BANK_FILE, BANK_SIZE, 0))
+      return 1;
+
+    AzureADUImage_t written = {};
+    bool seeded = AzureIoTPlatform_Init(&written) == eAzureIoTSuccess &&
+                  AzureIoTPlatform_WriteBlock(&written, 0, image.data(), RESUME_OFFSET) == eAzureIoTSuccess;
+
+    progress_record record = {};
+    nvs_handle_t handle;
+    memcpy(record.sha256, hash, sizeof(record.sha256));
+    record.size = IMAGE_SIZE;
+    seeded = seeded && nvs_open("ota", NVS_READWRITE, &handle) == ESP_OK &&
+             nvs_set_blob(handle, "image", &record, sizeof(record)) == ESP_OK &&
+             nvs_set_u32(handle, "offset", RESUME_OFFSET) == ESP_OK;
+    nvs_close(handle);
+
+    uint64_t elapsed_us = 0;
+    OTAResult_t result = seeded ? run_update(server, hash, elapsed_us) : eOTAResultFailed;
+    range_server_stats stats = server.get_stats();
+
+    check(result == eOTAResultSuccess && bank_holds(image), "a resumed update completes");
+    check(stats.first_offset == RESUME_OFFSET && stats.body_bytes == IMAGE_SIZE - RESUME_OFFSET,
+          "a resumed update fetches only what is not in flash");
+    print_throughput("resumed", IMAGE_SIZE - RESUME_OFFSET, elapsed_us);
+  }
+
+  // The manifest's hash does not match what is served
+  {
+    RangeServer server;
+    if (!server.start(image, IMAGE_PATH) || !FlashFile_Configure(BANK_FILE, BANK_SIZE, 0))
+      return 1;
+
+    uint8_t wrong_hash[32];
+    memcpy(wrong_hash, hash, sizeof(wrong_hash));
+    wrong_hash[0] ^= 1;
+
+    uint64_t elapsed_us = 0;
+    OTAResult_t result = run_update(server, wrong_hash, elapsed_us);
+
+    check(result == eOTAResultFailed, "an image that does not match its hash fails");
+    check(!FlashFile_IsEnabled(), "an image that does not match its hash is not enabled");
+  }
+
+  unlink(BANK_FILE);
+  return check_summary();
+}
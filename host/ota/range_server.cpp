@@ -0,0 +1,300 @@
+// Includes
+#include "range_server.hpp"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "esp_log.h"
+
+static constexpr char *TAG = "RangeServer";
+
+static constexpr char RESPONSE_NOT_FOUND[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+static constexpr char RESPONSE_BAD_RANGE[] = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n";
+
+RangeServer::RangeServer()
+{
+  listen_fd = -1;
+  wakeup_fd = -1;
+  port = 0;
+
+  running = false;
+  rate = 0;
+  drop_bytes = -1;
+
+  stats = {};
+  stats.first_offset = UINT32_MAX;
+}
+
+RangeServer::~RangeServer()
+{
+  stop();
+}
+
+uint64_t RangeServer::now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+bool RangeServer::start(const std::vector<uint8_t> &image, const std::string &path, uint16_t port)
+{
+  struct sockaddr_in address = {};
+  socklen_t address_length = sizeof(address);
+  int enable = 1;
+
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+  {
+    ESP_LOGE(TAG, "Failed to create the listening socket, errno %d.", errno);
+    return false;
+  }
+
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0 ||
+      getsockname(listen_fd, (struct sockaddr *)&address, &address_length) != 0)
+  {
+    ESP_LOGE(TAG, "Failed to listen on port %u, errno %d.", port, errno);
+    close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+
+  this->port = ntohs(address.sin_port);
+  this->image = image;
+  this->path = path;
+  wakeup_fd = eventfd(0, EFD_NONBLOCK);
+
+  running = true;
+  thread = std::thread(&RangeServer::run, this);
+
+  ESP_LOGI(TAG, "Serving %zu bytes at %s on port %u.", image.size(), path.c_str(), this->port);
+  return true;
+}
+
+void RangeServer::stop()
+{
+  if (!running)
+    return;
+
+  uint64_t signal = 1;
+  running = false;
+  (void)write(wakeup_fd, &signal, sizeof(signal));
+  thread.join();
+
+  close(listen_fd);
+  close(wakeup_fd);
+  listen_fd = wakeup_fd = -1;
+}
+
+void RangeServer::set_rate(uint32_t bytes_per_second)
+{
+  rate = bytes_per_second;
+}
+
+void RangeServer::drop_after(uint64_t bytes)
+{
+  drop_bytes = (int64_t)bytes;
+}
+
+uint16_t RangeServer::get_port()
+{
+  return port;
+}
+
+range_server_stats RangeServer::get_stats()
+{
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  return stats;
+}
+
+// Returns false once stop() was called
+bool RangeServer::wait_readable(int fd)
+{
+  struct pollfd fds[2] = {{fd, POLLIN, 0}, {wakeup_fd, POLLIN, 0}};
+
+  while (poll(fds, 2, -1) < 0)
+    if (errno != EINTR)
+      return false;
+  return running && (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+}
+
+void RangeServer::run()
+{
+  while (running)
+  {
+    if (!wait_readable(listen_fd))
+      break;
+
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      stats.connections++;
+    }
+
+    serve(fd);
+    close(fd);
+  }
+}
+
+// Answers requests on one connection until the client closes it or it is dropped
+void RangeServer::serve(int fd)
+{
+  std::string input;
+  char buffer[1024];
+
+  while (running)
+  {
+    size_t end = input.find("\r\n\r\n");
+    if (end == std::string::npos)
+    {
+      if (input.size() > MAX_HEADER_SIZE || !wait_readable(fd))
+        return;
+      ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+      if (received <= 0)
+        return;
+      input.append(buffer, received);
+      continue;
+    }
+
+    std::string request = input.substr(0, end + 2);
+    input.erase(0, end + 4);
+
+    // Request line, then the one header that matters
+    char method[8] = {};
+    char target[256] = {};
+    if (sscanf(request.c_str(), "%7s %255s", method, target) != 2 || strcmp(method, "GET") != 0 || path != target)
+    {
+      if (!send_all(fd, RESPONSE_NOT_FOUND, sizeof(RESPONSE_NOT_FOUND) - 1))
+        return;
+      continue;
+    }
+
+    uint64_t first = 0;
+    uint64_t last = image.size() - 1;
+    bool ranged = false;
+    for (size_t line = request.find("\r\n") + 2; line < request.size(); line = request.find("\r\n", line) + 2)
+    {
+      if (strncasecmp(request.c_str() + line, "Range: bytes=", 13) != 0)
+        continue;
+      ranged = sscanf(request.c_str() + line + 13, "%" SCNu64 "-%" SCNu64, &first, &last) == 2;
+      if (!ranged)
+      {
+        // An open-ended range runs to the end of the image
+        ranged = sscanf(request.c_str() + line + 13, "%" SCNu64 "-", &first) == 1;
+        last = image.size() - 1;
+      }
+      break;
+    }
+
+    if (image.empty() || first > last || last >= image.size())
+    {
+      if (!send_all(fd, RESPONSE_BAD_RANGE, sizeof(RESPONSE_BAD_RANGE) - 1))
+        return;
+      continue;
+    }
+
+    char header[256];
+    int header_length;
+    if (ranged)
+      header_length = snprintf(header, sizeof(header),
+                               "HTTP/1.1 206 Partial Content\r\nContent-Type: application/octet-stream\r\n"
+                               "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%zu\r\nContent-Length: %" PRIu64 "\r\n\r\n",
+                               first, last, image.size(), last - first + 1);
+    else
+      header_length = snprintf(header, sizeof(header),
+                               "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                               "Content-Length: %zu\r\n\r\n",
+                               image.size());
+
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      stats.requests++;
+      if (stats.first_offset == UINT32_MAX)
+        stats.first_offset = first;
+    }
+
+    if (!send_all(fd, header, header_length) || !send_body(fd, image.data() + first, last - first + 1))
+      return;
+  }
+}
+
+bool RangeServer::send_all(int fd, const void *data, size_t length)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+
+  while (length > 0)
+  {
+    ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return false;
+    bytes += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+// Paces the body to the configured rate and drops the connection where drop_after() asked
+bool RangeServer::send_body(int fd, const uint8_t *data, size_t length)
+{
+  uint64_t start = now_us();
+  size_t offset = 0;
+
+  while (offset < length && running)
+  {
+    size_t slice = length - offset < SEND_SLICE ? length - offset : SEND_SLICE;
+
+    int64_t left = drop_bytes;
+    if (left >= 0 && (uint64_t)left < slice)
+    {
+      send_all(fd, data + offset, left);
+      drop_bytes = -1;
+      ESP_LOGI(TAG, "Dropping the connection part way through a response.");
+      return false;
+    }
+    if (left >= 0)
+      drop_bytes = left - (int64_t)slice;
+
+    if (!send_all(fd, data + offset, slice))
+      return false;
+    offset += slice;
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      stats.body_bytes += slice;
+    }
+
+    uint32_t bytes_per_second = rate;
+    if (bytes_per_second > 0)
+    {
+      uint64_t due = start + offset * 1000000ULL / bytes_per_second;
+      uint64_t now = now_us();
+      if (due > now)
+        usleep(due - now);
+    }
+  }
+  return offset == length;
+}
@@ -0,0 +1,71 @@
+#ifndef RANGE_SERVER_H_
+#define RANGE_SERVER_H_
+
+// Includes
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Local stand-in for the file server an update manifest points at: one image served over
+// HTTP/1.1 with keep-alive, answering GETs with a Range header with 206 and the rest with 200.
+// One thread serves one connection at a time, which is all the download engine opens. The
+// response body can be paced to a network's rate, and a connection dropped part way through
+// a response as a lost link would.
+
+typedef struct
+{
+  uint32_t connections;  // Accepted since start()
+  uint32_t requests;     // Answered with the image or part of it
+  uint64_t body_bytes;   // Image bytes sent
+  uint32_t first_offset; // Start of the first range requested, UINT32_MAX before one
+} range_server_stats;
+
+class RangeServer
+{
+private:
+  // Class variables
+  static constexpr uint32_t MAX_HEADER_SIZE = 4096;
+  static constexpr uint32_t SEND_SLICE = 4096; // Pacing granularity
+
+  int listen_fd;
+  int wakeup_fd;
+  uint16_t port;
+  std::string path;
+  std::vector<uint8_t> image;
+
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<uint32_t> rate;       // Body bytes per second, 0 unpaced
+  std::atomic<int64_t> drop_bytes;  // Body bytes left before the connection is dropped, -1 never
+
+  std::mutex stats_mutex;
+  range_server_stats stats; // Guarded by stats_mutex
+
+  static uint64_t now_us();
+
+  void run();
+  void serve(int fd);
+  bool wait_readable(int fd);
+  bool send_all(int fd, const void *data, size_t length);
+  bool send_body(int fd, const uint8_t *data, size_t length);
+
+public:
+  RangeServer();
+  ~RangeServer();
+
+  // Serves image at path on the loopback interface, port 0 picks a free one
+  bool start(const std::vector<uint8_t> &image, const std::string &path, uint16_t port = 0);
+  void stop();
+
+  // Callable while serving
+  void set_rate(uint32_t bytes_per_second);
+  void drop_after(uint64_t bytes); // Once, counted from now
+
+  uint16_t get_port();
+  range_server_stats get_stats();
+};
+
+#endif // RANGE_SERVER_H_
@@ -0,0 +1,179 @@
+/*
+ * Host implementation of the mbedTLS SHA-256 calls in include/mbedtls/sha256.h,
+ * FIPS 180-4 in the plain form.
+ */
+
+#include <string.h>
+
+#include "mbedtls/sha256.h"
+
+static const uint32_t ulRoundConstants[ 64 ] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define sha256ROTR( x, n )    ( ( ( x ) >> ( n ) ) | ( ( x ) << ( 32 - ( n ) ) ) )
+
+static void prvProcessBlock( uint32_t * pulState,
+                             const uint8_t * pucBlock )
+{
+    uint32_t ulW[ 64 ];
+    uint32_t a, b, c, d, e, f, g, h;
+    int i;
+
+    for( i = 0; i < 16; i++ )
+    {
+        ulW[ i ] = ( ( uint32_t ) pucBlock[ i * 4 ] << 24 ) | ( ( uint32_t ) pucBlock[ i * 4 + 1 ] << 16 ) |
+                   ( ( uint32_t ) pucBlock[ i * 4 + 2 ] << 8 ) | ( uint32_t ) pucBlock[ i * 4 + 3 ];
+    }
+
+    for( i = 16; i < 64; i++ )
+    {
+        uint32_t s0 = sha256ROTR( ulW[ i - 15 ], 7 ) ^ sha256ROTR( ulW[ i - 15 ], 18 ) ^ ( ulW[ i - 15 ] >> 3 );
+        uint32_t s1 = sha256ROTR( ulW[ i - 2 ], 17 ) ^ sha256ROTR( ulW[ i - 2 ], 19 ) ^ ( ulW[ i - 2 ] >> 10 );
+
+        ulW[ i ] = ulW[ i - 16 ] + s0 + ulW[ i - 7 ] + s1;
+    }
+
+    a = pulState[ 0 ];
+    b = pulState[ 1 ];
+    c = pulState[ 2 ];
+    d = pulState[ 3 ];
+    e = pulState[ 4 ];
+    f = pulState[ 5 ];
+    g = pulState[ 6 ];
+    h = pulState[ 7 ];
+
+    for( i = 0; i < 64; i++ )
+    {
+        uint32_t S1 = sha256ROTR( e, 6 ) ^ sha256ROTR( e, 11 ) ^ sha256ROTR( e, 25 );
+        uint32_t ch = ( e & f ) ^ ( ~e & g );
+        uint32_t t1 = h + S1 + ch + ulRoundConstants[ i ] + ulW[ i ];
+        uint32_t S0 = sha256ROTR( a, 2 ) ^ sha256ROTR( a, 13 ) ^ sha256ROTR( a, 22 );
+        uint32_t maj = ( a & b ) ^ ( a & c ) ^ ( b & c );
+        uint32_t t2 = S0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    pulState[ 0 ] += a;
+    pulState[ 1 ] += b;
+    pulState[ 2 ] += c;
+    pulState[ 3 ] += d;
+    pulState[ 4 ] += e;
+    pulState[ 5 ] += f;
+    pulState[ 6 ] += g;
+    pulState[ 7 ] += h;
+}
+/*-----------------------------------------------------------*/
+
+void mbedtls_sha256_init( mbedtls_sha256_context * ctx )
+{
+    memset( ctx, 0, sizeof( *ctx ) );
+}
+/*-----------------------------------------------------------*/
+
+void mbedtls_sha256_free( mbedtls_sha256_context * ctx )
+{
+    memset( ctx, 0, sizeof( *ctx ) );
+}
+/*-----------------------------------------------------------*/
+
+int mbedtls_sha256_starts( mbedtls_sha256_context * ctx,
+                           int is224 )
+{
+    static const uint32_t ulInitialState[ 8 ] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    if( is224 != 0 )
+    {
+        return -1;
+    }
+
+    memcpy( ctx->state, ulInitialState, sizeof( ulInitialState ) );
+    ctx->total = 0;
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+int mbedtls_sha256_update( mbedtls_sha256_context * ctx,
+                           const unsigned char * input,
+                           size_t ilen )
+{
+    size_t xFill = ( size_t ) ( ctx->total % 64 );
+
+    ctx->total += ilen;
+
+    if( ( xFill > 0 ) && ( xFill + ilen >= 64 ) )
+    {
+        memcpy( ctx->buffer + xFill, input, 64 - xFill );
+        prvProcessBlock( ctx->state, ctx->buffer );
+        input += 64 - xFill;
+        ilen -= 64 - xFill;
+        xFill = 0;
+    }
+
+    for( ; ilen >= 64 && xFill == 0; input += 64, ilen -= 64 )
+    {
+        prvProcessBlock( ctx->state, input );
+    }
+
+    memcpy( ctx->buffer + xFill, input, ilen );
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+int mbedtls_sha256_finish( mbedtls_sha256_context * ctx,
+                           unsigned char * output )
+{
+    uint64_t ullBits = ctx->total * 8;
+    size_t xFill = ( size_t ) ( ctx->total % 64 );
+    int i;
+
+    ctx->buffer[ xFill++ ] = 0x80;
+
+    if( xFill > 56 )
+    {
+        memset( ctx->buffer + xFill, 0, 64 - xFill );
+        prvProcessBlock( ctx->state, ctx->buffer );
+        xFill = 0;
+    }
+
+    memset( ctx->buffer + xFill, 0, 56 - xFill );
+
+    for( i = 0; i < 8; i++ )
+    {
+        ctx->buffer[ 56 + i ] = ( uint8_t ) ( ullBits >> ( 56 - i * 8 ) );
+    }
+
+    prvProcessBlock( ctx->state, ctx->buffer );
+
+    for( i = 0; i < 8; i++ )
+    {
+        output[ i * 4 ] = ( uint8_t ) ( ctx->state[ i ] >> 24 );
+        output[ i * 4 + 1 ] = ( uint8_t ) ( ctx->state[ i ] >> 16 );
+        output[ i * 4 + 2 ] = ( uint8_t ) ( ctx->state[ i ] >> 8 );
+        output[ i * 4 + 3 ] = ( uint8_t ) ctx->state[ i ];
+    }
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
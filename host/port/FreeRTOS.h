@@ -0,0 +1,35 @@
+/*
+ * Host stand-in for the FreeRTOS kernel header. The middleware only needs the
+ * base types, the tick rate, configASSERT and the heap hooks, so Linux builds of
+ * the device-side stack compile against this instead of a kernel port.
+ */
+
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define configTICK_RATE_HZ    ( 1000 )
+#define configASSERT( x )     assert( x )
+
+#define pdFALSE               ( ( BaseType_t ) 0 )
+#define pdTRUE                ( ( BaseType_t ) 1 )
+#define pdFAIL                ( pdFALSE )
+#define pdPASS                ( pdTRUE )
+
+#define portMAX_DELAY         ( ( TickType_t ) 0xffffffffUL )
+#define portTICK_PERIOD_MS    ( ( TickType_t ) 1000 / configTICK_RATE_HZ )
+#define pdMS_TO_TICKS( x )    ( ( TickType_t ) ( ( ( uint64_t ) ( x ) * configTICK_RATE_HZ ) / 1000U ) )
+#define pdTICKS_TO_MS( x )    ( ( TickType_t ) ( ( ( uint64_t ) ( x ) * 1000U ) / configTICK_RATE_HZ ) )
+
+#define pvPortMalloc( x )     malloc( x )
+#define vPortFree( x )        free( x )
+
+#endif /* HOST_FREERTOS_H */
@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for the ESP-IDF error codes the device-side sources check.
+ */
+
+#ifndef HOST_ESP_ERR_H
+#define HOST_ESP_ERR_H
+
+typedef int esp_err_t;
+
+#define ESP_OK                     0
+#define ESP_FAIL                   -1
+#define ESP_ERR_INVALID_SIZE       0x104
+#define ESP_ERR_INVALID_STATE      0x103
+#define ESP_ERR_NVS_BASE           0x1100
+#define ESP_ERR_NVS_NOT_FOUND      ( ESP_ERR_NVS_BASE + 0x02 )
+
+#endif /* HOST_ESP_ERR_H */
@@ -0,0 +1,55 @@
+/*
+ * Host implementation of the ESP-IDF logging calls declared in esp_log.h, shared by
+ * the real-time host tools and the control simulator.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "esp_log.h"
+
+static volatile esp_log_level_t xLogLevel = ESP_LOG_WARN;
+
+static const char cLevelLetters[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+
+void esp_log_level_set( const char * pcTag,
+                        esp_log_level_t xLevel )
+{
+    ( void ) pcTag;
+    xLogLevel = xLevel;
+}
+/*-----------------------------------------------------------*/
+
+void esp_log_write( esp_log_level_t xLevel,
+                    const char * pcTag,
+                    const char * pcFormat,
+                    ... )
+{
+    char cLine[ 512 ];
+    size_t xLength;
+    va_list xArgs;
+
+    if( ( xLevel == ESP_LOG_NONE ) || ( xLevel > xLogLevel ) )
+    {
+        return;
+    }
+
+    va_start( xArgs, pcFormat );
+    ( void ) vsnprintf( cLine, sizeof( cLine ), pcFormat, xArgs );
+    va_end( xArgs );
+
+    /* Middleware messages carry their own line endings, the firmware's do not. */
+    xLength = strlen( cLine );
+
+    while( ( xLength > 0 ) && ( ( cLine[ xLength - 1 ] == '\n' ) || ( cLine[ xLength - 1 ] == '\r' ) ) )
+    {
+        cLine[ --xLength ] = '\0';
+    }
+
+    /* One fprintf per line so concurrent stations do not interleave mid-line. */
+    fprintf( stderr, "%c (%lu) %s: %s\n", cLevelLetters[ xLevel ], ( unsigned long ) xTaskGetTickCount(), pcTag, cLine );
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,42 @@
+/*
+ * Host stand-in for the ESP-IDF logging macros, so the main/config headers and the
+ * firmware's portable sources log to stderr unchanged.
+ */
+
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+/* The tag is ignored, one level applies to the whole process. */
+void esp_log_level_set( const char * pcTag,
+                        esp_log_level_t xLevel );
+
+void esp_log_write( esp_log_level_t xLevel,
+                    const char * pcTag,
+                    const char * pcFormat,
+                    ... ) __attribute__( ( format( printf, 3, 4 ) ) );
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ESP_LOGE( tag, format, ... )    esp_log_write( ESP_LOG_ERROR, tag, format, ## __VA_ARGS__ )
+#define ESP_LOGW( tag, format, ... )    esp_log_write( ESP_LOG_WARN, tag, format, ## __VA_ARGS__ )
+#define ESP_LOGI( tag, format, ... )    esp_log_write( ESP_LOG_INFO, tag, format, ## __VA_ARGS__ )
+#define ESP_LOGD( tag, format, ... )    esp_log_write( ESP_LOG_DEBUG, tag, format, ## __VA_ARGS__ )
+#define ESP_LOGV( tag, format, ... )    esp_log_write( ESP_LOG_VERBOSE, tag, format, ## __VA_ARGS__ )
+
+#endif /* HOST_ESP_LOG_H */
@@ -0,0 +1,41 @@
+/*
+ * Host implementations of the kernel hooks declared in this directory, on the
+ * real clock. The control simulator in host/sim provides its own on a virtual one.
+ */
+
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "esp_timer.h"
+
+TickType_t xTaskGetTickCount( void )
+{
+    struct timespec xNow;
+
+    clock_gettime( CLOCK_MONOTONIC, &xNow );
+    return ( TickType_t ) ( ( uint64_t ) xNow.tv_sec * configTICK_RATE_HZ +
+                            ( uint64_t ) xNow.tv_nsec / ( 1000000000U / configTICK_RATE_HZ ) );
+}
+/*-----------------------------------------------------------*/
+
+void vTaskDelay( TickType_t xTicksToDelay )
+{
+    struct timespec xDelay =
+    {
+        .tv_sec = xTicksToDelay / configTICK_RATE_HZ,
+        .tv_nsec = ( long ) ( xTicksToDelay % configTICK_RATE_HZ ) * ( 1000000000L / configTICK_RATE_HZ )
+    };
+
+    ( void ) nanosleep( &xDelay, NULL );
+}
+/*-----------------------------------------------------------*/
+
+int64_t esp_timer_get_time( void )
+{
+    struct timespec xNow;
+
+    clock_gettime( CLOCK_MONOTONIC, &xNow );
+    return ( int64_t ) xNow.tv_sec * 1000000 + xNow.tv_nsec / 1000;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,124 @@
+/*
+ * Host implementation of the statically allocated queues in queue.h, on POSIX
+ * threads. Blocking calls wait on the queue's condition variable against the
+ * monotonic clock.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+QueueHandle_t xQueueCreateStatic( UBaseType_t uxQueueLength,
+                                  UBaseType_t uxItemSize,
+                                  uint8_t * pucQueueStorage,
+                                  StaticQueue_t * pxStaticQueue )
+{
+    pthread_condattr_t xAttributes;
+
+    pthread_condattr_init( &xAttributes );
+    pthread_condattr_setclock( &xAttributes, CLOCK_MONOTONIC );
+    pthread_mutex_init( &pxStaticQueue->xMutex, NULL );
+    pthread_cond_init( &pxStaticQueue->xChanged, &xAttributes );
+    pthread_condattr_destroy( &xAttributes );
+
+    pxStaticQueue->pucStorage = pucQueueStorage;
+    pxStaticQueue->uxLength = uxQueueLength;
+    pxStaticQueue->uxItemSize = uxItemSize;
+    pxStaticQueue->uxHead = 0;
+    pxStaticQueue->uxCount = 0;
+
+    return pxStaticQueue;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Waits with the queue's mutex held until it has room, or an item if xForItem,
+ * or the ticks run out. Returns pdFAIL on a timeout.
+ */
+static BaseType_t prvWait( QueueHandle_t xQueue,
+                           TickType_t xTicksToWait,
+                           BaseType_t xForItem )
+{
+    struct timespec xDeadline;
+
+    clock_gettime( CLOCK_MONOTONIC, &xDeadline );
+    xDeadline.tv_sec += xTicksToWait / configTICK_RATE_HZ;
+    xDeadline.tv_nsec += ( long ) ( xTicksToWait % configTICK_RATE_HZ ) * ( 1000000000L / configTICK_RATE_HZ );
+
+    if( xDeadline.tv_nsec >= 1000000000L )
+    {
+        xDeadline.tv_sec++;
+        xDeadline.tv_nsec -= 1000000000L;
+    }
+
+    while( xForItem ? ( xQueue->uxCount == 0 ) : ( xQueue->uxCount == xQueue->uxLength ) )
+    {
+        if( xTicksToWait == 0 )
+        {
+            return pdFAIL;
+        }
+
+        if( xTicksToWait == portMAX_DELAY )
+        {
+            pthread_cond_wait( &xQueue->xChanged, &xQueue->xMutex );
+        }
+        else if( pthread_cond_timedwait( &xQueue->xChanged, &xQueue->xMutex, &xDeadline ) != 0 )
+        {
+            return ( xForItem ? ( xQueue->uxCount > 0 ) : ( xQueue->uxCount < xQueue->uxLength ) ) ? pdPASS : pdFAIL;
+        }
+    }
+
+    return pdPASS;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xQueueSend( QueueHandle_t xQueue,
+                       const void * pvItemToQueue,
+                       TickType_t xTicksToWait )
+{
+    BaseType_t xResult;
+
+    pthread_mutex_lock( &xQueue->xMutex );
+
+    xResult = prvWait( xQueue, xTicksToWait, pdFALSE );
+
+    if( xResult == pdPASS )
+    {
+        UBaseType_t uxTail = ( xQueue->uxHead + xQueue->uxCount ) % xQueue->uxLength;
+
+        memcpy( xQueue->pucStorage + uxTail * xQueue->uxItemSize, pvItemToQueue, xQueue->uxItemSize );
+        xQueue->uxCount++;
+        pthread_cond_broadcast( &xQueue->xChanged );
+    }
+
+    pthread_mutex_unlock( &xQueue->xMutex );
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xQueueReceive( QueueHandle_t xQueue,
+                          void * pvBuffer,
+                          TickType_t xTicksToWait )
+{
+    BaseType_t xResult;
+
+    pthread_mutex_lock( &xQueue->xMutex );
+
+    xResult = prvWait( xQueue, xTicksToWait, pdTRUE );
+
+    if( xResult == pdPASS )
+    {
+        memcpy( pvBuffer, xQueue->pucStorage + xQueue->uxHead * xQueue->uxItemSize, xQueue->uxItemSize );
+        xQueue->uxHead = ( xQueue->uxHead + 1 ) % xQueue->uxLength;
+        xQueue->uxCount--;
+        pthread_cond_broadcast( &xQueue->xChanged );
+    }
+
+    pthread_mutex_unlock( &xQueue->xMutex );
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,12 @@
+#ifndef NETWORK_CONTEXT_H_
+#define NETWORK_CONTEXT_H_
+
+/* Each transport defines the same NetworkContext. The host tools pass TlsTransportParams_t */
+/* as pParams, the same as the samples do with the ESP32 transport. */
+struct NetworkContext
+{
+    /* TlsTransportParams_t */
+    void * pParams;
+};
+
+#endif /* NETWORK_CONTEXT_H_ */
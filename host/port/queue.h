@@ -0,0 +1,47 @@
+/*
+ * Host stand-in for statically allocated FreeRTOS queues, a ring of items under a
+ * mutex with a condition variable for blocked senders and receivers.
+ */
+
+#ifndef HOST_QUEUE_H
+#define HOST_QUEUE_H
+
+#include <pthread.h>
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct StaticQueue
+{
+    pthread_mutex_t xMutex;
+    pthread_cond_t xChanged;
+    uint8_t * pucStorage;
+    UBaseType_t uxLength;
+    UBaseType_t uxItemSize;
+    UBaseType_t uxHead;
+    UBaseType_t uxCount;
+} StaticQueue_t;
+
+typedef StaticQueue_t * QueueHandle_t;
+
+QueueHandle_t xQueueCreateStatic( UBaseType_t uxQueueLength,
+                                  UBaseType_t uxItemSize,
+                                  uint8_t * pucQueueStorage,
+                                  StaticQueue_t * pxStaticQueue );
+
+BaseType_t xQueueSend( QueueHandle_t xQueue,
+                       const void * pvItemToQueue,
+                       TickType_t xTicksToWait );
+
+BaseType_t xQueueReceive( QueueHandle_t xQueue,
+                          void * pvBuffer,
+                          TickType_t xTicksToWait );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_QUEUE_H */
@@ -0,0 +1,23 @@
+/*
+ * Host stand-in for the FreeRTOS task API used by the middleware.
+ */
+
+#ifndef HOST_TASK_H
+#define HOST_TASK_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Milliseconds of CLOCK_MONOTONIC, so ticks compare across threads like on the device. */
+TickType_t xTaskGetTickCount( void );
+
+void vTaskDelay( TickType_t xTicksToDelay );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_TASK_H */
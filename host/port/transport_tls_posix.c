@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file transport_tls_posix.c
+ * @brief Host port of the TLS_Socket_* transport over plain POSIX TCP sockets.
+ *
+ * The host tools talk to a broker stand-in on the same machine, so the TLS layer of
+ * transport_tls_esp32.c is left out and the credentials are ignored. Timeouts, the
+ * return conventions and TLS_Socket_Wait() match the ESP32 port, so the middleware
+ * and the network loop behave as they do on the device. poll() replaces select() so
+ * a fleet of stations is not limited to FD_SETSIZE descriptors.
+ */
+
+/* Standard includes. */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+
+/* TLS transport header. */
+#include "transport_tls_socket.h"
+#include "network_context.h"
+
+#include "esp_log.h"
+
+static const char * TAG = "tls_posix";
+
+/**
+ * @brief Definition of the network context for the transport interface
+ * implementation that uses POSIX sockets.
+ */
+typedef struct PosixTransportParams
+{
+    int xSocket;
+    uint32_t ulReceiveTimeoutMs;
+    uint32_t ulSendTimeoutMs;
+} PosixTransportParams_t;
+
+
+static void prvSetSocketTimeout( int xSocket,
+                                 int xOption,
+                                 uint32_t ulTimeoutMs )
+{
+    struct timeval xTimeout =
+    {
+        .tv_sec = ulTimeoutMs / 1000,
+        .tv_usec = ( ulTimeoutMs % 1000 ) * 1000
+    };
+
+    ( void ) setsockopt( xSocket, SOL_SOCKET, xOption, &xTimeout, sizeof( xTimeout ) );
+}
+
+static PosixTransportParams_t * prvGetTransport( NetworkContext_t * pNetworkContext )
+{
+    TlsTransportParams_t * pxTlsParams;
+
+    if( ( pNetworkContext == NULL ) || ( pNetworkContext->pParams == NULL ) )
+    {
+        return NULL;
+    }
+
+    pxTlsParams = ( TlsTransportParams_t * ) pNetworkContext->pParams;
+
+    return ( PosixTransportParams_t * ) pxTlsParams->xSSLContext;
+}
+
+static int prvConnectSocket( const char * pHostName,
+                             uint16_t usPort,
+                             uint32_t ulSendTimeoutMs )
+{
+    struct addrinfo xHints;
+    struct addrinfo * pxResults = NULL;
+    struct addrinfo * pxAddress;
+    char cPort[ 6 ];
+    int xSocket = -1;
+    int xNoDelay = 1;
+
+    memset( &xHints, 0, sizeof( xHints ) );
+    xHints.ai_family = AF_UNSPEC;
+    xHints.ai_socktype = SOCK_STREAM;
+    xHints.ai_protocol = IPPROTO_TCP;
+    snprintf( cPort, sizeof( cPort ), "%u", usPort );
+
+    if( getaddrinfo( pHostName, cPort, &xHints, &pxResults ) != 0 )
+    {
+        ESP_LOGE( TAG, "Failed to resolve %s", pHostName );
+        return -1;
+    }
+
+    for( pxAddress = pxResults; pxAddress != NULL; pxAddress = pxAddress->ai_next )
+    {
+        xSocket = socket( pxAddress->ai_family, pxAddress->ai_socktype, pxAddress->ai_protocol );
+
+        if( xSocket < 0 )
+        {
+            continue;
+        }
+
+        /* The connect is bounded by the send timeout, as the handshake is on the device. */
+        prvSetSocketTimeout( xSocket, SO_SNDTIMEO, ulSendTimeoutMs );
+
+        if( connect( xSocket, pxAddress->ai_addr, pxAddress->ai_addrlen ) == 0 )
+        {
+            break;
+        }
+
+        close( xSocket );
+        xSocket = -1;
+    }
+
+    freeaddrinfo( pxResults );
+
+    if( xSocket >= 0 )
+    {
+        /* Telemetry is written in network buffer sized parts, do not hold them back. */
+        ( void ) setsockopt( xSocket, IPPROTO_TCP, TCP_NODELAY, &xNoDelay, sizeof( xNoDelay ) );
+    }
+
+    return xSocket;
+}
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
+                                         const char * pHostName,
+                                         uint16_t usPort,
+                                         const NetworkCredentials_t * pNetworkCredentials,
+                                         uint32_t ulReceiveTimeoutMs,
+                                         uint32_t ulSendTimeoutMs )
+{
+    TlsTransportParams_t * pxTlsParams;
+    PosixTransportParams_t * pxPosixTransport;
+
+    if( ( pNetworkContext == NULL ) ||
+        ( pHostName == NULL ) ||
+        ( pNetworkCredentials == NULL ) ||
+        ( pNetworkContext->pParams == NULL ) )
+    {
+        ESP_LOGE( TAG, "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p, "
+                  "pHostName=%p, pNetworkCredentials=%p.",
+                  ( void * ) pNetworkContext,
+                  ( const void * ) pHostName,
+                  ( const void * ) pNetworkCredentials );
+        return eTLSTransportInvalidParameter;
+    }
+
+    pxTlsParams = ( TlsTransportParams_t * ) pNetworkContext->pParams;
+
+    if( pxTlsParams->xSSLContext != NULL )
+    {
+        pxPosixTransport = ( PosixTransportParams_t * ) pxTlsParams->xSSLContext;
+
+        if( pxPosixTransport->xSocket >= 0 )
+        {
+            close( pxPosixTransport->xSocket );
+            pxPosixTransport->xSocket = -1;
+        }
+    }
+    else
+    {
+        pxPosixTransport = ( PosixTransportParams_t * ) pvPortMalloc( sizeof( PosixTransportParams_t ) );
+
+        if( pxPosixTransport == NULL )
+        {
+            return eTLSTransportInsufficientMemory;
+        }
+
+        pxPosixTransport->xSocket = -1;
+        pxTlsParams->xSSLContext = ( void * ) pxPosixTransport;
+    }
+
+    pxPosixTransport->ulReceiveTimeoutMs = ulReceiveTimeoutMs;
+    pxPosixTransport->ulSendTimeoutMs = ulSendTimeoutMs;
+    pxPosixTransport->xSocket = prvConnectSocket( pHostName, usPort, ulSendTimeoutMs );
+
+    if( pxPosixTransport->xSocket < 0 )
+    {
+        ESP_LOGE( TAG, "Failed establishing TCP connection to %s:%u, errno= %d", pHostName, usPort, errno );
+        vPortFree( pxPosixTransport );
+        pxTlsParams->xSSLContext = NULL;
+        return eTLSTransportConnectFailure;
+    }
+
+    ESP_LOGI( TAG, "(Network connection %p) Connection to %s established.",
+              ( void * ) pNetworkContext,
+              pHostName );
+
+    return eTLSTransportSuccess;
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Socket_Disconnect( NetworkContext_t * pNetworkContext )
+{
+    PosixTransportParams_t * pxPosixTransport = prvGetTransport( pNetworkContext );
+
+    if( pxPosixTransport == NULL )
+    {
+        ESP_LOGE( TAG, "Invalid input parameter(s): Arguments cannot be NULL." );
+        return;
+    }
+
+    if( pxPosixTransport->xSocket >= 0 )
+    {
+        ( void ) shutdown( pxPosixTransport->xSocket, SHUT_RDWR );
+        close( pxPosixTransport->xSocket );
+    }
+
+    vPortFree( pxPosixTransport );
+    ( ( TlsTransportParams_t * ) pNetworkContext->pParams )->xSSLContext = NULL;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Socket_Recv( NetworkContext_t * pNetworkContext,
+                         void * pBuffer,
+                         size_t xBytesToRecv )
+{
+    PosixTransportParams_t * pxPosixTransport = prvGetTransport( pNetworkContext );
+    struct pollfd xPollFd;
+    ssize_t xReceived;
+    int xStatus;
+
+    if( ( pxPosixTransport == NULL ) ||
+        ( pBuffer == NULL ) ||
+        ( xBytesToRecv == 0 ) )
+    {
+        ESP_LOGE( TAG, "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p, "
+                  "pBuffer=%p, xBytesToRecv=%zu.", ( void * ) pNetworkContext, pBuffer, xBytesToRecv );
+        return eTLSTransportInvalidParameter;
+    }
+
+    xPollFd.fd = pxPosixTransport->xSocket;
+    xPollFd.events = POLLIN;
+    xPollFd.revents = 0;
+
+    xStatus = poll( &xPollFd, 1, ( int ) pxPosixTransport->ulReceiveTimeoutMs );
+
+    if( xStatus == 0 )
+    {
+        return 0;
+    }
+    else if( xStatus < 0 )
+    {
+        ESP_LOGE( TAG, "Poll failed, errno= %d", errno );
+        return -1;
+    }
+
+    xReceived = recv( pxPosixTransport->xSocket, pBuffer, xBytesToRecv, MSG_DONTWAIT );
+
+    if( ( xReceived < 0 ) && ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) ) )
+    {
+        return 0;
+    }
+    else if( xReceived <= 0 )
+    {
+        /* An orderly shutdown by the broker is a lost connection to the middleware. */
+        ESP_LOGE( TAG, "Reading failed, errno= %d", xReceived < 0 ? errno : 0 );
+        return -1;
+    }
+
+    return ( int32_t ) xReceived;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Socket_Send( NetworkContext_t * pNetworkContext,
+                         const void * pBuffer,
+                         size_t xBytesToSend )
+{
+    PosixTransportParams_t * pxPosixTransport = prvGetTransport( pNetworkContext );
+    ssize_t xSent;
+
+    if( ( pxPosixTransport == NULL ) ||
+        ( pBuffer == NULL ) ||
+        ( xBytesToSend == 0 ) )
+    {
+        ESP_LOGE( TAG, "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p, "
+                  "pBuffer=%p, xBytesToSend=%zu.", ( void * ) pNetworkContext, pBuffer, xBytesToSend );
+        return eTLSTransportInvalidParameter;
+    }
+
+    /* Blocks up to the send timeout, a full socket buffer is the broker pushing back. */
+    xSent = send( pxPosixTransport->xSocket, pBuffer, xBytesToSend, MSG_NOSIGNAL );
+
+    if( ( xSent < 0 ) && ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) ) )
+    {
+        return 0;
+    }
+    else if( xSent < 0 )
+    {
+        ESP_LOGE( TAG, "Writing failed, errno= %d", errno );
+        return -1;
+    }
+
+    return ( int32_t ) xSent;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Socket_Wait( NetworkContext_t * pNetworkContext,
+                         int xWakeupFd,
+                         uint32_t ulTimeoutMs )
+{
+    PosixTransportParams_t * pxPosixTransport = prvGetTransport( pNetworkContext );
+    struct pollfd xPollFds[ 2 ];
+    nfds_t xCount = 1;
+    int32_t lStatus;
+
+    if( pxPosixTransport == NULL )
+    {
+        ESP_LOGE( TAG, "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p.", ( void * ) pNetworkContext );
+        return eTLSTransportInvalidParameter;
+    }
+
+    xPollFds[ 0 ].fd = pxPosixTransport->xSocket;
+    xPollFds[ 0 ].events = POLLIN;
+    xPollFds[ 0 ].revents = 0;
+
+    if( xWakeupFd >= 0 )
+    {
+        xPollFds[ 1 ].fd = xWakeupFd;
+        xPollFds[ 1 ].events = POLLIN;
+        xPollFds[ 1 ].revents = 0;
+        xCount = 2;
+    }
+
+    lStatus = poll( xPollFds, xCount, ( int ) ulTimeoutMs );
+
+    if( lStatus < 0 )
+    {
+        if( errno == EINTR )
+        {
+            return 0;
+        }
+
+        ESP_LOGE( TAG, "Poll failed, errno= %d", errno );
+        return -1;
+    }
+
+    lStatus = 0;
+
+    /* A hang-up is reported as readable so the process loop sees the closed connection. */
+    if( xPollFds[ 0 ].revents & ( POLLIN | POLLHUP | POLLERR ) )
+    {
+        lStatus |= tlsWAIT_READABLE;
+    }
+
+    if( ( xCount > 1 ) && ( xPollFds[ 1 ].revents & POLLIN ) )
+    {
+        lStatus |= tlsWAIT_WAKEUP;
+    }
+
+    return lStatus;
+}
+/*-----------------------------------------------------------*/
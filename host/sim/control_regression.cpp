@@ -0,0 +1,251 @@
+// Includes
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "motor_controller.hpp"
+#include "scenarios.hpp"
+
+// Closed-loop regression of the firmware's automatic modes over the scenarios of scenarios.cpp,
+// each checked against its limits. Reports every metric and segment as JSON.
+
+static double wall_time()
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void write_number(FILE *file, float value)
+{
+  if (isnan(value))
+    fprintf(file, "null");
+  else
+    fprintf(file, "%.4g", value);
+}
+
+static bool write_report(const char *path, const std::vector<uint8_t> &selected, const scenario_result *results, bool passed)
+{
+  FILE *file = fopen(path, "w");
+
+  if (file == nullptr)
+    return false;
+
+  fprintf(file, "{\n  \"passed\": %s,\n  \"scenarios\": [", passed ? "true" : "false");
+  for (size_t i = 0; i < selected.size(); i++)
+  {
+    const scenario &test = SCENARIOS[selected[i]];
+    const scenario_result &result = results[i];
+
+    fprintf(file, "%s\n    {\n      \"name\": \"%s\",\n      \"mode\": \"%s\",\n      \"completed\": %s,\n"
+                  "      \"passed\": %s,\n      \"wall_time_s\": ",
+            i > 0 ? "," : "", test.name, test.mode == AUTO_VELOCITY ? "velocity" : "position",
+            result.completed ? "true" : "false", scenario_passed(test, result) ? "true" : "false");
+    write_number(file, result.wall_time);
+
+    fprintf(file, ",\n      \"metrics\": {");
+    for (uint8_t j = 0; j < METRIC_COUNT; j++)
+    {
+      float limit = metric_limit(test, j);
+
+      fprintf(file, "%s\n        \"%s\": {\"value\": ", j > 0 ? "," : "", METRIC_NAMES[j]);
+      write_number(file, result.completed ? result.metrics[j] : NAN);
+      fprintf(file, ", \"limit\": ");
+      write_number(file, limit);
+      fprintf(file, ", \"passed\": %s}", result.completed && metric_passed(result.metrics[j], limit) ? "true" : "false");
+    }
+
+    fprintf(file, "\n      },\n      \"segments\": [");
+    for (uint8_t j = 0; j < result.segment_count; j++)
+    {
+      const segment_result &segment = result.segments[j];
+
+      fprintf(file, "%s\n        {\"start_s\": %.3f, \"end_s\": %.3f, \"target\": %.1f, \"kind\": \"%s\"",
+              j > 0 ? "," : "", segment.start, segment.end, segment.target,
+              segment.disturbance ? "disturbance" : "setpoint");
+      for (uint8_t k = 0; k <= METRIC_PEAK_CURRENT; k++)
+      {
+        fprintf(file, ", \"%s\": ", METRIC_NAMES[k]);
+        write_number(file, segment.metrics[k]);
+      }
+      fprintf(file, "}");
+    }
+    fprintf(file, "%s]\n    }", result.segment_count > 0 ? "\n      " : "");
+  }
+  fprintf(file, "\n  ]\n}\n");
+
+  return fclose(file) == 0;
+}
+
+static void print_result(const scenario &test, const scenario_result &result)
+{
+  if (!result.completed)
+  {
+    printf("%-26s did not complete                                                      FAIL\n", test.name);
+    return;
+  }
+
+  printf("%-26s %6.3f %7.2f %7.2f %8.1f %8.1f %7.0f %6.1f %7.1f   %s\n", test.name,
+         result.metrics[METRIC_SETTLING_TIME], result.metrics[METRIC_OVERSHOOT],
+         result.metrics[METRIC_STEADY_STATE_ERROR], result.metrics[METRIC_IAE],
+         result.metrics[METRIC_PEAK_DEVIATION], result.metrics[METRIC_PEAK_CURRENT],
+         result.metrics[METRIC_PID_CPU_MEAN], result.metrics[METRIC_PID_CPU_MAX],
+         scenario_passed(test, result) ? "ok" : "FAIL");
+}
+
+typedef struct
+{
+  const std::vector<uint8_t> *selected;
+  const scenario_output *output;
+} regression_jobs;
+
+static void run_job(size_t job, scenario_result *result, void *context)
+{
+  regression_jobs *jobs = static_cast<regression_jobs *>(context);
+  scenario_setup setup = {nullptr, nullptr};
+
+  run_scenario(SCENARIOS[(*jobs->selected)[job]], setup, *jobs->output, result);
+}
+
+static void job_finished(size_t job, const scenario_result &result, void *context)
+{
+  regression_jobs *jobs = static_cast<regression_jobs *>(context);
+
+  print_result(SCENARIOS[(*jobs->selected)[job]], result);
+  fflush(stdout);
+}
+
+// A process per scenario, results in the order of selected
+static void run_scenarios(const std::vector<uint8_t> &selected, uint32_t jobs, const scenario_output &output,
+                          scenario_result *results)
+{
+  regression_jobs context = {&selected, &output};
+
+  run_scenario_jobs(selected.size(), jobs, run_job, job_finished, &context, results);
+}
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --jobs N          Scenarios run at once (default one per core)\n"
+          "  --scenario NAME   Run only scenarios whose name contains NAME, repeatable\n"
+          "  --list            List the scenarios and their limits\n"
+          "  --report FILE     JSON report (default control_report.json)\n"
+          "  --trace DIR       Write each scenario's samples to DIR/<name>.csv\n"
+          "  --record DIR      Record each scenario's controller inputs to DIR/<name>.dtmr\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t jobs = cores > 0 ? cores : 1;
+  const char *report_path = "control_report.json";
+  scenario_output output = {nullptr, nullptr};
+  std::vector<const char *> filters;
+  bool list = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--jobs") == 0 && has_value)
+      jobs = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+    else if (strcmp(argv[i], "--scenario") == 0 && has_value)
+      filters.push_back(argv[++i]);
+    else if (strcmp(argv[i], "--list") == 0)
+      list = true;
+    else if (strcmp(argv[i], "--report") == 0 && has_value)
+      report_path = argv[++i];
+    else if (strcmp(argv[i], "--trace") == 0 && has_value)
+      output.trace_directory = argv[++i];
+    else if (strcmp(argv[i], "--record") == 0 && has_value)
+      output.record_directory = argv[++i];
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  std::vector<uint8_t> selected;
+  for (uint8_t i = 0; i < SCENARIO_COUNT; i++)
+  {
+    bool matched = filters.empty();
+
+    for (const char *filter : filters)
+      matched = matched || strstr(SCENARIOS[i].name, filter) != nullptr;
+    if (matched)
+      selected.push_back(i);
+  }
+
+  if (list)
+  {
+    for (uint8_t i : selected)
+    {
+      const scenario &test = SCENARIOS[i];
+
+      printf("%-26s %s %.0f at %.2f reversals/s for %.0f s", test.name,
+             test.mode == AUTO_VELOCITY ? "velocity" : "position", test.setpoint, test.freq, test.duration);
+      for (uint8_t j = 0; j <= METRIC_PEAK_CURRENT; j++)
+      {
+        if (!isnan(metric_limit(test, j)))
+          printf(", %s <= %g", METRIC_NAMES[j], metric_limit(test, j));
+      }
+      printf("\n");
+    }
+    return 0;
+  }
+
+  if (selected.empty())
+  {
+    fprintf(stderr, "No scenario matches.\n");
+    return 2;
+  }
+
+  for (const char *directory : {output.trace_directory, output.record_directory})
+  {
+    if (directory != nullptr && mkdir(directory, 0755) != 0 && errno != EEXIST)
+    {
+      fprintf(stderr, "Cannot create %s.\n", directory);
+      return 1;
+    }
+  }
+
+  printf("%-26s %6s %7s %7s %8s %8s %7s %6s %7s\n", "scenario", "settle", "over%", "sse", "iae", "peak dev",
+         "peak mA", "pid us", "max us");
+
+  std::vector<scenario_result> results(selected.size());
+  double started = wall_time();
+  run_scenarios(selected, jobs, output, results.data());
+
+  bool passed = true;
+  uint32_t failures = 0;
+  for (size_t i = 0; i < selected.size(); i++)
+  {
+    if (!scenario_passed(SCENARIOS[selected[i]], results[i]))
+    {
+      passed = false;
+      failures++;
+    }
+  }
+
+  printf("%u of %u scenarios passed in %.1f s on %u jobs.\n", (unsigned)(selected.size() - failures),
+         (unsigned)selected.size(), wall_time() - started, jobs);
+
+  if (!write_report(report_path, selected, results.data(), passed))
+  {
+    fprintf(stderr, "Cannot write %s.\n", report_path);
+    return 1;
+  }
+
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+// Includes
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "check.hpp"
+#include "nvs.h"
+
+extern "C"
+{
+#include "sample_azure_iot_dps_cache.h"
+}
+
+// The firmware's cache of the IoT Hub assigned by the Provisioning service, against the
+// simulator's NVS. Each boot is a fresh DPSCache_t over the NVS the last one left: the first
+// provisions and stores, the next uses the cached hub without DPS, a hub that fails after a cached
+// boot is provisioned again and replaced, a reconfigured ID scope or registration ID misses, and a
+// failed provisioning leaves nothing cached.
+
+static constexpr char SOURCE[] = "0ne00000000/motor-1";
+static constexpr char OTHER_SOURCE[] = "0ne00000000/motor-2";
+static constexpr char HUB_A[] = "hub-a.azure-devices.net";
+static constexpr char HUB_B[] = "hub-b.azure-devices.net";
+static constexpr char DEVICE_ID[] = "motor-1";
+
+// What the stand-in for DPS assigns, and how often it was run
+struct provisioning
+{
+  const char *hub;
+  bool fail;
+  int runs;
+};
+
+static uint8_t hostname[128];
+static uint8_t device_id[128];
+
+static uint32_t provision(void *context, uint8_t *hub, uint32_t *hub_length, uint8_t *device,
+                          uint32_t *device_length)
+{
+  provisioning *service = static_cast<provisioning *>(context);
+
+  service->runs++;
+  if (service->fail || strlen(service->hub) > *hub_length || sizeof(DEVICE_ID) - 1 > *device_length)
+    return 1;
+
+  // DPS does not terminate the hostname
+  memcpy(hub, service->hub, strlen(service->hub));
+  *hub_length = strlen(service->hub);
+  memcpy(device, DEVICE_ID, sizeof(DEVICE_ID) - 1);
+  *device_length = sizeof(DEVICE_ID) - 1;
+  return 0;
+}
+
+// A cache as the firmware sets it up at boot, over buffers left dirty by the last boot
+static DPSCache_t boot(const char *source, provisioning &service)
+{
+  DPSCache_t cache = {};
+
+  memset(hostname, 'x', sizeof(hostname));
+  memset(device_id, 'x', sizeof(device_id));
+  cache.pcSource = source;
+  cache.xProvision = provision;
+  cache.pvProvisionContext = &service;
+  cache.pucHostname = hostname;
+  cache.ulHostnameSize = sizeof(hostname);
+  cache.pucDeviceId = device_id;
+  cache.ulDeviceIdSize = sizeof(device_id);
+  return cache;
+}
+
+static bool resolved_to(const DPSCache_t &cache, const char *hub)
+{
+  return cache.ulHostnameLength == strlen(hub) && strcmp((const char *)cache.pucHostname, hub) == 0 &&
+         cache.ulDeviceIdLength == sizeof(DEVICE_ID) - 1 &&
+         memcmp(cache.pucDeviceId, DEVICE_ID, sizeof(DEVICE_ID) - 1) == 0;
+}
+
+int main()
+{
+  provisioning service = {HUB_A, false, 0};
+
+  // First boot, nothing cached
+  {
+    DPSCache_t cache = boot(SOURCE, service);
+
+    check(DPSCache_Resolve(&cache) == 0 && service.runs == 1, "a miss provisions");
+    check(resolved_to(cache, HUB_A), "a miss resolves to the assigned hub, terminated");
+    check(!cache.xCached, "a provisioned hub is not treated as cached");
+    check(!DPSCache_Unreachable(&cache) && service.runs == 1,
+          "a provisioned hub that fails is not provisioned again");
+  }
+
+  // Next boot, the cached hub is used and confirmed
+  {
+    DPSCache_t cache = boot(SOURCE, service);
+
+    check(DPSCache_Resolve(&cache) == 0 && service.runs == 1, "a hit does not provision");
+    check(resolved_to(cache, HUB_A) && cache.xCached, "a hit resolves to the cached hub");
+    DPSCache_Reached(&cache);
+    check(!DPSCache_Unreachable(&cache) && service.runs == 1,
+          "a cached hub that was reached is not blamed for later failures");
+  }
+
+  // The device was moved to another hub, the cached one fails
+  {
+    DPSCache_t cache = boot(SOURCE, service);
+    service.hub = HUB_B;
+
+    check(DPSCache_Resolve(&cache) == 0 && resolved_to(cache, HUB_A), "a stale hub is still a hit");
+    check(DPSCache_Unreachable(&cache) && service.runs == 2, "a stale cached hub falls back to DPS");
+    check(resolved_to(cache, HUB_B) && !cache.xCached, "the fallback resolves to the new hub");
+  }
+
+  {
+    DPSCache_t cache = boot(SOURCE, service);
+
+    check(DPSCache_Resolve(&cache) == 0 && service.runs == 2 && resolved_to(cache, HUB_B),
+          "the new hub replaces the cached one");
+  }
+
+  // Reconfigured with another registration ID
+  {
+    DPSCache_t cache = boot(OTHER_SOURCE, service);
+    service.hub = HUB_A;
+
+    check(DPSCache_Resolve(&cache) == 0 && service.runs == 3 && resolved_to(cache, HUB_A),
+          "another source misses and provisions");
+  }
+
+  // Provisioning fails after a cached hub failed
+  {
+    DPSCache_t cache = boot(OTHER_SOURCE, service);
+    service.fail = true;
+
+    check(DPSCache_Resolve(&cache) == 0 && cache.xCached, "a cached boot does not need DPS");
+    check(!DPSCache_Unreachable(&cache) && service.runs == 4, "a failed fallback is reported");
+  }
+
+  {
+    DPSCache_t cache = boot(OTHER_SOURCE, service);
+
+    check(DPSCache_Resolve(&cache) != 0 && service.runs == 5, "a failed fallback leaves no stale hub cached");
+    service.fail = false;
+    check(DPSCache_Resolve(&cache) == 0 && service.runs == 6 && resolved_to(cache, HUB_A),
+          "the next boot provisions");
+  }
+
+  printf("provisioned %d times\n", service.runs);
+  return check_summary();
+}
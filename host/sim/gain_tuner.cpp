@@ -0,0 +1,810 @@
+// Includes
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "calibration.hpp"
+#include "controller_tuning.hpp"
+#include "motor_plant.hpp"
+#include "nelder_mead.hpp"
+#include "record_format.hpp"
+#include "record_log.hpp"
+#include "scenarios.hpp"
+#include "system_id.hpp"
+#include "tuned_gains.hpp"
+
+// Offline tuning of the controller's fixed constants, in place of DC_Motor_Tuner.mlx. Candidate
+// PID gains and velocity filter lengths are loaded into the real MotorController as a unit's
+// NVS tuning and scored on the control regression's scenarios against a MotorPlant of the
+// identified motor, every scenario of every candidate in a process of its own so the search
+// runs on all cores. The search is Nelder-Mead from several starts, the current constants, the
+// gains system identification derived if the model came with them, and random points, all
+// advancing together so each round's candidates run at once. The cost of a scenario is the mean
+// of its motion metrics over their limits, with any excess over a limit weighted heavily, so the
+// tuned constants pass the regression wherever they can.
+
+static constexpr uint32_t DEFAULT_STARTS = 8;
+static constexpr uint32_t DEFAULT_EVALUATIONS = 120; // Per start
+static constexpr double INITIAL_STEP = 0.15;         // Of each parameter's range
+static constexpr double TOLERANCE = 0.005;
+static constexpr double EXCESS_WEIGHT = 10;
+static constexpr double FAILED_COST = 100; // A scenario that did not complete
+static constexpr uint8_t SIGNIFICANT_DIGITS = 6;   // Candidates are rounded to what the header prints
+
+// Encoder counts per output revolution as the controller scales them, and per watch point edge
+static constexpr double COUNTS_PER_REV = 65 * 11 * 4 / 1.03798;
+static constexpr double COUNTS_PER_EDGE = 2;
+
+enum TunedParameter : uint8_t
+{
+  TUNED_PARAMETER_KP = 0,
+  TUNED_PARAMETER_TI,
+  TUNED_PARAMETER_TD,
+  TUNED_PARAMETER_VELOCITY_WINDOW,
+  TUNED_PARAMETER_COUNT,
+};
+
+// Searched over [0, 1] and mapped onto the range, geometrically where it spans decades
+typedef struct
+{
+  const char *name;
+  double minimum;
+  double maximum;
+  bool logarithmic;
+} parameter_range;
+
+static const parameter_range PARAMETER_RANGES[TUNED_PARAMETER_COUNT] = {
+    {"kp", 0.0005, 0.05, true},
+    {"ti", 0.01, 1, true},
+    {"td", 0, 0.02, false},
+    {"velocity_window", 1, 100, true},
+};
+
+static_assert(TUNED_PARAMETER_COUNT <= NelderMead::MAX_DIMENSIONS, "Too many tuned parameters");
+
+typedef struct
+{
+  std::vector<controller_tuning> candidates;
+  const std::vector<uint8_t> *selected;
+  const plant_model *model;
+} evaluation_jobs;
+
+static double wall_time()
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static float round_significant(double value)
+{
+  char text[32];
+
+  snprintf(text, sizeof(text), "%.*g", SIGNIFICANT_DIGITS, value);
+  return strtof(text, nullptr);
+}
+
+static double to_range(const parameter_range &range, double x)
+{
+  if (range.logarithmic)
+    return range.minimum * pow(range.maximum / range.minimum, x);
+  return range.minimum + x * (range.maximum - range.minimum);
+}
+
+static double from_range(const parameter_range &range, double value)
+{
+  value = fmin(fmax(value, range.minimum), range.maximum);
+  if (range.logarithmic)
+    return log(value / range.minimum) / log(range.maximum / range.minimum);
+  return (value - range.minimum) / (range.maximum - range.minimum);
+}
+
+static controller_tuning to_tuning(const double *x)
+{
+  controller_tuning tuning;
+
+  // Padding included, the blob is written as it is
+  memset(&tuning, 0, sizeof(tuning));
+  tuning.kp = round_significant(to_range(PARAMETER_RANGES[TUNED_PARAMETER_KP], x[TUNED_PARAMETER_KP]));
+  tuning.ti = round_significant(to_range(PARAMETER_RANGES[TUNED_PARAMETER_TI], x[TUNED_PARAMETER_TI]));
+  tuning.td = round_significant(to_range(PARAMETER_RANGES[TUNED_PARAMETER_TD], x[TUNED_PARAMETER_TD]));
+  tuning.velocity_window = (uint16_t)lround(
+      to_range(PARAMETER_RANGES[TUNED_PARAMETER_VELOCITY_WINDOW], x[TUNED_PARAMETER_VELOCITY_WINDOW]));
+
+  return tuning;
+}
+
+static void from_tuning(const controller_tuning &tuning, double *x)
+{
+  x[TUNED_PARAMETER_KP] = from_range(PARAMETER_RANGES[TUNED_PARAMETER_KP], tuning.kp);
+  x[TUNED_PARAMETER_TI] = from_range(PARAMETER_RANGES[TUNED_PARAMETER_TI], tuning.ti);
+  x[TUNED_PARAMETER_TD] = from_range(PARAMETER_RANGES[TUNED_PARAMETER_TD], tuning.td);
+  x[TUNED_PARAMETER_VELOCITY_WINDOW] =
+      from_range(PARAMETER_RANGES[TUNED_PARAMETER_VELOCITY_WINDOW], tuning.velocity_window);
+}
+
+// The dead zone and breakaway of a fitted model keep the default plant's proportion
+static float default_breakaway(float dead_zone)
+{
+  plant_model defaults = MotorPlant::default_model();
+
+  return dead_zone * defaults.breakaway / defaults.dead_zone;
+}
+
+static bool parse_plant(const char *text, plant_model *model)
+{
+  if (sscanf(text, "%f,%f,%f", &model->gain, &model->dead_zone, &model->time_constant) != 3 || !(model->gain > 0) ||
+      !(model->dead_zone >= 0) || !(model->time_constant > 0))
+    return false;
+
+  model->breakaway = default_breakaway(model->dead_zone);
+  return true;
+}
+
+// Number after "key": within text, as the firmware's reports write them
+static bool json_number(const char *text, const char *key, double *value)
+{
+  std::string pattern = std::string("\"") + key + "\":";
+  const char *found = strstr(text, pattern.c_str());
+  char *end;
+
+  if (found == nullptr)
+    return false;
+
+  *value = strtod(found + pattern.size(), &end);
+  return end != found + pattern.size();
+}
+
+// Model from the system identification report of the board, get_system_id_string(). The dead
+// zone is where the ARX model's steady state meets zero, its gains are a start for the search.
+static bool load_model_report(const char *path, plant_model *model, controller_tuning *gains, bool *has_gains)
+{
+  std::vector<uint8_t> data;
+  double gain, time_constant, a1, a2, bias, kp, ti, td;
+
+  if (!record_read_file(path, &data))
+  {
+    fprintf(stderr, "Cannot read %s.\n", path);
+    return false;
+  }
+  data.push_back('\0');
+
+  const char *report = strstr((const char *)data.data(), "\"system_id\":");
+  if (report == nullptr || strstr(report, "\"valid\":true") == nullptr)
+  {
+    fprintf(stderr, "%s holds no valid system identification.\n", path);
+    return false;
+  }
+  if (!json_number(report, "gain", &gain) || !json_number(report, "time_constant", &time_constant) ||
+      !json_number(report, "a1", &a1) || !json_number(report, "a2", &a2) || !json_number(report, "bias", &bias) ||
+      !(gain > 0) || !(time_constant > 0) || a1 + a2 >= 1)
+  {
+    fprintf(stderr, "%s does not hold a usable model.\n", path);
+    return false;
+  }
+
+  model->gain = gain;
+  model->dead_zone = fmax(-bias / (1 - a1 - a2), 0);
+  model->breakaway = default_breakaway(model->dead_zone);
+  model->time_constant = time_constant;
+
+  *has_gains = json_number(report, "kp", &kp) && json_number(report, "ti", &ti) && json_number(report, "td", &td) &&
+               kp > 0 && ti > 0 && td >= 0;
+  if (*has_gains)
+  {
+    memset(gains, 0, sizeof(*gains));
+    gains->kp = kp;
+    gains->ti = ti;
+    gains->td = td;
+    gains->velocity_window = TUNED_VELOCITY_WINDOW;
+  }
+
+  return true;
+}
+
+// Solves the normal equations of a least squares fit in place, Gaussian elimination with
+// partial pivoting
+static bool solve(double matrix[4][4], double *vector, uint8_t size)
+{
+  for (uint8_t column = 0; column < size; column++)
+  {
+    uint8_t pivot = column;
+
+    for (uint8_t row = column + 1; row < size; row++)
+    {
+      if (fabs(matrix[row][column]) > fabs(matrix[pivot][column]))
+        pivot = row;
+    }
+    if (fabs(matrix[pivot][column]) < 1e-12)
+      return false;
+
+    for (uint8_t i = 0; i < size; i++)
+    {
+      double swap = matrix[column][i];
+      matrix[column][i] = matrix[pivot][i];
+      matrix[pivot][i] = swap;
+    }
+    double swap = vector[column];
+    vector[column] = vector[pivot];
+    vector[pivot] = swap;
+
+    for (uint8_t row = column + 1; row < size; row++)
+    {
+      double factor = matrix[row][column] / matrix[column][column];
+
+      for (uint8_t i = column; i < size; i++)
+        matrix[row][i] -= factor * matrix[column][i];
+      vector[row] -= factor * vector[column];
+    }
+  }
+
+  for (int8_t row = size - 1; row >= 0; row--)
+  {
+    for (uint8_t i = row + 1; i < size; i++)
+      vector[row] -= matrix[row][i] * vector[i];
+    vector[row] /= matrix[row][row];
+  }
+
+  return true;
+}
+
+// Fits the plant to the motor's first system identification run in a recorded log. The
+// excitation bypasses the actuator map, so the duty the update task recorded is the PWM duty.
+// Over each identification period the input is the mean of that duty and the output the mean
+// velocity the encoder edges give, and the periods the motor turns through are fitted by least
+// squares to y[k] = a y[k-1] + b0 u[k] + b1 u[k-1] + c.
+static bool fit_dataset(const char *path, uint8_t motor, plant_model *model)
+{
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> stream;
+  record_entry entry;
+
+  if (!record_read_file(path, &data))
+  {
+    fprintf(stderr, "Cannot read %s.\n", path);
+    return false;
+  }
+  record_join_blocks(data.data(), data.size(), &stream);
+
+  RecordDecoder decoder(stream.data(), stream.size());
+  if (!decoder.next(&entry) || entry.type != RECORD_HEADER || entry.value <= 0)
+  {
+    fprintf(stderr, "%s is not a recorded log.\n", path);
+    return false;
+  }
+
+  uint64_t header_time = entry.time;
+  uint32_t header_tick = entry.tick;
+  uint64_t us_per_tick = 1000000 / entry.value;
+  uint64_t period_us = (uint64_t)lround(SystemIdentifier::SAMPLE_PERIOD * 1e6);
+  uint64_t start = 0;
+  uint32_t periods = 0;
+  std::vector<double> duty_sum;
+  std::vector<uint32_t> duty_ticks;
+  std::vector<uint32_t> edges;
+  float duty = 0;
+  uint32_t duty_tick = 0;
+
+  // Adds the duty held since the last change to the periods its ticks fall in
+  auto hold_duty = [&](uint32_t until)
+  {
+    for (uint32_t tick = duty_tick; tick < until; tick++)
+    {
+      uint64_t time = header_time + (tick - header_tick) * us_per_tick;
+      if (time < start || time >= start + periods * period_us)
+        continue;
+      duty_sum[(time - start) / period_us] += fabsf(duty);
+      duty_ticks[(time - start) / period_us]++;
+    }
+    duty_tick = until;
+  };
+
+  while (decoder.next(&entry) && entry.type != RECORD_HEADER)
+  {
+    if (entry.index != motor || entry.type == RECORD_ADC || entry.type == RECORD_ZERO)
+      continue;
+
+    if (entry.type == RECORD_PARAMETER && entry.parameter == PARAMETER_SYSTEM_ID && periods == 0)
+    {
+      start = header_time + (entry.tick - header_tick) * us_per_tick +
+              (uint64_t)(SystemIdentifier::SETTLE_TIME * 1e6);
+      periods = (uint32_t)(entry.values[4] / SystemIdentifier::SAMPLE_PERIOD);
+      duty_sum.assign(periods, 0);
+      duty_ticks.assign(periods, 0);
+      edges.assign(periods, 0);
+      duty_tick = entry.tick;
+    }
+    else if (periods == 0)
+      continue;
+    else if (entry.type == RECORD_OUTPUT)
+    {
+      hold_duty(entry.tick);
+      duty = entry.values[0];
+    }
+    else if (entry.type == RECORD_EDGE && entry.time >= start && entry.time < start + periods * period_us)
+      edges[(entry.time - start) / period_us]++;
+  }
+
+  if (periods == 0)
+  {
+    fprintf(stderr, "%s holds no system identification of motor %u.\n", path, motor);
+    return false;
+  }
+  hold_duty(header_tick + (uint32_t)((start + periods * period_us - header_time) / us_per_tick) + 1);
+
+  double matrix[4][4] = {};
+  double vector[4] = {};
+  uint32_t rows = 0;
+  double period_s = period_us / 1e6;
+  auto velocity = [&](uint32_t k)
+  {
+    return edges[k] * COUNTS_PER_EDGE * 60 / COUNTS_PER_REV / period_s;
+  };
+
+  for (uint32_t k = 1; k < periods; k++)
+  {
+    if (duty_ticks[k] == 0 || duty_ticks[k - 1] == 0 || edges[k] == 0 || edges[k - 1] == 0)
+      continue;
+
+    double phi[4] = {velocity(k - 1), duty_sum[k] / duty_ticks[k], duty_sum[k - 1] / duty_ticks[k - 1], 1};
+    double y = velocity(k);
+
+    for (uint8_t i = 0; i < 4; i++)
+    {
+      for (uint8_t j = 0; j < 4; j++)
+        matrix[i][j] += phi[i] * phi[j];
+      vector[i] += phi[i] * y;
+    }
+    rows++;
+  }
+
+  double a = vector[0];
+  if (rows < 20 || !solve(matrix, vector, 4) || !((a = vector[0]) > 0 && a < 1) || !(vector[1] + vector[2] > 0))
+  {
+    fprintf(stderr, "%s: the run does not fit a first order model (%u periods turning).\n", path, rows);
+    return false;
+  }
+
+  model->gain = (vector[1] + vector[2]) / (1 - a);
+  model->dead_zone = fmax(-vector[3] / (1 - a), 0);
+  model->breakaway = default_breakaway(model->dead_zone);
+  model->time_constant = -period_s / log(a);
+
+  return true;
+}
+
+static double scenario_cost(const scenario &test, const scenario_result &result)
+{
+  double cost = 0;
+  uint8_t count = 0;
+
+  if (!result.completed)
+    return FAILED_COST;
+
+  // Host CPU is not the controller's doing, it is left out
+  for (uint8_t i = 0; i <= METRIC_PEAK_CURRENT; i++)
+  {
+    float limit = metric_limit(test, i);
+    double ratio;
+
+    if (isnan(limit))
+      continue;
+
+    ratio = isnan(result.metrics[i]) ? 2 : result.metrics[i] / limit;
+    cost += ratio + EXCESS_WEIGHT * fmax(ratio - 1, 0);
+    count++;
+  }
+
+  return count > 0 ? cost / count : 0;
+}
+
+static void run_job(size_t job, scenario_result *result, void *context)
+{
+  evaluation_jobs *jobs = static_cast<evaluation_jobs *>(context);
+  size_t count = jobs->selected->size();
+  scenario_setup setup = {jobs->model, &jobs->candidates[job / count]};
+  scenario_output output = {nullptr, nullptr};
+
+  run_scenario(SCENARIOS[(*jobs->selected)[job % count]], setup, output, result);
+}
+
+// Every candidate on every selected scenario at once, costs the mean over the scenarios
+static void evaluate(evaluation_jobs *jobs, uint32_t parallel, std::vector<scenario_result> *results,
+                     std::vector<double> *costs)
+{
+  size_t count = jobs->selected->size();
+
+  results->resize(jobs->candidates.size() * count);
+  run_scenario_jobs(results->size(), parallel, run_job, nullptr, jobs, results->data());
+
+  costs->assign(jobs->candidates.size(), 0);
+  for (size_t i = 0; i < results->size(); i++)
+    (*costs)[i / count] += scenario_cost(SCENARIOS[(*jobs->selected)[i % count]], (*results)[i]) / count;
+}
+
+static bool scenarios_passed(const std::vector<uint8_t> &selected, const scenario_result *results)
+{
+  bool passed = true;
+
+  for (size_t i = 0; i < selected.size(); i++)
+    passed = passed && scenario_passed(SCENARIOS[selected[i]], results[i]);
+
+  return passed;
+}
+
+static void print_tuning(const char *label, const controller_tuning &tuning, double cost)
+{
+  printf("%-9s cost %.4f: kp = %g, ti = %g, td = %g, velocity window %u\n", label, cost, tuning.kp, tuning.ti,
+         tuning.td, tuning.velocity_window);
+}
+
+static bool write_header(const char *path, const plant_model &model, const char *source, size_t scenarios,
+                         double baseline_cost, double cost, const controller_tuning &tuning)
+{
+  FILE *file = fopen(path, "w");
+
+  if (file == nullptr)
+    return false;
+
+  fprintf(file,
+          "#ifndef TUNED_GAINS_H_\n"
+          "#define TUNED_GAINS_H_\n"
+          "\n"
+          "// Includes\n"
+          "#include <stdint.h>\n"
+          "\n"
+          "// Fixed controller constants, written by host/sim's dtmc_gain_tuner --header. Regenerate rather\n"
+          "// than edit. A unit with its own tuning in NVS loads that instead.\n"
+          "// Plant %g RPM per duty, %g RPM dead zone, %g s time constant, from %s.\n"
+          "// Cost %.4f over %u scenarios, %.4f before.\n"
+          "\n"
+          "static constexpr float TUNED_KP = %g;\n"
+          "static constexpr float TUNED_TI = %g;\n"
+          "static constexpr float TUNED_TD = %g;\n"
+          "static constexpr uint8_t TUNED_VELOCITY_WINDOW = %u;\n"
+          "\n"
+          "#endif // TUNED_GAINS_H_\n",
+          model.gain, model.dead_zone, model.time_constant, source, cost, (unsigned)scenarios, baseline_cost,
+          tuning.kp, tuning.ti, tuning.td, tuning.velocity_window);
+
+  return fclose(file) == 0;
+}
+
+// The blob as controller_tuning_load() reads it, and the rows nvs_partition_gen.py takes for it
+static bool write_blob(const char *path, uint8_t motor, const controller_tuning &tuning)
+{
+  std::string csv_path = std::string(path) + ".csv";
+  char name[CALIBRATION_NAMESPACE_SIZE];
+  FILE *file = fopen(path, "wb");
+
+  if (file == nullptr || fwrite(&tuning, sizeof(tuning), 1, file) != 1 || fclose(file) != 0)
+    return false;
+
+  calibration_namespace(motor, name, sizeof(name));
+  file = fopen(csv_path.c_str(), "w");
+  if (file == nullptr)
+    return false;
+
+  fprintf(file, "key,type,encoding,value\n%s,namespace,,\n%s,file,binary,%s\n", name, CONTROLLER_TUNING_KEY, path);
+  return fclose(file) == 0;
+}
+
+static void write_number(FILE *file, float value)
+{
+  if (isnan(value))
+    fprintf(file, "null");
+  else
+    fprintf(file, "%.4g", value);
+}
+
+static void write_result(FILE *file, const scenario &test, const scenario_result &result)
+{
+  fprintf(file, "{\"passed\": %s, \"cost\": %.4f", scenario_passed(test, result) ? "true" : "false",
+          scenario_cost(test, result));
+  for (uint8_t i = 0; i <= METRIC_PEAK_CURRENT; i++)
+  {
+    fprintf(file, ", \"%s\": ", METRIC_NAMES[i]);
+    write_number(file, result.completed ? result.metrics[i] : NAN);
+  }
+  fprintf(file, "}");
+}
+
+static void write_tuning(FILE *file, const controller_tuning &tuning, double cost)
+{
+  fprintf(file, "{\"cost\": %.4f, \"kp\": %g, \"ti\": %g, \"td\": %g, \"velocity_window\": %u}", cost, tuning.kp,
+          tuning.ti, tuning.td, tuning.velocity_window);
+}
+
+static bool write_report(const char *path, const plant_model &model, const char *source,
+                         const std::vector<uint8_t> &selected, uint32_t evaluations, double elapsed, uint32_t jobs,
+                         const controller_tuning &baseline, double baseline_cost, const scenario_result *baseline_results,
+                         const controller_tuning &tuned, double tuned_cost, const scenario_result *tuned_results)
+{
+  FILE *file = fopen(path, "w");
+
+  if (file == nullptr)
+    return false;
+
+  fprintf(file,
+          "{\n  \"passed\": %s,\n  \"model\": {\"source\": \"%s\", \"gain\": %g, \"dead_zone\": %g, "
+          "\"breakaway\": %g, \"time_constant\": %g},\n  \"evaluations\": %u,\n  \"wall_time_s\": %.1f,\n"
+          "  \"jobs\": %u,\n  \"baseline\": ",
+          scenarios_passed(selected, tuned_results) ? "true" : "false", source, model.gain, model.dead_zone,
+          model.breakaway, model.time_constant, evaluations, elapsed, jobs);
+  write_tuning(file, baseline, baseline_cost);
+  fprintf(file, ",\n  \"tuned\": ");
+  write_tuning(file, tuned, tuned_cost);
+
+  fprintf(file, ",\n  \"scenarios\": [");
+  for (size_t i = 0; i < selected.size(); i++)
+  {
+    const scenario &test = SCENARIOS[selected[i]];
+
+    fprintf(file, "%s\n    {\n      \"name\": \"%s\",\n      \"baseline\": ", i > 0 ? "," : "", test.name);
+    write_result(file, test, baseline_results[i]);
+    fprintf(file, ",\n      \"tuned\": ");
+    write_result(file, test, tuned_results[i]);
+    fprintf(file, "\n    }");
+  }
+  fprintf(file, "\n  ]\n}\n");
+
+  return fclose(file) == 0;
+}
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --model FILE       Plant from the board's system identification report (JSON)\n"
+          "  --dataset FILE     Plant fitted to a recorded system identification run (.dtmr)\n"
+          "  --plant G,D,T      Plant of G RPM per duty, a D RPM dead zone and a T s time constant\n"
+          "  --motor N          Motor of the dataset and of the blob's namespace (default 0)\n"
+          "  --scenario NAME    Tune on scenarios whose name contains NAME, repeatable (default all)\n"
+          "  --starts N         Searches, from the current constants and random points (default %u)\n"
+          "  --evaluations N    Candidates each search evaluates at most (default %u)\n"
+          "  --seed N           Seed of the random starts (default 1)\n"
+          "  --jobs N           Scenarios run at once (default one per core)\n"
+          "  --header FILE      Write the tuned constants as tuned_gains.hpp\n"
+          "  --blob FILE        Write them as a unit's NVS blob, and FILE.csv for nvs_partition_gen.py\n"
+          "  --report FILE      JSON report (default tuning_report.json)\n",
+          name, DEFAULT_STARTS, DEFAULT_EVALUATIONS);
+}
+
+int main(int argc, char **argv)
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t jobs = cores > 0 ? cores : 1;
+  uint32_t starts = DEFAULT_STARTS;
+  uint32_t budget = DEFAULT_EVALUATIONS;
+  uint32_t seed = 1;
+  uint8_t motor = 0;
+  const char *model_path = nullptr;
+  const char *dataset_path = nullptr;
+  const char *plant_text = nullptr;
+  const char *header_path = nullptr;
+  const char *blob_path = nullptr;
+  const char *report_path = "tuning_report.json";
+  std::vector<const char *> filters;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--model") == 0 && has_value)
+      model_path = argv[++i];
+    else if (strcmp(argv[i], "--dataset") == 0 && has_value)
+      dataset_path = argv[++i];
+    else if (strcmp(argv[i], "--plant") == 0 && has_value)
+      plant_text = argv[++i];
+    else if (strcmp(argv[i], "--motor") == 0 && has_value)
+      motor = (uint8_t)atoi(argv[++i]);
+    else if (strcmp(argv[i], "--scenario") == 0 && has_value)
+      filters.push_back(argv[++i]);
+    else if (strcmp(argv[i], "--starts") == 0 && has_value)
+      starts = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+    else if (strcmp(argv[i], "--evaluations") == 0 && has_value)
+      budget = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+    else if (strcmp(argv[i], "--seed") == 0 && has_value)
+      seed = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--jobs") == 0 && has_value)
+      jobs = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+    else if (strcmp(argv[i], "--header") == 0 && has_value)
+      header_path = argv[++i];
+    else if (strcmp(argv[i], "--blob") == 0 && has_value)
+      blob_path = argv[++i];
+    else if (strcmp(argv[i], "--report") == 0 && has_value)
+      report_path = argv[++i];
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if ((model_path != nullptr) + (dataset_path != nullptr) + (plant_text != nullptr) > 1)
+  {
+    fprintf(stderr, "Give one of --model, --dataset and --plant.\n");
+    return 2;
+  }
+
+  // The plant, and the gains its identification derived if there are any
+  plant_model model = MotorPlant::default_model();
+  controller_tuning model_gains;
+  bool has_model_gains = false;
+  std::string source = "the simulator's default plant";
+
+  if (model_path != nullptr && !load_model_report(model_path, &model, &model_gains, &has_model_gains))
+    return 1;
+  if (dataset_path != nullptr && !fit_dataset(dataset_path, motor, &model))
+    return 1;
+  if (plant_text != nullptr && !parse_plant(plant_text, &model))
+  {
+    fprintf(stderr, "--plant takes the gain, dead zone and time constant, as 200,40,0.12.\n");
+    return 2;
+  }
+  if (model_path != nullptr || dataset_path != nullptr)
+    source = model_path != nullptr ? model_path : dataset_path;
+  else if (plant_text != nullptr)
+    source = "--plant";
+
+  printf("Plant: %.1f RPM per duty, %.1f RPM dead zone, %.3f s time constant, from %s.\n", model.gain,
+         model.dead_zone, model.time_constant, source.c_str());
+
+  std::vector<uint8_t> selected;
+  for (uint8_t i = 0; i < SCENARIO_COUNT; i++)
+  {
+    bool matched = filters.empty();
+
+    for (const char *filter : filters)
+      matched = matched || strstr(SCENARIOS[i].name, filter) != nullptr;
+    if (matched)
+      selected.push_back(i);
+  }
+  if (selected.empty())
+  {
+    fprintf(stderr, "No scenario matches.\n");
+    return 2;
+  }
+
+  // Starts: the current constants, the model's gains, then random points
+  controller_tuning current;
+  memset(&current, 0, sizeof(current));
+  current.kp = TUNED_KP;
+  current.ti = TUNED_TI;
+  current.td = TUNED_TD;
+  current.velocity_window = TUNED_VELOCITY_WINDOW;
+
+  std::vector<NelderMead> searches(starts);
+  uint32_t random_state = seed * 2654435761u + 1;
+  for (uint32_t i = 0; i < starts; i++)
+  {
+    double start[NelderMead::MAX_DIMENSIONS];
+
+    if (i == 0)
+      from_tuning(current, start);
+    else if (i == 1 && has_model_gains)
+      from_tuning(model_gains, start);
+    else
+    {
+      for (uint8_t j = 0; j < TUNED_PARAMETER_COUNT; j++)
+      {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        start[j] = random_state / 4294967296.0;
+      }
+    }
+    searches[i].begin(TUNED_PARAMETER_COUNT, start, INITIAL_STEP, TOLERANCE);
+  }
+
+  printf("Tuning on %u scenarios, %u searches of up to %u candidates, %u jobs.\n", (unsigned)selected.size(), starts,
+         budget, jobs);
+
+  evaluation_jobs evaluations;
+  evaluations.selected = &selected;
+  evaluations.model = &model;
+
+  std::vector<scenario_result> results;
+  std::vector<double> costs;
+  std::vector<scenario_result> baseline_results;
+  std::vector<scenario_result> best_results;
+  controller_tuning best = current;
+  double baseline_cost = NAN;
+  double best_cost = INFINITY;
+  uint32_t evaluated = 0;
+  double started = wall_time();
+
+  while (true)
+  {
+    std::vector<std::pair<uint32_t, uint8_t>> asked; // Search and its number of candidates
+    double points[NelderMead::MAX_DIMENSIONS + 1][NelderMead::MAX_DIMENSIONS];
+
+    evaluations.candidates.clear();
+    for (uint32_t i = 0; i < starts; i++)
+    {
+      if (searches[i].get_evaluations() >= budget)
+        continue;
+
+      uint8_t count = searches[i].ask(points);
+      for (uint8_t j = 0; j < count; j++)
+        evaluations.candidates.push_back(to_tuning(points[j]));
+      if (count > 0)
+        asked.push_back({i, count});
+    }
+    if (evaluations.candidates.empty())
+      break;
+
+    evaluate(&evaluations, jobs, &results, &costs);
+    evaluated += evaluations.candidates.size();
+
+    // The first candidate of the first round is the current constants
+    if (isnan(baseline_cost))
+    {
+      baseline_cost = costs[0];
+      baseline_results.assign(results.begin(), results.begin() + selected.size());
+      print_tuning("Current", current, baseline_cost);
+    }
+
+    size_t offset = 0;
+    for (const std::pair<uint32_t, uint8_t> &search : asked)
+    {
+      searches[search.first].tell(&costs[offset]);
+      offset += search.second;
+    }
+
+    for (size_t i = 0; i < costs.size(); i++)
+    {
+      if (costs[i] >= best_cost)
+        continue;
+
+      best_cost = costs[i];
+      best = evaluations.candidates[i];
+      best_results.assign(results.begin() + i * selected.size(), results.begin() + (i + 1) * selected.size());
+      printf("%5u candidates in %5.1f s, ", evaluated, wall_time() - started);
+      print_tuning("best", best, best_cost);
+      fflush(stdout);
+    }
+  }
+
+  double elapsed = wall_time() - started;
+  bool passed = scenarios_passed(selected, best_results.data());
+
+  printf("\n%-26s %8s %8s %8s %8s\n", "scenario", "cost", "tuned", "iae", "tuned");
+  for (size_t i = 0; i < selected.size(); i++)
+  {
+    const scenario &test = SCENARIOS[selected[i]];
+
+    printf("%-26s %8.4f %8.4f %8.1f %8.1f   %s\n", test.name, scenario_cost(test, baseline_results[i]),
+           scenario_cost(test, best_results[i]), baseline_results[i].metrics[METRIC_IAE],
+           best_results[i].metrics[METRIC_IAE], scenario_passed(test, best_results[i]) ? "ok" : "FAIL");
+  }
+  print_tuning("Tuned", best, best_cost);
+  printf("%u candidates in %.1f s on %u jobs, %.0f scenarios/s.\n", evaluated, elapsed, jobs,
+         evaluated * selected.size() / elapsed);
+
+  if (header_path != nullptr &&
+      !write_header(header_path, model, source.c_str(), selected.size(), baseline_cost, best_cost, best))
+  {
+    fprintf(stderr, "Cannot write %s.\n", header_path);
+    return 1;
+  }
+  if (blob_path != nullptr && !write_blob(blob_path, motor, best))
+  {
+    fprintf(stderr, "Cannot write %s.\n", blob_path);
+    return 1;
+  }
+  if (!write_report(report_path, model, source.c_str(), selected, evaluated, elapsed, jobs, current, baseline_cost,
+                    baseline_results.data(), best, best_cost, best_results.data()))
+  {
+    fprintf(stderr, "Cannot write %s.\n", report_path);
+    return 1;
+  }
+
+  return passed ? 0 : 1;
+}
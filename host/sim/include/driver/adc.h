@@ -0,0 +1,10 @@
+/*
+ * Host simulator stand-in for the legacy ADC driver header, only its types are used.
+ */
+
+#ifndef HOST_SIM_ADC_H
+#define HOST_SIM_ADC_H
+
+#include "hal/adc_types.h"
+
+#endif /* HOST_SIM_ADC_H */
@@ -0,0 +1,36 @@
+/*
+ * Host simulator stand-in for ADC calibration, a straight line over the range of the
+ * 6 dB attenuation.
+ */
+
+#ifndef HOST_SIM_ADC_CALI_SCHEME_H
+#define HOST_SIM_ADC_CALI_SCHEME_H
+
+#include "esp_err.h"
+#include "hal/adc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sim_adc_cali * adc_cali_handle_t;
+
+typedef struct
+{
+    adc_unit_t unit_id;
+    adc_channel_t chan;
+    adc_atten_t atten;
+    adc_bitwidth_t bitwidth;
+} adc_cali_curve_fitting_config_t;
+
+esp_err_t adc_cali_create_scheme_curve_fitting( const adc_cali_curve_fitting_config_t * config,
+                                                adc_cali_handle_t * ret_handle );
+esp_err_t adc_cali_raw_to_voltage( adc_cali_handle_t handle,
+                                   int raw,
+                                   int * voltage );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SIM_ADC_CALI_SCHEME_H */
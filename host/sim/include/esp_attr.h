@@ -0,0 +1,11 @@
+/*
+ * Host stand-in for the ESP-IDF placement attributes, everything is in one memory.
+ */
+
+#ifndef HOST_SIM_ESP_ATTR_H
+#define HOST_SIM_ESP_ATTR_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif /* HOST_SIM_ESP_ATTR_H */
@@ -0,0 +1,47 @@
+/*
+ * Host stand-in for the ESP-IDF error codes.
+ */
+
+#ifndef HOST_SIM_ESP_ERR_H
+#define HOST_SIM_ESP_ERR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK                     0
+#define ESP_FAIL                   -1
+#define ESP_ERR_NO_MEM             0x101
+#define ESP_ERR_INVALID_ARG        0x102
+#define ESP_ERR_INVALID_STATE      0x103
+#define ESP_ERR_INVALID_SIZE       0x104
+#define ESP_ERR_NOT_FOUND          0x105
+#define ESP_ERR_NOT_SUPPORTED      0x106
+#define ESP_ERR_TIMEOUT            0x107
+#define ESP_ERR_NVS_BASE           0x1100
+#define ESP_ERR_NVS_NOT_FOUND      ( ESP_ERR_NVS_BASE + 0x02 )
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char * esp_err_to_name( esp_err_t xCode );
+
+#ifdef __cplusplus
+}
+#endif
+
+/* A failed call is a bug in the simulation or the firmware, stop the scenario where it happened. */
+#define ESP_ERROR_CHECK( x )                                                               \
+    do {                                                                                   \
+        esp_err_t xErrorCheck = ( x );                                                     \
+        if( xErrorCheck != ESP_OK )                                                        \
+        {                                                                                  \
+            fprintf( stderr, "ESP_ERROR_CHECK failed: %s (0x%x) at %s:%d: %s\n",           \
+                     esp_err_to_name( xErrorCheck ), xErrorCheck, __FILE__, __LINE__, #x ); \
+            abort();                                                                       \
+        }                                                                                  \
+    } while( 0 )
+
+#endif /* HOST_SIM_ESP_ERR_H */
@@ -0,0 +1,32 @@
+/*
+ * Host stand-in for the heap capability queries in memory_report(), the simulated
+ * board has no heap statistics and reports zero.
+ */
+
+#ifndef HOST_SIM_ESP_HEAP_CAPS_H
+#define HOST_SIM_ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_DEFAULT    ( 1 << 12 )
+
+static inline size_t heap_caps_get_free_size( uint32_t ulCaps )
+{
+    ( void ) ulCaps;
+    return 0;
+}
+
+static inline size_t heap_caps_get_minimum_free_size( uint32_t ulCaps )
+{
+    ( void ) ulCaps;
+    return 0;
+}
+
+static inline size_t heap_caps_get_largest_free_block( uint32_t ulCaps )
+{
+    ( void ) ulCaps;
+    return 0;
+}
+
+#endif /* HOST_SIM_ESP_HEAP_CAPS_H */
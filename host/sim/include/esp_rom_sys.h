@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for the ROM printf.
+ */
+
+#ifndef HOST_SIM_ESP_ROM_SYS_H
+#define HOST_SIM_ESP_ROM_SYS_H
+
+#include <stdio.h>
+
+#define esp_rom_printf    printf
+
+#endif /* HOST_SIM_ESP_ROM_SYS_H */
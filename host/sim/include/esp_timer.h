@@ -0,0 +1,20 @@
+/*
+ * Host stand-in for esp_timer, the simulator's virtual clock in us.
+ */
+
+#ifndef HOST_SIM_ESP_TIMER_H
+#define HOST_SIM_ESP_TIMER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int64_t esp_timer_get_time( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SIM_ESP_TIMER_H */
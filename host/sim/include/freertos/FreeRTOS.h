@@ -0,0 +1,29 @@
+/*
+ * Host simulator stand-in for the ESP-IDF FreeRTOS header: the host port's base
+ * types plus the priorities and critical sections the firmware uses. The simulator
+ * runs one task at a time and calls interrupt handlers between them, so critical
+ * sections have nothing to exclude.
+ */
+
+#ifndef HOST_SIM_FREERTOS_H
+#define HOST_SIM_FREERTOS_H
+
+/* host/port/FreeRTOS.h, found through the include path rather than this directory */
+#include <FreeRTOS.h>
+
+#define configMAX_PRIORITIES    ( 25 )
+
+typedef struct
+{
+    uint32_t ulOwner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { 0 }
+#define portMUX_INITIALIZE( mux )       ( ( mux )->ulOwner = 0 )
+
+#define portENTER_CRITICAL( mux )       ( ( void ) ( mux ) )
+#define portEXIT_CRITICAL( mux )        ( ( void ) ( mux ) )
+#define portENTER_CRITICAL_ISR( mux )   ( ( void ) ( mux ) )
+#define portEXIT_CRITICAL_ISR( mux )    ( ( void ) ( mux ) )
+
+#endif /* HOST_SIM_FREERTOS_H */
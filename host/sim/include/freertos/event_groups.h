@@ -0,0 +1,38 @@
+/*
+ * Host simulator stand-in for the FreeRTOS event groups. A task that waits yields to
+ * the simulator's scheduler until the bits it waits for are set or the timeout passes.
+ */
+
+#ifndef HOST_SIM_EVENT_GROUPS_H
+#define HOST_SIM_EVENT_GROUPS_H
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t EventBits_t;
+
+typedef struct sim_event_group
+{
+    EventBits_t uxBits;
+} StaticEventGroup_t;
+
+typedef struct sim_event_group * EventGroupHandle_t;
+
+EventGroupHandle_t xEventGroupCreateStatic( StaticEventGroup_t * pxEventGroupBuffer );
+EventBits_t xEventGroupWaitBits( EventGroupHandle_t xEventGroup,
+                                 const EventBits_t uxBitsToWaitFor,
+                                 const BaseType_t xClearOnExit,
+                                 const BaseType_t xWaitForAllBits,
+                                 TickType_t xTicksToWait );
+EventBits_t xEventGroupSetBits( EventGroupHandle_t xEventGroup,
+                                const EventBits_t uxBitsToSet );
+EventBits_t xEventGroupGetBits( EventGroupHandle_t xEventGroup );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SIM_EVENT_GROUPS_H */
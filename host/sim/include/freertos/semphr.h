@@ -0,0 +1,27 @@
+/*
+ * Host simulator stand-in for the FreeRTOS semaphores. A task that blocks yields to
+ * the simulator's scheduler until the semaphore is given or the timeout passes.
+ */
+
+#ifndef HOST_SIM_SEMPHR_H
+#define HOST_SIM_SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sim_semaphore * SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex( void );
+SemaphoreHandle_t xSemaphoreCreateBinary( void );
+BaseType_t xSemaphoreTake( SemaphoreHandle_t xSemaphore,
+                           TickType_t xBlockTime );
+BaseType_t xSemaphoreGive( SemaphoreHandle_t xSemaphore );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SIM_SEMPHR_H */
@@ -0,0 +1,42 @@
+/*
+ * Host simulator stand-in for the FreeRTOS task API. Tasks are coroutines on a
+ * virtual clock, scheduled by host/sim/sim_kernel.cpp.
+ */
+
+#ifndef HOST_SIM_TASK_H
+#define HOST_SIM_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+/* host/port/task.h, xTaskGetTickCount() and vTaskDelay() on the virtual clock */
+#include <task.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define tskIDLE_PRIORITY    ( ( UBaseType_t ) 0U )
+#define tskNO_AFFINITY      ( ( BaseType_t ) 0x7FFFFFFF )
+
+typedef struct sim_task * TaskHandle_t;
+typedef void (* TaskFunction_t)( void * );
+
+/* The core is ignored, the simulated board runs one task at a time. */
+BaseType_t xTaskCreatePinnedToCore( TaskFunction_t pxTaskCode,
+                                    const char * pcName,
+                                    uint32_t ulStackDepth,
+                                    void * pvParameters,
+                                    UBaseType_t uxPriority,
+                                    TaskHandle_t * pxCreatedTask,
+                                    BaseType_t xCoreID );
+
+void vTaskDelete( TaskHandle_t xTaskToDelete );
+void vTaskSuspend( TaskHandle_t xTaskToSuspend );
+void vTaskResume( TaskHandle_t xTaskToResume );
+TaskHandle_t xTaskGetCurrentTaskHandle( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SIM_TASK_H */
@@ -0,0 +1,10 @@
+/*
+ * Host simulator stand-in for the NVS flash header, see nvs.h.
+ */
+
+#ifndef HOST_SIM_NVS_FLASH_H
+#define HOST_SIM_NVS_FLASH_H
+
+#include "nvs.h"
+
+#endif /* HOST_SIM_NVS_FLASH_H */
@@ -0,0 +1,39 @@
+/*
+ * Configuration of the simulated board, the subset of main/sdkconfig that the
+ * control code reads. Two motors so scenarios can run either MOTOR_CONFIGS entry.
+ */
+
+#ifndef HOST_SIM_SDKCONFIG_H
+#define HOST_SIM_SDKCONFIG_H
+
+#define CONFIG_DTMC_MOTOR_COUNT                    2
+#define CONFIG_DTMC_CAPTURE                        1
+#define CONFIG_DTMC_CAPTURE_SAMPLES                8192
+#define CONFIG_DTMC_CAPTURE_PRETRIGGER_PERCENT     25
+#define CONFIG_DTMC_CAPTURE_EDGES                  512
+#define CONFIG_DTMC_CAPTURE_OVERCURRENT_MA         1500
+#define CONFIG_DTMC_RECORDER                       1
+#define CONFIG_DTMC_RECORDER_BUFFER_KB             32
+#define CONFIG_DTMC_SPECTRUM                       1
+#define CONFIG_DTMC_SPECTRUM_PERIOD_S              10
+#define CONFIG_DTMC_SPECTRUM_CPU_PERCENT           5
+#define CONFIG_DTMC_SPECTRUM_RIPPLES_PER_REV       6
+#define CONFIG_DTMC_SPECTRUM_MESH_TEETH            1
+#define CONFIG_DTMC_SAFETY                         1
+#define CONFIG_DTMC_SAFETY_OVERCURRENT_MA          1050
+#define CONFIG_DTMC_SAFETY_OVERCURRENT_US          100
+#define CONFIG_DTMC_SAFETY_PLUGGING_US             50000
+#define CONFIG_DTMC_SAFETY_STALL_DUTY_PERCENT      60
+#define CONFIG_DTMC_SAFETY_STALL_TIMEOUT_MS        50
+#define CONFIG_DTMC_SAFETY_STALL_MA                500
+#define CONFIG_DTMC_SAFETY_LINK_TIMEOUT_MS         200
+#define CONFIG_DTMC_LIVE                           1
+#define CONFIG_DTMC_LIVE_PORT                      80
+#define CONFIG_DTMC_LIVE_MAX_CLIENTS               4
+#define CONFIG_DTMC_LIVE_FLUSH_MS                  20
+
+#define CONFIG_NETWORK_BUFFER_SIZE                 5120
+#define CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN          16384
+#define CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN         4096
+
+#endif /* HOST_SIM_SDKCONFIG_H */
@@ -0,0 +1,115 @@
+// Includes
+#include "motor_commands.hpp"
+
+#include "recorder.hpp"
+
+// Values each parameter takes, see RecordParameter
+static uint8_t value_count(RecordParameter parameter)
+{
+  switch (parameter)
+  {
+  case PARAMETER_MODE:
+  case PARAMETER_GAIN:
+  case PARAMETER_FREQUENCY:
+  case PARAMETER_POSITION:
+  case PARAMETER_VELOCITY:
+  case PARAMETER_FRICTION_CALIBRATION:
+    return 1;
+  case PARAMETER_PROFILE:
+    return 4;
+  case PARAMETER_SYSTEM_ID:
+    return 7;
+  case PARAMETER_AUTOTUNE:
+    return 6;
+  default:
+    return 0;
+  }
+}
+
+esp_err_t command_motor(MotorController &motor, uint8_t index, RecordParameter parameter, const float *values,
+                        uint8_t count)
+{
+  if (count < value_count(parameter))
+    return ESP_ERR_INVALID_ARG;
+
+  recorder().add_parameter(index, parameter, values, count);
+
+  switch (parameter)
+  {
+  case PARAMETER_MODE:
+    motor.set_mode((int32_t)values[0]);
+    return ESP_OK;
+
+  case PARAMETER_GAIN:
+    motor.set_gain(values[0]);
+    return ESP_OK;
+
+  case PARAMETER_FREQUENCY:
+    motor.set_frequency(values[0]);
+    return ESP_OK;
+
+  case PARAMETER_POSITION:
+    motor.set_position(values[0]);
+    return ESP_OK;
+
+  case PARAMETER_VELOCITY:
+    motor.set_velocity(values[0]);
+    return ESP_OK;
+
+  case PARAMETER_PROFILE:
+    return motor.set_profile((int32_t)values[0], values[1], values[2], values[3]);
+
+  case PARAMETER_WAVEFORM:
+    return motor.set_waveform(values, count);
+
+  case PARAMETER_SYSTEM_ID:
+  {
+    sysid_config config = {
+        .excitation = (int32_t)values[0],
+        .order = (uint8_t)values[1],
+        .offset = values[2],
+        .amplitude = values[3],
+        .duration = values[4],
+        .response = values[5],
+        .apply = values[6] != 0,
+    };
+    return motor.run_system_id(config);
+  }
+
+  case PARAMETER_AUTOTUNE:
+  {
+    autotune_config config = {
+        .min_velocity = values[0],
+        .max_velocity = values[1],
+        .points = (uint8_t)values[2],
+        .amplitude = values[3],
+        .hysteresis = values[4],
+        .save = values[5] != 0,
+    };
+    return motor.run_autotune(config);
+  }
+
+  case PARAMETER_FRICTION_CALIBRATION:
+    return motor.run_friction_calibration(values[0] != 0);
+
+  case PARAMETER_CLEAR_GAIN_SCHEDULE:
+    motor.clear_gain_schedule();
+    return ESP_OK;
+
+  case PARAMETER_CLEAR_FRICTION_CALIBRATION:
+    motor.clear_friction_calibration();
+    return ESP_OK;
+
+  case PARAMETER_CLEAR_FAULT:
+    return motor.clear_fault();
+
+  default:
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+}
+
+esp_err_t command_motor(MotorController &motor, uint8_t index, RecordParameter parameter,
+                        std::initializer_list<float> values)
+{
+  return command_motor(motor, index, parameter, values.begin(), (uint8_t)values.size());
+}
@@ -0,0 +1,19 @@
+#ifndef MOTOR_COMMANDS_H_
+#define MOTOR_COMMANDS_H_
+
+// Includes
+#include <stdint.h>
+#include <initializer_list>
+
+#include "motor_controller.hpp"
+#include "record_format.hpp"
+
+// External commands to one controller, recorded and applied as main.cpp's bridge functions do,
+// so a scenario's log holds the commands it gave and a replay gives them again. Missing values
+// are ESP_ERR_INVALID_ARG, the other results are the controller's.
+esp_err_t command_motor(MotorController &motor, uint8_t index, RecordParameter parameter, const float *values,
+                        uint8_t count);
+esp_err_t command_motor(MotorController &motor, uint8_t index, RecordParameter parameter,
+                        std::initializer_list<float> values);
+
+#endif // MOTOR_COMMANDS_H_
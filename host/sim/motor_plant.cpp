@@ -0,0 +1,199 @@
+// Includes
+#include "motor_plant.hpp"
+
+#include <cmath>
+
+#include "sim_hardware.hpp"
+#include "sim_kernel.hpp"
+
+MotorPlant::MotorPlant()
+{
+  config = &MOTOR_CONFIGS[0];
+
+  velocity = 0;
+  count = 0;
+  step_count = 0;
+  current = 0;
+  load = 0;
+  jitter_us = 0;
+  edge_time = 0;
+  noise_state = 1;
+  resistance = RESISTANCE;
+  encoder_connected = true;
+
+  peak_current = 0;
+
+  back_emf = BACK_EMF;
+  tau = TAU;
+  coulomb_v = COULOMB_V;
+  stiction_v = STICTION_V;
+}
+
+// Wires the plant to the pins of a motor, before the controller of that motor is initialised
+void MotorPlant::init(uint8_t index)
+{
+  config = &MOTOR_CONFIGS[index];
+
+  sim_adc_set_voltage(config->adc_channel, SENSOR_ZERO_MV);
+  sim_add_device(advance_trampoline, this);
+}
+
+// Replaces the default motor, the winding and supply stay as they are
+void MotorPlant::set_model(const plant_model &model)
+{
+  back_emf = SUPPLY_V / model.gain;
+  tau = model.time_constant;
+  coulomb_v = model.dead_zone * back_emf;
+  stiction_v = fmaxf(model.breakaway, model.dead_zone) * back_emf;
+}
+
+plant_model MotorPlant::default_model()
+{
+  return {SUPPLY_V / BACK_EMF, COULOMB_V / BACK_EMF, STICTION_V / BACK_EMF, TAU};
+}
+
+void MotorPlant::set_load(float load)
+{
+  this->load = load;
+}
+
+void MotorPlant::set_encoder_jitter(float jitter_us, uint32_t seed)
+{
+  this->jitter_us = jitter_us;
+  noise_state = seed * 2654435761u + 1;
+}
+
+void MotorPlant::set_current_noise(float noise_mv, uint32_t seed)
+{
+  sim_adc_set_noise(config->adc_channel, noise_mv, seed);
+}
+
+void MotorPlant::set_short(float resistance)
+{
+  this->resistance = resistance > 0 ? resistance : RESISTANCE;
+}
+
+// The motor still turns, the pulse counter just stops hearing of it
+void MotorPlant::set_encoder_connected(bool connected)
+{
+  encoder_connected = connected;
+}
+
+float MotorPlant::get_velocity()
+{
+  return velocity;
+}
+
+float MotorPlant::get_position()
+{
+  return count * 360 / COUNTS_PER_REV;
+}
+
+float MotorPlant::get_current()
+{
+  return current;
+}
+
+float MotorPlant::get_peak_current()
+{
+  return peak_current;
+}
+
+void MotorPlant::reset_peak_current()
+{
+  peak_current = 0;
+}
+
+void MotorPlant::advance_trampoline(void *context, uint64_t from, uint64_t to)
+{
+  static_cast<MotorPlant *>(context)->advance(from, to);
+}
+
+void MotorPlant::advance(uint64_t from, uint64_t to)
+{
+  for (uint64_t time = from; time < to; time += STEP_US)
+  {
+    uint64_t end = time + STEP_US < to ? time + STEP_US : to;
+    double start_count = count;
+
+    integrate((end - time) / 1e6f);
+    report_steps(time, end, start_count);
+  }
+
+  sim_adc_set_voltage(config->adc_channel, SENSOR_ZERO_MV + SENSOR_MV_PER_MA * current);
+}
+
+// Averaged bridge: driving applies the duty of the supply against the back EMF, equal inputs
+// short the winding for the duty and a zero duty lets the motor coast
+void MotorPlant::integrate(float dt)
+{
+  int in1 = sim_gpio_level(config->in1);
+  int in2 = sim_gpio_level(config->in2);
+  float duty = sim_pwm_duty(config->ena);
+  float amps = 0;
+  float drive;
+  float acceleration;
+  float next;
+
+  if (duty > 0 && in1 != in2)
+    amps = ((in1 ? 1 : -1) * duty * SUPPLY_V - back_emf * velocity) / resistance;
+  else if (duty > 0)
+    amps = -duty * back_emf * velocity / resistance;
+
+  current = amps * 1000;
+  if (fabsf(current) > peak_current)
+    peak_current = fabsf(current);
+
+  // The load acts whether or not the motor turns, friction only against the motion. Torque
+  // follows the current whatever the winding's resistance.
+  drive = RESISTANCE * amps - load;
+  if (velocity == 0)
+  {
+    // Held by stiction until the drive breaks it away
+    if (fabsf(drive) <= stiction_v)
+      return;
+    acceleration = (drive - copysignf(coulomb_v, drive)) / (back_emf * tau);
+  }
+  else
+    acceleration = (drive - copysignf(coulomb_v, velocity)) / (back_emf * tau);
+
+  // Friction stops the motor rather than reversing it
+  next = velocity + acceleration * dt;
+  if (velocity != 0 && next * velocity < 0)
+    next = 0;
+
+  count -= (velocity + next) / 2 * COUNTS_PER_REV / 60 * dt;
+  velocity = next;
+}
+
+// One step per whole count crossed, at the interpolated time of the crossing
+void MotorPlant::report_steps(uint64_t from, uint64_t to, double start_count)
+{
+  int64_t target = (int64_t)floor(count);
+
+  while (step_count != target)
+  {
+    int32_t step = target > step_count ? 1 : -1;
+    double crossing = step > 0 ? step_count + 1 : step_count;
+    double fraction = (crossing - start_count) / (count - start_count);
+    float time = from + fraction * (to - from);
+
+    if (jitter_us > 0)
+      time += jitter_us * noise();
+    time = fminf(fmaxf(time, from), to);
+    if (time < edge_time)
+      time = edge_time;
+
+    step_count += step;
+    edge_time = (uint64_t)time;
+    if (encoder_connected)
+      sim_encoder_step(config->encoder_a, step, edge_time);
+  }
+}
+
+// Uniform in [-1, 1)
+float MotorPlant::noise()
+{
+  noise_state = noise_state * 1664525u + 1013904223u;
+  return (float)(noise_state >> 8) / (1 << 23) - 1;
+}
@@ -0,0 +1,94 @@
+#ifndef MOTOR_PLANT_H_
+#define MOTOR_PLANT_H_
+
+// Includes
+#include <stdint.h>
+
+#include "configuration.hpp"
+
+// First-order model of a motor in terms of the PWM duty, as system identification fits it:
+// steady state velocity = gain * duty - dead_zone
+typedef struct
+{
+  float gain;          // RPM per unit duty
+  float dead_zone;     // Running friction, as the RPM its duty would give
+  float breakaway;     // Friction to start from rest, likewise
+  float time_constant; // s
+} plant_model;
+
+// Geared DC motor behind the H-bridge of one motor_config, wired to the firmware through the
+// simulated peripherals. It drives from the bridge inputs and the PWM duty averaged over a
+// period, turns against Coulomb friction, stiction and a load, and gives back quadrature steps
+// at the times the count crosses them and its current to the sensor's ADC channel. By default its
+// steady state matches the fleet's MotorModel, 200 RPM per unit duty less a 40 RPM dead zone,
+// set_model() takes an identified motor's instead.
+class MotorPlant
+{
+private:
+  // Class variables
+  const motor_config *config;
+
+  float velocity;      // RPM, positive turning clockwise as the firmware reports it
+  double count;        // Encoder counts, rising counter-clockwise
+  int64_t step_count;  // Whole counts reported to the pulse counter
+  float current;       // mA, signed with the drive voltage
+  float load;          // Torque as the voltage that balances it, positive opposes clockwise
+  float jitter_us;     // Uniform edge time noise, peak
+  uint64_t edge_time;  // Last step reported, jittered edges keep their order
+  uint32_t noise_state;
+  float resistance;       // Of the winding, lowered by a short
+  bool encoder_connected; // Steps reach the pulse counter
+
+  float peak_current;
+
+  // Plant properties, the defaults or those of set_model()
+  float back_emf;   // V per RPM
+  float tau;        // Mechanical time constant in seconds
+  float coulomb_v;  // Running friction
+  float stiction_v; // Friction to break away from rest
+
+  static constexpr float SUPPLY_V = 12;
+  static constexpr float BACK_EMF = SUPPLY_V / 200;
+  static constexpr float RESISTANCE = 12; // Winding resistance in ohms
+  static constexpr float TAU = 0.12;
+  static constexpr float COULOMB_V = 40 * BACK_EMF;
+  static constexpr float STICTION_V = 2.8;
+  static constexpr double COUNTS_PER_REV = 65 * 11 * 4 / 1.03798;
+
+  // Current sensor output, as CurrentSensor converts it back
+  static constexpr float SENSOR_ZERO_MV = 875;
+  static constexpr float SENSOR_MV_PER_MA = 0.8;
+
+  static constexpr uint32_t STEP_US = 10; // Integration step within a slice
+
+  static void advance_trampoline(void *context, uint64_t from, uint64_t to);
+  void advance(uint64_t from, uint64_t to);
+  void integrate(float dt);
+  void report_steps(uint64_t from, uint64_t to, double start_count);
+  float noise();
+
+public:
+  MotorPlant();
+
+  void init(uint8_t index);
+
+  void set_model(const plant_model &model);
+  static plant_model default_model();
+
+  void set_load(float load);
+  void set_encoder_jitter(float jitter_us, uint32_t seed);
+  void set_current_noise(float noise_mv, uint32_t seed);
+
+  // Faults for the safety supervisor: a winding shorted down to resistance ohms, 0 to repair
+  // it, and the encoder's cable
+  void set_short(float resistance);
+  void set_encoder_connected(bool connected);
+
+  float get_velocity();
+  float get_position();
+  float get_current();
+  float get_peak_current();
+  void reset_peak_current();
+};
+
+#endif // MOTOR_PLANT_H_
@@ -0,0 +1,222 @@
+// Includes
+#include "nelder_mead.hpp"
+
+#include <math.h>
+#include <string.h>
+
+NelderMead::NelderMead()
+{
+  dimensions = 0;
+  tolerance = 0;
+  stage = STAGE_INITIAL;
+  evaluations = 0;
+  reflected_cost = 0;
+
+  memset(simplex, 0, sizeof(simplex));
+  memset(costs, 0, sizeof(costs));
+  memset(centroid, 0, sizeof(centroid));
+  memset(reflected, 0, sizeof(reflected));
+  memset(trial, 0, sizeof(trial));
+}
+
+// The initial simplex is the start and a step along each axis from it, back from the edge of the
+// box where the step would leave it
+void NelderMead::begin(uint8_t dimensions, const double *start, double step, double tolerance)
+{
+  this->dimensions = dimensions < MAX_DIMENSIONS ? dimensions : MAX_DIMENSIONS;
+  this->tolerance = tolerance;
+  stage = STAGE_INITIAL;
+  evaluations = 0;
+
+  for (uint8_t i = 0; i <= this->dimensions; i++)
+  {
+    for (uint8_t j = 0; j < this->dimensions; j++)
+      simplex[i][j] = fmin(fmax(start[j], 0), 1);
+
+    if (i > 0)
+    {
+      double &value = simplex[i][i - 1];
+      value = value + step <= 1 ? value + step : value - step;
+    }
+  }
+}
+
+uint8_t NelderMead::ask(double points[][MAX_DIMENSIONS])
+{
+  switch (stage)
+  {
+  case STAGE_INITIAL:
+    for (uint8_t i = 0; i <= dimensions; i++)
+      memcpy(points[i], simplex[i], sizeof(simplex[i]));
+    return dimensions + 1;
+
+  case STAGE_REFLECT:
+    if (is_converged())
+      return 0;
+    memcpy(points[0], reflected, sizeof(reflected));
+    return 1;
+
+  case STAGE_EXPAND:
+  case STAGE_CONTRACT_OUTSIDE:
+  case STAGE_CONTRACT_INSIDE:
+    memcpy(points[0], trial, sizeof(trial));
+    return 1;
+
+  case STAGE_SHRINK:
+    for (uint8_t i = 1; i <= dimensions; i++)
+      memcpy(points[i - 1], simplex[i], sizeof(simplex[i]));
+    return dimensions;
+  }
+
+  return 0;
+}
+
+void NelderMead::tell(const double *point_costs)
+{
+  double cost = point_costs[0];
+
+  switch (stage)
+  {
+  case STAGE_INITIAL:
+    memcpy(costs, point_costs, (dimensions + 1) * sizeof(double));
+    evaluations += dimensions + 1;
+    reflect();
+    return;
+
+  case STAGE_REFLECT:
+    evaluations++;
+    reflected_cost = cost;
+    if (cost < costs[0])
+    {
+      along(centroid, reflected, EXPANSION, trial);
+      stage = STAGE_EXPAND;
+    }
+    else if (cost < costs[dimensions - 1])
+    {
+      replace_worst(reflected, cost);
+      reflect();
+    }
+    else if (cost < costs[dimensions])
+    {
+      along(centroid, reflected, CONTRACTION, trial);
+      stage = STAGE_CONTRACT_OUTSIDE;
+    }
+    else
+    {
+      along(centroid, simplex[dimensions], CONTRACTION, trial);
+      stage = STAGE_CONTRACT_INSIDE;
+    }
+    return;
+
+  case STAGE_EXPAND:
+    evaluations++;
+    if (cost < reflected_cost)
+      replace_worst(trial, cost);
+    else
+      replace_worst(reflected, reflected_cost);
+    reflect();
+    return;
+
+  case STAGE_CONTRACT_OUTSIDE:
+  case STAGE_CONTRACT_INSIDE:
+    evaluations++;
+    if (stage == STAGE_CONTRACT_OUTSIDE ? cost <= reflected_cost : cost < costs[dimensions])
+    {
+      replace_worst(trial, cost);
+      reflect();
+      return;
+    }
+
+    // Neither contraction helped, every vertex moves towards the best
+    for (uint8_t i = 1; i <= dimensions; i++)
+      along(simplex[0], simplex[i], SHRINKAGE, simplex[i]);
+    stage = STAGE_SHRINK;
+    return;
+
+  case STAGE_SHRINK:
+    evaluations += dimensions;
+    memcpy(costs + 1, point_costs, dimensions * sizeof(double));
+    reflect();
+    return;
+  }
+}
+
+// Done once every vertex is within the tolerance of the best in each coordinate
+bool NelderMead::is_converged()
+{
+  if (stage == STAGE_INITIAL)
+    return false;
+
+  for (uint8_t i = 1; i <= dimensions; i++)
+  {
+    for (uint8_t j = 0; j < dimensions; j++)
+    {
+      if (fabs(simplex[i][j] - simplex[0][j]) > tolerance)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+uint32_t NelderMead::get_evaluations()
+{
+  return evaluations;
+}
+
+// Best vertex so far and its cost
+double NelderMead::get_best(double *point)
+{
+  memcpy(point, simplex[0], dimensions * sizeof(double));
+  return costs[0];
+}
+
+// Insertion sort by cost, stable so ties keep the older vertex ahead
+void NelderMead::sort()
+{
+  for (uint8_t i = 1; i <= dimensions; i++)
+  {
+    double vertex[MAX_DIMENSIONS];
+    double cost = costs[i];
+    uint8_t j = i;
+
+    memcpy(vertex, simplex[i], sizeof(vertex));
+    while (j > 0 && costs[j - 1] > cost)
+    {
+      memcpy(simplex[j], simplex[j - 1], sizeof(simplex[j]));
+      costs[j] = costs[j - 1];
+      j--;
+    }
+    memcpy(simplex[j], vertex, sizeof(vertex));
+    costs[j] = cost;
+  }
+}
+
+// from + factor * (to - from), clamped to the box. dest may be to.
+void NelderMead::along(const double *from, const double *to, double factor, double *dest)
+{
+  for (uint8_t i = 0; i < dimensions; i++)
+    dest[i] = fmin(fmax(from[i] + factor * (to[i] - from[i]), 0), 1);
+}
+
+void NelderMead::replace_worst(const double *point, double cost)
+{
+  memcpy(simplex[dimensions], point, dimensions * sizeof(double));
+  costs[dimensions] = cost;
+}
+
+// Sorts the simplex and reflects its worst vertex through the centroid of the others
+void NelderMead::reflect()
+{
+  sort();
+
+  for (uint8_t j = 0; j < dimensions; j++)
+  {
+    centroid[j] = 0;
+    for (uint8_t i = 0; i < dimensions; i++)
+      centroid[j] += simplex[i][j] / dimensions;
+  }
+
+  along(centroid, simplex[dimensions], -REFLECTION, reflected);
+  stage = STAGE_REFLECT;
+}
@@ -0,0 +1,66 @@
+#ifndef NELDER_MEAD_H_
+#define NELDER_MEAD_H_
+
+// Includes
+#include <stdint.h>
+
+// Nelder-Mead simplex search for the minimum of a cost over [0, 1]^n, driven from outside so the
+// points of several searches can be evaluated together: ask() gives the points to evaluate next,
+// which do not depend on each other, and tell() takes their costs in the same order. Points are
+// kept in the box by clamping them to it.
+class NelderMead
+{
+public:
+  static constexpr uint8_t MAX_DIMENSIONS = 8;
+
+private:
+  enum Stage : uint8_t
+  {
+    STAGE_INITIAL = 0,
+    STAGE_REFLECT,
+    STAGE_EXPAND,
+    STAGE_CONTRACT_OUTSIDE,
+    STAGE_CONTRACT_INSIDE,
+    STAGE_SHRINK,
+  };
+
+  // Coefficients of the usual form
+  static constexpr double REFLECTION = 1;
+  static constexpr double EXPANSION = 2;
+  static constexpr double CONTRACTION = 0.5;
+  static constexpr double SHRINKAGE = 0.5;
+
+  // Class variables
+  uint8_t dimensions;
+  double tolerance; // Largest distance from the best vertex, in each coordinate, that ends the search
+  Stage stage;
+  uint32_t evaluations;
+
+  double simplex[MAX_DIMENSIONS + 1][MAX_DIMENSIONS]; // Sorted by cost once the initial costs are in
+  double costs[MAX_DIMENSIONS + 1];
+
+  double centroid[MAX_DIMENSIONS];
+  double reflected[MAX_DIMENSIONS];
+  double reflected_cost;
+  double trial[MAX_DIMENSIONS];
+
+  void sort();
+  void along(const double *from, const double *to, double factor, double *dest);
+  void replace_worst(const double *point, double cost);
+  void reflect();
+
+public:
+  NelderMead();
+
+  void begin(uint8_t dimensions, const double *start, double step, double tolerance);
+
+  // Returns the number of points written, 0 once the search has converged
+  uint8_t ask(double points[][MAX_DIMENSIONS]);
+  void tell(const double *point_costs);
+
+  bool is_converged();
+  uint32_t get_evaluations();
+  double get_best(double *point);
+};
+
+#endif // NELDER_MEAD_H_
@@ -0,0 +1,48 @@
+// Includes
+#include "record_log.hpp"
+
+#include <stdio.h>
+
+#include "record_format.hpp"
+
+bool record_read_file(const char *path, std::vector<uint8_t> *data)
+{
+  FILE *file = fopen(path, "rb");
+  uint8_t buffer[1 << 16];
+  size_t length;
+
+  if (file == nullptr)
+    return false;
+
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    data->insert(data->end(), buffer, buffer + length);
+
+  bool complete = !ferror(file);
+  fclose(file);
+  return complete;
+}
+
+// Joins the payloads of the blocks found in the UART output. Blocks are numbered from the start
+// of the recording, the stream ends at the first one missing.
+uint32_t record_join_blocks(const uint8_t *data, size_t length, std::vector<uint8_t> *stream)
+{
+  size_t offset = 0;
+  uint32_t expected = 0;
+  uint32_t sequence;
+  const uint8_t *payload;
+  uint32_t payload_length;
+
+  while (record_block_find(data, length, &offset, &sequence, &payload, &payload_length))
+  {
+    if (sequence != expected)
+    {
+      fprintf(stderr, "Block %u missing, reading the %u blocks before it.\n", expected, expected);
+      break;
+    }
+
+    stream->insert(stream->end(), payload, payload + payload_length);
+    expected++;
+  }
+
+  return expected;
+}
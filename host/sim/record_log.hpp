@@ -0,0 +1,17 @@
+#ifndef RECORD_LOG_H_
+#define RECORD_LOG_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Logs of the recorder as the UART output they were captured from, for the host tools that
+// read them
+
+bool record_read_file(const char *path, std::vector<uint8_t> *data);
+
+// Appends the payloads of the blocks in data to stream, returns the blocks joined
+uint32_t record_join_blocks(const uint8_t *data, size_t length, std::vector<uint8_t> *stream);
+
+#endif // RECORD_LOG_H_
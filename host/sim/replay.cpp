@@ -0,0 +1,524 @@
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "calibration.hpp"
+#include "motor_commands.hpp"
+#include "motor_controller.hpp"
+#include "record_format.hpp"
+#include "record_log.hpp"
+#include "recorder.hpp"
+#include "sim_hardware.hpp"
+#include "sim_kernel.hpp"
+
+// Feeds a log of controller inputs, recorded on the board or by dtmc_control_regression --record,
+// through the host build of the controllers on the simulated board and records it again. Edges
+// are delivered at their recorded times, pulse counts and ADC conversions at the start of the
+// tick their task read them on, calibration loads and commands after the tasks of their tick, as
+// app_main's bridges apply them. The controllers are initialised when the recording starts, as
+// app_main does, on the zero voltages they measured. The replayed log is then compared with the
+// original record by record: a log from the simulator replays bit-exactly, a log from the board
+// runs its tasks on ideal tick times and shows where that is enough.
+
+static constexpr uint64_t US_PER_TICK = 1000000 / configTICK_RATE_HZ;
+static constexpr uint32_t PROGRESS_TICKS = 60 * configTICK_RATE_HZ;
+
+typedef struct
+{
+  uint64_t time; // esp_timer time of the header
+  uint32_t tick;
+  bool zeroed[MAX_RECORD_INDEX + 1];
+  int32_t zero_mv[MAX_RECORD_INDEX + 1];
+  uint32_t last_tick;
+  uint64_t records;
+  uint64_t edges;
+  uint64_t outputs;
+  uint64_t commands;
+  bool overflowed;
+} log_summary;
+
+static MotorController motors[MOTOR_COUNT];
+
+static double wall_time()
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static bool scan_log(const std::vector<uint8_t> &stream, log_summary *summary)
+{
+  RecordDecoder decoder(stream.data(), stream.size());
+  record_entry entry;
+
+  memset(summary, 0, sizeof(*summary));
+  if (!decoder.next(&entry) || entry.type != RECORD_HEADER)
+  {
+    fprintf(stderr, "The log does not start with a header.\n");
+    return false;
+  }
+  if (entry.value != configTICK_RATE_HZ)
+  {
+    fprintf(stderr, "The log ticks at %d Hz, the simulator at %d Hz.\n", entry.value, configTICK_RATE_HZ);
+    return false;
+  }
+  summary->time = entry.time;
+  summary->tick = entry.tick;
+
+  while (decoder.next(&entry))
+  {
+    summary->records++;
+    summary->last_tick = entry.tick;
+
+    if (entry.type == RECORD_EDGE)
+      summary->edges++;
+    else if (entry.type == RECORD_OUTPUT)
+      summary->outputs++;
+    else if (entry.type == RECORD_PARAMETER)
+      summary->commands++;
+    else if (entry.type == RECORD_END)
+      summary->overflowed = entry.value != 0;
+    else if (entry.type == RECORD_ZERO && !summary->zeroed[entry.index])
+    {
+      summary->zeroed[entry.index] = true;
+      summary->zero_mv[entry.index] = entry.value;
+    }
+    else if (entry.type == RECORD_HEADER)
+    {
+      fprintf(stderr, "The log restarts at tick %u, replaying up to it.\n", entry.tick);
+      break;
+    }
+
+    if (entry.index >= MOTOR_COUNT && entry.type != RECORD_END && entry.type != RECORD_HEADER)
+    {
+      fprintf(stderr, "Record for motor %u, the simulator has %u.\n", entry.index, MOTOR_COUNT);
+      return false;
+    }
+  }
+
+  if (decoder.get_failed())
+    fprintf(stderr, "Record at byte %u does not decode, replaying up to it.\n", decoder.get_offset());
+
+  return true;
+}
+
+// The encoder edges, pulse counts and conversions of the log, as a device of the simulated board
+class ReplayInputs
+{
+private:
+  // Class variables
+  RecordDecoder decoder;
+  record_entry entry;
+  bool pending; // entry is due later
+  bool done;
+  uint64_t time_offset; // Simulator time less esp_timer time
+
+  static void advance_trampoline(void *context, uint64_t from, uint64_t to)
+  {
+    static_cast<ReplayInputs *>(context)->advance(from, to);
+  }
+
+  void advance(uint64_t from, uint64_t to)
+  {
+    while (!done)
+    {
+      if (!pending && !decoder.next(&entry))
+      {
+        done = true;
+        return;
+      }
+      pending = true;
+
+      if (entry.type == RECORD_EDGE)
+      {
+        // An edge on a tick boundary logged after records of that tick came after its tasks
+        uint64_t time = entry.time + time_offset;
+        if (time > to || entry.tick * US_PER_TICK >= to)
+          return;
+        sim_encoder_watch(MOTOR_CONFIGS[entry.index].encoder_a, entry.value, time > from ? time : from);
+      }
+      else if (entry.type == RECORD_COUNT || entry.type == RECORD_ADC)
+      {
+        // Before the tasks of the tick run
+        if (entry.tick * US_PER_TICK > to)
+          return;
+        if (entry.type == RECORD_COUNT)
+          sim_encoder_set_count(MOTOR_CONFIGS[entry.index].encoder_a, entry.value);
+        else
+          sim_adc_set_code(MOTOR_CONFIGS[entry.index].adc_channel, entry.value, entry.millivolts);
+      }
+      else if (entry.type == RECORD_HEADER)
+      {
+        // The log restarts, scan_log() ended the replay here
+        done = true;
+        return;
+      }
+
+      pending = false;
+    }
+  }
+
+public:
+  ReplayInputs(const std::vector<uint8_t> &stream, const log_summary &summary)
+      : decoder(stream.data(), stream.size())
+  {
+    pending = false;
+    done = false;
+    time_offset = summary.tick * US_PER_TICK - summary.time;
+
+    // Past the header, its time is not an edge
+    decoder.next(&entry);
+  }
+
+  void init()
+  {
+    sim_add_device(advance_trampoline, this);
+  }
+};
+
+static void run_to_tick(uint32_t tick)
+{
+  if (sim_time() < tick * US_PER_TICK)
+    sim_run_until(tick * US_PER_TICK);
+}
+
+// Loaded blobs go into NVS, then the motor loads its calibration as main.cpp's load_calibration()
+// does, once for the keys it loaded together
+static void load_motor(uint8_t motor)
+{
+  motors[motor].load_calibration();
+}
+
+static void replay_commands(const std::vector<uint8_t> &stream, const log_summary &summary)
+{
+  RecordDecoder decoder(stream.data(), stream.size());
+  record_entry entry;
+  int16_t load_motor_index = -1;
+  uint32_t load_tick = 0;
+  uint32_t progress_tick = summary.tick + PROGRESS_TICKS;
+
+  decoder.next(&entry);
+  while (decoder.next(&entry) && entry.type != RECORD_HEADER)
+  {
+    bool load = entry.type == RECORD_LOAD;
+
+    if (load_motor_index >= 0 && (!load || entry.index != load_motor_index || entry.tick != load_tick))
+    {
+      load_motor(load_motor_index);
+      load_motor_index = -1;
+    }
+
+    if (entry.type != RECORD_PARAMETER && !load)
+      continue;
+
+    while (progress_tick < entry.tick)
+    {
+      run_to_tick(progress_tick);
+      fprintf(stderr, "\r%.0f s", (progress_tick - summary.tick) / (double)configTICK_RATE_HZ);
+      progress_tick += PROGRESS_TICKS;
+    }
+    run_to_tick(entry.tick);
+
+    if (load)
+    {
+      if (entry.data != nullptr)
+        calibration_save(entry.index, entry.key, entry.data, entry.size);
+      else
+        calibration_erase(entry.index, entry.key);
+      load_motor_index = entry.index;
+      load_tick = entry.tick;
+    }
+    else if (command_motor(motors[entry.index], entry.index, (RecordParameter)entry.parameter, entry.values,
+                           entry.value_count) == ESP_ERR_INVALID_ARG)
+      fprintf(stderr, "Command %u at tick %u is missing values.\n", entry.parameter, entry.tick);
+  }
+
+  if (load_motor_index >= 0)
+    load_motor(load_motor_index);
+
+  run_to_tick(summary.last_tick);
+  if (summary.last_tick >= PROGRESS_TICKS)
+    fprintf(stderr, "\r");
+}
+
+static const char *const RECORD_NAMES[16] = {
+    "header", "tick", "edge", "count", "adc", "zero", "command", "load",
+    "output", "?", "?", "?", "?", "?", "?", "end",
+};
+
+static void print_record(FILE *file, const record_entry &entry, uint64_t start_time, uint32_t start_tick)
+{
+  fprintf(file, "%10.3f %-7s %u", (entry.tick - start_tick) / (double)configTICK_RATE_HZ, RECORD_NAMES[entry.type],
+          entry.index);
+
+  switch (entry.type)
+  {
+  case RECORD_HEADER:
+    fprintf(file, " %d Hz from %llu us", entry.value, (unsigned long long)entry.time);
+    break;
+  case RECORD_EDGE:
+    fprintf(file, " %+d at %.6f s", entry.value, (entry.time - start_time) / 1e6);
+    break;
+  case RECORD_COUNT:
+  case RECORD_ZERO:
+  case RECORD_END:
+    fprintf(file, " %d", entry.value);
+    break;
+  case RECORD_ADC:
+    fprintf(file, " %d = %d mV", entry.value, entry.millivolts);
+    break;
+  case RECORD_PARAMETER:
+    fprintf(file, " %u:", entry.parameter);
+    for (uint8_t i = 0; i < entry.value_count; i++)
+      fprintf(file, " %g", entry.values[i]);
+    break;
+  case RECORD_LOAD:
+    fprintf(file, " %s, %u bytes", entry.key, entry.size);
+    break;
+  case RECORD_OUTPUT:
+    fprintf(file, " %.9g", entry.values[0]);
+    break;
+  default:
+    break;
+  }
+
+  fprintf(file, "\n");
+}
+
+// Fields compared as recorded, times relative to each log's start
+static bool same_record(const record_entry &a, const record_entry &b, const log_summary &a_start,
+                        const log_summary &b_start)
+{
+  if (a.type != b.type || a.index != b.index || a.tick - a_start.tick != b.tick - b_start.tick ||
+      a.value != b.value || a.millivolts != b.millivolts)
+    return false;
+
+  switch (a.type)
+  {
+  case RECORD_EDGE:
+    return a.time - a_start.time == b.time - b_start.time;
+  case RECORD_PARAMETER:
+    return a.parameter == b.parameter && a.value_count == b.value_count &&
+           memcmp(a.values, b.values, a.value_count * sizeof(float)) == 0;
+  case RECORD_LOAD:
+    return strcmp(a.key, b.key) == 0 && a.size == b.size && memcmp(a.data, b.data, a.size) == 0;
+  case RECORD_OUTPUT:
+    return memcmp(a.values, b.values, sizeof(float)) == 0;
+  default:
+    return true;
+  }
+}
+
+// Next record of a log which the comparison covers, up to a restart. The end reason is the
+// recorder's, not the controller's.
+static bool next_compared(RecordDecoder *decoder, record_entry *entry, bool outputs_only)
+{
+  while (decoder->next(entry))
+  {
+    if (entry->type == RECORD_HEADER)
+      return false;
+    if (entry->type == RECORD_END)
+      continue;
+    if (!outputs_only || entry->type == RECORD_OUTPUT)
+      return true;
+  }
+
+  return false;
+}
+
+// Walks both logs in step, returns the records matched before the first difference
+static uint64_t compare_logs(const std::vector<uint8_t> &original, const log_summary &original_start,
+                             const std::vector<uint8_t> &replayed, const log_summary &replayed_start,
+                             bool outputs_only, bool *identical)
+{
+  RecordDecoder a_decoder(original.data(), original.size());
+  RecordDecoder b_decoder(replayed.data(), replayed.size());
+  record_entry a;
+  record_entry b;
+  uint64_t matched = 0;
+
+  // Past the headers, their times are the start of each log
+  a_decoder.next(&a);
+  b_decoder.next(&b);
+  *identical = true;
+  while (true)
+  {
+    bool a_more = next_compared(&a_decoder, &a, outputs_only);
+    bool b_more = next_compared(&b_decoder, &b, outputs_only);
+
+    if (!a_more && !b_more)
+      return matched;
+
+    if (a_more != b_more || !same_record(a, b, original_start, replayed_start))
+    {
+      *identical = false;
+      fprintf(stderr, "First %s difference after %llu records:\n", outputs_only ? "output" : "record",
+              (unsigned long long)matched);
+      fprintf(stderr, "  recorded ");
+      if (a_more)
+        print_record(stderr, a, original_start.time, original_start.tick);
+      else
+        fprintf(stderr, "end of log\n");
+      fprintf(stderr, "  replayed ");
+      if (b_more)
+        print_record(stderr, b, replayed_start.time, replayed_start.tick);
+      else
+        fprintf(stderr, "end of log\n");
+      return matched;
+    }
+
+    matched++;
+  }
+}
+
+static void dump_log(const std::vector<uint8_t> &stream, const log_summary &summary)
+{
+  RecordDecoder decoder(stream.data(), stream.size());
+  record_entry entry;
+
+  while (decoder.next(&entry))
+    print_record(stdout, entry, summary.time, summary.tick);
+}
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options] LOG\n"
+          "  --dump         Print the log's records instead of replaying it\n"
+          "  --output FILE  Write the replayed log to FILE\n"
+          "  --no-verify    Replay without comparing against the log\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  const char *log_path = nullptr;
+  const char *output_path = nullptr;
+  bool dump = false;
+  bool verify = true;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--dump") == 0)
+      dump = true;
+    else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+      output_path = argv[++i];
+    else if (strcmp(argv[i], "--no-verify") == 0)
+      verify = false;
+    else if (argv[i][0] != '-' && log_path == nullptr)
+      log_path = argv[i];
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (log_path == nullptr)
+  {
+    print_usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> stream;
+  log_summary summary;
+
+  if (!record_read_file(log_path, &data))
+  {
+    fprintf(stderr, "Cannot read %s.\n", log_path);
+    return 1;
+  }
+  uint32_t blocks = record_join_blocks(data.data(), data.size(), &stream);
+  data.clear();
+  data.shrink_to_fit();
+
+  if (!scan_log(stream, &summary))
+    return 1;
+
+  if (dump)
+  {
+    dump_log(stream, summary);
+    return 0;
+  }
+
+  double duration = (summary.last_tick - summary.tick) / (double)configTICK_RATE_HZ;
+  printf("%s: %u blocks, %.1f s, %llu records, %llu edges, %llu commands%s.\n", log_path, blocks, duration,
+         (unsigned long long)summary.records, (unsigned long long)summary.edges,
+         (unsigned long long)summary.commands, summary.overflowed ? ", ended by an overflow" : "");
+
+  // The replay is recorded again, into memory
+  char *replayed_data = nullptr;
+  size_t replayed_length = 0;
+  FILE *replayed_file = open_memstream(&replayed_data, &replayed_length);
+  double started = wall_time();
+
+  ReplayInputs inputs(stream, summary);
+  run_to_tick(summary.tick);
+  inputs.init();
+  sim_uart_set_output(replayed_file);
+  recorder().start();
+
+  for (uint8_t i = 0; i < MOTOR_COUNT; i++)
+  {
+    if (summary.zeroed[i])
+      sim_adc_set_code(MOTOR_CONFIGS[i].adc_channel, sim_adc_code(summary.zero_mv[i]), summary.zero_mv[i]);
+  }
+  for (uint8_t i = 0; i < MOTOR_COUNT; i++)
+  {
+    if (summary.zeroed[i])
+      motors[i].init(i);
+  }
+
+  replay_commands(stream, summary);
+
+  recorder().stop();
+  recorder().flush();
+  sim_uart_set_output(nullptr);
+  fclose(replayed_file);
+
+  double elapsed = wall_time() - started;
+  printf("Replayed in %.2f s, %.0fx real time.\n", elapsed, duration / elapsed);
+
+  std::vector<uint8_t> replayed;
+  log_summary replayed_summary;
+  record_join_blocks((const uint8_t *)replayed_data, replayed_length, &replayed);
+
+  if (output_path != nullptr)
+  {
+    FILE *output = fopen(output_path, "wb");
+    if (output == nullptr || fwrite(replayed_data, 1, replayed_length, output) != replayed_length ||
+        fclose(output) != 0)
+    {
+      fprintf(stderr, "Cannot write %s.\n", output_path);
+      return 1;
+    }
+  }
+  free(replayed_data);
+
+  if (!verify)
+    return 0;
+
+  if (!scan_log(replayed, &replayed_summary))
+    return 1;
+
+  bool outputs_identical;
+  bool records_identical;
+  uint64_t outputs = compare_logs(stream, summary, replayed, replayed_summary, true, &outputs_identical);
+  uint64_t records = compare_logs(stream, summary, replayed, replayed_summary, false, &records_identical);
+
+  if (records_identical)
+    printf("Replay is bit-exact: %llu records, %llu duty cycle changes.\n", (unsigned long long)records,
+           (unsigned long long)outputs);
+  else if (outputs_identical)
+    printf("Duty cycles match over %llu changes, other records differ.\n", (unsigned long long)outputs);
+  else
+    printf("Replay diverges after %llu matching duty cycle changes.\n", (unsigned long long)outputs);
+
+  return records_identical ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+// Includes
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.hpp"
+#include "motor_commands.hpp"
+#include "motor_controller.hpp"
+#include "motor_plant.hpp"
+#include "sim_hardware.hpp"
+#include "sim_kernel.hpp"
+
+// Trip latency of the safety supervisor on the simulator's clock. A simulated motor running the
+// firmware at speed has a fault injected into its plant: a shorted winding, a shaft turned by
+// hand against a reversed drive, a stall by hand, a cut encoder cable and a silent hub. Each must
+// force the bridge, to coast for overcurrent and to brake otherwise, latch its fault, stop the
+// motor and hold it off until cleared. The short is timed by stepping the simulator in STEP_US
+// until the enable pin drops, plugging likewise against its own limit, and the slow path by its
+// own latency from the limit to the trip, within one update period.
+
+static constexpr float SPEED = 90;              // Set point in RPM
+static constexpr float SHORT_OHMS = 2;          // Winding shorted down to this, 6 A at full duty
+static constexpr float STALL_LOAD = 12;         // As volts, holds the motor at full duty
+static constexpr float HAND_LOAD = -20;         // Turns the motor forward against full reverse duty
+static constexpr uint32_t STEP_US = 5;
+static constexpr uint32_t MAX_OVERCURRENT_US = CONFIG_DTMC_SAFETY_OVERCURRENT_US + 175; // A frame and the plant's step
+static constexpr uint32_t MAX_PLUGGING_US = CONFIG_DTMC_SAFETY_PLUGGING_US + 175;
+static constexpr uint64_t REVERSAL_US = 1000000;
+static constexpr uint32_t MAX_SLOW_US = 1000;       // One update period
+static constexpr uint64_t SETTLE_US = 2000000;
+static constexpr uint64_t TRIP_TIMEOUT_US = 3000000;
+
+static uint8_t fault_reports = 0;
+
+static void fault_reported(uint8_t motor)
+{
+  (void)motor;
+  fault_reports++;
+}
+
+static void run(MotorController &motor)
+{
+  command_motor(motor, 0, PARAMETER_VELOCITY, {SPEED});
+  command_motor(motor, 0, PARAMETER_MODE, {(float)AUTO_VELOCITY});
+  sim_run_for(SETTLE_US);
+}
+
+// Runs until the motor trips or the timeout passes, returns the time it took
+static uint64_t run_to_trip(MotorController &motor)
+{
+  uint64_t start = sim_time();
+
+  while (motor.get_fault() == FAULT_NONE && sim_time() - start < TRIP_TIMEOUT_US)
+    sim_run_for(1000);
+
+  // The PID task stops the motor and reports the fault after the trip
+  sim_run_for(20000);
+  return sim_time() - start;
+}
+
+static uint32_t report_latency(MotorController &motor, char *code)
+{
+  char json[MEMORY_SUMMARY_BUFFER_SIZE];
+  uint32_t latency = UINT32_MAX;
+
+  motor.get_fault_string(json, sizeof(json));
+  printf("    %s\n", json);
+  if (sscanf(json, "{\"fault\":{\"active\":true,\"code\":\"%15[a-z]\",\"time\":%*u,\"latency_us\":%" SCNu32, code,
+             &latency) != 2)
+    return UINT32_MAX;
+  return latency;
+}
+
+static bool braking(const motor_config *config)
+{
+  return sim_pwm_duty(config->ena) == 1 && sim_gpio_level(config->in1) == 0 && sim_gpio_level(config->in2) == 0;
+}
+
+// An unknown mode from the cloud must not leave the bridge driven with no loop controlling it
+static void check_unknown_mode(MotorController &motor)
+{
+  run(motor);
+  command_motor(motor, 0, PARAMETER_MODE, {99});
+  command_motor(motor, 0, PARAMETER_MODE, {-1});
+  check(motor.get_mode() == AUTO_VELOCITY, "an unknown mode is ignored and the velocity loop runs on");
+}
+
+static void check_overcurrent(MotorController &motor, MotorPlant &plant, const motor_config *config)
+{
+  char code[16] = "";
+
+  run(motor);
+  check(motor.get_fault() == FAULT_NONE && sim_pwm_duty(config->ena) > 0, "a motor running at speed has no fault");
+
+  uint64_t start = sim_time();
+  plant.set_short(SHORT_OHMS);
+  while (sim_pwm_duty(config->ena) > 0 && sim_time() - start < TRIP_TIMEOUT_US)
+    sim_run_for(STEP_US);
+  uint64_t latency = sim_time() - start;
+  printf("    overcurrent trip %llu us after the short\n", (unsigned long long)latency);
+
+  check(motor.get_fault() == FAULT_OVERCURRENT, "a shorted winding trips on overcurrent");
+  check(latency <= MAX_OVERCURRENT_US, "the overcurrent trip forces the bridge within a frame of its duration");
+
+  sim_run_for(20000);
+  uint32_t reported = report_latency(motor, code);
+  check(strcmp(code, "overcurrent") == 0 && reported >= CONFIG_DTMC_SAFETY_OVERCURRENT_US && reported <= latency,
+        "the report carries the fault and its latency");
+  check(fault_reports == 1, "the fault is reported once");
+  check(sim_pwm_duty(config->ena) == 0 && sim_gpio_level(config->in1) == 0 && sim_gpio_level(config->in2) == 0,
+        "an overcurrent leaves the bridge coasting");
+
+  // Latched: driving is refused until the fault is cleared
+  command_motor(motor, 0, PARAMETER_MODE, {(float)AUTO_VELOCITY});
+  sim_run_for(100000);
+  check(motor.get_fault() == FAULT_OVERCURRENT && sim_pwm_duty(config->ena) == 0, "the fault holds the motor off");
+  check(command_motor(motor, 0, PARAMETER_AUTOTUNE, {40, 160, 4, 0.1, 1, 0}) == ESP_ERR_INVALID_STATE,
+        "tuning is refused while the fault is latched");
+
+  plant.set_short(0);
+  check(command_motor(motor, 0, PARAMETER_CLEAR_FAULT, {}) == ESP_OK, "the fault clears");
+  check(motor.get_fault() == FAULT_NONE && fault_reports == 2, "clearing is reported");
+  check(command_motor(motor, 0, PARAMETER_CLEAR_FAULT, {}) == ESP_ERR_INVALID_STATE, "nothing is left to clear");
+  check(sim_gpio_level(config->in1) == 0 && sim_gpio_level(config->in2) == 0, "the motor stays off after clearing");
+}
+
+// Reverses the bridge at full duty under the manual mode, as a PID saturating against the motion would
+static void reverse(MotorController &motor)
+{
+  command_motor(motor, 0, PARAMETER_MODE, {(float)MANUAL});
+  motor.set_direction(COUNTERCLOCKWISE);
+  motor.set_duty_cycle(1);
+}
+
+// Lets the motor coast to rest, the velocity loop resumes driving clockwise
+static void rest(MotorController &motor)
+{
+  motor.stop_motor();
+  sim_run_for(SETTLE_US);
+  motor.set_direction(CLOCKWISE);
+  motor.stop_motor();
+}
+
+static void check_plugging(MotorController &motor, MotorPlant &plant, const motor_config *config)
+{
+  char code[16] = "";
+
+  // A reversal plugs the motor beyond the overcurrent limit until it slows, well within its own
+  run(motor);
+  reverse(motor);
+  sim_run_for(REVERSAL_US);
+  check(motor.get_fault() == FAULT_NONE && plant.get_velocity() < 0, "a reversal at speed does not trip");
+  rest(motor);
+
+  // Held turning forward, the reversed drive plugs the motor for as long as the hand holds on
+  run(motor);
+  uint64_t start = sim_time();
+  plant.set_load(HAND_LOAD);
+  reverse(motor);
+  while (sim_pwm_duty(config->ena) > 0 && sim_time() - start < TRIP_TIMEOUT_US)
+    sim_run_for(STEP_US);
+  uint64_t latency = sim_time() - start;
+  printf("    plugging trip %llu us after the reversal\n", (unsigned long long)latency);
+
+  check(motor.get_fault() == FAULT_OVERCURRENT, "a drive reversed against a shaft held turning trips on overcurrent");
+  check(latency <= MAX_PLUGGING_US, "the plugging trip forces the bridge within a frame of its duration");
+
+  sim_run_for(20000);
+  uint32_t reported = report_latency(motor, code);
+  check(strcmp(code, "overcurrent") == 0 && reported >= CONFIG_DTMC_SAFETY_PLUGGING_US && reported <= latency,
+        "the report carries the plugging trip's latency");
+  check(sim_pwm_duty(config->ena) == 0, "plugging leaves the bridge coasting");
+
+  plant.set_load(0);
+  rest(motor);
+  command_motor(motor, 0, PARAMETER_CLEAR_FAULT, {});
+}
+
+static void check_stall(MotorController &motor, MotorPlant &plant, const motor_config *config)
+{
+  char code[16] = "";
+
+  run(motor);
+  plant.set_load(STALL_LOAD);
+  uint64_t elapsed = run_to_trip(motor);
+  printf("    stalled trip %llu ms after the load\n", (unsigned long long)(elapsed / 1000));
+
+  check(motor.get_fault() == FAULT_STALL, "a stalled motor trips on stall");
+  check(report_latency(motor, code) <= MAX_SLOW_US && strcmp(code, "stall") == 0,
+        "the stall trips within an update period of its timeout");
+  check(braking(config), "a stall brakes the bridge");
+
+  plant.set_load(0);
+  command_motor(motor, 0, PARAMETER_CLEAR_FAULT, {});
+}
+
+static void check_encoder(MotorController &motor, MotorPlant &plant, const motor_config *config)
+{
+  char code[16] = "";
+
+  run(motor);
+  plant.set_encoder_connected(false);
+  uint64_t elapsed = run_to_trip(motor);
+  printf("    encoder trip %llu ms after the cable was cut\n", (unsigned long long)(elapsed / 1000));
+
+  check(motor.get_fault() == FAULT_ENCODER, "a motor turning without edges trips on its encoder");
+  check(report_latency(motor, code) <= MAX_SLOW_US && strcmp(code, "encoder") == 0,
+        "the encoder fault trips within an update period of its timeout");
+  check(braking(config), "an encoder fault brakes the bridge");
+
+  sim_run_for(SETTLE_US);
+  check(fabsf(plant.get_velocity()) < 1, "the braked motor stops");
+
+  plant.set_encoder_connected(true);
+  command_motor(motor, 0, PARAMETER_CLEAR_FAULT, {});
+}
+
+static void check_link(MotorController &motor, const motor_config *config)
+{
+  char code[16] = "";
+
+  // Heard from throughout the run, then silent
+  SafetySupervisor::heartbeat();
+  command_motor(motor, 0, PARAMETER_VELOCITY, {SPEED});
+  command_motor(motor, 0, PARAMETER_MODE, {(float)AUTO_VELOCITY});
+  for (uint32_t i = 0; i < 20; i++)
+  {
+    sim_run_for(CONFIG_DTMC_SAFETY_LINK_TIMEOUT_MS * 1000 / 2);
+    SafetySupervisor::heartbeat();
+  }
+  check(motor.get_fault() == FAULT_NONE, "a motor hearing from the hub runs on");
+
+  uint64_t elapsed = run_to_trip(motor);
+  printf("    link trip %llu ms after the last heartbeat\n", (unsigned long long)(elapsed / 1000));
+
+  check(motor.get_fault() == FAULT_LINK, "a silent hub trips the link");
+  check(report_latency(motor, code) <= MAX_SLOW_US && strcmp(code, "link") == 0,
+        "the link trips within an update period of its timeout");
+  check(braking(config), "a lost link brakes the bridge");
+}
+
+int main()
+{
+  MotorController motor;
+  MotorPlant plant;
+  const motor_config *config = &MOTOR_CONFIGS[0];
+
+  plant.init(0);
+  motor.set_fault_callback(fault_reported);
+  motor.init(0);
+
+  check_unknown_mode(motor);
+  check_overcurrent(motor, plant, config);
+  check_plugging(motor, plant, config);
+  check_stall(motor, plant, config);
+  check_encoder(motor, plant, config);
+  check_link(motor, config);
+
+  return check_summary();
+}
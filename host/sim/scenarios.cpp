@@ -0,0 +1,487 @@
+// Includes
+#include "scenarios.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "motor_commands.hpp"
+#include "motor_controller.hpp"
+#include "recorder.hpp"
+#include "sim_hardware.hpp"
+#include "sim_kernel.hpp"
+
+static constexpr uint32_t SAMPLE_US = 1000;
+static constexpr float SETTLING_BAND = 0.02;    // Of the step, or of the set point after a load change
+static constexpr float STEADY_STATE_PART = 0.25; // Last part of a segment the steady state error is the mean over
+static constexpr float CALIBRATION_TIMEOUT = 60;
+
+// Host CPU per control period, loose enough for a loaded build machine
+static constexpr float CPU_MEAN_LIMIT_US = 50;
+static constexpr float CPU_MAX_LIMIT_US = 5000;
+
+const char *const METRIC_NAMES[METRIC_COUNT] = {
+    "settling_time_s",
+    "overshoot_percent",
+    "steady_state_error",
+    "iae",
+    "peak_deviation",
+    "peak_current_ma",
+    "pid_cpu_mean_us",
+    "pid_cpu_max_us",
+    "update_cpu_mean_us",
+    "update_cpu_max_us",
+};
+
+// Limits are the first baseline with a margin of about a fifth, tighten them as the controllers
+// improve. Position control limit-cycles around its 5 degree deadband at the uncalibrated duty
+// floor, so its settling time is the segment's length until that changes.
+const scenario SCENARIOS[] = {
+    {"velocity_step_60", AUTO_VELOCITY, PROFILE_SQUARE, 60, 0.25, 4, 0, 0, 0, 0, 0, false,
+     {1, 31, 0.5, 11, NAN, 800}},
+    {"velocity_step_120", AUTO_VELOCITY, PROFILE_SQUARE, 120, 0.25, 4, 0, 0, 0, 0, 0, false,
+     {0.8, 7, 1, 17, NAN, 1000}},
+    {"velocity_reversal_square", AUTO_VELOCITY, PROFILE_SQUARE, 90, 0.5, 6, 0, 0, 0, 0, 0, false,
+     {0.9, 15, 0.6, 60, NAN, 1300}},
+    {"velocity_reversal_scurve", AUTO_VELOCITY, PROFILE_SCURVE, 90, 0.5, 6, 0, 0, 0, 0, 0, false,
+     {1.25, 2, 0.4, 230, NAN, 1000}},
+    {"velocity_load", AUTO_VELOCITY, PROFILE_SQUARE, 90, 0.1, 6, 1.5, 2, 4, 0, 0, false,
+     {0.9, 14, 0.6, 27, 19, 900}},
+    {"velocity_noise", AUTO_VELOCITY, PROFILE_SQUARE, 90, 0.25, 4, 0, 0, 0, 20, 20, false,
+     {0.9, 14, 0.7, 14, NAN, 900}},
+    {"velocity_calibrated", AUTO_VELOCITY, PROFILE_SCURVE, 120, 0.5, 6, 0, 0, 0, 0, 0, true,
+     {1.45, 24, 0.3, 340, NAN, 620}},
+    {"position_step_360", AUTO_POSITION, PROFILE_SQUARE, 360, 0.25, 4, 0, 0, 0, 0, 0, false,
+     {4, 8, 5.5, 195, NAN, 1700}},
+    {"position_reversal_scurve", AUTO_POSITION, PROFILE_SCURVE, 360, 0.2, 10, 0, 0, 0, 0, 0, false,
+     {5, 3, 6, 1400, NAN, 1050}},
+    {"position_load", AUTO_POSITION, PROFILE_SQUARE, 360, 0.1, 6, 3.5, 3, 6, 0, 0, false,
+     {3, 8, 6, 205, 12.5, 1700}},
+};
+
+const uint8_t SCENARIO_COUNT = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]);
+
+typedef struct
+{
+  float time;
+  float target;
+  float actual;
+  float current;
+  float duty_cycle;
+  float measured; // The controller's own velocity or position
+} trace_sample;
+
+static volatile bool calibration_done = false;
+
+static void calibration_finished(uint8_t motor)
+{
+  calibration_done = true;
+}
+
+static double wall_time()
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Set point the reference steps to in the segment containing time
+static float target_at(const scenario &test, float time)
+{
+  uint32_t reversals = (uint32_t)(time * test.freq);
+
+  return reversals % 2 == 0 ? test.setpoint : -test.setpoint;
+}
+
+static void split_segments(const scenario &test, scenario_result *result)
+{
+  std::vector<float> bounds;
+  std::vector<bool> disturbance;
+
+  for (uint32_t i = 0; i * (1 / test.freq) < test.duration; i++)
+  {
+    bounds.push_back(i / test.freq);
+    disturbance.push_back(false);
+  }
+
+  for (float change : {test.load_start, test.load_end})
+  {
+    if (test.load == 0 || change <= 0 || change >= test.duration)
+      continue;
+
+    size_t i = 0;
+    while (i < bounds.size() && bounds[i] < change)
+      i++;
+    if (i < bounds.size() && bounds[i] == change)
+      continue;
+    bounds.insert(bounds.begin() + i, change);
+    disturbance.insert(disturbance.begin() + i, true);
+  }
+
+  result->segment_count = 0;
+  for (size_t i = 0; i < bounds.size() && i < MAX_SEGMENTS; i++)
+  {
+    segment_result &segment = result->segments[result->segment_count++];
+
+    segment.start = bounds[i];
+    segment.end = i + 1 < bounds.size() ? bounds[i + 1] : test.duration;
+    segment.target = target_at(test, segment.start);
+    segment.disturbance = disturbance[i];
+  }
+}
+
+static void measure_segment(const std::vector<trace_sample> &trace, segment_result *segment)
+{
+  float *metrics = segment->metrics;
+  size_t first = trace.size();
+  size_t last = 0;
+  float step;
+  float band;
+  float settled = segment->start;
+  float overshoot = 0;
+  float steady_sum = 0;
+  uint32_t steady_count = 0;
+  float iae = 0;
+  float deviation = 0;
+  float peak_current = 0;
+  float steady_start = segment->end - STEADY_STATE_PART * (segment->end - segment->start);
+
+  for (size_t i = 0; i < trace.size(); i++)
+  {
+    if (trace[i].time >= segment->start && trace[i].time < segment->end)
+    {
+      first = i < first ? i : first;
+      last = i;
+    }
+  }
+  if (first > last)
+  {
+    for (uint8_t i = 0; i <= METRIC_PEAK_CURRENT; i++)
+      metrics[i] = NAN;
+    return;
+  }
+
+  step = segment->target - trace[first].actual;
+  band = SETTLING_BAND * (segment->disturbance ? fabsf(segment->target) : fabsf(step));
+
+  for (size_t i = first; i <= last; i++)
+  {
+    const trace_sample &sample = trace[i];
+    float error = sample.actual - segment->target;
+
+    if (fabsf(error) > band)
+      settled = sample.time + SAMPLE_US / 1e6f;
+    if (step != 0 && error * step > 0)
+      overshoot = fmaxf(overshoot, fabsf(error) / fabsf(step) * 100);
+    if (sample.time >= steady_start)
+    {
+      steady_sum += fabsf(error);
+      steady_count++;
+    }
+    iae += fabsf(error) * SAMPLE_US / 1e6f;
+    deviation = fmaxf(deviation, fabsf(error));
+    peak_current = fmaxf(peak_current, sample.current);
+  }
+
+  // A segment that never settles counts its full length
+  metrics[METRIC_SETTLING_TIME] = fminf(settled, segment->end) - segment->start;
+  metrics[METRIC_OVERSHOOT] = segment->disturbance ? NAN : overshoot;
+  metrics[METRIC_STEADY_STATE_ERROR] = steady_count > 0 ? steady_sum / steady_count : NAN;
+  metrics[METRIC_IAE] = iae;
+  metrics[METRIC_PEAK_DEVIATION] = segment->disturbance ? deviation : NAN;
+  metrics[METRIC_PEAK_CURRENT] = peak_current;
+}
+
+// Worst segment for each metric, IAE summed over the scenario
+static void reduce_segments(scenario_result *result)
+{
+  for (uint8_t i = 0; i <= METRIC_PEAK_CURRENT; i++)
+  {
+    float value = NAN;
+
+    for (uint8_t j = 0; j < result->segment_count; j++)
+    {
+      float metric = result->segments[j].metrics[i];
+
+      if (isnan(metric))
+        continue;
+      if (isnan(value))
+        value = metric;
+      else
+        value = i == METRIC_IAE ? value + metric : fmaxf(value, metric);
+    }
+
+    result->metrics[i] = value;
+  }
+}
+
+static void measure_cpu(const char *task_name, float *mean, float *max)
+{
+  sim_task_stats stats;
+
+  if (!sim_get_task_stats(task_name, &stats) || stats.slices == 0)
+  {
+    *mean = NAN;
+    *max = NAN;
+    return;
+  }
+
+  *mean = stats.cpu_ns / 1000.0 / stats.slices;
+  *max = stats.max_ns / 1000.0;
+}
+
+static bool write_trace(const char *directory, const scenario &test, const std::vector<trace_sample> &trace)
+{
+  std::string path = std::string(directory) + "/" + test.name + ".csv";
+  FILE *file = fopen(path.c_str(), "w");
+
+  if (file == nullptr)
+    return false;
+
+  fprintf(file, "time_s,target,actual,measured,duty_cycle,current_ma\n");
+  for (const trace_sample &sample : trace)
+    fprintf(file, "%.3f,%.3f,%.3f,%.3f,%.4f,%.1f\n", sample.time, sample.target, sample.actual, sample.measured,
+            sample.duty_cycle, sample.current);
+
+  return fclose(file) == 0;
+}
+
+// Runs in the scenario's own process
+void run_scenario(const scenario &test, const scenario_setup &setup, const scenario_output &output,
+                  scenario_result *result)
+{
+  MotorController motor;
+  MotorPlant plant;
+  std::vector<trace_sample> trace;
+  double started = wall_time();
+  bool load_applied = false;
+  FILE *record = nullptr;
+
+  memset(result, 0, sizeof(*result));
+
+  plant.init(0);
+  if (setup.model != nullptr)
+    plant.set_model(*setup.model);
+  plant.set_encoder_jitter(test.jitter_us, 1);
+  plant.set_current_noise(test.noise_mv, 2);
+
+  // Started ahead of the controller as app_main does, so the log holds its zeroing
+  if (output.record_directory != nullptr)
+  {
+    std::string path = std::string(output.record_directory) + "/" + test.name + ".dtmr";
+    record = fopen(path.c_str(), "wb");
+    if (record == nullptr)
+      return;
+    sim_uart_set_output(record);
+    recorder().start();
+  }
+  motor.init(0);
+
+  if (setup.tuning != nullptr)
+  {
+    if (controller_tuning_save(0, *setup.tuning) != ESP_OK)
+      return;
+    motor.load_calibration();
+  }
+
+  if (test.calibrate)
+  {
+    motor.set_calibration_callback(calibration_finished);
+    if (command_motor(motor, 0, PARAMETER_FRICTION_CALIBRATION, {0}) != ESP_OK)
+      return;
+    while (!calibration_done && sim_time() < CALIBRATION_TIMEOUT * 1e6)
+      sim_run_for(SAMPLE_US);
+    if (!calibration_done)
+      return;
+
+    // Settle back to rest before the reference starts
+    sim_run_for(500 * SAMPLE_US);
+  }
+
+  command_motor(motor, 0, PARAMETER_PROFILE, {(float)test.profile, 60, 300, 3000});
+  command_motor(motor, 0, PARAMETER_FREQUENCY, {test.freq});
+  if (test.mode == AUTO_VELOCITY)
+    command_motor(motor, 0, PARAMETER_VELOCITY, {test.setpoint});
+  else
+    command_motor(motor, 0, PARAMETER_POSITION, {test.setpoint});
+
+  uint64_t start = sim_time();
+  command_motor(motor, 0, PARAMETER_MODE, {(float)test.mode});
+  sim_reset_task_stats();
+
+  for (uint64_t elapsed = 0; elapsed < test.duration * 1e6; elapsed += SAMPLE_US)
+  {
+    float time = elapsed / 1e6f;
+    bool load_due = time >= test.load_start && time < test.load_end;
+
+    if (load_due != load_applied)
+    {
+      plant.set_load(load_due ? test.load : 0);
+      load_applied = load_due;
+    }
+
+    plant.reset_peak_current();
+    sim_run_until(start + elapsed + SAMPLE_US);
+
+    trace_sample sample;
+    sample.time = time;
+    sample.target = target_at(test, time);
+    sample.current = plant.get_peak_current();
+    sample.duty_cycle = motor.get_duty_cycle();
+    if (test.mode == AUTO_VELOCITY)
+    {
+      sample.actual = plant.get_velocity();
+      sample.measured = motor.get_velocity();
+    }
+    else
+    {
+      sample.actual = plant.get_position();
+      sample.measured = motor.get_position();
+    }
+    trace.push_back(sample);
+  }
+
+  measure_cpu("PID Controller Task", &result->metrics[METRIC_PID_CPU_MEAN], &result->metrics[METRIC_PID_CPU_MAX]);
+  measure_cpu("Update Task", &result->metrics[METRIC_UPDATE_CPU_MEAN], &result->metrics[METRIC_UPDATE_CPU_MAX]);
+  motor.stop_motor();
+
+  if (record != nullptr)
+  {
+    recorder().stop();
+    recorder().flush();
+    sim_uart_set_output(nullptr);
+    if (fclose(record) != 0 || recorder().has_overflowed())
+      return;
+  }
+
+  split_segments(test, result);
+  for (uint8_t i = 0; i < result->segment_count; i++)
+    measure_segment(trace, &result->segments[i]);
+  reduce_segments(result);
+
+  if (output.trace_directory != nullptr && !write_trace(output.trace_directory, test, trace))
+    fprintf(stderr, "%s: failed to write the trace.\n", test.name);
+
+  result->wall_time = wall_time() - started;
+  result->completed = true;
+}
+
+float metric_limit(const scenario &test, uint8_t metric)
+{
+  switch (metric)
+  {
+  case METRIC_SETTLING_TIME:
+    return test.limits.settling_time;
+  case METRIC_OVERSHOOT:
+    return test.limits.overshoot;
+  case METRIC_STEADY_STATE_ERROR:
+    return test.limits.steady_state_error;
+  case METRIC_IAE:
+    return test.limits.iae;
+  case METRIC_PEAK_DEVIATION:
+    return test.limits.peak_deviation;
+  case METRIC_PEAK_CURRENT:
+    return test.limits.peak_current;
+  case METRIC_PID_CPU_MEAN:
+  case METRIC_UPDATE_CPU_MEAN:
+    return CPU_MEAN_LIMIT_US;
+  default:
+    return CPU_MAX_LIMIT_US;
+  }
+}
+
+// A metric with no limit is reported only, one that was not measured against a limit fails
+bool metric_passed(float value, float limit)
+{
+  if (isnan(limit))
+    return true;
+  return !isnan(value) && value <= limit;
+}
+
+bool scenario_passed(const scenario &test, const scenario_result &result)
+{
+  bool passed = result.completed;
+
+  for (uint8_t i = 0; i < METRIC_COUNT && passed; i++)
+    passed = metric_passed(result.metrics[i], metric_limit(test, i));
+
+  return passed;
+}
+
+typedef struct
+{
+  pid_t pid;
+  int fd;
+  size_t job;
+} running_job;
+
+void run_scenario_jobs(size_t count, uint32_t jobs, scenario_job run, scenario_job_finished finished, void *context,
+                       scenario_result *results)
+{
+  std::vector<running_job> running;
+  size_t next = 0;
+
+  fflush(stdout);
+  fflush(stderr);
+
+  while (next < count || !running.empty())
+  {
+    while (next < count && running.size() < jobs)
+    {
+      int fds[2];
+      size_t job = next++;
+
+      memset(&results[job], 0, sizeof(results[job]));
+      if (pipe(fds) != 0)
+        continue;
+
+      pid_t pid = fork();
+      if (pid == 0)
+      {
+        scenario_result result;
+
+        close(fds[0]);
+        run(job, &result, context);
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+          _exit(1);
+        _exit(0);
+      }
+
+      close(fds[1]);
+      if (pid < 0)
+      {
+        close(fds[0]);
+        continue;
+      }
+      running.push_back({pid, fds[0], job});
+    }
+
+    int status;
+    pid_t ended = wait(&status);
+    if (ended < 0)
+      break;
+
+    for (size_t i = 0; i < running.size(); i++)
+    {
+      if (running[i].pid != ended)
+        continue;
+
+      // A crashed job leaves its result zeroed, which reports it as not completed
+      scenario_result &result = results[running[i].job];
+      if (read(running[i].fd, &result, sizeof(result)) != sizeof(result))
+        memset(&result, 0, sizeof(result));
+      close(running[i].fd);
+
+      if (finished != nullptr)
+        finished(running[i].job, result, context);
+      running.erase(running.begin() + i);
+      break;
+    }
+  }
+}
@@ -0,0 +1,122 @@
+#ifndef SCENARIOS_H_
+#define SCENARIOS_H_
+
+// Includes
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "controller_tuning.hpp"
+#include "motor_plant.hpp"
+
+// Closed-loop scenarios of the firmware's automatic modes, shared by the control regression and
+// the gain tuner. Each scenario runs the real MotorController against a MotorPlant on the
+// simulated board, in a process of its own since the firmware's peripherals and tasks are
+// global, with as many processes at once as there are cores. The reference steps between +/-
+// the set point at every reversal, the motion metrics are taken per segment between reversals
+// and load changes from the plant's true velocity or position, then reduced to the worst
+// segment of the scenario.
+
+static constexpr uint8_t MAX_SEGMENTS = 16;
+
+enum Metric : uint8_t
+{
+  METRIC_SETTLING_TIME = 0,
+  METRIC_OVERSHOOT,
+  METRIC_STEADY_STATE_ERROR,
+  METRIC_IAE,
+  METRIC_PEAK_DEVIATION,
+  METRIC_PEAK_CURRENT,
+  METRIC_PID_CPU_MEAN,
+  METRIC_PID_CPU_MAX,
+  METRIC_UPDATE_CPU_MEAN,
+  METRIC_UPDATE_CPU_MAX,
+  METRIC_COUNT,
+};
+
+extern const char *const METRIC_NAMES[METRIC_COUNT];
+
+// Upper limits of the motion metrics, NAN where a scenario does not measure one. Errors are in
+// RPM or degrees, IAE in RPM s or degree s.
+typedef struct
+{
+  float settling_time;
+  float overshoot;
+  float steady_state_error;
+  float iae;
+  float peak_deviation;
+  float peak_current;
+} scenario_limits;
+
+typedef struct
+{
+  const char *name;
+  int32_t mode;        // AUTO_VELOCITY or AUTO_POSITION
+  int32_t profile;
+  float setpoint;      // RPM or degrees
+  float freq;          // Reversals per second
+  float duration;      // s
+  float load;          // Plant load over [load_start, load_end), positive opposes clockwise
+  float load_start;
+  float load_end;
+  float jitter_us;     // Encoder edge time noise
+  float noise_mv;      // Current sensor noise
+  bool calibrate;      // Runs the friction calibration first
+  scenario_limits limits;
+} scenario;
+
+extern const scenario SCENARIOS[];
+extern const uint8_t SCENARIO_COUNT;
+
+typedef struct
+{
+  float start; // s since the reference started
+  float end;
+  float target;
+  bool disturbance; // Starts at a load change rather than a reversal
+  float metrics[METRIC_PEAK_CURRENT + 1];
+} segment_result;
+
+// Sent back from the scenario's process through a pipe, small enough to be written at once
+typedef struct
+{
+  bool completed;
+  uint8_t segment_count;
+  segment_result segments[MAX_SEGMENTS];
+  float metrics[METRIC_COUNT];
+  float wall_time;
+} scenario_result;
+
+static_assert(sizeof(scenario_result) <= PIPE_BUF, "Scenario result exceeds an atomic pipe write");
+
+// What the scenario runs on, nullptr for the defaults
+typedef struct
+{
+  const plant_model *model;        // MotorPlant's own without
+  const controller_tuning *tuning; // Saved to NVS and loaded as the board loads it, the compiled gains without
+} scenario_setup;
+
+// Directories the scenarios write to, nullptr for none
+typedef struct
+{
+  const char *trace_directory;
+  const char *record_directory; // The recorder's log of each scenario, for dtmc_replay
+} scenario_output;
+
+// Runs in the scenario's own process
+void run_scenario(const scenario &test, const scenario_setup &setup, const scenario_output &output,
+                  scenario_result *result);
+
+float metric_limit(const scenario &test, uint8_t metric);
+bool metric_passed(float value, float limit);
+bool scenario_passed(const scenario &test, const scenario_result &result);
+
+// Forks a process per job, at most jobs at a time. run fills in the job's result in its process,
+// finished is called with it in this one as each job ends, zeroed if the job crashed.
+typedef void (*scenario_job)(size_t job, scenario_result *result, void *context);
+typedef void (*scenario_job_finished)(size_t job, const scenario_result &result, void *context);
+
+void run_scenario_jobs(size_t count, uint32_t jobs, scenario_job run, scenario_job_finished finished, void *context,
+                       scenario_result *results);
+
+#endif // SCENARIOS_H_
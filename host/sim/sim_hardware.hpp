@@ -0,0 +1,50 @@
+#ifndef SIM_HARDWARE_H_
+#define SIM_HARDWARE_H_
+
+// Includes
+#include <stdint.h>
+#include <stdio.h>
+
+#include "driver/gpio.h"
+#include "hal/adc_types.h"
+
+// The board side of the simulated peripherals, for plant models. A plant is wired to the firmware
+// by the same pins as on the board: it reads the H-bridge inputs and the PWM duty on the enable
+// pin, reports encoder steps on the pin its pulse counter's channels count edges on, and sets the
+// voltage of its current sensor's ADC channel. A replay sets the recorded counts, watch point
+// events and conversions instead.
+
+// Level written by gpio_set_level(), 0 for pins never written
+int sim_gpio_level(gpio_num_t gpio);
+
+// Duty in [0, 1] of the MCPWM generator on the pin, 0 if there is none or its timer is stopped,
+// or the level the generator is forced to
+float sim_pwm_duty(gpio_num_t gpio);
+
+// One quadrature step, +1 counting up, at a time within the device's current slice. Every enabled
+// unit with a channel on the pin counts it and calls its watch point handler.
+void sim_encoder_step(gpio_num_t gpio, int32_t step, uint64_t time);
+
+// Watch point handler of the unit counting the pin, without counting, and the count it reports
+void sim_encoder_watch(gpio_num_t gpio, int32_t watch_point, uint64_t time);
+void sim_encoder_set_count(gpio_num_t gpio, int32_t count);
+
+// Voltage the channel converts until the next call, with uniform noise of up to noise_mv per
+// conversion from the seeded generator. Once the firmware registers a conversion done callback
+// the conversions of a slice are made after the devices registered before the ADC, plants and
+// replays are initialised before their controllers for that.
+void sim_adc_set_voltage(adc_channel_t channel, float millivolts);
+void sim_adc_set_noise(adc_channel_t channel, float noise_mv, uint32_t seed);
+
+// Code the channel converts until the next call, exactly, and the voltage its calibration gives
+// for that code from then on
+void sim_adc_set_code(adc_channel_t channel, uint16_t code, int millivolts);
+
+// Code a voltage converts to without noise
+uint16_t sim_adc_code(float millivolts);
+
+// Bytes written to the UARTs, and a file to copy them to, nullptr for none
+uint64_t sim_uart_bytes();
+void sim_uart_set_output(FILE *file);
+
+#endif // SIM_HARDWARE_H_
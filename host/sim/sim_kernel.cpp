@@ -0,0 +1,516 @@
+// Includes
+#include "sim_kernel.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+#include <string>
+#include <vector>
+
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+static constexpr uint32_t STACK_SIZE = 256 * 1024; // Host code in the tasks needs more than the device's
+static constexpr uint64_t US_PER_TICK = 1000000 / configTICK_RATE_HZ;
+static constexpr uint64_t NEVER = UINT64_MAX;
+
+enum SimTaskState : uint8_t
+{
+  TASK_READY = 0,
+  TASK_DELAYED = 1,
+  TASK_BLOCKED = 2,   // On a semaphore or event group, with a timeout unless wake_time is NEVER
+  TASK_SUSPENDED = 3,
+  TASK_DELETED = 4,   // Returned from its function
+};
+
+struct sim_task
+{
+  std::string name;
+  TaskFunction_t function;
+  void *parameters;
+  UBaseType_t priority;
+
+  SimTaskState state;
+  uint64_t wake_time;
+  uint64_t order; // When it became ready or started waiting, ties between priorities go first come
+  sim_semaphore *waiting;
+  sim_event_group *waiting_group;
+  EventBits_t wait_bits;
+  bool wait_all;
+  bool taken;
+
+  ucontext_t context;
+  std::vector<uint8_t> stack;
+
+  uint64_t slices;
+  uint64_t cpu_ns;
+  uint64_t max_ns;
+};
+
+struct sim_semaphore
+{
+  UBaseType_t count;
+  UBaseType_t max_count;
+};
+
+typedef struct
+{
+  sim_advance_callback advance;
+  void *context;
+} sim_device;
+
+static std::vector<sim_task *> tasks; // In creation order
+static std::vector<sim_device> devices;
+static sim_task *current = nullptr;   // nullptr outside the tasks
+static ucontext_t scheduler_context;
+static uint64_t now = 0;
+static uint64_t order = 0;
+
+static uint64_t cpu_time_ns()
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void fail(const char *message)
+{
+  fprintf(stderr, "Simulation error at %llu us: %s\n", (unsigned long long)now, message);
+  abort();
+}
+
+static void make_ready(sim_task *task)
+{
+  task->state = TASK_READY;
+  task->wake_time = NEVER;
+  task->order = order++;
+}
+
+// Back to the scheduler, returns when the task next runs
+static void yield()
+{
+  swapcontext(&current->context, &scheduler_context);
+}
+
+static void task_entry()
+{
+  sim_task *task = current;
+
+  task->function(task->parameters);
+
+  // FreeRTOS tasks never return, one that does is simply not run again
+  task->state = TASK_DELETED;
+  yield();
+}
+
+static void run_task(sim_task *task)
+{
+  uint64_t start = cpu_time_ns();
+
+  current = task;
+  swapcontext(&scheduler_context, &task->context);
+  current = nullptr;
+
+  uint64_t elapsed = cpu_time_ns() - start;
+  task->slices++;
+  task->cpu_ns += elapsed;
+  if (elapsed > task->max_ns)
+    task->max_ns = elapsed;
+}
+
+// Tasks whose delay or timeout has passed, in the order of their wake times
+static void wake_due()
+{
+  while (true)
+  {
+    sim_task *first = nullptr;
+
+    for (sim_task *task : tasks)
+    {
+      if ((task->state == TASK_DELAYED || task->state == TASK_BLOCKED) && task->wake_time <= now &&
+          (first == nullptr || task->wake_time < first->wake_time))
+        first = task;
+    }
+    if (first == nullptr)
+      return;
+
+    if (first->state == TASK_BLOCKED)
+    {
+      first->waiting = nullptr;
+      first->waiting_group = nullptr;
+      first->taken = false;
+    }
+    make_ready(first);
+  }
+}
+
+static sim_task *next_ready()
+{
+  sim_task *next = nullptr;
+
+  for (sim_task *task : tasks)
+  {
+    if (task->state == TASK_READY &&
+        (next == nullptr || task->priority > next->priority || (task->priority == next->priority && task->order < next->order)))
+      next = task;
+  }
+
+  return next;
+}
+
+static uint64_t next_wake()
+{
+  uint64_t next = NEVER;
+
+  for (sim_task *task : tasks)
+  {
+    if ((task->state == TASK_DELAYED || task->state == TASK_BLOCKED) && task->wake_time < next)
+      next = task->wake_time;
+  }
+
+  return next;
+}
+
+// Steps every device through each slice from the slice's start, so interrupts of different
+// devices keep their own times
+static void advance(uint64_t time)
+{
+  while (now < time)
+  {
+    uint64_t from = now;
+    uint64_t to = time - now > SIM_SLICE_US ? now + SIM_SLICE_US : time;
+
+    for (const sim_device &device : devices)
+    {
+      now = from;
+      device.advance(device.context, from, to);
+    }
+    now = to;
+  }
+}
+
+static uint64_t tick_wake_time(TickType_t ticks)
+{
+  return (now / US_PER_TICK + ticks) * US_PER_TICK;
+}
+
+void sim_add_device(sim_advance_callback advance, void *context)
+{
+  devices.push_back({advance, context});
+}
+
+void sim_run_until(uint64_t time)
+{
+  if (current != nullptr)
+    fail("sim_run_until() called from a task.");
+
+  while (true)
+  {
+    wake_due();
+
+    sim_task *task = next_ready();
+    if (task != nullptr)
+    {
+      run_task(task);
+      continue;
+    }
+
+    if (now >= time)
+      return;
+
+    uint64_t wake = next_wake();
+    advance(wake < time ? wake : time);
+  }
+}
+
+void sim_run_for(uint64_t duration)
+{
+  sim_run_until(now + duration);
+}
+
+uint64_t sim_time()
+{
+  return now;
+}
+
+// For devices inside their advance callback, before calling an interrupt handler
+void sim_set_time(uint64_t time)
+{
+  now = time;
+}
+
+bool sim_get_task_stats(const char *name, sim_task_stats *stats)
+{
+  *stats = {0, 0, 0, 0};
+
+  for (sim_task *task : tasks)
+  {
+    if (task->name != name)
+      continue;
+
+    stats->tasks++;
+    stats->slices += task->slices;
+    stats->cpu_ns += task->cpu_ns;
+    if (task->max_ns > stats->max_ns)
+      stats->max_ns = task->max_ns;
+  }
+
+  return stats->tasks > 0;
+}
+
+void sim_reset_task_stats()
+{
+  for (sim_task *task : tasks)
+  {
+    task->slices = 0;
+    task->cpu_ns = 0;
+    task->max_ns = 0;
+  }
+}
+
+// FreeRTOS and esp_timer on the virtual clock
+
+extern "C" BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth,
+                                              void *parameters, UBaseType_t priority, TaskHandle_t *created, BaseType_t core)
+{
+  sim_task *task = new sim_task();
+
+  task->name = name;
+  task->function = function;
+  task->parameters = parameters;
+  task->priority = priority;
+  task->waiting = nullptr;
+  task->waiting_group = nullptr;
+  task->taken = false;
+  task->stack.resize(STACK_SIZE);
+  task->slices = 0;
+  task->cpu_ns = 0;
+  task->max_ns = 0;
+
+  getcontext(&task->context);
+  task->context.uc_stack.ss_sp = task->stack.data();
+  task->context.uc_stack.ss_size = task->stack.size();
+  task->context.uc_link = &scheduler_context;
+  makecontext(&task->context, task_entry, 0);
+
+  make_ready(task);
+  tasks.push_back(task);
+
+  if (created != nullptr)
+    *created = task;
+  return pdPASS;
+}
+
+extern "C" void vTaskDelete(TaskHandle_t handle)
+{
+  sim_task *task = handle != nullptr ? handle : current;
+
+  if (task == nullptr)
+    fail("vTaskDelete(NULL) outside a task.");
+
+  task->state = TASK_DELETED;
+  task->waiting = nullptr;
+  task->waiting_group = nullptr;
+  task->wake_time = NEVER;
+
+  if (task == current)
+    yield();
+}
+
+extern "C" void vTaskSuspend(TaskHandle_t handle)
+{
+  sim_task *task = handle != nullptr ? handle : current;
+
+  if (task == nullptr)
+    fail("vTaskSuspend(NULL) outside a task.");
+
+  task->state = TASK_SUSPENDED;
+  task->waiting = nullptr;
+  task->waiting_group = nullptr;
+  task->taken = false;
+  task->wake_time = NEVER;
+
+  if (task == current)
+    yield();
+}
+
+extern "C" void vTaskResume(TaskHandle_t handle)
+{
+  if (handle != nullptr && handle->state == TASK_SUSPENDED)
+    make_ready(handle);
+}
+
+extern "C" TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+  return current;
+}
+
+extern "C" TickType_t xTaskGetTickCount(void)
+{
+  return (TickType_t)(now / US_PER_TICK);
+}
+
+// Wakes on a tick boundary like the kernel, a delay of 0 only yields
+extern "C" void vTaskDelay(TickType_t ticks)
+{
+  if (current == nullptr)
+  {
+    sim_run_until(tick_wake_time(ticks));
+    return;
+  }
+
+  if (ticks == 0)
+    make_ready(current);
+  else
+  {
+    current->state = TASK_DELAYED;
+    current->wake_time = tick_wake_time(ticks);
+  }
+  yield();
+}
+
+extern "C" int64_t esp_timer_get_time(void)
+{
+  return (int64_t)now;
+}
+
+extern "C" SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+  return new sim_semaphore{1, 1};
+}
+
+extern "C" SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+  return new sim_semaphore{0, 1};
+}
+
+extern "C" BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+  if (semaphore->count > 0)
+  {
+    semaphore->count--;
+    return pdTRUE;
+  }
+  if (ticks == 0)
+    return pdFALSE;
+
+  uint64_t deadline = ticks == portMAX_DELAY ? NEVER : now + ticks * US_PER_TICK;
+
+  // Outside the tasks, run the simulation a tick at a time until a task gives it
+  if (current == nullptr)
+  {
+    while (semaphore->count == 0 && now < deadline)
+      sim_run_until(tick_wake_time(1) < deadline ? tick_wake_time(1) : deadline);
+    if (semaphore->count == 0)
+      return pdFALSE;
+
+    semaphore->count--;
+    return pdTRUE;
+  }
+
+  current->state = TASK_BLOCKED;
+  current->waiting = semaphore;
+  current->taken = false;
+  current->wake_time = deadline;
+  current->order = order++;
+  yield();
+
+  return current->taken ? pdTRUE : pdFALSE;
+}
+
+// Hands the semaphore straight to the highest priority task waiting on it
+extern "C" BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  sim_task *waiter = nullptr;
+
+  for (sim_task *task : tasks)
+  {
+    if (task->state == TASK_BLOCKED && task->waiting == semaphore &&
+        (waiter == nullptr || task->priority > waiter->priority || (task->priority == waiter->priority && task->order < waiter->order)))
+      waiter = task;
+  }
+
+  if (waiter != nullptr)
+  {
+    waiter->waiting = nullptr;
+    waiter->taken = true;
+    make_ready(waiter);
+    return pdTRUE;
+  }
+
+  if (semaphore->count >= semaphore->max_count)
+    return pdFALSE;
+
+  semaphore->count++;
+  return pdTRUE;
+}
+
+static bool bits_set(EventBits_t bits, EventBits_t wait_bits, bool wait_all)
+{
+  return wait_all ? (bits & wait_bits) == wait_bits : (bits & wait_bits) != 0;
+}
+
+extern "C" EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buffer)
+{
+  buffer->uxBits = 0;
+  return buffer;
+}
+
+extern "C" EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, const EventBits_t wait_bits,
+                                           const BaseType_t clear_on_exit, const BaseType_t wait_all, TickType_t ticks)
+{
+  EventBits_t bits = group->uxBits;
+
+  if (!bits_set(bits, wait_bits, wait_all) && ticks != 0)
+  {
+    uint64_t deadline = ticks == portMAX_DELAY ? NEVER : now + ticks * US_PER_TICK;
+
+    // Outside the tasks, run the simulation a tick at a time until a task sets them
+    if (current == nullptr)
+    {
+      while (!bits_set(group->uxBits, wait_bits, wait_all) && now < deadline)
+        sim_run_until(tick_wake_time(1) < deadline ? tick_wake_time(1) : deadline);
+    }
+    else
+    {
+      current->state = TASK_BLOCKED;
+      current->waiting_group = group;
+      current->wait_bits = wait_bits;
+      current->wait_all = wait_all;
+      current->wake_time = deadline;
+      current->order = order++;
+      yield();
+    }
+    bits = group->uxBits;
+  }
+
+  if (clear_on_exit && bits_set(bits, wait_bits, wait_all))
+    group->uxBits &= ~wait_bits;
+  return bits;
+}
+
+// Readies every task whose wait the new bits satisfy
+extern "C" EventBits_t xEventGroupSetBits(EventGroupHandle_t group, const EventBits_t set_bits)
+{
+  group->uxBits |= set_bits;
+
+  for (sim_task *task : tasks)
+  {
+    if (task->state == TASK_BLOCKED && task->waiting_group == group &&
+        bits_set(group->uxBits, task->wait_bits, task->wait_all))
+    {
+      task->waiting_group = nullptr;
+      make_ready(task);
+    }
+  }
+
+  return group->uxBits;
+}
+
+extern "C" EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+  return group->uxBits;
+}
@@ -0,0 +1,43 @@
+#ifndef SIM_KERNEL_H_
+#define SIM_KERNEL_H_
+
+// Includes
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Deterministic FreeRTOS for the control simulator. Tasks are coroutines that run one at a time
+// on a virtual clock in us, so a scenario repeats exactly and runs as fast as the host allows.
+// A task runs in zero virtual time until it delays, blocks or suspends itself, then the highest
+// priority task that is ready goes next, in the order they became ready. Between tasks the clock
+// advances to the next wake-up in slices of at most SIM_SLICE_US, and each device registered with
+// sim_add_device() steps its model through every slice, calling interrupt handlers at the times
+// they happen with sim_set_time().
+//
+// The caller of sim_run_until() is the scheduler. Kernel calls made outside a task behave like
+// app_main: a delay or a blocking take runs the simulation until it returns.
+
+static constexpr uint32_t SIM_SLICE_US = 50;
+
+typedef void (*sim_advance_callback)(void *context, uint64_t from, uint64_t to);
+
+// Host CPU time spent in the tasks with one name, summed over every task that has it
+typedef struct
+{
+  uint32_t tasks;
+  uint64_t slices;  // Times a task ran until it yielded
+  uint64_t cpu_ns;
+  uint64_t max_ns;  // Longest slice
+} sim_task_stats;
+
+void sim_add_device(sim_advance_callback advance, void *context);
+void sim_run_until(uint64_t time);
+void sim_run_for(uint64_t duration);
+uint64_t sim_time();
+void sim_set_time(uint64_t time);
+
+bool sim_get_task_stats(const char *name, sim_task_stats *stats);
+void sim_reset_task_stats();
+
+#endif // SIM_KERNEL_H_
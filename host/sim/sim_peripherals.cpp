@@ -0,0 +1,759 @@
+// Includes
+#include "sim_hardware.hpp"
+#include "sim_kernel.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "driver/gpio.h"
+#include "driver/mcpwm_prelude.h"
+#include "driver/pulse_cnt.h"
+#include "driver/uart.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+// ESP-IDF peripheral drivers on the virtual clock, as far as the firmware's control code uses them
+
+static constexpr uint16_t ADC_MAX_CODE = (1 << 12) - 1;
+static constexpr float ADC_FULL_SCALE_MV = 1750; // 6 dB attenuation
+static constexpr uint8_t ADC_CHANNEL_COUNT = 10;
+
+struct sim_mcpwm_timer
+{
+  uint32_t period;
+  bool running;
+};
+
+struct sim_mcpwm_oper
+{
+  sim_mcpwm_timer *timer;
+};
+
+struct sim_mcpwm_cmpr
+{
+  sim_mcpwm_oper *oper;
+  uint32_t value;
+};
+
+// Set high when the timer is empty and low on its comparator, the firmware's edge-aligned PWM,
+// unless forced to a level
+struct sim_mcpwm_gen
+{
+  sim_mcpwm_oper *oper;
+  int gpio;
+  bool high_on_empty;
+  sim_mcpwm_cmpr *low_on_compare;
+  int forced; // -1 while not forced
+};
+
+struct sim_pcnt_unit
+{
+  int low_limit;
+  int high_limit;
+  bool accumulate;
+  int count;
+  int accumulated; // Count at the limits reached so far
+  std::vector<int> watch_points;
+  pcnt_watch_cb_t on_reach;
+  void *context;
+  bool enabled;
+  bool started;
+};
+
+struct sim_pcnt_chan
+{
+  sim_pcnt_unit *unit;
+  int edge_gpio;
+  int level_gpio;
+};
+
+struct sim_adc_cali
+{
+  adc_channel_t channel;
+};
+
+struct sim_adc_continuous
+{
+  uint32_t capacity; // Conversions the pool holds
+  std::vector<adc_channel_t> pattern;
+  uint32_t sample_freq;
+  bool started;
+  uint64_t start_time;
+  uint64_t produced; // Conversions since start
+  std::deque<uint32_t> pool;
+
+  uint32_t frame_size; // Conversions per frame
+  std::vector<uint32_t> frame;
+  adc_continuous_callback_t on_conv_done;
+  void *context;
+};
+
+typedef struct
+{
+  float voltage;
+  float noise;
+  uint32_t noise_state;
+  bool fixed;               // Converts code as is rather than the voltage
+  uint16_t code;
+  std::vector<int> cali_mv; // Calibration of each code, empty for the linear default
+} sim_adc_channel;
+
+static int gpio_levels[GPIO_NUM_MAX];
+static std::vector<sim_mcpwm_gen *> generators;
+static std::vector<sim_pcnt_chan *> pcnt_channels;
+static std::vector<sim_adc_continuous *> adc_handles;
+static sim_adc_channel adc_channels[ADC_CHANNEL_COUNT];
+static uint64_t uart_bytes = 0;
+static FILE *uart_output = nullptr;
+
+// NVS namespaces, and the namespace and mode of each open handle
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> nvs_namespaces;
+static std::vector<std::pair<std::string, nvs_open_mode_t>> nvs_handles;
+
+extern "C" const char *esp_err_to_name(esp_err_t code)
+{
+  switch (code)
+  {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_NOT_SUPPORTED:
+    return "ESP_ERR_NOT_SUPPORTED";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  case ESP_ERR_NVS_NOT_FOUND:
+    return "ESP_ERR_NVS_NOT_FOUND";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+// GPIO
+
+extern "C" esp_err_t gpio_config(const gpio_config_t *config)
+{
+  return config != nullptr ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+extern "C" esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+  if (gpio < 0 || gpio >= GPIO_NUM_MAX)
+    return ESP_ERR_INVALID_ARG;
+
+  gpio_levels[gpio] = level != 0;
+  return ESP_OK;
+}
+
+extern "C" int gpio_get_level(gpio_num_t gpio)
+{
+  return sim_gpio_level(gpio);
+}
+
+int sim_gpio_level(gpio_num_t gpio)
+{
+  return gpio >= 0 && gpio < GPIO_NUM_MAX ? gpio_levels[gpio] : 0;
+}
+
+// MCPWM
+
+extern "C" esp_err_t mcpwm_new_timer(const mcpwm_timer_config_t *config, mcpwm_timer_handle_t *timer)
+{
+  if (config->period_ticks == 0)
+    return ESP_ERR_INVALID_ARG;
+
+  *timer = new sim_mcpwm_timer{config->period_ticks, false};
+  return ESP_OK;
+}
+
+extern "C" esp_err_t mcpwm_timer_enable(mcpwm_timer_handle_t timer)
+{
+  return ESP_OK;
+}
+
+extern "C" esp_err_t mcpwm_timer_start_stop(mcpwm_timer_handle_t timer, mcpwm_timer_start_stop_cmd_t command)
+{
+  timer->running = command == MCPWM_TIMER_START_NO_STOP;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t mcpwm_new_operator(const mcpwm_operator_config_t *config, mcpwm_oper_handle_t *oper)
+{
+  *oper = new sim_mcpwm_oper{nullptr};
+  return ESP_OK;
+}
+
+extern "C" esp_err_t mcpwm_operator_connect_timer(mcpwm_oper_handle_t oper, mcpwm_timer_handle_t timer)
+{
+  oper->timer = timer;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t mcpwm_new_comparator(mcpwm_oper_handle_t oper, const mcpwm_comparator_config_t *config,
+                                          mcpwm_cmpr_handle_t *cmpr)
+{
+  *cmpr = new sim_mcpwm_cmpr{oper, 0};
+  return ESP_OK;
+}
+
+extern "C" esp_err_t mcpwm_comparator_set_compare_value(mcpwm_cmpr_handle_t cmpr, uint32_t ticks)
+{
+  if (cmpr->oper->timer != nullptr && ticks > cmpr->oper->timer->period)
+    return ESP_ERR_INVALID_ARG;
+
+  cmpr->value = ticks;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t mcpwm_new_generator(mcpwm_oper_handle_t oper, const mcpwm_generator_config_t *config,
+                                         mcpwm_gen_handle_t *gen)
+{
+  *gen = new sim_mcpwm_gen{oper, config->gen_gpio_num, false, nullptr, -1};
+  generators.push_back(*gen);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t mcpwm_generator_set_action_on_timer_event(mcpwm_gen_handle_t gen, mcpwm_gen_timer_event_action_t action)
+{
+  if (action.event == MCPWM_TIMER_EVENT_EMPTY)
+    gen->high_on_empty = action.action == MCPWM_GEN_ACTION_HIGH;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t mcpwm_generator_set_action_on_compare_event(mcpwm_gen_handle_t gen, mcpwm_gen_compare_event_action_t action)
+{
+  gen->low_on_compare = action.action == MCPWM_GEN_ACTION_LOW ? action.comparator : nullptr;
+  return ESP_OK;
+}
+
+// The level holds until released with -1, whether or not the timer runs
+extern "C" esp_err_t mcpwm_generator_set_force_level(mcpwm_gen_handle_t gen, int level, bool hold_on)
+{
+  if (level < -1 || level > 1)
+    return ESP_ERR_INVALID_ARG;
+
+  gen->forced = level;
+  return ESP_OK;
+}
+
+float sim_pwm_duty(gpio_num_t gpio)
+{
+  for (sim_mcpwm_gen *gen : generators)
+  {
+    sim_mcpwm_timer *timer = gen->oper->timer;
+
+    if (gen->gpio == gpio && gen->forced >= 0)
+      return gen->forced;
+    if (gen->gpio != gpio || timer == nullptr || !timer->running || !gen->high_on_empty || gen->low_on_compare == nullptr)
+      continue;
+
+    return (float)gen->low_on_compare->value / timer->period;
+  }
+
+  return 0;
+}
+
+// Pulse counter
+
+extern "C" esp_err_t pcnt_new_unit(const pcnt_unit_config_t *config, pcnt_unit_handle_t *unit)
+{
+  if (config->low_limit >= 0 || config->high_limit <= 0)
+    return ESP_ERR_INVALID_ARG;
+
+  sim_pcnt_unit *created = new sim_pcnt_unit();
+  created->low_limit = config->low_limit;
+  created->high_limit = config->high_limit;
+  created->accumulate = config->flags.accum_count;
+  created->count = 0;
+  created->accumulated = 0;
+  created->on_reach = nullptr;
+  created->context = nullptr;
+  created->enabled = false;
+  created->started = false;
+
+  *unit = created;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t pcnt_unit_set_glitch_filter(pcnt_unit_handle_t unit, const pcnt_glitch_filter_config_t *config)
+{
+  return ESP_OK;
+}
+
+extern "C" esp_err_t pcnt_new_channel(pcnt_unit_handle_t unit, const pcnt_chan_config_t *config, pcnt_channel_handle_t *chan)
+{
+  *chan = new sim_pcnt_chan{unit, config->edge_gpio_num, config->level_gpio_num};
+  pcnt_channels.push_back(*chan);
+  return ESP_OK;
+}
+
+// The plant reports quadrature steps directly, the channels' actions are the firmware's decoding of them
+extern "C" esp_err_t pcnt_channel_set_edge_action(pcnt_channel_handle_t chan, pcnt_channel_edge_action_t pos_act,
+                                                  pcnt_channel_edge_action_t neg_act)
+{
+  return ESP_OK;
+}
+
+extern "C" esp_err_t pcnt_channel_set_level_action(pcnt_channel_handle_t chan, pcnt_channel_level_action_t high_act,
+                                                   pcnt_channel_level_action_t low_act)
+{
+  return ESP_OK;
+}
+
+extern "C" esp_err_t pcnt_unit_add_watch_point(pcnt_unit_handle_t unit, int watch_point)
+{
+  if (watch_point < unit->low_limit || watch_point > unit->high_limit)
+    return ESP_ERR_INVALID_ARG;
+
+  unit->watch_points.push_back(watch_point);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t pcnt_unit_register_event_callbacks(pcnt_unit_handle_t unit, const pcnt_event_callbacks_t *cbs, void *user_data)
+{
+  unit->on_reach = cbs->on_reach;
+  unit->context = user_data;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t pcnt_unit_enable(pcnt_unit_handle_t unit)
+{
+  unit->enabled = true;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t pcnt_unit_clear_count(pcnt_unit_handle_t unit)
+{
+  unit->count = 0;
+  unit->accumulated = 0;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t pcnt_unit_start(pcnt_unit_handle_t unit)
+{
+  if (!unit->enabled)
+    return ESP_ERR_INVALID_STATE;
+
+  unit->started = true;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t pcnt_unit_get_count(pcnt_unit_handle_t unit, int *value)
+{
+  *value = unit->accumulate ? unit->accumulated + unit->count : unit->count;
+  return ESP_OK;
+}
+
+static void encoder_reach(sim_pcnt_unit *unit, int watch_point, uint64_t time)
+{
+  pcnt_watch_event_data_t event = {
+      .watch_point_value = watch_point,
+      .zero_cross_mode = PCNT_UNIT_ZERO_CROSS_POS_ZERO,
+  };
+  sim_set_time(time);
+  unit->on_reach(unit, &event, unit->context);
+}
+
+void sim_encoder_step(gpio_num_t gpio, int32_t step, uint64_t time)
+{
+  std::vector<sim_pcnt_unit *> counted;
+
+  for (sim_pcnt_chan *chan : pcnt_channels)
+  {
+    sim_pcnt_unit *unit = chan->unit;
+
+    if (chan->edge_gpio != gpio || !unit->started)
+      continue;
+
+    // A unit with both channels on the encoder counts each step once
+    bool seen = false;
+    for (sim_pcnt_unit *other : counted)
+      seen = seen || other == unit;
+    if (seen)
+      continue;
+    counted.push_back(unit);
+
+    unit->count += step;
+
+    for (int watch_point : unit->watch_points)
+    {
+      if (watch_point == unit->count && unit->on_reach != nullptr)
+        encoder_reach(unit, watch_point, time);
+    }
+
+    // The hardware count restarts from zero at either limit
+    if (unit->count >= unit->high_limit || unit->count <= unit->low_limit)
+    {
+      unit->accumulated += unit->count;
+      unit->count = 0;
+    }
+  }
+}
+
+static sim_pcnt_unit *encoder_unit(gpio_num_t gpio)
+{
+  for (sim_pcnt_chan *chan : pcnt_channels)
+  {
+    if (chan->edge_gpio == gpio && chan->unit->started)
+      return chan->unit;
+  }
+
+  return nullptr;
+}
+
+void sim_encoder_watch(gpio_num_t gpio, int32_t watch_point, uint64_t time)
+{
+  sim_pcnt_unit *unit = encoder_unit(gpio);
+
+  if (unit != nullptr && unit->on_reach != nullptr)
+    encoder_reach(unit, watch_point, time);
+}
+
+void sim_encoder_set_count(gpio_num_t gpio, int32_t count)
+{
+  sim_pcnt_unit *unit = encoder_unit(gpio);
+
+  if (unit == nullptr)
+    return;
+
+  unit->count = count;
+  unit->accumulated = 0;
+}
+
+// ADC
+
+extern "C" esp_err_t adc_cali_create_scheme_curve_fitting(const adc_cali_curve_fitting_config_t *config, adc_cali_handle_t *handle)
+{
+  *handle = new sim_adc_cali{config->chan};
+  return ESP_OK;
+}
+
+extern "C" esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t handle, int raw, int *voltage)
+{
+  if (raw < 0 || raw > ADC_MAX_CODE)
+    return ESP_ERR_INVALID_ARG;
+
+  const std::vector<int> &cali_mv = adc_channels[handle->channel].cali_mv;
+  *voltage = cali_mv.empty() ? (int)lroundf(raw * ADC_FULL_SCALE_MV / ADC_MAX_CODE) : cali_mv[raw];
+  return ESP_OK;
+}
+
+extern "C" esp_err_t adc_continuous_new_handle(const adc_continuous_handle_cfg_t *config, adc_continuous_handle_t *handle)
+{
+  sim_adc_continuous *created = new sim_adc_continuous();
+  created->capacity = config->max_store_buf_size / sizeof(adc_digi_output_data_t);
+  created->sample_freq = 0;
+  created->started = false;
+  created->start_time = 0;
+  created->produced = 0;
+  created->frame_size = config->conv_frame_size / sizeof(adc_digi_output_data_t);
+  created->on_conv_done = nullptr;
+  created->context = nullptr;
+
+  adc_handles.push_back(created);
+  *handle = created;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t adc_continuous_config(adc_continuous_handle_t handle, const adc_continuous_config_t *config)
+{
+  if (handle->started || config->pattern_num == 0)
+    return ESP_ERR_INVALID_STATE;
+
+  handle->pattern.clear();
+  for (uint32_t i = 0; i < config->pattern_num; i++)
+    handle->pattern.push_back((adc_channel_t)config->adc_pattern[i].channel);
+  handle->sample_freq = config->sample_freq_hz;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t adc_continuous_start(adc_continuous_handle_t handle)
+{
+  if (handle->started || handle->pattern.empty())
+    return ESP_ERR_INVALID_STATE;
+
+  handle->started = true;
+  handle->start_time = sim_time();
+  handle->produced = 0;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t adc_continuous_stop(adc_continuous_handle_t handle)
+{
+  if (!handle->started)
+    return ESP_ERR_INVALID_STATE;
+
+  handle->started = false;
+  handle->pool.clear();
+  handle->frame.clear();
+  return ESP_OK;
+}
+
+static uint16_t adc_convert(adc_channel_t channel)
+{
+  sim_adc_channel &input = adc_channels[channel];
+  float millivolts = input.voltage;
+
+  if (input.fixed)
+    return input.code;
+
+  if (input.noise > 0)
+  {
+    input.noise_state = input.noise_state * 1664525u + 1013904223u;
+    millivolts += input.noise * ((float)(input.noise_state >> 8) / (1 << 23) - 1);
+  }
+
+  return sim_adc_code(millivolts);
+}
+
+uint16_t sim_adc_code(float millivolts)
+{
+  float code = roundf(millivolts * ADC_MAX_CODE / ADC_FULL_SCALE_MV);
+  return (uint16_t)fminf(fmaxf(code, 0), ADC_MAX_CODE);
+}
+
+// Conversions due by the time, from the voltage when they are made. Without a conversion done
+// callback they are made when read, the ADC task reads every tick. With one a device makes them
+// every slice after the plants registered before it have set the slice's voltages, and calls
+// the callback at the time each frame completes.
+static void adc_produce(sim_adc_continuous *handle, uint64_t time)
+{
+  if (!handle->started)
+    return;
+
+  uint64_t due = (time - handle->start_time) * handle->sample_freq / 1000000;
+
+  for (; handle->produced < due; handle->produced++)
+  {
+    adc_channel_t channel = handle->pattern[handle->produced % handle->pattern.size()];
+    adc_digi_output_data_t conversion = {};
+
+    conversion.type2.data = adc_convert(channel);
+    conversion.type2.channel = channel;
+    handle->pool.push_back(conversion.val);
+    if (handle->pool.size() > handle->capacity)
+      handle->pool.pop_front();
+
+    if (handle->on_conv_done == nullptr || handle->frame_size == 0)
+      continue;
+
+    handle->frame.push_back(conversion.val);
+    if (handle->frame.size() < handle->frame_size)
+      continue;
+
+    // At the time the frame's last conversion is due
+    adc_continuous_evt_data_t event = {
+        .conv_frame_buffer = (uint8_t *)handle->frame.data(),
+        .size = (uint32_t)(handle->frame.size() * sizeof(uint32_t)),
+    };
+    sim_set_time(handle->start_time + ((handle->produced + 1) * 1000000 + handle->sample_freq - 1) / handle->sample_freq);
+    handle->on_conv_done(handle, &event, handle->context);
+    handle->frame.clear();
+  }
+}
+
+static void adc_advance(void *context, uint64_t from, uint64_t to)
+{
+  adc_produce(static_cast<sim_adc_continuous *>(context), to);
+}
+
+extern "C" esp_err_t adc_continuous_register_event_callbacks(adc_continuous_handle_t handle, const adc_continuous_evt_cbs_t *cbs,
+                                                            void *user_data)
+{
+  if (handle->started)
+    return ESP_ERR_INVALID_STATE;
+
+  if (handle->on_conv_done == nullptr && cbs->on_conv_done != nullptr)
+    sim_add_device(adc_advance, handle);
+  handle->on_conv_done = cbs->on_conv_done;
+  handle->context = user_data;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t adc_continuous_read(adc_continuous_handle_t handle, uint8_t *buf, uint32_t length_max,
+                                         uint32_t *out_length, uint32_t timeout_ms)
+{
+  uint32_t count = length_max / sizeof(adc_digi_output_data_t);
+
+  adc_produce(handle, sim_time());
+  for (uint32_t waited = 0; handle->pool.empty() && waited < timeout_ms; waited++)
+  {
+    vTaskDelay(1);
+    adc_produce(handle, sim_time());
+  }
+
+  *out_length = 0;
+  if (handle->pool.empty())
+    return ESP_ERR_TIMEOUT;
+
+  for (uint32_t i = 0; i < count && !handle->pool.empty(); i++)
+  {
+    uint32_t conversion = handle->pool.front();
+    handle->pool.pop_front();
+    memcpy(buf + *out_length, &conversion, sizeof(conversion));
+    *out_length += sizeof(conversion);
+  }
+
+  return ESP_OK;
+}
+
+void sim_adc_set_voltage(adc_channel_t channel, float millivolts)
+{
+  adc_channels[channel].voltage = millivolts;
+  adc_channels[channel].fixed = false;
+}
+
+void sim_adc_set_code(adc_channel_t channel, uint16_t code, int millivolts)
+{
+  sim_adc_channel &input = adc_channels[channel];
+
+  if (input.cali_mv.empty())
+  {
+    input.cali_mv.resize(ADC_MAX_CODE + 1);
+    for (uint16_t i = 0; i <= ADC_MAX_CODE; i++)
+      input.cali_mv[i] = (int)lroundf(i * ADC_FULL_SCALE_MV / ADC_MAX_CODE);
+  }
+
+  input.fixed = true;
+  input.code = code;
+  input.cali_mv[code] = millivolts;
+}
+
+void sim_adc_set_noise(adc_channel_t channel, float noise_mv, uint32_t seed)
+{
+  adc_channels[channel].noise = noise_mv;
+  adc_channels[channel].noise_state = seed * 2654435761u + 1;
+}
+
+// UART
+
+extern "C" esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t *uart_config)
+{
+  return ESP_OK;
+}
+
+extern "C" esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size,
+                                         QueueHandle_t *uart_queue, int intr_alloc_flags)
+{
+  return ESP_OK;
+}
+
+extern "C" esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num)
+{
+  return ESP_OK;
+}
+
+extern "C" int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size)
+{
+  uart_bytes += size;
+  if (uart_output != nullptr)
+    fwrite(src, 1, size, uart_output);
+  return (int)size;
+}
+
+void sim_uart_set_output(FILE *file)
+{
+  uart_output = file;
+}
+
+uint64_t sim_uart_bytes()
+{
+  return uart_bytes;
+}
+
+// NVS
+
+extern "C" esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *handle)
+{
+  if (open_mode == NVS_READONLY && nvs_namespaces.find(name) == nvs_namespaces.end())
+    return ESP_ERR_NVS_NOT_FOUND;
+
+  nvs_namespaces[name];
+  nvs_handles.push_back({name, open_mode});
+  *handle = nvs_handles.size();
+  return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+  auto &blobs = nvs_namespaces[nvs_handles[handle - 1].first];
+  auto blob = blobs.find(key);
+
+  if (blob == blobs.end())
+    return ESP_ERR_NVS_NOT_FOUND;
+  if (out_value == nullptr)
+  {
+    *length = blob->second.size();
+    return ESP_OK;
+  }
+  if (*length < blob->second.size())
+    return ESP_ERR_INVALID_SIZE;
+
+  memcpy(out_value, blob->second.data(), blob->second.size());
+  *length = blob->second.size();
+  return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+  if (nvs_handles[handle - 1].second != NVS_READWRITE)
+    return ESP_ERR_INVALID_STATE;
+
+  const uint8_t *bytes = static_cast<const uint8_t *>(value);
+  nvs_namespaces[nvs_handles[handle - 1].first][key].assign(bytes, bytes + length);
+  return ESP_OK;
+}
+
+// Strings are kept as blobs with their terminator, as NVS returns them
+extern "C" esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+  return nvs_get_blob(handle, key, out_value, length);
+}
+
+extern "C" esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+  return nvs_set_blob(handle, key, value, strlen(value) + 1);
+}
+
+extern "C" esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+  if (nvs_handles[handle - 1].second != NVS_READWRITE)
+    return ESP_ERR_INVALID_STATE;
+
+  return nvs_namespaces[nvs_handles[handle - 1].first].erase(key) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+extern "C" esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+  if (nvs_handles[handle - 1].second != NVS_READWRITE)
+    return ESP_ERR_INVALID_STATE;
+
+  nvs_namespaces[nvs_handles[handle - 1].first].clear();
+  return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_commit(nvs_handle_t handle)
+{
+  return ESP_OK;
+}
+
+extern "C" void nvs_close(nvs_handle_t handle)
+{
+}
@@ -0,0 +1,142 @@
+// Includes
+#include <stdio.h>
+
+#include "check.hpp"
+#include "motor_controller.hpp"
+#include "motor_plant.hpp"
+#include "sim_kernel.hpp"
+#include "startup.h"
+
+// Time to first control and to first telemetry on the simulator's clock. The firmware's startup
+// orchestrator brings the boot up as app_main does: every motor's controller, with its current
+// sensor zeroed from a DMA burst, then the network stages in their own tasks on their dependencies,
+// with the calibration loaded from NVS once storage is up. The network has no simulator, its
+// stages take the assumed times below, so time to first telemetry is those times on the critical
+// path plus the wait for the next frame of the real format task. The sequential boot it replaced
+// is computed from the same stage times and its own costs: 1000 samples 1 ms apart to zero each
+// sensor, SNTP polled once a second and a fixed delay before provisioning.
+
+static constexpr uint64_t STORAGE_US = 30000;     // NVS, netif and event loop
+static constexpr uint64_t WIFI_US = 2500000;      // Association and DHCP
+static constexpr uint64_t SNTP_US = 300000;       // First synchronization once there is an address
+static constexpr uint64_t DPS_US = 2500000;       // TLS, registration and the polls for its result
+static constexpr uint64_t MQTT_US = 1200000;      // TLS, CONNECT and the subscribes
+
+static constexpr uint64_t LEGACY_ZERO_US = 1000 * 1000; // Per sensor
+static constexpr uint64_t LEGACY_SNTP_POLL_US = 1000000;
+static constexpr uint64_t LEGACY_SETTLE_US = 100000;
+
+static constexpr uint64_t MAX_CONTROL_US = 100000;
+static constexpr uint32_t TIMEOUT_MS = 30000;
+
+static MotorController motors[MOTOR_COUNT];
+static MotorPlant plants[MOTOR_COUNT];
+static uint64_t first_frame_us = 0;
+
+// The demo task publishes the first frame queued once it is connected
+static void sample_ready(uint8_t motor)
+{
+  (void)motor;
+  if (first_frame_us == 0)
+    first_frame_us = sim_time();
+  if (startup_wait(STARTUP_BIT(STARTUP_STAGE_MQTT), 0))
+    startup_complete(STARTUP_STAGE_TELEMETRY);
+}
+
+static void initialize_storage()
+{
+  vTaskDelay(pdMS_TO_TICKS(STORAGE_US / 1000));
+  startup_complete(STARTUP_STAGE_STORAGE);
+}
+
+static void initialize_wifi()
+{
+  vTaskDelay(pdMS_TO_TICKS(WIFI_US / 1000));
+  startup_complete(STARTUP_STAGE_WIFI);
+}
+
+// SNTP starts with storage and synchronizes once the station has an address
+static void initialize_time()
+{
+  startup_wait(STARTUP_BIT(STARTUP_STAGE_WIFI), portMAX_DELAY);
+  vTaskDelay(pdMS_TO_TICKS(SNTP_US / 1000));
+  startup_complete(STARTUP_STAGE_TIME);
+}
+
+// The demo task, provisioning and then connecting
+static void connect_hub()
+{
+  vTaskDelay(pdMS_TO_TICKS(DPS_US / 1000));
+  startup_complete(STARTUP_STAGE_PROVISIONING);
+
+  startup_begin(STARTUP_STAGE_MQTT);
+  vTaskDelay(pdMS_TO_TICKS(MQTT_US / 1000));
+  startup_complete(STARTUP_STAGE_MQTT);
+}
+
+static void load_calibration()
+{
+  for (MotorController &motor : motors)
+    motor.load_calibration();
+  startup_complete(STARTUP_STAGE_CALIBRATION);
+}
+
+static void print_stage(const char *name, startup_stage_t stage)
+{
+  printf("  %-13s %6llu ms\n", name, (unsigned long long)(startup_ready_time(stage) / 1000));
+}
+
+int main()
+{
+  startup_init();
+
+  startup_begin(STARTUP_STAGE_CONTROL);
+  for (uint8_t i = 0; i < MOTOR_COUNT; i++)
+  {
+    plants[i].init(i);
+    motors[i].set_sample_callback(sample_ready);
+    motors[i].init(i);
+  }
+  startup_complete(STARTUP_STAGE_CONTROL);
+
+  startup_launch(STARTUP_STAGE_STORAGE, initialize_storage, 0);
+  startup_launch(STARTUP_STAGE_WIFI, initialize_wifi, STARTUP_BIT(STARTUP_STAGE_STORAGE));
+  startup_launch(STARTUP_STAGE_TIME, initialize_time, STARTUP_BIT(STARTUP_STAGE_STORAGE));
+  startup_launch(STARTUP_STAGE_PROVISIONING, connect_hub,
+                 STARTUP_BIT(STARTUP_STAGE_WIFI) | STARTUP_BIT(STARTUP_STAGE_TIME));
+  startup_launch(STARTUP_STAGE_CALIBRATION, load_calibration, STARTUP_BIT(STARTUP_STAGE_STORAGE));
+
+  bool telemetry = startup_wait(STARTUP_BIT(STARTUP_STAGE_TELEMETRY), pdMS_TO_TICKS(TIMEOUT_MS));
+
+  uint64_t control_us = startup_ready_time(STARTUP_STAGE_CONTROL);
+  uint64_t mqtt_us = startup_ready_time(STARTUP_STAGE_MQTT);
+  uint64_t telemetry_us = startup_ready_time(STARTUP_STAGE_TELEMETRY);
+  uint64_t frame_us = (uint64_t)SAMPLE_VECTOR_SIZE * update_config.delay * 1000;
+  uint64_t legacy_us = MOTOR_COUNT * LEGACY_ZERO_US + control_us + STORAGE_US + WIFI_US +
+                       (SNTP_US + LEGACY_SNTP_POLL_US - 1) / LEGACY_SNTP_POLL_US * LEGACY_SNTP_POLL_US +
+                       LEGACY_SETTLE_US + DPS_US + MQTT_US;
+
+  printf("Ready after boot:\n");
+  print_stage("control", STARTUP_STAGE_CONTROL);
+  print_stage("calibration", STARTUP_STAGE_CALIBRATION);
+  print_stage("wifi", STARTUP_STAGE_WIFI);
+  print_stage("time", STARTUP_STAGE_TIME);
+  print_stage("provisioning", STARTUP_STAGE_PROVISIONING);
+  print_stage("mqtt", STARTUP_STAGE_MQTT);
+  print_stage("telemetry", STARTUP_STAGE_TELEMETRY);
+  printf("First frame formatted at %llu ms, sequential boot connected at %llu ms\n",
+         (unsigned long long)(first_frame_us / 1000), (unsigned long long)(legacy_us / 1000));
+
+  check(telemetry, "the first frame is published");
+  check(control_us <= MAX_CONTROL_US, "control is up within 100 ms of boot");
+  check(control_us < (uint64_t)startup_ready_time(STARTUP_STAGE_STORAGE), "control does not wait on any network stage");
+  check(startup_ready_time(STARTUP_STAGE_CALIBRATION) < startup_ready_time(STARTUP_STAGE_WIFI),
+        "the calibration is loaded without waiting on Wi-Fi");
+  check(mqtt_us <= control_us + STORAGE_US + WIFI_US + SNTP_US + DPS_US + MQTT_US + 5000,
+        "the hub is connected after the network's critical path, without extra delays");
+  check(telemetry_us >= mqtt_us && telemetry_us <= mqtt_us + frame_us,
+        "the first telemetry follows the connection within a frame");
+  check(telemetry_us < legacy_us, "the first telemetry comes before the sequential boot would connect");
+
+  return check_summary();
+}
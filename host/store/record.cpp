@@ -0,0 +1,143 @@
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "frame_decoder.hpp"
+#include "sample_store.hpp"
+
+// Records JSON frames, one per line as sent over UART or IoT Hub, into a sample store. Reading
+// from a pipe records a live session, flushing every --flush-ms so that a browser watching the
+// store follows it. Samples timed before the last one recorded are dropped.
+
+static const char *const CHANNEL_NAMES[] = {"gain", "duty_cycle", "velocity", "position", "current"};
+static constexpr uint8_t CHANNEL_COUNT = sizeof(CHANNEL_NAMES) / sizeof(CHANNEL_NAMES[0]);
+static constexpr size_t MAX_LINE_LENGTH = 1 << 20;
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options] STORE [FILE]\n"
+          "  FILE           JSON frames, one per line (default - for standard input)\n"
+          "  --flush-ms N   Longest time between flushes while recording (default 1000)\n",
+          name);
+}
+
+static uint64_t now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int main(int argc, char **argv)
+{
+  const char *store_path = nullptr;
+  const char *input_path = "-";
+  uint32_t flush_ms = 1000;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--flush-ms") == 0 && has_value)
+      flush_ms = atoi(argv[++i]);
+    else if (argv[i][0] == '-' && argv[i][1] != '\0')
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+    else if (store_path == nullptr)
+      store_path = argv[i];
+    else
+      input_path = argv[i];
+  }
+
+  if (store_path == nullptr)
+  {
+    print_usage(argv[0]);
+    return 2;
+  }
+
+  FILE *input = strcmp(input_path, "-") == 0 ? stdin : fopen(input_path, "r");
+  if (input == nullptr)
+  {
+    fprintf(stderr, "Cannot read %s\n", input_path);
+    return 1;
+  }
+
+  SampleStore store;
+  if (!store.create(store_path, CHANNEL_COUNT, CHANNEL_NAMES))
+  {
+    fprintf(stderr, "Cannot create %s\n", store_path);
+    return 1;
+  }
+
+  std::vector<char> line(MAX_LINE_LENGTH);
+  std::vector<uint64_t> times;
+  std::vector<float> values;
+  decoded_frame frame;
+  uint64_t last_time = 0;
+  uint64_t last_flush = now_ms();
+  uint32_t frames = 0;
+  uint32_t skipped = 0;
+
+  while (fgets(line.data(), line.size(), input) != nullptr)
+  {
+    if (!decode_json_frame(line.data(), strlen(line.data()), frame))
+    {
+      skipped++;
+      continue;
+    }
+
+    const std::vector<float> *columns[CHANNEL_COUNT] = {&frame.gain, &frame.duty_cycle, &frame.velocity,
+                                                        &frame.position, &frame.current};
+    times.clear();
+    values.resize((size_t)CHANNEL_COUNT * frame.count);
+    for (uint16_t i = 0; i < frame.count; i++)
+    {
+      if (frame.timestamp[i] < last_time)
+        continue;
+      last_time = frame.timestamp[i];
+
+      for (uint8_t c = 0; c < CHANNEL_COUNT; c++)
+        values[c * frame.count + times.size()] = (*columns[c])[i];
+      times.push_back(frame.timestamp[i]);
+    }
+
+    // Channels were laid out a frame's length apart, close them up to the samples kept
+    for (uint8_t c = 1; c < CHANNEL_COUNT && times.size() < frame.count; c++)
+      memmove(&values[c * times.size()], &values[c * frame.count], times.size() * sizeof(float));
+
+    if (!store.append(times.data(), values.data(), times.size()))
+    {
+      fprintf(stderr, "Cannot write %s\n", store_path);
+      return 1;
+    }
+    frames++;
+
+    if (now_ms() - last_flush >= flush_ms)
+    {
+      store.flush();
+      last_flush = now_ms();
+    }
+  }
+
+  if (!store.flush())
+  {
+    fprintf(stderr, "Cannot write %s\n", store_path);
+    return 1;
+  }
+
+  printf("%u frames, %llu samples recorded to %s", frames, (unsigned long long)store.get_samples(), store_path);
+  if (skipped > 0)
+    printf(", %u lines that were not frames skipped", skipped);
+  printf("\n");
+
+  if (input != stdin)
+    fclose(input);
+
+  return 0;
+}
@@ -0,0 +1,572 @@
+// Includes
+#include "sample_store.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char STORE_MAGIC[4] = {'D', 'T', 'M', 'S'};
+
+static bool pread_all(int fd, void *dest, size_t length, uint64_t offset)
+{
+  uint8_t *bytes = static_cast<uint8_t *>(dest);
+
+  while (length > 0)
+  {
+    ssize_t read = pread(fd, bytes, length, offset);
+    if (read <= 0)
+    {
+      if (read < 0 && errno == EINTR)
+        continue;
+      return false;
+    }
+    bytes += read;
+    length -= read;
+    offset += read;
+  }
+
+  return true;
+}
+
+static bool pwrite_all(int fd, const void *data, size_t length, uint64_t offset)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+  while (length > 0)
+  {
+    ssize_t written = pwrite(fd, bytes, length, offset);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    bytes += written;
+    length -= written;
+    offset += written;
+  }
+
+  return true;
+}
+
+SampleStore::SampleStore()
+{
+  writable = false;
+  memset(&header, 0, sizeof(header));
+  header_fd = -1;
+  samples_fd = -1;
+  for (uint8_t i = 0; i < STORE_LEVELS; i++)
+  {
+    level_fd[i] = -1;
+    records[i] = 0;
+  }
+  chunk_fill = 0;
+  memset(building, 0, sizeof(building));
+}
+
+SampleStore::~SampleStore()
+{
+  close();
+}
+
+bool SampleStore::create(const char *path, uint8_t channel_count, const char *const *names)
+{
+  close();
+
+  if (channel_count == 0 || channel_count > MAX_STORE_CHANNELS || (mkdir(path, 0755) != 0 && errno != EEXIST))
+    return false;
+
+  this->path = path;
+  writable = true;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+  header.version = STORE_VERSION;
+  header.channel_count = channel_count;
+  header.chunk_samples = STORE_CHUNK_SAMPLES;
+  header.fanout = STORE_FANOUT;
+  header.levels = STORE_LEVELS;
+  for (uint8_t i = 0; i < channel_count; i++)
+    strncpy(header.names[i], names[i], MAX_STORE_CHANNEL_NAME - 1);
+
+  int flags = O_RDWR | O_CREAT | O_TRUNC;
+  header_fd = ::open((this->path + "/header").c_str(), flags, 0644);
+  samples_fd = ::open((this->path + "/samples").c_str(), flags, 0644);
+  bool opened = header_fd >= 0 && samples_fd >= 0;
+  for (uint8_t i = 0; i < STORE_LEVELS; i++)
+  {
+    level_fd[i] = ::open((this->path + "/level" + std::to_string(i + 1)).c_str(), flags, 0644);
+    opened = opened && level_fd[i] >= 0;
+    pending[i].clear();
+    records[i] = 0;
+    building[i].count = 0;
+  }
+
+  chunk.assign(chunk_bytes(), 0);
+  chunk_fill = 0;
+
+  if (!opened || !write_header())
+  {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+bool SampleStore::open(const char *path)
+{
+  close();
+
+  this->path = path;
+  writable = false;
+  memset(&header, 0, sizeof(header));
+
+  header_fd = ::open((this->path + "/header").c_str(), O_RDONLY);
+  samples_fd = ::open((this->path + "/samples").c_str(), O_RDONLY);
+  if (header_fd < 0 || samples_fd < 0 || !refresh() || header.levels > STORE_LEVELS)
+  {
+    close();
+    return false;
+  }
+
+  for (uint8_t i = 0; i < header.levels; i++)
+  {
+    level_fd[i] = ::open((this->path + "/level" + std::to_string(i + 1)).c_str(), O_RDONLY);
+    if (level_fd[i] < 0)
+    {
+      close();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Writes what is left of a recording, closing it as a complete store
+void SampleStore::close()
+{
+  if (writable && header_fd >= 0)
+    flush();
+
+  if (header_fd >= 0)
+    ::close(header_fd);
+  if (samples_fd >= 0)
+    ::close(samples_fd);
+  for (uint8_t i = 0; i < STORE_LEVELS; i++)
+  {
+    if (level_fd[i] >= 0)
+      ::close(level_fd[i]);
+    level_fd[i] = -1;
+  }
+
+  header_fd = -1;
+  samples_fd = -1;
+  writable = false;
+}
+
+bool SampleStore::append(const uint64_t *times, const float *values, uint32_t count)
+{
+  uint32_t channels = header.channel_count;
+  uint32_t chunk_samples = header.chunk_samples;
+
+  if (!writable)
+    return false;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    level_record sample;
+
+    sample.time = times[i];
+    sample.count = 1;
+    memcpy(chunk.data() + chunk_fill * sizeof(uint64_t), &times[i], sizeof(uint64_t));
+
+    for (uint32_t c = 0; c < channels; c++)
+    {
+      float value = values[c * count + i];
+
+      memcpy(chunk.data() + chunk_samples * sizeof(uint64_t) + (c * chunk_samples + chunk_fill) * sizeof(float),
+             &value, sizeof(float));
+      sample.min[c] = value;
+      sample.max[c] = value;
+      sample.sum[c] = value;
+    }
+
+    header.samples++;
+    chunk_fill++;
+
+    if (!add_to_level(0, sample))
+      return false;
+
+    if (chunk_fill == chunk_samples)
+    {
+      if (!write_chunk())
+        return false;
+      chunk_fill = 0;
+    }
+  }
+
+  return true;
+}
+
+// Partial chunk and records first, then the header that makes them visible
+bool SampleStore::flush()
+{
+  std::vector<uint8_t> record(record_bytes());
+  bool written = writable && (chunk_fill == 0 || write_chunk());
+
+  level_record partial;
+
+  // Each level's partial record takes in the samples of the partial records below it
+  partial.count = 0;
+  for (uint8_t i = 0; written && i < STORE_LEVELS; i++)
+  {
+    written = write_pending(i);
+    if (building[i].count > 0)
+      merge_record(partial, building[i]);
+    if (written && partial.count > 0)
+    {
+      encode_record(partial, record.data());
+      written = pwrite_all(level_fd[i], record.data(), record.size(), records[i] * record.size());
+    }
+  }
+
+  return written && write_header();
+}
+
+bool SampleStore::refresh()
+{
+  store_header read;
+
+  if (!pread_all(header_fd, &read, sizeof(read), 0) || memcmp(read.magic, STORE_MAGIC, sizeof(read.magic)) != 0 ||
+      read.version != STORE_VERSION || read.channel_count == 0 || read.channel_count > MAX_STORE_CHANNELS ||
+      read.chunk_samples == 0 || read.fanout < 2)
+    return false;
+
+  // The recorder only adds samples, a header from another store is refused
+  if (header.chunk_samples != 0 &&
+      (read.channel_count != header.channel_count || read.chunk_samples != header.chunk_samples))
+    return false;
+
+  header = read;
+  return true;
+}
+
+uint8_t SampleStore::get_channel_count()
+{
+  return header.channel_count;
+}
+
+const char *SampleStore::get_channel_name(uint8_t channel)
+{
+  return channel < header.channel_count ? header.names[channel] : nullptr;
+}
+
+int8_t SampleStore::find_channel(const char *name)
+{
+  for (uint8_t i = 0; i < header.channel_count; i++)
+  {
+    if (strncmp(header.names[i], name, MAX_STORE_CHANNEL_NAME) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+uint64_t SampleStore::get_samples()
+{
+  return header.samples;
+}
+
+bool SampleStore::get_time_range(uint64_t *start, uint64_t *end)
+{
+  return header.samples > 0 && read_times(0, 1, start) && read_times(header.samples - 1, 1, end);
+}
+
+bool SampleStore::query(uint8_t channel, uint64_t start, uint64_t end, uint32_t max_points,
+                        std::vector<store_point> &points)
+{
+  uint64_t first;
+  uint64_t last;
+
+  points.clear();
+  if (channel >= header.channel_count || max_points == 0)
+    return false;
+  if (header.samples == 0 || start > end)
+    return true;
+  if (!find_index(start, &first) || !(end == UINT64_MAX ? (last = header.samples, true) : find_index(end + 1, &last)))
+    return false;
+  if (first >= last)
+    return true;
+
+  // Few enough samples to draw each one
+  if (last - first <= max_points)
+  {
+    points.resize(last - first);
+    return read_points(0, channel, first, last - first, points.data());
+  }
+
+  // Points of bin samples each, aligned to the bin so that panning keeps them. A bin is a whole
+  // number of records of the finest level whose records alone would not be too many, so the
+  // window fills about half its points or more and costs no more than fanout reads a point.
+  uint8_t level = 0;
+  uint64_t size = 1;
+  while (level < header.levels && bin_count(first, last, size * header.fanout) > max_points)
+  {
+    level++;
+    size *= header.fanout;
+  }
+
+  uint64_t group = 1;
+  while (group < header.fanout && bin_count(first, last, size * group) > max_points)
+    group++;
+
+  uint64_t bin = size * group;
+  uint64_t count = bin_count(first, last, bin);
+  if (count > max_points)
+    count = max_points; // Beyond the last level, the start of the window
+
+  uint64_t from = first / bin * group;
+  uint64_t available = (header.samples + size - 1) / size - from;
+  uint64_t records = count * group < available ? count * group : available;
+  std::vector<store_point> fine(records);
+
+  if (!read_points(level, channel, from, records, fine.data()))
+    return false;
+
+  points.resize(count);
+  for (uint64_t i = 0; i < count; i++)
+  {
+    store_point &point = points[i];
+    double sum = 0;
+    uint64_t samples = 0;
+
+    point = fine[i * group];
+    for (uint64_t n = i * group; n < (i + 1) * group && n < records; n++)
+    {
+      // Every record is full but the store's last
+      uint64_t begin = (from + n) * size;
+      uint64_t weight = begin + size < header.samples ? size : header.samples - begin;
+
+      point.min = fine[n].min < point.min ? fine[n].min : point.min;
+      point.max = fine[n].max > point.max ? fine[n].max : point.max;
+      sum += (double)fine[n].mean * weight;
+      samples += weight;
+    }
+    point.mean = sum / samples;
+  }
+
+  return true;
+}
+
+uint64_t SampleStore::bin_count(uint64_t first, uint64_t last, uint64_t bin)
+{
+  return (last - 1) / bin - first / bin + 1;
+}
+
+// Samples at level 0, records above it, as points
+bool SampleStore::read_points(uint8_t level, uint8_t channel, uint64_t first, uint32_t count, store_point *dest)
+{
+  if (level == 0)
+  {
+    std::vector<uint64_t> times(count);
+    std::vector<float> values(count);
+
+    if (!read_times(first, count, times.data()) || !read_values(channel, first, count, values.data()))
+      return false;
+
+    for (uint32_t i = 0; i < count; i++)
+      dest[i] = {times[i], values[i], values[i], values[i]};
+    return true;
+  }
+
+  uint32_t bytes = record_bytes();
+  uint32_t channels = header.channel_count;
+  std::vector<uint8_t> data((size_t)count * bytes);
+
+  if (!pread_all(level_fd[level - 1], data.data(), data.size(), first * bytes))
+    return false;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    const uint8_t *record = data.data() + (size_t)i * bytes;
+    const uint8_t *floats = record + sizeof(uint64_t);
+
+    memcpy(&dest[i].time, record, sizeof(uint64_t));
+    memcpy(&dest[i].min, floats + channel * sizeof(float), sizeof(float));
+    memcpy(&dest[i].max, floats + (channels + channel) * sizeof(float), sizeof(float));
+    memcpy(&dest[i].mean, floats + (2 * channels + channel) * sizeof(float), sizeof(float));
+  }
+
+  return true;
+}
+
+uint32_t SampleStore::chunk_bytes()
+{
+  return header.chunk_samples * (sizeof(uint64_t) + header.channel_count * sizeof(float));
+}
+
+uint32_t SampleStore::record_bytes()
+{
+  return sizeof(uint64_t) + 3 * header.channel_count * sizeof(float);
+}
+
+// Timestamp, then the channels' minimums, maximums and means
+void SampleStore::encode_record(const level_record &record, uint8_t *dest)
+{
+  uint32_t channels = header.channel_count;
+  uint8_t *floats = dest + sizeof(uint64_t);
+
+  memcpy(dest, &record.time, sizeof(uint64_t));
+  for (uint32_t c = 0; c < channels; c++)
+  {
+    float mean = record.sum[c] / record.count;
+
+    memcpy(floats + c * sizeof(float), &record.min[c], sizeof(float));
+    memcpy(floats + (channels + c) * sizeof(float), &record.max[c], sizeof(float));
+    memcpy(floats + (2 * channels + c) * sizeof(float), &mean, sizeof(float));
+  }
+}
+
+// Record's samples into target, which takes record's timestamp if it is empty
+void SampleStore::merge_record(level_record &target, const level_record &record)
+{
+  if (target.count == 0)
+  {
+    target = record;
+    return;
+  }
+
+  // Partial records are merged from the finest level up, so the earlier samples are in record
+  if (record.time < target.time)
+    target.time = record.time;
+  for (uint32_t c = 0; c < header.channel_count; c++)
+  {
+    target.min[c] = record.min[c] < target.min[c] ? record.min[c] : target.min[c];
+    target.max[c] = record.max[c] > target.max[c] ? record.max[c] : target.max[c];
+    target.sum[c] += record.sum[c];
+  }
+  target.count += record.count;
+}
+
+// Folds a sample, or a completed record of the level below, into the level's record. A record
+// that completes is queued for writing and folded into the level above.
+bool SampleStore::add_to_level(uint8_t level, const level_record &record)
+{
+  level_record &target = building[level];
+
+  merge_record(target, record);
+
+  uint64_t size = header.fanout;
+  for (uint8_t i = 0; i < level; i++)
+    size *= header.fanout;
+  if (target.count < size)
+    return true;
+
+  size_t offset = pending[level].size();
+  pending[level].resize(offset + record_bytes());
+  encode_record(target, pending[level].data() + offset);
+  records[level]++;
+
+  bool written = pending[level].size() < PENDING_RECORDS * record_bytes() || write_pending(level);
+  if (written && level + 1 < STORE_LEVELS)
+    written = add_to_level(level + 1, target);
+
+  target.count = 0;
+  return written;
+}
+
+// The chunk being filled, into its slot whether or not it is full
+bool SampleStore::write_chunk()
+{
+  uint64_t index = (header.samples - chunk_fill) / header.chunk_samples;
+
+  return pwrite_all(samples_fd, chunk.data(), chunk.size(), index * chunk.size());
+}
+
+bool SampleStore::write_pending(uint8_t level)
+{
+  uint32_t bytes = record_bytes();
+  uint64_t first = records[level] - pending[level].size() / bytes;
+
+  if (pending[level].empty())
+    return true;
+  if (!pwrite_all(level_fd[level], pending[level].data(), pending[level].size(), first * bytes))
+    return false;
+
+  pending[level].clear();
+  return true;
+}
+
+bool SampleStore::write_header()
+{
+  return pwrite_all(header_fd, &header, sizeof(header), 0);
+}
+
+bool SampleStore::read_times(uint64_t first, uint32_t count, uint64_t *dest)
+{
+  uint32_t chunk_samples = header.chunk_samples;
+
+  while (count > 0)
+  {
+    uint64_t index = first / chunk_samples;
+    uint32_t offset = first % chunk_samples;
+    uint32_t length = chunk_samples - offset < count ? chunk_samples - offset : count;
+
+    if (!pread_all(samples_fd, dest, length * sizeof(uint64_t), index * chunk_bytes() + offset * sizeof(uint64_t)))
+      return false;
+
+    first += length;
+    count -= length;
+    dest += length;
+  }
+
+  return true;
+}
+
+bool SampleStore::read_values(uint8_t channel, uint64_t first, uint32_t count, float *dest)
+{
+  uint32_t chunk_samples = header.chunk_samples;
+
+  while (count > 0)
+  {
+    uint64_t index = first / chunk_samples;
+    uint32_t offset = first % chunk_samples;
+    uint32_t length = chunk_samples - offset < count ? chunk_samples - offset : count;
+    uint64_t column = chunk_samples * sizeof(uint64_t) + (uint64_t)channel * chunk_samples * sizeof(float);
+
+    if (!pread_all(samples_fd, dest, length * sizeof(float), index * chunk_bytes() + column + offset * sizeof(float)))
+      return false;
+
+    first += length;
+    count -= length;
+    dest += length;
+  }
+
+  return true;
+}
+
+// First sample timed at or after time, the sample count if there is none. Timestamps only rise.
+bool SampleStore::find_index(uint64_t time, uint64_t *index)
+{
+  uint64_t low = 0;
+  uint64_t high = header.samples;
+
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    uint64_t value;
+
+    if (!read_times(middle, 1, &value))
+      return false;
+    if (value < time)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  *index = low;
+  return true;
+}
@@ -0,0 +1,124 @@
+#ifndef SAMPLE_STORE_H_
+#define SAMPLE_STORE_H_
+
+// Includes
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// On-disk store of a recorded sample stream, for browsing sessions of hours at 1 kHz. A store is
+// a directory of:
+//   header   magic, version, layout, channel names and the number of samples written
+//   samples  fixed-size chunks of STORE_CHUNK_SAMPLES, each the chunk's timestamps (u64) and
+//            then each channel's values (f32), so chunk k is at a known offset
+//   level<n> one record per STORE_FANOUT^n samples, its first timestamp and per channel the
+//            minimum, maximum and mean of those samples
+// A window of any length is served from the level just finer than one that would give fewer
+// points than asked for, its records merged in groups, so a query reads a small multiple of the
+// pixels to draw whatever the window's length. The recorder appends
+// as samples arrive, completed records are written as they fill and flush() writes the partial
+// chunk and records and then the header, so a browser that calls refresh() sees a consistent
+// store while recording continues. All values are little-endian, as the host writes them.
+
+static constexpr uint8_t STORE_VERSION = 1;
+static constexpr uint8_t MAX_STORE_CHANNELS = 8;
+static constexpr uint8_t MAX_STORE_CHANNEL_NAME = 16; // Including the terminator
+static constexpr uint32_t STORE_CHUNK_SAMPLES = 4096;
+static constexpr uint32_t STORE_FANOUT = 16;
+static constexpr uint8_t STORE_LEVELS = 8; // Down to a record per 16^8 samples, 50 days at 1 kHz
+
+// One point of a window, a single sample at level 0
+typedef struct
+{
+  uint64_t time; // First sample's timestamp
+  float min;
+  float max;
+  float mean;
+} store_point;
+
+typedef struct
+{
+  char magic[4]; // "DTMS"
+  uint8_t version;
+  uint8_t channel_count;
+  uint16_t reserved;
+  uint32_t chunk_samples;
+  uint32_t fanout;
+  uint32_t levels;
+  uint64_t samples;
+  char names[MAX_STORE_CHANNELS][MAX_STORE_CHANNEL_NAME];
+} store_header;
+
+class SampleStore
+{
+private:
+  // Running reduction of the record a level is filling
+  typedef struct
+  {
+    uint64_t time;
+    uint32_t count;
+    float min[MAX_STORE_CHANNELS];
+    float max[MAX_STORE_CHANNELS];
+    double sum[MAX_STORE_CHANNELS];
+  } level_record;
+
+  static constexpr uint32_t PENDING_RECORDS = 256; // Completed records written together
+
+  // Class variables
+  std::string path;
+  bool writable;
+  store_header header;
+  int header_fd;
+  int samples_fd;
+  int level_fd[STORE_LEVELS];
+
+  // Writer state
+  std::vector<uint8_t> chunk; // Chunk being filled
+  uint32_t chunk_fill;
+  level_record building[STORE_LEVELS];
+  std::vector<uint8_t> pending[STORE_LEVELS]; // Completed records not yet written
+  uint64_t records[STORE_LEVELS];             // Completed records, pending ones included
+
+  uint32_t chunk_bytes();
+  uint32_t record_bytes();
+  void merge_record(level_record &target, const level_record &record);
+  void encode_record(const level_record &record, uint8_t *dest);
+  bool add_to_level(uint8_t level, const level_record &record);
+  bool write_chunk();
+  bool write_pending(uint8_t level);
+  bool write_header();
+  bool read_times(uint64_t first, uint32_t count, uint64_t *dest);
+  bool read_values(uint8_t channel, uint64_t first, uint32_t count, float *dest);
+  bool find_index(uint64_t time, uint64_t *index);
+  uint64_t bin_count(uint64_t first, uint64_t last, uint64_t bin);
+  bool read_points(uint8_t level, uint8_t channel, uint64_t first, uint32_t count, store_point *dest);
+
+public:
+  SampleStore();
+  ~SampleStore();
+
+  // A new store for recording, replacing any at path
+  bool create(const char *path, uint8_t channel_count, const char *const *names);
+  // An existing store for browsing
+  bool open(const char *path);
+  void close();
+
+  // values holds count samples of each channel in turn, channel_count * count in all. Times must
+  // not fall, a window is found by binary search.
+  bool append(const uint64_t *times, const float *values, uint32_t count);
+  bool flush();
+  // Rereads the header of a store opened for browsing, returns false if it is unreadable
+  bool refresh();
+
+  uint8_t get_channel_count();
+  const char *get_channel_name(uint8_t channel);
+  int8_t find_channel(const char *name); // -1 if there is none
+  uint64_t get_samples();
+  bool get_time_range(uint64_t *start, uint64_t *end);
+
+  // At most max_points points covering the samples timed [start, end], each the same whole number
+  // of samples. Points at the ends may reach outside the window. Sees what was flushed.
+  bool query(uint8_t channel, uint64_t start, uint64_t end, uint32_t max_points, std::vector<store_point> &points);
+};
+
+#endif // SAMPLE_STORE_H_
@@ -0,0 +1,95 @@
+// Includes
+#include "store_api.h"
+
+#include <vector>
+
+#include "sample_store.hpp"
+
+struct dtmc_store
+{
+  SampleStore store;
+  std::vector<store_point> points;
+};
+
+dtmc_store *dtmc_store_create(const char *path, uint8_t channel_count, const char *const *names)
+{
+  dtmc_store *store = new dtmc_store;
+
+  if (!store->store.create(path, channel_count, names))
+  {
+    delete store;
+    return nullptr;
+  }
+
+  return store;
+}
+
+dtmc_store *dtmc_store_open(const char *path)
+{
+  dtmc_store *store = new dtmc_store;
+
+  if (!store->store.open(path))
+  {
+    delete store;
+    return nullptr;
+  }
+
+  return store;
+}
+
+void dtmc_store_close(dtmc_store *store)
+{
+  delete store;
+}
+
+int dtmc_store_append(dtmc_store *store, const uint64_t *times, const float *values, uint32_t count)
+{
+  return store->store.append(times, values, count);
+}
+
+int dtmc_store_flush(dtmc_store *store)
+{
+  return store->store.flush();
+}
+
+int dtmc_store_refresh(dtmc_store *store)
+{
+  return store->store.refresh();
+}
+
+uint8_t dtmc_store_channel_count(dtmc_store *store)
+{
+  return store->store.get_channel_count();
+}
+
+const char *dtmc_store_channel_name(dtmc_store *store, uint8_t channel)
+{
+  return store->store.get_channel_name(channel);
+}
+
+uint64_t dtmc_store_samples(dtmc_store *store)
+{
+  return store->store.get_samples();
+}
+
+int dtmc_store_time_range(dtmc_store *store, uint64_t *start, uint64_t *end)
+{
+  return store->store.get_time_range(start, end);
+}
+
+int64_t dtmc_store_query(dtmc_store *store, uint8_t channel, uint64_t start, uint64_t end, uint32_t max_points,
+                         uint64_t *times, float *min, float *max, float *mean)
+{
+  if (!store->store.query(channel, start, end, max_points, store->points))
+    return -1;
+
+  for (size_t i = 0; i < store->points.size(); i++)
+  {
+    times[i] = store->points[i].time;
+    min[i] = store->points[i].min;
+    max[i] = store->points[i].max;
+    mean[i] = store->points[i].mean;
+  }
+
+  return store->points.size();
+}
@@ -0,0 +1,40 @@
+#ifndef STORE_API_H_
+#define STORE_API_H_
+
+// Includes
+#include <stdint.h>
+
+// C interface to SampleStore, built as the shared library libdtmc_store for
+// python_scripts/sample_store.py to load with ctypes. Functions returning int give 1 on success
+// and 0 on failure.
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef struct dtmc_store dtmc_store;
+
+  dtmc_store *dtmc_store_create(const char *path, uint8_t channel_count, const char *const *names);
+  dtmc_store *dtmc_store_open(const char *path);
+  void dtmc_store_close(dtmc_store *store);
+
+  // values holds count samples of each channel in turn
+  int dtmc_store_append(dtmc_store *store, const uint64_t *times, const float *values, uint32_t count);
+  int dtmc_store_flush(dtmc_store *store);
+  int dtmc_store_refresh(dtmc_store *store);
+
+  uint8_t dtmc_store_channel_count(dtmc_store *store);
+  const char *dtmc_store_channel_name(dtmc_store *store, uint8_t channel);
+  uint64_t dtmc_store_samples(dtmc_store *store);
+  int dtmc_store_time_range(dtmc_store *store, uint64_t *start, uint64_t *end);
+
+  // Writes up to max_points points of the window into the arrays, returns how many or -1
+  int64_t dtmc_store_query(dtmc_store *store, uint8_t channel, uint64_t start, uint64_t end, uint32_t max_points,
+                           uint64_t *times, float *min, float *max, float *mean);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STORE_API_H_
@@ -0,0 +1,136 @@
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include "sample_store.hpp"
+
+// Sample store timings on a synthetic session of the firmware's five channels: recording, then
+// opening the store and zooming from the whole session down to a second as a plot would, each
+// window at the plot's width in pixels.
+
+static const char *const CHANNEL_NAMES[] = {"gain", "duty_cycle", "velocity", "position", "current"};
+static constexpr uint8_t CHANNEL_COUNT = sizeof(CHANNEL_NAMES) / sizeof(CHANNEL_NAMES[0]);
+static constexpr uint32_t FRAME_SAMPLES = 50;
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --path P      Store to write (default store_bench.dtms)\n"
+          "  --hours N     Session length (default 4)\n"
+          "  --rate N      Samples per second (default 1000)\n"
+          "  --pixels N    Points per window (default 2000)\n",
+          name);
+}
+
+static uint64_t now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+  const char *path = "store_bench.dtms";
+  double hours = 4;
+  uint32_t rate = 1000;
+  uint32_t pixels = 2000;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--path") == 0 && has_value)
+      path = argv[++i];
+    else if (strcmp(argv[i], "--hours") == 0 && has_value)
+      hours = atof(argv[++i]);
+    else if (strcmp(argv[i], "--rate") == 0 && has_value)
+      rate = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--pixels") == 0 && has_value)
+      pixels = atoi(argv[++i]);
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  uint64_t sample_count = hours * 3600 * rate;
+  if (sample_count < FRAME_SAMPLES || rate == 0 || rate > 1000 || pixels == 0)
+  {
+    print_usage(argv[0]);
+    return 2;
+  }
+
+  SampleStore writer;
+  if (!writer.create(path, CHANNEL_COUNT, CHANNEL_NAMES))
+  {
+    fprintf(stderr, "Cannot create %s\n", path);
+    return 1;
+  }
+
+  std::vector<uint64_t> times(FRAME_SAMPLES);
+  std::vector<float> values(CHANNEL_COUNT * FRAME_SAMPLES);
+  uint64_t start_ms = 1700000000000ULL;
+  uint64_t start = now_ns();
+
+  for (uint64_t i = 0; i + FRAME_SAMPLES <= sample_count; i += FRAME_SAMPLES)
+  {
+    for (uint32_t n = 0; n < FRAME_SAMPLES; n++)
+    {
+      float t = (i + n) / (float)rate;
+
+      times[n] = start_ms + (i + n) * 1000 / rate;
+      values[n] = 0.5f;
+      values[FRAME_SAMPLES + n] = 50 + 40 * sinf(t * 0.1f);
+      values[2 * FRAME_SAMPLES + n] = 90 + 30 * sinf(t * 0.5f) + (n % 5);
+      values[3 * FRAME_SAMPLES + n] = fmodf(t * 540, 360);
+      values[4 * FRAME_SAMPLES + n] = 200 + 50 * sinf(t * 3);
+    }
+    writer.append(times.data(), values.data(), FRAME_SAMPLES);
+  }
+  writer.close();
+  uint64_t record_ns = now_ns() - start;
+
+  printf("%.1f h at %u Hz, %llu samples of %u channels\n\n", hours, rate, (unsigned long long)sample_count,
+         CHANNEL_COUNT);
+  printf("record         %10.1f ms %10.1f Msample/s\n", record_ns / 1e6, sample_count / (record_ns / 1e3));
+
+  SampleStore reader;
+  start = now_ns();
+  bool opened = reader.open(path);
+  uint64_t open_ns = now_ns() - start;
+  if (!opened)
+  {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return 1;
+  }
+  printf("open           %10.3f ms\n\n", open_ns / 1e6);
+
+  // Zooming in by 4 at a time on the middle of the session, each window as a plot redraws it
+  uint64_t first_ms;
+  uint64_t last_ms;
+  std::vector<store_point> points;
+  int8_t velocity = reader.find_channel("velocity");
+
+  reader.get_time_range(&first_ms, &last_ms);
+  printf("%-14s %10s %10s\n", "window", "points", "ms");
+  for (uint64_t span = last_ms - first_ms; span >= 1000; span /= 4)
+  {
+    uint64_t middle = first_ms + (last_ms - first_ms) / 2;
+    uint64_t window_start = middle - span / 2;
+
+    start = now_ns();
+    reader.query(velocity, window_start, window_start + span, pixels, points);
+    uint64_t query_ns = now_ns() - start;
+
+    printf("%10.1f s   %10zu %10.3f\n", span / 1000.0, points.size(), query_ns / 1e6);
+  }
+
+  return 0;
+}
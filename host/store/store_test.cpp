@@ -0,0 +1,205 @@
+// Includes
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#include "check.hpp"
+#include "sample_store.hpp"
+
+// Ten minutes of three channels at 1 kHz recorded in frames, as the recorder writes them: every
+// window served at any zoom must hold exactly the minimum, maximum and mean of the samples it
+// covers, a one-sample spike must survive the coarsest zoom, a browser must see each flush while
+// recording continues and a reopened store must serve the same windows.
+
+static constexpr uint32_t SAMPLE_COUNT = 600000;
+static constexpr uint32_t FRAME_SAMPLES = 50;
+static constexpr uint32_t FLUSH_SAMPLES = 100000;
+static constexpr uint32_t SPIKE_SAMPLE = 345678;
+static constexpr float SPIKE_VALUE = 1000;
+static constexpr uint64_t START_MS = 1700000000000ULL;
+static constexpr uint8_t CHANNEL_COUNT = 3;
+static const char *const CHANNEL_NAMES[CHANNEL_COUNT] = {"velocity", "position", "current"};
+static const char *const STORE_PATH = "store_test.dtms";
+
+static float sample_value(uint8_t channel, uint32_t i)
+{
+  if (channel == 0)
+    return i == SPIKE_SAMPLE ? SPIKE_VALUE : 100 * sinf(i * 0.001f) + (i % 7);
+  if (channel == 1)
+    return (i % 3600) * 0.1f;
+  return (i * 2654435761u >> 20) % 100;
+}
+
+// Sample times rise by 1 ms with a repeated time and a 10 s gap thrown in
+static uint64_t sample_time(uint32_t i)
+{
+  return START_MS + i - (i > 1000 ? 1 : 0) + (i > 300000 ? 10000 : 0);
+}
+
+static uint32_t lower_bound(uint64_t time, uint32_t samples)
+{
+  uint32_t low = 0;
+  uint32_t high = samples;
+
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (sample_time(middle) < time)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+// Each point against a brute-force reduction of the samples of its record
+static bool window_matches(SampleStore &store, uint8_t channel, uint64_t start, uint64_t end, uint32_t max_points,
+                           uint32_t samples)
+{
+  std::vector<store_point> points;
+  uint32_t first = lower_bound(start, samples);
+  uint32_t last = end == UINT64_MAX ? samples : lower_bound(end + 1, samples);
+
+  if (!store.query(channel, start, end, max_points, points) || points.size() > max_points)
+    return false;
+  if (first >= last)
+    return points.empty();
+
+  // Raw samples when there are few enough
+  if (last - first <= max_points)
+  {
+    bool matches = points.size() == last - first;
+    for (uint32_t i = 0; matches && i < points.size(); i++)
+    {
+      float value = sample_value(channel, first + i);
+      matches = points[i].time == sample_time(first + i) && points[i].min == value && points[i].max == value;
+    }
+    return matches;
+  }
+
+  // Records of the finest level that the next would not give too many of, in the fewest groups
+  uint64_t power = 1;
+  while ((uint64_t)(last - 1) / (power * STORE_FANOUT) - first / (power * STORE_FANOUT) + 1 > max_points)
+    power *= STORE_FANOUT;
+
+  uint64_t size = power;
+  while ((last - 1) / size - first / size + 1 > max_points)
+    size += power;
+
+  uint64_t from = first / size;
+  if (points.size() != (last - 1) / size - from + 1)
+    return false;
+
+  for (uint32_t i = 0; i < points.size(); i++)
+  {
+    uint64_t begin = (from + i) * size;
+    uint64_t stop = begin + size < samples ? begin + size : samples;
+    float min = INFINITY;
+    float max = -INFINITY;
+    double sum = 0;
+
+    for (uint64_t n = begin; n < stop; n++)
+    {
+      float value = sample_value(channel, n);
+      min = fminf(min, value);
+      max = fmaxf(max, value);
+      sum += value;
+    }
+
+    float mean = sum / (stop - begin);
+    if (points[i].time != sample_time(begin) || points[i].min != min || points[i].max != max ||
+        fabsf(points[i].mean - mean) > 1e-3f * (1 + fabsf(mean)))
+      return false;
+  }
+
+  return true;
+}
+
+static bool windows_match(SampleStore &store, uint32_t samples)
+{
+  uint64_t end_ms = sample_time(samples - 1);
+  const uint32_t pixels[] = {1, 7, 800, 4000};
+  const uint64_t spans_ms[] = {1, 40, 900, 20000, 400000, 10000000};
+  bool matches = true;
+
+  for (uint8_t c = 0; c < CHANNEL_COUNT; c++)
+  {
+    for (uint32_t max_points : pixels)
+    {
+      matches = matches && window_matches(store, c, 0, UINT64_MAX, max_points, samples);
+      for (uint64_t span : spans_ms)
+      {
+        for (uint64_t start = START_MS - 5; start < end_ms; start += span * 3 + 12345)
+          matches = matches && window_matches(store, c, start, start + span, max_points, samples);
+      }
+    }
+  }
+
+  return matches;
+}
+
+int main()
+{
+  SampleStore writer;
+  SampleStore reader;
+  std::vector<uint64_t> times(FRAME_SAMPLES);
+  std::vector<float> values(CHANNEL_COUNT * FRAME_SAMPLES);
+  bool flushes_seen = true;
+  bool flushed_match = true;
+
+  check(writer.create(STORE_PATH, CHANNEL_COUNT, CHANNEL_NAMES), "a store is created");
+  check(writer.flush() && reader.open(STORE_PATH), "an empty store opens for browsing");
+  check(reader.get_samples() == 0, "the empty store has no samples");
+
+  for (uint32_t i = 0; i < SAMPLE_COUNT; i += FRAME_SAMPLES)
+  {
+    for (uint32_t n = 0; n < FRAME_SAMPLES; n++)
+    {
+      times[n] = sample_time(i + n);
+      for (uint8_t c = 0; c < CHANNEL_COUNT; c++)
+        values[c * FRAME_SAMPLES + n] = sample_value(c, i + n);
+    }
+    writer.append(times.data(), values.data(), FRAME_SAMPLES);
+
+    // Flushed partway through chunks and records
+    uint32_t samples = i + FRAME_SAMPLES;
+    if (samples % FLUSH_SAMPLES == 12350)
+    {
+      writer.flush();
+      flushes_seen = flushes_seen && reader.refresh() && reader.get_samples() == samples;
+      flushed_match = flushed_match && window_matches(reader, 0, 0, UINT64_MAX, 100, samples) &&
+                      window_matches(reader, 2, START_MS + samples / 2, UINT64_MAX, 500, samples);
+    }
+  }
+  check(flushes_seen, "a browser sees each flush while recording continues");
+  check(flushed_match, "windows of a store being recorded cover what was flushed");
+
+  writer.close();
+  check(reader.refresh() && reader.get_samples() == SAMPLE_COUNT, "closing the recording flushes it");
+  check(windows_match(reader, SAMPLE_COUNT), "windows at every zoom reduce the samples they cover");
+
+  std::vector<store_point> points;
+  reader.query(0, 0, UINT64_MAX, 1, points);
+  check(points.size() == 1 && points[0].max == SPIKE_VALUE, "a one-sample spike survives the coarsest zoom");
+
+  reader.query(1, START_MS, START_MS + 3600000, 1000, points);
+  check(points.size() <= 1000 && points.size() >= 1000 / 2, "a window fills at least half its points");
+
+  SampleStore reopened;
+  uint64_t start;
+  uint64_t end;
+  check(reopened.open(STORE_PATH), "the store reopens");
+  check(reopened.get_channel_count() == CHANNEL_COUNT && reopened.find_channel("current") == 2 &&
+            reopened.find_channel("duty_cycle") == -1,
+        "channels are found by name");
+  check(reopened.get_time_range(&start, &end) && start == sample_time(0) && end == sample_time(SAMPLE_COUNT - 1),
+        "the time range spans the recording");
+  check(window_matches(reopened, 0, START_MS + 123456, START_MS + 456789, 640, SAMPLE_COUNT),
+        "the reopened store serves the same windows");
+  check(!reopened.append(times.data(), values.data(), FRAME_SAMPLES), "a store opened for browsing is not written");
+
+  check(!reopened.open("no_such_store.dtms"), "a missing store does not open");
+
+  return check_summary();
+}
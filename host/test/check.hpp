@@ -0,0 +1,26 @@
+#ifndef CHECK_H_
+#define CHECK_H_
+
+// Includes
+#include <stdio.h>
+
+// Checks for the host tests: a PASS or FAIL line for each, then a summary and an exit status that
+// fails the ctest on any failed check.
+
+inline int check_failures = 0;
+
+inline void check(bool condition, const char *description)
+{
+  printf("%s: %s\n", condition ? "PASS" : "FAIL", description);
+  if (!condition)
+    check_failures++;
+}
+
+// Prints the summary, returns the test's exit status
+inline int check_summary()
+{
+  printf("%s: %d failures\n", check_failures == 0 ? "PASSED" : "FAILED", check_failures);
+  return check_failures == 0 ? 0 : 1;
+}
+
+#endif // CHECK_H_
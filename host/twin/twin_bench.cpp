@@ -0,0 +1,173 @@
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <memory>
+#include <vector>
+
+#include "motor_model.hpp"
+#include "twin_residual.hpp"
+
+// Twin residual throughput: a fleet's frames stepped through one engine in lockstep, against the
+// same frames through an engine per device, in device-seconds simulated per wall-second. Frames
+// are sampled from the stations' motor model beforehand, so only the engine is timed.
+
+static constexpr uint32_t TEMPLATE_COUNT = 8;   // Distinct motors the fleet's frames are taken from
+static constexpr uint32_t TEMPLATE_SECONDS = 20; // Frames of each, replayed from the start when used up
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --devices N        Devices in the fleet (default 1024)\n"
+          "  --seconds S        Telemetry time stepped per device (default 60)\n"
+          "  --sample-rate N    Samples per second (default 100)\n"
+          "  --frame-samples N  Samples per frame (default 50)\n",
+          name);
+}
+
+static uint64_t now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Consecutive frames of a motor stepping between set points, as a station would sample them
+static void make_frames(std::vector<decoded_frame> &frames, uint32_t seed, uint32_t sample_rate, uint16_t samples)
+{
+  MotorModel motor(seed);
+  uint64_t sample_time_us = 0;
+  uint64_t period_us = 1000000 / sample_rate;
+
+  for (decoded_frame &frame : frames)
+  {
+    frame.count = samples;
+    frame.timestamp.resize(samples);
+    frame.gain.resize(samples);
+    frame.duty_cycle.resize(samples);
+    frame.velocity.resize(samples);
+    frame.position.resize(samples);
+    frame.current.resize(samples);
+
+    for (uint16_t i = 0; i < samples; i++)
+    {
+      uint64_t phase = (sample_time_us + seed * 997 * 1000) % 4000000;
+      motor.set_velocity_sp(phase < 2000000 ? 60 : 120);
+      motor.step(1.0f / sample_rate);
+      sample_time_us += period_us;
+
+      frame.timestamp[i] = 1700000000000ULL + sample_time_us / 1000;
+      frame.gain[i] = motor.get_gain();
+      frame.duty_cycle[i] = motor.get_duty_cycle();
+      frame.velocity[i] = motor.get_velocity();
+      frame.position[i] = motor.get_position();
+      frame.current[i] = motor.get_current();
+    }
+  }
+}
+
+static void print_result(const char *label, double device_seconds, uint64_t samples, uint64_t elapsed_ns,
+                         uint32_t frames)
+{
+  printf("%-22s %12.0f %10.1f %12.2f %12.3f\n", label, device_seconds / (elapsed_ns / 1e9),
+         samples / (elapsed_ns / 1e3), (double)elapsed_ns / samples, elapsed_ns / 1e6 / frames);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t device_count = 1024;
+  uint32_t seconds = 60;
+  uint32_t sample_rate = 100;
+  uint16_t frame_samples = 50;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--devices") == 0 && has_value)
+      device_count = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--seconds") == 0 && has_value)
+      seconds = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--sample-rate") == 0 && has_value)
+      sample_rate = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--frame-samples") == 0 && has_value)
+      frame_samples = atoi(argv[++i]);
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (device_count == 0 || seconds == 0 || sample_rate == 0 || frame_samples == 0)
+  {
+    print_usage(argv[0]);
+    return 2;
+  }
+
+  uint32_t frame_count = (uint64_t)seconds * sample_rate / frame_samples;
+  uint32_t template_frames = (uint64_t)TEMPLATE_SECONDS * sample_rate / frame_samples;
+  if (template_frames == 0)
+    template_frames = 1;
+
+  std::vector<std::vector<decoded_frame>> templates(TEMPLATE_COUNT, std::vector<decoded_frame>(template_frames));
+  for (uint32_t i = 0; i < TEMPLATE_COUNT; i++)
+    make_frames(templates[i], i, sample_rate, frame_samples);
+
+  printf("%u devices, %u s at %u Hz in frames of %u samples, %u lanes per block\n\n", device_count, seconds,
+         sample_rate, frame_samples, ResidualEngine::LANES);
+  printf("%-22s %12s %10s %12s %12s\n", "", "device-s/s", "Msample/s", "ns/sample", "ms/fleet frame");
+
+  // The fleet in lockstep through one engine
+  ResidualEngine engine(default_residual_config());
+  std::vector<const decoded_frame *> frames(device_count);
+
+  for (uint32_t i = 0; i < device_count; i++)
+    engine.add_device(default_twin_model());
+
+  uint64_t start = now_ns();
+  for (uint32_t n = 0; n < frame_count; n++)
+  {
+    for (uint32_t i = 0; i < device_count; i++)
+      frames[i] = &templates[i % TEMPLATE_COUNT][n % template_frames];
+    engine.step(frames.data());
+  }
+  uint64_t batch_ns = now_ns() - start;
+  print_result("lockstep", engine.get_device_seconds(), engine.get_samples(), batch_ns, frame_count);
+
+  // The same frames through an engine of its own per device
+  std::vector<std::unique_ptr<ResidualEngine>> engines;
+  double device_seconds = 0;
+  uint64_t samples = 0;
+
+  for (uint32_t i = 0; i < device_count; i++)
+  {
+    engines.emplace_back(new ResidualEngine(default_residual_config()));
+    engines.back()->add_device(default_twin_model());
+  }
+
+  start = now_ns();
+  for (uint32_t n = 0; n < frame_count; n++)
+  {
+    for (uint32_t i = 0; i < device_count; i++)
+    {
+      const decoded_frame *frame = &templates[i % TEMPLATE_COUNT][n % template_frames];
+      engines[i]->step(&frame);
+    }
+  }
+  uint64_t single_ns = now_ns() - start;
+
+  for (auto &single : engines)
+  {
+    device_seconds += single->get_device_seconds();
+    samples += single->get_samples();
+  }
+  print_result("engine per device", device_seconds, samples, single_ns, frame_count);
+
+  printf("\nLockstep is %.1fx an engine per device, one core keeps up with %.0f devices at %u Hz\n",
+         (double)single_ns / batch_ns, engine.get_device_seconds() / (batch_ns / 1e9), sample_rate);
+
+  return 0;
+}
@@ -0,0 +1,272 @@
+// Includes
+#include "twin_residual.hpp"
+
+#include <math.h>
+
+twin_model default_twin_model()
+{
+  return {200, 40, 0.12, 8, 12};
+}
+
+// A healthy fleet motor stays within a few RPM of its twin and the current sensor's noise, 40 RPM
+// of added friction trips the velocity alarm within a few seconds
+residual_config default_residual_config()
+{
+  return {
+      .drift_time = 10,
+      .velocity_slack = 5,
+      .velocity_threshold = 20,
+      .current_slack = 20,
+      .current_threshold = 50,
+      .max_gap = 1,
+  };
+}
+
+ResidualEngine::ResidualEngine(const residual_config &config)
+{
+  this->config = config;
+  count = 0;
+  capacity = 0;
+  total_samples = 0;
+  device_seconds = 0;
+}
+
+uint32_t ResidualEngine::add_device(const twin_model &model)
+{
+  uint32_t device = count++;
+
+  if (count > capacity)
+  {
+    capacity += LANES;
+
+    for (std::vector<float> *lanes : {&gain, &dead_zone, &inverse_tau, &back_emf, &inverse_resistance, &supply,
+                                      &predicted, &velocity_residual, &current_residual, &velocity_mean,
+                                      &velocity_square, &current_mean, &current_square, &velocity_high,
+                                      &velocity_low, &current_high, &current_low, &velocity_alarm, &current_alarm,
+                                      &duty_in, &velocity_in, &current_in, &dt_in, &restart_in})
+      lanes->resize(capacity, 0);
+  }
+
+  last_time.push_back(0);
+  period.push_back(0);
+  samples.push_back(0);
+  alarm_time.push_back(0);
+
+  set_model(device, model);
+  return device;
+}
+
+void ResidualEngine::set_model(uint32_t device, const twin_model &model)
+{
+  gain[device] = model.gain;
+  dead_zone[device] = model.dead_zone;
+  inverse_tau[device] = 1 / model.time_constant;
+  back_emf[device] = model.supply / model.gain;
+  inverse_resistance[device] = 1 / model.resistance;
+  supply[device] = model.supply;
+}
+
+// Clears the statistics and alarms, the twin restarts from the next sample
+void ResidualEngine::reset_device(uint32_t device)
+{
+  for (std::vector<float> *lanes : {&predicted, &velocity_residual, &current_residual, &velocity_mean,
+                                    &velocity_square, &current_mean, &current_square, &velocity_high, &velocity_low,
+                                    &current_high, &current_low, &velocity_alarm, &current_alarm})
+    (*lanes)[device] = 0;
+
+  last_time[device] = 0;
+  period[device] = 0;
+  samples[device] = 0;
+  alarm_time[device] = 0;
+}
+
+uint32_t ResidualEngine::get_device_count()
+{
+  return count;
+}
+
+void ResidualEngine::step(const decoded_frame *const *frames)
+{
+  uint16_t longest = 0;
+
+  // Timestamps are whole ms, the samples of a frame are spread evenly over its span
+  for (uint32_t device = 0; device < count; device++)
+  {
+    const decoded_frame *frame = frames[device];
+
+    if (frame == nullptr || frame->count == 0)
+      continue;
+    if (frame->count > longest)
+      longest = frame->count;
+    if (frame->count > 1 && frame->timestamp[frame->count - 1] > frame->timestamp[0])
+      period[device] = (frame->timestamp[frame->count - 1] - frame->timestamp[0]) / 1000.0f / (frame->count - 1);
+  }
+
+  for (uint16_t k = 0; k < longest; k++)
+  {
+    for (uint32_t device = 0; device < count; device++)
+    {
+      const decoded_frame *frame = frames[device];
+
+      if (frame == nullptr || k >= frame->count)
+      {
+        dt_in[device] = 0;
+        restart_in[device] = 0;
+        continue;
+      }
+
+      uint64_t time = frame->timestamp[k];
+      float dt = period[device];
+      bool restart = last_time[device] == 0 || time < last_time[device] ||
+                     time - last_time[device] > config.max_gap * 1000;
+
+      // A lone sample, too short a frame to show its period
+      if (dt == 0)
+      {
+        dt = last_time[device] != 0 && !restart ? (time - last_time[device]) / 1000.0f : 0;
+        restart = restart || dt == 0;
+      }
+
+      duty_in[device] = frame->duty_cycle[k];
+      velocity_in[device] = frame->velocity[k];
+      current_in[device] = frame->current[k];
+      dt_in[device] = restart ? 0 : dt;
+      restart_in[device] = restart ? 1 : 0;
+
+      last_time[device] = time;
+      total_samples++;
+      if (!restart)
+      {
+        samples[device]++;
+        device_seconds += dt;
+      }
+    }
+
+    step_lanes();
+  }
+
+  for (uint32_t device = 0; device < count; device++)
+  {
+    const decoded_frame *frame = frames[device];
+
+    if (frame != nullptr && frame->count > 0 && alarm_time[device] == 0 &&
+        (velocity_alarm[device] > 0 || current_alarm[device] > 0))
+      alarm_time[device] = frame->timestamp[frame->count - 1];
+  }
+}
+
+// One lockstep sample of every lane. Blends rather than branches, so each statement maps onto
+// vector instructions across devices. Lanes without a sample, and restarting ones, have dt 0 and
+// keep their statistics. The former still hold their last inputs, so their residuals come out
+// as they were, and a restart's are 0.
+void ResidualEngine::step_lanes()
+{
+  const float *lane_gain = gain.data();
+  const float *lane_dead_zone = dead_zone.data();
+  const float *lane_inverse_tau = inverse_tau.data();
+  const float *lane_back_emf = back_emf.data();
+  const float *lane_inverse_resistance = inverse_resistance.data();
+  const float *lane_supply = supply.data();
+  const float *duty = duty_in.data();
+  const float *velocity = velocity_in.data();
+  const float *current = current_in.data();
+  const float *dt = dt_in.data();
+  const float *restart = restart_in.data();
+
+  float *twin = predicted.data();
+  float *residual_v = velocity_residual.data();
+  float *residual_c = current_residual.data();
+  float *mean_v = velocity_mean.data();
+  float *square_v = velocity_square.data();
+  float *mean_c = current_mean.data();
+  float *square_c = current_square.data();
+  float *high_v = velocity_high.data();
+  float *low_v = velocity_low.data();
+  float *high_c = current_high.data();
+  float *low_c = current_low.data();
+  float *alarm_v = velocity_alarm.data();
+  float *alarm_c = current_alarm.data();
+
+  const float drift_time = config.drift_time;
+  const float slack_v = config.velocity_slack;
+  const float threshold_v = config.velocity_threshold;
+  const float slack_c = config.current_slack;
+  const float threshold_c = config.current_threshold;
+  const uint32_t lanes = capacity;
+
+  // The columns are separate vectors, but GCC ignores restrict on locals and gives up on checking
+  // two dozen of them for overlap at run time
+#if defined(__clang__)
+#pragma clang loop vectorize(assume_safety)
+#elif defined(__GNUC__)
+#pragma GCC ivdep
+#endif
+  for (uint32_t i = 0; i < lanes; i++)
+  {
+    float step = dt[i];
+
+    // Euler step towards the duty's steady state, as the fleet's MotorModel integrates
+    float magnitude = lane_gain[i] * fabsf(duty[i]) - lane_dead_zone[i];
+    magnitude = magnitude > 0 ? magnitude : 0;
+    float rate = step * lane_inverse_tau[i];
+    rate = rate < 1 ? rate : 1;
+    float next = twin[i] + rate * (copysignf(magnitude, duty[i]) - twin[i]);
+    twin[i] = next + restart[i] * (velocity[i] - next);
+
+    float expected_current =
+        1000 * (lane_supply[i] * duty[i] - lane_back_emf[i] * velocity[i]) * lane_inverse_resistance[i];
+    float rv = velocity[i] - twin[i];
+    float rc = current[i] - expected_current;
+    residual_v[i] = rv;
+    residual_c[i] = rc;
+
+    float weight = step / (drift_time + step);
+    mean_v[i] += weight * (rv - mean_v[i]);
+    square_v[i] += weight * (rv * rv - square_v[i]);
+    mean_c[i] += weight * (rc - mean_c[i]);
+    square_c[i] += weight * (rc * rc - square_c[i]);
+
+    // CUSUM over time rather than samples, so thresholds hold whatever the sample rate
+    float hv = high_v[i] + (rv - slack_v) * step;
+    float lv = low_v[i] + (-rv - slack_v) * step;
+    float hc = high_c[i] + (rc - slack_c) * step;
+    float lc = low_c[i] + (-rc - slack_c) * step;
+    high_v[i] = hv > 0 ? hv : 0;
+    low_v[i] = lv > 0 ? lv : 0;
+    high_c[i] = hc > 0 ? hc : 0;
+    low_c[i] = lc > 0 ? lc : 0;
+
+    float trip_v = hv > threshold_v || lv > threshold_v ? 1.0f : 0.0f;
+    float trip_c = hc > threshold_c || lc > threshold_c ? 1.0f : 0.0f;
+    alarm_v[i] = alarm_v[i] > trip_v ? alarm_v[i] : trip_v;
+    alarm_c[i] = alarm_c[i] > trip_c ? alarm_c[i] : trip_c;
+  }
+}
+
+device_residuals ResidualEngine::get_residuals(uint32_t device)
+{
+  return {
+      .samples = samples[device],
+      .velocity = velocity_residual[device],
+      .current = current_residual[device],
+      .velocity_mean = velocity_mean[device],
+      .velocity_rms = sqrtf(velocity_square[device]),
+      .current_mean = current_mean[device],
+      .current_rms = sqrtf(current_square[device]),
+      .velocity_cusum = fmaxf(velocity_high[device], velocity_low[device]),
+      .current_cusum = fmaxf(current_high[device], current_low[device]),
+      .velocity_alarm = velocity_alarm[device] > 0,
+      .current_alarm = current_alarm[device] > 0,
+      .alarm_time = alarm_time[device],
+  };
+}
+
+uint64_t ResidualEngine::get_samples()
+{
+  return total_samples;
+}
+
+double ResidualEngine::get_device_seconds()
+{
+  return device_seconds;
+}
@@ -0,0 +1,129 @@
+#ifndef TWIN_RESIDUAL_H_
+#define TWIN_RESIDUAL_H_
+
+// Includes
+#include <stdint.h>
+#include <vector>
+
+#include "frame_decoder.hpp"
+
+// Healthy-motor twins of a fleet, checked against every telemetry frame. Each device's twin is
+// the first-order plant system identification fits, driven open loop by the duty cycle the
+// station reports, so its velocity is what a healthy motor would have done. Current is predicted
+// from the duty and the measured velocity's back EMF. The residuals, measured less predicted,
+// feed a slow mean and RMS and a two-sided CUSUM per channel, which raises a sticky alarm once
+// the residual has stayed beyond its slack for long enough, as a worn gearbox's added friction
+// makes it do.
+//
+// The twins are kept as structure of arrays, one lane per device padded to a whole number of
+// vector registers, and step in lockstep: sample k of every device's frame is one branch-free
+// pass over all the lanes, which the compiler vectorises across devices.
+
+// Healthy motor, by default the fleet's MotorModel
+typedef struct
+{
+  float gain;          // RPM per unit duty
+  float dead_zone;     // RPM, the motor stalls below it
+  float time_constant; // s
+  float resistance;    // Winding resistance in ohms
+  float supply;        // V
+} twin_model;
+
+typedef struct
+{
+  float drift_time;         // s, time constant of the residual mean and RMS
+  float velocity_slack;     // RPM a healthy velocity residual stays within
+  float velocity_threshold; // RPM s beyond the slack that raises the alarm
+  float current_slack;      // mA
+  float current_threshold;  // mA s
+  float max_gap;            // s between samples that restarts a twin from the measurement
+} residual_config;
+
+typedef struct
+{
+  uint64_t samples;    // Scored, restarts excluded
+  float velocity;      // Latest residuals
+  float current;
+  float velocity_mean; // Over the drift time
+  float velocity_rms;
+  float current_mean;
+  float current_rms;
+  float velocity_cusum; // Larger side, RPM s or mA s
+  float current_cusum;
+  bool velocity_alarm;
+  bool current_alarm;
+  uint64_t alarm_time; // Last timestamp of the frame the first alarm was raised in, 0 without
+} device_residuals;
+
+twin_model default_twin_model();
+residual_config default_residual_config();
+
+class ResidualEngine
+{
+public:
+  static constexpr uint32_t LANES = 16; // Devices per padded block, an AVX-512 register of floats
+
+private:
+  // Class variables
+  residual_config config;
+  uint32_t count;
+  uint32_t capacity; // count rounded up to LANES
+
+  // Per device, 0 in the padding lanes
+  std::vector<float> gain;
+  std::vector<float> dead_zone;
+  std::vector<float> inverse_tau;
+  std::vector<float> back_emf;   // V per RPM
+  std::vector<float> inverse_resistance;
+  std::vector<float> supply;
+
+  std::vector<float> predicted; // Twin velocity
+  std::vector<float> velocity_residual;
+  std::vector<float> current_residual;
+  std::vector<float> velocity_mean;
+  std::vector<float> velocity_square;
+  std::vector<float> current_mean;
+  std::vector<float> current_square;
+  std::vector<float> velocity_high; // CUSUM sides
+  std::vector<float> velocity_low;
+  std::vector<float> current_high;
+  std::vector<float> current_low;
+  std::vector<float> velocity_alarm; // 0 or 1
+  std::vector<float> current_alarm;
+
+  // Inputs of one lockstep sample, dt 0 where a device has none
+  std::vector<float> duty_in;
+  std::vector<float> velocity_in;
+  std::vector<float> current_in;
+  std::vector<float> dt_in;
+  std::vector<float> restart_in; // 1 restarts the twin from the measurement, unscored
+
+  std::vector<float> period; // s between samples of the device's latest frame
+
+  std::vector<uint64_t> last_time; // ms, 0 before a device's first sample
+  std::vector<uint64_t> samples;
+  std::vector<uint64_t> alarm_time;
+
+  uint64_t total_samples;
+  double device_seconds;
+
+  void step_lanes();
+
+public:
+  ResidualEngine(const residual_config &config);
+
+  // Returns the device's index, frames are given in that order
+  uint32_t add_device(const twin_model &model);
+  void set_model(uint32_t device, const twin_model &model);
+  void reset_device(uint32_t device);
+  uint32_t get_device_count();
+
+  // One frame or nullptr per device, stepped together sample by sample
+  void step(const decoded_frame *const *frames);
+
+  device_residuals get_residuals(uint32_t device);
+  uint64_t get_samples();       // Over all devices
+  double get_device_seconds();  // Simulated, over all devices
+};
+
+#endif // TWIN_RESIDUAL_H_
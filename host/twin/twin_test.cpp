@@ -0,0 +1,144 @@
+// Includes
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#include "check.hpp"
+#include "motor_model.hpp"
+#include "twin_residual.hpp"
+
+// A fleet of the stations' motor models checked by one engine: healthy motors must stay quiet
+// through gaps in their telemetry and at a different sample rate, a motor whose gearbox wears
+// partway through must raise the velocity alarm within seconds, and each lane must give exactly
+// what an engine of that device alone gives.
+
+static constexpr uint32_t DEVICE_COUNT = 13; // Not a whole number of lanes
+static constexpr uint32_t SAMPLE_RATE = 100;
+static constexpr uint16_t FRAME_SAMPLES = 50;
+static constexpr uint32_t FRAME_COUNT = 120; // 60 s
+
+static constexpr uint32_t WORN_DEVICE = 4;
+static constexpr uint32_t WORN_FRAME = 40;   // Wears from 20 s
+static constexpr float WORN_DEAD_ZONE = 80;  // Twice the healthy friction
+static constexpr uint32_t GAP_DEVICE = 7;
+static constexpr uint32_t GAP_FRAME = 60;    // Three frames lost from 30 s
+static constexpr uint32_t GAP_FRAMES = 3;
+static constexpr uint32_t FAST_DEVICE = 9;   // Samples ten times faster, same frame period
+
+static constexpr uint64_t START_MS = 1700000000000ULL;
+
+// Samples a frame of the motor as a station does, stepping between set points every 2 s
+static void sample_frame(MotorModel &motor, uint32_t device, uint64_t &sample_time_us, uint32_t sample_rate,
+                         uint16_t samples, decoded_frame &frame)
+{
+  uint64_t period_us = 1000000 / sample_rate;
+
+  frame.count = samples;
+  frame.timestamp.resize(samples);
+  frame.gain.resize(samples);
+  frame.duty_cycle.resize(samples);
+  frame.velocity.resize(samples);
+  frame.position.resize(samples);
+  frame.current.resize(samples);
+
+  for (uint16_t i = 0; i < samples; i++)
+  {
+    uint64_t phase = (sample_time_us + device * 997 * 1000) % 4000000;
+    motor.set_velocity_sp(phase < 2000000 ? 60 : 120);
+    motor.step(1.0f / sample_rate);
+    sample_time_us += period_us;
+
+    frame.timestamp[i] = START_MS + sample_time_us / 1000;
+    frame.gain[i] = motor.get_gain();
+    frame.duty_cycle[i] = motor.get_duty_cycle();
+    frame.velocity[i] = motor.get_velocity();
+    frame.position[i] = motor.get_position();
+    frame.current[i] = motor.get_current();
+  }
+}
+
+int main()
+{
+  ResidualEngine engine(default_residual_config());
+  ResidualEngine alone(default_residual_config());
+  std::vector<MotorModel> motors;
+  std::vector<uint64_t> sample_time_us(DEVICE_COUNT, 0);
+  std::vector<decoded_frame> frames(DEVICE_COUNT);
+  std::vector<const decoded_frame *> step_frames(DEVICE_COUNT);
+  bool lanes_match = true;
+
+  for (uint32_t i = 0; i < DEVICE_COUNT; i++)
+  {
+    motors.emplace_back(i);
+    engine.add_device(default_twin_model());
+  }
+  alone.add_device(default_twin_model());
+  check(engine.get_device_count() == DEVICE_COUNT, "one twin per device");
+
+  for (uint32_t n = 0; n < FRAME_COUNT; n++)
+  {
+    if (n == WORN_FRAME)
+      motors[WORN_DEVICE].set_dead_zone(WORN_DEAD_ZONE);
+
+    for (uint32_t i = 0; i < DEVICE_COUNT; i++)
+    {
+      bool fast = i == FAST_DEVICE;
+
+      sample_frame(motors[i], i, sample_time_us[i], fast ? SAMPLE_RATE * 10 : SAMPLE_RATE,
+                   fast ? FRAME_SAMPLES * 10 : FRAME_SAMPLES, frames[i]);
+      step_frames[i] = &frames[i];
+    }
+
+    // The gap device's frames are sampled but never arrive
+    if (n >= GAP_FRAME && n < GAP_FRAME + GAP_FRAMES)
+      step_frames[GAP_DEVICE] = nullptr;
+
+    engine.step(step_frames.data());
+    alone.step(&step_frames[WORN_DEVICE]);
+
+    device_residuals batch = engine.get_residuals(WORN_DEVICE);
+    device_residuals single = alone.get_residuals(0);
+    lanes_match = lanes_match && batch.velocity == single.velocity && batch.current == single.current &&
+                  batch.velocity_cusum == single.velocity_cusum && batch.current_mean == single.current_mean;
+  }
+
+  bool healthy_quiet = true;
+  bool healthy_close = true;
+  for (uint32_t i = 0; i < DEVICE_COUNT; i++)
+  {
+    device_residuals residuals = engine.get_residuals(i);
+
+    if (i == WORN_DEVICE)
+      continue;
+    healthy_quiet = healthy_quiet && !residuals.velocity_alarm && !residuals.current_alarm;
+    healthy_close = healthy_close && residuals.velocity_rms < 1 && residuals.current_rms < 5;
+  }
+  check(healthy_quiet, "no alarm on a healthy motor, through a gap and at ten times the sample rate");
+  check(healthy_close, "healthy residuals stay within the sensor noise");
+
+  device_residuals worn = engine.get_residuals(WORN_DEVICE);
+  uint64_t worn_ms = START_MS + (uint64_t)WORN_FRAME * FRAME_SAMPLES * 1000 / SAMPLE_RATE;
+  check(worn.velocity_alarm, "added friction raises the velocity alarm");
+  check(!worn.current_alarm, "the winding stays healthy");
+  check(worn.velocity_mean < -5, "the worn motor runs slower than its twin");
+  check(worn.alarm_time > worn_ms && worn.alarm_time < worn_ms + 10000, "the alarm is raised within 10 s of wear");
+  printf("Worn motor: alarm %.1f s after wear, velocity residual mean %.1f RPM, RMS %.1f RPM\n",
+         (worn.alarm_time - worn_ms) / 1000.0, worn.velocity_mean, worn.velocity_rms);
+
+  device_residuals gap = engine.get_residuals(GAP_DEVICE);
+  device_residuals full = engine.get_residuals(0);
+  check(gap.samples < full.samples, "samples across a gap restart the twin unscored");
+  check(engine.get_residuals(FAST_DEVICE).samples > 9 * full.samples, "the fast device is scored at its own rate");
+
+  check(lanes_match, "a lane of the batch matches the device's engine alone");
+
+  double seconds = FRAME_COUNT * FRAME_SAMPLES / (double)SAMPLE_RATE;
+  check(fabs(engine.get_device_seconds() - DEVICE_COUNT * seconds) < DEVICE_COUNT * seconds * 0.01,
+        "device-seconds add up to the fleet's simulated time");
+
+  engine.reset_device(WORN_DEVICE);
+  worn = engine.get_residuals(WORN_DEVICE);
+  check(!worn.velocity_alarm && worn.alarm_time == 0 && worn.samples == 0, "a reset clears the alarm");
+
+  return check_summary();
+}
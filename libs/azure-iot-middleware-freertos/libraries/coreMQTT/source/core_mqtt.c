@@ -237,13 +237,51 @@ static MQTTStatus_t validateSubscribeUnsubscribeParams( const MQTTContext_t * pC
  * @brief param[in] pContext Initialized MQTT context.
  * @brief param[in] pPublishInfo MQTT PUBLISH packet parameters.
  * @brief param[in] headerSize Header size of the PUBLISH packet.
+ * @brief param[in] producer Payload producer, or NULL to send the payload buffer.
+ * @brief param[in] pProducerContext Context passed to @p producer.
  *
  * @return #MQTTSendFailed if transport write failed;
  * #MQTTSuccess otherwise.
  */
 static MQTTStatus_t sendPublish( MQTTContext_t * pContext,
                                  const MQTTPublishInfo_t * pPublishInfo,
-                                 size_t headerSize );
+                                 size_t headerSize,
+                                 MQTTPayloadProducer_t producer,
+                                 void * pProducerContext );
+
+/**
+ * @brief Send a publish payload pulled from a producer, one network buffer at
+ * a time. Only valid once the PUBLISH header has been sent.
+ *
+ * @brief param[in] pContext Initialized MQTT context.
+ * @brief param[in] payloadLength Total length of the payload.
+ * @brief param[in] producer Payload producer.
+ * @brief param[in] pProducerContext Context passed to @p producer.
+ *
+ * @return #MQTTSendFailed if transport write failed or the producer aborted;
+ * #MQTTSuccess otherwise.
+ */
+static MQTTStatus_t sendPublishPayloadStream( MQTTContext_t * pContext,
+                                              size_t payloadLength,
+                                              MQTTPayloadProducer_t producer,
+                                              void * pProducerContext );
+
+/**
+ * @brief Serialize, send and track a PUBLISH packet.
+ *
+ * @brief param[in] pContext Initialized MQTT context.
+ * @brief param[in] pPublishInfo MQTT PUBLISH packet parameters.
+ * @brief param[in] packetId Packet ID of the PUBLISH.
+ * @brief param[in] producer Payload producer, or NULL to send the payload buffer.
+ * @brief param[in] pProducerContext Context passed to @p producer.
+ *
+ * @return The result of #MQTT_Publish or #MQTT_PublishStream.
+ */
+static MQTTStatus_t publishPacket( MQTTContext_t * pContext,
+                                   const MQTTPublishInfo_t * pPublishInfo,
+                                   uint16_t packetId,
+                                   MQTTPayloadProducer_t producer,
+                                   void * pProducerContext );
 
 /**
  * @brief Receives a CONNACK MQTT packet.
@@ -302,13 +340,15 @@ static MQTTStatus_t serializePublish( const MQTTContext_t * pContext,
  * @brief param[in] pContext Initialized MQTT context.
  * @brief param[in] pPublishInfo MQTT PUBLISH packet parameters.
  * @brief param[in] packetId Packet Id for the MQTT PUBLISH packet.
+ * @brief param[in] payloadStreamed Whether the payload comes from a producer.
  *
  * @return #MQTTBadParameter if invalid parameters are passed;
  * #MQTTSuccess otherwise.
  */
 static MQTTStatus_t validatePublishParams( const MQTTContext_t * pContext,
                                            const MQTTPublishInfo_t * pPublishInfo,
-                                           uint16_t packetId );
+                                           uint16_t packetId,
+                                           bool payloadStreamed );
 
 /**
  * @brief Performs matching for special cases when a topic filter ends
@@ -1391,9 +1431,67 @@ static MQTTStatus_t validateSubscribeUnsubscribeParams( const MQTTContext_t * pC
 
 /*-----------------------------------------------------------*/
 
+static MQTTStatus_t sendPublishPayloadStream( MQTTContext_t * pContext,
+                                              size_t payloadLength,
+                                              MQTTPayloadProducer_t producer,
+                                              void * pProducerContext )
+{
+    MQTTStatus_t status = MQTTSuccess;
+    size_t bytesRemaining = payloadLength;
+    size_t chunkSize = 0U;
+    int32_t bytesSent = 0;
+
+    assert( pContext != NULL );
+    assert( producer != NULL );
+
+    while( ( bytesRemaining > 0U ) && ( status == MQTTSuccess ) )
+    {
+        chunkSize = ( bytesRemaining < pContext->networkBuffer.size ) ?
+                    bytesRemaining : pContext->networkBuffer.size;
+        chunkSize = producer( pProducerContext,
+                              pContext->networkBuffer.pBuffer,
+                              chunkSize );
+
+        if( ( chunkSize == 0U ) || ( chunkSize > bytesRemaining ) )
+        {
+            LogError( ( "Payload producer failed with %lu bytes of PUBLISH payload left.",
+                        ( unsigned long ) bytesRemaining ) );
+            status = MQTTSendFailed;
+        }
+        else
+        {
+            bytesSent = sendPacket( pContext,
+                                    pContext->networkBuffer.pBuffer,
+                                    chunkSize );
+
+            if( bytesSent < ( int32_t ) chunkSize )
+            {
+                LogError( ( "Transport send failed for PUBLISH payload." ) );
+                status = MQTTSendFailed;
+            }
+            else
+            {
+                bytesRemaining -= chunkSize;
+            }
+        }
+    }
+
+    if( status == MQTTSuccess )
+    {
+        LogDebug( ( "Sent %lu bytes of streamed PUBLISH payload.",
+                    ( unsigned long ) payloadLength ) );
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
 static MQTTStatus_t sendPublish( MQTTContext_t * pContext,
                                  const MQTTPublishInfo_t * pPublishInfo,
-                                 size_t headerSize )
+                                 size_t headerSize,
+                                 MQTTPayloadProducer_t producer,
+                                 void * pProducerContext )
 {
     MQTTStatus_t status = MQTTSuccess;
     int32_t bytesSent = 0;
@@ -1402,7 +1500,7 @@ static MQTTStatus_t sendPublish( MQTTContext_t * pContext,
     assert( pPublishInfo != NULL );
     assert( headerSize > 0 );
     assert( pContext->networkBuffer.pBuffer != NULL );
-    assert( !( pPublishInfo->payloadLength > 0 ) || ( pPublishInfo->pPayload != NULL ) );
+    assert( !( pPublishInfo->payloadLength > 0 ) || ( pPublishInfo->pPayload != NULL ) || ( producer != NULL ) );
 
     /* Send header first. */
     bytesSent = sendPacket( pContext,
@@ -1421,7 +1519,14 @@ static MQTTStatus_t sendPublish( MQTTContext_t * pContext,
 
         /* Send Payload if there is one to send. It is valid for a PUBLISH
          * Packet to contain a zero length payload.*/
-        if( pPublishInfo->payloadLength > 0U )
+        if( ( pPublishInfo->payloadLength > 0U ) && ( producer != NULL ) )
+        {
+            status = sendPublishPayloadStream( pContext,
+                                               pPublishInfo->payloadLength,
+                                               producer,
+                                               pProducerContext );
+        }
+        else if( pPublishInfo->payloadLength > 0U )
         {
             bytesSent = sendPacket( pContext,
                                     pPublishInfo->pPayload,
@@ -1651,7 +1756,8 @@ static MQTTStatus_t serializePublish( const MQTTContext_t * pContext,
 
 static MQTTStatus_t validatePublishParams( const MQTTContext_t * pContext,
                                            const MQTTPublishInfo_t * pPublishInfo,
-                                           uint16_t packetId )
+                                           uint16_t packetId,
+                                           bool payloadStreamed )
 {
     MQTTStatus_t status = MQTTSuccess;
 
@@ -1670,7 +1776,8 @@ static MQTTStatus_t validatePublishParams( const MQTTContext_t * pContext,
                     ( unsigned int ) pPublishInfo->qos ) );
         status = MQTTBadParameter;
     }
-    else if( ( pPublishInfo->payloadLength > 0U ) && ( pPublishInfo->pPayload == NULL ) )
+    else if( ( pPublishInfo->payloadLength > 0U ) && ( pPublishInfo->pPayload == NULL ) &&
+             ( payloadStreamed == false ) )
     {
         LogError( ( "A nonzero payload length requires a non-NULL payload: "
                     "payloadLength=%lu, pPayload=%p.",
@@ -1904,15 +2011,18 @@ MQTTStatus_t MQTT_Subscribe( MQTTContext_t * pContext,
 
 /*-----------------------------------------------------------*/
 
-MQTTStatus_t MQTT_Publish( MQTTContext_t * pContext,
-                           const MQTTPublishInfo_t * pPublishInfo,
-                           uint16_t packetId )
+static MQTTStatus_t publishPacket( MQTTContext_t * pContext,
+                                   const MQTTPublishInfo_t * pPublishInfo,
+                                   uint16_t packetId,
+                                   MQTTPayloadProducer_t producer,
+                                   void * pProducerContext )
 {
     size_t headerSize = 0UL;
     MQTTPublishState_t publishStatus = MQTTStateNull;
 
     /* Validate arguments. */
-    MQTTStatus_t status = validatePublishParams( pContext, pPublishInfo, packetId );
+    MQTTStatus_t status = validatePublishParams( pContext, pPublishInfo, packetId,
+                                                 ( producer != NULL ) );
 
     if( status == MQTTSuccess )
     {
@@ -1944,7 +2054,9 @@ MQTTStatus_t MQTT_Publish( MQTTContext_t * pContext,
         /* Sends the serialized publish packet over network. */
         status = sendPublish( pContext,
                               pPublishInfo,
-                              headerSize );
+                              headerSize,
+                              producer,
+                              pProducerContext );
     }
 
     if( ( status == MQTTSuccess ) && ( pPublishInfo->qos > MQTTQoS0 ) )
@@ -1978,6 +2090,38 @@ MQTTStatus_t MQTT_Publish( MQTTContext_t * pContext,
 
 /*-----------------------------------------------------------*/
 
+MQTTStatus_t MQTT_Publish( MQTTContext_t * pContext,
+                           const MQTTPublishInfo_t * pPublishInfo,
+                           uint16_t packetId )
+{
+    return publishPacket( pContext, pPublishInfo, packetId, NULL, NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTT_PublishStream( MQTTContext_t * pContext,
+                                 const MQTTPublishInfo_t * pPublishInfo,
+                                 uint16_t packetId,
+                                 MQTTPayloadProducer_t producer,
+                                 void * pProducerContext )
+{
+    MQTTStatus_t status = MQTTSuccess;
+
+    if( producer == NULL )
+    {
+        LogError( ( "Argument cannot be NULL: producer=NULL." ) );
+        status = MQTTBadParameter;
+    }
+    else
+    {
+        status = publishPacket( pContext, pPublishInfo, packetId, producer, pProducerContext );
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
 MQTTStatus_t MQTT_Ping( MQTTContext_t * pContext )
 {
     int32_t bytesSent = 0;
@@ -516,6 +516,49 @@ MQTTStatus_t MQTT_Publish( MQTTContext_t * pContext,
                            uint16_t packetId );
 /* @[declare_mqtt_publish] */
 
+/**
+ * @brief Writes the next part of a payload sent with #MQTT_PublishStream.
+ *
+ * @param[in] pProducerContext The context passed to #MQTT_PublishStream.
+ * @param[out] pBuffer Buffer to write the payload into.
+ * @param[in] bufferSize Bytes available in @p pBuffer, never more than are
+ * left of the payload.
+ *
+ * @return The number of bytes written, or 0 to abort the publish.
+ */
+typedef size_t ( * MQTTPayloadProducer_t )( void * pProducerContext,
+                                            uint8_t * pBuffer,
+                                            size_t bufferSize );
+
+/**
+ * @brief Publishes a message whose payload is pulled from a producer callback
+ * instead of a contiguous buffer.
+ *
+ * The PUBLISH header is sent first, after which the network buffer is reused
+ * to hold one part of the payload at a time. The payload therefore never has
+ * to exist in memory as a whole.
+ *
+ * @param[in] pContext Initialized MQTT context.
+ * @param[in] pPublishInfo MQTT PUBLISH packet parameters. The payload length
+ * must be the total the producer will write, the payload pointer is ignored.
+ * @param[in] packetId packet ID generated by #MQTT_GetPacketId.
+ * @param[in] producer Callback writing the payload.
+ * @param[in] pProducerContext Context passed to @p producer.
+ *
+ * @return #MQTTNoMemory if pBuffer is too small to hold the PUBLISH header;
+ * #MQTTBadParameter if invalid parameters are passed;
+ * #MQTTSendFailed if transport write failed or the producer aborted, in which
+ * case a partial packet has been sent and the connection must be closed;
+ * #MQTTSuccess otherwise.
+ */
+/* @[declare_mqtt_publishstream] */
+MQTTStatus_t MQTT_PublishStream( MQTTContext_t * pContext,
+                                 const MQTTPublishInfo_t * pPublishInfo,
+                                 uint16_t packetId,
+                                 MQTTPayloadProducer_t producer,
+                                 void * pProducerContext );
+/* @[declare_mqtt_publishstream] */
+
 /**
  * @brief Sends an MQTT PINGREQ to broker.
  *
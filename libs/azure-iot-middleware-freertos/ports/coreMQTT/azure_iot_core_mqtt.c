@@ -143,6 +143,21 @@ AzureIoTMQTTResult_t AzureIoTMQTT_Publish( AzureIoTMQTTHandle_t xContext,
     return prvTranslateToAzureIoTMQTTResult( xResult );
 }
 
+AzureIoTMQTTResult_t AzureIoTMQTT_PublishStream( AzureIoTMQTTHandle_t xContext,
+                                                 const AzureIoTMQTTPublishInfo_t * pxPublishInfo,
+                                                 uint16_t usPacketId,
+                                                 AzureIoTMQTTPayloadProducer_t xProducer,
+                                                 void * pvProducerContext )
+{
+    MQTTStatus_t xResult;
+
+    xResult = MQTT_PublishStream( xContext, ( const MQTTPublishInfo_t * ) pxPublishInfo,
+                                  usPacketId, ( MQTTPayloadProducer_t ) xProducer,
+                                  pvProducerContext );
+
+    return prvTranslateToAzureIoTMQTTResult( xResult );
+}
+
 AzureIoTMQTTResult_t AzureIoTMQTT_Ping( AzureIoTMQTTHandle_t xContext )
 {
     MQTTStatus_t xResult;
@@ -43,6 +43,7 @@
 #define azureiothubTOPIC_SUBSCRIBE_STATE_NONE (0x0)
 #define azureiothubTOPIC_SUBSCRIBE_STATE_SUB (0x1)
 #define azureiothubTOPIC_SUBSCRIBE_STATE_SUBACK (0x2)
+#define azureiothubTOPIC_SUBSCRIBE_STATE_FAILED (0x3)
 
 /*
  * Indexes of the receive context buffer for each feature
@@ -110,8 +111,8 @@ static void prvMQTTProcessSuback(AzureIoTHubClient_t *pxAzureIoTHubClient,
 {
     uint32_t ulIndex;
     AzureIoTHubClientReceiveContext_t *pxContext;
-
-    (void)pxIncomingPacket;
+    uint8_t *pucStatusCodes;
+    size_t xStatusCodeCount;
 
     configASSERT(pxIncomingPacket != NULL);
     configASSERT((azureiotmqttGET_PACKET_TYPE(pxIncomingPacket->ucType)) == azureiotmqttPACKET_TYPE_SUBACK);
@@ -122,9 +123,21 @@ static void prvMQTTProcessSuback(AzureIoTHubClient_t *pxAzureIoTHubClient,
 
         if (pxContext->_internal.usMqttSubPacketID == usPacketID)
         {
-            /* We assume success since IoT Hub would disconnect if there was a problem subscribing. */
-            pxContext->_internal.usState = azureiothubTOPIC_SUBSCRIBE_STATE_SUBACK;
-            AZLogInfo(("Suback receive context found: 0x%08x", (uint16_t)ulIndex));
+            /* Each SUBSCRIBE carries a single topic filter, so the SUBACK carries a single code. */
+            if ((AzureIoTMQTT_GetSubAckStatusCodes(pxIncomingPacket, &pucStatusCodes,
+                                                   &xStatusCodeCount) != eAzureIoTMQTTSuccess) ||
+                (xStatusCodeCount == 0) ||
+                (pucStatusCodes[0] == eMQTTSubAckFailure))
+            {
+                pxContext->_internal.usState = azureiothubTOPIC_SUBSCRIBE_STATE_FAILED;
+                AZLogError(("Subscription rejected for receive context: 0x%08x", (uint16_t)ulIndex));
+            }
+            else
+            {
+                pxContext->_internal.usState = azureiothubTOPIC_SUBSCRIBE_STATE_SUBACK;
+                AZLogInfo(("Suback receive context found: 0x%08x", (uint16_t)ulIndex));
+            }
+
             break;
         }
     }
@@ -453,8 +466,42 @@ static AzureIoTResult_t prvGetPropertiesRequestId(AzureIoTHubClient_t *pxAzureIo
 }
 /*-----------------------------------------------------------*/
 
+/**
+ * Count the receive contexts whose sub-ack is still outstanding, and whether any was rejected.
+ *
+ **/
+static uint32_t prvPendingSubAcks(AzureIoTHubClient_t *pxAzureIoTHubClient,
+                                  bool *pxRejected)
+{
+    uint32_t ulIndex;
+    uint32_t ulPending = 0;
+    uint16_t usState;
+
+    *pxRejected = false;
+
+    for (ulIndex = 0; ulIndex < azureiothubSUBSCRIBE_FEATURE_COUNT; ulIndex++)
+    {
+        usState = pxAzureIoTHubClient->_internal.xReceiveContext[ulIndex]._internal.usState;
+
+        if (usState == azureiothubTOPIC_SUBSCRIBE_STATE_SUB)
+        {
+            ulPending++;
+        }
+        else if (usState == azureiothubTOPIC_SUBSCRIBE_STATE_FAILED)
+        {
+            *pxRejected = true;
+        }
+    }
+
+    return ulPending;
+}
+/*-----------------------------------------------------------*/
+
 /**
  * Do blocking wait for sub-ack of particular receive context.
+ * A zero timeout does not wait, the sub-ack is confirmed by the next wait with a timeout. That
+ * wait lasts until every outstanding sub-ack has arrived and fails if any subscription was
+ * rejected, so a pipelined subscribe is not left unchecked.
  *
  **/
 static AzureIoTResult_t prvWaitForSubAck(AzureIoTHubClient_t *pxAzureIoTHubClient,
@@ -462,15 +509,23 @@ static AzureIoTResult_t prvWaitForSubAck(AzureIoTHubClient_t *pxAzureIoTHubClien
                                          uint32_t ulTimeoutMilliseconds)
 {
     AzureIoTResult_t xResult = eAzureIoTErrorSubackWaitTimeout;
+    AzureIoTHubClientReceiveContext_t *pxRejectedContext;
     uint32_t ulWaitTime;
+    uint32_t ulIndex;
+    bool xRejected;
+
+    if (ulTimeoutMilliseconds == 0)
+    {
+        AZLogDebug(("Not waiting for sub ack id: %d", pxContext->_internal.usMqttSubPacketID));
+        return eAzureIoTSuccess;
+    }
 
     AZLogDebug(("Waiting for sub ack id: %d", pxContext->_internal.usMqttSubPacketID));
 
     do
     {
-        if (pxContext->_internal.usState == azureiothubTOPIC_SUBSCRIBE_STATE_SUBACK)
+        if (prvPendingSubAcks(pxAzureIoTHubClient, &xRejected) == 0)
         {
-            xResult = eAzureIoTSuccess;
             break;
         }
 
@@ -492,9 +547,31 @@ static AzureIoTResult_t prvWaitForSubAck(AzureIoTHubClient_t *pxAzureIoTHubClien
         }
     } while (ulTimeoutMilliseconds);
 
-    if (pxContext->_internal.usState == azureiothubTOPIC_SUBSCRIBE_STATE_SUBACK)
+    if (xResult != eAzureIoTErrorFailed)
     {
-        xResult = eAzureIoTSuccess;
+        if (prvPendingSubAcks(pxAzureIoTHubClient, &xRejected) != 0)
+        {
+            xResult = eAzureIoTErrorSubackWaitTimeout;
+        }
+        else if (xRejected)
+        {
+            /* Reported once, a rejected subscription is dropped like one that failed to send. */
+            for (ulIndex = 0; ulIndex < azureiothubSUBSCRIBE_FEATURE_COUNT; ulIndex++)
+            {
+                pxRejectedContext = &pxAzureIoTHubClient->_internal.xReceiveContext[ulIndex];
+
+                if (pxRejectedContext->_internal.usState == azureiothubTOPIC_SUBSCRIBE_STATE_FAILED)
+                {
+                    memset(pxRejectedContext, 0, sizeof(AzureIoTHubClientReceiveContext_t));
+                }
+            }
+
+            xResult = eAzureIoTErrorSubscribeFailed;
+        }
+        else
+        {
+            xResult = eAzureIoTSuccess;
+        }
     }
 
     AZLogDebug(("Done waiting for sub ack id: %d, result: 0x%08x",
@@ -836,12 +913,17 @@ AzureIoTResult_t AzureIoTHubClient_Disconnect(AzureIoTHubClient_t *pxAzureIoTHub
 }
 /*-----------------------------------------------------------*/
 
-AzureIoTResult_t AzureIoTHubClient_SendTelemetry(AzureIoTHubClient_t *pxAzureIoTHubClient,
-                                                 const uint8_t *pucTelemetryData,
-                                                 uint32_t ulTelemetryDataLength,
-                                                 AzureIoTMessageProperties_t *pxProperties,
-                                                 AzureIoTHubMessageQoS_t xQOS,
-                                                 uint16_t *pusTelemetryPacketID)
+/**
+ * Publish telemetry either from a buffer or, when xProducer is set, from a payload producer.
+ **/
+static AzureIoTResult_t prvSendTelemetry(AzureIoTHubClient_t *pxAzureIoTHubClient,
+                                         const uint8_t *pucTelemetryData,
+                                         uint32_t ulTelemetryDataLength,
+                                         AzureIoTHubClientPayloadProducer_t xProducer,
+                                         void *pvProducerContext,
+                                         AzureIoTMessageProperties_t *pxProperties,
+                                         AzureIoTHubMessageQoS_t xQOS,
+                                         uint16_t *pusTelemetryPacketID)
 {
     AzureIoTMQTTResult_t xMQTTResult;
     AzureIoTResult_t xResult;
@@ -870,7 +952,6 @@ AzureIoTResult_t AzureIoTHubClient_SendTelemetry(AzureIoTHubClient_t *pxAzureIoT
         xMQTTPublishInfo.xQOS = xQOS == eAzureIoTHubMessageQoS1 ? eAzureIoTMQTTQoS1 : eAzureIoTMQTTQoS0;
         xMQTTPublishInfo.pcTopicName = pxAzureIoTHubClient->_internal.pucWorkingBuffer;
         xMQTTPublishInfo.usTopicNameLength = (uint16_t)xTelemetryTopicLength;
-        AZLogInfo(("pucTelemetryData: %i", *pucTelemetryData));
         xMQTTPublishInfo.pvPayload = (const void *)pucTelemetryData;
         xMQTTPublishInfo.xPayloadLength = ulTelemetryDataLength;
 
@@ -881,8 +962,19 @@ AzureIoTResult_t AzureIoTHubClient_SendTelemetry(AzureIoTHubClient_t *pxAzureIoT
         }
 
         /* Send PUBLISH packet. */
-        if ((xMQTTResult = AzureIoTMQTT_Publish(&(pxAzureIoTHubClient->_internal.xMQTTContext),
-                                                &xMQTTPublishInfo, usPublishPacketIdentifier)) != eAzureIoTMQTTSuccess)
+        if (xProducer != NULL)
+        {
+            xMQTTResult = AzureIoTMQTT_PublishStream(&(pxAzureIoTHubClient->_internal.xMQTTContext),
+                                                     &xMQTTPublishInfo, usPublishPacketIdentifier,
+                                                     (AzureIoTMQTTPayloadProducer_t)xProducer, pvProducerContext);
+        }
+        else
+        {
+            xMQTTResult = AzureIoTMQTT_Publish(&(pxAzureIoTHubClient->_internal.xMQTTContext),
+                                               &xMQTTPublishInfo, usPublishPacketIdentifier);
+        }
+
+        if (xMQTTResult != eAzureIoTMQTTSuccess)
         {
             AZLogError(("Failed to publish telemetry: MQTT error=0x%08x", xMQTTResult));
             xResult = eAzureIoTErrorPublishFailed;
@@ -903,6 +995,37 @@ AzureIoTResult_t AzureIoTHubClient_SendTelemetry(AzureIoTHubClient_t *pxAzureIoT
 }
 /*-----------------------------------------------------------*/
 
+AzureIoTResult_t AzureIoTHubClient_SendTelemetry(AzureIoTHubClient_t *pxAzureIoTHubClient,
+                                                 const uint8_t *pucTelemetryData,
+                                                 uint32_t ulTelemetryDataLength,
+                                                 AzureIoTMessageProperties_t *pxProperties,
+                                                 AzureIoTHubMessageQoS_t xQOS,
+                                                 uint16_t *pusTelemetryPacketID)
+{
+    return prvSendTelemetry(pxAzureIoTHubClient, pucTelemetryData, ulTelemetryDataLength, NULL, NULL,
+                            pxProperties, xQOS, pusTelemetryPacketID);
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTHubClient_SendTelemetryStream(AzureIoTHubClient_t *pxAzureIoTHubClient,
+                                                       uint32_t ulTelemetryDataLength,
+                                                       AzureIoTHubClientPayloadProducer_t xProducer,
+                                                       void *pvProducerContext,
+                                                       AzureIoTMessageProperties_t *pxProperties,
+                                                       AzureIoTHubMessageQoS_t xQOS,
+                                                       uint16_t *pusTelemetryPacketID)
+{
+    if (xProducer == NULL)
+    {
+        AZLogError(("AzureIoTHubClient_SendTelemetryStream failed: invalid argument"));
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    return prvSendTelemetry(pxAzureIoTHubClient, NULL, ulTelemetryDataLength, xProducer, pvProducerContext,
+                            pxProperties, xQOS, pusTelemetryPacketID);
+}
+/*-----------------------------------------------------------*/
+
 AzureIoTResult_t AzureIoTHubClient_ProcessLoop(AzureIoTHubClient_t *pxAzureIoTHubClient,
                                                uint32_t ulTimeoutMilliseconds)
 {
@@ -372,6 +372,42 @@ AzureIoTResult_t AzureIoTHubClient_SendTelemetry( AzureIoTHubClient_t * pxAzureI
                                                   AzureIoTHubMessageQoS_t xQOS,
                                                   uint16_t * pusTelemetryPacketID );
 
+/**
+ * @brief Writes the next part of a telemetry payload sent with AzureIoTHubClient_SendTelemetryStream().
+ *
+ * @param[in] pvContext The context passed to AzureIoTHubClient_SendTelemetryStream().
+ * @param[out] pucBuffer Buffer to write the payload into.
+ * @param[in] xBufferSize Bytes available in \p pucBuffer, never more than are left of the payload.
+ * @return The number of bytes written, or 0 to abort the message.
+ */
+typedef size_t ( * AzureIoTHubClientPayloadProducer_t )( void * pvContext,
+                                                         uint8_t * pucBuffer,
+                                                         size_t xBufferSize );
+
+/**
+ * @brief Send telemetry data to IoT Hub without holding the payload in one buffer.
+ *
+ * The payload is pulled from \p xProducer in parts no larger than the MQTT network
+ * buffer, and each part is written to the transport before the next is requested.
+ *
+ * @param[in] pxAzureIoTHubClient The #AzureIoTHubClient_t * to use for this call.
+ * @param[in] ulTelemetryDataLength The total length \p xProducer will write.
+ * @param[in] xProducer The callback writing the payload.
+ * @param[in] pvProducerContext The context passed to \p xProducer.
+ * @param[in] pxProperties The property bag to send with the message.
+ * @param[in] xQOS The QOS to use for the telemetry. Only QOS `0` and `1` are supported.
+ * @param[out] pusTelemetryPacketID The packet id for the sent telemetry. Can be `NULL`.
+ * @return An #AzureIoTResult_t with the result of the operation. If the producer aborts
+ *         part way, a partial packet has been sent and the connection must be closed.
+ */
+AzureIoTResult_t AzureIoTHubClient_SendTelemetryStream( AzureIoTHubClient_t * pxAzureIoTHubClient,
+                                                        uint32_t ulTelemetryDataLength,
+                                                        AzureIoTHubClientPayloadProducer_t xProducer,
+                                                        void * pvProducerContext,
+                                                        AzureIoTMessageProperties_t * pxProperties,
+                                                        AzureIoTHubMessageQoS_t xQOS,
+                                                        uint16_t * pusTelemetryPacketID );
+
 /**
  * @brief Receive any incoming MQTT messages from and manage the MQTT connection to IoT Hub.
  *
@@ -391,7 +427,10 @@ AzureIoTResult_t AzureIoTHubClient_ProcessLoop( AzureIoTHubClient_t * pxAzureIoT
  * @param[in] pxAzureIoTHubClient The #AzureIoTHubClient_t * to use for this call.
  * @param[in] xCloudToDeviceMessageCallback The #AzureIoTHubClientCloudToDeviceMessageCallback_t to invoke when a CloudToDevice messages arrive.
  * @param[in] prvCallbackContext A pointer to a context to pass to the callback.
- * @param[in] ulTimeoutMilliseconds Timeout in milliseconds for subscribe operation to complete.
+ * @param[in] ulTimeoutMilliseconds Timeout in milliseconds for subscribe operation to complete. If `0` is passed, the
+ *            SUBSCRIBE is sent without waiting and its SUBACK is confirmed by the next subscribe with a timeout,
+ *            which waits for every outstanding SUBACK and fails with #eAzureIoTErrorSubscribeFailed if any
+ *            subscription was rejected.
  * @return An #AzureIoTResult_t with the result of the operation.
  */
 AzureIoTResult_t AzureIoTHubClient_SubscribeCloudToDeviceMessage( AzureIoTHubClient_t * pxAzureIoTHubClient,
@@ -413,7 +452,10 @@ AzureIoTResult_t AzureIoTHubClient_UnsubscribeCloudToDeviceMessage( AzureIoTHubC
  * @param[in] pxAzureIoTHubClient The #AzureIoTHubClient_t * to use for this call.
  * @param[in] xCommandCallback The #AzureIoTHubClientCommandCallback_t to invoke when command messages arrive.
  * @param[in] prvCallbackContext A pointer to a context to pass to the callback.
- * @param[in] ulTimeoutMilliseconds Timeout in milliseconds for Subscribe operation to complete.
+ * @param[in] ulTimeoutMilliseconds Timeout in milliseconds for Subscribe operation to complete. If `0` is passed, the
+ *            SUBSCRIBE is sent without waiting and its SUBACK is confirmed by the next subscribe with a timeout,
+ *            which waits for every outstanding SUBACK and fails with #eAzureIoTErrorSubscribeFailed if any
+ *            subscription was rejected.
  * @return An #AzureIoTResult_t with the result of the operation.
  */
 AzureIoTResult_t AzureIoTHubClient_SubscribeCommand( AzureIoTHubClient_t * pxAzureIoTHubClient,
@@ -451,7 +493,10 @@ AzureIoTResult_t AzureIoTHubClient_SendCommandResponse( AzureIoTHubClient_t * px
  * @param[in] pxAzureIoTHubClient The #AzureIoTHubClient_t * to use for this call.
  * @param[in] xPropertiesCallback The #AzureIoTHubClientPropertiesCallback_t to invoke when device property messages arrive.
  * @param[in] prvCallbackContext A pointer to a context to pass to the callback.
- * @param[in] ulTimeoutMilliseconds Timeout in milliseconds for Subscribe operation to complete.
+ * @param[in] ulTimeoutMilliseconds Timeout in milliseconds for Subscribe operation to complete. If `0` is passed, the
+ *            SUBSCRIBE is sent without waiting and its SUBACK is confirmed by the next subscribe with a timeout,
+ *            which waits for every outstanding SUBACK and fails with #eAzureIoTErrorSubscribeFailed if any
+ *            subscription was rejected.
  * @return An #AzureIoTResult_t with the result of the operation.
  */
 AzureIoTResult_t AzureIoTHubClient_SubscribeProperties( AzureIoTHubClient_t * pxAzureIoTHubClient,
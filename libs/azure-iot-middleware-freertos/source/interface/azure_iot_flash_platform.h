@@ -44,6 +44,22 @@ AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage
                                               uint8_t * const pData,
                                               uint32_t ulBlockSize );
 
+/**
+ * @brief Read back a block of data from the image.
+ *
+ * Used to rebuild the running hash of a partially written image when a download is resumed.
+ *
+ * @param pxAduImage The #AzureADUImage_t to use for this operation.
+ * @param ulOffset The offset into the image from which to start reading.
+ * @param pData The pointer to the buffer to read into.
+ * @param ulBlockSize The length of \p pData.
+ * @return AzureIoTResult_t
+ */
+AzureIoTResult_t AzureIoTPlatform_ReadBlock( AzureADUImage_t * const pxAduImage,
+                                             uint32_t ulOffset,
+                                             uint8_t * const pData,
+                                             uint32_t ulBlockSize );
+
 /**
  * @brief Verify the bytes written to the image match a SHA256 hash.
  *
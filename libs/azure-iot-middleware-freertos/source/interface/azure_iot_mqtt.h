@@ -316,6 +316,41 @@ AzureIoTMQTTResult_t AzureIoTMQTT_Publish( AzureIoTMQTTHandle_t xContext,
                                            const AzureIoTMQTTPublishInfo_t * pxPublishInfo,
                                            uint16_t usPacketId );
 
+/**
+ * @brief Writes the next part of a payload sent with #AzureIoTMQTT_PublishStream.
+ *
+ * @param[in] pvContext The context passed to #AzureIoTMQTT_PublishStream.
+ * @param[out] pucBuffer Buffer to write the payload into.
+ * @param[in] xBufferSize Bytes available in \p pucBuffer, never more than are left of the payload.
+ *
+ * @return The number of bytes written, or 0 to abort the publish.
+ */
+typedef size_t ( * AzureIoTMQTTPayloadProducer_t )( void * pvContext,
+                                                    uint8_t * pucBuffer,
+                                                    size_t xBufferSize );
+
+/**
+ * @brief Publishes a message whose payload is pulled from \p xProducer.
+ *
+ * The payload is written into the network buffer one part at a time after the
+ * PUBLISH header has been sent, so it never has to be held in memory as a whole.
+ *
+ * @param[in] xContext Initialized AzureIoTMQTT context.
+ * @param[in] pxPublishInfo MQTT PUBLISH packet parameters. `xPayloadLength` is the total
+ *                          length the producer will write, `pvPayload` is ignored.
+ * @param[in] usPacketId packet ID ( generated by #AzureIoTMQTT_GetPacketId ).
+ * @param[in] xProducer Callback writing the payload.
+ * @param[in] pvProducerContext Context passed to \p xProducer.
+ *
+ * @return An #AzureIoTMQTTResult_t with the result of the operation. On a send
+ *         failure the connection is left mid-packet and must be closed.
+ */
+AzureIoTMQTTResult_t AzureIoTMQTT_PublishStream( AzureIoTMQTTHandle_t xContext,
+                                                 const AzureIoTMQTTPublishInfo_t * pxPublishInfo,
+                                                 uint16_t usPacketId,
+                                                 AzureIoTMQTTPayloadProducer_t xProducer,
+                                                 void * pvProducerContext );
+
 /**
  * @brief Sends a MQTT PINGREQ to broker.
  *
@@ -27,6 +27,7 @@ uint16_t usTestPacketId = 1;
 const uint8_t * pucPublishPayload = NULL;
 uint16_t usSentQOS = 0xFF;
 uint32_t ulDelayReceivePacket = 0;
+uint8_t ucSubAckStatus = eMQTTSubAckSuccessQos1;
 /*-----------------------------------------------------------*/
 
 AzureIoTMQTTResult_t AzureIoTMQTT_Init( AzureIoTMQTTHandle_t xContext,
@@ -107,6 +108,57 @@ AzureIoTMQTTResult_t AzureIoTMQTT_Publish( AzureIoTMQTTHandle_t xContext,
 }
 /*-----------------------------------------------------------*/
 
+AzureIoTMQTTResult_t AzureIoTMQTT_PublishStream( AzureIoTMQTTHandle_t xContext,
+                                                 const AzureIoTMQTTPublishInfo_t * pxPublishInfo,
+                                                 uint16_t usPacketId,
+                                                 AzureIoTMQTTPayloadProducer_t xProducer,
+                                                 void * pvProducerContext )
+{
+    uint8_t ucChunk[ 4 ];
+    size_t xOffset = 0;
+    size_t xChunkSize;
+
+    ( void ) xContext;
+    ( void ) usPacketId;
+
+    AzureIoTMQTTResult_t xReturn = ( AzureIoTMQTTResult_t ) mock();
+
+    if( xReturn )
+    {
+        return xReturn;
+    }
+
+    /* Pull the payload in chunks smaller than it, like a small network buffer would. */
+    while( xOffset < pxPublishInfo->xPayloadLength )
+    {
+        xChunkSize = pxPublishInfo->xPayloadLength - xOffset;
+        xChunkSize = ( xChunkSize > sizeof( ucChunk ) ) ? sizeof( ucChunk ) : xChunkSize;
+        xChunkSize = xProducer( pvProducerContext, ucChunk, xChunkSize );
+
+        if( xChunkSize == 0 )
+        {
+            return eAzureIoTMQTTSendFailed;
+        }
+
+        if( pucPublishPayload )
+        {
+            assert_memory_equal( ucChunk, pucPublishPayload + xOffset, xChunkSize );
+        }
+
+        xOffset += xChunkSize;
+    }
+
+    if( usSentQOS != 0xFF )
+    {
+        assert_int_equal( usSentQOS, pxPublishInfo->xQOS );
+    }
+
+    usSentQOS = 0xFF; /* Reset to wrong value after checking */
+
+    return xReturn;
+}
+/*-----------------------------------------------------------*/
+
 AzureIoTMQTTResult_t AzureIoTMQTT_Unsubscribe( AzureIoTMQTTHandle_t xContext,
                                                const AzureIoTMQTTSubscribeInfo_t * pxSubscriptionList,
                                                size_t xSubscriptionCount,
@@ -163,3 +215,16 @@ uint16_t AzureIoTMQTT_GetPacketId( AzureIoTMQTTHandle_t xContext )
 
     return usTestPacketId;
 }
+/*-----------------------------------------------------------*/
+
+AzureIoTMQTTResult_t AzureIoTMQTT_GetSubAckStatusCodes( const AzureIoTMQTTPacketInfo_t * pxSubackPacket,
+                                                        uint8_t ** ppucPayloadStart,
+                                                        size_t * pxPayloadSize )
+{
+    ( void ) pxSubackPacket;
+
+    *ppucPayloadStart = &ucSubAckStatus;
+    *pxPayloadSize = 1;
+
+    return eAzureIoTMQTTSuccess;
+}
@@ -45,6 +45,7 @@ extern uint16_t usTestPacketId;
 extern const uint8_t * pucPublishPayload;
 extern uint16_t usSentQOS;
 extern uint32_t ulDelayReceivePacket;
+extern uint8_t ucSubAckStatus;
 
 static const uint8_t ucHostname[] = "unittest.azure-devices.net";
 static const uint8_t ucDeviceId[] = "testiothub";
@@ -593,6 +594,112 @@ static void testAzureIoTHubClient_SendTelemetryQOS1WithPacketID_Success( void **
 }
 /*-----------------------------------------------------------*/
 
+static size_t prvTestTelemetryProducer( void * pvContext,
+                                        uint8_t * pucBuffer,
+                                        size_t xBufferSize )
+{
+    uint32_t * pulOffset = ( uint32_t * ) pvContext;
+
+    memcpy( pucBuffer, ucTestTelemetryPayload + *pulOffset, xBufferSize );
+    *pulOffset += ( uint32_t ) xBufferSize;
+
+    return xBufferSize;
+}
+/*-----------------------------------------------------------*/
+
+static size_t prvTestTelemetryProducerFailure( void * pvContext,
+                                               uint8_t * pucBuffer,
+                                               size_t xBufferSize )
+{
+    ( void ) pvContext;
+    ( void ) pucBuffer;
+    ( void ) xBufferSize;
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+static void testAzureIoTHubClient_SendTelemetryStream_InvalidArgFailure( void ** ppvState )
+{
+    AzureIoTHubClient_t xTestIoTHubClient;
+    uint32_t ulOffset = 0;
+
+    ( void ) ppvState;
+
+    prvSetupTestIoTHubClient( &xTestIoTHubClient );
+
+    /* Fail if the hub client is NULL. */
+    assert_int_equal( AzureIoTHubClient_SendTelemetryStream( NULL,
+                                                             sizeof( ucTestTelemetryPayload ) - 1,
+                                                             prvTestTelemetryProducer,
+                                                             &ulOffset,
+                                                             NULL,
+                                                             eAzureIoTHubMessageQoS0,
+                                                             NULL ),
+                      eAzureIoTErrorInvalidArgument );
+
+    /* Fail if the producer is NULL. */
+    assert_int_equal( AzureIoTHubClient_SendTelemetryStream( &xTestIoTHubClient,
+                                                             sizeof( ucTestTelemetryPayload ) - 1,
+                                                             NULL,
+                                                             &ulOffset,
+                                                             NULL,
+                                                             eAzureIoTHubMessageQoS0,
+                                                             NULL ),
+                      eAzureIoTErrorInvalidArgument );
+}
+/*-----------------------------------------------------------*/
+
+static void testAzureIoTHubClient_SendTelemetryStream_ProducerFailure( void ** ppvState )
+{
+    AzureIoTHubClient_t xTestIoTHubClient;
+
+    ( void ) ppvState;
+
+    prvSetupTestIoTHubClient( &xTestIoTHubClient );
+
+    /* Fail if the producer aborts the payload. */
+    will_return( AzureIoTMQTT_PublishStream, eAzureIoTMQTTSuccess );
+    assert_int_equal( AzureIoTHubClient_SendTelemetryStream( &xTestIoTHubClient,
+                                                             sizeof( ucTestTelemetryPayload ) - 1,
+                                                             prvTestTelemetryProducerFailure,
+                                                             NULL,
+                                                             NULL,
+                                                             eAzureIoTHubMessageQoS0,
+                                                             NULL ),
+                      eAzureIoTErrorPublishFailed );
+}
+/*-----------------------------------------------------------*/
+
+static void testAzureIoTHubClient_SendTelemetryStreamQOS1_Success( void ** ppvState )
+{
+    AzureIoTHubClient_t xTestIoTHubClient;
+    uint32_t ulOffset = 0;
+    uint16_t usPacketId = 0;
+
+    ( void ) ppvState;
+
+    prvSetupTestIoTHubClient( &xTestIoTHubClient );
+
+    usSentQOS = eAzureIoTMQTTQoS1;
+    pucPublishPayload = ucTestTelemetryPayload;
+
+    will_return( AzureIoTMQTT_PublishStream, eAzureIoTMQTTSuccess );
+    assert_int_equal( AzureIoTHubClient_SendTelemetryStream( &xTestIoTHubClient,
+                                                             sizeof( ucTestTelemetryPayload ) - 1,
+                                                             prvTestTelemetryProducer,
+                                                             &ulOffset,
+                                                             NULL,
+                                                             eAzureIoTHubMessageQoS1,
+                                                             &usPacketId ),
+                      eAzureIoTSuccess );
+    assert_int_equal( ulOffset, sizeof( ucTestTelemetryPayload ) - 1 );
+    assert_int_equal( usPacketId, 1 );
+
+    pucPublishPayload = NULL;
+}
+/*-----------------------------------------------------------*/
+
 static void testAzureIoTHubClient_ProcessLoop_InvalidArgFailure( void ** ppvState )
 {
     ( void ) ppvState;
@@ -748,6 +855,28 @@ static void testAzureIoTHubClient_SubscribeCloudMessage_MultipleSuccess( void **
 }
 /*-----------------------------------------------------------*/
 
+static void testAzureIoTHubClient_SubscribeCloudMessage_RejectedFailure( void ** ppvState )
+{
+    AzureIoTHubClient_t xTestIoTHubClient;
+
+    ( void ) ppvState;
+
+    prvSetupTestIoTHubClient( &xTestIoTHubClient );
+
+    will_return( AzureIoTMQTT_Subscribe, eAzureIoTMQTTSuccess );
+    will_return( AzureIoTMQTT_ProcessLoop, eAzureIoTMQTTSuccess );
+    xPacketInfo.ucType = azureiotmqttPACKET_TYPE_SUBACK;
+    xDeserializedInfo.usPacketIdentifier = usTestPacketId;
+    ulDelayReceivePacket = 0;
+    ucSubAckStatus = eMQTTSubAckFailure;
+    assert_int_equal( AzureIoTHubClient_SubscribeCloudToDeviceMessage( &xTestIoTHubClient,
+                                                                       prvTestCloudMessage,
+                                                                       NULL, ( uint32_t ) -1 ),
+                      eAzureIoTErrorSubscribeFailed );
+    ucSubAckStatus = eMQTTSubAckSuccessQos1;
+}
+/*-----------------------------------------------------------*/
+
 static void testAzureIoTHubClient_SubscribeCommand_InvalidArgFailure( void ** ppvState )
 {
     AzureIoTHubClient_t xTestIoTHubClient;
@@ -978,6 +1107,139 @@ static void testAzureIoTHubClient_SubscribeProperties_MultipleSuccess( void ** p
 }
 /*-----------------------------------------------------------*/
 
+static void testAzureIoTHubClient_SubscribeProperties_NoWaitSuccess( void ** ppvState )
+{
+    AzureIoTHubClient_t xTestIoTHubClient;
+
+    ( void ) ppvState;
+
+    prvSetupTestIoTHubClient( &xTestIoTHubClient );
+
+    /* A zero timeout sends the SUBSCRIBE without running the process loop */
+    will_return( AzureIoTMQTT_Subscribe, eAzureIoTMQTTSuccess );
+    assert_int_equal( AzureIoTHubClient_SubscribeProperties( &xTestIoTHubClient,
+                                                             prvTestProperties,
+                                                             NULL, 0 ),
+                      eAzureIoTSuccess );
+
+    /* Not subscribed until the SUBACK arrives */
+    assert_int_equal( AzureIoTHubClient_RequestPropertiesAsync( &xTestIoTHubClient ),
+                      eAzureIoTErrorTopicNotSubscribed );
+
+    will_return( AzureIoTMQTT_ProcessLoop, eAzureIoTMQTTSuccess );
+    xPacketInfo.ucType = azureiotmqttPACKET_TYPE_SUBACK;
+    xDeserializedInfo.usPacketIdentifier = usTestPacketId;
+    ulDelayReceivePacket = 0;
+    assert_int_equal( AzureIoTHubClient_ProcessLoop( &xTestIoTHubClient, 0 ),
+                      eAzureIoTSuccess );
+
+    will_return( AzureIoTMQTT_Publish, eAzureIoTMQTTSuccess );
+    pucPublishPayload = NULL;
+    assert_int_equal( AzureIoTHubClient_RequestPropertiesAsync( &xTestIoTHubClient ),
+                      eAzureIoTSuccess );
+}
+/*-----------------------------------------------------------*/
+
+static void testAzureIoTHubClient_SubscribePipelined_Success( void ** ppvState )
+{
+    AzureIoTHubClient_t xTestIoTHubClient;
+
+    ( void ) ppvState;
+
+    prvSetupTestIoTHubClient( &xTestIoTHubClient );
+
+    will_return( AzureIoTMQTT_Subscribe, eAzureIoTMQTTSuccess );
+    assert_int_equal( AzureIoTHubClient_SubscribeCloudToDeviceMessage( &xTestIoTHubClient,
+                                                                       prvTestCloudMessage,
+                                                                       NULL, 0 ),
+                      eAzureIoTSuccess );
+
+    will_return( AzureIoTMQTT_ProcessLoop, eAzureIoTMQTTSuccess );
+    xPacketInfo.ucType = azureiotmqttPACKET_TYPE_SUBACK;
+    xDeserializedInfo.usPacketIdentifier = usTestPacketId;
+    ulDelayReceivePacket = 0;
+    assert_int_equal( AzureIoTHubClient_ProcessLoop( &xTestIoTHubClient, 0 ),
+                      eAzureIoTSuccess );
+
+    xDeserializedInfo.usPacketIdentifier = ++usTestPacketId;
+    will_return( AzureIoTMQTT_Subscribe, eAzureIoTMQTTSuccess );
+    will_return( AzureIoTMQTT_ProcessLoop, eAzureIoTMQTTSuccess );
+    assert_int_equal( AzureIoTHubClient_SubscribeProperties( &xTestIoTHubClient,
+                                                             prvTestProperties,
+                                                             NULL, ( uint32_t ) -1 ),
+                      eAzureIoTSuccess );
+}
+/*-----------------------------------------------------------*/
+
+static void testAzureIoTHubClient_SubscribePipelined_PendingFailure( void ** ppvState )
+{
+    AzureIoTHubClient_t xTestIoTHubClient;
+
+    ( void ) ppvState;
+
+    prvSetupTestIoTHubClient( &xTestIoTHubClient );
+
+    will_return( AzureIoTMQTT_Subscribe, eAzureIoTMQTTSuccess );
+    assert_int_equal( AzureIoTHubClient_SubscribeCloudToDeviceMessage( &xTestIoTHubClient,
+                                                                       prvTestCloudMessage,
+                                                                       NULL, 0 ),
+                      eAzureIoTSuccess );
+
+    /* Only the properties SUBACK arrives, the wait also needs the cloud to device one */
+    xPacketInfo.ucType = azureiotmqttPACKET_TYPE_SUBACK;
+    xDeserializedInfo.usPacketIdentifier = ++usTestPacketId;
+    ulDelayReceivePacket = 0;
+    will_return( AzureIoTMQTT_Subscribe, eAzureIoTMQTTSuccess );
+    will_return_always( AzureIoTMQTT_ProcessLoop, eAzureIoTMQTTSuccess );
+    assert_int_equal( AzureIoTHubClient_SubscribeProperties( &xTestIoTHubClient,
+                                                             prvTestProperties,
+                                                             NULL, 2 * azureiotconfigSUBACK_WAIT_INTERVAL_MS ),
+                      eAzureIoTErrorSubackWaitTimeout );
+}
+/*-----------------------------------------------------------*/
+
+static void testAzureIoTHubClient_SubscribePipelined_RejectedFailure( void ** ppvState )
+{
+    AzureIoTHubClient_t xTestIoTHubClient;
+
+    ( void ) ppvState;
+
+    prvSetupTestIoTHubClient( &xTestIoTHubClient );
+
+    will_return( AzureIoTMQTT_Subscribe, eAzureIoTMQTTSuccess );
+    assert_int_equal( AzureIoTHubClient_SubscribeCommand( &xTestIoTHubClient,
+                                                          prvTestCommand,
+                                                          NULL, 0 ),
+                      eAzureIoTSuccess );
+
+    will_return( AzureIoTMQTT_ProcessLoop, eAzureIoTMQTTSuccess );
+    xPacketInfo.ucType = azureiotmqttPACKET_TYPE_SUBACK;
+    xDeserializedInfo.usPacketIdentifier = usTestPacketId;
+    ulDelayReceivePacket = 0;
+    ucSubAckStatus = eMQTTSubAckFailure;
+    assert_int_equal( AzureIoTHubClient_ProcessLoop( &xTestIoTHubClient, 0 ),
+                      eAzureIoTSuccess );
+    ucSubAckStatus = eMQTTSubAckSuccessQos1;
+
+    /* The properties SUBACK succeeds, the wait still reports the rejected command subscription */
+    xDeserializedInfo.usPacketIdentifier = ++usTestPacketId;
+    will_return( AzureIoTMQTT_Subscribe, eAzureIoTMQTTSuccess );
+    will_return( AzureIoTMQTT_ProcessLoop, eAzureIoTMQTTSuccess );
+    assert_int_equal( AzureIoTHubClient_SubscribeProperties( &xTestIoTHubClient,
+                                                             prvTestProperties,
+                                                             NULL, ( uint32_t ) -1 ),
+                      eAzureIoTErrorSubscribeFailed );
+
+    /* Reported once */
+    will_return( AzureIoTMQTT_Subscribe, eAzureIoTMQTTSuccess );
+    will_return( AzureIoTMQTT_ProcessLoop, eAzureIoTMQTTSuccess );
+    assert_int_equal( AzureIoTHubClient_SubscribeProperties( &xTestIoTHubClient,
+                                                             prvTestProperties,
+                                                             NULL, ( uint32_t ) -1 ),
+                      eAzureIoTSuccess );
+}
+/*-----------------------------------------------------------*/
+
 static void testAzureIoTHubClient_UnsubscribeCloudMessage_InvalidArgFailure( void ** ppvState )
 {
     ( void ) ppvState;
@@ -1601,6 +1863,9 @@ uint32_t ulGetAllTests()
         cmocka_unit_test( testAzureIoTHubClient_SendTelemetry_SendFailure ),
         cmocka_unit_test( testAzureIoTHubClient_SendTelemetryQOS0_Success ),
         cmocka_unit_test( testAzureIoTHubClient_SendTelemetryQOS1WithPacketID_Success ),
+        cmocka_unit_test( testAzureIoTHubClient_SendTelemetryStream_InvalidArgFailure ),
+        cmocka_unit_test( testAzureIoTHubClient_SendTelemetryStream_ProducerFailure ),
+        cmocka_unit_test( testAzureIoTHubClient_SendTelemetryStreamQOS1_Success ),
         cmocka_unit_test( testAzureIoTHubClient_ProcessLoop_InvalidArgFailure ),
         cmocka_unit_test( testAzureIoTHubClient_ProcessLoop_MQTTProcessFailure ),
         cmocka_unit_test( testAzureIoTHubClient_ProcessLoop_Success ),
@@ -1610,6 +1875,7 @@ uint32_t ulGetAllTests()
         cmocka_unit_test( testAzureIoTHubClient_SubscribeCloudMessage_Success ),
         cmocka_unit_test( testAzureIoTHubClient_SubscribeCloudMessage_DelayedSuccess ),
         cmocka_unit_test( testAzureIoTHubClient_SubscribeCloudMessage_MultipleSuccess ),
+        cmocka_unit_test( testAzureIoTHubClient_SubscribeCloudMessage_RejectedFailure ),
         cmocka_unit_test( testAzureIoTHubClient_SubscribeCommand_InvalidArgFailure ),
         cmocka_unit_test( testAzureIoTHubClient_SubscribeCommand_SubscribeFailure ),
         cmocka_unit_test( testAzureIoTHubClient_SubscribeCommand_ReceiveFailure ),
@@ -1622,6 +1888,10 @@ uint32_t ulGetAllTests()
         cmocka_unit_test( testAzureIoTHubClient_SubscribeProperties_Success ),
         cmocka_unit_test( testAzureIoTHubClient_SubscribeProperties_DelayedSuccess ),
         cmocka_unit_test( testAzureIoTHubClient_SubscribeProperties_MultipleSuccess ),
+        cmocka_unit_test( testAzureIoTHubClient_SubscribeProperties_NoWaitSuccess ),
+        cmocka_unit_test( testAzureIoTHubClient_SubscribePipelined_Success ),
+        cmocka_unit_test( testAzureIoTHubClient_SubscribePipelined_PendingFailure ),
+        cmocka_unit_test( testAzureIoTHubClient_SubscribePipelined_RejectedFailure ),
         cmocka_unit_test( testAzureIoTHubClient_UnsubscribeCloudMessage_InvalidArgFailure ),
         cmocka_unit_test( testAzureIoTHubClient_UnsubscribeCloudMessage_UnsubscribeFailure ),
         cmocka_unit_test( testAzureIoTHubClient_UnsubscribeCloudMessage_Success ),
@@ -1,6 +1,9 @@
 /* Copyright (c) Microsoft Corporation.
  * Licensed under the MIT License. */
 
+#ifndef TRANSPORT_TLS_SOCKET_H
+#define TRANSPORT_TLS_SOCKET_H
+
 #include "azure_iot_transport_interface.h"
 
 #include "sockets_wrapper.h"
@@ -103,3 +106,23 @@ int32_t TLS_Socket_Recv( NetworkContext_t * pxNetworkContext,
 int32_t TLS_Socket_Send( NetworkContext_t * pxNetworkContext,
                          const void * pvBuffer,
                          size_t xBytesToSend );
+
+/**
+ * @brief Flags returned by TLS_Socket_Wait().
+ */
+#define tlsWAIT_READABLE    ( 1 << 0 ) /**< @brief TLS data is available to receive. */
+#define tlsWAIT_WAKEUP      ( 1 << 1 ) /**< @brief The wakeup descriptor was signalled. */
+
+/**
+ * @brief Block until TLS data is available, the wakeup descriptor is readable or the timeout expires.
+ *
+ * @param pxNetworkContext Pointer to the Network context.
+ * @param xWakeupFd Additional descriptor to wait on (e.g. an eventfd), or -1 for none.
+ * @param ulTimeoutMs Maximum time to block.
+ * @return A combination of #tlsWAIT_READABLE and #tlsWAIT_WAKEUP, 0 on timeout, negative on error.
+ */
+int32_t TLS_Socket_Wait( NetworkContext_t * pxNetworkContext,
+                         int xWakeupFd,
+                         uint32_t ulTimeoutMs );
+
+#endif /* TRANSPORT_TLS_SOCKET_H */
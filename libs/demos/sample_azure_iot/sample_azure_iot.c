@@ -4,14 +4,21 @@
 /* Standard includes. */
 #include <string.h>
 #include <stdio.h>
+#include <sys/time.h>
 
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
 
+/* ESP-IDF includes */
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
+
 /* Demo Specific configs. */
 #include "demo_config.h"
 #include "../../main/main/azure_iot_freertos.h"
+#include "../../main/main/memory_budget.h"
+#include "../../main/main/startup.h"
 
 /* Demo Specific Interface Functions. */
 #include "azure_sample_connection.h"
@@ -27,9 +34,24 @@
 /* Transport interface implementation include header for TLS. */
 #include "transport_tls_socket.h"
 
+/* Outbound publish requests */
+#include "sample_azure_iot_requests.h"
+
 /* Crypto helper header. */
 #include "azure_sample_crypto.h"
 
+#ifdef democonfigENABLE_DPS_SAMPLE
+/* The provisioning result, cached in NVS. */
+#include "sample_azure_iot_dps_cache.h"
+#endif /* democonfigENABLE_DPS_SAMPLE */
+
+#ifdef democonfigENABLE_ADU_SAMPLE
+/* Device Update agent and the firmware download it drives. */
+#include "azure_iot_adu_client.h"
+#include "mbedtls/base64.h"
+#include "sample_azure_iot_ota.h"
+#endif /* democonfigENABLE_ADU_SAMPLE */
+
 /*-----------------------------------------------------------*/
 
 /* Compile time error for undefined configs. */
@@ -82,6 +104,23 @@
  */
 #define sampleazureiotMESSAGE "Hello World : %d !"
 
+#ifdef CONFIG_DTMC_TELEMETRY_COMPRESSION
+
+/**
+ * @brief  The content type of compressed sample frames.
+ * @remark Message properties must be url-encoded.
+ */
+#define sampleazureiotMESSAGE_CONTENT_TYPE "application%2Foctet-stream"
+
+/**
+ * @brief  The content encoding of compressed sample frames, consumers decode them with
+ *         python_scripts/telemetry_codec.py or the function app's TelemetryCodec.
+ * @remark Message properties must be url-encoded.
+ */
+#define sampleazureiotMESSAGE_CONTENT_ENCODING "heatshrink"
+
+#else
+
 /**
  * @brief  The content type of the Telemetry message published in this example.
  * @remark Message properties must be url-encoded.
@@ -96,6 +135,45 @@
  */
 #define sampleazureiotMESSAGE_CONTENT_ENCODING "us-ascii"
 
+#endif /* CONFIG_DTMC_TELEMETRY_COMPRESSION */
+
+/**
+ * @brief  Properties of the frame summary message. JSON in UTF-8 lets IoT Hub route on the body,
+ *         and the type property lets the digital twin route pick summaries without it.
+ * @remark Message properties must be url-encoded.
+ */
+#define sampleazureiotSUMMARY_CONTENT_TYPE "application%2Fjson"
+#define sampleazureiotSUMMARY_CONTENT_ENCODING "utf-8"
+#define sampleazureiotSUMMARY_TYPE "summary"
+
+/**
+ * @brief  Properties of triggered capture messages. The metadata is JSON, the data follows
+ *         in binary chunks tagged with the capture id and their offset.
+ * @remark Message properties must be url-encoded.
+ */
+#define sampleazureiotCAPTURE_METADATA_CONTENT_TYPE "application%2Fjson"
+#define sampleazureiotCAPTURE_DATA_CONTENT_TYPE "application%2Foctet-stream"
+#define sampleazureiotCAPTURE_TYPE "capture"
+
+/**
+ * @brief  Properties of condition monitoring messages, the features of one spectrum window as JSON.
+ * @remark Message properties must be url-encoded.
+ */
+#define sampleazureiotSPECTRUM_CONTENT_TYPE "application%2Fjson"
+#define sampleazureiotSPECTRUM_TYPE "spectrum"
+
+/**
+ * @brief Motors driven by the board. Motor 0 is the root of the twin, motor N the "motorN"
+ *        component, and every message it sends carries its index in the motor property.
+ */
+#define sampleazureiotMOTOR_COUNT CONFIG_DTMC_MOTOR_COUNT
+
+/**
+ * @brief Capture data sent per message. One message goes out per pass of the network task,
+ * so inbound commands and queued publishes are never behind more than one chunk.
+ */
+#define sampleazureiotCAPTURE_CHUNK_SIZE (4096U)
+
 /**
  * @brief The reported property payload to send to IoT Hub
  */
@@ -113,20 +191,24 @@
 #define sampleazureiotPROCESS_LOOP_TIMEOUT_MS (1U)
 
 /**
- * @brief Delay (in ticks) between consecutive cycles of MQTT publish operations in a
- * demo iteration.
- *
- * Note that the process loop also has a timeout, so the total time between
- * publishes is the sum of the two delays.
+ * @brief Longest time the network task blocks without running the MQTT process loop,
+ * which keeps the keep-alive serviced while the link is idle.
  */
-#define TELEMETRY_INTERVAL (pdMS_TO_TICKS(10U))
-#define PROCESS_LOOP_INTERVAL (pdMS_TO_TICKS(10U))
+#define sampleazureiotNETWORK_IDLE_TIMEOUT_MS (1000U)
 
 /**
  * @brief Transport timeout in milliseconds for transport send and receive.
  */
 #define sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS (2000U)
 
+/**
+ * @brief Transport timeout in milliseconds for receive.
+ *
+ * The network task only reads once the socket is readable, so receives poll briefly
+ * instead of blocking the owner of the MQTT context.
+ */
+#define sampleazureiotTRANSPORT_RECV_TIMEOUT_MS (10U)
+
 /**
  * @brief Transport timeout in milliseconds for transport send and receive.
  */
@@ -136,6 +218,15 @@
  * @brief Wait timeout for subscribe to finish.
  */
 #define sampleazureiotSUBSCRIBE_TIMEOUT (10 * 1000U)
+
+/**
+ * @brief The ID scope and registration ID a cached IoT Hub assignment was made for.
+ */
+#ifdef democonfigUSE_HSM
+#define sampleazureiotPROVISIONING_SOURCE democonfigID_SCOPE
+#else
+#define sampleazureiotPROVISIONING_SOURCE democonfigID_SCOPE "/" democonfigREGISTRATION_ID
+#endif
 /*-----------------------------------------------------------*/
 
 /*CUSTOM FUNCTIONS-------------------------------------------*/
@@ -163,12 +254,91 @@
                           "sample" \
                           "\":%s}"
 
-SemaphoreHandle_t process_semaphore;
+#define COMMAND_STOP_TEXT "stop"
+#define COMMAND_SET_MODE_TEXT "set_mode"
+#define COMMAND_SET_SETPOINT_TEXT "set_setpoint"
+#define COMMAND_STEP_TEXT "step"
+#define COMMAND_START_CAPTURE_TEXT "start_capture"
+#define COMMAND_IDENTIFY_TEXT "identify"
+#define COMMAND_AUTOTUNE_TEXT "autotune"
+#define COMMAND_CALIBRATE_TEXT "calibrate"
+#define COMMAND_SET_PROFILE_TEXT "set_profile"
+#define COMMAND_SET_WAVEFORM_TEXT "set_waveform"
+#define COMMAND_CLEAR_FAULT_TEXT "clear_fault"
+
+#define COMMAND_MODE_TEXT "mode"
+#define COMMAND_POS_TEXT "position"
+#define COMMAND_VEL_TEXT "velocity"
+#define COMMAND_EXCITATION_TEXT "excitation"
+#define COMMAND_ORDER_TEXT "order"
+#define COMMAND_OFFSET_TEXT "offset"
+#define COMMAND_AMPLITUDE_TEXT "amplitude"
+#define COMMAND_DURATION_TEXT "duration"
+#define COMMAND_RESPONSE_TEXT "response"
+#define COMMAND_APPLY_TEXT "apply"
+#define COMMAND_MIN_TEXT "min"
+#define COMMAND_MAX_TEXT "max"
+#define COMMAND_POINTS_TEXT "points"
+#define COMMAND_HYSTERESIS_TEXT "hysteresis"
+#define COMMAND_SAVE_TEXT "save"
+#define COMMAND_CLEAR_TEXT "clear"
+#define COMMAND_PROFILE_TEXT "profile"
+#define COMMAND_ACCELERATION_TEXT "acceleration"
+#define COMMAND_JERK_TEXT "jerk"
+#define COMMAND_MOTOR_TEXT "motor"
+
+#define COMMAND_MAX_WAVEFORM_POINTS 64
+
+/* Modes the cloud may set, OFF to AUTO_VELOCITY. System ID, tuning and calibration
+ * are entered by their own commands with their configuration. */
+#define COMMAND_MODE_MIN 0
+#define COMMAND_MODE_MAX 3
+
+#define COMMAND_STATUS_OK (200U)
+#define COMMAND_STATUS_BAD_REQUEST (400U)
+#define COMMAND_STATUS_NOT_FOUND (404U)
+#define COMMAND_STATUS_CONFLICT (409U)
+
+#define COMMAND_RESPONSE_FORMAT "{\""          \
+                                "status"       \
+                                "\":%lu,\""    \
+                                "received_us"  \
+                                "\":%lld,\""   \
+                                "actuated_us"  \
+                                "\":%lld,\""   \
+                                "timestamp"    \
+                                "\":%llu}"
+
+/**
+ * @brief Direct method handler. Runs on the network task and returns the method status.
+ */
+typedef uint32_t (*CommandHandler_t)(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength);
+
+typedef struct CommandEntry
+{
+    const char *pcName;
+    CommandHandler_t xHandler;
+} CommandEntry_t;
+
+/* Publishes queued by the other tasks, their eventfd wakes the network task out of select(). */
+static NetworkRequests_t xNetworkRequests;
+
+/* esp_timer time the network task was woken by inbound data, for command latency. */
+static int64_t llInboundTime = 0;
 
 void process_properties(AzureIoTHubClientPropertiesResponse_t *pxMessage,
                         AzureIoTHubClientPropertyType_t xPropertyType);
-
-static void process_loop_task(void *arg);
+uint32_t process_command(const uint8_t *pucComponentName, uint16_t usComponentNameLength,
+                         const uint8_t *pucCommandName, uint16_t usCommandNameLength,
+                         const uint8_t *pucPayload, uint32_t ulPayloadLength);
+
+#ifdef democonfigENABLE_ADU_SAMPLE
+static void prvADUInit(void);
+static AzureIoTResult_t prvADUProcessRequest(AzureIoTJSONReader_t *pxReader, uint32_t ulPropertyVersion);
+static AzureIoTResult_t prvADUSendAgentState(AzureIoTADUAgentState_t xAgentState,
+                                             AzureIoTADUClientInstallResult_t *pxInstallResult);
+static AzureIoTResult_t prvADUReportResult(OTAResult_t xOTAResult);
+#endif /* democonfigENABLE_ADU_SAMPLE */
 
 /*-----------------------------------------------------------*/
 
@@ -185,11 +355,30 @@ extern uint64_t ullGetUnixTime(void);
 static uint8_t ucSampleIotHubHostname[128];
 static uint8_t ucSampleIotHubDeviceId[128];
 static AzureIoTProvisioningClient_t xAzureIoTProvisioningClient;
+static DPSCache_t xDPSCache;
 #endif /* democonfigENABLE_DPS_SAMPLE */
 
-#define BUFFER_SIZE 27908UL
-static uint8_t ucPropertyBuffer[80];
-static uint8_t ucScratchBuffer[BUFFER_SIZE];
+static uint8_t ucPropertyBuffer[sampleazureiotMOTOR_COUNT][96];
+static uint8_t ucSummaryPropertyBuffer[sampleazureiotMOTOR_COUNT][96];
+static uint8_t ucCapturePropertyBuffer[128];
+static uint8_t ucSpectrumPropertyBuffer[128];
+static uint8_t ucCommandResponseBuffer[128];
+
+#ifdef democonfigENABLE_ADU_SAMPLE
+static AzureIoTADUClient_t xAzureIoTADUClient;
+static AzureIoTADUClientDeviceProperties_t xADUDeviceProperties;
+
+/* Last update request. Its workflow is reported with every agent state, so the
+ * strings it needs are copied out of the MQTT buffer. */
+static AzureIoTADUUpdateRequest_t xADUUpdateRequest;
+static uint8_t ucADUWorkflowId[64];
+static uint8_t ucADURetryTimestamp[64];
+static OTAImage_t xADUImage;
+
+/* Agent state and request responses, reserved from the OTA arena. */
+static uint8_t *pucADUBuffer = NULL;
+#endif /* democonfigENABLE_ADU_SAMPLE */
+
 
 /* Each compilation unit must define the NetworkContext struct. */
 struct NetworkContext
@@ -205,17 +394,18 @@ static AzureIoTHubClient_t xAzureIoTHubClient;
 /**
  * @brief Gets the IoT Hub endpoint and deviceId from Provisioning service.
  *   This function will block for Provisioning service for result or return failure.
+ *   Called by the DPS cache when no usable assignment is cached.
  *
- * @param[in] pXNetworkCredentials  Network credential used to connect to Provisioning service
- * @param[out] ppucIothubHostname  Pointer to uint8_t* IoT Hub hostname return from Provisioning Service
+ * @param[in] pvContext  Network credential used to connect to Provisioning service
+ * @param[out] pucIothubHostname  IoT Hub hostname returned by Provisioning Service
  * @param[in,out] pulIothubHostnameLength  Length of hostname
- * @param[out] ppucIothubDeviceId  Pointer to uint8_t* deviceId return from Provisioning Service
+ * @param[out] pucIothubDeviceId  deviceId returned by Provisioning Service
  * @param[in,out] pulIothubDeviceIdLength  Length of deviceId
  */
-static uint32_t prvIoTHubInfoGet(NetworkCredentials_t *pXNetworkCredentials,
-                                 uint8_t **ppucIothubHostname,
+static uint32_t prvIoTHubInfoGet(void *pvContext,
+                                 uint8_t *pucIothubHostname,
                                  uint32_t *pulIothubHostnameLength,
-                                 uint8_t **ppucIothubDeviceId,
+                                 uint8_t *pucIothubDeviceId,
                                  uint32_t *pulIothubDeviceIdLength);
 
 #endif /* democonfigENABLE_DPS_SAMPLE */
@@ -248,9 +438,36 @@ static uint32_t prvConnectToServerWithBackoffRetries(const char *pcHostName,
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Static buffer used to hold MQTT messages being sent and received.
+ * @brief Buffer used to hold MQTT messages being sent and received,
+ * reserved from the network arena.
+ */
+static uint8_t *pucMQTTMessageBuffer = NULL;
+
+/**
+ * @brief Buffer the frame summary is formatted into, reserved from the network arena.
  */
-static uint8_t ucMQTTMessageBuffer[democonfigNETWORK_BUFFER_SIZE];
+static uint8_t *pucSummaryBuffer = NULL;
+
+/* Upload of the completed captures, one motor at a time and resumed after a reconnect.
+ * Bit N of the pending mask is set while motor N's capture waits, an offset of
+ * UINT32_MAX means the metadata of the current one has not been sent yet. */
+static uint32_t ulCaptureUploadPending = 0;
+static uint8_t ucCaptureMotor = 0;
+static uint32_t ulCaptureOffset = UINT32_MAX;
+
+/* Twin components of the motors after the first, the first is the root of the twin */
+#if sampleazureiotMOTOR_COUNT > 2
+#error "Add the components of the extra motors"
+#elif sampleazureiotMOTOR_COUNT > 1
+static AzureIoTHubClientComponent_t xMotorComponents[] = {azureiothubCREATE_COMPONENT("motor1")};
+#endif
+
+/* Producer context of a capture chunk */
+typedef struct CaptureCursor
+{
+    uint8_t ucMotor;
+    uint32_t ulOffset;
+} CaptureCursor_t;
 
 /*-----------------------------------------------------------*/
 
@@ -274,17 +491,40 @@ static void prvHandleCloudMessage(AzureIoTHubClientCloudToDeviceMessageRequest_t
 static void prvHandleCommand(AzureIoTHubClientCommandRequest_t *pxMessage,
                              void *pvContext)
 {
-    LogInfo(("Command payload : %.*s \r\n",
-             (int)pxMessage->ulPayloadLength,
-             (const char *)pxMessage->pvMessagePayload));
-
     AzureIoTHubClient_t *xHandle = (AzureIoTHubClient_t *)pvContext;
+    int64_t llReceivedTime = llInboundTime;
+    int64_t llActuatedTime;
+    struct timeval xNow;
+    uint32_t ulStatus;
+    int lLength;
+
+    /* Actuate before anything is logged, the console is slower than the motor. */
+    ulStatus = process_command(pxMessage->pucComponentName, pxMessage->usComponentNameLength,
+                               pxMessage->pucCommandName, pxMessage->usCommandNameLength,
+                               (const uint8_t *)pxMessage->pvMessagePayload, pxMessage->ulPayloadLength);
+    llActuatedTime = esp_timer_get_time();
+    gettimeofday(&xNow, NULL);
+
+    lLength = snprintf((char *)ucCommandResponseBuffer, sizeof(ucCommandResponseBuffer),
+                       COMMAND_RESPONSE_FORMAT, (unsigned long)ulStatus, llReceivedTime, llActuatedTime,
+                       (unsigned long long)xNow.tv_sec * 1000ULL + (unsigned long long)(xNow.tv_usec / 1000));
+
+    if ((lLength <= 0) || (lLength >= (int)sizeof(ucCommandResponseBuffer)))
+    {
+        LogError(("Failed to format command response"));
+        lLength = 0;
+    }
 
-    if (AzureIoTHubClient_SendCommandResponse(xHandle, pxMessage, 200,
-                                              NULL, 0) != eAzureIoTSuccess)
+    if (AzureIoTHubClient_SendCommandResponse(xHandle, pxMessage, ulStatus,
+                                              ucCommandResponseBuffer, (uint32_t)lLength) != eAzureIoTSuccess)
     {
         LogInfo(("Error sending command response\r\n"));
     }
+
+    LogInfo(("Command %.*s returned %lu, actuated %lld us after arrival, payload : %.*s \r\n",
+             (int)pxMessage->usCommandNameLength, (const char *)pxMessage->pucCommandName,
+             (unsigned long)ulStatus, llActuatedTime - llReceivedTime,
+             (int)pxMessage->ulPayloadLength, (const char *)pxMessage->pvMessagePayload));
 }
 /*-----------------------------------------------------------*/
 
@@ -310,6 +550,7 @@ static void prvHandlePropertiesMessage(AzureIoTHubClientPropertiesResponse_t *px
     case eAzureIoTHubPropertiesWritablePropertyMessage:
         LogInfo(("Device property desired property received"));
         process_properties(pxMessage, eAzureIoTHubClientPropertyWritable);
+        LogInfo(("Desired properties applied %lld us after arrival", esp_timer_get_time() - llInboundTime));
         break;
 
     default:
@@ -342,6 +583,300 @@ static uint32_t prvSetupNetworkCredentials(NetworkCredentials_t *pxNetworkCreden
 }
 /*-----------------------------------------------------------*/
 
+/**
+ * @brief Telemetry payload producer, copies the next part of the open sample frame.
+ */
+static size_t prvTelemetryProducer(void *pvContext, uint8_t *pucBuffer, size_t xBufferSize)
+{
+    uint8_t ucMotor = *(uint8_t *)pvContext;
+
+    return read_sample_stream(ucMotor, (char *)pucBuffer, (uint32_t)xBufferSize);
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Capture payload producer, copies the next part of the current chunk.
+ */
+static size_t prvCaptureProducer(void *pvContext, uint8_t *pucBuffer, size_t xBufferSize)
+{
+    CaptureCursor_t *pxCursor = (CaptureCursor_t *)pvContext;
+    uint32_t ulLength = read_capture(pxCursor->ucMotor, pxCursor->ulOffset, pucBuffer, (uint32_t)xBufferSize);
+
+    pxCursor->ulOffset += ulLength;
+    return ulLength;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Append a decimal property value, the properties are copied into the message topic.
+ */
+static AzureIoTResult_t prvAppendNumberProperty(AzureIoTMessageProperties_t *pxPropertyBag, const char *pcName,
+                                                uint32_t ulValue, char *pcValue, uint32_t ulValueSize)
+{
+    int lLength = snprintf(pcValue, ulValueSize, "%lu", (unsigned long)ulValue);
+
+    return AzureIoTMessage_PropertiesAppend(pxPropertyBag, (uint8_t *)pcName, strlen(pcName),
+                                            (uint8_t *)pcValue, (uint32_t)lLength);
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Send the next part of a completed capture: its metadata first, then one data chunk
+ * per call. Returns with more to send still pending, the caller wakes itself to continue.
+ */
+static AzureIoTResult_t prvProcessCaptureUpload(void)
+{
+    AzureIoTMessageProperties_t xCapturePropertyBag;
+    AzureIoTResult_t xResult;
+    CaptureCursor_t xCursor;
+    char cMotor[4];
+    char cCaptureId[12];
+    char cOffset[12];
+    uint32_t ulLength;
+    uint32_t ulChunkLength;
+    bool xMetadata = (ulCaptureOffset == UINT32_MAX);
+
+    /* A new upload starts with the lowest motor waiting, a started one finishes first */
+    if (xMetadata)
+    {
+        ucCaptureMotor = 0;
+        while ((ulCaptureUploadPending & (1UL << ucCaptureMotor)) == 0)
+            ucCaptureMotor++;
+    }
+
+    ulLength = get_capture_length(ucCaptureMotor);
+    if (ulLength == 0)
+    {
+        ulCaptureUploadPending &= ~(1UL << ucCaptureMotor);
+        ulCaptureOffset = UINT32_MAX;
+        return eAzureIoTSuccess;
+    }
+
+    xResult = AzureIoTMessage_PropertiesInit(&xCapturePropertyBag, ucCapturePropertyBuffer, 0, sizeof(ucCapturePropertyBuffer));
+    if (xResult == eAzureIoTSuccess)
+        xResult = AzureIoTMessage_PropertiesAppend(&xCapturePropertyBag,
+                                                   (uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE) - 1,
+                                                   xMetadata ? (uint8_t *)sampleazureiotCAPTURE_METADATA_CONTENT_TYPE : (uint8_t *)sampleazureiotCAPTURE_DATA_CONTENT_TYPE,
+                                                   xMetadata ? sizeof(sampleazureiotCAPTURE_METADATA_CONTENT_TYPE) - 1 : sizeof(sampleazureiotCAPTURE_DATA_CONTENT_TYPE) - 1);
+    if (xResult == eAzureIoTSuccess)
+        xResult = AzureIoTMessage_PropertiesAppend(&xCapturePropertyBag, (uint8_t *)"type", sizeof("type") - 1,
+                                                   (uint8_t *)sampleazureiotCAPTURE_TYPE, sizeof(sampleazureiotCAPTURE_TYPE) - 1);
+    if (xResult == eAzureIoTSuccess)
+        xResult = prvAppendNumberProperty(&xCapturePropertyBag, "motor", ucCaptureMotor, cMotor, sizeof(cMotor));
+    if (xResult == eAzureIoTSuccess)
+        xResult = prvAppendNumberProperty(&xCapturePropertyBag, "capture", get_capture_id(ucCaptureMotor), cCaptureId, sizeof(cCaptureId));
+    if ((xResult == eAzureIoTSuccess) && !xMetadata)
+        xResult = prvAppendNumberProperty(&xCapturePropertyBag, "offset", ulCaptureOffset, cOffset, sizeof(cOffset));
+    if (xResult != eAzureIoTSuccess)
+        return xResult;
+
+    if (xMetadata)
+    {
+        ulChunkLength = get_capture_metadata(ucCaptureMotor, (char *)pucSummaryBuffer, MEMORY_SUMMARY_BUFFER_SIZE);
+        if (ulChunkLength > 0)
+            xResult = AzureIoTHubClient_SendTelemetry(&xAzureIoTHubClient, pucSummaryBuffer, ulChunkLength,
+                                                      &xCapturePropertyBag, eAzureIoTHubMessageQoS1, NULL);
+        if (xResult == eAzureIoTSuccess)
+            ulCaptureOffset = 0;
+        return xResult;
+    }
+
+    ulChunkLength = ulLength - ulCaptureOffset;
+    if (ulChunkLength > sampleazureiotCAPTURE_CHUNK_SIZE)
+        ulChunkLength = sampleazureiotCAPTURE_CHUNK_SIZE;
+
+    /* The capture is frozen until released, so the chunk streams straight out of its rings. */
+    xCursor.ucMotor = ucCaptureMotor;
+    xCursor.ulOffset = ulCaptureOffset;
+    xResult = AzureIoTHubClient_SendTelemetryStream(&xAzureIoTHubClient, ulChunkLength,
+                                                    prvCaptureProducer, &xCursor,
+                                                    &xCapturePropertyBag, eAzureIoTHubMessageQoS1, NULL);
+    if (xResult != eAzureIoTSuccess)
+        return xResult;
+
+    ulCaptureOffset += ulChunkLength;
+    if (ulCaptureOffset >= ulLength)
+    {
+        LogInfo(("Capture %lu of motor %u uploaded, %lu bytes", (unsigned long)get_capture_id(ucCaptureMotor),
+                 ucCaptureMotor, (unsigned long)ulLength));
+        ulCaptureUploadPending &= ~(1UL << ucCaptureMotor);
+        ulCaptureOffset = UINT32_MAX;
+        release_capture(ucCaptureMotor);
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Send the features of a motor's last condition monitoring window as telemetry.
+ */
+static AzureIoTResult_t prvSendSpectrum(uint8_t ucMotor)
+{
+    AzureIoTMessageProperties_t xSpectrumPropertyBag;
+    AzureIoTResult_t xResult;
+    char cMotor[4];
+    char cComponent[12];
+    int lLength;
+    uint32_t ulLength;
+
+    ulLength = get_spectrum_features(ucMotor, (char *)pucSummaryBuffer, MEMORY_SUMMARY_BUFFER_SIZE);
+    if (ulLength == 0)
+        return eAzureIoTSuccess;
+
+    xResult = AzureIoTMessage_PropertiesInit(&xSpectrumPropertyBag, ucSpectrumPropertyBuffer, 0, sizeof(ucSpectrumPropertyBuffer));
+    if (xResult == eAzureIoTSuccess)
+        xResult = AzureIoTMessage_PropertiesAppend(&xSpectrumPropertyBag,
+                                                   (uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE) - 1,
+                                                   (uint8_t *)sampleazureiotSPECTRUM_CONTENT_TYPE, sizeof(sampleazureiotSPECTRUM_CONTENT_TYPE) - 1);
+    if (xResult == eAzureIoTSuccess)
+        xResult = AzureIoTMessage_PropertiesAppend(&xSpectrumPropertyBag, (uint8_t *)"type", sizeof("type") - 1,
+                                                   (uint8_t *)sampleazureiotSPECTRUM_TYPE, sizeof(sampleazureiotSPECTRUM_TYPE) - 1);
+    if (xResult == eAzureIoTSuccess)
+        xResult = prvAppendNumberProperty(&xSpectrumPropertyBag, "motor", ucMotor, cMotor, sizeof(cMotor));
+    if ((xResult == eAzureIoTSuccess) && (ucMotor > 0))
+    {
+        lLength = snprintf(cComponent, sizeof(cComponent), "motor%u", ucMotor);
+        xResult = AzureIoTMessage_PropertiesAppend(&xSpectrumPropertyBag,
+                                                   (uint8_t *)AZ_IOT_MESSAGE_COMPONENT_NAME, sizeof(AZ_IOT_MESSAGE_COMPONENT_NAME) - 1,
+                                                   (uint8_t *)cComponent, (uint32_t)lLength);
+    }
+    if (xResult != eAzureIoTSuccess)
+        return xResult;
+
+    return AzureIoTHubClient_SendTelemetry(&xAzureIoTHubClient, pucSummaryBuffer, ulLength,
+                                           &xSpectrumPropertyBag, eAzureIoTHubMessageQoS1, NULL);
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Send every queued publish request. Only called from the network task.
+ *
+ * @param[in] pxPropertyBag        Telemetry properties, one bag per motor.
+ * @param[in] pxSummaryPropertyBag Summary properties, one bag per motor.
+ */
+static AzureIoTResult_t prvProcessNetworkRequests(AzureIoTMessageProperties_t *pxPropertyBag,
+                                                  AzureIoTMessageProperties_t *pxSummaryPropertyBag)
+{
+    NetworkRequest_t xRequest;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+    uint32_t ulTelemetryLength;
+    uint32_t ulSummaryLength;
+    uint8_t ucMotor;
+
+    while (NetworkRequests_Receive(&xNetworkRequests, &xRequest))
+    {
+        /* Requests about one motor carry its index, none is the first */
+        ucMotor = (xRequest.ulPayloadLength > 0) ? xRequest.ucPayload[0] : 0;
+
+        switch (xRequest.xType)
+        {
+        case AZURE_REQUEST_TELEMETRY:
+            ulTelemetryLength = open_sample_stream(ucMotor);
+            if (ulTelemetryLength == 0)
+                continue;
+
+            /* The frame goes from the formatter's buffer to the TLS socket one network buffer at a time. */
+            xResult = AzureIoTHubClient_SendTelemetryStream(&xAzureIoTHubClient, ulTelemetryLength,
+                                                            prvTelemetryProducer, &ucMotor,
+                                                            &pxPropertyBag[ucMotor], eAzureIoTHubMessageQoS1, NULL);
+            close_sample_stream(ucMotor);
+            if (xResult == eAzureIoTSuccess)
+                startup_complete(STARTUP_STAGE_TELEMETRY);
+            break;
+
+        case AZURE_REQUEST_SUMMARY:
+            ulSummaryLength = get_sample_summary(ucMotor, (char *)pucSummaryBuffer, MEMORY_SUMMARY_BUFFER_SIZE);
+            if (ulSummaryLength == 0)
+                continue;
+
+            xResult = AzureIoTHubClient_SendTelemetry(&xAzureIoTHubClient, pucSummaryBuffer, ulSummaryLength,
+                                                      &pxSummaryPropertyBag[ucMotor], eAzureIoTHubMessageQoS1, NULL);
+            break;
+
+        case AZURE_REQUEST_REPORTED_PROPERTIES:
+            xResult = AzureIoTHubClient_SendPropertiesReported(&xAzureIoTHubClient,
+                                                               xRequest.ucPayload, xRequest.ulPayloadLength,
+                                                               NULL);
+            break;
+
+#ifdef democonfigENABLE_ADU_SAMPLE
+        case AZURE_REQUEST_UPDATE_STATE:
+        {
+            OTAResult_t xOTAResult;
+
+            memcpy(&xOTAResult, xRequest.ucPayload, sizeof(xOTAResult));
+            xResult = prvADUReportResult(xOTAResult);
+            break;
+        }
+#endif /* democonfigENABLE_ADU_SAMPLE */
+
+        case AZURE_REQUEST_SYSTEM_ID:
+            ulSummaryLength = get_system_id_report(ucMotor, (char *)pucSummaryBuffer, MEMORY_SUMMARY_BUFFER_SIZE);
+            if (ulSummaryLength == 0)
+                continue;
+
+            xResult = AzureIoTHubClient_SendPropertiesReported(&xAzureIoTHubClient, pucSummaryBuffer, ulSummaryLength, NULL);
+            break;
+
+        case AZURE_REQUEST_GAIN_SCHEDULE:
+            ulSummaryLength = get_gain_schedule_report(ucMotor, (char *)pucSummaryBuffer, MEMORY_SUMMARY_BUFFER_SIZE);
+            if (ulSummaryLength == 0)
+                continue;
+
+            xResult = AzureIoTHubClient_SendPropertiesReported(&xAzureIoTHubClient, pucSummaryBuffer, ulSummaryLength, NULL);
+            break;
+
+        case AZURE_REQUEST_ACTUATOR:
+            ulSummaryLength = get_actuator_report(ucMotor, (char *)pucSummaryBuffer, MEMORY_SUMMARY_BUFFER_SIZE);
+            if (ulSummaryLength == 0)
+                continue;
+
+            xResult = AzureIoTHubClient_SendPropertiesReported(&xAzureIoTHubClient, pucSummaryBuffer, ulSummaryLength, NULL);
+            break;
+
+        case AZURE_REQUEST_FAULT:
+            ulSummaryLength = get_fault_report(ucMotor, (char *)pucSummaryBuffer, MEMORY_SUMMARY_BUFFER_SIZE);
+            if (ulSummaryLength == 0)
+                continue;
+
+            xResult = AzureIoTHubClient_SendPropertiesReported(&xAzureIoTHubClient, pucSummaryBuffer, ulSummaryLength, NULL);
+            break;
+
+        case AZURE_REQUEST_SPECTRUM:
+            xResult = prvSendSpectrum(ucMotor);
+            break;
+
+        case AZURE_REQUEST_CAPTURE:
+            /* Uploaded one chunk at a time once the queue is empty */
+            ulCaptureUploadPending |= 1UL << ucMotor;
+            continue;
+
+        default:
+            LogError(("Unknown network request %d", xRequest.xType));
+            continue;
+        }
+
+        if (xResult != eAzureIoTSuccess)
+        {
+            LogError(("Network request %d failed: result 0x%08x", xRequest.xType, xResult));
+            break;
+        }
+
+        LogDebug(("Network request %d sent %lld us after it was queued",
+                  xRequest.xType, esp_timer_get_time() - xRequest.llRequestTime));
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+bool azure_request_publish(azure_request_t xType, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    return NetworkRequests_Send(&xNetworkRequests, xType, pucPayload, ulPayloadLength);
+}
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Azure IoT demo task that gets started in the platform specific project.
  *  In this demo task, middleware API's are used to connect to Azure IoT Hub.
@@ -349,7 +884,7 @@ static uint32_t prvSetupNetworkCredentials(NetworkCredentials_t *pxNetworkCreden
 static void prvAzureDemoTask(void *pvParameters)
 {
     int lPublishCount = 0;
-    uint32_t ulScratchBufferLength = 0U;
+    int32_t lWaitStatus;
     const int lMaxPublishCount = 5;
     NetworkCredentials_t xNetworkCredentials = {0};
     AzureIoTTransportInterface_t xTransport;
@@ -358,8 +893,17 @@ static void prvAzureDemoTask(void *pvParameters)
     AzureIoTResult_t xResult;
     uint32_t ulStatus;
     AzureIoTHubClientOptions_t xHubOptions = {0};
-    AzureIoTMessageProperties_t xPropertyBag;
+    AzureIoTMessageProperties_t xPropertyBag[sampleazureiotMOTOR_COUNT];
+    AzureIoTMessageProperties_t xSummaryPropertyBag[sampleazureiotMOTOR_COUNT];
+    uint8_t ucMotor;
+    char cMotor[4];
+    char cComponent[12];
+    int lLength;
     bool xSessionPresent;
+    TickType_t xDisconnectTick = 0;
+    TickType_t xConnectStartTick;
+    TickType_t xTlsReadyTick;
+    TickType_t xMqttReadyTick;
 
 #ifdef democonfigENABLE_DPS_SAMPLE
     uint8_t *pucIotHubHostname = NULL;
@@ -378,26 +922,52 @@ static void prvAzureDemoTask(void *pvParameters)
     /* Initialize Azure IoT Middleware.  */
     configASSERT(AzureIoT_Init() == eAzureIoTSuccess);
 
+#ifdef democonfigENABLE_ADU_SAMPLE
+    prvADUInit();
+#endif /* democonfigENABLE_ADU_SAMPLE */
+
     ulStatus = prvSetupNetworkCredentials(&xNetworkCredentials);
     configASSERT(ulStatus == 0);
 
+    /* Reserve network buffers once, they live for the lifetime of the task. */
+    pucMQTTMessageBuffer = (uint8_t *)memory_reserve(MEMORY_ARENA_NETWORK, democonfigNETWORK_BUFFER_SIZE);
+    pucSummaryBuffer = (uint8_t *)memory_reserve(MEMORY_ARENA_NETWORK, MEMORY_SUMMARY_BUFFER_SIZE);
+
+    /* Provisioning and TLS need an address and a synchronized clock, both are brought up concurrently. */
+    startup_wait(STARTUP_BIT(STARTUP_STAGE_WIFI) | STARTUP_BIT(STARTUP_STAGE_TIME), portMAX_DELAY);
+    startup_begin(STARTUP_STAGE_PROVISIONING);
+
 #ifdef democonfigENABLE_DPS_SAMPLE
-    /* Run DPS.  */
-    if ((ulStatus = prvIoTHubInfoGet(&xNetworkCredentials, &pucIotHubHostname,
-                                     &pulIothubHostnameLength, &pucIotHubDeviceId,
-                                     &pulIothubDeviceIdLength)) != 0)
+    xDPSCache.pcSource = sampleazureiotPROVISIONING_SOURCE;
+    xDPSCache.xProvision = prvIoTHubInfoGet;
+    xDPSCache.pvProvisionContext = &xNetworkCredentials;
+    xDPSCache.pucHostname = ucSampleIotHubHostname;
+    xDPSCache.ulHostnameSize = sizeof(ucSampleIotHubHostname);
+    xDPSCache.pucDeviceId = ucSampleIotHubDeviceId;
+    xDPSCache.ulDeviceIdSize = sizeof(ucSampleIotHubDeviceId);
+
+    /* Use the hub assigned on a previous boot, or run DPS. */
+    if ((ulStatus = DPSCache_Resolve(&xDPSCache)) != 0)
     {
         LogError(("Failed on sample_dps_entry!: error code = 0x%08x\r\n", (uint16_t)ulStatus));
         return;
     }
+
+    pucIotHubHostname = xDPSCache.pucHostname;
+    pucIotHubDeviceId = xDPSCache.pucDeviceId;
 #endif /* democonfigENABLE_DPS_SAMPLE */
 
+    startup_complete(STARTUP_STAGE_PROVISIONING);
+
     xNetworkContext.pParams = &xTlsTransportParams;
 
     for (;;)
     {
         if (xAzureSample_IsConnectedToInternet())
         {
+            startup_begin(STARTUP_STAGE_MQTT);
+            xConnectStartTick = xTaskGetTickCount();
+
             /* Attempt to establish TLS session with IoT Hub. If connection fails,
              * retry after a timeout. Timeout value will be exponentially increased
              * until  the maximum number of attempts are reached or the maximum timeout
@@ -407,7 +977,19 @@ static void prvAzureDemoTask(void *pvParameters)
             ulStatus = prvConnectToServerWithBackoffRetries((const char *)pucIotHubHostname,
                                                             democonfigIOTHUB_PORT,
                                                             &xNetworkCredentials, &xNetworkContext);
+
+#ifdef democonfigENABLE_DPS_SAMPLE
+            /* The cached hub may no longer exist, provision again and retry. */
+            if ((ulStatus != 0) && DPSCache_Unreachable(&xDPSCache))
+            {
+                continue;
+            }
+
+            pulIothubHostnameLength = xDPSCache.ulHostnameLength;
+            pulIothubDeviceIdLength = xDPSCache.ulDeviceIdLength;
+#endif /* democonfigENABLE_DPS_SAMPLE */
             configASSERT(ulStatus == 0);
+            xTlsReadyTick = xTaskGetTickCount();
 
             /* Fill in Transport Interface send and receive function pointers. */
             xTransport.pxNetworkContext = &xNetworkContext;
@@ -421,11 +1003,23 @@ static void prvAzureDemoTask(void *pvParameters)
             xHubOptions.pucModuleID = (const uint8_t *)democonfigMODULE_ID;
             xHubOptions.ulModuleIDLength = sizeof(democonfigMODULE_ID) - 1;
 
+#if sampleazureiotMOTOR_COUNT > 1
+            /* Desired properties of the other motors arrive under their components. */
+            xHubOptions.pxComponentList = xMotorComponents;
+            xHubOptions.ulComponentListLength = sizeof(xMotorComponents) / sizeof(xMotorComponents[0]);
+#endif
+
+#ifdef democonfigENABLE_ADU_SAMPLE
+            /* Device Update requests arrive as properties of the ADU component. */
+            xHubOptions.pucModelID = AzureIoTADUModelID;
+            xHubOptions.ulModelIDLength = AzureIoTADUModelIDLength;
+#endif /* democonfigENABLE_ADU_SAMPLE */
+
             xResult = AzureIoTHubClient_Init(&xAzureIoTHubClient,
                                              pucIotHubHostname, pulIothubHostnameLength,
                                              pucIotHubDeviceId, pulIothubDeviceIdLength,
                                              &xHubOptions,
-                                             ucMQTTMessageBuffer, sizeof(ucMQTTMessageBuffer),
+                                             pucMQTTMessageBuffer, democonfigNETWORK_BUFFER_SIZE,
                                              ullGetUnixTime,
                                              &xTransport);
             configASSERT(xResult == eAzureIoTSuccess);
@@ -445,14 +1039,37 @@ static void prvAzureDemoTask(void *pvParameters)
             xResult = AzureIoTHubClient_Connect(&xAzureIoTHubClient,
                                                 false, &xSessionPresent,
                                                 sampleazureiotCONNACK_RECV_TIMEOUT_MS);
+
+#ifdef democonfigENABLE_DPS_SAMPLE
+            /* The device may have been moved to another hub, provision again and retry. */
+            if (xResult != eAzureIoTSuccess)
+            {
+                TLS_Socket_Disconnect(&xNetworkContext);
+
+                if (DPSCache_Unreachable(&xDPSCache))
+                {
+                    continue;
+                }
+            }
+#endif /* democonfigENABLE_DPS_SAMPLE */
             configASSERT(xResult == eAzureIoTSuccess);
+            xMqttReadyTick = xTaskGetTickCount();
+
+#ifdef democonfigENABLE_DPS_SAMPLE
+            /* The cached assignment has been confirmed by the hub. */
+            DPSCache_Reached(&xDPSCache);
+#endif /* democonfigENABLE_DPS_SAMPLE */
 
+            /* IoT Hub keeps only the cloud to device subscription in a persistent session, so
+             * every subscription is sent again. They are pipelined: the first two are not waited
+             * for, the properties subscribe waits for all three SUBACKs and fails the connect if
+             * any subscription was rejected. */
             xResult = AzureIoTHubClient_SubscribeCloudToDeviceMessage(&xAzureIoTHubClient, prvHandleCloudMessage,
-                                                                      &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT);
+                                                                      &xAzureIoTHubClient, 0);
             configASSERT(xResult == eAzureIoTSuccess);
 
             xResult = AzureIoTHubClient_SubscribeCommand(&xAzureIoTHubClient, prvHandleCommand,
-                                                         &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT);
+                                                         &xAzureIoTHubClient, 0);
             configASSERT(xResult == eAzureIoTSuccess);
 
             xResult = AzureIoTHubClient_SubscribeProperties(&xAzureIoTHubClient, prvHandlePropertiesMessage,
@@ -463,61 +1080,123 @@ static void prvAzureDemoTask(void *pvParameters)
             xResult = AzureIoTHubClient_RequestPropertiesAsync(&xAzureIoTHubClient);
             configASSERT(xResult == eAzureIoTSuccess);
 
-            /* Create a bag of properties for the telemetry */
-            xResult = AzureIoTMessage_PropertiesInit(&xPropertyBag, ucPropertyBuffer, 0, sizeof(ucPropertyBuffer));
-            configASSERT(xResult == eAzureIoTSuccess);
+#ifdef democonfigENABLE_ADU_SAMPLE
+            /* A download keeps running across reconnects, report it rather than idle. */
+            xResult = prvADUSendAgentState(OTA_IsActive() ? eAzureIoTADUAgentStateDeploymentInProgress
+                                                          : eAzureIoTADUAgentStateIdle,
+                                           NULL);
+            if (xResult != eAzureIoTSuccess)
+            {
+                LogError(("Failed to report the update agent state: result 0x%08x", xResult));
+            }
+#endif /* democonfigENABLE_ADU_SAMPLE */
 
-            /* Sending a default property (Content-Type). */
-            xResult = AzureIoTMessage_PropertiesAppend(&xPropertyBag,
-                                                       (uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE) - 1,
-                                                       (uint8_t *)sampleazureiotMESSAGE_CONTENT_TYPE, sizeof(sampleazureiotMESSAGE_CONTENT_TYPE) - 1);
-            configASSERT(xResult == eAzureIoTSuccess);
+            startup_complete(STARTUP_STAGE_MQTT);
 
-            /* Sending a default property (Content-Encoding). */
-            xResult = AzureIoTMessage_PropertiesAppend(&xPropertyBag,
-                                                       (uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING) - 1,
-                                                       (uint8_t *)sampleazureiotMESSAGE_CONTENT_ENCODING, sizeof(sampleazureiotMESSAGE_CONTENT_ENCODING) - 1);
-            configASSERT(xResult == eAzureIoTSuccess);
+            if (xDisconnectTick != 0)
+            {
+                LogInfo(("Reconnected in %lu ms (TLS %lu ms, MQTT %lu ms, subscribe %lu ms, session present %d).\r\n",
+                         (unsigned long)pdTICKS_TO_MS(xTaskGetTickCount() - xDisconnectTick),
+                         (unsigned long)pdTICKS_TO_MS(xTlsReadyTick - xConnectStartTick),
+                         (unsigned long)pdTICKS_TO_MS(xMqttReadyTick - xTlsReadyTick),
+                         (unsigned long)pdTICKS_TO_MS(xTaskGetTickCount() - xMqttReadyTick),
+                         xSessionPresent));
+            }
 
-            /* How to send an user-defined custom property. */
-            xResult = AzureIoTMessage_PropertiesAppend(&xPropertyBag, (uint8_t *)"name", sizeof("name") - 1,
-                                                       (uint8_t *)"value", sizeof("value") - 1);
-            configASSERT(xResult == eAzureIoTSuccess);
+            /* Create a bag of properties for the telemetry and the summaries of each motor */
+            for (ucMotor = 0; ucMotor < sampleazureiotMOTOR_COUNT; ucMotor++)
+            {
+                xResult = AzureIoTMessage_PropertiesInit(&xPropertyBag[ucMotor], ucPropertyBuffer[ucMotor], 0, sizeof(ucPropertyBuffer[ucMotor]));
+                configASSERT(xResult == eAzureIoTSuccess);
+
+                /* Sending a default property (Content-Type). */
+                xResult = AzureIoTMessage_PropertiesAppend(&xPropertyBag[ucMotor],
+                                                           (uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE) - 1,
+                                                           (uint8_t *)sampleazureiotMESSAGE_CONTENT_TYPE, sizeof(sampleazureiotMESSAGE_CONTENT_TYPE) - 1);
+                configASSERT(xResult == eAzureIoTSuccess);
 
-            process_semaphore = xSemaphoreCreateBinary();
+                /* Sending a default property (Content-Encoding). */
+                xResult = AzureIoTMessage_PropertiesAppend(&xPropertyBag[ucMotor],
+                                                           (uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING) - 1,
+                                                           (uint8_t *)sampleazureiotMESSAGE_CONTENT_ENCODING, sizeof(sampleazureiotMESSAGE_CONTENT_ENCODING) - 1);
+                configASSERT(xResult == eAzureIoTSuccess);
 
-            if (xAzureSample_IsConnectedToInternet())
-            {
-                xTaskCreate(process_loop_task,
-                            "Process Loop Task",
-                            1024 * 3,
-                            NULL,
-                            configMAX_PRIORITIES - 3,
-                            NULL);
+                /* The motor the frame came from, for routes and the host tools. */
+                xResult = prvAppendNumberProperty(&xPropertyBag[ucMotor], "motor", ucMotor, cMotor, sizeof(cMotor));
+                configASSERT(xResult == eAzureIoTSuccess);
+
+                /* Frame summaries are always JSON, even when frames are compressed. */
+                xResult = AzureIoTMessage_PropertiesInit(&xSummaryPropertyBag[ucMotor], ucSummaryPropertyBuffer[ucMotor], 0, sizeof(ucSummaryPropertyBuffer[ucMotor]));
+                configASSERT(xResult == eAzureIoTSuccess);
+
+                xResult = AzureIoTMessage_PropertiesAppend(&xSummaryPropertyBag[ucMotor],
+                                                           (uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_TYPE) - 1,
+                                                           (uint8_t *)sampleazureiotSUMMARY_CONTENT_TYPE, sizeof(sampleazureiotSUMMARY_CONTENT_TYPE) - 1);
+                configASSERT(xResult == eAzureIoTSuccess);
+
+                xResult = AzureIoTMessage_PropertiesAppend(&xSummaryPropertyBag[ucMotor],
+                                                           (uint8_t *)AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING, sizeof(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING) - 1,
+                                                           (uint8_t *)sampleazureiotSUMMARY_CONTENT_ENCODING, sizeof(sampleazureiotSUMMARY_CONTENT_ENCODING) - 1);
+                configASSERT(xResult == eAzureIoTSuccess);
+
+                xResult = AzureIoTMessage_PropertiesAppend(&xSummaryPropertyBag[ucMotor], (uint8_t *)"type", sizeof("type") - 1,
+                                                           (uint8_t *)sampleazureiotSUMMARY_TYPE, sizeof(sampleazureiotSUMMARY_TYPE) - 1);
+                configASSERT(xResult == eAzureIoTSuccess);
+
+                xResult = prvAppendNumberProperty(&xSummaryPropertyBag[ucMotor], "motor", ucMotor, cMotor, sizeof(cMotor));
+                configASSERT(xResult == eAzureIoTSuccess);
+
+                /* The other motors are components of the twin, their telemetry is tagged with theirs. */
+                if (ucMotor > 0)
+                {
+                    lLength = snprintf(cComponent, sizeof(cComponent), "motor%u", ucMotor);
+                    xResult = AzureIoTMessage_PropertiesAppend(&xPropertyBag[ucMotor],
+                                                               (uint8_t *)AZ_IOT_MESSAGE_COMPONENT_NAME, sizeof(AZ_IOT_MESSAGE_COMPONENT_NAME) - 1,
+                                                               (uint8_t *)cComponent, (uint32_t)lLength);
+                    configASSERT(xResult == eAzureIoTSuccess);
+
+                    xResult = AzureIoTMessage_PropertiesAppend(&xSummaryPropertyBag[ucMotor],
+                                                               (uint8_t *)AZ_IOT_MESSAGE_COMPONENT_NAME, sizeof(AZ_IOT_MESSAGE_COMPONENT_NAME) - 1,
+                                                               (uint8_t *)cComponent, (uint32_t)lLength);
+                    configASSERT(xResult == eAzureIoTSuccess);
+                }
             }
 
-            /* Publish messages with QoS0*/
+            /* From here this task is the only user of the MQTT context: inbound packets are
+             * processed as soon as the socket is readable, and publishes from other tasks
+             * arrive through the request queue. */
             for (; xAzureSample_IsConnectedToInternet();)
             {
-                // Clear buffer
-                ulScratchBufferLength = sizeof(ucScratchBuffer);
-                memset((char *)ucScratchBuffer, '\0', ulScratchBufferLength);
+                lWaitStatus = TLS_Socket_Wait(&xNetworkContext, xNetworkRequests.lWakeupFd, sampleazureiotNETWORK_IDLE_TIMEOUT_MS);
+                if (lWaitStatus < 0)
+                    break;
 
-                // Send new sample if it is ready
-                if (get_sample_string((char *)ucScratchBuffer))
-                {
-                    ulScratchBufferLength = sizeof(ucScratchBuffer);
+                if (lWaitStatus & tlsWAIT_WAKEUP)
+                    NetworkRequests_ClearWakeup(&xNetworkRequests);
 
-                    xResult = AzureIoTHubClient_SendTelemetry(&xAzureIoTHubClient,
-                                                              ucScratchBuffer, ulScratchBufferLength,
-                                                              &xPropertyBag, eAzureIoTHubMessageQoS1, NULL);
-                    if (xResult != eAzureIoTSuccess)
+                /* An idle timeout also runs the process loop so keep-alive pings go out. */
+                if ((lWaitStatus & tlsWAIT_READABLE) || (lWaitStatus == 0))
+                {
+                    llInboundTime = esp_timer_get_time();
+                    if (AzureIoTHubClient_ProcessLoop(&xAzureIoTHubClient, 0) != eAzureIoTSuccess)
                         break;
-                    // configASSERT(xResult == eAzureIoTSuccess);
+
+                    /* The motors' link timeout runs from the last loop that heard the hub */
+                    safety_heartbeat();
                 }
 
-                xSemaphoreGive(process_semaphore);
-                vTaskDelay(TELEMETRY_INTERVAL);
+                if (prvProcessNetworkRequests(xPropertyBag, xSummaryPropertyBag) != eAzureIoTSuccess)
+                    break;
+
+                if (ulCaptureUploadPending != 0)
+                {
+                    if (prvProcessCaptureUpload() != eAzureIoTSuccess)
+                        break;
+
+                    /* Come straight back for the next chunk after servicing the socket */
+                    if (ulCaptureUploadPending != 0)
+                        NetworkRequests_Wake(&xNetworkRequests);
+                }
             }
 
             // if (xAzureSample_IsConnectedToInternet())
@@ -541,6 +1220,7 @@ static void prvAzureDemoTask(void *pvParameters)
 
             /* Close the network connection.  */
             TLS_Socket_Disconnect(&xNetworkContext);
+            xDisconnectTick = xTaskGetTickCount();
 
             /* Wait for some time between two iterations to ensure that we do not
              * bombard the IoT Hub. */
@@ -559,18 +1239,17 @@ static void prvAzureDemoTask(void *pvParameters)
  * @brief Get IoT Hub endpoint and device Id info, when Provisioning service is used.
  *   This function will block for Provisioning service for result or return failure.
  */
-static uint32_t prvIoTHubInfoGet(NetworkCredentials_t *pXNetworkCredentials,
-                                 uint8_t **ppucIothubHostname,
+static uint32_t prvIoTHubInfoGet(void *pvContext,
+                                 uint8_t *pucIothubHostname,
                                  uint32_t *pulIothubHostnameLength,
-                                 uint8_t **ppucIothubDeviceId,
+                                 uint8_t *pucIothubDeviceId,
                                  uint32_t *pulIothubDeviceIdLength)
 {
+    NetworkCredentials_t *pXNetworkCredentials = (NetworkCredentials_t *)pvContext;
     NetworkContext_t xNetworkContext = {0};
     TlsTransportParams_t xTlsTransportParams = {0};
     AzureIoTResult_t xResult;
     AzureIoTTransportInterface_t xTransport;
-    uint32_t ucSamplepIothubHostnameLength = sizeof(ucSampleIotHubHostname);
-    uint32_t ucSamplepIothubDeviceIdLength = sizeof(ucSampleIotHubDeviceId);
     uint32_t ulStatus;
 
     /* Set the pParams member of the network context with desired transport. */
@@ -610,7 +1289,7 @@ static uint32_t prvIoTHubInfoGet(NetworkCredentials_t *pXNetworkCredentials,
 #else
                                               sizeof(democonfigREGISTRATION_ID) - 1,
 #endif
-                                              NULL, ucMQTTMessageBuffer, sizeof(ucMQTTMessageBuffer),
+                                              NULL, pucMQTTMessageBuffer, democonfigNETWORK_BUFFER_SIZE,
                                               ullGetUnixTime,
                                               &xTransport);
     configASSERT(xResult == eAzureIoTSuccess);
@@ -632,8 +1311,8 @@ static uint32_t prvIoTHubInfoGet(NetworkCredentials_t *pXNetworkCredentials,
     configASSERT(xResult == eAzureIoTSuccess);
 
     xResult = AzureIoTProvisioningClient_GetDeviceAndHub(&xAzureIoTProvisioningClient,
-                                                         ucSampleIotHubHostname, &ucSamplepIothubHostnameLength,
-                                                         ucSampleIotHubDeviceId, &ucSamplepIothubDeviceIdLength);
+                                                         pucIothubHostname, pulIothubHostnameLength,
+                                                         pucIothubDeviceId, pulIothubDeviceIdLength);
     configASSERT(xResult == eAzureIoTSuccess);
 
     AzureIoTProvisioningClient_Deinit(&xAzureIoTProvisioningClient);
@@ -641,11 +1320,6 @@ static uint32_t prvIoTHubInfoGet(NetworkCredentials_t *pXNetworkCredentials,
     /* Close the network connection.  */
     TLS_Socket_Disconnect(&xNetworkContext);
 
-    *ppucIothubHostname = ucSampleIotHubHostname;
-    *pulIothubHostnameLength = ucSamplepIothubHostnameLength;
-    *ppucIothubDeviceId = ucSampleIotHubDeviceId;
-    *pulIothubDeviceIdLength = ucSamplepIothubDeviceIdLength;
-
     return 0;
 }
 
@@ -682,7 +1356,7 @@ static uint32_t prvConnectToServerWithBackoffRetries(const char *pcHostName,
         xNetworkStatus = TLS_Socket_Connect(pxNetworkContext,
                                             pcHostName, port,
                                             pxNetworkCredentials,
-                                            sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                            sampleazureiotTRANSPORT_RECV_TIMEOUT_MS,
                                             sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS);
 
         if (xNetworkStatus != eTLSTransportSuccess)
@@ -717,6 +1391,17 @@ static uint32_t prvConnectToServerWithBackoffRetries(const char *pcHostName,
  */
 void vStartDemoTask(void)
 {
+    esp_vfs_eventfd_config_t xEventfdConfig = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    int lWakeupFd;
+
+    /* Outbound requests are queued here and signalled through an eventfd, which the
+     * network task waits on together with the TLS socket. */
+    ESP_ERROR_CHECK(esp_vfs_eventfd_register(&xEventfdConfig));
+    lWakeupFd = eventfd(0, 0);
+    configASSERT(lWakeupFd >= 0);
+
+    NetworkRequests_Init(&xNetworkRequests, lWakeupFd);
+
     /* This example uses a single application task, which in turn is used to
      * connect, subscribe, publish, unsubscribe and disconnect from the IoT Hub */
     xTaskCreate(prvAzureDemoTask,         /* Function that implements the task. */
@@ -744,6 +1429,30 @@ static void prvSkipPropertyAndValue(AzureIoTJSONReader_t *pxReader)
 
 /*-----------------------------------------------------------*/
 
+/**
+ * @brief Maps a twin component or command prefix of the form "motorN" to the motor's index.
+ *
+ * @return true if it names one of the motors after the first.
+ */
+static bool prvGetMotorComponent(const uint8_t *pucName, uint32_t ulNameLength, uint8_t *pucMotor)
+{
+    char cComponent[12];
+    int lLength;
+
+    for (uint8_t ucMotor = 1; ucMotor < sampleazureiotMOTOR_COUNT; ucMotor++)
+    {
+        lLength = snprintf(cComponent, sizeof(cComponent), "motor%u", ucMotor);
+        if (((uint32_t)lLength == ulNameLength) && (memcmp(cComponent, pucName, ulNameLength) == 0))
+        {
+            *pucMotor = ucMotor;
+            return true;
+        }
+    }
+
+    return false;
+}
+/*-----------------------------------------------------------*/
+
 void process_properties(AzureIoTHubClientPropertiesResponse_t *pxMessage,
                         AzureIoTHubClientPropertyType_t xPropertyType)
 {
@@ -752,6 +1461,7 @@ void process_properties(AzureIoTHubClientPropertiesResponse_t *pxMessage,
     const uint8_t *pucComponentName = NULL;
     uint32_t ulComponentNameLength = 0;
     uint32_t ulOutVersion;
+    uint8_t ucMotor;
 
     int32_t mode = 0;
     double gain = 0;
@@ -777,14 +1487,27 @@ void process_properties(AzureIoTHubClientPropertiesResponse_t *pxMessage,
                                                                                pxMessage->xMessageType, xPropertyType,
                                                                                &pucComponentName, &ulComponentNameLength)) == eAzureIoTSuccess)
         {
-            if (ulComponentNameLength > 0)
+            /* Root properties are the first motor's, the others are under their components */
+            ucMotor = 0;
+            if ((ulComponentNameLength > 0) && !prvGetMotorComponent(pucComponentName, ulComponentNameLength, &ucMotor))
             {
+#ifdef democonfigENABLE_ADU_SAMPLE
+                if (AzureIoTADUClient_IsADUComponent(&xAzureIoTADUClient, pucComponentName, ulComponentNameLength))
+                {
+                    /* Consumes the component value, the reader is lost if it fails. */
+                    if (prvADUProcessRequest(&xReader, ulOutVersion) != eAzureIoTSuccess)
+                        break;
+                    continue;
+                }
+#endif /* democonfigENABLE_ADU_SAMPLE */
                 LogInfo(("Unknown component name received"));
                 prvSkipPropertyAndValue(&xReader);
+                continue;
             }
-            else if (AzureIoTJSONReader_TokenIsTextEqual(&xReader,
-                                                         (const uint8_t *)PROPERTY_TARGET_MODE_TEXT,
-                                                         sizeof(PROPERTY_TARGET_MODE_TEXT) - 1))
+
+            if (AzureIoTJSONReader_TokenIsTextEqual(&xReader,
+                                                    (const uint8_t *)PROPERTY_TARGET_MODE_TEXT,
+                                                    sizeof(PROPERTY_TARGET_MODE_TEXT) - 1))
             {
                 xResult = AzureIoTJSONReader_NextToken(&xReader);
                 configASSERT(xResult == eAzureIoTSuccess);
@@ -798,10 +1521,18 @@ void process_properties(AzureIoTHubClientPropertiesResponse_t *pxMessage,
 
                 xResult = AzureIoTJSONReader_NextToken(&xReader);
                 configASSERT(xResult == eAzureIoTSuccess);
-                set_desired_mode(mode);
-            }
-            else if (AzureIoTJSONReader_TokenIsTextEqual(&xReader,
-                                                         (const uint8_t *)PROPERTY_TARGET_GAIN_TEXT,
+
+                if ((mode < COMMAND_MODE_MIN) || (mode > COMMAND_MODE_MAX))
+                {
+                    LogError(("Ignoring desired mode %ld", (long)mode));
+                }
+                else
+                {
+                    set_desired_mode(ucMotor, mode);
+                }
+            }
+            else if (AzureIoTJSONReader_TokenIsTextEqual(&xReader,
+                                                         (const uint8_t *)PROPERTY_TARGET_GAIN_TEXT,
                                                          sizeof(PROPERTY_TARGET_GAIN_TEXT) - 1))
             {
                 xResult = AzureIoTJSONReader_NextToken(&xReader);
@@ -816,7 +1547,7 @@ void process_properties(AzureIoTHubClientPropertiesResponse_t *pxMessage,
 
                 xResult = AzureIoTJSONReader_NextToken(&xReader);
                 configASSERT(xResult == eAzureIoTSuccess);
-                set_desired_gain((float)gain);
+                set_desired_gain(ucMotor, (float)gain);
             }
             else if (AzureIoTJSONReader_TokenIsTextEqual(&xReader,
                                                          (const uint8_t *)PROPERTY_TARGET_FREQ_TEXT,
@@ -834,7 +1565,7 @@ void process_properties(AzureIoTHubClientPropertiesResponse_t *pxMessage,
 
                 xResult = AzureIoTJSONReader_NextToken(&xReader);
                 configASSERT(xResult == eAzureIoTSuccess);
-                set_desired_frequency((float)frequency);
+                set_desired_frequency(ucMotor, (float)frequency);
             }
             else if (AzureIoTJSONReader_TokenIsTextEqual(&xReader,
                                                          (const uint8_t *)PROPERTY_TARGET_POS_TEXT,
@@ -852,7 +1583,7 @@ void process_properties(AzureIoTHubClientPropertiesResponse_t *pxMessage,
 
                 xResult = AzureIoTJSONReader_NextToken(&xReader);
                 configASSERT(xResult == eAzureIoTSuccess);
-                set_desired_position((float)position);
+                set_desired_position(ucMotor, (float)position);
             }
             else if (AzureIoTJSONReader_TokenIsTextEqual(&xReader,
                                                          (const uint8_t *)PROPERTY_TARGET_VEL_TEXT,
@@ -870,7 +1601,7 @@ void process_properties(AzureIoTHubClientPropertiesResponse_t *pxMessage,
 
                 xResult = AzureIoTJSONReader_NextToken(&xReader);
                 configASSERT(xResult == eAzureIoTSuccess);
-                set_desired_velocity((float)velocity);
+                set_desired_velocity(ucMotor, (float)velocity);
             }
             else
             {
@@ -891,18 +1622,652 @@ void process_properties(AzureIoTHubClientPropertiesResponse_t *pxMessage,
     }
 }
 
-static void process_loop_task(void *arg)
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Positions the reader on the value of a top-level member of a command payload.
+ *
+ * @return true if the member was found.
+ */
+static bool prvFindCommandValue(AzureIoTJSONReader_t *pxReader,
+                                const uint8_t *pucPayload,
+                                uint32_t ulPayloadLength,
+                                const char *pcName)
+{
+    AzureIoTJSONTokenType_t xTokenType;
+
+    if ((ulPayloadLength == 0) ||
+        (AzureIoTJSONReader_Init(pxReader, pucPayload, ulPayloadLength) != eAzureIoTSuccess) ||
+        (AzureIoTJSONReader_NextToken(pxReader) != eAzureIoTSuccess) ||
+        (AzureIoTJSONReader_TokenType(pxReader, &xTokenType) != eAzureIoTSuccess) ||
+        (xTokenType != eAzureIoTJSONTokenBEGIN_OBJECT))
+    {
+        return false;
+    }
+
+    while ((AzureIoTJSONReader_NextToken(pxReader) == eAzureIoTSuccess) &&
+           (AzureIoTJSONReader_TokenType(pxReader, &xTokenType) == eAzureIoTSuccess) &&
+           (xTokenType == eAzureIoTJSONTokenPROPERTY_NAME))
+    {
+        bool xMatch = AzureIoTJSONReader_TokenIsTextEqual(pxReader, (const uint8_t *)pcName, strlen(pcName));
+
+        if (AzureIoTJSONReader_NextToken(pxReader) != eAzureIoTSuccess)
+        {
+            return false;
+        }
+
+        if (xMatch)
+        {
+            return true;
+        }
+
+        if (AzureIoTJSONReader_SkipChildren(pxReader) != eAzureIoTSuccess)
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvGetCommandDouble(const uint8_t *pucPayload, uint32_t ulPayloadLength,
+                                const char *pcName, double *pxValue)
+{
+    AzureIoTJSONReader_t xReader;
+
+    return prvFindCommandValue(&xReader, pucPayload, ulPayloadLength, pcName) &&
+           (AzureIoTJSONReader_GetTokenDouble(&xReader, pxValue) == eAzureIoTSuccess);
+}
+/*-----------------------------------------------------------*/
+
+static bool prvGetCommandInt32(const uint8_t *pucPayload, uint32_t ulPayloadLength,
+                               const char *pcName, int32_t *plValue)
+{
+    AzureIoTJSONReader_t xReader;
+
+    return prvFindCommandValue(&xReader, pucPayload, ulPayloadLength, pcName) &&
+           (AzureIoTJSONReader_GetTokenInt32(&xReader, plValue) == eAzureIoTSuccess);
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Reads a top-level array of numbers from a command payload.
+ *
+ * @return true if the member was an array of numbers that fit in pfValues.
+ */
+static bool prvGetCommandFloatArray(const uint8_t *pucPayload, uint32_t ulPayloadLength,
+                                    const char *pcName, float *pfValues, uint32_t ulMaxCount,
+                                    uint32_t *pulCount)
+{
+    AzureIoTJSONReader_t xReader;
+    AzureIoTJSONTokenType_t xTokenType;
+    double xValue;
+
+    *pulCount = 0;
+
+    if (!prvFindCommandValue(&xReader, pucPayload, ulPayloadLength, pcName) ||
+        (AzureIoTJSONReader_TokenType(&xReader, &xTokenType) != eAzureIoTSuccess) ||
+        (xTokenType != eAzureIoTJSONTokenBEGIN_ARRAY))
+    {
+        return false;
+    }
+
+    while ((AzureIoTJSONReader_NextToken(&xReader) == eAzureIoTSuccess) &&
+           (AzureIoTJSONReader_TokenType(&xReader, &xTokenType) == eAzureIoTSuccess))
+    {
+        if (xTokenType == eAzureIoTJSONTokenEND_ARRAY)
+        {
+            return true;
+        }
+
+        if ((*pulCount >= ulMaxCount) ||
+            (AzureIoTJSONReader_GetTokenDouble(&xReader, &xValue) != eAzureIoTSuccess))
+        {
+            return false;
+        }
+
+        pfValues[(*pulCount)++] = (float)xValue;
+    }
+
+    return false;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Stops every motor immediately, whichever one it is sent to. The payload is ignored.
+ */
+static uint32_t prvCommandStop(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    (void)ucMotor;
+    (void)pucPayload;
+    (void)ulPayloadLength;
+
+    emergency_stop();
+    return COMMAND_STATUS_OK;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Changes the controller mode, e.g. {"mode": 3}.
+ */
+static uint32_t prvCommandSetMode(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    int32_t mode;
+
+    if (!prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_MODE_TEXT, &mode) ||
+        (mode < COMMAND_MODE_MIN) || (mode > COMMAND_MODE_MAX))
+    {
+        return COMMAND_STATUS_BAD_REQUEST;
+    }
+
+    set_desired_mode(ucMotor, mode);
+    return COMMAND_STATUS_OK;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Updates the set points without changing mode, e.g. {"velocity": 30}.
+ */
+static uint32_t prvCommandSetSetpoint(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    double position;
+    double velocity;
+    bool xHasPosition = prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_POS_TEXT, &position);
+    bool xHasVelocity = prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_VEL_TEXT, &velocity);
+
+    if (!xHasPosition && !xHasVelocity)
+    {
+        return COMMAND_STATUS_BAD_REQUEST;
+    }
+
+    if (xHasPosition)
+    {
+        set_desired_position(ucMotor, (float)position);
+    }
+
+    if (xHasVelocity)
+    {
+        set_desired_velocity(ucMotor, (float)velocity);
+    }
+
+    return COMMAND_STATUS_OK;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Steps to a new set point and switches into the matching automatic mode,
+ * e.g. {"position": 90}.
+ */
+static uint32_t prvCommandStep(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    double value;
+
+    if (prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_POS_TEXT, &value))
+    {
+        step_desired_position(ucMotor, (float)value);
+    }
+    else if (prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_VEL_TEXT, &value))
+    {
+        step_desired_velocity(ucMotor, (float)value);
+    }
+    else
+    {
+        return COMMAND_STATUS_BAD_REQUEST;
+    }
+
+    return COMMAND_STATUS_OK;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Triggers a capture now. Fails with 409 while one is recording or being uploaded.
+ */
+static uint32_t prvCommandStartCapture(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    (void)pucPayload;
+    (void)ulPayloadLength;
+
+    return start_capture(ucMotor) ? COMMAND_STATUS_OK : COMMAND_STATUS_CONFLICT;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Runs system identification, e.g. {"excitation": 0, "order": 2, "offset": 0.5,
+ * "amplitude": 0.2, "duration": 10, "response": 0, "apply": 1}. Every member is optional;
+ * excitation 0 is PRBS and 1 a chirp. The model is reported when the run finishes.
+ */
+static uint32_t prvCommandIdentify(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    int32_t lExcitation = 0;
+    int32_t lOrder = 2;
+    int32_t lApply = 0;
+    double xOffset = 0.5;
+    double xAmplitude = 0.2;
+    double xDuration = 10.0;
+    double xResponse = 0.0;
+    esp_err_t xError;
+
+    (void)prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_EXCITATION_TEXT, &lExcitation);
+    (void)prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_ORDER_TEXT, &lOrder);
+    (void)prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_APPLY_TEXT, &lApply);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_OFFSET_TEXT, &xOffset);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_AMPLITUDE_TEXT, &xAmplitude);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_DURATION_TEXT, &xDuration);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_RESPONSE_TEXT, &xResponse);
+
+    xError = start_system_id(ucMotor, lExcitation, lOrder, (float)xOffset, (float)xAmplitude,
+                             (float)xDuration, (float)xResponse, lApply != 0);
+    if (xError == ESP_ERR_INVALID_STATE)
+        return COMMAND_STATUS_CONFLICT;
+    if (xError != ESP_OK)
+        return COMMAND_STATUS_BAD_REQUEST;
+
+    return COMMAND_STATUS_OK;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Tunes the velocity controller by relay feedback at evenly spaced set points, e.g.
+ * {"min": 40, "max": 160, "points": 4, "amplitude": 0.1, "hysteresis": 1, "save": 1}.
+ * Every member is optional. {"clear": 1} drops the schedule and returns to the fixed gains.
+ * The schedule is reported when tuning finishes.
+ */
+static uint32_t prvCommandAutotune(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    int32_t lPoints = 4;
+    int32_t lSave = 1;
+    int32_t lClear = 0;
+    double xMin = 40.0;
+    double xMax = 160.0;
+    double xAmplitude = 0.1;
+    double xHysteresis = 1.0;
+    esp_err_t xError;
+
+    (void)prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_CLEAR_TEXT, &lClear);
+    if (lClear != 0)
+    {
+        clear_gain_schedule(ucMotor);
+        (void)azure_request_publish(AZURE_REQUEST_GAIN_SCHEDULE, &ucMotor, sizeof(ucMotor));
+        return COMMAND_STATUS_OK;
+    }
+
+    (void)prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_POINTS_TEXT, &lPoints);
+    (void)prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_SAVE_TEXT, &lSave);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_MIN_TEXT, &xMin);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_MAX_TEXT, &xMax);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_AMPLITUDE_TEXT, &xAmplitude);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_HYSTERESIS_TEXT, &xHysteresis);
+
+    xError = start_autotune(ucMotor, (float)xMin, (float)xMax, lPoints, (float)xAmplitude,
+                            (float)xHysteresis, lSave != 0);
+    if (xError == ESP_ERR_INVALID_STATE)
+        return COMMAND_STATUS_CONFLICT;
+    if (xError != ESP_OK)
+        return COMMAND_STATUS_BAD_REQUEST;
+
+    return COMMAND_STATUS_OK;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Measures breakaway, Coulomb and viscous friction in both directions and rebuilds the
+ * duty cycle map, e.g. {"save": 1}. The motor runs unloaded for about half a minute. A new map
+ * drops the gain schedule, which was tuned through the old one. {"clear": 1} returns to the
+ * fixed remap. The map is reported when calibration finishes.
+ */
+static uint32_t prvCommandCalibrate(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    int32_t lSave = 1;
+    int32_t lClear = 0;
+    esp_err_t xError;
+
+    (void)prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_CLEAR_TEXT, &lClear);
+    if (lClear != 0)
+    {
+        clear_friction_calibration(ucMotor);
+        (void)azure_request_publish(AZURE_REQUEST_ACTUATOR, &ucMotor, sizeof(ucMotor));
+        return COMMAND_STATUS_OK;
+    }
+
+    (void)prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_SAVE_TEXT, &lSave);
+
+    xError = start_friction_calibration(ucMotor, lSave != 0);
+    if (xError == ESP_ERR_INVALID_STATE)
+        return COMMAND_STATUS_CONFLICT;
+    if (xError != ESP_OK)
+        return COMMAND_STATUS_BAD_REQUEST;
+
+    return COMMAND_STATUS_OK;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Selects the reference profile of the automatic modes, e.g. {"profile": 1,
+ * "velocity": 60, "acceleration": 300, "jerk": 3000}. Profiles are 0 square, 1 S-curve,
+ * 2 sine, 3 triangle and 4 the uploaded waveform. The S-curve limits are in RPM, RPM/s and
+ * RPM/s^2, jerk 0 is unlimited. Every member is optional.
+ */
+static uint32_t prvCommandSetProfile(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    int32_t lProfile = 1;
+    double xVelocity = 60.0;
+    double xAcceleration = 300.0;
+    double xJerk = 3000.0;
+    esp_err_t xError;
+
+    (void)prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_PROFILE_TEXT, &lProfile);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_VEL_TEXT, &xVelocity);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_ACCELERATION_TEXT, &xAcceleration);
+    (void)prvGetCommandDouble(pucPayload, ulPayloadLength, COMMAND_JERK_TEXT, &xJerk);
+
+    xError = set_motion_profile(ucMotor, lProfile, (float)xVelocity, (float)xAcceleration, (float)xJerk);
+    if (xError == ESP_ERR_INVALID_STATE)
+        return COMMAND_STATUS_CONFLICT;
+    if (xError != ESP_OK)
+        return COMMAND_STATUS_BAD_REQUEST;
+
+    return COMMAND_STATUS_OK;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Uploads one cycle of the waveform profile, e.g. {"points": [0, 1, 0, -1]}. Points are
+ * evenly spaced over a cycle of two reversals, normalised to [-1, 1] and scaled by the set point.
+ */
+static uint32_t prvCommandSetWaveform(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    float pfPoints[COMMAND_MAX_WAVEFORM_POINTS];
+    uint32_t ulCount;
+
+    if (!prvGetCommandFloatArray(pucPayload, ulPayloadLength, COMMAND_POINTS_TEXT,
+                                 pfPoints, COMMAND_MAX_WAVEFORM_POINTS, &ulCount))
+    {
+        return COMMAND_STATUS_BAD_REQUEST;
+    }
+
+    return (set_motion_waveform(ucMotor, pfPoints, ulCount) == ESP_OK) ? COMMAND_STATUS_OK : COMMAND_STATUS_BAD_REQUEST;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Releases the bridge after a latched safety fault, leaving the motor off. Fails with
+ * 409 when no fault is latched. A fault still present trips again.
+ */
+static uint32_t prvCommandClearFault(uint8_t ucMotor, const uint8_t *pucPayload, uint32_t ulPayloadLength)
+{
+    (void)pucPayload;
+    (void)ulPayloadLength;
+
+    return (clear_fault(ucMotor) == ESP_OK) ? COMMAND_STATUS_OK : COMMAND_STATUS_CONFLICT;
+}
+/*-----------------------------------------------------------*/
+
+static const CommandEntry_t xCommandTable[] =
+{
+    { COMMAND_STOP_TEXT,         prvCommandStop         },
+    { COMMAND_SET_MODE_TEXT,     prvCommandSetMode      },
+    { COMMAND_SET_SETPOINT_TEXT, prvCommandSetSetpoint  },
+    { COMMAND_STEP_TEXT,         prvCommandStep         },
+    { COMMAND_START_CAPTURE_TEXT, prvCommandStartCapture },
+    { COMMAND_IDENTIFY_TEXT,     prvCommandIdentify     },
+    { COMMAND_AUTOTUNE_TEXT,     prvCommandAutotune     },
+    { COMMAND_CALIBRATE_TEXT,    prvCommandCalibrate    },
+    { COMMAND_SET_PROFILE_TEXT,  prvCommandSetProfile   },
+    { COMMAND_SET_WAVEFORM_TEXT, prvCommandSetWaveform  },
+    { COMMAND_CLEAR_FAULT_TEXT,  prvCommandClearFault   },
+};
+/*-----------------------------------------------------------*/
+
+uint32_t process_command(const uint8_t *pucComponentName, uint16_t usComponentNameLength,
+                         const uint8_t *pucCommandName, uint16_t usCommandNameLength,
+                         const uint8_t *pucPayload, uint32_t ulPayloadLength)
 {
+    uint8_t ucMotor = 0;
+    int32_t lMotor;
+
+    /* Commands of the other motors are sent to their components, "motor1*set_mode", or
+     * name the motor in the payload, {"motor": 1}. Without either they go to the first. */
+    if (usComponentNameLength > 0)
+    {
+        if (!prvGetMotorComponent(pucComponentName, usComponentNameLength, &ucMotor))
+        {
+            return COMMAND_STATUS_NOT_FOUND;
+        }
+    }
+    else if (prvGetCommandInt32(pucPayload, ulPayloadLength, COMMAND_MOTOR_TEXT, &lMotor))
+    {
+        if ((lMotor < 0) || (lMotor >= sampleazureiotMOTOR_COUNT))
+        {
+            return COMMAND_STATUS_BAD_REQUEST;
+        }
+
+        ucMotor = (uint8_t)lMotor;
+    }
+
+    for (uint32_t i = 0; i < sizeof(xCommandTable) / sizeof(xCommandTable[0]); i++)
+    {
+        if ((strlen(xCommandTable[i].pcName) == usCommandNameLength) &&
+            (memcmp(xCommandTable[i].pcName, pucCommandName, usCommandNameLength) == 0))
+        {
+            return xCommandTable[i].xHandler(ucMotor, pucPayload, ulPayloadLength);
+        }
+    }
+
+    return COMMAND_STATUS_NOT_FOUND;
+}
+/*-----------------------------------------------------------*/
+
+#ifdef democonfigENABLE_ADU_SAMPLE
+
+/**
+ * @brief Called on the download task, the result is reported by the network task.
+ */
+static void prvOTAComplete(OTAResult_t xOTAResult)
+{
+    while (!azure_request_publish(AZURE_REQUEST_UPDATE_STATE, (const uint8_t *)&xOTAResult, sizeof(xOTAResult)))
+    {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvADUInit(void)
+{
+    AzureIoTADUClientOptions_t xADUOptions;
     AzureIoTResult_t xResult;
 
-    while (1)
+    xResult = AzureIoTADUClient_OptionsInit(&xADUOptions);
+    configASSERT(xResult == eAzureIoTSuccess);
+
+    xResult = AzureIoTADUClient_Init(&xAzureIoTADUClient, &xADUOptions);
+    configASSERT(xResult == eAzureIoTSuccess);
+
+    xResult = AzureIoTADUClient_DevicePropertiesInit(&xADUDeviceProperties);
+    configASSERT(xResult == eAzureIoTSuccess);
+
+    xADUDeviceProperties.ucManufacturer = (const uint8_t *)democonfigADU_DEVICE_MANUFACTURER;
+    xADUDeviceProperties.ulManufacturerLength = sizeof(democonfigADU_DEVICE_MANUFACTURER) - 1;
+    xADUDeviceProperties.ucModel = (const uint8_t *)democonfigADU_DEVICE_MODEL;
+    xADUDeviceProperties.ulModelLength = sizeof(democonfigADU_DEVICE_MODEL) - 1;
+    xADUDeviceProperties.ucCurrentUpdateId = (const uint8_t *)democonfigADU_UPDATE_ID;
+    xADUDeviceProperties.ulCurrentUpdateIdLength = sizeof(democonfigADU_UPDATE_ID) - 1;
+
+    pucADUBuffer = (uint8_t *)memory_reserve(MEMORY_ARENA_OTA, MEMORY_ADU_BUFFER_SIZE);
+    configASSERT(pucADUBuffer != NULL);
+
+    OTA_Init(prvOTAComplete);
+}
+/*-----------------------------------------------------------*/
+
+static void prvADUKeepString(const uint8_t **ppucValue, uint32_t *pulLength, uint8_t *pucStorage, uint32_t ulStorageSize)
+{
+    if (*ppucValue == NULL)
     {
-        xSemaphoreTake(process_semaphore, portMAX_DELAY);
-        if (xAzureSample_IsConnectedToInternet())
+        *pulLength = 0;
+        return;
+    }
+
+    if (*pulLength > ulStorageSize)
+    {
+        *pulLength = ulStorageSize;
+    }
+
+    memmove(pucStorage, *ppucValue, *pulLength);
+    *ppucValue = pucStorage;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Fill in the image to download from the single file of the update manifest.
+ */
+static bool prvADUGetImage(OTAImage_t *pxImage)
+{
+    AzureIoTADUUpdateManifestFile_t *pxFile;
+    AzureIoTADUUpdateManifestFileUrl_t *pxFileUrl = NULL;
+    size_t xHashLength = 0;
+
+    if (xADUUpdateRequest.xUpdateManifest.ulFilesCount == 0)
+    {
+        return false;
+    }
+
+    pxFile = &xADUUpdateRequest.xUpdateManifest.pxFiles[0];
+
+    for (uint32_t i = 0; i < xADUUpdateRequest.ulFileUrlCount; i++)
+    {
+        if ((xADUUpdateRequest.pxFileUrls[i].ulIdLength == pxFile->ulIdLength) &&
+            (memcmp(xADUUpdateRequest.pxFileUrls[i].pucId, pxFile->pucId, pxFile->ulIdLength) == 0))
+        {
+            pxFileUrl = &xADUUpdateRequest.pxFileUrls[i];
+            break;
+        }
+    }
+
+    if ((pxFileUrl == NULL) || (pxFile->ulHashesCount == 0) ||
+        (pxFile->llSizeInBytes <= 0) || (pxFile->llSizeInBytes > UINT32_MAX))
+    {
+        return false;
+    }
+
+    if (!OTA_ParseUrl(pxFileUrl->pucUrl, pxFileUrl->ulUrlLength, pxImage))
+    {
+        return false;
+    }
+
+    pxImage->ulSize = (uint32_t)pxFile->llSizeInBytes;
+
+    /* The manifest carries the SHA-256 base64 encoded. */
+    if ((mbedtls_base64_decode(pxImage->ucSHA256, sizeof(pxImage->ucSHA256), &xHashLength,
+                               pxFile->pxHashes[0].pucHash, pxFile->pxHashes[0].ulHashLength) != 0) ||
+        (xHashLength != sizeof(pxImage->ucSHA256)))
+    {
+        LogError(("Update manifest has no usable SHA-256 for the image."));
+        return false;
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvADUProcessRequest(AzureIoTJSONReader_t *pxReader, uint32_t ulPropertyVersion)
+{
+    AzureIoTResult_t xResult;
+    AzureIoTADUInstructionStep_t *pxStep;
+
+    xResult = AzureIoTADUClient_ParseRequest(&xAzureIoTADUClient, pxReader, &xADUUpdateRequest);
+
+    if (xResult != eAzureIoTSuccess)
+    {
+        LogError(("Error parsing the update request: result 0x%08x", xResult));
+        return xResult;
+    }
+
+    prvADUKeepString(&xADUUpdateRequest.xWorkflow.pucID, &xADUUpdateRequest.xWorkflow.ulIDLength,
+                     ucADUWorkflowId, sizeof(ucADUWorkflowId));
+    prvADUKeepString(&xADUUpdateRequest.xWorkflow.pucRetryTimestamp, &xADUUpdateRequest.xWorkflow.ulRetryTimestampLength,
+                     ucADURetryTimestamp, sizeof(ucADURetryTimestamp));
+
+    if (xADUUpdateRequest.xWorkflow.xAction == eAzureIoTADUActionCancel)
+    {
+        LogInfo(("Update cancelled by the service."));
+        OTA_Cancel();
+        return prvADUSendAgentState(eAzureIoTADUAgentStateIdle, NULL);
+    }
+
+    if (xADUUpdateRequest.xWorkflow.xAction != eAzureIoTADUActionApplyDownload)
+    {
+        return eAzureIoTSuccess;
+    }
+
+    xResult = AzureIoTADUClient_SendResponse(&xAzureIoTADUClient, &xAzureIoTHubClient,
+                                             eAzureIoTADURequestDecisionAccept, ulPropertyVersion,
+                                             pucADUBuffer, MEMORY_ADU_BUFFER_SIZE, NULL);
+
+    if (xResult != eAzureIoTSuccess)
+    {
+        LogError(("Failed to accept the update request: result 0x%08x", xResult));
+        return xResult;
+    }
+
+    /* The request stays in the twin, so it is seen again after the restart into the new image. */
+    pxStep = &xADUUpdateRequest.xUpdateManifest.xInstructions.pxSteps[0];
+
+    if ((xADUUpdateRequest.xUpdateManifest.xInstructions.ulStepsCount > 0) &&
+        (pxStep->ulInstalledCriteriaLength == sizeof(democonfigADU_UPDATE_VERSION) - 1) &&
+        (memcmp(pxStep->pucInstalledCriteria, democonfigADU_UPDATE_VERSION, pxStep->ulInstalledCriteriaLength) == 0))
+    {
+        LogInfo(("Update %s is already installed.", democonfigADU_UPDATE_VERSION));
+        return prvADUSendAgentState(eAzureIoTADUAgentStateIdle, NULL);
+    }
+
+    if (!OTA_IsActive())
+    {
+        if (!prvADUGetImage(&xADUImage) || !OTA_Start(&xADUImage))
         {
-            LogInfo(("Attempt to receive publish message from IoT Hub.\r\n"));
-            xResult = AzureIoTHubClient_ProcessLoop(&xAzureIoTHubClient, 0);
+            return prvADUReportResult(eOTAResultFailed);
         }
-        vTaskDelay(PROCESS_LOOP_INTERVAL);
     }
-}
\ No newline at end of file
+
+    return prvADUSendAgentState(eAzureIoTADUAgentStateDeploymentInProgress, NULL);
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvADUSendAgentState(AzureIoTADUAgentState_t xAgentState,
+                                             AzureIoTADUClientInstallResult_t *pxInstallResult)
+{
+    return AzureIoTADUClient_SendAgentState(&xAzureIoTADUClient, &xAzureIoTHubClient, &xADUDeviceProperties,
+                                            (xAgentState == eAzureIoTADUAgentStateIdle) ? NULL : &xADUUpdateRequest,
+                                            xAgentState, pxInstallResult,
+                                            pucADUBuffer, MEMORY_ADU_BUFFER_SIZE, NULL);
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvADUReportResult(OTAResult_t xOTAResult)
+{
+    AzureIoTADUClientInstallResult_t xInstallResult;
+
+    if (xOTAResult == eOTAResultSuccess)
+    {
+        /* Success is reported by the new image, through its update id. */
+        OTA_Restart();
+        return eAzureIoTSuccess;
+    }
+
+    if (xOTAResult == eOTAResultCancelled)
+    {
+        /* Idle was reported when the cancel arrived. */
+        return eAzureIoTSuccess;
+    }
+
+    /* A zero result code is a failure to Device Update, the extended code says which. */
+    memset(&xInstallResult, 0, sizeof(xInstallResult));
+    xInstallResult.lExtendedResultCode = (int32_t)xOTAResult;
+    xInstallResult.ulStepResultsCount = 1;
+    xInstallResult.pxStepResults[0].ulExtendedResultCode = (uint32_t)xOTAResult;
+
+    return prvADUSendAgentState(eAzureIoTADUAgentStateFailed, &xInstallResult);
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigENABLE_ADU_SAMPLE */
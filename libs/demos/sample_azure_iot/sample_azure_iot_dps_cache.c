@@ -0,0 +1,169 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_dps_cache.c
+ * @brief The IoT Hub assigned by the Provisioning service, cached in NVS across boots.
+ *
+ * Shared by sample_azure_iot.c and the host's simulator tests, which run it against
+ * their NVS stand-in.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* ESP-IDF includes. */
+#include "nvs.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_dps_cache.h"
+
+/**
+ * @brief NVS namespace and keys holding the assignment.
+ *
+ * The source key records the ID scope and registration ID the assignment was made for,
+ * so a reconfigured device provisions again instead of using a stale hub.
+ */
+#define dpscacheNVS_NAMESPACE        "dps"
+#define dpscacheNVS_KEY_SOURCE       "source"
+#define dpscacheNVS_KEY_HOSTNAME     "hostname"
+#define dpscacheNVS_KEY_DEVICE_ID    "device_id"
+
+#define dpscacheSOURCE_SIZE          ( 256U )
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvLoad( DPSCache_t * pxCache )
+{
+    nvs_handle_t xHandle;
+    char cSource[ dpscacheSOURCE_SIZE ];
+    size_t xSourceLength = sizeof( cSource );
+    size_t xHostnameLength = pxCache->ulHostnameSize;
+    size_t xDeviceIdLength = pxCache->ulDeviceIdSize;
+    uint32_t ulStatus = 1;
+
+    if( nvs_open( dpscacheNVS_NAMESPACE, NVS_READONLY, &xHandle ) != ESP_OK )
+    {
+        return 1;
+    }
+
+    if( ( nvs_get_str( xHandle, dpscacheNVS_KEY_SOURCE, cSource, &xSourceLength ) == ESP_OK ) &&
+        ( strcmp( cSource, pxCache->pcSource ) == 0 ) &&
+        ( nvs_get_blob( xHandle, dpscacheNVS_KEY_HOSTNAME, pxCache->pucHostname, &xHostnameLength ) == ESP_OK ) &&
+        ( nvs_get_blob( xHandle, dpscacheNVS_KEY_DEVICE_ID, pxCache->pucDeviceId, &xDeviceIdLength ) == ESP_OK ) &&
+        ( xHostnameLength > 0 ) && ( xHostnameLength < pxCache->ulHostnameSize ) &&
+        ( xDeviceIdLength > 0 ) )
+    {
+        /* The hostname is used as a C string by the transport. */
+        pxCache->pucHostname[ xHostnameLength ] = '\0';
+        pxCache->ulHostnameLength = ( uint32_t ) xHostnameLength;
+        pxCache->ulDeviceIdLength = ( uint32_t ) xDeviceIdLength;
+        ulStatus = 0;
+    }
+
+    nvs_close( xHandle );
+
+    return ulStatus;
+}
+/*-----------------------------------------------------------*/
+
+static void prvStore( const DPSCache_t * pxCache )
+{
+    nvs_handle_t xHandle;
+
+    if( nvs_open( dpscacheNVS_NAMESPACE, NVS_READWRITE, &xHandle ) != ESP_OK )
+    {
+        LogWarn( ( "Unable to open NVS, IoT Hub assignment not cached.\r\n" ) );
+        return;
+    }
+
+    if( ( nvs_set_str( xHandle, dpscacheNVS_KEY_SOURCE, pxCache->pcSource ) != ESP_OK ) ||
+        ( nvs_set_blob( xHandle, dpscacheNVS_KEY_HOSTNAME, pxCache->pucHostname, pxCache->ulHostnameLength ) != ESP_OK ) ||
+        ( nvs_set_blob( xHandle, dpscacheNVS_KEY_DEVICE_ID, pxCache->pucDeviceId, pxCache->ulDeviceIdLength ) != ESP_OK ) ||
+        ( nvs_commit( xHandle ) != ESP_OK ) )
+    {
+        LogWarn( ( "Unable to write NVS, IoT Hub assignment not cached.\r\n" ) );
+    }
+
+    nvs_close( xHandle );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Runs the Provisioning service again, replacing the cached assignment.
+ */
+static uint32_t prvRefresh( DPSCache_t * pxCache )
+{
+    nvs_handle_t xHandle;
+    uint32_t ulHostnameLength = pxCache->ulHostnameSize;
+    uint32_t ulDeviceIdLength = pxCache->ulDeviceIdSize;
+    uint32_t ulStatus;
+
+    /* Drop the cached assignment first so a failed provisioning is not followed by a stale hub. */
+    if( nvs_open( dpscacheNVS_NAMESPACE, NVS_READWRITE, &xHandle ) == ESP_OK )
+    {
+        ( void ) nvs_erase_all( xHandle );
+        ( void ) nvs_commit( xHandle );
+        nvs_close( xHandle );
+    }
+
+    pxCache->xCached = false;
+
+    ulStatus = pxCache->xProvision( pxCache->pvProvisionContext,
+                                    pxCache->pucHostname, &ulHostnameLength,
+                                    pxCache->pucDeviceId, &ulDeviceIdLength );
+
+    if( ulStatus == 0 )
+    {
+        /* Keep the hostname usable as a C string, as it is when loaded from NVS. */
+        if( ulHostnameLength < pxCache->ulHostnameSize )
+        {
+            pxCache->pucHostname[ ulHostnameLength ] = '\0';
+        }
+
+        pxCache->ulHostnameLength = ulHostnameLength;
+        pxCache->ulDeviceIdLength = ulDeviceIdLength;
+        prvStore( pxCache );
+    }
+
+    return ulStatus;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t DPSCache_Resolve( DPSCache_t * pxCache )
+{
+    /* Use the hub assigned on a previous boot, it is revalidated by the first connection. */
+    if( prvLoad( pxCache ) == 0 )
+    {
+        LogInfo( ( "Using cached IoT Hub assignment %.*s.\r\n",
+                   ( int ) pxCache->ulHostnameLength, pxCache->pucHostname ) );
+        pxCache->xCached = true;
+        return 0;
+    }
+
+    return prvRefresh( pxCache );
+}
+/*-----------------------------------------------------------*/
+
+bool DPSCache_Unreachable( DPSCache_t * pxCache )
+{
+    if( !pxCache->xCached )
+    {
+        return false;
+    }
+
+    /* The cached hub may no longer exist or the device was moved, provision again. */
+    LogWarn( ( "Cached IoT Hub %.*s failed, provisioning again.\r\n",
+               ( int ) pxCache->ulHostnameLength, pxCache->pucHostname ) );
+
+    return prvRefresh( pxCache ) == 0;
+}
+/*-----------------------------------------------------------*/
+
+void DPSCache_Reached( DPSCache_t * pxCache )
+{
+    pxCache->xCached = false;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,69 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_dps_cache.h
+ * @brief The IoT Hub assigned by the Provisioning service, cached in NVS across boots.
+ *
+ * A boot with a cached assignment connects straight to its hub. If that hub cannot
+ * be reached or rejects the device, the assignment is dropped and the device is
+ * provisioned again, so a device moved to another hub only pays for DPS once.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_DPS_CACHE_H
+#define SAMPLE_AZURE_IOT_DPS_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Runs the Provisioning service, filling in the hub and device ID.
+ *
+ * The lengths hold the buffer sizes on entry and the lengths written on return.
+ *
+ * @return 0 on success.
+ */
+typedef uint32_t (* DPSCacheProvision_t)( void * pvContext,
+                                          uint8_t * pucHostname,
+                                          uint32_t * pulHostnameLength,
+                                          uint8_t * pucDeviceId,
+                                          uint32_t * pulDeviceIdLength );
+
+/**
+ * @brief The assignment in use and where it came from.
+ */
+typedef struct DPSCache
+{
+    const char * pcSource;          /**< ID scope and registration ID the assignment is for. */
+    DPSCacheProvision_t xProvision; /**< Called when nothing usable is cached. */
+    void * pvProvisionContext;      /**< Passed to xProvision. */
+    uint8_t * pucHostname;          /**< NUL terminated once resolved. */
+    uint32_t ulHostnameSize;
+    uint32_t ulHostnameLength;
+    uint8_t * pucDeviceId;
+    uint32_t ulDeviceIdSize;
+    uint32_t ulDeviceIdLength;
+    bool xCached;                   /**< Loaded from NVS and not yet confirmed by the hub. */
+} DPSCache_t;
+
+/**
+ * @brief Use the cached assignment for pcSource, or provision and cache a new one.
+ *
+ * @return 0 once the hub and device ID are filled in.
+ */
+uint32_t DPSCache_Resolve( DPSCache_t * pxCache );
+
+/**
+ * @brief The hub could not be reached or rejected the device.
+ *
+ * @return true if the hub was the cached one and a new assignment was provisioned,
+ * the caller connects again. false if there is nothing better to try.
+ */
+bool DPSCache_Unreachable( DPSCache_t * pxCache );
+
+/**
+ * @brief The hub accepted the device, later failures are not blamed on the cache.
+ */
+void DPSCache_Reached( DPSCache_t * pxCache );
+
+#endif /* SAMPLE_AZURE_IOT_DPS_CACHE_H */
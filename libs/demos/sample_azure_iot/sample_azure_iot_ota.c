@@ -0,0 +1,633 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_ota.c
+ * @brief Pipelined firmware download into the inactive boot bank.
+ *
+ * The download task requests one chunk at a time with a range request, hashes it
+ * and hands the buffer to the flash task, then immediately requests the next
+ * chunk into the other buffer. The MQTT connection is left untouched, so the
+ * device keeps streaming telemetry until it restarts into the new image.
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* ESP-IDF includes */
+#include "esp_timer.h"
+#include "nvs.h"
+#include "mbedtls/sha256.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+#include "../../main/main/memory_budget.h"
+
+/* Azure IoT HTTP and flash platform includes. */
+#include "azure_iot_http.h"
+#include "azure_iot_flash_platform.h"
+
+/* Transport interface implementation include header for plain sockets. */
+#include "transport_socket.h"
+
+#include "sample_azure_iot_ota.h"
+
+#ifdef democonfigENABLE_ADU_SAMPLE
+
+/*-----------------------------------------------------------*/
+
+#define otaCHUNK_SIZE                ( CONFIG_OTA_CHUNK_SIZE )
+
+/**
+ * @brief Bytes written between two progress records, bounds the NVS wear and
+ * the amount downloaded again after a reboot.
+ */
+#define otaPERSIST_INTERVAL          ( 64U * 1024U )
+
+#define otaNVS_NAMESPACE             "ota"
+#define otaNVS_KEY_IMAGE             "image"
+#define otaNVS_KEY_OFFSET            "offset"
+
+#define otaSOCKET_TIMEOUT_MS         ( 5000U )
+#define otaRETRY_MAX_ATTEMPTS        ( 5U )
+#define otaRETRY_BACKOFF_MS          ( 1000U )
+
+#define otaURL_SCHEME                "http://"
+#define otaDEFAULT_PORT              ( 80U )
+
+/* Request line plus Host, User-Agent, Connection and Range headers. */
+#define otaREQUEST_HEADER_SIZE       ( otaPATH_SIZE + otaHOST_SIZE + 256U )
+
+#define otaDOWNLOAD_TASK_STACK_SIZE  ( 6 * 1024 )
+#define otaFLASH_TASK_STACK_SIZE     ( 3 * 1024 )
+
+/* Below the network task, a download never delays telemetry or commands. */
+#define otaTASK_PRIORITY             ( tskIDLE_PRIORITY + 2 )
+
+_Static_assert( ( otaCHUNK_SIZE % 4096U ) == 0, "OTA chunks must be whole flash sectors." );
+
+/*-----------------------------------------------------------*/
+
+/* Each transport defines the same NetworkContext. */
+struct NetworkContext
+{
+    void * pParams;
+};
+
+/**
+ * @brief A downloaded chunk on its way to the flash task.
+ */
+typedef struct OTAChunk
+{
+    uint32_t ulBuffer;
+    uint8_t * pucData;
+    uint32_t ulOffset;
+    uint32_t ulLength;
+} OTAChunk_t;
+
+/**
+ * @brief Identifies the image a persisted offset belongs to.
+ */
+typedef struct OTAProgressRecord
+{
+    uint8_t ucSHA256[ otaSHA256_SIZE ];
+    uint32_t ulSize;
+} OTAProgressRecord_t;
+
+/*-----------------------------------------------------------*/
+
+static OTACompleteCallback_t xCompleteCallback;
+
+static OTAImage_t xImage;
+static AzureADUImage_t xAduImage;
+
+static uint8_t * pucBuffers[ MEMORY_OTA_BUFFER_COUNT ];
+static char cRequestHeaders[ otaREQUEST_HEADER_SIZE ];
+
+/* Image requests, at most one outstanding. */
+static StaticQueue_t xImageQueueBuffer;
+static uint8_t ucImageQueueStorage[ sizeof( OTAImage_t ) ];
+static QueueHandle_t xImageQueue;
+
+/* Buffer indices ready to be downloaded into. */
+static StaticQueue_t xFreeQueueBuffer;
+static uint8_t ucFreeQueueStorage[ MEMORY_OTA_BUFFER_COUNT * sizeof( uint32_t ) ];
+static QueueHandle_t xFreeQueue;
+
+/* Downloaded chunks waiting to be written. */
+static StaticQueue_t xChunkQueueBuffer;
+static uint8_t ucChunkQueueStorage[ MEMORY_OTA_BUFFER_COUNT * sizeof( OTAChunk_t ) ];
+static QueueHandle_t xChunkQueue;
+
+static volatile bool xActive;
+static volatile bool xCancelRequested;
+static volatile bool xFlashFailed;
+static uint32_t ulPersistedOffset;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Offset to resume \p pxImage from, or 0 if nothing of it was written yet.
+ */
+static uint32_t prvProgressLoad( const OTAImage_t * pxImage )
+{
+    nvs_handle_t xHandle;
+    OTAProgressRecord_t xRecord;
+    size_t xLength = sizeof( xRecord );
+    uint32_t ulOffset = 0;
+
+    if( nvs_open( otaNVS_NAMESPACE, NVS_READONLY, &xHandle ) != ESP_OK )
+    {
+        return 0;
+    }
+
+    if( ( nvs_get_blob( xHandle, otaNVS_KEY_IMAGE, &xRecord, &xLength ) != ESP_OK ) ||
+        ( xLength != sizeof( xRecord ) ) ||
+        ( xRecord.ulSize != pxImage->ulSize ) ||
+        ( memcmp( xRecord.ucSHA256, pxImage->ucSHA256, otaSHA256_SIZE ) != 0 ) ||
+        ( nvs_get_u32( xHandle, otaNVS_KEY_OFFSET, &ulOffset ) != ESP_OK ) )
+    {
+        ulOffset = 0;
+    }
+
+    nvs_close( xHandle );
+
+    /* Chunks are requested on sector boundaries, so resume on one as well. */
+    ulOffset -= ulOffset % otaCHUNK_SIZE;
+
+    return ( ulOffset < pxImage->ulSize ) ? ulOffset : 0;
+}
+/*-----------------------------------------------------------*/
+
+static void prvProgressBegin( const OTAImage_t * pxImage )
+{
+    nvs_handle_t xHandle;
+    OTAProgressRecord_t xRecord;
+
+    memcpy( xRecord.ucSHA256, pxImage->ucSHA256, otaSHA256_SIZE );
+    xRecord.ulSize = pxImage->ulSize;
+
+    if( nvs_open( otaNVS_NAMESPACE, NVS_READWRITE, &xHandle ) != ESP_OK )
+    {
+        LogError( ( "Failed to open OTA progress storage, the download will not be resumable." ) );
+        return;
+    }
+
+    ( void ) nvs_set_blob( xHandle, otaNVS_KEY_IMAGE, &xRecord, sizeof( xRecord ) );
+    ( void ) nvs_set_u32( xHandle, otaNVS_KEY_OFFSET, 0 );
+    ( void ) nvs_commit( xHandle );
+    nvs_close( xHandle );
+}
+/*-----------------------------------------------------------*/
+
+static void prvProgressStore( uint32_t ulOffset )
+{
+    nvs_handle_t xHandle;
+
+    if( nvs_open( otaNVS_NAMESPACE, NVS_READWRITE, &xHandle ) == ESP_OK )
+    {
+        ( void ) nvs_set_u32( xHandle, otaNVS_KEY_OFFSET, ulOffset );
+        ( void ) nvs_commit( xHandle );
+        nvs_close( xHandle );
+    }
+
+    ulPersistedOffset = ulOffset;
+}
+/*-----------------------------------------------------------*/
+
+static void prvProgressClear( void )
+{
+    nvs_handle_t xHandle;
+
+    if( nvs_open( otaNVS_NAMESPACE, NVS_READWRITE, &xHandle ) == ESP_OK )
+    {
+        ( void ) nvs_erase_all( xHandle );
+        ( void ) nvs_commit( xHandle );
+        nvs_close( xHandle );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Feed the part of the image already in flash back into the hash.
+ */
+static bool prvRehashWritten( mbedtls_sha256_context * pxContext,
+                              uint32_t ulLength )
+{
+    uint32_t ulOffset;
+    uint32_t ulBlockLength;
+
+    for( ulOffset = 0; ulOffset < ulLength; ulOffset += ulBlockLength )
+    {
+        ulBlockLength = ulLength - ulOffset;
+        ulBlockLength = ( ulBlockLength > otaCHUNK_SIZE ) ? otaCHUNK_SIZE : ulBlockLength;
+
+        if( AzureIoTPlatform_ReadBlock( &xAduImage, ulOffset, pucBuffers[ 0 ], ulBlockLength ) != eAzureIoTSuccess )
+        {
+            return false;
+        }
+
+        mbedtls_sha256_update( pxContext, pucBuffers[ 0 ], ulBlockLength );
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static OTAResult_t prvDownloadImage( void )
+{
+    NetworkContext_t xNetworkContext = { 0 };
+    SocketTransportParams_t xSocketTransportParams = { 0 };
+    AzureIoTTransportInterface_t xTransport;
+    AzureIoTHTTP_t xHTTP;
+    mbedtls_sha256_context xSHA256;
+    uint8_t ucCalculatedHash[ otaSHA256_SIZE ];
+    OTAChunk_t xChunk;
+    char * pcData;
+    uint32_t ulDataLength;
+    uint32_t ulOffset;
+    uint32_t ulResumeOffset;
+    uint32_t ulAttempts = 0;
+    uint32_t ulBuffer;
+    uint32_t ulElapsedMs;
+    int64_t llStartTime;
+    int64_t llWaitTime;
+    int64_t llStallTime = 0;
+    bool xConnected = false;
+    OTAResult_t xResult = eOTAResultSuccess;
+
+    if( ( xImage.ulSize == 0 ) || ( xImage.ulSize > AzureIoTPlatform_GetSingleFlashBootBankSize() ) )
+    {
+        LogError( ( "Image of %lu bytes does not fit the update partition.", ( unsigned long ) xImage.ulSize ) );
+        return eOTAResultFailed;
+    }
+
+    if( AzureIoTPlatform_Init( &xAduImage ) != eAzureIoTSuccess )
+    {
+        return eOTAResultFailed;
+    }
+
+    xAduImage.ulImageFileSize = xImage.ulSize;
+    xFlashFailed = false;
+
+    mbedtls_sha256_init( &xSHA256 );
+    mbedtls_sha256_starts( &xSHA256, 0 );
+
+    ulOffset = prvProgressLoad( &xImage );
+
+    if( ulOffset > 0 )
+    {
+        LogInfo( ( "Resuming update at %lu of %lu bytes.", ( unsigned long ) ulOffset, ( unsigned long ) xImage.ulSize ) );
+
+        if( !prvRehashWritten( &xSHA256, ulOffset ) )
+        {
+            mbedtls_sha256_starts( &xSHA256, 0 );
+            ulOffset = 0;
+        }
+    }
+
+    if( ulOffset == 0 )
+    {
+        prvProgressBegin( &xImage );
+    }
+
+    ulPersistedOffset = ulOffset;
+    ulResumeOffset = ulOffset;
+
+    xSocketTransportParams.xTCPSocket = SOCKETS_INVALID_SOCKET;
+    xNetworkContext.pParams = &xSocketTransportParams;
+    xTransport.pxNetworkContext = &xNetworkContext;
+    xTransport.xSend = Azure_Socket_Send;
+    xTransport.xRecv = Azure_Socket_Recv;
+
+    llStartTime = esp_timer_get_time();
+
+    while( ulOffset < xImage.ulSize )
+    {
+        if( xCancelRequested )
+        {
+            LogInfo( ( "Update cancelled at %lu bytes.", ( unsigned long ) ulOffset ) );
+            xResult = eOTAResultCancelled;
+            break;
+        }
+
+        if( xFlashFailed )
+        {
+            xResult = eOTAResultFailed;
+            break;
+        }
+
+        if( ulAttempts >= otaRETRY_MAX_ATTEMPTS )
+        {
+            LogError( ( "Giving up on the download at %lu bytes.", ( unsigned long ) ulOffset ) );
+            xResult = eOTAResultFailed;
+            break;
+        }
+
+        if( !xConnected )
+        {
+            if( ulAttempts > 0 )
+            {
+                vTaskDelay( pdMS_TO_TICKS( otaRETRY_BACKOFF_MS * ulAttempts ) );
+            }
+
+            if( Azure_Socket_Connect( &xNetworkContext, xImage.cHost, xImage.usPort,
+                                      otaSOCKET_TIMEOUT_MS, otaSOCKET_TIMEOUT_MS ) != eSocketTransportSuccess )
+            {
+                ulAttempts++;
+                continue;
+            }
+
+            xConnected = true;
+        }
+
+        /* Blocks only while both buffers are queued for flash, i.e. flash is the bottleneck. */
+        llWaitTime = esp_timer_get_time();
+        ( void ) xQueueReceive( xFreeQueue, &ulBuffer, portMAX_DELAY );
+        llStallTime += esp_timer_get_time() - llWaitTime;
+
+        xChunk.ulBuffer = ulBuffer;
+        xChunk.ulOffset = ulOffset;
+        xChunk.ulLength = xImage.ulSize - ulOffset;
+        xChunk.ulLength = ( xChunk.ulLength > otaCHUNK_SIZE ) ? otaCHUNK_SIZE : xChunk.ulLength;
+        pcData = NULL;
+        ulDataLength = 0;
+
+        /* The request headers are rebuilt for every range, the connection is kept alive. */
+        if( ( AzureIoTHTTP_Init( &xHTTP, &xTransport,
+                                 xImage.cHost, strlen( xImage.cHost ),
+                                 xImage.cPath, strlen( xImage.cPath ),
+                                 cRequestHeaders, sizeof( cRequestHeaders ) ) != eAzureIoTHTTPSuccess ) ||
+            ( AzureIoTHTTP_Request( &xHTTP, ( int32_t ) ulOffset, ( int32_t ) ( ulOffset + xChunk.ulLength - 1 ),
+                                    ( char * ) pucBuffers[ ulBuffer ], MEMORY_OTA_BUFFER_SIZE,
+                                    &pcData, &ulDataLength ) != eAzureIoTHTTPSuccess ) ||
+            ( pcData == NULL ) || ( ulDataLength != xChunk.ulLength ) )
+        {
+            LogError( ( "Range request at %lu failed, reconnecting.", ( unsigned long ) ulOffset ) );
+            ( void ) xQueueSend( xFreeQueue, &ulBuffer, 0 );
+            Azure_Socket_Close( &xNetworkContext );
+            xConnected = false;
+            ulAttempts++;
+            continue;
+        }
+
+        ulAttempts = 0;
+
+        /* Hashed here while the flash task is still writing the previous chunk. */
+        mbedtls_sha256_update( &xSHA256, ( const uint8_t * ) pcData, ulDataLength );
+
+        xChunk.pucData = ( uint8_t * ) pcData;
+        ( void ) xQueueSend( xChunkQueue, &xChunk, portMAX_DELAY );
+
+        ulOffset += xChunk.ulLength;
+    }
+
+    if( xConnected )
+    {
+        Azure_Socket_Close( &xNetworkContext );
+    }
+
+    /* Wait until the flash task has handed every buffer back. */
+    for( ulBuffer = 0; ulBuffer < MEMORY_OTA_BUFFER_COUNT; ulBuffer++ )
+    {
+        uint32_t ulFree;
+
+        ( void ) xQueueReceive( xFreeQueue, &ulFree, portMAX_DELAY );
+    }
+
+    for( ulBuffer = 0; ulBuffer < MEMORY_OTA_BUFFER_COUNT; ulBuffer++ )
+    {
+        ( void ) xQueueSend( xFreeQueue, &ulBuffer, 0 );
+    }
+
+    mbedtls_sha256_finish( &xSHA256, ucCalculatedHash );
+    mbedtls_sha256_free( &xSHA256 );
+
+    ulElapsedMs = ( uint32_t ) ( ( esp_timer_get_time() - llStartTime ) / 1000 );
+    LogInfo( ( "Downloaded %lu bytes in %lu ms (%lu KB/s), %lu ms waiting on flash.",
+               ( unsigned long ) ( ulOffset - ulResumeOffset ),
+               ( unsigned long ) ulElapsedMs,
+               ( unsigned long ) ( ulElapsedMs > 0 ? ( ulOffset - ulResumeOffset ) / ulElapsedMs : 0 ),
+               ( unsigned long ) ( llStallTime / 1000 ) ) );
+
+    if( ( xResult == eOTAResultSuccess ) && xFlashFailed )
+    {
+        xResult = eOTAResultFailed;
+    }
+
+    if( xResult == eOTAResultSuccess )
+    {
+        if( memcmp( ucCalculatedHash, xImage.ucSHA256, otaSHA256_SIZE ) != 0 )
+        {
+            LogError( ( "Downloaded image hash does not match the update manifest." ) );
+            xResult = eOTAResultFailed;
+        }
+        else if( AzureIoTPlatform_EnableImage( &xAduImage ) != eAzureIoTSuccess )
+        {
+            xResult = eOTAResultFailed;
+        }
+    }
+
+    /* A failed download keeps its progress so the next attempt at the same image
+     * resumes, anything that invalidates what is in flash starts over. */
+    if( ( xResult != eOTAResultFailed ) || xFlashFailed || ( ulOffset == xImage.ulSize ) )
+    {
+        prvProgressClear();
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+static void prvOTADownloadTask( void * pvParameters )
+{
+    OTAResult_t xResult;
+
+    ( void ) pvParameters;
+
+    for( ; ; )
+    {
+        ( void ) xQueueReceive( xImageQueue, &xImage, portMAX_DELAY );
+
+        LogInfo( ( "Starting update from %s:%u%s, %lu bytes.",
+                   xImage.cHost, xImage.usPort, xImage.cPath, ( unsigned long ) xImage.ulSize ) );
+
+        xResult = prvDownloadImage();
+        xActive = false;
+
+        if( xCompleteCallback != NULL )
+        {
+            xCompleteCallback( xResult );
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvOTAFlashTask( void * pvParameters )
+{
+    OTAChunk_t xChunk;
+    uint32_t ulEnd;
+
+    ( void ) pvParameters;
+
+    for( ; ; )
+    {
+        ( void ) xQueueReceive( xChunkQueue, &xChunk, portMAX_DELAY );
+
+        /* After a failure the remaining chunks are only drained. */
+        if( !xFlashFailed )
+        {
+            if( AzureIoTPlatform_WriteBlock( &xAduImage, xChunk.ulOffset, xChunk.pucData, xChunk.ulLength ) != eAzureIoTSuccess )
+            {
+                xFlashFailed = true;
+            }
+            else
+            {
+                ulEnd = xChunk.ulOffset + xChunk.ulLength;
+
+                if( ulEnd - ulPersistedOffset >= otaPERSIST_INTERVAL )
+                {
+                    prvProgressStore( ulEnd );
+                }
+            }
+        }
+
+        ( void ) xQueueSend( xFreeQueue, &xChunk.ulBuffer, portMAX_DELAY );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void OTA_Init( OTACompleteCallback_t xCallback )
+{
+    uint32_t ulBuffer;
+
+    xCompleteCallback = xCallback;
+
+    xImageQueue = xQueueCreateStatic( 1, sizeof( OTAImage_t ), ucImageQueueStorage, &xImageQueueBuffer );
+    xFreeQueue = xQueueCreateStatic( MEMORY_OTA_BUFFER_COUNT, sizeof( uint32_t ), ucFreeQueueStorage, &xFreeQueueBuffer );
+    xChunkQueue = xQueueCreateStatic( MEMORY_OTA_BUFFER_COUNT, sizeof( OTAChunk_t ), ucChunkQueueStorage, &xChunkQueueBuffer );
+
+    for( ulBuffer = 0; ulBuffer < MEMORY_OTA_BUFFER_COUNT; ulBuffer++ )
+    {
+        pucBuffers[ ulBuffer ] = ( uint8_t * ) memory_reserve( MEMORY_ARENA_OTA, MEMORY_OTA_BUFFER_SIZE );
+        configASSERT( pucBuffers[ ulBuffer ] != NULL );
+        ( void ) xQueueSend( xFreeQueue, &ulBuffer, 0 );
+    }
+
+    xTaskCreate( prvOTADownloadTask, "OTADownload", otaDOWNLOAD_TASK_STACK_SIZE, NULL, otaTASK_PRIORITY, NULL );
+    xTaskCreate( prvOTAFlashTask, "OTAFlash", otaFLASH_TASK_STACK_SIZE, NULL, otaTASK_PRIORITY, NULL );
+}
+/*-----------------------------------------------------------*/
+
+bool OTA_ParseUrl( const uint8_t * pucUrl,
+                   uint32_t ulUrlLength,
+                   OTAImage_t * pxImage )
+{
+    const uint32_t ulSchemeLength = sizeof( otaURL_SCHEME ) - 1;
+    const char * pcHost;
+    const char * pcEnd = ( const char * ) pucUrl + ulUrlLength;
+    const char * pcPath;
+    const char * pcPort;
+    uint32_t ulHostLength;
+    uint32_t ulPort = 0;
+
+    if( ( ulUrlLength <= ulSchemeLength ) ||
+        ( strncmp( ( const char * ) pucUrl, otaURL_SCHEME, ulSchemeLength ) != 0 ) )
+    {
+        LogError( ( "Only http:// update URLs are supported." ) );
+        return false;
+    }
+
+    pcHost = ( const char * ) pucUrl + ulSchemeLength;
+    pcPath = memchr( pcHost, '/', pcEnd - pcHost );
+
+    if( pcPath == NULL )
+    {
+        return false;
+    }
+
+    pcPort = memchr( pcHost, ':', pcPath - pcHost );
+    ulHostLength = ( uint32_t ) ( ( pcPort != NULL ? pcPort : pcPath ) - pcHost );
+
+    if( ( ulHostLength == 0 ) || ( ulHostLength >= otaHOST_SIZE ) ||
+        ( ( uint32_t ) ( pcEnd - pcPath ) >= otaPATH_SIZE ) )
+    {
+        return false;
+    }
+
+    if( pcPort != NULL )
+    {
+        for( pcPort++; pcPort < pcPath; pcPort++ )
+        {
+            if( ( *pcPort < '0' ) || ( *pcPort > '9' ) )
+            {
+                return false;
+            }
+
+            ulPort = ulPort * 10 + ( uint32_t ) ( *pcPort - '0' );
+
+            if( ulPort > UINT16_MAX )
+            {
+                return false;
+            }
+        }
+    }
+
+    memcpy( pxImage->cHost, pcHost, ulHostLength );
+    pxImage->cHost[ ulHostLength ] = '\0';
+    memcpy( pxImage->cPath, pcPath, pcEnd - pcPath );
+    pxImage->cPath[ pcEnd - pcPath ] = '\0';
+    pxImage->usPort = ( ulPort == 0 ) ? otaDEFAULT_PORT : ( uint16_t ) ulPort;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+bool OTA_Start( const OTAImage_t * pxImage )
+{
+    if( xActive )
+    {
+        return false;
+    }
+
+    xActive = true;
+    xCancelRequested = false;
+
+    if( xQueueSend( xImageQueue, pxImage, 0 ) != pdPASS )
+    {
+        xActive = false;
+        return false;
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+void OTA_Cancel( void )
+{
+    if( xActive )
+    {
+        xCancelRequested = true;
+    }
+}
+/*-----------------------------------------------------------*/
+
+bool OTA_IsActive( void )
+{
+    return xActive;
+}
+/*-----------------------------------------------------------*/
+
+void OTA_Restart( void )
+{
+    ( void ) AzureIoTPlatform_ResetDevice( &xAduImage );
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigENABLE_ADU_SAMPLE */
@@ -0,0 +1,89 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_ota.h
+ * @brief Pipelined firmware download into the inactive boot bank.
+ *
+ * The image is fetched with HTTP range requests over one kept-alive connection.
+ * While one chunk is being written to flash the next one is downloaded and hashed,
+ * so the slower of the network and the flash sets the pace rather than their sum.
+ * Progress is persisted so an interrupted download resumes where it stopped.
+ *
+ * Images are written as served, compressed and delta images are not supported:
+ * resuming one would mean persisting the decoder's state with the offset, and
+ * the manifest's hash covers the file as served rather than what is written.
+ * host/ota runs this engine on Linux against a range server and a file.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_OTA_H
+#define SAMPLE_AZURE_IOT_OTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define otaSHA256_SIZE    ( 32U )
+#define otaHOST_SIZE      ( 128U )
+#define otaPATH_SIZE      ( 256U )
+
+/**
+ * @brief The image to download, copied out of the update request.
+ */
+typedef struct OTAImage
+{
+    char cHost[ otaHOST_SIZE ];
+    uint16_t usPort;
+    char cPath[ otaPATH_SIZE ];
+    uint32_t ulSize;
+    uint8_t ucSHA256[ otaSHA256_SIZE ];
+} OTAImage_t;
+
+typedef enum OTAResult
+{
+    eOTAResultSuccess = 0, /* Image written, verified and set as the boot partition. */
+    eOTAResultFailed,      /* Download, flash or hash failure. */
+    eOTAResultCancelled    /* Cancelled by OTA_Cancel(). */
+} OTAResult_t;
+
+/**
+ * @brief Called from the download task when an update finishes.
+ */
+typedef void (* OTACompleteCallback_t)( OTAResult_t xResult );
+
+/**
+ * @brief Reserve the download buffers and start the download and flash tasks.
+ */
+void OTA_Init( OTACompleteCallback_t xCallback );
+
+/**
+ * @brief Split an http:// URL into the host, port and path of \p pxImage.
+ *
+ * @return true if the URL could be parsed and fits.
+ */
+bool OTA_ParseUrl( const uint8_t * pucUrl,
+                   uint32_t ulUrlLength,
+                   OTAImage_t * pxImage );
+
+/**
+ * @brief Queue an image for download. Does not block.
+ *
+ * @return false if an update is already in progress.
+ */
+bool OTA_Start( const OTAImage_t * pxImage );
+
+/**
+ * @brief Stop the update in progress at the next chunk boundary.
+ */
+void OTA_Cancel( void );
+
+/**
+ * @brief Whether an update is queued or downloading.
+ */
+bool OTA_IsActive( void );
+
+/**
+ * @brief Restart into the image enabled by a successful update.
+ */
+void OTA_Restart( void );
+
+#endif /* SAMPLE_AZURE_IOT_OTA_H */
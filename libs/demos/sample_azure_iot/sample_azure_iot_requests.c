@@ -0,0 +1,87 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_requests.c
+ * @brief Outbound publish requests for the task that owns the MQTT connection.
+ *
+ * Shared by the network task of sample_azure_iot.c and the host's virtual
+ * stations, which run this queue and wakeup against a real broker stand-in.
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <unistd.h>
+
+/* ESP-IDF includes. */
+#include "esp_timer.h"
+
+#include "sample_azure_iot_requests.h"
+
+/*-----------------------------------------------------------*/
+
+void NetworkRequests_Init( NetworkRequests_t * pxRequests,
+                           int lWakeupFd )
+{
+    pxRequests->lWakeupFd = lWakeupFd;
+    pxRequests->xQueue = xQueueCreateStatic( requestsQUEUE_LENGTH, sizeof( NetworkRequest_t ),
+                                             pxRequests->ucQueueStorage, &pxRequests->xQueueBuffer );
+}
+/*-----------------------------------------------------------*/
+
+bool NetworkRequests_Send( NetworkRequests_t * pxRequests,
+                           azure_request_t xType,
+                           const uint8_t * pucPayload,
+                           uint32_t ulPayloadLength )
+{
+    NetworkRequest_t xRequest;
+
+    if( ( pxRequests->xQueue == NULL ) ||
+        ( ulPayloadLength > sizeof( xRequest.ucPayload ) ) ||
+        ( ( pucPayload == NULL ) && ( ulPayloadLength > 0 ) ) )
+    {
+        return false;
+    }
+
+    xRequest.xType = xType;
+    xRequest.llRequestTime = esp_timer_get_time();
+    xRequest.ulPayloadLength = ulPayloadLength;
+
+    if( ulPayloadLength > 0 )
+    {
+        memcpy( xRequest.ucPayload, pucPayload, ulPayloadLength );
+    }
+
+    if( xQueueSend( pxRequests->xQueue, &xRequest, 0 ) != pdPASS )
+    {
+        return false;
+    }
+
+    NetworkRequests_Wake( pxRequests );
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+bool NetworkRequests_Receive( NetworkRequests_t * pxRequests,
+                              NetworkRequest_t * pxRequest )
+{
+    return xQueueReceive( pxRequests->xQueue, pxRequest, 0 ) == pdPASS;
+}
+/*-----------------------------------------------------------*/
+
+void NetworkRequests_Wake( NetworkRequests_t * pxRequests )
+{
+    uint64_t ullSignal = 1;
+
+    ( void ) write( pxRequests->lWakeupFd, &ullSignal, sizeof( ullSignal ) );
+}
+/*-----------------------------------------------------------*/
+
+void NetworkRequests_ClearWakeup( NetworkRequests_t * pxRequests )
+{
+    uint64_t ullCount;
+
+    ( void ) read( pxRequests->lWakeupFd, &ullCount, sizeof( ullCount ) );
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,88 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_requests.h
+ * @brief Outbound publish requests for the task that owns the MQTT connection.
+ *
+ * Any task queues a request and signals the owner through an eventfd, which the
+ * owner waits on together with its TLS socket, so a publish goes out as soon as
+ * it is queued rather than at the next idle timeout.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_REQUESTS_H
+#define SAMPLE_AZURE_IOT_REQUESTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+#include "../../main/main/azure_iot_freertos.h"
+
+/**
+ * @brief Number of outbound publish requests that can be queued for the owner task.
+ */
+#define requestsQUEUE_LENGTH     ( 8U )
+
+/**
+ * @brief Largest payload carried inline by a publish request.
+ */
+#define requestsPAYLOAD_SIZE     ( 128U )
+
+/**
+ * @brief Outbound publish request, queued by any task and sent by the owner task.
+ */
+typedef struct NetworkRequest
+{
+    azure_request_t xType;
+    int64_t llRequestTime; /* esp_timer time the request was queued, in us */
+    uint32_t ulPayloadLength;
+    uint8_t ucPayload[ requestsPAYLOAD_SIZE ];
+} NetworkRequest_t;
+
+/**
+ * @brief The queue of one connection and the eventfd that wakes its owner.
+ */
+typedef struct NetworkRequests
+{
+    StaticQueue_t xQueueBuffer;
+    uint8_t ucQueueStorage[ requestsQUEUE_LENGTH * sizeof( NetworkRequest_t ) ];
+    QueueHandle_t xQueue;
+    int lWakeupFd;
+} NetworkRequests_t;
+
+/**
+ * @brief Create the queue, signalled through \p lWakeupFd, an eventfd.
+ */
+void NetworkRequests_Init( NetworkRequests_t * pxRequests,
+                           int lWakeupFd );
+
+/**
+ * @brief Queue a request and wake the owner task. Does not block, callable from any task.
+ *
+ * @return false if the queue is full or was never created, or the payload does not fit.
+ */
+bool NetworkRequests_Send( NetworkRequests_t * pxRequests,
+                           azure_request_t xType,
+                           const uint8_t * pucPayload,
+                           uint32_t ulPayloadLength );
+
+/**
+ * @brief Take the oldest request without blocking. Only called from the owner task.
+ */
+bool NetworkRequests_Receive( NetworkRequests_t * pxRequests,
+                              NetworkRequest_t * pxRequest );
+
+/**
+ * @brief Wake the owner task without queueing anything, e.g. to come back for more work.
+ */
+void NetworkRequests_Wake( NetworkRequests_t * pxRequests );
+
+/**
+ * @brief Consume the pending wakeups so the owner's wait blocks again.
+ */
+void NetworkRequests_ClearWakeup( NetworkRequests_t * pxRequests );
+
+#endif /* SAMPLE_AZURE_IOT_REQUESTS_H */
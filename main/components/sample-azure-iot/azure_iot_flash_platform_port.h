@@ -0,0 +1,30 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_iot_flash_platform_port.h
+ *
+ * @brief Defines the ADU image context for the ESP32 OTA partitions.
+ */
+#ifndef AZURE_IOT_FLASH_PLATFORM_PORT_H
+#define AZURE_IOT_FLASH_PLATFORM_PORT_H
+
+#include <stdint.h>
+
+#include "esp_partition.h"
+
+/**
+ * @brief The image being written to the inactive boot bank.
+ *
+ * Flash is erased sector by sector just ahead of the writes, so an interrupted
+ * download only loses the sectors after the last persisted offset.
+ */
+typedef struct AzureADUImage
+{
+    const esp_partition_t * xUpdatePartition; /**< The inactive OTA partition. */
+    uint32_t ulImageFileSize;                  /**< Size of the image being downloaded. */
+    uint32_t ulCurrentOffset;                  /**< End of the last block written. */
+    uint32_t ulErasedOffset;                   /**< Flash is erased from the resume point up to here. */
+} AzureADUImage_t;
+
+#endif /* AZURE_IOT_FLASH_PLATFORM_PORT_H */
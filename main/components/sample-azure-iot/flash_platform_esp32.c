@@ -0,0 +1,205 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file flash_platform_esp32.c
+ * @brief ADU flash platform implementation on the ESP32 OTA partitions.
+ *
+ * Blocks are written with the partition API rather than esp_ota_begin(), which
+ * erases the whole bank up front and cannot pick up a download where it stopped.
+ */
+
+#include <string.h>
+
+#include "azure_iot_flash_platform.h"
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+
+#include "mbedtls/sha256.h"
+
+static const char *TAG = "flash_platform";
+
+#define flashplatformSECTOR_SIZE         ( 4096U )
+#define flashplatformVERIFY_BUFFER_SIZE  ( 512U )
+#define flashplatformSHA256_SIZE         ( 32U )
+
+#define flashplatformALIGN_DOWN( x )     ( ( x ) & ~( flashplatformSECTOR_SIZE - 1U ) )
+#define flashplatformALIGN_UP( x )       flashplatformALIGN_DOWN( ( x ) + flashplatformSECTOR_SIZE - 1U )
+
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
+{
+    pxAduImage->xUpdatePartition = esp_ota_get_next_update_partition( NULL );
+
+    if( pxAduImage->xUpdatePartition == NULL )
+    {
+        ESP_LOGE( TAG, "No OTA partition to update, check the partition table." );
+        return eAzureIoTErrorFailed;
+    }
+
+    pxAduImage->ulCurrentOffset = 0;
+    pxAduImage->ulErasedOffset = 0;
+
+    ESP_LOGI( TAG, "Writing update to partition %s at 0x%08lx.",
+              pxAduImage->xUpdatePartition->label,
+              ( unsigned long ) pxAduImage->xUpdatePartition->address );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+int64_t AzureIoTPlatform_GetSingleFlashBootBankSize()
+{
+    const esp_partition_t * pxPartition = esp_ota_get_next_update_partition( NULL );
+
+    return ( pxPartition == NULL ) ? 0 : ( int64_t ) pxPartition->size;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage,
+                                              uint32_t ulOffset,
+                                              uint8_t * const pData,
+                                              uint32_t ulBlockSize )
+{
+    uint32_t ulEraseStart;
+    uint32_t ulEraseEnd;
+    esp_err_t xError;
+
+    if( ( uint64_t ) ulOffset + ulBlockSize > pxAduImage->xUpdatePartition->size )
+    {
+        ESP_LOGE( TAG, "Block at %lu exceeds the partition.", ( unsigned long ) ulOffset );
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    /* Sequential blocks only erase the sectors not yet erased. A block written
+     * out of order, e.g. the first one after a resume, must start on a sector
+     * boundary since its sector is erased from the start. */
+    ulEraseStart = flashplatformALIGN_DOWN( ulOffset );
+
+    if( ( ulOffset >= pxAduImage->ulCurrentOffset ) && ( pxAduImage->ulErasedOffset > ulEraseStart ) )
+    {
+        ulEraseStart = pxAduImage->ulErasedOffset;
+    }
+
+    ulEraseEnd = flashplatformALIGN_UP( ulOffset + ulBlockSize );
+
+    if( ulEraseEnd > ulEraseStart )
+    {
+        xError = esp_partition_erase_range( pxAduImage->xUpdatePartition, ulEraseStart, ulEraseEnd - ulEraseStart );
+
+        if( xError != ESP_OK )
+        {
+            ESP_LOGE( TAG, "Erase failed at %lu: %s", ( unsigned long ) ulEraseStart, esp_err_to_name( xError ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        pxAduImage->ulErasedOffset = ulEraseEnd;
+    }
+
+    xError = esp_partition_write( pxAduImage->xUpdatePartition, ulOffset, pData, ulBlockSize );
+
+    if( xError != ESP_OK )
+    {
+        ESP_LOGE( TAG, "Write failed at %lu: %s", ( unsigned long ) ulOffset, esp_err_to_name( xError ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    pxAduImage->ulCurrentOffset = ulOffset + ulBlockSize;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_ReadBlock( AzureADUImage_t * const pxAduImage,
+                                             uint32_t ulOffset,
+                                             uint8_t * const pData,
+                                             uint32_t ulBlockSize )
+{
+    esp_err_t xError = esp_partition_read( pxAduImage->xUpdatePartition, ulOffset, pData, ulBlockSize );
+
+    if( xError != ESP_OK )
+    {
+        ESP_LOGE( TAG, "Read failed at %lu: %s", ( unsigned long ) ulOffset, esp_err_to_name( xError ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_VerifyImage( AzureADUImage_t * const pxAduImage,
+                                               uint8_t * pucSHA256Hash,
+                                               uint32_t ulSHA256HashLength )
+{
+    uint8_t ucBuffer[ flashplatformVERIFY_BUFFER_SIZE ];
+    uint8_t ucCalculatedHash[ flashplatformSHA256_SIZE ];
+    mbedtls_sha256_context xContext;
+    uint32_t ulOffset;
+    uint32_t ulLength;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    if( ulSHA256HashLength != flashplatformSHA256_SIZE )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    mbedtls_sha256_init( &xContext );
+    mbedtls_sha256_starts( &xContext, 0 );
+
+    for( ulOffset = 0; ulOffset < pxAduImage->ulImageFileSize; ulOffset += ulLength )
+    {
+        ulLength = pxAduImage->ulImageFileSize - ulOffset;
+        ulLength = ( ulLength > sizeof( ucBuffer ) ) ? sizeof( ucBuffer ) : ulLength;
+
+        if( AzureIoTPlatform_ReadBlock( pxAduImage, ulOffset, ucBuffer, ulLength ) != eAzureIoTSuccess )
+        {
+            xResult = eAzureIoTErrorFailed;
+            break;
+        }
+
+        mbedtls_sha256_update( &xContext, ucBuffer, ulLength );
+    }
+
+    mbedtls_sha256_finish( &xContext, ucCalculatedHash );
+    mbedtls_sha256_free( &xContext );
+
+    if( ( xResult == eAzureIoTSuccess ) &&
+        ( memcmp( ucCalculatedHash, pucSHA256Hash, flashplatformSHA256_SIZE ) != 0 ) )
+    {
+        ESP_LOGE( TAG, "Image hash does not match." );
+        xResult = eAzureIoTErrorFailed;
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_EnableImage( AzureADUImage_t * const pxAduImage )
+{
+    /* Also validates the image header and checksum before switching banks. */
+    esp_err_t xError = esp_ota_set_boot_partition( pxAduImage->xUpdatePartition );
+
+    if( xError != ESP_OK )
+    {
+        ESP_LOGE( TAG, "Failed to set boot partition: %s", esp_err_to_name( xError ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t AzureIoTPlatform_ResetDevice( AzureADUImage_t * const pxAduImage )
+{
+    ( void ) pxAduImage;
+
+    ESP_LOGI( TAG, "Restarting into the new image." );
+    esp_restart();
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,191 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file transport_socket_esp32.c
+ * @brief Plain TCP transport interface implementation on lwIP sockets, used for
+ * firmware downloads which are served over HTTP.
+ */
+
+/* Standard includes. */
+#include "errno.h"
+#include <stdio.h>
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "freertos/FreeRTOS.h"
+
+/* Socket transport header. */
+#include "transport_socket.h"
+
+#include "esp_log.h"
+
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+
+static const char *TAG = "socket_freertos";
+
+/* Each transport defines the same NetworkContext. The user then passes their respective transport */
+/* as pParams for the transport which is defined in the transport header file */
+/* (here it's SocketTransportParams_t) */
+struct NetworkContext
+{
+    // SocketTransportParams_t
+    void * pParams;
+};
+
+/* The socket descriptor is kept in the SocketHandle itself. */
+#define socketesp32TO_HANDLE( xSocket )    ( ( SocketHandle ) ( intptr_t ) ( xSocket ) )
+#define socketesp32TO_FD( xHandle )        ( ( int ) ( intptr_t ) ( xHandle ) )
+
+static void prvSetSocketTimeout( int xSocket,
+                                 int xOption,
+                                 uint32_t ulTimeoutMs )
+{
+    struct timeval xTimeout =
+    {
+        .tv_sec = ulTimeoutMs / 1000,
+        .tv_usec = ( ulTimeoutMs % 1000 ) * 1000
+    };
+
+    ( void ) setsockopt( xSocket, SOL_SOCKET, xOption, &xTimeout, sizeof( xTimeout ) );
+}
+
+/*-----------------------------------------------------------*/
+
+SocketTransportStatus_t Azure_Socket_Connect( NetworkContext_t * pxNetworkContext,
+                                              const char * pHostName,
+                                              uint16_t usPort,
+                                              uint32_t ulReceiveTimeoutMs,
+                                              uint32_t ulSendTimeoutMs )
+{
+    struct addrinfo xHints = { 0 };
+    struct addrinfo * pxAddress = NULL;
+    char cPort[ 6 ];
+    int xSocket;
+    int xNoDelay = 1;
+
+    if( ( pxNetworkContext == NULL ) ||
+        ( pxNetworkContext->pParams == NULL ) ||
+        ( pHostName == NULL ) )
+    {
+        ESP_LOGE( TAG, "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p, "
+                  "pHostName=%p.", pxNetworkContext, pHostName );
+        return eSocketTransportInvalidParameter;
+    }
+
+    SocketTransportParams_t * pxSocketParams = ( SocketTransportParams_t * ) pxNetworkContext->pParams;
+
+    xHints.ai_family = AF_INET;
+    xHints.ai_socktype = SOCK_STREAM;
+    ( void ) snprintf( cPort, sizeof( cPort ), "%u", usPort );
+
+    if( ( getaddrinfo( pHostName, cPort, &xHints, &pxAddress ) != 0 ) || ( pxAddress == NULL ) )
+    {
+        ESP_LOGE( TAG, "Failed to resolve %s.", pHostName );
+        return eSocketTransportConnectFailure;
+    }
+
+    xSocket = socket( pxAddress->ai_family, pxAddress->ai_socktype, pxAddress->ai_protocol );
+
+    if( xSocket < 0 )
+    {
+        ESP_LOGE( TAG, "Failed to open socket, errno= %d", errno );
+        freeaddrinfo( pxAddress );
+        return eSocketTransportInternalError;
+    }
+
+    prvSetSocketTimeout( xSocket, SO_RCVTIMEO, ulReceiveTimeoutMs );
+    prvSetSocketTimeout( xSocket, SO_SNDTIMEO, ulSendTimeoutMs );
+
+    /* Range requests are small writes followed by a wait for the response. */
+    ( void ) setsockopt( xSocket, IPPROTO_TCP, TCP_NODELAY, &xNoDelay, sizeof( xNoDelay ) );
+
+    if( connect( xSocket, pxAddress->ai_addr, pxAddress->ai_addrlen ) != 0 )
+    {
+        ESP_LOGE( TAG, "Failed to connect to %s:%u, errno= %d", pHostName, usPort, errno );
+        close( xSocket );
+        freeaddrinfo( pxAddress );
+        return eSocketTransportConnectFailure;
+    }
+
+    freeaddrinfo( pxAddress );
+    pxSocketParams->xTCPSocket = socketesp32TO_HANDLE( xSocket );
+    pxSocketParams->xSocketContext = NULL;
+
+    return eSocketTransportSuccess;
+}
+/*-----------------------------------------------------------*/
+
+void Azure_Socket_Close( NetworkContext_t * pNetworkContext )
+{
+    if( ( pNetworkContext == NULL ) || ( pNetworkContext->pParams == NULL ) )
+    {
+        ESP_LOGE( TAG, "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p.", pNetworkContext );
+        return;
+    }
+
+    SocketTransportParams_t * pxSocketParams = ( SocketTransportParams_t * ) pNetworkContext->pParams;
+
+    if( pxSocketParams->xTCPSocket != SOCKETS_INVALID_SOCKET )
+    {
+        ( void ) shutdown( socketesp32TO_FD( pxSocketParams->xTCPSocket ), SHUT_RDWR );
+        ( void ) close( socketesp32TO_FD( pxSocketParams->xTCPSocket ) );
+        pxSocketParams->xTCPSocket = SOCKETS_INVALID_SOCKET;
+    }
+}
+/*-----------------------------------------------------------*/
+
+int32_t Azure_Socket_Send( NetworkContext_t * pxNetworkContext,
+                           const void * pvBuffer,
+                           size_t xBytesToSend )
+{
+    SocketTransportParams_t * pxSocketParams = ( SocketTransportParams_t * ) pxNetworkContext->pParams;
+    int32_t lStatus;
+
+    lStatus = send( socketesp32TO_FD( pxSocketParams->xTCPSocket ), pvBuffer, xBytesToSend, 0 );
+
+    if( lStatus < 0 )
+    {
+        if( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+        {
+            return 0;
+        }
+
+        ESP_LOGE( TAG, "Writing failed, errno= %d", errno );
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    return lStatus;
+}
+/*-----------------------------------------------------------*/
+
+int32_t Azure_Socket_Recv( NetworkContext_t * pxNetworkContext,
+                           void * pvBuffer,
+                           size_t xBytesToRecv )
+{
+    SocketTransportParams_t * pxSocketParams = ( SocketTransportParams_t * ) pxNetworkContext->pParams;
+    int32_t lStatus;
+
+    lStatus = recv( socketesp32TO_FD( pxSocketParams->xTCPSocket ), pvBuffer, xBytesToRecv, 0 );
+
+    if( lStatus < 0 )
+    {
+        /* Receive timeout, the caller decides whether to retry. */
+        if( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+        {
+            return 0;
+        }
+
+        ESP_LOGE( TAG, "Reading failed, errno= %d", errno );
+        return SOCKETS_SOCKET_ERROR;
+    }
+    else if( lStatus == 0 )
+    {
+        /* The server closed the connection. */
+        return SOCKETS_ECLOSED;
+    }
+
+    return lStatus;
+}
+/*-----------------------------------------------------------*/
@@ -22,11 +22,12 @@
 /**
  * @file transport_tls_esp32.c
  * @brief TLS transport interface implementations. This implementation uses
- * mbedTLS.
+ * mbedTLS through esp-tls.
  */
 
 /* Standard includes. */
 #include "errno.h"
+#include <string.h>
 
 /* FreeRTOS includes. */
 #include "freertos/FreeRTOS.h"
@@ -37,7 +38,8 @@
 #include "esp_log.h"
 
 /* TLS includes. */
-#include "esp_transport_ssl.h"
+#include "esp_tls.h"
+#include "lwip/sockets.h"
 
 #include "demo_config.h"
 
@@ -219,12 +221,12 @@ uint32_t getRegistrationId( char **ppcRegistrationId ) {
 
 /**
  * @brief Definition of the network context for the transport interface
- * implementation that uses mbedTLS and FreeRTOS+TLS sockets.
+ * implementation that uses esp-tls.
  */
 typedef struct EspTlsTransportParams
 {
-    esp_transport_handle_t xTransport;
-    esp_transport_list_handle_t xTransportList;
+    esp_tls_t * pxTls;
+    int xSocket;
     uint32_t ulReceiveTimeoutMs;
     uint32_t ulSendTimeoutMs;
 } EspTlsTransportParams_t;
@@ -238,6 +240,76 @@ struct NetworkContext
     void * pParams;
 };
 
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+
+#define tlsesp32SESSION_HOSTNAME_SIZE 128
+
+/**
+ * @brief Last TLS session negotiated, offered again on the next connection to the
+ * same endpoint so a reconnect skips the full handshake.
+ */
+static esp_tls_client_session_t * pxCachedSession = NULL;
+static char pcCachedSessionHost[ tlsesp32SESSION_HOSTNAME_SIZE ];
+static uint16_t usCachedSessionPort = 0;
+
+static esp_tls_client_session_t * prvGetCachedSession( const char * pHostName,
+                                                       uint16_t usPort )
+{
+    if( ( pxCachedSession != NULL ) &&
+        ( usCachedSessionPort == usPort ) &&
+        ( strncmp( pcCachedSessionHost, pHostName, sizeof( pcCachedSessionHost ) ) == 0 ) )
+    {
+        return pxCachedSession;
+    }
+
+    return NULL;
+}
+
+static void prvClearCachedSession( void )
+{
+    if( pxCachedSession != NULL )
+    {
+        esp_tls_free_client_session( pxCachedSession );
+        pxCachedSession = NULL;
+    }
+
+    usCachedSessionPort = 0;
+    pcCachedSessionHost[ 0 ] = '\0';
+}
+
+static void prvStoreCachedSession( esp_tls_t * pxTls,
+                                   const char * pHostName,
+                                   uint16_t usPort )
+{
+    esp_tls_client_session_t * pxSession = esp_tls_get_client_session( pxTls );
+
+    if( pxSession == NULL )
+    {
+        return;
+    }
+
+    prvClearCachedSession();
+    pxCachedSession = pxSession;
+    usCachedSessionPort = usPort;
+    strncpy( pcCachedSessionHost, pHostName, sizeof( pcCachedSessionHost ) - 1 );
+    pcCachedSessionHost[ sizeof( pcCachedSessionHost ) - 1 ] = '\0';
+}
+
+#endif /* CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS */
+
+static void prvSetSocketTimeout( int xSocket,
+                                 int xOption,
+                                 uint32_t ulTimeoutMs )
+{
+    struct timeval xTimeout =
+    {
+        .tv_sec = ulTimeoutMs / 1000,
+        .tv_usec = ( ulTimeoutMs % 1000 ) * 1000
+    };
+
+    ( void ) setsockopt( xSocket, SOL_SOCKET, xOption, &xTimeout, sizeof( xTimeout ) );
+}
+
 /*-----------------------------------------------------------*/
 
 TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
@@ -274,6 +346,12 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
     if ( pxTlsParams->xSSLContext != NULL )
     {
         pxEspTlsTransport = pxTlsParams->xSSLContext;
+
+        if ( pxEspTlsTransport->pxTls != NULL )
+        {
+            esp_tls_conn_destroy( pxEspTlsTransport->pxTls );
+            pxEspTlsTransport->pxTls = NULL;
+        }
     }
     else
     {
@@ -284,90 +362,117 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
             return eTLSTransportInsufficientMemory;
         }
 
-        // Create a transport list into which we put the transport.
-        pxEspTlsTransport->xTransportList = esp_transport_list_init();
-        pxEspTlsTransport->xTransport = esp_transport_ssl_init( );
-        pxEspTlsTransport->ulReceiveTimeoutMs = ulReceiveTimeoutMs;
-        pxEspTlsTransport->ulSendTimeoutMs = ulSendTimeoutMs;
+        pxEspTlsTransport->pxTls = NULL;
+        pxEspTlsTransport->xSocket = -1;
+        pxTlsParams->xSSLContext = (void*)pxEspTlsTransport;
+    }
 
-        esp_transport_ssl_enable_global_ca_store(pxEspTlsTransport->xTransport);
+    pxEspTlsTransport->ulReceiveTimeoutMs = ulReceiveTimeoutMs;
+    pxEspTlsTransport->ulSendTimeoutMs = ulSendTimeoutMs;
 
-        esp_transport_list_add(pxEspTlsTransport->xTransportList, pxEspTlsTransport->xTransport, "_ssl");
+    /* The handshake is bounded by the send timeout, the receive timeout only bounds
+     * the wait for application data in TLS_Socket_Recv(). */
+    esp_tls_cfg_t xTlsConfig =
+    {
+        .timeout_ms = ( int ) ulSendTimeoutMs,
+        .use_global_ca_store = true,
+        .alpn_protos = pNetworkCredentials->ppcAlpnProtos,
+        .skip_common_name = pNetworkCredentials->xDisableSni ? true : false,
+    };
 
-        pxTlsParams->xSSLContext = (void*)pxEspTlsTransport;
+    if ( pNetworkCredentials->pucRootCa )
+    {
+        ESP_LOGI( TAG, "Setting CA store");
+        esp_tls_set_global_ca_store( ( const unsigned char * ) pNetworkCredentials->pucRootCa, pNetworkCredentials->xRootCaSize );
+    }
 
-        if ( pNetworkCredentials->ppcAlpnProtos )
-        {
-            esp_transport_ssl_set_alpn_protocol( pxEspTlsTransport->xTransport, pNetworkCredentials->ppcAlpnProtos );
-        }
+#ifdef democonfigUSE_HSM
 
-        if ( pNetworkCredentials->xDisableSni )
-        {
-            esp_transport_ssl_skip_common_name_check( pxEspTlsTransport->xTransport );
-        }
+    xTlsConfig.use_secure_element = true;
 
-        if ( pNetworkCredentials->pucRootCa )
+    #if defined(CONFIG_ATECC608A_TCUSTOM) || defined(CONFIG_ATECC608A_TFLEX)
+        /*  This is TrustCUSTOM or TrustFLEX chip - the private key will be used from the ATECC608 device slot 0.
+            We will plug in your custom device certificate here (should be in DER format).
+        */
+        if ( pNetworkCredentials->pucClientCert )
         {
-            ESP_LOGI( TAG, "Setting CA store");
-            esp_tls_set_global_ca_store( ( const unsigned char * ) pNetworkCredentials->pucRootCa, pNetworkCredentials->xRootCaSize );
+            xTlsConfig.clientcert_buf = pNetworkCredentials->pucClientCert;
+            xTlsConfig.clientcert_bytes = pNetworkCredentials->xClientCertSize;
         }
-#ifdef democonfigUSE_HSM
-
-        esp_transport_ssl_use_secure_element( pxEspTlsTransport->xTransport );
 
-        #if defined(CONFIG_ATECC608A_TCUSTOM) || defined(CONFIG_ATECC608A_TFLEX)
-            /*  This is TrustCUSTOM or TrustFLEX chip - the private key will be used from the ATECC608 device slot 0.
-                We will plug in your custom device certificate here (should be in DER format).
-            */
-            if ( pNetworkCredentials->pucClientCert )
-            {
-                esp_transport_ssl_set_client_cert_data_der( pxEspTlsTransport->xTransport, ( const char *) pNetworkCredentials->pucClientCert, pNetworkCredentials->xClientCertSize );
-            }
-
-        
-        #else
-            /*  This is the Trust&GO chip - the private key will be used from ATECC608 device slot 0.
-                We don't need to add certs to the network context as the esp-tls does that for us using cryptoauthlib API.
-            */
+    #else
+        /*  This is the Trust&GO chip - the private key will be used from ATECC608 device slot 0.
+            We don't need to add certs to the network context as the esp-tls does that for us using cryptoauthlib API.
+        */
 
-        #endif
+    #endif
 
 #else
 
-        if ( pNetworkCredentials->pucClientCert )
-        {
-            esp_transport_ssl_set_client_cert_data_der( pxEspTlsTransport->xTransport, ( const char *) pNetworkCredentials->pucClientCert, pNetworkCredentials->xClientCertSize );
-        }
+    if ( pNetworkCredentials->pucClientCert )
+    {
+        xTlsConfig.clientcert_buf = pNetworkCredentials->pucClientCert;
+        xTlsConfig.clientcert_bytes = pNetworkCredentials->xClientCertSize;
+    }
 
-        if ( pNetworkCredentials->pucPrivateKey )
-        {
-            esp_transport_ssl_set_client_key_data_der( pxEspTlsTransport->xTransport, (const char *) pNetworkCredentials->pucPrivateKey, pNetworkCredentials->xPrivateKeySize );
-        }
+    if ( pNetworkCredentials->pucPrivateKey )
+    {
+        xTlsConfig.clientkey_buf = pNetworkCredentials->pucPrivateKey;
+        xTlsConfig.clientkey_bytes = pNetworkCredentials->xPrivateKeySize;
+    }
 
 #endif
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    xTlsConfig.client_session = prvGetCachedSession( pHostName, usPort );
+
+    if ( xTlsConfig.client_session != NULL )
+    {
+        ESP_LOGI( TAG, "Resuming TLS session with %s", pHostName );
     }
+#endif
+
+    pxEspTlsTransport->pxTls = esp_tls_init();
 
-    if ( esp_transport_connect( pxEspTlsTransport->xTransport, pHostName, usPort, ulReceiveTimeoutMs ) < 0 )
+    if ( pxEspTlsTransport->pxTls == NULL )
+    {
+        xReturnStatus = eTLSTransportInsufficientMemory;
+    }
+    else if ( esp_tls_conn_new_sync( pHostName, strlen( pHostName ), usPort, &xTlsConfig, pxEspTlsTransport->pxTls ) != 1 )
     {
-        ESP_LOGE( TAG, "Failed establishing TLS connection (esp_transport_connect failed)" );
+        ESP_LOGE( TAG, "Failed establishing TLS connection (esp_tls_conn_new_sync failed)" );
         xReturnStatus = eTLSTransportConnectFailure;
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        /* A rejected ticket should not be offered again. */
+        prvClearCachedSession();
+#endif
+    }
+    else if ( esp_tls_get_conn_sockfd( pxEspTlsTransport->pxTls, &pxEspTlsTransport->xSocket ) != ESP_OK )
+    {
+        xReturnStatus = eTLSTransportInternalError;
     }
     else
     {
+        prvSetSocketTimeout( pxEspTlsTransport->xSocket, SO_SNDTIMEO, ulSendTimeoutMs );
         xReturnStatus = eTLSTransportSuccess;
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        prvStoreCachedSession( pxEspTlsTransport->pxTls, pHostName, usPort );
+#endif
     }
 
     /* Clean up on failure. */
     if( xReturnStatus != eTLSTransportSuccess )
     {
-        if( pxEspTlsTransport != NULL )
+        if( pxEspTlsTransport->pxTls != NULL )
         {
-            esp_transport_close( pxEspTlsTransport->xTransport );
-            esp_tls_free_global_ca_store( );
-            esp_transport_list_destroy(pxEspTlsTransport->xTransportList);
-            vPortFree(pxEspTlsTransport);
-            pxTlsParams->xSSLContext = NULL;
+            esp_tls_conn_destroy( pxEspTlsTransport->pxTls );
         }
+
+        esp_tls_free_global_ca_store( );
+        vPortFree(pxEspTlsTransport);
+        pxTlsParams->xSSLContext = NULL;
     }
     else
     {
@@ -390,7 +495,7 @@ void TLS_Socket_Disconnect( NetworkContext_t * pNetworkContext )
 
     TlsTransportParams_t * pxTlsParams = (TlsTransportParams_t*)pNetworkContext->pParams;
 
-    if (( pxTlsParams == NULL ))
+    if (( pxTlsParams == NULL ) || ( pxTlsParams->xSSLContext == NULL ))
     {
         ESP_LOGE( TAG, "Invalid input parameter(s): Arguments cannot be NULL." );
         return;
@@ -399,13 +504,12 @@ void TLS_Socket_Disconnect( NetworkContext_t * pNetworkContext )
     EspTlsTransportParams_t * pxEspTlsTransport = (EspTlsTransportParams_t *)pxTlsParams->xSSLContext;
 
     /* Attempting to terminate TLS connection. */
-    esp_transport_close( pxEspTlsTransport->xTransport );
+    esp_tls_conn_destroy( pxEspTlsTransport->pxTls );
 
     /* Clear CA store. */
     esp_tls_free_global_ca_store( );
 
     /* Free TLS contexts. */
-    esp_transport_list_destroy(pxEspTlsTransport->xTransportList);
     vPortFree(pxEspTlsTransport);
     pxTlsParams->xSSLContext = NULL;
 }
@@ -436,8 +540,37 @@ int32_t TLS_Socket_Recv( NetworkContext_t * pNetworkContext,
 
     EspTlsTransportParams_t * pxEspTlsTransport = (EspTlsTransportParams_t *)pxTlsParams->xSSLContext;
 
-    tlsStatus = esp_transport_read( pxEspTlsTransport->xTransport, pBuffer, xBytesToRecv, pxEspTlsTransport->ulReceiveTimeoutMs );
-    if ( tlsStatus < 0 )
+    /* Only block on the socket when mbedTLS has no decrypted bytes buffered. */
+    if ( esp_tls_get_bytes_avail( pxEspTlsTransport->pxTls ) <= 0 )
+    {
+        fd_set xReadSet;
+        struct timeval xTimeout =
+        {
+            .tv_sec = pxEspTlsTransport->ulReceiveTimeoutMs / 1000,
+            .tv_usec = ( pxEspTlsTransport->ulReceiveTimeoutMs % 1000 ) * 1000
+        };
+
+        FD_ZERO( &xReadSet );
+        FD_SET( pxEspTlsTransport->xSocket, &xReadSet );
+
+        tlsStatus = select( pxEspTlsTransport->xSocket + 1, &xReadSet, NULL, NULL, &xTimeout );
+        if ( tlsStatus == 0 )
+        {
+            return 0;
+        }
+        else if ( tlsStatus < 0 )
+        {
+            ESP_LOGE( TAG, "Select failed, errno= %d", errno );
+            return ESP_FAIL;
+        }
+    }
+
+    tlsStatus = esp_tls_conn_read( pxEspTlsTransport->pxTls, pBuffer, xBytesToRecv );
+    if ( ( tlsStatus == ESP_TLS_ERR_SSL_WANT_READ ) || ( tlsStatus == ESP_TLS_ERR_SSL_WANT_WRITE ) )
+    {
+        return 0;
+    }
+    else if ( tlsStatus <= 0 )
     {
         ESP_LOGE( TAG, "Reading failed, errno= %d", errno );
         return ESP_FAIL;
@@ -472,8 +605,12 @@ int32_t TLS_Socket_Send( NetworkContext_t * pNetworkContext,
 
     EspTlsTransportParams_t * pxEspTlsTransport = (EspTlsTransportParams_t *)pxTlsParams->xSSLContext;
 
-    tlsStatus = esp_transport_write( pxEspTlsTransport->xTransport, pBuffer, xBytesToSend, pxEspTlsTransport->ulSendTimeoutMs );
-    if ( tlsStatus < 0 )
+    tlsStatus = esp_tls_conn_write( pxEspTlsTransport->pxTls, pBuffer, xBytesToSend );
+    if ( ( tlsStatus == ESP_TLS_ERR_SSL_WANT_READ ) || ( tlsStatus == ESP_TLS_ERR_SSL_WANT_WRITE ) )
+    {
+        return 0;
+    }
+    else if ( tlsStatus < 0 )
     {
         ESP_LOGE( TAG, "Writing failed, errno= %d", errno );
         return ESP_FAIL;
@@ -482,3 +619,69 @@ int32_t TLS_Socket_Send( NetworkContext_t * pNetworkContext,
     return tlsStatus;
 }
 /*-----------------------------------------------------------*/
+
+int32_t TLS_Socket_Wait( NetworkContext_t * pNetworkContext,
+                         int xWakeupFd,
+                         uint32_t ulTimeoutMs )
+{
+    int32_t lStatus = 0;
+    int xMaxFd;
+    fd_set xReadSet;
+    struct timeval xTimeout =
+    {
+        .tv_sec = ulTimeoutMs / 1000,
+        .tv_usec = ( ulTimeoutMs % 1000 ) * 1000
+    };
+
+    if (( pNetworkContext == NULL ) || ( pNetworkContext->pParams == NULL ))
+    {
+        ESP_LOGE( TAG, "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p.", pNetworkContext );
+        return eTLSTransportInvalidParameter;
+    }
+
+    TlsTransportParams_t * pxTlsParams = (TlsTransportParams_t*)pNetworkContext->pParams;
+    EspTlsTransportParams_t * pxEspTlsTransport = (EspTlsTransportParams_t *)pxTlsParams->xSSLContext;
+
+    if ( pxEspTlsTransport == NULL )
+    {
+        return ESP_FAIL;
+    }
+
+    /* Records already decrypted by mbedTLS will not make the socket readable again. */
+    if ( esp_tls_get_bytes_avail( pxEspTlsTransport->pxTls ) > 0 )
+    {
+        return tlsWAIT_READABLE;
+    }
+
+    FD_ZERO( &xReadSet );
+    FD_SET( pxEspTlsTransport->xSocket, &xReadSet );
+    xMaxFd = pxEspTlsTransport->xSocket;
+
+    if ( xWakeupFd >= 0 )
+    {
+        FD_SET( xWakeupFd, &xReadSet );
+        xMaxFd = ( xWakeupFd > xMaxFd ) ? xWakeupFd : xMaxFd;
+    }
+
+    lStatus = select( xMaxFd + 1, &xReadSet, NULL, NULL, &xTimeout );
+    if ( lStatus < 0 )
+    {
+        ESP_LOGE( TAG, "Select failed, errno= %d", errno );
+        return ESP_FAIL;
+    }
+
+    lStatus = 0;
+
+    if ( FD_ISSET( pxEspTlsTransport->xSocket, &xReadSet ) )
+    {
+        lStatus |= tlsWAIT_READABLE;
+    }
+
+    if ( ( xWakeupFd >= 0 ) && FD_ISSET( xWakeupFd, &xReadSet ) )
+    {
+        lStatus |= tlsWAIT_WAKEUP;
+    }
+
+    return lStatus;
+}
+/*-----------------------------------------------------------*/
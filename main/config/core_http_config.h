@@ -0,0 +1,54 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#ifndef CORE_HTTP_CONFIG_H
+#define CORE_HTTP_CONFIG_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/*
+ * Include logging header files and define logging macros in the following order:
+ * 1. Include the header file "esp_log.h".
+ * 2. Define the LIBRARY_LOG_NAME and LIBRARY_LOG_LEVEL macros depending on
+ * the logging configuration for DEMO.
+ * 3. Define macros to replace module logging functions by esp logging functions.
+ */
+
+#include "esp_log.h"
+
+#ifndef LIBRARY_LOG_NAME
+#define LIBRARY_LOG_NAME "HTTP"
+#endif
+
+#define SINGLE_PARENTHESIS_LOGE(x, ...) ESP_LOGE(LIBRARY_LOG_NAME, x, ##__VA_ARGS__)
+#define LogError(message) SINGLE_PARENTHESIS_LOGE message
+
+#define SINGLE_PARENTHESIS_LOGI(x, ...) ESP_LOGI(LIBRARY_LOG_NAME, x, ##__VA_ARGS__)
+#define LogInfo(message) SINGLE_PARENTHESIS_LOGI message
+
+#define SINGLE_PARENTHESIS_LOGW(x, ...) ESP_LOGW(LIBRARY_LOG_NAME, x, ##__VA_ARGS__)
+#define LogWarn(message) SINGLE_PARENTHESIS_LOGW message
+
+#define SINGLE_PARENTHESIS_LOGD(x, ...) ESP_LOGD(LIBRARY_LOG_NAME, x, ##__VA_ARGS__)
+#define LogDebug(message) SINGLE_PARENTHESIS_LOGD message
+
+/* The middleware's coreHTTP port logs every response through SdkLog */
+#define SdkLog(message) LogDebug(message)
+
+/************ End of logging configuration ****************/
+
+/**
+ * @brief Space reserved for the response headers of a firmware range request.
+ *
+ * Blob storage sends a few hundred bytes of headers with each 206 response.
+ */
+#define HTTP_MAX_RESPONSE_HEADERS_SIZE_BYTES 1024U
+
+/**
+ * @brief The user agent sent with every request.
+ */
+#define HTTP_USER_AGENT_VALUE "digital-twin-motor-control"
+
+#endif /* ifndef CORE_HTTP_CONFIG_H */
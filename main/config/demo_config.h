@@ -10,7 +10,7 @@
  * This Model ID is tightly tied to the code implementation in `sample_azure_iot_pnp_simulated_device.c`
  * If you intend to test a different Model ID, please provide the implementation of the model on your application.
  */
-#define sampleazureiotMODEL_ID "dtmi:dcmotor;1"
+#define sampleazureiotMODEL_ID "dtmi:dcmotor;5"
 
 /**************************************************/
 /******* DO NOT CHANGE the following order ********/
@@ -84,6 +84,41 @@
 
 #endif /* democonfigENABLE_DPS_SAMPLE */
 
+/**
+ * @brief Enable Device Update
+ *
+ * @note To disable Device Update undef this macro
+ *
+ */
+
+#ifdef CONFIG_ENABLE_ADU_SAMPLE
+#define democonfigENABLE_ADU_SAMPLE
+#endif
+
+#ifdef democonfigENABLE_ADU_SAMPLE
+
+/**
+ * @brief Device properties used by Device Update to target deployments.
+ *
+ * @note https://docs.microsoft.com/azure/iot-hub-device-update/device-update-plug-and-play#device-properties
+ *
+ */
+#define democonfigADU_DEVICE_MANUFACTURER CONFIG_AZURE_ADU_DEVICE_MANUFACTURER
+#define democonfigADU_DEVICE_MODEL CONFIG_AZURE_ADU_DEVICE_MODEL
+
+/**
+ * @brief Update ID of the running firmware, reported as the installed update.
+ *
+ * @note The version is compared against the installed criteria of an update request.
+ *
+ */
+#define democonfigADU_UPDATE_PROVIDER CONFIG_AZURE_ADU_UPDATE_PROVIDER
+#define democonfigADU_UPDATE_NAME CONFIG_AZURE_ADU_UPDATE_NAME
+#define democonfigADU_UPDATE_VERSION CONFIG_AZURE_ADU_UPDATE_VERSION
+#define democonfigADU_UPDATE_ID "{\"provider\":\"" democonfigADU_UPDATE_PROVIDER "\",\"name\":\"" democonfigADU_UPDATE_NAME "\",\"version\":\"" democonfigADU_UPDATE_VERSION "\"}"
+
+#endif /* democonfigENABLE_ADU_SAMPLE */
+
 /**
  * @brief IoTHub device Id.
  *
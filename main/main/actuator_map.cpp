@@ -0,0 +1,178 @@
+// Includes
+#include "actuator_map.hpp"
+#include "calibration.hpp"
+
+#include <string.h>
+#include <cmath>
+
+static constexpr char *ACTUATOR_MAP_KEY = "actuator";
+
+ActuatorMap::ActuatorMap()
+{
+  reset(0);
+}
+
+uint8_t ActuatorMap::index(int32_t direction)
+{
+  return direction < 0 ? 1 : 0;
+}
+
+// Linear remap of [0, 1] onto [min_duty_cycle, 1] in both directions, with no friction model
+void ActuatorMap::reset(float min_duty_cycle)
+{
+  calibrated = false;
+  max_velocity = 0;
+  memset(friction, 0, sizeof(friction));
+
+  for (uint8_t i = 0; i < TABLE_SIZE; i++)
+  {
+    table[0][i] = min_duty_cycle + (1 - min_duty_cycle) * i / (TABLE_SIZE - 1);
+    table[1][i] = table[0][i];
+  }
+}
+
+// Inverts the steady-state velocity measured at each duty into the table for one direction.
+// Points that would make the curve non-monotone are dropped, above the last point the table
+// follows the viscous fit. Returns false if no point was moving.
+bool ActuatorMap::set_curve(int32_t direction, const actuator_friction &friction, const float *duty, const float *velocity,
+                            uint8_t count, float max_velocity)
+{
+  float curve_duty[TABLE_SIZE + 1];
+  float curve_velocity[TABLE_SIZE + 1];
+  uint8_t curve_count = 1;
+  uint8_t order[TABLE_SIZE];
+  uint8_t direction_index = index(direction);
+  uint8_t segment = 1;
+
+  if (count == 0 || count > TABLE_SIZE || max_velocity <= 0)
+    return false;
+
+  // Velocity order, the sweep measures from full duty down
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint8_t j = i;
+    while (j > 0 && velocity[order[j - 1]] > velocity[i])
+    {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = i;
+  }
+
+  // Starts from the Coulomb duty at standstill, the edge of the dead zone
+  curve_duty[0] = fmaxf(friction.coulomb, 0);
+  curve_velocity[0] = 0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    float point_duty = duty[order[i]];
+    float point_velocity = velocity[order[i]];
+
+    if (point_velocity > curve_velocity[curve_count - 1] && point_duty >= curve_duty[curve_count - 1])
+    {
+      curve_duty[curve_count] = point_duty;
+      curve_velocity[curve_count] = point_velocity;
+      curve_count++;
+    }
+  }
+  if (curve_count < 2)
+    return false;
+
+  for (uint8_t i = 0; i < TABLE_SIZE; i++)
+  {
+    float target = max_velocity * i / (TABLE_SIZE - 1);
+    float value;
+
+    while (segment < curve_count - 1 && curve_velocity[segment] < target)
+      segment++;
+
+    if (target > curve_velocity[curve_count - 1])
+      value = curve_duty[curve_count - 1] + friction.viscous * (target - curve_velocity[curve_count - 1]);
+    else
+      value = curve_duty[segment - 1] + (curve_duty[segment] - curve_duty[segment - 1]) *
+                                            (target - curve_velocity[segment - 1]) /
+                                            (curve_velocity[segment] - curve_velocity[segment - 1]);
+
+    value = fminf(fmaxf(value, 0), 1);
+    table[direction_index][i] = i > 0 ? fmaxf(value, table[direction_index][i - 1]) : value;
+  }
+
+  this->friction[direction_index] = friction;
+  this->max_velocity = max_velocity;
+  return true;
+}
+
+void ActuatorMap::set_calibrated()
+{
+  calibrated = true;
+}
+
+// PWM duty for a command in [0, 1]. From rest a calibrated map gives at least the breakaway duty,
+// below it the motor would sit in stiction until the integral wound up.
+float ActuatorMap::to_duty(float command, int32_t direction, bool at_rest)
+{
+  uint8_t direction_index = index(direction);
+  float position;
+  uint8_t lower;
+  float duty;
+
+  command = fminf(fmaxf(command, 0), 1);
+  position = command * (TABLE_SIZE - 1);
+  lower = (uint8_t)position;
+  if (lower >= TABLE_SIZE - 1)
+    duty = table[direction_index][TABLE_SIZE - 1];
+  else
+    duty = table[direction_index][lower] + (table[direction_index][lower + 1] - table[direction_index][lower]) * (position - lower);
+
+  if (calibrated && at_rest && command > 0)
+    duty = fmaxf(duty, friction[direction_index].breakaway);
+
+  return duty;
+}
+
+// Command that holds a velocity in RPM with no error, 0 when uncalibrated
+float ActuatorMap::feedforward(float velocity)
+{
+  if (!calibrated)
+    return 0;
+
+  return fminf(fabsf(velocity) / max_velocity, 1);
+}
+
+bool ActuatorMap::is_calibrated()
+{
+  return calibrated;
+}
+
+float ActuatorMap::get_max_velocity()
+{
+  return max_velocity;
+}
+
+const actuator_friction &ActuatorMap::get_friction(int32_t direction)
+{
+  return friction[index(direction)];
+}
+
+esp_err_t ActuatorMap::load(uint8_t motor)
+{
+  ActuatorMap stored;
+  esp_err_t err = calibration_load(motor, ACTUATOR_MAP_KEY, &stored, sizeof(stored));
+
+  if (err != ESP_OK)
+    return err;
+  if (!stored.calibrated || stored.max_velocity <= 0)
+    return ESP_ERR_INVALID_STATE;
+
+  *this = stored;
+  return ESP_OK;
+}
+
+esp_err_t ActuatorMap::save(uint8_t motor)
+{
+  return calibration_save(motor, ACTUATOR_MAP_KEY, this, sizeof(*this));
+}
+
+esp_err_t ActuatorMap::erase(uint8_t motor)
+{
+  return calibration_erase(motor, ACTUATOR_MAP_KEY);
+}
@@ -0,0 +1,56 @@
+#ifndef ACTUATOR_MAP_H_
+#define ACTUATOR_MAP_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Friction of one direction in raw PWM duty, fitted as duty = coulomb + viscous * velocity
+typedef struct
+{
+  float breakaway;    // Duty that starts the motor from rest
+  float coulomb;      // Duty that just keeps it turning
+  float viscous;      // Duty per RPM
+  float max_velocity; // RPM at full duty
+} actuator_friction;
+
+// Maps the controllers' duty cycle command to the PWM duty per direction. A calibrated command
+// is the fraction of max_velocity, so the table inverts the dead zone and the curve of the
+// velocity against duty. Uncalibrated, it is the fixed [MIN_DUTY_CYCLE, 1] remap it replaces.
+class ActuatorMap
+{
+public:
+  static constexpr uint8_t TABLE_SIZE = 17;
+
+private:
+  // Class variables
+  bool calibrated;
+  float max_velocity; // RPM a command of 1 gives in either direction
+  actuator_friction friction[2]; // Clockwise, counter-clockwise
+  float table[2][TABLE_SIZE];    // PWM duty at commands evenly spaced over [0, 1], non-decreasing
+
+  static uint8_t index(int32_t direction);
+
+public:
+  ActuatorMap();
+
+  void reset(float min_duty_cycle);
+  bool set_curve(int32_t direction, const actuator_friction &friction, const float *duty, const float *velocity,
+                 uint8_t count, float max_velocity);
+  void set_calibrated();
+
+  float to_duty(float command, int32_t direction, bool at_rest);
+  float feedforward(float velocity);
+
+  bool is_calibrated();
+  float get_max_velocity();
+  const actuator_friction &get_friction(int32_t direction);
+
+  esp_err_t load(uint8_t motor);
+  esp_err_t save(uint8_t motor);
+  esp_err_t erase(uint8_t motor);
+};
+
+#endif // ACTUATOR_MAP_H_
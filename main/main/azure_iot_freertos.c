@@ -8,6 +8,7 @@
 
 #include "azure_sample_connection.h"
 #include "azure_iot_freertos.h"
+#include "startup.h"
 
 #include "sdkconfig.h"
 #include "esp_event.h"
@@ -107,7 +108,12 @@ static void on_got_ip(void *arg,
              esp_netif_get_desc(event->esp_netif), IP2STR(&event->ip_info.ip));
     memcpy(&s_ip_addr, &event->ip_info.ip, sizeof(s_ip_addr));
     s_is_connected_to_internet = true;
-    xSemaphoreGive(s_semph_get_ip_addrs);
+    startup_complete(STARTUP_STAGE_WIFI);
+
+    if (s_semph_get_ip_addrs != NULL)
+    {
+        xSemaphoreGive(s_semph_get_ip_addrs);
+    }
 }
 /*-----------------------------------------------------------*/
 
@@ -288,36 +294,46 @@ static void time_sync_notification_cb(struct timeval *tv)
 {
     ESP_LOGI(TAG, "Notification of a time synchronization event");
     g_timeInitialized = true;
+    startup_complete(STARTUP_STAGE_TIME);
 }
 /*-----------------------------------------------------------*/
 
-static void initialize_time()
+/* SNTP retries on its own until the station has an address, completion is signalled from the callback */
+static void initialize_time(void)
 {
     sntp_setoperatingmode(SNTP_OPMODE_POLL);
     sntp_setservername(0, SNTP_SERVER_FQDN);
     sntp_set_time_sync_notification_cb(time_sync_notification_cb);
     sntp_init();
 
-    ESP_LOGI(TAG, "Waiting for time synchronization with SNTP server");
-
-    while (!g_timeInitialized)
-    {
-        vTaskDelay(pdMS_TO_TICKS(1000));
-    }
+    ESP_LOGI(TAG, "Time synchronization with SNTP server started");
 }
 /*-----------------------------------------------------------*/
 
-void azure_init(void)
+static void initialize_storage(void)
 {
     ESP_ERROR_CHECK(nvs_flash_init());
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    /*Allow other core to finish initialization */
-    vTaskDelay(pdMS_TO_TICKS(100));
+    startup_complete(STARTUP_STAGE_STORAGE);
+}
+/*-----------------------------------------------------------*/
+
+/* Starts the station without waiting for an address, completion is signalled from on_got_ip */
+static void initialize_wifi(void)
+{
+    (void)wifi_start();
+    ESP_ERROR_CHECK(esp_register_shutdown_handler(&stop));
+}
+/*-----------------------------------------------------------*/
 
-    (void)example_connect();
+void azure_init(void)
+{
+    startup_launch(STARTUP_STAGE_STORAGE, initialize_storage, 0);
+    startup_launch(STARTUP_STAGE_WIFI, initialize_wifi, STARTUP_BIT(STARTUP_STAGE_STORAGE));
+    startup_launch(STARTUP_STAGE_TIME, initialize_time, STARTUP_BIT(STARTUP_STAGE_STORAGE));
 
-    initialize_time();
+    /* The demo task waits on the Wi-Fi and time stages before provisioning */
     vStartDemoTask();
 }
 /*-----------------------------------------------------------*/
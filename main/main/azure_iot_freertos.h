@@ -1,6 +1,9 @@
 #ifndef AZURE_IOT_FREERTOS_H
 #define AZURE_IOT_FREERTOS_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
 #ifdef __cplusplus
@@ -8,18 +11,83 @@ extern "C"
 {
 #endif
 
+    // Outbound publishes, sent by the network task which owns the MQTT connection. Requests about
+    // one motor carry its index as a one byte payload, none is motor 0.
+    typedef enum
+    {
+        AZURE_REQUEST_TELEMETRY = 0,       // A new sample frame is ready to be sent
+        AZURE_REQUEST_SUMMARY,             // The summary of the new sample frame is ready to be sent
+        AZURE_REQUEST_REPORTED_PROPERTIES, // Payload is a reported properties JSON document
+        AZURE_REQUEST_UPDATE_STATE,        // Payload is the OTAResult_t of a finished firmware update
+        AZURE_REQUEST_CAPTURE,             // A triggered capture is complete and waiting to be uploaded
+        AZURE_REQUEST_SYSTEM_ID,           // A system identification run finished, report its model
+        AZURE_REQUEST_GAIN_SCHEDULE,       // Auto-tuning finished or the schedule was cleared, report it
+        AZURE_REQUEST_ACTUATOR,            // Actuator calibration finished or was cleared, report the map
+        AZURE_REQUEST_SPECTRUM,            // A condition monitoring window completed, send its features
+        AZURE_REQUEST_FAULT,               // A safety fault latched or was cleared, report it
+    } azure_request_t;
+
     void azure_init(void);
     extern bool xAzureSample_IsConnectedToInternet();
+    extern bool azure_request_publish(azure_request_t request, const uint8_t *payload, uint32_t length);
 
-    extern void get_data(uint64_t *timestamp, int32_t *direction, float *duty_cycle, float *velocity, float *position, float *current);
+    // Motor bridges take the motor's index, below CONFIG_DTMC_MOTOR_COUNT
+    extern void get_data(uint8_t motor, uint64_t *timestamp, int32_t *direction, float *duty_cycle, float *velocity, float *position, float *current);
     
-    extern void set_desired_mode(int32_t mode);
-    extern void set_desired_gain(float gain);
-    extern void set_desired_frequency(float freq);
-    extern void set_desired_position(float position);
-    extern void set_desired_velocity(float velocity);
+    extern void set_desired_mode(uint8_t motor, int32_t mode);
+    extern void set_desired_gain(uint8_t motor, float gain);
+    extern void set_desired_frequency(uint8_t motor, float freq);
+    extern void set_desired_position(uint8_t motor, float position);
+    extern void set_desired_velocity(uint8_t motor, float velocity);
+    extern void step_desired_position(uint8_t motor, float position);
+    extern void step_desired_velocity(uint8_t motor, float velocity);
+    extern void emergency_stop(void); // Stops every motor
     
-    extern bool get_sample_string(char *char_array);
+    // Streams the latest sample frame, returns 0 and holds nothing when no new frame is ready.
+    // Otherwise the frame is held until close_sample_stream().
+    extern uint32_t open_sample_stream(uint8_t motor);
+    extern uint32_t read_sample_stream(uint8_t motor, char *dest, uint32_t size);
+    extern void close_sample_stream(uint8_t motor);
+
+    // Copies the latest frame summary as JSON, returns 0 if it does not fit
+    extern uint32_t get_sample_summary(uint8_t motor, char *dest, uint32_t size);
+
+    // Triggered capture, held from completion until release_capture() re-arms it
+    extern bool start_capture(uint8_t motor);
+    extern uint32_t get_capture_id(uint8_t motor);
+    extern uint32_t get_capture_metadata(uint8_t motor, char *dest, uint32_t size);
+    extern uint32_t get_capture_length(uint8_t motor);
+    extern uint32_t read_capture(uint8_t motor, uint32_t offset, uint8_t *dest, uint32_t size);
+    extern void release_capture(uint8_t motor);
+
+    // Features of the last condition monitoring window as JSON, 0 before the first completes
+    extern uint32_t get_spectrum_features(uint8_t motor, char *dest, uint32_t size);
+
+    // System identification, ESP_ERR_INVALID_STATE while a run is in progress
+    extern esp_err_t start_system_id(uint8_t motor, int32_t excitation, int32_t order, float offset, float amplitude,
+                                     float duration, float response, bool apply);
+    extern uint32_t get_system_id_report(uint8_t motor, char *dest, uint32_t size);
+
+    // Relay auto-tuning of the velocity gain schedule, ESP_ERR_INVALID_STATE while a run is in progress
+    extern esp_err_t start_autotune(uint8_t motor, float min_velocity, float max_velocity, int32_t points, float amplitude,
+                                    float hysteresis, bool save);
+    extern void clear_gain_schedule(uint8_t motor);
+    extern uint32_t get_gain_schedule_report(uint8_t motor, char *dest, uint32_t size);
+
+    // Dead zone and friction calibration of the duty cycle map, ESP_ERR_INVALID_STATE while a run is in progress
+    extern esp_err_t start_friction_calibration(uint8_t motor, bool save);
+    extern void clear_friction_calibration(uint8_t motor);
+    extern uint32_t get_actuator_report(uint8_t motor, char *dest, uint32_t size);
+
+    // Safety faults latch until cleared, ESP_ERR_INVALID_STATE if none is latched. The heartbeat
+    // is called whenever the hub has been heard from.
+    extern esp_err_t clear_fault(uint8_t motor);
+    extern uint32_t get_fault_report(uint8_t motor, char *dest, uint32_t size);
+    extern void safety_heartbeat(void);
+
+    // Reference profile of the automatic modes, ESP_ERR_INVALID_STATE for a table before one is uploaded
+    extern esp_err_t set_motion_profile(uint8_t motor, int32_t profile, float velocity, float acceleration, float jerk);
+    extern esp_err_t set_motion_waveform(uint8_t motor, const float *points, uint32_t count);
 
     esp_err_t example_connect();
     uint64_t ullGetUnixTime(void);
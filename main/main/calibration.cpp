@@ -0,0 +1,89 @@
+// Includes
+#include "calibration.hpp"
+#include "recorder.hpp"
+
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+
+static constexpr char *TAG = "Calibration";
+
+void calibration_namespace(uint8_t motor, char *dest, size_t size)
+{
+  if (motor == 0)
+    snprintf(dest, size, "%s", CALIBRATION_NAMESPACE);
+  else
+    snprintf(dest, size, "%s-%u", CALIBRATION_NAMESPACE, motor);
+}
+
+static esp_err_t open_namespace(uint8_t motor, nvs_open_mode_t open_mode, nvs_handle_t *handle)
+{
+  char name[CALIBRATION_NAMESPACE_SIZE];
+
+  calibration_namespace(motor, name, sizeof(name));
+  return nvs_open(name, open_mode, handle);
+}
+
+// Every load is recorded, what was read or that nothing was, so a replay loads the same
+esp_err_t calibration_load(uint8_t motor, const char *key, void *data, size_t size)
+{
+  nvs_handle_t handle;
+  size_t stored_size = 0;
+  esp_err_t err = open_namespace(motor, NVS_READONLY, &handle);
+
+  if (err == ESP_OK)
+  {
+    err = nvs_get_blob(handle, key, nullptr, &stored_size);
+    if (err == ESP_OK && stored_size != size)
+    {
+      ESP_LOGW(TAG, "Stored %s is %u bytes, expected %u, ignoring it.", key, (unsigned)stored_size, (unsigned)size);
+      err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK)
+      err = nvs_get_blob(handle, key, data, &stored_size);
+
+    nvs_close(handle);
+  }
+
+  recorder().add_load(motor, key, err == ESP_OK ? data : nullptr, size);
+  return err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : err;
+}
+
+esp_err_t calibration_save(uint8_t motor, const char *key, const void *data, size_t size)
+{
+  nvs_handle_t handle;
+  esp_err_t err = open_namespace(motor, NVS_READWRITE, &handle);
+
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Error (%s) opening NVS.", esp_err_to_name(err));
+    return err;
+  }
+
+  err = nvs_set_blob(handle, key, data, size);
+  if (err == ESP_OK)
+    err = nvs_commit(handle);
+  if (err != ESP_OK)
+    ESP_LOGE(TAG, "Error (%s) saving %s.", esp_err_to_name(err), key);
+
+  nvs_close(handle);
+  return err;
+}
+
+esp_err_t calibration_erase(uint8_t motor, const char *key)
+{
+  nvs_handle_t handle;
+  esp_err_t err = open_namespace(motor, NVS_READWRITE, &handle);
+
+  if (err != ESP_OK)
+    return err;
+
+  err = nvs_erase_key(handle, key);
+  if (err == ESP_OK)
+    err = nvs_commit(handle);
+
+  nvs_close(handle);
+  return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+}
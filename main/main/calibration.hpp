@@ -0,0 +1,24 @@
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Per-unit calibration kept in NVS as one blob per key. A blob whose size no longer matches
+// the structure it is loaded into is treated as missing, so a layout change falls back to the
+// compiled defaults instead of loading garbage. Each motor has its own namespace, motor 0
+// keeps the one used before there were several.
+esp_err_t calibration_load(uint8_t motor, const char *key, void *data, size_t size);
+esp_err_t calibration_save(uint8_t motor, const char *key, const void *data, size_t size);
+esp_err_t calibration_erase(uint8_t motor, const char *key);
+
+static constexpr char *CALIBRATION_NAMESPACE = "dtmc-cal";
+static constexpr size_t CALIBRATION_NAMESPACE_SIZE = 16; // NVS limit, including the terminator
+
+// Namespace of a motor's calibration, for tools that write NVS images as well
+void calibration_namespace(uint8_t motor, char *dest, size_t size);
+
+#endif // CALIBRATION_H_
@@ -0,0 +1,285 @@
+// Includes
+#include "capture.hpp"
+
+#include <string.h>
+#include <chrono>
+
+#include "memory_arena.hpp"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static constexpr char *TAG = "Capture";
+
+Capture::Capture()
+{
+  samples = nullptr;
+  sample_capacity = 0;
+  sample_index = 0;
+  sample_fill = 0;
+  post_trigger = 0;
+  post_remaining = 0;
+
+  edges = nullptr;
+  edge_capacity = 0;
+  edge_index = 0;
+  edge_fill = 0;
+
+  state = CAPTURE_IDLE;
+  trigger_reason = TRIGGER_NONE;
+  trigger_time = 0;
+  trigger_timestamp = 0;
+  sequence = 0;
+
+  first_sample = 0;
+  sample_count = 0;
+  first_edge = 0;
+  edge_count = 0;
+
+  // Disabled until the current sensor is zeroed
+  overcurrent_low = 0;
+  overcurrent_high = UINT16_MAX;
+
+  complete_callback = nullptr;
+  complete_context = nullptr;
+
+  portMUX_INITIALIZE(&lock);
+}
+
+void Capture::init(uint32_t sample_capacity, uint32_t edge_capacity, uint8_t pre_trigger_percent)
+{
+  ESP_LOGI(TAG, "Reserving %lu conversion and %lu edge capture rings.",
+           (unsigned long)sample_capacity, (unsigned long)edge_capacity);
+
+  this->sample_capacity = sample_capacity;
+  this->edge_capacity = edge_capacity;
+  post_trigger = sample_capacity - (uint64_t)sample_capacity * pre_trigger_percent / 100;
+
+  samples = memory_arena(MEMORY_ARENA_CAPTURE).reserve_array<uint16_t>(sample_capacity);
+  edges = memory_arena(MEMORY_ARENA_CAPTURE).reserve_array<capture_edge>(edge_capacity);
+
+  release();
+}
+
+// Discards the frozen capture and starts recording again
+void Capture::release()
+{
+  portENTER_CRITICAL(&lock);
+  sample_index = 0;
+  sample_fill = 0;
+  edge_index = 0;
+  edge_fill = 0;
+  trigger_reason = TRIGGER_NONE;
+  state = CAPTURE_ARMED;
+  portEXIT_CRITICAL(&lock);
+}
+
+// Called with the lock held
+void Capture::start(CaptureTrigger reason)
+{
+  trigger_reason = reason;
+  trigger_time = (uint32_t)esp_timer_get_time();
+  post_remaining = post_trigger;
+  state = CAPTURE_TRIGGERED;
+}
+
+// Called with the lock held
+void Capture::freeze()
+{
+  sample_count = sample_fill;
+  first_sample = (sample_index + sample_capacity - sample_fill) % sample_capacity;
+  edge_count = edge_fill;
+  first_edge = (edge_index + edge_capacity - edge_fill) % edge_capacity;
+  sequence++;
+  state = CAPTURE_COMPLETE;
+}
+
+void Capture::add_samples(const uint16_t *raw, uint32_t count)
+{
+  bool overcurrent = false;
+  bool completed = false;
+
+  if (samples == nullptr)
+    return;
+
+  portENTER_CRITICAL(&lock);
+  for (uint32_t i = 0; i < count && (state == CAPTURE_ARMED || state == CAPTURE_TRIGGERED); i++)
+  {
+    samples[sample_index] = raw[i];
+    sample_index = (sample_index + 1) % sample_capacity;
+    if (sample_fill < sample_capacity)
+      sample_fill++;
+
+    if (state == CAPTURE_ARMED && (raw[i] < overcurrent_low || raw[i] > overcurrent_high))
+    {
+      start(TRIGGER_OVERCURRENT);
+      overcurrent = true;
+    }
+    else if (state == CAPTURE_TRIGGERED && --post_remaining == 0)
+    {
+      freeze();
+      completed = true;
+    }
+  }
+  portEXIT_CRITICAL(&lock);
+
+  // Read before completion, the clock is not read inside the critical section
+  if (overcurrent)
+  {
+    auto now = std::chrono::system_clock::now();
+    trigger_timestamp = std::chrono::time_point_cast<std::chrono::milliseconds>(now).time_since_epoch().count();
+  }
+
+  if (completed)
+  {
+    ESP_LOGI(TAG, "Captured %lu conversions and %lu edges.", (unsigned long)sample_count, (unsigned long)edge_count);
+    if (complete_callback != nullptr)
+      complete_callback(complete_context);
+  }
+}
+
+void Capture::add_edge(uint32_t time, int32_t direction)
+{
+  if (edges == nullptr)
+    return;
+
+  portENTER_CRITICAL_ISR(&lock);
+  if (state == CAPTURE_ARMED || state == CAPTURE_TRIGGERED)
+  {
+    edges[edge_index].time = time;
+    edges[edge_index].direction = direction;
+    edge_index = (edge_index + 1) % edge_capacity;
+    if (edge_fill < edge_capacity)
+      edge_fill++;
+  }
+  portEXIT_CRITICAL_ISR(&lock);
+}
+
+// Returns false if a capture is already in progress or waiting to be uploaded
+bool Capture::trigger(CaptureTrigger reason)
+{
+  bool started = false;
+
+  if (samples == nullptr)
+    return false;
+
+  auto now = std::chrono::system_clock::now();
+  uint64_t timestamp = std::chrono::time_point_cast<std::chrono::milliseconds>(now).time_since_epoch().count();
+
+  portENTER_CRITICAL(&lock);
+  if (state == CAPTURE_ARMED)
+  {
+    start(reason);
+    trigger_timestamp = timestamp;
+    started = true;
+  }
+  portEXIT_CRITICAL(&lock);
+
+  return started;
+}
+
+// Raw ADC codes outside [low, high] trigger a capture
+void Capture::set_overcurrent(uint16_t low, uint16_t high)
+{
+  portENTER_CRITICAL(&lock);
+  overcurrent_low = low;
+  overcurrent_high = high;
+  portEXIT_CRITICAL(&lock);
+}
+
+void Capture::set_complete_callback(void (*callback)(void *context), void *context)
+{
+  complete_callback = callback;
+  complete_context = context;
+}
+
+CaptureState Capture::get_state()
+{
+  return state;
+}
+
+uint32_t Capture::get_sequence()
+{
+  return sequence;
+}
+
+CaptureTrigger Capture::get_trigger()
+{
+  return trigger_reason;
+}
+
+uint32_t Capture::get_trigger_time()
+{
+  return trigger_time;
+}
+
+uint64_t Capture::get_trigger_timestamp()
+{
+  return trigger_timestamp;
+}
+
+// Position of the first post-trigger conversion in the capture
+uint32_t Capture::get_trigger_index()
+{
+  return sample_count - post_trigger;
+}
+
+uint32_t Capture::get_sample_count()
+{
+  return sample_count;
+}
+
+uint32_t Capture::get_edge_count()
+{
+  return edge_count;
+}
+
+// Conversions as little-endian u16 codes followed by the edges
+uint32_t Capture::get_length()
+{
+  return sample_count * sizeof(uint16_t) + edge_count * sizeof(capture_edge);
+}
+
+uint32_t Capture::read(uint32_t offset, uint8_t *dest, uint32_t size)
+{
+  uint32_t sample_bytes = sample_count * sizeof(uint16_t);
+  uint32_t length = get_length();
+  uint32_t copied = 0;
+
+  if (state != CAPTURE_COMPLETE)
+    return 0;
+
+  while (copied < size && offset < length)
+  {
+    const uint8_t *source;
+    uint32_t available;
+
+    // Copy up to the end of the ring or the region, whichever comes first
+    if (offset < sample_bytes)
+    {
+      uint32_t index = (first_sample + offset / sizeof(uint16_t)) % sample_capacity;
+      source = (const uint8_t *)&samples[index] + offset % sizeof(uint16_t);
+      available = (sample_capacity - index) * sizeof(uint16_t) - offset % sizeof(uint16_t);
+      if (available > sample_bytes - offset)
+        available = sample_bytes - offset;
+    }
+    else
+    {
+      uint32_t edge_offset = offset - sample_bytes;
+      uint32_t index = (first_edge + edge_offset / sizeof(capture_edge)) % edge_capacity;
+      source = (const uint8_t *)&edges[index] + edge_offset % sizeof(capture_edge);
+      available = (edge_capacity - index) * sizeof(capture_edge) - edge_offset % sizeof(capture_edge);
+      if (available > length - offset)
+        available = length - offset;
+    }
+
+    if (available > size - copied)
+      available = size - copied;
+
+    memcpy(&dest[copied], source, available);
+    copied += available;
+    offset += available;
+  }
+
+  return copied;
+}
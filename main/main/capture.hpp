@@ -0,0 +1,106 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+// Includes
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+
+// Capture triggers, in the order of their names in the capture metadata
+enum CaptureTrigger : uint8_t
+{
+  TRIGGER_NONE = 0,
+  TRIGGER_SETPOINT = 1,    // Position or velocity set point changed
+  TRIGGER_MODE = 2,        // Controller mode changed
+  TRIGGER_OVERCURRENT = 3, // ADC conversion beyond the overcurrent threshold
+  TRIGGER_REQUEST = 4,     // start_capture direct method
+};
+
+enum CaptureState : uint8_t
+{
+  CAPTURE_IDLE = 0,      // Not recording
+  CAPTURE_ARMED = 1,     // Recording into the rings, waiting for a trigger
+  CAPTURE_TRIGGERED = 2, // Recording the post-trigger part
+  CAPTURE_COMPLETE = 3,  // Frozen until uploaded and released
+};
+
+// Encoder watch point, every VELOCITY_SAMPLE_SIZE counts
+typedef struct
+{
+  uint32_t time;     // esp_timer time in us, low 32 bits
+  int32_t direction; // 1 clockwise, -1 counter-clockwise
+} capture_edge;
+
+// Pre/post-trigger ring buffers of raw ADC conversions at the native rate and encoder edges.
+// The ADC task and encoder ISR only append to the rings, a completed capture is frozen and
+// read out in chunks by the network task, then released to re-arm.
+class Capture
+{
+private:
+  // Class variables
+  uint16_t *samples;
+  uint32_t sample_capacity;
+  uint32_t sample_index; // Next conversion to write
+  uint32_t sample_fill;  // Conversions held, up to sample_capacity
+  uint32_t post_trigger;
+  uint32_t post_remaining;
+
+  capture_edge *edges;
+  uint32_t edge_capacity;
+  uint32_t edge_index;
+  uint32_t edge_fill;
+
+  volatile CaptureState state;
+  CaptureTrigger trigger_reason;
+  uint32_t trigger_time;      // esp_timer time in us, low 32 bits
+  uint64_t trigger_timestamp; // Unix time in ms
+  uint32_t sequence;          // Completed captures since boot
+
+  // Frozen window, set on completion
+  uint32_t first_sample;
+  uint32_t sample_count;
+  uint32_t first_edge;
+  uint32_t edge_count;
+
+  uint16_t overcurrent_low;
+  uint16_t overcurrent_high;
+
+  void (*complete_callback)(void *context);
+  void *complete_context;
+
+  portMUX_TYPE lock;
+
+  void start(CaptureTrigger reason);
+  void freeze();
+
+public:
+  Capture();
+
+  void init(uint32_t sample_capacity, uint32_t edge_capacity, uint8_t pre_trigger_percent);
+  void release();
+
+  // Called from the ADC task and encoder ISR
+  void add_samples(const uint16_t *raw, uint32_t count);
+  void add_edge(uint32_t time, int32_t direction);
+
+  bool trigger(CaptureTrigger reason);
+  void set_overcurrent(uint16_t low, uint16_t high);
+  void set_complete_callback(void (*callback)(void *context), void *context);
+
+  // Valid once complete, until released
+  CaptureState get_state();
+  uint32_t get_sequence();
+  CaptureTrigger get_trigger();
+  uint32_t get_trigger_time();
+  uint64_t get_trigger_timestamp();
+  uint32_t get_trigger_index();
+  uint32_t get_sample_count();
+  uint32_t get_edge_count();
+  uint32_t get_length();
+  uint32_t read(uint32_t offset, uint8_t *dest, uint32_t size);
+};
+
+#endif // CAPTURE_H_
@@ -3,15 +3,19 @@
 
 static constexpr char *TAG = "Communication";
 
-static Communication *comm_obj;
+bool Communication::initialised = false;
 
 Communication::Communication()
 {
-  comm_obj = this;
 }
 
+// Every motor and the recorder stream over the same UART, the first to start sets it up
 void Communication::init()
 {
+  if (initialised)
+    return;
+  initialised = true;
+
   ESP_LOGI(TAG, "Setting up UART.");
   uart_config_t uart_config = {
       .baud_rate = UART_BAUD_RATE,
@@ -17,6 +17,9 @@
 class Communication
 {
 private:
+  // Class variables
+  static bool initialised; // Every instance sends on the same UART
+
   // UART properties
   static constexpr uint32_t UART_BAUD_RATE = 921600;
   static constexpr uint16_t BUFFER_SIZE = 1024;
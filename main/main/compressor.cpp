@@ -0,0 +1,185 @@
+// Includes
+#include "compressor.hpp"
+
+#include <string.h>
+
+StreamCompressor::StreamCompressor()
+{
+  buffer = nullptr;
+  start = 0;
+  fill = 0;
+
+  bits = 0;
+  bit_count = 0;
+  output_length = 0;
+
+  sink = nullptr;
+  context = nullptr;
+  failed = false;
+
+  input_total = 0;
+  output_total = 0;
+}
+
+void StreamCompressor::init(uint8_t *buffer)
+{
+  this->buffer = buffer;
+}
+
+void StreamCompressor::begin(Sink sink, void *context)
+{
+  this->sink = sink;
+  this->context = context;
+
+  start = 0;
+  fill = 0;
+  bits = 0;
+  bit_count = 0;
+  output_length = 0;
+  failed = false;
+
+  input_total = 0;
+  output_total = 0;
+}
+
+bool StreamCompressor::write(const void *data, uint32_t length)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+  while (length > 0 && !failed)
+  {
+    if (fill == BUFFER_SIZE)
+      slide();
+
+    uint32_t count = BUFFER_SIZE - fill;
+    if (count > length)
+      count = length;
+
+    memcpy(&buffer[fill], bytes, count);
+    fill += count;
+    bytes += count;
+    length -= count;
+    input_total += count;
+
+    // Hold back a full lookahead so matches are not cut short at write boundaries
+    while (fill - start >= LOOKAHEAD_SIZE && !failed)
+      encode_next();
+  }
+
+  return !failed;
+}
+
+bool StreamCompressor::finish()
+{
+  while (start < fill && !failed)
+    encode_next();
+
+  // Zero padding is shorter than any token, decoders stop on it
+  if (bit_count > 0)
+    push_byte(bits << (8 - bit_count));
+  bits = 0;
+  bit_count = 0;
+
+  if (output_length > 0)
+    flush();
+
+  return !failed;
+}
+
+uint32_t StreamCompressor::get_input_length()
+{
+  return input_total;
+}
+
+uint32_t StreamCompressor::get_output_length()
+{
+  return output_total;
+}
+
+// Drops history older than one window to make room for more input
+void StreamCompressor::slide()
+{
+  uint32_t discard = start - WINDOW_SIZE;
+
+  memmove(buffer, &buffer[discard], fill - discard);
+  start -= discard;
+  fill -= discard;
+}
+
+void StreamCompressor::encode_next()
+{
+  const uint8_t *current = &buffer[start];
+  uint32_t max_length = fill - start;
+  uint32_t history = start < WINDOW_SIZE ? start : WINDOW_SIZE;
+  uint32_t best_length = 0;
+  uint32_t best_distance = 0;
+
+  if (max_length > LOOKAHEAD_SIZE)
+    max_length = LOOKAHEAD_SIZE;
+
+  // Nearest match first, a match may run into the bytes it reproduces
+  for (uint32_t distance = 1; distance <= history && best_length < max_length; distance++)
+  {
+    const uint8_t *candidate = current - distance;
+    if (candidate[0] != current[0] || candidate[best_length] != current[best_length])
+      continue;
+
+    uint32_t length = 1;
+    while (length < max_length && candidate[length] == current[length])
+      length++;
+
+    if (length > best_length)
+    {
+      best_length = length;
+      best_distance = distance;
+    }
+  }
+
+  if (best_length * LITERAL_BITS > REFERENCE_BITS)
+  {
+    push_bits(1, 0);
+    push_bits(WINDOW_BITS, best_distance - 1);
+    push_bits(LOOKAHEAD_BITS, best_length - 1);
+    start += best_length;
+  }
+  else
+  {
+    push_bits(1, 1);
+    push_bits(8, current[0]);
+    start++;
+  }
+}
+
+// Most significant bit first, as heatshrink reads them
+void StreamCompressor::push_bits(uint8_t count, uint32_t value)
+{
+  while (count > 0)
+  {
+    count--;
+    bits = (bits << 1) | ((value >> count) & 1);
+    bit_count++;
+
+    if (bit_count == 8)
+    {
+      push_byte(bits);
+      bits = 0;
+      bit_count = 0;
+    }
+  }
+}
+
+void StreamCompressor::push_byte(uint8_t value)
+{
+  output[output_length++] = value;
+  output_total++;
+
+  if (output_length == OUTPUT_SIZE)
+    flush();
+}
+
+void StreamCompressor::flush()
+{
+  if (!failed && !sink(context, output, output_length))
+    failed = true;
+  output_length = 0;
+}
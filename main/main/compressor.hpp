@@ -0,0 +1,72 @@
+#ifndef COMPRESSOR_H_
+#define COMPRESSOR_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming LZSS compressor writing the heatshrink bit format, so output decodes with any
+// heatshrink decoder of the same window and lookahead, or python_scripts/telemetry_codec.py.
+// Literals are a 1 bit then the byte, back-references a 0 bit, distance - 1 and length - 1.
+// RAM is fixed: BUFFER_SIZE bytes of history and pending input supplied by the caller.
+class StreamCompressor
+{
+public:
+  // Receives compressed bytes, returns false to abort the stream
+  typedef bool (*Sink)(void *context, const uint8_t *data, uint32_t length);
+
+  static constexpr uint8_t WINDOW_BITS = 8;
+  static constexpr uint8_t LOOKAHEAD_BITS = 4;
+  static constexpr uint32_t WINDOW_SIZE = 1 << WINDOW_BITS;
+  static constexpr uint32_t LOOKAHEAD_SIZE = 1 << LOOKAHEAD_BITS;
+  static constexpr uint32_t BUFFER_SIZE = 2 * WINDOW_SIZE;
+
+  // Worst-case output for a stream of length bytes, every byte sent as a 9 bit literal
+  static constexpr uint32_t bound(uint32_t length)
+  {
+    return length + (length + 7) / 8 + 1;
+  }
+
+private:
+  // Class variables
+  uint8_t *buffer;
+  uint32_t start; // Next byte to encode
+  uint32_t fill;  // Bytes of history and pending input held in the buffer
+
+  uint8_t bits;
+  uint8_t bit_count;
+
+  static constexpr uint8_t OUTPUT_SIZE = 64;
+  uint8_t output[OUTPUT_SIZE];
+  uint8_t output_length;
+
+  Sink sink;
+  void *context;
+  bool failed;
+
+  uint32_t input_total;
+  uint32_t output_total;
+
+  // A back-reference must cost fewer bits than the literals it replaces
+  static constexpr uint32_t LITERAL_BITS = 1 + 8;
+  static constexpr uint32_t REFERENCE_BITS = 1 + WINDOW_BITS + LOOKAHEAD_BITS;
+
+  void slide();
+  void encode_next();
+  void push_bits(uint8_t count, uint32_t value);
+  void push_byte(uint8_t value);
+  void flush();
+
+public:
+  StreamCompressor();
+
+  void init(uint8_t *buffer);
+  void begin(Sink sink, void *context);
+  bool write(const void *data, uint32_t length);
+  bool finish();
+
+  uint32_t get_input_length();
+  uint32_t get_output_length();
+};
+
+#endif // COMPRESSOR_H_
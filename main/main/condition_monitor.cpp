@@ -0,0 +1,426 @@
+// Includes
+#include "condition_monitor.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <chrono>
+
+#include "configuration.hpp"
+#include "memory_arena.hpp"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static constexpr char *TAG = "Condition";
+
+// Monitors run by the shared spectrum task, in the order they were attached
+static ConditionMonitor *monitors[MAX_MOTORS];
+static uint8_t monitor_count = 0;
+static TaskHandle_t spectrum_task_hdl = NULL;
+
+ConditionMonitor::ConditionMonitor()
+{
+  index = 0;
+  reduction_ratio = 1;
+  collecting = false;
+  overrun = false;
+  rate_changed = false;
+
+  memset(&current_hops, 0, sizeof(current_hops));
+  memset(&velocity_hops, 0, sizeof(velocity_hops));
+
+  current_rate = CURRENT_RATE;
+  decimation = 1;
+  decimation_fill = 0;
+  decimation_sum = 0;
+  raw_count = 0;
+  raw_sum = 0;
+  raw_sum_squares = 0;
+  raw_min = UINT16_MAX;
+  raw_max = 0;
+
+  offset_mv = 0;
+  mv_per_code = 0;
+  zero_mv = 0;
+  ma_per_mv = 0;
+
+  velocity_rate = 1;
+  velocity_fill = 0;
+  velocity_sum = 0;
+  speed_sum = 0;
+  speed_count = 0;
+
+  window_start = 0;
+  busy_us = 0;
+  rest_until = 0;
+  overruns = 0;
+
+  memset(&features, 0, sizeof(features));
+  has_features = false;
+  features_callback = nullptr;
+
+  portMUX_INITIALIZE(&lock);
+}
+
+// update_rate is how often add_velocity() is called, in Hz
+void ConditionMonitor::init(uint8_t index, float update_rate, float reduction_ratio)
+{
+  static_assert(HOP_COUNT >= 2, "The hop being written is never ready, so at least two are needed");
+
+  this->index = index;
+  velocity_rate = update_rate / VELOCITY_DECIMATION;
+  this->reduction_ratio = reduction_ratio;
+
+  for (uint8_t i = 0; i < HOP_COUNT; i++)
+  {
+    current_hops.hops[i] = memory_arena(MEMORY_ARENA_SPECTRUM).reserve_array<float>(WelchEstimator::HOP_SIZE);
+    velocity_hops.hops[i] = memory_arena(MEMORY_ARENA_SPECTRUM).reserve_array<float>(WelchEstimator::HOP_SIZE);
+  }
+
+  current_psd.init();
+  velocity_psd.init();
+}
+
+void ConditionMonitor::attach()
+{
+  ESP_LOGI(TAG, "Adding motor %u to the spectrum task.", index);
+  configASSERT(monitor_count < MAX_MOTORS);
+
+  start();
+  if (spectrum_task_hdl == NULL)
+  {
+    monitors[monitor_count++] = this;
+    xTaskCreatePinnedToCore(spectrum_task, "Spectrum Task", spectrum_config.stack_size, nullptr, spectrum_config.priority, &spectrum_task_hdl, spectrum_config.core);
+  }
+  else
+  {
+    vTaskSuspend(spectrum_task_hdl);
+    monitors[monitor_count++] = this;
+    vTaskResume(spectrum_task_hdl);
+  }
+}
+
+// Discards the window in progress and collects a new one
+void ConditionMonitor::start()
+{
+  collecting = false;
+  rate_changed = false;
+  current_psd.reset(current_rate);
+  velocity_psd.reset(velocity_rate);
+  speed_sum = 0;
+  speed_count = 0;
+  window_start = esp_timer_get_time();
+  busy_us = 0;
+  rest_until = 0;
+
+  portENTER_CRITICAL(&lock);
+  current_hops.fill = 0;
+  current_hops.write = 0;
+  current_hops.read = 0;
+  current_hops.ready = 0;
+  velocity_hops.fill = 0;
+  velocity_hops.write = 0;
+  velocity_hops.read = 0;
+  velocity_hops.ready = 0;
+
+  decimation_fill = 0;
+  decimation_sum = 0;
+  velocity_fill = 0;
+  velocity_sum = 0;
+  raw_count = 0;
+  raw_sum = 0;
+  raw_sum_squares = 0;
+  raw_min = UINT16_MAX;
+  raw_max = 0;
+
+  overrun = false;
+  collecting = true;
+  portEXIT_CRITICAL(&lock);
+}
+
+// Each motor takes its share of the conversions, averaged in blocks down to about CURRENT_RATE.
+// A window in progress restarts, its conversions were taken at the old rate.
+void ConditionMonitor::set_current_rate(uint32_t sample_rate)
+{
+  uint16_t factor = sample_rate / CURRENT_RATE;
+
+  if (factor == 0)
+    factor = 1;
+
+  portENTER_CRITICAL(&lock);
+  decimation = factor;
+  current_rate = (float)sample_rate / factor;
+  rate_changed = true;
+  collecting = false;
+  portEXIT_CRITICAL(&lock);
+}
+
+void ConditionMonitor::set_current_scale(float offset_mv, float mv_per_code, float zero_mv, float ma_per_mv)
+{
+  portENTER_CRITICAL(&lock);
+  this->offset_mv = offset_mv;
+  this->mv_per_code = mv_per_code;
+  this->zero_mv = zero_mv;
+  this->ma_per_mv = ma_per_mv;
+  portEXIT_CRITICAL(&lock);
+}
+
+// Called with the lock held. A full ring stops the window, which the spectrum task restarts.
+bool ConditionMonitor::push(hop_ring &ring, float value)
+{
+  ring.hops[ring.write][ring.fill++] = value;
+  if (ring.fill < WelchEstimator::HOP_SIZE)
+    return true;
+
+  ring.fill = 0;
+  if (ring.ready >= HOP_COUNT - 1)
+  {
+    overrun = true;
+    collecting = false;
+    return false;
+  }
+
+  ring.write = (ring.write + 1) % HOP_COUNT;
+  ring.ready = ring.ready + 1;
+  return true;
+}
+
+void ConditionMonitor::add_current(const uint16_t *raw, uint32_t count)
+{
+  if (!collecting)
+    return;
+
+  portENTER_CRITICAL(&lock);
+  for (uint32_t i = 0; i < count && collecting; i++)
+  {
+    uint16_t code = raw[i];
+
+    raw_count++;
+    raw_sum += code;
+    raw_sum_squares += (uint32_t)code * code;
+    raw_min = code < raw_min ? code : raw_min;
+    raw_max = code > raw_max ? code : raw_max;
+
+    decimation_sum += code;
+    if (++decimation_fill < decimation)
+      continue;
+
+    float mean_code = (float)decimation_sum / decimation;
+    push(current_hops, (offset_mv + mean_code * mv_per_code - zero_mv) * ma_per_mv);
+    decimation_fill = 0;
+    decimation_sum = 0;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void ConditionMonitor::add_velocity(float velocity)
+{
+  if (!collecting)
+    return;
+
+  portENTER_CRITICAL(&lock);
+  velocity_sum += velocity;
+  if (collecting && ++velocity_fill >= VELOCITY_DECIMATION)
+  {
+    push(velocity_hops, velocity_sum / VELOCITY_DECIMATION);
+    velocity_fill = 0;
+    velocity_sum = 0;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+// Feeds the ready hops to the estimator, returns false if the window was stopped
+bool ConditionMonitor::drain(hop_ring &ring, WelchEstimator &psd, bool velocity)
+{
+  while (ring.ready > 0)
+  {
+    const float *hop = ring.hops[ring.read];
+
+    psd.add_hop(hop);
+    if (velocity)
+    {
+      for (uint16_t i = 0; i < WelchEstimator::HOP_SIZE; i++)
+        speed_sum += fabsf(hop[i]);
+      speed_count += WelchEstimator::HOP_SIZE;
+    }
+
+    ring.read = (ring.read + 1) % HOP_COUNT;
+    portENTER_CRITICAL(&lock);
+    ring.ready = ring.ready - 1;
+    portEXIT_CRITICAL(&lock);
+  }
+
+  return !overrun;
+}
+
+bool ConditionMonitor::process()
+{
+  uint64_t start_time = esp_timer_get_time();
+
+  if (rest_until != 0)
+  {
+    if (start_time >= rest_until)
+      start();
+    return false;
+  }
+
+  if (rate_changed)
+  {
+    start();
+    return false;
+  }
+
+  if (overrun)
+  {
+    overruns++;
+    ESP_LOGW(TAG, "Motor %u spectrum window restarted, %lu so far.", index, (unsigned long)overruns);
+    start();
+    return false;
+  }
+
+  drain(current_hops, current_psd, false);
+  drain(velocity_hops, velocity_psd, true);
+  if (current_psd.get_segments() < WINDOW_SEGMENTS || velocity_psd.get_segments() < WINDOW_SEGMENTS)
+  {
+    busy_us += esp_timer_get_time() - start_time;
+    return false;
+  }
+
+  collecting = false;
+  current_psd.complete();
+  velocity_psd.complete();
+  extract();
+
+  // Rest out the period, or longer if the window took more than its share of core 0
+  uint64_t end_time = esp_timer_get_time();
+  uint64_t elapsed_us = end_time - window_start;
+  uint64_t cycle_us = (uint64_t)CONFIG_DTMC_SPECTRUM_PERIOD_S * 1000000;
+
+  busy_us += end_time - start_time;
+  if (busy_us * 100 / CONFIG_DTMC_SPECTRUM_CPU_PERCENT > cycle_us)
+    cycle_us = busy_us * 100 / CONFIG_DTMC_SPECTRUM_CPU_PERCENT;
+
+  portENTER_CRITICAL(&lock);
+  features.load = 100.0f * busy_us / (cycle_us > elapsed_us ? cycle_us : elapsed_us);
+  portEXIT_CRITICAL(&lock);
+
+  rest_until = window_start + (cycle_us > elapsed_us ? cycle_us : elapsed_us);
+
+  return true;
+}
+
+// Features of the completed window, everything but the load
+void ConditionMonitor::extract()
+{
+  condition_features result;
+  float speed = speed_count > 0 ? speed_sum / speed_count : 0;
+  float motor_hz = speed * reduction_ratio / 60;
+  bool turning = speed >= MIN_SPEED;
+
+  memset(&result, 0, sizeof(result));
+  auto now = std::chrono::system_clock::now();
+  result.time = std::chrono::time_point_cast<std::chrono::milliseconds>(now).time_since_epoch().count();
+  result.window = (float)(velocity_psd.get_segments() + 1) * WelchEstimator::HOP_SIZE / velocity_rate;
+  result.speed = speed;
+
+  // RMS and peak of the raw conversions, E[(a c + b)^2] from the sums of c and c^2
+  if (raw_count > 0)
+  {
+    float a = mv_per_code * ma_per_mv;
+    float b = (offset_mv - zero_mv) * ma_per_mv;
+    double mean = (double)raw_sum / raw_count;
+    double mean_squares = (double)raw_sum_squares / raw_count;
+    double power = a * a * mean_squares + 2 * a * b * mean + b * b;
+    float peak = fmaxf(fabsf(a * raw_min + b), fabsf(a * raw_max + b));
+
+    result.current_rms = sqrt(power > 0 ? power : 0);
+    result.crest = result.current_rms >= MIN_CREST_CURRENT ? peak / result.current_rms : 0;
+  }
+
+  float current_nyquist = current_psd.get_sample_rate() / 2;
+  result.current_ac = current_psd.band_rms(current_psd.get_resolution(), current_nyquist);
+
+  if (turning)
+  {
+    float expected = motor_hz * CONFIG_DTMC_SPECTRUM_RIPPLES_PER_REV;
+
+    result.ripple_frequency = current_psd.find_peak(expected * (1 - RIPPLE_SEARCH), expected * (1 + RIPPLE_SEARCH));
+    result.ripple = current_psd.tone_rms(result.ripple_frequency);
+    result.mesh_frequency = motor_hz * CONFIG_DTMC_SPECTRUM_MESH_TEETH;
+    for (uint8_t i = 0; i < MESH_HARMONICS; i++)
+      result.mesh[i] = current_psd.tone_rms(result.mesh_frequency * (i + 1));
+
+    result.shaft_runout = velocity_psd.tone_rms(speed / 60);
+    result.motor_runout = velocity_psd.tone_rms(motor_hz);
+  }
+
+  result.velocity_ac = velocity_psd.band_rms(velocity_psd.get_resolution(), velocity_psd.get_sample_rate() / 2);
+  result.overruns = overruns;
+
+  portENTER_CRITICAL(&lock);
+  features = result;
+  has_features = true;
+  portEXIT_CRITICAL(&lock);
+}
+
+void ConditionMonitor::spectrum_task(void *arg)
+{
+  while (1)
+  {
+    for (uint8_t i = 0; i < monitor_count; i++)
+    {
+      ConditionMonitor *monitor = monitors[i];
+
+      if (monitor->process() && monitor->features_callback != nullptr)
+        monitor->features_callback(monitor->index);
+    }
+
+    vTaskDelay(spectrum_config.delay / portTICK_PERIOD_MS);
+  }
+}
+
+// Returns false before the first window completes
+bool ConditionMonitor::get_features(condition_features *features)
+{
+  portENTER_CRITICAL(&lock);
+  bool available = has_features;
+  *features = this->features;
+  portEXIT_CRITICAL(&lock);
+
+  return available;
+}
+
+// Formats the latest features as JSON, returns 0 if there are none or they do not fit
+uint32_t ConditionMonitor::get_features_string(char *dest, uint32_t size)
+{
+  condition_features result;
+  int length;
+
+  if (!get_features(&result))
+    return 0;
+
+  length = snprintf(dest, size,
+                    "{\"spectrum\":{\"time\":%llu,\"window\":%.2f,\"speed\":%.2f,"
+                    "\"current\":{\"rms\":%.1f,\"ac\":%.2f,\"crest\":%.2f,\"ripple_hz\":%.1f,\"ripple\":%.2f,"
+                    "\"mesh_hz\":%.1f,\"mesh\":[%.2f,%.2f,%.2f]},"
+                    "\"velocity\":{\"ac\":%.3f,\"shaft\":%.3f,\"motor\":%.3f},"
+                    "\"load\":%.2f,\"overruns\":%lu}}",
+                    (unsigned long long)result.time, result.window, result.speed,
+                    result.current_rms, result.current_ac, result.crest, result.ripple_frequency, result.ripple,
+                    result.mesh_frequency, result.mesh[0], result.mesh[1], result.mesh[2],
+                    result.velocity_ac, result.shaft_runout, result.motor_runout,
+                    result.load, (unsigned long)result.overruns);
+
+  if (length < 0 || (uint32_t)length >= size)
+  {
+    ESP_LOGW(TAG, "Spectrum report exceeds %lu bytes.", (unsigned long)size);
+    return 0;
+  }
+
+  return length;
+}
+
+void ConditionMonitor::set_features_callback(void (*callback)(uint8_t motor))
+{
+  features_callback = callback;
+}
@@ -0,0 +1,146 @@
+#ifndef CONDITION_MONITOR_H_
+#define CONDITION_MONITOR_H_
+
+// Includes
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "spectrum.hpp"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Condition of one motor over an analysis window, from the spectra of its current and velocity
+typedef struct
+{
+  uint64_t time;    // Unix time in ms at the end of the window
+  float window;     // s of signal analysed
+  float speed;      // Mean output speed in RPM, the motor shaft turns REDUCTION_RATIO times faster
+
+  float current_rms;      // mA, of the raw conversions
+  float current_ac;       // mA RMS above DC, from the spectrum
+  float crest;            // Peak over RMS of the raw conversions, 0 near standstill
+  float ripple_frequency; // Hz, commutation ripple found near its expected frequency, 0 at standstill
+  float ripple;           // mA RMS of the commutation ripple
+  float mesh_frequency;   // Hz, first stage gear mesh
+  float mesh[3];          // mA RMS of the first three mesh harmonics, 0 beyond the spectrum
+
+  float velocity_ac;   // RPM RMS above DC
+  float shaft_runout;  // RPM RMS at the output shaft's rotation
+  float motor_runout;  // RPM RMS at the motor shaft's rotation, 0 beyond the spectrum
+
+  float load;        // Percent of core 0 the analysis took over the window and the rest after it
+  uint32_t overruns; // Windows restarted because the spectrum task fell behind
+} condition_features;
+
+// Background spectral analysis of one motor for condition monitoring. The ADC task hands over
+// every conversion of the motor's channel, averaged down to CURRENT_RATE, and the update task
+// its unfiltered velocity each period, averaged in pairs. Both fill hops of half a Welch segment, which the shared
+// spectrum task on core 0 takes as they fill. Once both spectra hold WINDOW_SEGMENTS segments
+// the features are extracted, the callback is told and collection rests for long enough to keep
+// the window period at CONFIG_DTMC_SPECTRUM_PERIOD_S and the task's time on core 0 within
+// CONFIG_DTMC_SPECTRUM_CPU_PERCENT. Only the features leave the station, never the raw signal.
+class ConditionMonitor
+{
+public:
+  static constexpr float CURRENT_RATE = 5000;      // Hz after decimation, ripple and mesh lie well below
+  static constexpr uint8_t VELOCITY_DECIMATION = 2; // Update periods averaged per velocity sample, for finer bins near the shaft rate
+  static constexpr uint8_t HOP_COUNT = 4;          // Hops of each signal waiting for the spectrum task
+  static constexpr uint16_t WINDOW_SEGMENTS = 16;  // Welch segments of each spectrum per window
+  static constexpr uint8_t MESH_HARMONICS = 3;
+  static constexpr float RIPPLE_SEARCH = 0.2;      // Ripple is looked for within this fraction of its expected frequency
+  static constexpr float MIN_SPEED = 2;            // RPM below which the motor is at standstill
+  static constexpr float MIN_CREST_CURRENT = 10;   // mA RMS below which the crest factor is not reported
+
+private:
+  // Hops of one signal, written by one task and read by the spectrum task. The hop being
+  // written is never one of those ready.
+  typedef struct
+  {
+    float *hops[HOP_COUNT];
+    uint16_t fill;
+    uint8_t write;
+    uint8_t read;
+    volatile uint8_t ready;
+  } hop_ring;
+
+  // Class variables
+  uint8_t index;
+  float reduction_ratio;
+  volatile bool collecting;
+  volatile bool overrun;
+  volatile bool rate_changed;
+
+  hop_ring current_hops;
+  hop_ring velocity_hops;
+
+  // Decimation and raw statistics, kept by the ADC task while collecting
+  float current_rate;
+  uint16_t decimation;
+  uint16_t decimation_fill;
+  uint32_t decimation_sum;
+  uint32_t raw_count;
+  uint64_t raw_sum;
+  uint64_t raw_sum_squares;
+  uint16_t raw_min;
+  uint16_t raw_max;
+
+  // Linear fit of the sensor's calibration, code to mA about its zero
+  float offset_mv;
+  float mv_per_code;
+  float zero_mv;
+  float ma_per_mv;
+
+  float velocity_rate; // Hz after decimation
+  uint8_t velocity_fill;
+  float velocity_sum;
+  double speed_sum;
+  uint32_t speed_count;
+
+  WelchEstimator current_psd;
+  WelchEstimator velocity_psd;
+
+  // Spectrum task state
+  uint64_t window_start; // esp_timer time collection started
+  uint64_t busy_us;      // Spent in process() this window
+  uint64_t rest_until;   // esp_timer time collection resumes, 0 while collecting
+  uint32_t overruns;
+
+  condition_features features; // Latest window, guarded by lock
+  bool has_features;
+  void (*features_callback)(uint8_t motor);
+
+  portMUX_TYPE lock;
+
+  static void spectrum_task(void *arg);
+
+  bool push(hop_ring &ring, float value);
+  bool drain(hop_ring &ring, WelchEstimator &psd, bool velocity);
+  void extract();
+
+public:
+  ConditionMonitor();
+
+  void init(uint8_t index, float update_rate, float reduction_ratio);
+  // Adds the monitor to the spectrum task, starting it with the first
+  void attach();
+  void start();
+
+  // Called by the current sensor when the pattern changes and when its channel is zeroed
+  void set_current_rate(uint32_t sample_rate);
+  void set_current_scale(float offset_mv, float mv_per_code, float zero_mv, float ma_per_mv);
+
+  // Called from the ADC and update tasks
+  void add_current(const uint16_t *raw, uint32_t count);
+  void add_velocity(float velocity);
+
+  // Called from the spectrum task, returns true when a window completed and its features are ready
+  bool process();
+
+  bool get_features(condition_features *features);
+  uint32_t get_features_string(char *dest, uint32_t size);
+  void set_features_callback(void (*callback)(uint8_t motor));
+};
+
+#endif // CONDITION_MONITOR_H_
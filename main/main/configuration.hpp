@@ -2,10 +2,13 @@
 #define CONFIGURATION_H_
 
 // Includes
+#include "sdkconfig.h"
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "driver/gpio.h"
+#include "hal/adc_types.h"
 
 typedef struct
 {
@@ -15,21 +18,53 @@ typedef struct
     const BaseType_t core = 0;                   // Core which task runs on (0 or 1)
 } task_config;
 
+// Pins and peripherals of one motor. The drivers allocate a free PCNT unit and MCPWM
+// timer and operator in the group for each controller, the ADC1 channels share one
+// continuous conversion pattern.
+typedef struct
+{
+  gpio_num_t ena;            // MCPWM output (Connected to ENA)
+  gpio_num_t in1;            // GPIO output (Connected to IN1)
+  gpio_num_t in2;            // GPIO output (Connected to IN2)
+  gpio_num_t encoder_a;      // GPIO input (Connected to Encoder A) GREEN
+  gpio_num_t encoder_b;      // GPIO input (Connected to Encoder B) YELLOW
+  gpio_num_t adc;            // ADC input (Connected to the current sensor)
+  adc_channel_t adc_channel; // ADC1 channel of the adc pin
+  int mcpwm_group;           // Three timers and operators per group
+} motor_config;
+
 // Pin configurations
-// Motor driver pins
-static constexpr gpio_num_t GPIO_ENA = GPIO_NUM_1;  // MCPWM output (Connected to ENA)
-static constexpr gpio_num_t GPIO_IN1 = GPIO_NUM_2;  // GPIO output (Connected to IN1)
-static constexpr gpio_num_t GPIO_IN2 = GPIO_NUM_42; // GPIO output (Connected to IN2)
-static constexpr gpio_num_t GPIO_C1 = GPIO_NUM_41;  // GPIO output (Connected to Encoder A) GREEN
-static constexpr gpio_num_t GPIO_C2 = GPIO_NUM_40;  // GPIO output (Connected to Encoder B) YELLOW
+static constexpr uint8_t MAX_MOTORS = 2;
+static constexpr uint8_t MOTOR_COUNT = CONFIG_DTMC_MOTOR_COUNT;
+static_assert(MOTOR_COUNT >= 1 && MOTOR_COUNT <= MAX_MOTORS, "CONFIG_DTMC_MOTOR_COUNT exceeds MOTOR_CONFIGS");
+
+static constexpr motor_config MOTOR_CONFIGS[MAX_MOTORS] = {
+    {
+        .ena = GPIO_NUM_1,
+        .in1 = GPIO_NUM_2,
+        .in2 = GPIO_NUM_42,
+        .encoder_a = GPIO_NUM_41,
+        .encoder_b = GPIO_NUM_40,
+        .adc = GPIO_NUM_4,
+        .adc_channel = ADC_CHANNEL_3,
+        .mcpwm_group = 0,
+    },
+    {
+        .ena = GPIO_NUM_5,
+        .in1 = GPIO_NUM_6,
+        .in2 = GPIO_NUM_7,
+        .encoder_a = GPIO_NUM_15,
+        .encoder_b = GPIO_NUM_16,
+        .adc = GPIO_NUM_8,
+        .adc_channel = ADC_CHANNEL_7,
+        .mcpwm_group = 1,
+    },
+};
 
 // UART pins
 static constexpr gpio_num_t GPIO_TX = GPIO_NUM_43;
 static constexpr gpio_num_t GPIO_RX = GPIO_NUM_44;
 
-// ADC pins
-static constexpr gpio_num_t GPIO_ADC = GPIO_NUM_4;
-
 // Communication protocols and commands
 static constexpr uint16_t FRAME_START = 0x1;
 static constexpr uint16_t FRAME_END = 0x3;
@@ -40,6 +75,28 @@ static constexpr uint16_t COMMAND_POSITION = 0x13;
 
 static constexpr uint16_t COMMAND_VELOCITY = 0x21;
 
+// Sample frame configurations
+static constexpr uint16_t SAMPLE_VECTOR_SIZE = 500; // Samples per telemetry frame
+static constexpr uint8_t SAMPLE_BUFFER_COUNT = 2;   // Sample columns are double-buffered
+static constexpr uint16_t LIVE_RING_SIZE = 256;     // Live telemetry samples held per motor, a power of two
+
+// Worst-case characters per sample for each column, including the separator
+static constexpr uint32_t TIMESTAMP_FIELD_SIZE = 14;  // 1712345678901,
+static constexpr uint32_t GAIN_FIELD_SIZE = 8;        // -10.000,
+static constexpr uint32_t DUTY_CYCLE_FIELD_SIZE = 7;  // -1.000,
+static constexpr uint32_t VELOCITY_FIELD_SIZE = 10;   // -1234.567,
+static constexpr uint32_t POSITION_FIELD_SIZE = 9;    // -359.999,
+static constexpr uint32_t CURRENT_FIELD_SIZE = 10;    // -1234.567,
+static constexpr uint32_t SAMPLE_STRING_OVERHEAD = 84; // Keys, brackets, newline and terminator
+
+static constexpr uint32_t SAMPLE_STRING_SIZE = SAMPLE_VECTOR_SIZE * (TIMESTAMP_FIELD_SIZE +
+                                                                     GAIN_FIELD_SIZE +
+                                                                     DUTY_CYCLE_FIELD_SIZE +
+                                                                     VELOCITY_FIELD_SIZE +
+                                                                     POSITION_FIELD_SIZE +
+                                                                     CURRENT_FIELD_SIZE) +
+                                               SAMPLE_STRING_OVERHEAD;
+
 // FreeRTOS task configurations
 constexpr task_config update_config = {
     .delay = 1,
@@ -76,6 +133,36 @@ constexpr task_config tx_config = {
     .core = 1,
 };
 
+constexpr task_config startup_config = {
+    .delay = 0,
+    .stack_size = 1024 * 4,
+    .priority = tskIDLE_PRIORITY + 3,
+    .core = 0,
+};
+
+constexpr task_config recorder_config = {
+    .delay = 10,
+    .stack_size = 1024 * 3,
+    .priority = tskIDLE_PRIORITY + 1,
+    .core = 0,
+};
+
+constexpr task_config spectrum_config = {
+    .delay = 20,
+    .stack_size = 1024 * 3,
+    .priority = tskIDLE_PRIORITY + 1,
+    .core = 0,
+};
+
+#ifdef CONFIG_DTMC_LIVE
+constexpr task_config live_config = {
+    .delay = CONFIG_DTMC_LIVE_FLUSH_MS,
+    .stack_size = 1024 * 5,
+    .priority = tskIDLE_PRIORITY + 2,
+    .core = 0,
+};
+#endif
+
 constexpr task_config display_config = {
     .delay = 100,
     .stack_size = 1024 * 3,
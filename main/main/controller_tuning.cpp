@@ -0,0 +1,30 @@
+// Includes
+#include "controller_tuning.hpp"
+#include "calibration.hpp"
+
+#include <math.h>
+
+esp_err_t controller_tuning_load(uint8_t motor, controller_tuning *tuning)
+{
+  controller_tuning stored;
+  esp_err_t err = calibration_load(motor, CONTROLLER_TUNING_KEY, &stored, sizeof(stored));
+
+  if (err != ESP_OK)
+    return err;
+  if (!(stored.kp > 0) || !(stored.ti > 0) || !(stored.td >= 0) || !isfinite(stored.kp + stored.ti + stored.td) ||
+      stored.velocity_window == 0)
+    return ESP_ERR_INVALID_ARG;
+
+  *tuning = stored;
+  return ESP_OK;
+}
+
+esp_err_t controller_tuning_save(uint8_t motor, const controller_tuning &tuning)
+{
+  return calibration_save(motor, CONTROLLER_TUNING_KEY, &tuning, sizeof(tuning));
+}
+
+esp_err_t controller_tuning_erase(uint8_t motor)
+{
+  return calibration_erase(motor, CONTROLLER_TUNING_KEY);
+}
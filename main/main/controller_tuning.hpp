@@ -0,0 +1,26 @@
+#ifndef CONTROLLER_TUNING_H_
+#define CONTROLLER_TUNING_H_
+
+// Includes
+#include <stdint.h>
+
+#include "esp_err.h"
+
+static constexpr char *CONTROLLER_TUNING_KEY = "pid-tuning";
+
+// Fixed PID gains and velocity filter length of one unit, tuned offline by dtmc_gain_tuner
+// against the unit's identified model and flashed as an NVS blob. Loaded in place of the
+// defaults in tuned_gains.hpp. A gain schedule still takes over the velocity gains.
+typedef struct
+{
+  float kp;
+  float ti;
+  float td;
+  uint16_t velocity_window; // Samples, at most the filter's reserved length
+} controller_tuning;
+
+esp_err_t controller_tuning_load(uint8_t motor, controller_tuning *tuning);
+esp_err_t controller_tuning_save(uint8_t motor, const controller_tuning &tuning);
+esp_err_t controller_tuning_erase(uint8_t motor);
+
+#endif // CONTROLLER_TUNING_H_
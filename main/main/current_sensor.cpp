@@ -1,29 +1,54 @@
 // Includes
 #include "current_sensor.hpp"
+#include "memory_arena.hpp"
+#include "recorder.hpp"
 
-static constexpr char *TAG = "Current Sensor";
+#include "esp_attr.h"
 
-static CurrentSensor *curr_sen_obj;
+static constexpr char *TAG = "Current Sensor";
 
 CurrentSensor::CurrentSensor()
 {
-  curr_sen_obj = this;
+  channel_count = 0;
+
+  for (uint8_t i = 0; i < MAX_MOTORS; i++)
+  {
+    channels[i] = ADC_CHANNEL_0;
+    zero_voltage[i] = 0;
+    voltage[i] = 0;
+    current[i] = 0;
+    latest_raw[i] = 0;
 
-  zero_voltage = 0;
-  voltage = 0;
-  current = 0;
+    capture[i] = nullptr;
+    offset_mv[i] = 0;
+    mv_per_code[i] = 0;
+    overcurrent_mv[i] = 0;
+    monitor[i] = nullptr;
+    supervisor[i] = nullptr;
+    supervisor_mv[i] = 0;
+
+    raw_count[i] = 0;
+    cali_hdl[i] = nullptr;
+  }
 
   continuous_hdl = nullptr;
-  cali_hdl = nullptr;
 
   adc_task_hdl = NULL;
 }
 
-void CurrentSensor::init()
+// Adds a motor's channel to the conversion pattern and returns its index. The first channel
+// starts the conversions and the ADC task, later ones restart the pattern with theirs added.
+uint8_t CurrentSensor::add_channel(gpio_num_t gpio, adc_channel_t channel)
 {
-  ESP_LOGI(TAG, "Setting up pull-down resistor.");
+  static_assert((VOLTAGE_WINDOW_SIZE + CURRENT_WINDOW_SIZE) * sizeof(float) <= FILTERS_ARENA_SIZE / MOTOR_COUNT,
+                "Current sensor filters exceed the filters arena");
+
+  uint8_t index = channel_count;
+  configASSERT(index < MAX_MOTORS);
+
+  ESP_LOGI(TAG, "Setting up pull-down resistor on GPIO %d.", gpio);
   gpio_config_t adc_gpio_config = {
-      .pin_bit_mask = (1ULL << GPIO_ADC),
+      .pin_bit_mask = (1ULL << gpio),
       .mode = GPIO_MODE_INPUT,
       .pull_down_en = GPIO_PULLDOWN_ENABLE,
   };
@@ -31,83 +56,319 @@ void CurrentSensor::init()
 
   adc_cali_curve_fitting_config_t cali_config = {
       .unit_id = ADC_UNIT_1,
-      .chan = ADC_CHANNEL_3,
+      .chan = channel,
       .atten = ADC_ATTEN_DB_6,
       .bitwidth = ADC_BITWIDTH_12,
   };
-  ESP_ERROR_CHECK(adc_cali_create_scheme_curve_fitting(&cali_config, &cali_hdl));
+  ESP_ERROR_CHECK(adc_cali_create_scheme_curve_fitting(&cali_config, &cali_hdl[index]));
 
-  adc_continuous_handle_cfg_t continuous_config = {
-      .max_store_buf_size = BUFFER_SIZE,
-      .conv_frame_size = FRAME_SIZE,
-  };
-  ESP_ERROR_CHECK(adc_continuous_new_handle(&continuous_config, &continuous_hdl));
+  int low_mv = 0;
+  int high_mv = 0;
+  ESP_ERROR_CHECK(adc_cali_raw_to_voltage(cali_hdl[index], 0, &low_mv));
+  ESP_ERROR_CHECK(adc_cali_raw_to_voltage(cali_hdl[index], MAX_CODE, &high_mv));
+  offset_mv[index] = low_mv;
+  mv_per_code[index] = (float)(high_mv - low_mv) / MAX_CODE;
 
-  adc_digi_pattern_config_t pattern_config = {
-      .atten = ADC_ATTEN_DB_6,
-      .channel = ADC_CHANNEL_3,
-      .unit = ADC_UNIT_1,
-      .bit_width = ADC_BITWIDTH_12,
-  };
+  voltage_average[index].init(VOLTAGE_WINDOW_SIZE);
+  current_average[index].init(CURRENT_WINDOW_SIZE);
+  channels[index] = channel;
+
+  if (continuous_hdl == nullptr)
+  {
+    adc_continuous_handle_cfg_t continuous_config = {
+        .max_store_buf_size = BUFFER_SIZE,
+        .conv_frame_size = FRAME_SIZE,
+    };
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&continuous_config, &continuous_hdl));
+
+    adc_continuous_evt_cbs_t adc_cbs = {
+        .on_conv_done = conversion_done,
+    };
+    ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(continuous_hdl, &adc_cbs, this));
+  }
+  else
+  {
+    vTaskSuspend(adc_task_hdl);
+    ESP_ERROR_CHECK(adc_continuous_stop(continuous_hdl));
+  }
+
+  channel_count++;
+  configure_pattern();
+  ESP_ERROR_CHECK(adc_continuous_start(continuous_hdl));
+
+  // Each channel's share of the conversions shrinks with every channel added
+  for (uint8_t i = 0; i < channel_count; i++)
+  {
+    update_monitor(i);
+    update_supervisor(i);
+  }
+
+  if (adc_task_hdl == NULL)
+  {
+    xTaskCreatePinnedToCore(adc_task, "ADC Task", adc_config.stack_size, this, adc_config.priority, &adc_task_hdl, adc_config.core);
+    memory_guard_task(adc_task_hdl);
+  }
+  else
+    vTaskResume(adc_task_hdl);
+
+  return index;
+}
+
+void CurrentSensor::configure_pattern()
+{
+  adc_digi_pattern_config_t pattern_config[MAX_MOTORS];
+
+  for (uint8_t i = 0; i < channel_count; i++)
+  {
+    pattern_config[i] = {
+        .atten = ADC_ATTEN_DB_6,
+        .channel = (uint8_t)channels[i],
+        .unit = ADC_UNIT_1,
+        .bit_width = ADC_BITWIDTH_12,
+    };
+  }
 
   adc_continuous_config_t digi_cfg = {
-      .pattern_num = 1,
-      .adc_pattern = &pattern_config,
+      .pattern_num = channel_count,
+      .adc_pattern = pattern_config,
       .sample_freq_hz = SAMPLE_FREQ,
       .conv_mode = ADC_CONV_SINGLE_UNIT_1,
       .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
   };
   ESP_ERROR_CHECK(adc_continuous_config(continuous_hdl, &digi_cfg));
-  ESP_ERROR_CHECK(adc_continuous_start(continuous_hdl));
+}
 
-  xTaskCreatePinnedToCore(adc_task, "ADC Task", adc_config.stack_size, nullptr, adc_config.priority, &adc_task_hdl, adc_config.core);
+// Index of a converted channel in the pattern, -1 if it is not one of ours
+IRAM_ATTR int8_t CurrentSensor::find_channel(uint32_t channel)
+{
+  for (uint8_t i = 0; i < channel_count; i++)
+  {
+    if (channels[i] == channel)
+      return i;
+  }
+
+  return -1;
 }
 
 void CurrentSensor::adc_task(void *arg)
 {
-  static MovingAverage voltage_average(VOLTAGE_WINDOW_SIZE);
-  static MovingAverage current_average(CURRENT_WINDOW_SIZE);
+  CurrentSensor *sensor = static_cast<CurrentSensor *>(arg);
+  int sample_voltage = 0;
 
   while (1)
   {
-    curr_sen_obj->voltage = voltage_average.next(curr_sen_obj->read_voltage());
-    curr_sen_obj->current = current_average.next((float)(curr_sen_obj->voltage - curr_sen_obj->zero_voltage) / MV_TO_MA);
+    sensor->read_voltages();
+
+    for (uint8_t i = 0; i < sensor->channel_count; i++)
+    {
+      ESP_ERROR_CHECK(adc_cali_raw_to_voltage(sensor->cali_hdl[i], sensor->latest_raw[i], &sample_voltage));
+      recorder().add_adc(i, sensor->latest_raw[i], sample_voltage);
+      sensor->voltage[i] = sensor->voltage_average[i].next(sample_voltage);
+      sensor->current[i] = sensor->current_average[i].next((float)(sensor->voltage[i] - sensor->zero_voltage[i]) / MV_TO_MA);
+    }
 
     vTaskDelay(adc_config.delay / portTICK_PERIOD_MS);
   }
 }
 
-void CurrentSensor::zero()
+// Every DMA frame, FRAME_SIZE bytes, goes past the supervisors before the ADC task drains it
+IRAM_ATTR bool CurrentSensor::conversion_done(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+  CurrentSensor *sensor = static_cast<CurrentSensor *>(user_data);
+
+  for (uint32_t i = 0; i + sizeof(adc_digi_output_data_t) <= edata->size; i += sizeof(adc_digi_output_data_t))
+  {
+    adc_digi_output_data_t *digi_output = (adc_digi_output_data_t *)&edata->conv_frame_buffer[i];
+    int8_t index = sensor->find_channel(digi_output->type2.channel);
+    if (index >= 0 && sensor->supervisor[index] != nullptr)
+      sensor->supervisor[index]->add_conversion(digi_output->type2.data);
+  }
+
+  for (uint8_t index = 0; index < sensor->channel_count; index++)
+  {
+    if (sensor->supervisor[index] != nullptr)
+      sensor->supervisor[index]->end_frame();
+  }
+
+  return false;
+}
+
+void CurrentSensor::zero(uint8_t index)
 {
-  static int temp_zero_voltage = 0;
-  static MovingAverage zero_average(ZEROING_SAMPLE_SIZE);
+  static_assert(ZEROING_READ_SIZE <= DRAIN_SIZE, "Zeroing reads exceed the drain buffer");
+
+  uint32_t length = 0;
+  uint32_t sample_count = 0;
+  uint32_t sample_size = get_sample_freq() / 60;
+  int64_t voltage_sum = 0;
+  int sample_voltage = 0;
 
   vTaskSuspend(adc_task_hdl);
-  for (int i = 0; i <= ZEROING_SAMPLE_SIZE; i++)
+
+  // Drop conversions queued before the motor was stopped
+  for (uint16_t i = 0; i <= BUFFER_SIZE / ZEROING_READ_SIZE; i++)
   {
-    temp_zero_voltage = zero_average.next(read_voltage());
-    vTaskDelay(adc_config.delay / portTICK_PERIOD_MS);
+    if (adc_continuous_read(continuous_hdl, result, ZEROING_READ_SIZE, &length, 0) != ESP_OK)
+      break;
   }
-  zero_voltage = temp_zero_voltage;
+
+  while (sample_count < sample_size)
+  {
+    if (adc_continuous_read(continuous_hdl, result, ZEROING_READ_SIZE, &length, ZEROING_TIMEOUT_MS) != ESP_OK)
+      break;
+
+    for (uint32_t i = 0; i + sizeof(adc_digi_output_data_t) <= length && sample_count < sample_size;
+         i += sizeof(adc_digi_output_data_t))
+    {
+      adc_digi_output_data_t *digi_output = (adc_digi_output_data_t *)&result[i];
+      if (find_channel(digi_output->type2.channel) != index)
+        continue;
+
+      ESP_ERROR_CHECK(adc_cali_raw_to_voltage(cali_hdl[index], digi_output->type2.data, &sample_voltage));
+      voltage_sum += sample_voltage;
+      sample_count++;
+    }
+  }
+
+  if (sample_count > 0)
+    zero_voltage[index] = voltage_sum / sample_count;
+  else
+    ESP_LOGW(TAG, "No ADC conversions available, zero voltage unchanged.");
+
+  ESP_LOGI(TAG, "Zeroed channel %u at %d mV from %lu samples.", channels[index], zero_voltage[index], (unsigned long)sample_count);
+  recorder().add_zero(index, zero_voltage[index]);
+
+  // Thresholds move with the zero, compared against raw codes so the ADC task does not calibrate each one
+  if (capture[index] != nullptr && overcurrent_mv[index] > 0)
+    capture[index]->set_overcurrent(voltage_to_code(index, zero_voltage[index] - overcurrent_mv[index]),
+                                    voltage_to_code(index, zero_voltage[index] + overcurrent_mv[index]));
+  update_monitor(index);
+  update_supervisor(index);
   vTaskResume(adc_task_hdl);
 }
 
-int CurrentSensor::read_voltage()
+// Drains every queued conversion into the captures, the newest of each channel is kept for the filters
+void CurrentSensor::read_voltages()
+{
+  uint32_t length = 0;
+
+  while (adc_continuous_read(continuous_hdl, result, DRAIN_SIZE, &length, 0) == ESP_OK && length > 0)
+  {
+    for (uint8_t index = 0; index < channel_count; index++)
+      raw_count[index] = 0;
+
+    for (uint32_t i = 0; i + sizeof(adc_digi_output_data_t) <= length; i += sizeof(adc_digi_output_data_t))
+    {
+      adc_digi_output_data_t *digi_output = (adc_digi_output_data_t *)&result[i];
+      int8_t index = find_channel(digi_output->type2.channel);
+      if (index >= 0)
+        raw[index][raw_count[index]++] = digi_output->type2.data;
+    }
+
+    for (uint8_t index = 0; index < channel_count; index++)
+    {
+      if (capture[index] != nullptr)
+        capture[index]->add_samples(raw[index], raw_count[index]);
+      if (monitor[index] != nullptr)
+        monitor[index]->add_current(raw[index], raw_count[index]);
+      if (raw_count[index] > 0)
+        latest_raw[index] = raw[index][raw_count[index] - 1];
+    }
+
+    if (length < DRAIN_SIZE)
+      break;
+  }
+}
+
+// Lowest code at or above the voltage, the calibration curve is monotonic
+uint16_t CurrentSensor::voltage_to_code(uint8_t index, int target)
+{
+  uint16_t low = 0;
+  uint16_t high = MAX_CODE;
+  int code_voltage = 0;
+
+  while (low < high)
+  {
+    uint16_t middle = (low + high) / 2;
+    ESP_ERROR_CHECK(adc_cali_raw_to_voltage(cali_hdl[index], middle, &code_voltage));
+    if (code_voltage < target)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+void CurrentSensor::attach_capture(uint8_t index, Capture *capture, int overcurrent_ma)
+{
+  this->capture[index] = capture;
+  overcurrent_mv[index] = overcurrent_ma * MV_TO_MA;
+}
+
+void CurrentSensor::attach_monitor(uint8_t index, ConditionMonitor *monitor)
 {
-  static uint8_t result[FRAME_SIZE] = {0};
-  static uint32_t length = 0;
-  static adc_digi_output_data_t *digi_output;
-  static int adc_raw = 0;
-  static int voltage = 0;
+  this->monitor[index] = monitor;
+  update_monitor(index);
+}
+
+// Hands the channel's rate and calibration to its monitor, which converts codes itself
+void CurrentSensor::update_monitor(uint8_t index)
+{
+  if (monitor[index] == nullptr)
+    return;
+
+  monitor[index]->set_current_rate(get_sample_freq());
+  monitor[index]->set_current_scale(offset_mv[index], mv_per_code[index], zero_voltage[index], get_ma_per_mv());
+}
+
+void CurrentSensor::attach_supervisor(uint8_t index, SafetySupervisor *supervisor, int overcurrent_ma)
+{
+  this->supervisor[index] = supervisor;
+  supervisor_mv[index] = overcurrent_ma * MV_TO_MA;
+  update_supervisor(index);
+}
+
+// Thresholds follow the zero as the capture's do, left open until the channel is zeroed
+void CurrentSensor::update_supervisor(uint8_t index)
+{
+  if (supervisor[index] == nullptr)
+    return;
+
+  supervisor[index]->set_conversion_rate(get_sample_freq());
+  if (zero_voltage[index] > 0)
+    supervisor[index]->set_overcurrent(voltage_to_code(index, zero_voltage[index] - supervisor_mv[index]),
+                                       voltage_to_code(index, zero_voltage[index] + supervisor_mv[index]),
+                                       voltage_to_code(index, zero_voltage[index]), mv_per_code[index] * get_ma_per_mv());
+}
+
+float CurrentSensor::read_current(uint8_t index)
+{
+  return current[index];
+}
 
-  adc_continuous_read(continuous_hdl, result, FRAME_SIZE, &length, 0);
-  digi_output = (adc_digi_output_data_t *)&result[0];
-  adc_raw = digi_output->type2.data;
-  ESP_ERROR_CHECK(adc_cali_raw_to_voltage(curr_sen_obj->cali_hdl, adc_raw, &voltage));
-  return voltage;
+// Conversions per second of each channel
+uint32_t CurrentSensor::get_sample_freq()
+{
+  return channel_count > 0 ? SAMPLE_FREQ / channel_count : SAMPLE_FREQ;
 }
 
-float CurrentSensor::read_current()
+int CurrentSensor::get_zero_voltage(uint8_t index)
 {
-  return current;
-}
\ No newline at end of file
+  return zero_voltage[index];
+}
+
+float CurrentSensor::get_offset_mv(uint8_t index)
+{
+  return offset_mv[index];
+}
+
+float CurrentSensor::get_mv_per_code(uint8_t index)
+{
+  return mv_per_code[index];
+}
+
+float CurrentSensor::get_ma_per_mv()
+{
+  return 1 / MV_TO_MA;
+}
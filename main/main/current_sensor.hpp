@@ -6,6 +6,9 @@
 
 #include "configuration.hpp"
 #include "moving_average.hpp"
+#include "capture.hpp"
+#include "condition_monitor.hpp"
+#include "safety_supervisor.hpp"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -17,43 +20,93 @@
 #include "esp_adc/adc_cali_scheme.h"
 #include "esp_adc/adc_continuous.h"
 
+// Samples the current sensors of every motor. ADC1 converts one channel per motor in a single
+// continuous pattern, which one task drains and splits by channel, so the per-channel state is
+// kept as arrays indexed by the channel's position in the pattern.
 class CurrentSensor
 {
 private:
   // Class variables
-  int zero_voltage;
-  int voltage;
-  float current;
+  uint8_t channel_count;
+  adc_channel_t channels[MAX_MOTORS];
+  int zero_voltage[MAX_MOTORS];
+  int voltage[MAX_MOTORS];
+  float current[MAX_MOTORS];
+  uint16_t latest_raw[MAX_MOTORS];
 
-  // ESP handles
-  adc_continuous_handle_t continuous_hdl;
-  adc_cali_handle_t cali_hdl;
+  // Triggered capture of every conversion, nullptr if not attached
+  Capture *capture[MAX_MOTORS];
+  float offset_mv[MAX_MOTORS]; // Linear fit of the calibration for host side conversion
+  float mv_per_code[MAX_MOTORS];
+  int overcurrent_mv[MAX_MOTORS];
+
+  // Spectral condition monitoring of every conversion, nullptr if not attached
+  ConditionMonitor *monitor[MAX_MOTORS];
+
+  // Overcurrent protection of every conversion in the frame interrupt, nullptr if not attached
+  SafetySupervisor *supervisor[MAX_MOTORS];
+  int supervisor_mv[MAX_MOTORS];
 
   // Filtering properties
   static constexpr uint8_t VOLTAGE_WINDOW_SIZE = 100; // Size of window for moving average
   static constexpr uint8_t CURRENT_WINDOW_SIZE = 10;
-  static constexpr uint16_t ZEROING_SAMPLE_SIZE = 1000;
 
-  // ADC continuous properties
+  MovingAverage voltage_average[MAX_MOTORS];
+  MovingAverage current_average[MAX_MOTORS];
+
+  // ADC continuous properties, the pattern shares the sample frequency between the channels
   static constexpr uint32_t SAMPLE_FREQ = 80000;
   static constexpr uint16_t BUFFER_SIZE = 12 * 100;
   static constexpr uint16_t FRAME_SIZE = 12 * 3;
 
+  // Zeroing averages one 60 Hz mains period of DMA conversions (~17 ms) instead of 1 ms polling
+  static constexpr uint16_t ZEROING_READ_SIZE = FRAME_SIZE * 10;
+  static constexpr uint32_t ZEROING_TIMEOUT_MS = 10;
+
+  // Each read drains every queued conversion so none are lost to the captures
+  static constexpr uint16_t DRAIN_SIZE = FRAME_SIZE * 10;
+  static constexpr uint16_t DRAIN_COUNT = DRAIN_SIZE / sizeof(adc_digi_output_data_t);
+  static constexpr uint16_t MAX_CODE = (1 << 12) - 1;
+
+  uint8_t result[DRAIN_SIZE];
+  uint16_t raw[MAX_MOTORS][DRAIN_COUNT];
+  uint16_t raw_count[MAX_MOTORS];
+
   // Conversion constants
   static constexpr float MV_TO_MA = 800.0 / 1000.0;
 
+  // ESP handles
+  adc_continuous_handle_t continuous_hdl;
+  adc_cali_handle_t cali_hdl[MAX_MOTORS];
+
   // ADC task
   TaskHandle_t adc_task_hdl;
   static void adc_task(void *arg);
+  static bool conversion_done(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data);
+
+  void configure_pattern();
+  int8_t find_channel(uint32_t channel);
+  void read_voltages();
+  uint16_t voltage_to_code(uint8_t index, int target);
+  void update_monitor(uint8_t index);
+  void update_supervisor(uint8_t index);
 
 public:
   CurrentSensor();
 
-  void init();
-  void zero();
+  uint8_t add_channel(gpio_num_t gpio, adc_channel_t channel);
+  void zero(uint8_t index);
+  void attach_capture(uint8_t index, Capture *capture, int overcurrent_ma);
+  void attach_monitor(uint8_t index, ConditionMonitor *monitor);
+  void attach_supervisor(uint8_t index, SafetySupervisor *supervisor, int overcurrent_ma);
+
+  float read_current(uint8_t index);
 
-  int read_voltage();
-  float read_current();
+  uint32_t get_sample_freq();
+  int get_zero_voltage(uint8_t index);
+  float get_offset_mv(uint8_t index);
+  float get_mv_per_code(uint8_t index);
+  float get_ma_per_mv();
 };
 
 #endif // CURRENT_SENSOR_H_
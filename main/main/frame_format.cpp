@@ -0,0 +1,263 @@
+// Includes
+#include "frame_format.hpp"
+
+#include <string.h>
+
+enum ColumnType : uint8_t
+{
+  COLUMN_UINT64 = 0,
+  COLUMN_FLOAT32 = 1,
+};
+
+enum ColumnFilter : uint8_t
+{
+  FILTER_NONE = 0,
+  FILTER_DELTA = 1, // Difference from the previous value
+  FILTER_XOR = 2,   // Bits that changed from the previous value
+};
+
+typedef struct
+{
+  char *buffer;
+  uint32_t size;
+  uint32_t length;
+} frame_writer;
+
+bool append_text(char *buffer, uint32_t size, uint32_t *length, const char *text)
+{
+  uint32_t text_length = strlen(text);
+
+  if (*length + text_length >= size)
+    return false;
+
+  memcpy(&buffer[*length], text, text_length);
+  *length += text_length;
+  return true;
+}
+
+// Formats an unsigned integer in reverse, returns the number of digits
+static uint8_t format_reversed(char *digits, uint64_t value)
+{
+  uint8_t count = 0;
+
+  do
+  {
+    digits[count++] = '0' + (value % 10);
+    value /= 10;
+  } while (value > 0);
+
+  return count;
+}
+
+bool append_value(char *buffer, uint32_t size, uint32_t *length, uint64_t value)
+{
+  char digits[MAX_FIELD_SIZE];
+  uint8_t count = format_reversed(digits, value);
+
+  if (*length + count >= size)
+    return false;
+
+  while (count > 0)
+    buffer[(*length)++] = digits[--count];
+  return true;
+}
+
+// Fixed-point with three decimals, matching the previous stream precision
+bool append_value(char *buffer, uint32_t size, uint32_t *length, float value)
+{
+  char digits[MAX_FIELD_SIZE];
+  double scaled = (double)value * 1000.0;
+  bool negative = scaled < 0;
+  uint64_t magnitude = (uint64_t)(negative ? -scaled + 0.5 : scaled + 0.5);
+  uint8_t count = 0;
+
+  if (!std::isfinite(value))
+    magnitude = 0;
+
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    digits[count++] = '0' + (magnitude % 10);
+    magnitude /= 10;
+  }
+  digits[count++] = '.';
+  count += format_reversed(&digits[count], magnitude);
+  if (negative && std::isfinite(value))
+    digits[count++] = '-';
+
+  if (*length + count >= size)
+    return false;
+
+  while (count > 0)
+    buffer[(*length)++] = digits[--count];
+  return true;
+}
+
+bool append_summary(char *buffer, uint32_t size, uint32_t *length, const char *key, ChannelSummary &channel)
+{
+  return append_text(buffer, size, length, "\"") &&
+         append_text(buffer, size, length, key) &&
+         append_text(buffer, size, length, "\":{") &&
+         append_field(buffer, size, length, "min", channel.get_min()) &&
+         append_text(buffer, size, length, ",") &&
+         append_field(buffer, size, length, "max", channel.get_max()) &&
+         append_text(buffer, size, length, ",") &&
+         append_field(buffer, size, length, "mean", channel.get_mean()) &&
+         append_text(buffer, size, length, ",") &&
+         append_field(buffer, size, length, "rms", channel.get_rms()) &&
+         append_text(buffer, size, length, ",") &&
+         append_field(buffer, size, length, "last", channel.get_last()) &&
+         append_text(buffer, size, length, "}");
+}
+
+// Compressor sink appending to the frame buffer
+static bool append_bytes(void *context, const uint8_t *data, uint32_t length)
+{
+  frame_writer *frame = (frame_writer *)context;
+
+  if (frame->length + length > frame->size)
+    return false;
+
+  memcpy(&frame->buffer[frame->length], data, length);
+  frame->length += length;
+  return true;
+}
+
+static bool compress_descriptor(StreamCompressor &compressor, const char *key, ColumnType type, ColumnFilter filter)
+{
+  uint8_t key_length = strlen(key);
+  uint8_t descriptor[] = {type, filter};
+
+  return compressor.write(&key_length, sizeof(key_length)) &&
+         compressor.write(key, key_length) &&
+         compressor.write(descriptor, sizeof(descriptor));
+}
+
+// Timestamps advance by about one sample period, their deltas repeat
+static bool compress_column(StreamCompressor &compressor, const char *key, const uint64_t *values, uint16_t count)
+{
+  bool complete = compress_descriptor(compressor, key, COLUMN_UINT64, FILTER_DELTA);
+  uint64_t prev = 0;
+
+  for (uint16_t i = 0; complete && i < count; i++)
+  {
+    uint64_t delta = values[i] - prev;
+    prev = values[i];
+    complete = compressor.write(&delta, sizeof(delta));
+  }
+
+  return complete;
+}
+
+// Slowly varying floats keep their sign and exponent, unchanged ones become all zero
+static bool compress_column(StreamCompressor &compressor, const char *key, const float *values, uint16_t count)
+{
+  bool complete = compress_descriptor(compressor, key, COLUMN_FLOAT32, FILTER_XOR);
+  uint32_t prev = 0;
+
+  for (uint16_t i = 0; complete && i < count; i++)
+  {
+    uint32_t bits;
+    memcpy(&bits, &values[i], sizeof(bits));
+
+    uint32_t change = bits ^ prev;
+    prev = bits;
+    complete = compressor.write(&change, sizeof(change));
+  }
+
+  return complete;
+}
+
+bool compress_columns(StreamCompressor &compressor, const frame_columns &columns, uint16_t count)
+{
+  const uint8_t column_count = FRAME_COLUMN_COUNT;
+
+  return compressor.write(&count, sizeof(count)) &&
+         compressor.write(&column_count, sizeof(column_count)) &&
+         compress_column(compressor, "timestamp", columns.timestamp, count) &&
+         compress_column(compressor, "gain", columns.gain, count) &&
+         compress_column(compressor, "duty_cycle", columns.duty_cycle, count) &&
+         compress_column(compressor, "velocity", columns.velocity, count) &&
+         compress_column(compressor, "position", columns.position, count) &&
+         compress_column(compressor, "current", columns.current, count);
+}
+
+uint32_t format_frame(char *dest, uint32_t size, const frame_columns &columns, uint16_t count)
+{
+  uint32_t length = 0;
+  bool complete = true;
+
+  complete &= append_text(dest, size, &length, "{");
+  complete &= append_column(dest, size, &length, "timestamp", columns.timestamp, count);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_column(dest, size, &length, "gain", columns.gain, count);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_column(dest, size, &length, "duty_cycle", columns.duty_cycle, count);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_column(dest, size, &length, "velocity", columns.velocity, count);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_column(dest, size, &length, "position", columns.position, count);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_column(dest, size, &length, "current", columns.current, count);
+  complete &= append_text(dest, size, &length, "}\n");
+
+  // Drop frames that do not fit rather than sending truncated JSON
+  if (!complete)
+    length = 0;
+  if (size > 0)
+    dest[length] = '\0';
+
+  return length;
+}
+
+uint32_t compress_frame(StreamCompressor &compressor, char *dest, uint32_t size, const frame_columns &columns, uint16_t count)
+{
+  const uint8_t header[FRAME_HEADER_SIZE] = {'D', 'T', FRAME_VERSION,
+                                             (StreamCompressor::WINDOW_BITS << 4) | StreamCompressor::LOOKAHEAD_BITS};
+  frame_writer frame = {dest, size, 0};
+  bool complete = true;
+
+  compressor.begin(append_bytes, &frame);
+  complete &= append_bytes(&frame, header, sizeof(header));
+  complete &= compress_columns(compressor, columns, count);
+  complete &= compressor.finish();
+
+  return complete ? frame.length : 0;
+}
+
+uint32_t format_summary(char *dest, uint32_t size, frame_summary &summary)
+{
+  uint32_t length = 0;
+  bool complete = true;
+
+  complete &= append_text(dest, size, &length, "{\"summary\":{");
+  complete &= append_field(dest, size, &length, "start", summary.start_time);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "end", summary.end_time);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "count", (uint64_t)summary.velocity.get_count());
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "mode", (uint64_t)summary.mode);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "gain", summary.gain);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "frequency", summary.freq);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "position_sp", summary.position_sp);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "velocity_sp", summary.velocity_sp);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_summary(dest, size, &length, "duty_cycle", summary.duty_cycle);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_summary(dest, size, &length, "velocity", summary.velocity);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_summary(dest, size, &length, "position", summary.position);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_summary(dest, size, &length, "current", summary.current);
+  complete &= append_text(dest, size, &length, "}}");
+
+  if (!complete)
+    return 0;
+  dest[length] = '\0';
+
+  return length;
+}
@@ -0,0 +1,89 @@
+#ifndef FRAME_FORMAT_H_
+#define FRAME_FORMAT_H_
+
+// Includes
+#include <stdint.h>
+#include <cmath>
+
+#include "compressor.hpp"
+#include "summary.hpp"
+
+// Text and compressed encodings of telemetry frames, summaries and reports. Nothing here
+// depends on the ESP-IDF, so the host tools encode frames exactly as a station does.
+
+static constexpr uint8_t MAX_FIELD_SIZE = 24; // Longest formatted value, including sign and decimals
+
+// Appends text to a sample string, returns false if it does not fit
+bool append_text(char *buffer, uint32_t size, uint32_t *length, const char *text);
+
+bool append_value(char *buffer, uint32_t size, uint32_t *length, uint64_t value);
+bool append_value(char *buffer, uint32_t size, uint32_t *length, float value);
+
+// Appends "key":[v0,v1,...] to a sample string
+template <typename T>
+bool append_column(char *buffer, uint32_t size, uint32_t *length, const char *key, const T *values, uint16_t count)
+{
+  bool complete = append_text(buffer, size, length, "\"") &&
+                  append_text(buffer, size, length, key) &&
+                  append_text(buffer, size, length, "\":[");
+
+  for (uint16_t i = 0; complete && i < count; i++)
+  {
+    if (i > 0)
+      complete = append_text(buffer, size, length, ",");
+    complete = complete && append_value(buffer, size, length, values[i]);
+  }
+
+  return complete && append_text(buffer, size, length, "]");
+}
+
+// Appends "key":value to a sample string
+template <typename T>
+bool append_field(char *buffer, uint32_t size, uint32_t *length, const char *key, T value)
+{
+  return append_text(buffer, size, length, "\"") &&
+         append_text(buffer, size, length, key) &&
+         append_text(buffer, size, length, "\":") &&
+         append_value(buffer, size, length, value);
+}
+
+// Appends "key":{"min":..,"max":..,"mean":..,"rms":..,"last":..}
+bool append_summary(char *buffer, uint32_t size, uint32_t *length, const char *key, ChannelSummary &channel);
+
+// Columns of one telemetry frame, each count samples long
+typedef struct
+{
+  const uint64_t *timestamp;
+  const float *gain;
+  const float *duty_cycle;
+  const float *velocity;
+  const float *position;
+  const float *current;
+} frame_columns;
+
+// Compressed frame layout, decoded by python_scripts/telemetry_codec.py:
+// "DT", version, window bits << 4 | lookahead bits, then compressed: sample count (u16),
+// column count (u8) and per column key length (u8), key, type, filter and the values.
+// All values are little-endian.
+static constexpr uint8_t FRAME_VERSION = 1;
+static constexpr uint8_t FRAME_COLUMN_COUNT = 6;
+static constexpr uint32_t FRAME_HEADER_SIZE = 4;
+static constexpr uint32_t MAX_KEY_SIZE = 10; // "duty_cycle"
+
+// Uncompressed size of the columns of a frame of count samples
+static constexpr uint32_t frame_columns_size(uint16_t count)
+{
+  return sizeof(uint16_t) + 1 +
+         FRAME_COLUMN_COUNT * (1 + MAX_KEY_SIZE + 2) +
+         count * (sizeof(uint64_t) + 5 * sizeof(float));
+}
+
+// Writes the column section of a frame, sample count onwards, to a compressor already begun
+bool compress_columns(StreamCompressor &compressor, const frame_columns &columns, uint16_t count);
+
+// Each returns the length written, or 0 if it does not fit in size bytes. Text is terminated.
+uint32_t format_frame(char *dest, uint32_t size, const frame_columns &columns, uint16_t count);
+uint32_t compress_frame(StreamCompressor &compressor, char *dest, uint32_t size, const frame_columns &columns, uint16_t count);
+uint32_t format_summary(char *dest, uint32_t size, frame_summary &summary);
+
+#endif // FRAME_FORMAT_H_
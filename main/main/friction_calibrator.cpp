@@ -0,0 +1,209 @@
+// Includes
+#include "friction_calibrator.hpp"
+
+#include <string.h>
+#include <cmath>
+
+FrictionCalibrator::FrictionCalibrator()
+{
+  state = CALIBRATOR_IDLE;
+  save = false;
+
+  direction_index = 0;
+  duty = 0;
+  elapsed = 0;
+  start_position = 0;
+  measure_start = 0;
+
+  level = 0;
+  memset(level_count, 0, sizeof(level_count));
+  memset(level_duty, 0, sizeof(level_duty));
+  memset(level_velocity, 0, sizeof(level_velocity));
+  memset(friction, 0, sizeof(friction));
+  memset(measured, 0, sizeof(measured));
+  valid = false;
+}
+
+void FrictionCalibrator::begin(bool save)
+{
+  this->save = save;
+  direction_index = 0;
+  valid = false;
+  memset(level_count, 0, sizeof(level_count));
+  memset(friction, 0, sizeof(friction));
+  memset(measured, 0, sizeof(measured));
+
+  start_direction();
+}
+
+void FrictionCalibrator::cancel()
+{
+  state = CALIBRATOR_IDLE;
+}
+
+bool FrictionCalibrator::is_running()
+{
+  return state == CALIBRATOR_REST || state == CALIBRATOR_BREAKAWAY || state == CALIBRATOR_SWEEP;
+}
+
+bool FrictionCalibrator::is_complete()
+{
+  return state == CALIBRATOR_COMPLETE;
+}
+
+void FrictionCalibrator::start_direction()
+{
+  duty = 0;
+  elapsed = 0;
+  level = 0;
+  state = CALIBRATOR_REST;
+}
+
+// Fits duty = coulomb + viscous * velocity through the levels that kept turning
+void FrictionCalibrator::finish_direction()
+{
+  uint8_t count = level_count[direction_index];
+  actuator_friction &result = friction[direction_index];
+
+  if (count >= 2)
+  {
+    double sum_v = 0, sum_d = 0, sum_vv = 0, sum_vd = 0;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+      sum_v += level_velocity[direction_index][i];
+      sum_d += level_duty[direction_index][i];
+      sum_vv += level_velocity[direction_index][i] * level_velocity[direction_index][i];
+      sum_vd += level_velocity[direction_index][i] * level_duty[direction_index][i];
+    }
+
+    double denominator = count * sum_vv - sum_v * sum_v;
+    if (denominator > 0)
+    {
+      result.viscous = (count * sum_vd - sum_v * sum_d) / denominator;
+      result.coulomb = (sum_d - result.viscous * sum_v) / count;
+      result.max_velocity = level_velocity[direction_index][0];
+      measured[direction_index] = result.viscous > 0 && result.max_velocity > 0;
+    }
+  }
+
+  direction_index++;
+  if (direction_index < 2)
+    start_direction();
+  else
+    finish();
+}
+
+// The map uses the slower direction's top speed so a command means the same speed both ways
+void FrictionCalibrator::finish()
+{
+  map.reset(0);
+  valid = measured[0] && measured[1];
+
+  if (valid)
+  {
+    float max_velocity = fminf(friction[0].max_velocity, friction[1].max_velocity);
+
+    valid = map.set_curve(1, friction[0], level_duty[0], level_velocity[0], level_count[0], max_velocity) &&
+            map.set_curve(-1, friction[1], level_duty[1], level_velocity[1], level_count[1], max_velocity);
+    if (valid)
+      map.set_calibrated();
+  }
+
+  duty = 0;
+  state = CALIBRATOR_COMPLETE;
+}
+
+// PWM duty for the next period given the encoder position in degrees and the time since the
+// last call in s, in the direction from get_direction()
+float FrictionCalibrator::next_input(float position, float period)
+{
+  elapsed += period;
+
+  switch (state)
+  {
+  case CALIBRATOR_REST:
+    if (elapsed >= REST_TIME)
+    {
+      elapsed = 0;
+      start_position = position;
+      state = CALIBRATOR_BREAKAWAY;
+    }
+    return 0;
+
+  case CALIBRATOR_BREAKAWAY:
+    duty += RAMP_RATE * period;
+    if (fabsf(position - start_position) >= BREAKAWAY_ANGLE)
+    {
+      friction[direction_index].breakaway = duty;
+      elapsed = 0;
+      level = 0;
+      duty = 1;
+      state = CALIBRATOR_SWEEP;
+    }
+    else if (duty > 1)
+    {
+      // Never moved, nothing more to measure this way
+      finish_direction();
+      return 0;
+    }
+    return duty;
+
+  case CALIBRATOR_SWEEP:
+    if (elapsed >= LEVEL_TIME - MEASURE_TIME && elapsed - period < LEVEL_TIME - MEASURE_TIME)
+    {
+      start_position = position;
+      measure_start = elapsed;
+    }
+
+    if (elapsed >= LEVEL_TIME)
+    {
+      float velocity = fabsf(position - start_position) / (elapsed - measure_start) / 6; // deg/s to RPM
+      float floor = friction[direction_index].breakaway / 2;
+
+      if (velocity < STOP_VELOCITY)
+      {
+        finish_direction();
+        return 0;
+      }
+
+      level_duty[direction_index][level_count[direction_index]] = duty;
+      level_velocity[direction_index][level_count[direction_index]] = velocity;
+      level_count[direction_index]++;
+
+      level++;
+      if (level >= LEVELS)
+      {
+        finish_direction();
+        return 0;
+      }
+
+      duty = 1 - (1 - floor) * level / (LEVELS - 1);
+      elapsed = 0;
+    }
+    return duty;
+
+  default:
+    return 0;
+  }
+}
+
+int32_t FrictionCalibrator::get_direction()
+{
+  return direction_index == 0 ? 1 : -1;
+}
+
+bool FrictionCalibrator::is_valid()
+{
+  return valid;
+}
+
+ActuatorMap &FrictionCalibrator::get_map()
+{
+  return map;
+}
+
+bool FrictionCalibrator::get_save()
+{
+  return save;
+}
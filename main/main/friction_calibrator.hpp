@@ -0,0 +1,75 @@
+#ifndef FRICTION_CALIBRATOR_H_
+#define FRICTION_CALIBRATOR_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+#include "actuator_map.hpp"
+
+// Measures the actuator in each direction in turn, driving the PWM duty directly. From rest the
+// duty is ramped until the encoder moves, which gives the breakaway duty, then stepped down from
+// full duty holding each level long enough to read a steady velocity. A least squares line
+// through the levels that kept turning gives the Coulomb and viscous friction, and the levels
+// themselves the map's curve.
+class FrictionCalibrator
+{
+public:
+  static constexpr float REST_TIME = 1.0;        // s stopped before each direction
+  static constexpr float RAMP_RATE = 0.1;        // Duty per s while looking for breakaway
+  static constexpr float BREAKAWAY_ANGLE = 0.5;  // Degrees of motion that count as breakaway
+  static constexpr uint8_t LEVELS = 10;          // Duty levels from 1 down to half the breakaway duty
+  static constexpr float LEVEL_TIME = 1.0;       // s at each level
+  static constexpr float MEASURE_TIME = 0.5;     // s at the end of each level averaged
+  static constexpr float STOP_VELOCITY = 1.0;    // RPM below which a level counts as stalled
+
+private:
+  enum CalibratorState : uint8_t
+  {
+    CALIBRATOR_IDLE = 0,
+    CALIBRATOR_REST = 1,
+    CALIBRATOR_BREAKAWAY = 2,
+    CALIBRATOR_SWEEP = 3,
+    CALIBRATOR_COMPLETE = 4,
+  };
+
+  // Class variables
+  volatile CalibratorState state;
+  bool save;
+
+  uint8_t direction_index; // 0 clockwise, 1 counter-clockwise
+  float duty;
+  float elapsed;           // s in this state or level
+  float start_position;    // Degrees at the start of the ramp or measurement
+  float measure_start;     // s into the level the measurement started
+
+  uint8_t level;
+  uint8_t level_count[2];
+  float level_duty[2][LEVELS];
+  float level_velocity[2][LEVELS];
+  actuator_friction friction[2];
+  bool measured[2];
+
+  ActuatorMap map;
+  bool valid;
+
+  void start_direction();
+  void finish_direction();
+  void finish();
+
+public:
+  FrictionCalibrator();
+
+  void begin(bool save);
+  void cancel();
+  bool is_running();
+  bool is_complete();
+
+  float next_input(float position, float period);
+  int32_t get_direction();
+  bool is_valid();
+  ActuatorMap &get_map();
+  bool get_save();
+};
+
+#endif // FRICTION_CALIBRATOR_H_
@@ -0,0 +1,102 @@
+// Includes
+#include "gain_schedule.hpp"
+#include "calibration.hpp"
+
+#include <string.h>
+
+static constexpr char *GAIN_SCHEDULE_KEY = "gain-schedule";
+
+GainSchedule::GainSchedule()
+{
+  clear();
+}
+
+void GainSchedule::clear()
+{
+  count = 0;
+  memset(points, 0, sizeof(points));
+}
+
+// Inserts in velocity order, returns false if the table is full
+bool GainSchedule::add(const gain_point &point)
+{
+  uint8_t index = count;
+
+  if (count >= MAX_POINTS)
+    return false;
+
+  while (index > 0 && points[index - 1].velocity > point.velocity)
+  {
+    points[index] = points[index - 1];
+    index--;
+  }
+  points[index] = point;
+  count++;
+
+  return true;
+}
+
+// Returns false if the table is empty and the caller should use its fixed gains
+bool GainSchedule::interpolate(float velocity, float *kp, float *ti, float *td)
+{
+  uint8_t upper = 0;
+  float fraction;
+
+  if (count == 0)
+    return false;
+
+  while (upper < count && points[upper].velocity < velocity)
+    upper++;
+
+  if (upper == 0 || upper == count)
+  {
+    const gain_point &end = points[upper == 0 ? 0 : count - 1];
+    *kp = end.kp;
+    *ti = end.ti;
+    *td = end.td;
+    return true;
+  }
+
+  const gain_point &low = points[upper - 1];
+  const gain_point &high = points[upper];
+  fraction = (velocity - low.velocity) / (high.velocity - low.velocity);
+  *kp = low.kp + fraction * (high.kp - low.kp);
+  *ti = low.ti + fraction * (high.ti - low.ti);
+  *td = low.td + fraction * (high.td - low.td);
+
+  return true;
+}
+
+uint8_t GainSchedule::get_count()
+{
+  return count;
+}
+
+const gain_point &GainSchedule::get_point(uint8_t index)
+{
+  return points[index];
+}
+
+esp_err_t GainSchedule::load(uint8_t motor)
+{
+  GainSchedule stored;
+  esp_err_t err = calibration_load(motor, GAIN_SCHEDULE_KEY, &stored, sizeof(stored));
+
+  if (err != ESP_OK)
+    return err;
+  if (stored.count > MAX_POINTS)
+    return ESP_ERR_INVALID_SIZE;
+
+  *this = stored;
+  return ESP_OK;
+}
+
+esp_err_t GainSchedule::save(uint8_t motor)
+{
+  return calibration_save(motor, GAIN_SCHEDULE_KEY, this, sizeof(*this));
+}
+
+esp_err_t GainSchedule::erase(uint8_t motor)
+{
+  return calibration_erase(motor, GAIN_SCHEDULE_KEY);
+}
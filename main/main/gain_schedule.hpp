@@ -0,0 +1,48 @@
+#ifndef GAIN_SCHEDULE_H_
+#define GAIN_SCHEDULE_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Velocity controller gains tuned at one operating point, with the relay test behind them
+typedef struct
+{
+  float velocity; // Set point in RPM
+  float kp;
+  float ti;
+  float td;
+  float ultimate_gain;   // Duty cycle per RPM
+  float ultimate_period; // s
+} gain_point;
+
+// Velocity controller gains by set point, interpolated linearly between the tuned points and
+// held at the end points outside them. Fixed size so it is saved to NVS as one blob.
+class GainSchedule
+{
+public:
+  static constexpr uint8_t MAX_POINTS = 8;
+
+private:
+  // Class variables
+  uint8_t count;
+  gain_point points[MAX_POINTS]; // Sorted by velocity
+
+public:
+  GainSchedule();
+
+  void clear();
+  bool add(const gain_point &point);
+  bool interpolate(float velocity, float *kp, float *ti, float *td);
+
+  uint8_t get_count();
+  const gain_point &get_point(uint8_t index);
+
+  esp_err_t load(uint8_t motor);
+  esp_err_t save(uint8_t motor);
+  esp_err_t erase(uint8_t motor);
+};
+
+#endif // GAIN_SCHEDULE_H_
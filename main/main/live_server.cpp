@@ -0,0 +1,1034 @@
+// Includes
+#include "live_server.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+// lwIP never raises SIGPIPE
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static constexpr char LIVE_MAGIC[2] = {'D', 'L'};
+static constexpr char WEBSOCKET_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static constexpr uint32_t MAX_COMMAND_LENGTH = 256;
+
+// Bounds what a socket holds as lwIP's TCP_SND_BUF does, so a client that falls behind is found
+// within a second of samples rather than megabytes of stale ones. lwIP ignores the option.
+static constexpr int SEND_BUFFER_SIZE = 16 * 1024;
+
+// WebSocket opcodes and close codes, RFC 6455
+static constexpr uint8_t OPCODE_CONTINUATION = 0x0;
+static constexpr uint8_t OPCODE_TEXT = 0x1;
+static constexpr uint8_t OPCODE_BINARY = 0x2;
+static constexpr uint8_t OPCODE_CLOSE = 0x8;
+static constexpr uint8_t OPCODE_PING = 0x9;
+static constexpr uint8_t OPCODE_PONG = 0xA;
+static constexpr uint16_t CLOSE_PROTOCOL_ERROR = 1002;
+static constexpr uint16_t CLOSE_UNSUPPORTED = 1003;
+static constexpr uint16_t CLOSE_TOO_BIG = 1009;
+
+static constexpr char RESPONSE_BAD_REQUEST[] =
+    "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static constexpr char RESPONSE_NOT_FOUND[] =
+    "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static constexpr char RESPONSE_NOT_ALLOWED[] =
+    "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static constexpr char RESPONSE_TOO_LARGE[] =
+    "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static constexpr char RESPONSE_UNAVAILABLE[] =
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+// Served at /, shows the latest sample of a motor and steps its set points
+static constexpr char PAGE[] =
+    "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>DTMC live</title>"
+    "<style>body{font-family:sans-serif;margin:2em}td{padding:2px 1em}</style></head><body>"
+    "<h1>DTMC live</h1>"
+    "<p>Motor <input id=\"m\" type=\"number\" value=\"0\" min=\"0\" style=\"width:4em\"> every "
+    "<input id=\"d\" type=\"number\" value=\"10\" min=\"1\" style=\"width:5em\"> samples "
+    "<button onclick=\"watch()\">Watch</button></p>"
+    "<table><tr><td>Time</td><td id=\"t\"></td></tr><tr><td>Duty cycle</td><td id=\"u\"></td></tr>"
+    "<tr><td>Velocity (RPM)</td><td id=\"v\"></td></tr><tr><td>Position (deg)</td><td id=\"p\"></td></tr>"
+    "<tr><td>Current (mA)</td><td id=\"c\"></td></tr><tr><td>Samples/s</td><td id=\"r\"></td></tr>"
+    "<tr><td>Skipped</td><td id=\"k\">0</td></tr></table>"
+    "<p>Velocity <input id=\"sv\" type=\"number\" value=\"60\" style=\"width:5em\"> "
+    "<button onclick=\"send({velocity:+sv.value})\">Step</button> "
+    "Position <input id=\"sp\" type=\"number\" value=\"180\" style=\"width:5em\"> "
+    "<button onclick=\"send({position:+sp.value})\">Step</button> "
+    "<button onclick=\"send({stop:1})\">Stop</button></p>"
+    "<script>"
+    "var ws=new WebSocket('ws://'+location.host+'/live'),n=0,s=Date.now();ws.binaryType='arraybuffer';"
+    "function send(o){ws.send(JSON.stringify(o))}"
+    "function watch(){send({motor:+m.value,decimate:+d.value})}"
+    "ws.onopen=watch;"
+    "ws.onmessage=function(e){if(typeof e.data=='string')return;"
+    "var w=new DataView(e.data),c0=w.getUint16(6,true),o=16+(c0-1)*24;n+=c0;"
+    "k.textContent=+k.textContent+w.getUint32(12,true);if(!c0)return;"
+    "t.textContent=new Date(Number(w.getBigUint64(o,true))).toISOString();"
+    "u.textContent=w.getFloat32(o+8,true).toFixed(3);v.textContent=w.getFloat32(o+12,true).toFixed(1);"
+    "p.textContent=w.getFloat32(o+16,true).toFixed(1);c.textContent=w.getFloat32(o+20,true).toFixed(0)};"
+    "setInterval(function(){var x=Date.now();r.textContent=(n*1000/(x-s)).toFixed(0);n=0;s=x},1000);"
+    "</script></body></html>";
+
+static void put_u16(uint8_t *dest, uint16_t value)
+{
+  dest[0] = (uint8_t)value;
+  dest[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *dest, uint32_t value)
+{
+  for (uint32_t i = 0; i < 4; i++)
+    dest[i] = (uint8_t)(value >> (8 * i));
+}
+
+static void put_u64(uint8_t *dest, uint64_t value)
+{
+  for (uint32_t i = 0; i < 8; i++)
+    dest[i] = (uint8_t)(value >> (8 * i));
+}
+
+static void put_f32(uint8_t *dest, float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  put_u32(dest, bits);
+}
+
+// SHA-1, only for the handshake
+static uint32_t rotate_left(uint32_t value, uint32_t bits)
+{
+  return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1_block(uint32_t *state, const uint8_t *block)
+{
+  uint32_t w[80];
+
+  for (uint32_t i = 0; i < 16; i++)
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 |
+           block[4 * i + 3];
+  for (uint32_t i = 16; i < 80; i++)
+    w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+  for (uint32_t i = 0; i < 80; i++)
+  {
+    uint32_t f, k;
+    if (i < 20)
+    {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    }
+    else if (i < 40)
+    {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    }
+    else if (i < 60)
+    {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    }
+    else
+    {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+
+    uint32_t temp = rotate_left(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = rotate_left(b, 30);
+    b = a;
+    a = temp;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+static void sha1(const uint8_t *data, uint32_t length, uint8_t *digest)
+{
+  uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  uint8_t block[64];
+  uint32_t offset = 0;
+
+  for (; offset + 64 <= length; offset += 64)
+    sha1_block(state, data + offset);
+
+  // The padding, one or two blocks
+  uint32_t remaining = length - offset;
+  memset(block, 0, sizeof(block));
+  memcpy(block, data + offset, remaining);
+  block[remaining] = 0x80;
+  if (remaining >= 56)
+  {
+    sha1_block(state, block);
+    memset(block, 0, sizeof(block));
+  }
+  for (uint32_t i = 0; i < 8; i++)
+    block[63 - i] = (uint8_t)(((uint64_t)length * 8) >> (8 * i));
+  sha1_block(state, block);
+
+  for (uint32_t i = 0; i < 20; i++)
+    digest[i] = (uint8_t)(state[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+static void base64(const uint8_t *data, uint32_t length, char *dest)
+{
+  static constexpr char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  for (uint32_t i = 0; i < length; i += 3)
+  {
+    uint32_t value = (uint32_t)data[i] << 16;
+    if (i + 1 < length)
+      value |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < length)
+      value |= data[i + 2];
+
+    *dest++ = ALPHABET[(value >> 18) & 0x3F];
+    *dest++ = ALPHABET[(value >> 12) & 0x3F];
+    *dest++ = i + 1 < length ? ALPHABET[(value >> 6) & 0x3F] : '=';
+    *dest++ = i + 2 < length ? ALPHABET[value & 0x3F] : '=';
+  }
+  *dest = '\0';
+}
+
+static bool name_equals(const char *name, uint32_t length, const char *expected)
+{
+  return strlen(expected) == length && strncasecmp(name, expected, length) == 0;
+}
+
+// The CRLF ending the line that starts at line, searched no further than limit
+static const char *find_line_end(const char *line, const char *limit)
+{
+  for (const char *end = line; end + 1 < limit; end++)
+    if (end[0] == '\r' && end[1] == '\n')
+      return end;
+  return nullptr;
+}
+
+// Value of a query parameter such as motor=1, or false if it is absent or not a number
+static bool query_value(const char *query, uint32_t length, const char *name, uint32_t *value)
+{
+  uint32_t name_length = strlen(name);
+  uint32_t i = 0;
+
+  while (i < length)
+  {
+    uint32_t end = i;
+    while (end < length && query[end] != '&')
+      end++;
+
+    if (end - i > name_length && strncmp(query + i, name, name_length) == 0 && query[i + name_length] == '=')
+    {
+      char number[12];
+      uint32_t digits = end - i - name_length - 1;
+      if (digits == 0 || digits >= sizeof(number))
+        return false;
+      memcpy(number, query + i + name_length + 1, digits);
+      number[digits] = '\0';
+
+      char *parsed;
+      unsigned long result = strtoul(number, &parsed, 10);
+      if (*parsed != '\0')
+        return false;
+      *value = (uint32_t)result;
+      return true;
+    }
+
+    i = end + 1;
+  }
+
+  return false;
+}
+
+LiveRing::LiveRing()
+{
+  samples = nullptr;
+  capacity = 0;
+  head = 0;
+  tail = 0;
+  dropped = 0;
+}
+
+void LiveRing::init(live_sample *samples, uint32_t capacity)
+{
+  this->samples = samples;
+  this->capacity = capacity;
+  head = 0;
+  tail = 0;
+  dropped = 0;
+}
+
+bool LiveRing::push(const live_sample &sample)
+{
+  uint32_t sequence = head.load(std::memory_order_relaxed);
+
+  if (sequence - tail.load(std::memory_order_acquire) >= capacity)
+  {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  samples[sequence & (capacity - 1)] = sample;
+  head.store(sequence + 1, std::memory_order_release);
+  return true;
+}
+
+uint32_t LiveRing::pop(live_sample *dest, uint32_t count, uint32_t *sequence)
+{
+  uint32_t first = tail.load(std::memory_order_relaxed);
+  uint32_t available = head.load(std::memory_order_acquire) - first;
+
+  if (count > available)
+    count = available;
+  for (uint32_t i = 0; i < count; i++)
+    dest[i] = samples[(first + i) & (capacity - 1)];
+
+  tail.store(first + count, std::memory_order_release);
+  *sequence = first;
+  return count;
+}
+
+uint32_t LiveRing::get_dropped()
+{
+  return dropped.load(std::memory_order_relaxed);
+}
+
+LiveServer::LiveServer()
+{
+  pool = nullptr;
+  pool_size = 0;
+  batch = nullptr;
+  for (uint8_t i = 0; i < LIVE_MAX_MOTORS; i++)
+    rings[i] = nullptr;
+
+  listen_fd = -1;
+  port = 0;
+
+  command_callback = nullptr;
+  command_context = nullptr;
+
+  client_count = 0;
+  stream_count = 0;
+  accept_count = 0;
+  reject_count = 0;
+  message_count = 0;
+  sample_count = 0;
+  skip_count = 0;
+  byte_count = 0;
+  command_count = 0;
+  error_count = 0;
+}
+
+LiveServer::~LiveServer()
+{
+  stop();
+}
+
+void LiveServer::init(live_client *pool, uint16_t pool_size, live_sample *batch)
+{
+  this->pool = pool;
+  this->pool_size = pool_size;
+  this->batch = batch;
+
+  for (uint16_t i = 0; i < pool_size; i++)
+  {
+    pool[i].fd = -1;
+    pool[i].state = LIVE_CLIENT_FREE;
+  }
+}
+
+void LiveServer::attach(uint8_t motor, LiveRing *ring)
+{
+  if (motor < LIVE_MAX_MOTORS)
+    rings[motor] = ring;
+}
+
+void LiveServer::set_command_callback(live_command_callback callback, void *context)
+{
+  command_callback = callback;
+  command_context = context;
+}
+
+bool LiveServer::start(uint16_t port, bool any_address)
+{
+  struct sockaddr_in address = {};
+  socklen_t address_length = sizeof(address);
+  int enable = 1;
+
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    return false;
+
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK);
+
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(any_address ? INADDR_ANY : INADDR_LOOPBACK);
+
+  if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listen_fd, pool_size) != 0 ||
+      getsockname(listen_fd, (struct sockaddr *)&address, &address_length) != 0)
+  {
+    close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+
+  this->port = ntohs(address.sin_port);
+  return true;
+}
+
+void LiveServer::stop()
+{
+  for (uint16_t i = 0; i < pool_size; i++)
+    if (pool[i].state != LIVE_CLIENT_FREE)
+      close_client(pool[i]);
+
+  if (listen_fd >= 0)
+    close(listen_fd);
+  listen_fd = -1;
+}
+
+uint16_t LiveServer::get_port()
+{
+  return port;
+}
+
+live_stats LiveServer::get_stats()
+{
+  return {
+      .clients = client_count,
+      .streams = stream_count,
+      .accepted = accept_count,
+      .rejected = reject_count,
+      .messages = message_count,
+      .samples = sample_count,
+      .skipped = skip_count,
+      .bytes = byte_count,
+      .commands = command_count,
+      .protocol_errors = error_count,
+  };
+}
+
+void LiveServer::accept_key(const char *key, uint32_t length, char *dest)
+{
+  uint8_t text[LIVE_INPUT_SIZE + sizeof(WEBSOCKET_GUID)];
+  uint8_t digest[20];
+
+  if (length > LIVE_INPUT_SIZE)
+    length = LIVE_INPUT_SIZE;
+  memcpy(text, key, length);
+  memcpy(text + length, WEBSOCKET_GUID, sizeof(WEBSOCKET_GUID) - 1);
+
+  sha1(text, length + sizeof(WEBSOCKET_GUID) - 1, digest);
+  base64(digest, sizeof(digest), dest);
+}
+
+void LiveServer::flush()
+{
+  // A client that kept up through the last RECOVER_FLUSHES gets half its decimation back
+  for (uint16_t i = 0; i < pool_size; i++)
+  {
+    live_client &client = pool[i];
+    if (client.state != LIVE_CLIENT_STREAM)
+      continue;
+
+    if (client.output_offset < client.output_length)
+      client.drained = 0;
+    else if (client.decimation > client.requested && ++client.drained >= RECOVER_FLUSHES)
+    {
+      client.decimation = client.decimation / 2 > client.requested ? client.decimation / 2 : client.requested;
+      client.drained = 0;
+    }
+  }
+
+  for (uint8_t motor = 0; motor < LIVE_MAX_MOTORS; motor++)
+  {
+    if (rings[motor] == nullptr)
+      continue;
+
+    uint32_t sequence;
+    uint32_t count;
+    do
+    {
+      count = rings[motor]->pop(batch, BATCH_SIZE, &sequence);
+      for (uint16_t i = 0; i < pool_size && count > 0; i++)
+        if (pool[i].state == LIVE_CLIENT_STREAM && pool[i].motor == motor)
+          send_samples(pool[i], motor, sequence, count);
+    } while (count == BATCH_SIZE);
+  }
+
+  for (uint16_t i = 0; i < pool_size; i++)
+    if (pool[i].state != LIVE_CLIENT_FREE && pool[i].output_offset < pool[i].output_length)
+      write_client(pool[i]);
+}
+
+void LiveServer::poll(uint32_t timeout_ms)
+{
+  fd_set readable;
+  fd_set writable;
+  int max_fd = listen_fd;
+
+  if (listen_fd < 0)
+    return;
+
+  FD_ZERO(&readable);
+  FD_ZERO(&writable);
+  FD_SET(listen_fd, &readable);
+  for (uint16_t i = 0; i < pool_size; i++)
+  {
+    if (pool[i].state == LIVE_CLIENT_FREE)
+      continue;
+
+    FD_SET(pool[i].fd, &readable);
+    if (pool[i].output_offset < pool[i].output_length)
+      FD_SET(pool[i].fd, &writable);
+    if (pool[i].fd > max_fd)
+      max_fd = pool[i].fd;
+  }
+
+  struct timeval timeout = {
+      .tv_sec = (time_t)(timeout_ms / 1000),
+      .tv_usec = (suseconds_t)(timeout_ms % 1000 * 1000),
+  };
+  if (select(max_fd + 1, &readable, &writable, nullptr, &timeout) <= 0)
+    return;
+
+  // Sockets accepted now were not in the sets, those closed below are not reused before the next poll
+  for (uint16_t i = 0; i < pool_size; i++)
+  {
+    live_client &client = pool[i];
+    if (client.state != LIVE_CLIENT_FREE && FD_ISSET(client.fd, &writable))
+      write_client(client);
+    if (client.state != LIVE_CLIENT_FREE && FD_ISSET(client.fd, &readable))
+      read_client(client);
+  }
+
+  if (FD_ISSET(listen_fd, &readable))
+    accept_clients();
+}
+
+void LiveServer::accept_clients()
+{
+  while (true)
+  {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+      return;
+
+    live_client *client = nullptr;
+    for (uint16_t i = 0; i < pool_size && client == nullptr; i++)
+      if (pool[i].state == LIVE_CLIENT_FREE)
+        client = &pool[i];
+
+    if (client == nullptr || fd >= FD_SETSIZE)
+    {
+      // Best effort, the socket's buffer is empty
+      send(fd, RESPONSE_UNAVAILABLE, sizeof(RESPONSE_UNAVAILABLE) - 1, MSG_NOSIGNAL);
+      close(fd);
+      reject_count++;
+      continue;
+    }
+
+    int enable = 1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &SEND_BUFFER_SIZE, sizeof(SEND_BUFFER_SIZE));
+
+    client->fd = fd;
+    client->state = LIVE_CLIENT_REQUEST;
+    client->motor = 0;
+    client->requested = 1;
+    client->decimation = 1;
+    client->drained = 0;
+    client->skipped = 0;
+    client->input_length = 0;
+    client->output_length = 0;
+    client->output_offset = 0;
+
+    client_count++;
+    accept_count++;
+  }
+}
+
+void LiveServer::read_client(live_client &client)
+{
+  ssize_t received = recv(client.fd, client.input + client.input_length, LIVE_INPUT_SIZE - client.input_length, 0);
+
+  if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+  {
+    close_client(client);
+    return;
+  }
+  if (received < 0)
+    return;
+
+  client.input_length += received;
+
+  bool open = true;
+  if (client.state == LIVE_CLIENT_REQUEST)
+    open = handle_request(client);
+  if (open && client.state == LIVE_CLIENT_STREAM)
+    open = handle_frames(client);
+  if (client.state == LIVE_CLIENT_CLOSING)
+    client.input_length = 0;
+  if (!open)
+    error_count++;
+
+  // Responses go out now rather than on the next poll
+  write_client(client);
+}
+
+// Returns false if the request was refused, its response is queued and the client closing
+bool LiveServer::handle_request(live_client &client)
+{
+  const char *text = (const char *)client.input;
+  uint32_t length = 0;
+
+  for (uint32_t i = 0; i + 3 < client.input_length && length == 0; i++)
+    if (memcmp(text + i, "\r\n\r\n", 4) == 0)
+      length = i + 4;
+
+  if (length == 0)
+  {
+    if (client.input_length < LIVE_INPUT_SIZE)
+      return true;
+    queue(client, RESPONSE_TOO_LARGE, sizeof(RESPONSE_TOO_LARGE) - 1);
+    client.state = LIVE_CLIENT_CLOSING;
+    return false;
+  }
+
+  // The request ends in an empty line, so every line ends before it. The input is not terminated
+  // and a line may hold a NUL, the search is bounded by the request rather than left to strstr.
+  const char *response = nullptr;
+  const char *line_end = find_line_end(text, text + length);
+  const char *path = text + 4;
+  const char *path_end = nullptr;
+
+  if (memchr(text, '\0', length) != nullptr)
+    response = RESPONSE_BAD_REQUEST;
+  else if (line_end - text < 4 || strncmp(text, "GET ", 4) != 0)
+    response = RESPONSE_NOT_ALLOWED;
+  else if ((path_end = (const char *)memchr(path, ' ', line_end - path)) == nullptr)
+    response = RESPONSE_BAD_REQUEST;
+
+  // Only the headers of the upgrade matter
+  const char *key = nullptr;
+  uint32_t key_length = 0;
+  bool upgrade = false;
+  for (const char *line = line_end + 2; response == nullptr && line < text + length - 2;)
+  {
+    const char *end = find_line_end(line, text + length);
+    const char *colon = (const char *)memchr(line, ':', end - line);
+    if (colon != nullptr)
+    {
+      const char *value = colon + 1;
+      while (value < end && *value == ' ')
+        value++;
+
+      if (name_equals(line, colon - line, "upgrade"))
+        upgrade = name_equals(value, end - value, "websocket");
+      else if (name_equals(line, colon - line, "sec-websocket-key"))
+      {
+        key = value;
+        key_length = end - value;
+      }
+    }
+    line = end + 2;
+  }
+
+  const char *query = nullptr;
+  uint32_t path_length = 0;
+  uint32_t query_length = 0;
+  if (response == nullptr)
+  {
+    query = (const char *)memchr(path, '?', path_end - path);
+    path_length = (query != nullptr ? query : path_end) - path;
+    if (query != nullptr)
+    {
+      query++;
+      query_length = path_end - query;
+    }
+  }
+
+  if (response == nullptr && path_length == 1 && path[0] == '/')
+  {
+    char header[128];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: %u\r\n"
+                                 "Connection: close\r\n\r\n",
+                                 (unsigned)(sizeof(PAGE) - 1));
+    queue(client, header, header_length);
+    queue(client, PAGE, sizeof(PAGE) - 1);
+    client.state = LIVE_CLIENT_CLOSING;
+  }
+  else if (response == nullptr && path_length == 5 && strncmp(path, "/live", 5) == 0)
+  {
+    uint32_t motor = 0;
+    uint32_t decimation = 1;
+    if (query != nullptr)
+    {
+      query_value(query, query_length, "motor", &motor);
+      query_value(query, query_length, "decimate", &decimation);
+    }
+
+    if (!upgrade || key == nullptr || decimation < 1 || decimation > MAX_DECIMATION)
+      response = RESPONSE_BAD_REQUEST;
+    else if (motor >= LIVE_MAX_MOTORS || rings[motor] == nullptr)
+      response = RESPONSE_NOT_FOUND;
+    else
+    {
+      char accept[29];
+      char header[160];
+      accept_key(key, key_length, accept);
+      int header_length = snprintf(header, sizeof(header),
+                                   "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                                   "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n",
+                                   accept);
+      queue(client, header, header_length);
+
+      client.state = LIVE_CLIENT_STREAM;
+      client.motor = motor;
+      client.requested = decimation;
+      client.decimation = decimation;
+      stream_count++;
+    }
+  }
+  else if (response == nullptr)
+    response = RESPONSE_NOT_FOUND;
+
+  if (response != nullptr)
+  {
+    queue(client, response, strlen(response));
+    client.state = LIVE_CLIENT_CLOSING;
+    return false;
+  }
+
+  // A client may send its first frames with the request
+  memmove(client.input, client.input + length, client.input_length - length);
+  client.input_length -= length;
+  return true;
+}
+
+// Returns false if a frame broke the protocol, its close frame is queued
+bool LiveServer::handle_frames(live_client &client)
+{
+  while (client.state == LIVE_CLIENT_STREAM && client.input_length >= 2)
+  {
+    uint8_t *frame = client.input;
+    bool final = frame[0] & 0x80;
+    uint8_t opcode = frame[0] & 0x0F;
+    bool masked = frame[1] & 0x80;
+    uint32_t length = frame[1] & 0x7F;
+    uint32_t header = 2;
+    uint16_t status = 0;
+
+    if (length == 126)
+    {
+      if (client.input_length < 4)
+        break;
+      length = (uint32_t)frame[2] << 8 | frame[3];
+      header = 4;
+    }
+
+    if (!masked)
+      status = CLOSE_PROTOCOL_ERROR;
+    else if (length == 127 || header + 4 + length > LIVE_INPUT_SIZE)
+      status = CLOSE_TOO_BIG;
+    else if (!final || opcode == OPCODE_CONTINUATION || opcode == OPCODE_BINARY)
+      status = CLOSE_UNSUPPORTED;
+    else if (opcode != OPCODE_TEXT && opcode != OPCODE_CLOSE && opcode != OPCODE_PING && opcode != OPCODE_PONG)
+      status = CLOSE_PROTOCOL_ERROR;
+
+    if (status != 0)
+    {
+      uint8_t payload[2] = {(uint8_t)(status >> 8), (uint8_t)status};
+      queue_frame(client, OPCODE_CLOSE, payload, sizeof(payload));
+      client.state = LIVE_CLIENT_CLOSING;
+      stream_count--;
+      return false;
+    }
+
+    if (client.input_length < header + 4 + length)
+      break;
+
+    uint8_t *mask = frame + header;
+    uint8_t *payload = mask + 4;
+    for (uint32_t i = 0; i < length; i++)
+      payload[i] ^= mask[i % 4];
+
+    if (opcode == OPCODE_TEXT)
+    {
+      command_count++;
+      bool ok = handle_command(client, (const char *)payload, length);
+      queue_text(client, ok ? "{\"ok\":true}" : "{\"ok\":false}");
+    }
+    else if (opcode == OPCODE_PING)
+      queue_frame(client, OPCODE_PONG, payload, length);
+    else if (opcode == OPCODE_CLOSE)
+    {
+      // Echoes the status, the client closes the connection
+      queue_frame(client, OPCODE_CLOSE, payload, length >= 2 ? 2 : 0);
+      client.state = LIVE_CLIENT_CLOSING;
+      stream_count--;
+    }
+
+    uint32_t consumed = header + 4 + length;
+    memmove(client.input, client.input + consumed, client.input_length - consumed);
+    client.input_length -= consumed;
+  }
+
+  return true;
+}
+
+bool LiveServer::handle_command(live_client &client, const char *text, uint32_t length)
+{
+  char object[MAX_COMMAND_LENGTH];
+  float values[6];
+  bool present[6] = {};
+  static constexpr const char *KEYS[6] = {"motor", "decimate", "mode", "velocity", "position", "stop"};
+
+  if (length >= sizeof(object))
+    return false;
+  memcpy(object, text, length);
+  object[length] = '\0';
+
+  // A flat object of numbers, applied once it has all parsed
+  const char *cursor = object;
+  while (*cursor == ' ')
+    cursor++;
+  if (*cursor++ != '{')
+    return false;
+
+  while (true)
+  {
+    while (*cursor == ' ' || *cursor == ',')
+      cursor++;
+    if (*cursor == '}')
+      break;
+    if (*cursor++ != '"')
+      return false;
+
+    const char *name = cursor;
+    const char *name_end = strchr(name, '"');
+    if (name_end == nullptr)
+      return false;
+
+    uint32_t key = 0;
+    while (key < 6 && !name_equals(name, name_end - name, KEYS[key]))
+      key++;
+    if (key == 6)
+      return false;
+
+    cursor = name_end + 1;
+    while (*cursor == ' ')
+      cursor++;
+    if (*cursor++ != ':')
+      return false;
+
+    char *number_end;
+    values[key] = strtof(cursor, &number_end);
+    if (number_end == cursor)
+      return false;
+    present[key] = true;
+    cursor = number_end;
+  }
+
+  if (present[0])
+  {
+    if (values[0] < 0 || values[0] >= LIVE_MAX_MOTORS || rings[(uint8_t)values[0]] == nullptr)
+      return false;
+    client.motor = (uint8_t)values[0];
+  }
+
+  if (present[1])
+  {
+    if (values[1] < 1 || values[1] > MAX_DECIMATION)
+      return false;
+    client.requested = (uint16_t)values[1];
+    client.decimation = client.requested;
+    client.drained = 0;
+  }
+
+  static constexpr LiveCommand COMMANDS[4] = {LIVE_COMMAND_MODE, LIVE_COMMAND_VELOCITY, LIVE_COMMAND_POSITION,
+                                              LIVE_COMMAND_STOP};
+  bool ok = true;
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    if (!present[i + 2])
+      continue;
+    if (command_callback == nullptr)
+      return false;
+
+    live_command command = {
+        .motor = client.motor,
+        .command = COMMANDS[i],
+        .value = values[i + 2],
+    };
+    ok = command_callback(command, command_context) && ok;
+  }
+
+  return ok;
+}
+
+// Samples of a batch whose sequence is a multiple of the decimation, from the first of them
+static uint32_t decimate(uint32_t sequence, uint32_t count, uint32_t decimation, uint32_t *first)
+{
+  *first = (decimation - sequence % decimation) % decimation;
+  return *first < count ? (count - *first + decimation - 1) / decimation : 0;
+}
+
+void LiveServer::send_samples(live_client &client, uint8_t motor, uint32_t sequence, uint32_t count)
+{
+  uint32_t decimation = client.decimation;
+  uint32_t first;
+  uint32_t wanted = decimate(sequence, count, client.requested, &first);
+  uint32_t selected = decimate(sequence, count, decimation, &first);
+
+  // Skipped counts what the client asked for and was not sent, held back or thinned out
+  uint32_t length = LIVE_HEADER_SIZE + selected * LIVE_SAMPLE_SIZE;
+  if (selected > 0 && (client.output_length - client.output_offset > BACKLOG ||
+                       client.output_length - client.output_offset + length + 4 > LIVE_OUTPUT_SIZE))
+  {
+    // Behind: the client is sent fewer samples until it catches up
+    client.decimation = decimation * 2 < MAX_DECIMATION ? decimation * 2 : MAX_DECIMATION;
+    client.drained = 0;
+    selected = 0;
+  }
+
+  client.skipped += wanted - selected;
+  skip_count += wanted - selected;
+  if (selected == 0)
+    return;
+
+  uint8_t message[LIVE_HEADER_SIZE + BATCH_SIZE * LIVE_SAMPLE_SIZE];
+  message[0] = LIVE_MAGIC[0];
+  message[1] = LIVE_MAGIC[1];
+  message[2] = LIVE_VERSION;
+  message[3] = motor;
+  put_u16(message + 4, decimation);
+  put_u16(message + 6, selected);
+  put_u32(message + 8, sequence + first);
+  put_u32(message + 12, client.skipped);
+
+  uint8_t *dest = message + LIVE_HEADER_SIZE;
+  for (uint32_t i = first; i < count; i += decimation)
+  {
+    const live_sample &sample = batch[i];
+    put_u64(dest, sample.timestamp);
+    put_f32(dest + 8, sample.duty_cycle);
+    put_f32(dest + 12, sample.velocity);
+    put_f32(dest + 16, sample.position);
+    put_f32(dest + 20, sample.current);
+    dest += LIVE_SAMPLE_SIZE;
+  }
+
+  queue_frame(client, OPCODE_BINARY, message, length);
+  client.skipped = 0;
+  message_count++;
+  sample_count += selected;
+
+  // Output left over after this is what the socket would not take
+  write_client(client);
+}
+
+bool LiveServer::queue(live_client &client, const void *data, uint32_t length)
+{
+  if (client.output_offset == client.output_length)
+    client.output_offset = client.output_length = 0;
+
+  if (client.output_length + length > LIVE_OUTPUT_SIZE)
+  {
+    // Room once what was sent is dropped from the front
+    if (client.output_length - client.output_offset + length > LIVE_OUTPUT_SIZE)
+      return false;
+    memmove(client.output, client.output + client.output_offset, client.output_length - client.output_offset);
+    client.output_length -= client.output_offset;
+    client.output_offset = 0;
+  }
+
+  memcpy(client.output + client.output_length, data, length);
+  client.output_length += length;
+  return true;
+}
+
+bool LiveServer::queue_frame(live_client &client, uint8_t opcode, const void *payload, uint32_t length)
+{
+  uint8_t header[4];
+  uint32_t header_length = 2;
+
+  // Server frames are never masked nor fragmented
+  header[0] = 0x80 | opcode;
+  if (length < 126)
+    header[1] = (uint8_t)length;
+  else
+  {
+    header[1] = 126;
+    header[2] = (uint8_t)(length >> 8);
+    header[3] = (uint8_t)length;
+    header_length = 4;
+  }
+
+  if (client.output_length - client.output_offset + header_length + length > LIVE_OUTPUT_SIZE)
+    return false;
+  return queue(client, header, header_length) && queue(client, payload, length);
+}
+
+bool LiveServer::queue_text(live_client &client, const char *text)
+{
+  return queue_frame(client, OPCODE_TEXT, text, strlen(text));
+}
+
+void LiveServer::write_client(live_client &client)
+{
+  while (client.output_offset < client.output_length)
+  {
+    ssize_t sent = send(client.fd, client.output + client.output_offset, client.output_length - client.output_offset,
+                        MSG_NOSIGNAL);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (sent <= 0)
+    {
+      close_client(client);
+      return;
+    }
+
+    client.output_offset += sent;
+    byte_count += sent;
+  }
+
+  client.output_offset = client.output_length = 0;
+  if (client.state == LIVE_CLIENT_CLOSING)
+    close_client(client);
+}
+
+void LiveServer::close_client(live_client &client)
+{
+  if (client.state == LIVE_CLIENT_STREAM)
+    stream_count--;
+  if (client.state != LIVE_CLIENT_FREE)
+    client_count--;
+
+  close(client.fd);
+  client.fd = -1;
+  client.state = LIVE_CLIENT_FREE;
+}
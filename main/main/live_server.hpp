@@ -0,0 +1,193 @@
+#ifndef LIVE_SERVER_H_
+#define LIVE_SERVER_H_
+
+// Includes
+#include <stdint.h>
+#include <atomic>
+
+// Live telemetry on the lab LAN: an HTTP server with one WebSocket endpoint, /live, that
+// streams every update task sample of a motor, or every Nth, as binary messages a few tens of
+// ms after it was taken, and takes set points back as text. Nothing here depends on the
+// ESP-IDF, the station serves it on lwIP's sockets and host/live on Linux's, so the same code
+// is load-tested with hundreds of clients.
+//
+// Message layout, decoded by python_scripts/telemetry_codec.py:
+// "DL", version (u8), motor (u8), decimation (u16), sample count (u16), sequence of the first
+// sample (u32), samples this client asked for and was not sent since its last message (u32),
+// then per sample the timestamp in Unix ms (u64), duty cycle, velocity, position and current
+// (f32). Samples are those whose sequence is a multiple of the decimation, which is raised while
+// the client falls behind. All values are little-endian.
+//
+// Commands are flat JSON objects of numbers, each key optional:
+// {"motor":0,"decimate":10,"mode":3,"velocity":90,"position":180,"stop":1}
+// "motor" and "decimate" change what the client is sent, the rest go to the command callback
+// for that motor. Each is answered with {"ok":true} or {"ok":false}.
+
+static constexpr uint8_t LIVE_VERSION = 1;
+static constexpr uint32_t LIVE_HEADER_SIZE = 16;
+static constexpr uint32_t LIVE_SAMPLE_SIZE = sizeof(uint64_t) + 4 * sizeof(float);
+static constexpr uint8_t LIVE_MAX_MOTORS = 8;
+
+// One sample of the update task
+typedef struct
+{
+  uint64_t timestamp; // Unix time in ms
+  float duty_cycle;
+  float velocity;
+  float position;
+  float current;
+} live_sample;
+
+// Samples from the update task to the server's task, one producer and one consumer, neither
+// blocks. A full ring drops the newest sample, the sequence numbers only count those kept.
+class LiveRing
+{
+private:
+  // Class variables
+  live_sample *samples;
+  uint32_t capacity; // Power of two
+  std::atomic<uint32_t> head; // Sequence of the next sample pushed
+  std::atomic<uint32_t> tail; // Sequence of the next sample popped
+  std::atomic<uint32_t> dropped;
+
+public:
+  LiveRing();
+
+  void init(live_sample *samples, uint32_t capacity);
+
+  bool push(const live_sample &sample);
+  uint32_t pop(live_sample *dest, uint32_t count, uint32_t *sequence);
+
+  uint32_t get_dropped();
+};
+
+enum LiveCommand : uint8_t
+{
+  LIVE_COMMAND_MODE = 0,     // value is the controller mode
+  LIVE_COMMAND_VELOCITY = 1, // RPM, the motor steps to it in velocity mode
+  LIVE_COMMAND_POSITION = 2, // Degrees, the motor steps to it in position mode
+  LIVE_COMMAND_STOP = 3,     // Every motor
+};
+
+typedef struct
+{
+  uint8_t motor;
+  LiveCommand command;
+  float value;
+} live_command;
+
+// Called on the server's task, returns false if the command was refused
+typedef bool (*live_command_callback)(const live_command &command, void *context);
+
+enum LiveClientState : uint8_t
+{
+  LIVE_CLIENT_FREE = 0,
+  LIVE_CLIENT_REQUEST = 1, // Reading the HTTP request
+  LIVE_CLIENT_STREAM = 2,  // Upgraded to a WebSocket
+  LIVE_CLIENT_CLOSING = 3, // Closed once its output is sent
+};
+
+static constexpr uint32_t LIVE_INPUT_SIZE = 1024;  // Request headers or one client frame
+static constexpr uint32_t LIVE_OUTPUT_SIZE = 4096; // Queued messages, the page or a response
+
+// One slot of the connection pool, the caller provides them so they can come from an arena
+typedef struct
+{
+  int fd;
+  LiveClientState state;
+  uint8_t motor;
+  uint16_t requested;     // Decimation the client asked for
+  uint16_t decimation;    // In effect, raised while the client falls behind
+  uint16_t drained;       // Flushes in a row that found its output sent
+  uint32_t skipped;       // Samples asked for and not sent since its last message
+  uint32_t input_length;
+  uint32_t output_length;
+  uint32_t output_offset; // Sent so far
+  uint8_t input[LIVE_INPUT_SIZE];
+  uint8_t output[LIVE_OUTPUT_SIZE];
+} live_client;
+
+typedef struct
+{
+  uint32_t clients;         // Connected, including those still sending their request
+  uint32_t streams;         // Upgraded to a WebSocket
+  uint64_t accepted;
+  uint64_t rejected;        // Turned away with the pool full
+  uint64_t messages;        // Sample messages queued
+  uint64_t samples;         // Samples in those messages
+  uint64_t skipped;         // Samples clients asked for and were not sent while behind
+  uint64_t bytes;           // Sent
+  uint64_t commands;        // Commands received
+  uint64_t protocol_errors; // Requests and frames that closed their connection
+} live_stats;
+
+class LiveServer
+{
+public:
+  static constexpr uint32_t BATCH_SIZE = 64;        // Samples a flush takes from a ring at a time
+  static constexpr uint16_t MAX_DECIMATION = 1000;  // One sample a second at 1 kHz
+  static constexpr uint16_t RECOVER_FLUSHES = 25;   // Drained in a row before the decimation halves
+  static constexpr uint32_t BACKLOG = LIVE_OUTPUT_SIZE / 4; // Queued bytes that mark a client as behind
+
+private:
+  // Class variables
+  live_client *pool;
+  uint16_t pool_size;
+  live_sample *batch;
+  LiveRing *rings[LIVE_MAX_MOTORS];
+
+  int listen_fd;
+  uint16_t port;
+
+  live_command_callback command_callback;
+  void *command_context;
+
+  std::atomic<uint32_t> client_count;
+  std::atomic<uint32_t> stream_count;
+  std::atomic<uint64_t> accept_count;
+  std::atomic<uint64_t> reject_count;
+  std::atomic<uint64_t> message_count;
+  std::atomic<uint64_t> sample_count;
+  std::atomic<uint64_t> skip_count;
+  std::atomic<uint64_t> byte_count;
+  std::atomic<uint64_t> command_count;
+  std::atomic<uint64_t> error_count;
+
+  void accept_clients();
+  void read_client(live_client &client);
+  bool handle_request(live_client &client);
+  bool handle_frames(live_client &client);
+  bool handle_command(live_client &client, const char *text, uint32_t length);
+  void send_samples(live_client &client, uint8_t motor, uint32_t sequence, uint32_t count);
+  bool queue(live_client &client, const void *data, uint32_t length);
+  bool queue_frame(live_client &client, uint8_t opcode, const void *payload, uint32_t length);
+  bool queue_text(live_client &client, const char *text);
+  void write_client(live_client &client);
+  void close_client(live_client &client);
+
+public:
+  LiveServer();
+  ~LiveServer();
+
+  // The pool bounds the connections, batch holds BATCH_SIZE samples
+  void init(live_client *pool, uint16_t pool_size, live_sample *batch);
+  void attach(uint8_t motor, LiveRing *ring);
+  void set_command_callback(live_command_callback callback, void *context);
+
+  // Listens on every interface, or the loopback one only, port 0 picks a free one
+  bool start(uint16_t port, bool any_address);
+  void stop();
+
+  // Both on the server's task: flush() sends what the rings hold, poll() serves the sockets
+  // for up to timeout_ms
+  void flush();
+  void poll(uint32_t timeout_ms);
+
+  uint16_t get_port();
+  live_stats get_stats();
+
+  // Sec-WebSocket-Accept for a client's Sec-WebSocket-Key, dest holds 29 bytes
+  static void accept_key(const char *key, uint32_t length, char *dest);
+};
+
+#endif // LIVE_SERVER_H_
@@ -3,20 +3,189 @@
 #include <string.h>
 
 #include "azure_iot_freertos.h"
+#include "memory_budget.h"
 #include "motor_controller.hpp"
+#include "live_server.hpp"
+#include "recorder.hpp"
+#include "startup.h"
 
 #include "freertos/FreeRTOS.h"
 
 static constexpr char *TAG = "Main";
 
-static MotorController motor;
+// Without a network the boot is reported after this long, with the stages still pending
+static constexpr uint32_t STARTUP_REPORT_TIMEOUT_MS = 30000;
+
+static MotorController motors[MOTOR_COUNT];
+
+// Requests about one motor carry its index as their payload
+static void publish_sample(uint8_t motor)
+{
+  // The summary goes first, it is what keeps the digital twin current
+  azure_request_publish(AZURE_REQUEST_SUMMARY, &motor, sizeof(motor));
+  azure_request_publish(AZURE_REQUEST_TELEMETRY, &motor, sizeof(motor));
+}
+
+static void publish_capture(uint8_t motor)
+{
+  azure_request_publish(AZURE_REQUEST_CAPTURE, &motor, sizeof(motor));
+}
+
+static void publish_spectrum(uint8_t motor)
+{
+  azure_request_publish(AZURE_REQUEST_SPECTRUM, &motor, sizeof(motor));
+}
+
+static void publish_fault(uint8_t motor)
+{
+  azure_request_publish(AZURE_REQUEST_FAULT, &motor, sizeof(motor));
+}
+
+static void publish_system_id(uint8_t motor)
+{
+  azure_request_publish(AZURE_REQUEST_SYSTEM_ID, &motor, sizeof(motor));
+}
+
+static void publish_gain_schedule(uint8_t motor)
+{
+  azure_request_publish(AZURE_REQUEST_GAIN_SCHEDULE, &motor, sizeof(motor));
+}
+
+static void publish_actuator(uint8_t motor)
+{
+  azure_request_publish(AZURE_REQUEST_ACTUATOR, &motor, sizeof(motor));
+}
+
+// Control starts on the compiled defaults and switches over once NVS is up
+static void load_calibration()
+{
+  for (MotorController &motor : motors)
+    motor.load_calibration();
+  startup_complete(STARTUP_STAGE_CALIBRATION);
+}
+
+// Motors after the first report as their motor<N> component, the report's members are moved
+// inside it. Returns 0 if the result does not fit.
+static uint32_t nest_report(uint8_t motor, char *dest, uint32_t length, uint32_t size)
+{
+  char prefix[32];
+  int prefix_length;
+
+  if (motor == 0 || length < 2)
+    return length;
+
+  prefix_length = snprintf(prefix, sizeof(prefix), "{\"motor%u\":{\"__t\":\"c\",", motor);
+  if (prefix_length + length + 1 > size)
+    return 0;
+
+  memmove(dest + prefix_length, dest + 1, length - 1);
+  memcpy(dest, prefix, prefix_length);
+  length += prefix_length - 1;
+  dest[length++] = '}';
+  dest[length] = '\0';
+
+  return length;
+}
+
+#ifdef CONFIG_DTMC_LIVE
+static LiveServer live_server;
+static TaskHandle_t live_task_hdl = NULL;
+
+// Commands from the live page go through the same calls as direct methods, so they are recorded
+static bool live_command_received(const live_command &command, void *context)
+{
+  switch (command.command)
+  {
+  case LIVE_COMMAND_MODE:
+    if (command.value < OFF || command.value > AUTO_VELOCITY)
+      return false;
+    set_desired_mode(command.motor, (int32_t)command.value);
+    return true;
+  case LIVE_COMMAND_VELOCITY:
+    step_desired_velocity(command.motor, command.value);
+    return true;
+  case LIVE_COMMAND_POSITION:
+    step_desired_position(command.motor, command.value);
+    return true;
+  case LIVE_COMMAND_STOP:
+    emergency_stop();
+    return true;
+  }
+  return false;
+}
+
+// The rings fill from boot, they are drained until the station has an address to serve them on
+static void live_task(void *arg)
+{
+  while (!startup_wait(STARTUP_BIT(STARTUP_STAGE_WIFI), pdMS_TO_TICKS(live_config.delay)))
+    live_server.flush();
+
+  if (!live_server.start(CONFIG_DTMC_LIVE_PORT, true))
+  {
+    ESP_LOGE(TAG, "Failed to serve live telemetry on port %u.", CONFIG_DTMC_LIVE_PORT);
+    live_task_hdl = NULL;
+    vTaskDelete(NULL);
+  }
+  ESP_LOGI(TAG, "Serving live telemetry on port %u.", live_server.get_port());
+
+  while (1)
+  {
+    live_server.flush();
+    live_server.poll(live_config.delay);
+  }
+}
+
+static void start_live()
+{
+  live_client *pool = static_cast<live_client *>(memory_reserve(MEMORY_ARENA_LIVE, CONFIG_DTMC_LIVE_MAX_CLIENTS * sizeof(live_client)));
+  live_sample *batch = static_cast<live_sample *>(memory_reserve(MEMORY_ARENA_LIVE, LiveServer::BATCH_SIZE * sizeof(live_sample)));
+
+  live_server.init(pool, CONFIG_DTMC_LIVE_MAX_CLIENTS, batch);
+  for (uint8_t i = 0; i < MOTOR_COUNT; i++)
+    live_server.attach(i, motors[i].get_live_ring());
+  live_server.set_command_callback(live_command_received, nullptr);
+
+  xTaskCreatePinnedToCore(live_task, "Live Task", live_config.stack_size, nullptr, live_config.priority, &live_task_hdl, live_config.core);
+}
+#endif
 
 extern "C" void app_main(void)
 {
   // float temp_duty_cycle = 0;
 
-  motor.init();
+  startup_init();
+
+  // Control and local UART streaming do not wait on the network
+  startup_begin(STARTUP_STAGE_CONTROL);
+#ifdef CONFIG_DTMC_RECORDER
+  // Ahead of the controllers, so the log holds their zeroing
+  recorder().start();
+#endif
+  for (uint8_t i = 0; i < MOTOR_COUNT; i++)
+  {
+    motors[i].set_sample_callback(publish_sample);
+    motors[i].set_capture_callback(publish_capture);
+    motors[i].set_spectrum_callback(publish_spectrum);
+    motors[i].set_fault_callback(publish_fault);
+    motors[i].set_system_id_callback(publish_system_id);
+    motors[i].set_autotune_callback(publish_gain_schedule);
+    motors[i].set_calibration_callback(publish_actuator);
+    motors[i].init(i);
+  }
+#ifdef CONFIG_DTMC_LIVE
+  start_live();
+#endif
+  memory_lock();
+  startup_complete(STARTUP_STAGE_CONTROL);
+
+  // Storage, Wi-Fi, SNTP, provisioning and MQTT come up in the background
   azure_init();
+  startup_launch(STARTUP_STAGE_CALIBRATION, load_calibration, STARTUP_BIT(STARTUP_STAGE_STORAGE));
+
+  if (!startup_wait(STARTUP_BIT(STARTUP_STAGE_TELEMETRY), pdMS_TO_TICKS(STARTUP_REPORT_TIMEOUT_MS)))
+    ESP_LOGW(TAG, "No telemetry published %lu ms after boot.", (unsigned long)STARTUP_REPORT_TIMEOUT_MS);
+  startup_report();
+  memory_report();
   // motor.enable_display();
 
   // motor.set_mode(AUTO);
@@ -43,53 +212,237 @@ extern "C" void app_main(void)
   // }
 }
 
-void get_data(uint64_t *timestamp, int32_t *direction, float *duty_cycle, float *velocity, float *position, float *current)
+void get_data(uint8_t motor, uint64_t *timestamp, int32_t *direction, float *duty_cycle, float *velocity, float *position, float *current)
+{
+  *timestamp = motors[motor].get_timestamp();
+  *direction = motors[motor].get_direction();
+  *duty_cycle = motors[motor].get_duty_cycle();
+  *velocity = motors[motor].get_velocity();
+  *position = motors[motor].get_position();
+  *current = motors[motor].get_current();
+}
+
+// Commands are recorded as the controller receives them, see RecordParameter
+void set_desired_mode(uint8_t motor, int32_t mode)
+{
+  recorder().add_parameter(motor, PARAMETER_MODE, {(float)mode});
+  motors[motor].set_mode(mode);
+}
+
+void set_desired_gain(uint8_t motor, float gain)
 {
-  *timestamp = motor.get_timestamp();
-  *direction = motor.get_direction();
-  *duty_cycle = motor.get_duty_cycle();
-  *velocity = motor.get_velocity();
-  *position = motor.get_position();
-  *current = motor.get_current();
+  recorder().add_parameter(motor, PARAMETER_GAIN, {gain});
+  motors[motor].set_gain(gain);
 }
 
-void set_desired_mode(int32_t mode)
+void set_desired_frequency(uint8_t motor, float freq)
 {
-  motor.set_mode(mode);
+  recorder().add_parameter(motor, PARAMETER_FREQUENCY, {freq});
+  motors[motor].set_frequency(freq);
 }
 
-void set_desired_gain(float gain)
+void set_desired_position(uint8_t motor, float position)
 {
-  motor.set_gain(gain);
+  recorder().add_parameter(motor, PARAMETER_POSITION, {position});
+  motors[motor].set_position(position);
 }
 
-void set_desired_frequency(float freq)
+void set_desired_velocity(uint8_t motor, float velocity)
 {
-  motor.set_frequency(freq);
+  recorder().add_parameter(motor, PARAMETER_VELOCITY, {velocity});
+  motors[motor].set_velocity(velocity);
 }
 
-void set_desired_position(float position)
+void step_desired_position(uint8_t motor, float position)
 {
-  motor.set_position(position);
+  // Set point first so the PID task never runs a tick against the old target
+  set_desired_position(motor, position);
+  set_desired_mode(motor, AUTO_POSITION);
 }
 
-void set_desired_velocity(float velocity)
+void step_desired_velocity(uint8_t motor, float velocity)
 {
-  motor.set_velocity(velocity);
+  set_desired_velocity(motor, velocity);
+  set_desired_mode(motor, AUTO_VELOCITY);
 }
 
-bool get_sample_string(char *char_array)
+// Stops every motor
+void emergency_stop()
 {
-  static uint64_t prev_sample_count = 0;
+  for (uint8_t i = 0; i < MOTOR_COUNT; i++)
+    set_desired_mode(i, OFF);
+}
+
+uint32_t open_sample_stream(uint8_t motor)
+{
+  static uint64_t prev_sample_count[MOTOR_COUNT] = {0};
 
-  uint64_t curr_sample_count = motor.get_sample_count();
-  bool new_sample = false;
+  uint64_t curr_sample_count = motors[motor].get_sample_count();
+  uint32_t length = 0;
 
-  if (curr_sample_count > prev_sample_count)
+  if (curr_sample_count > prev_sample_count[motor])
   {
-    strcpy(char_array, motor.get_sample_string().c_str());
-    new_sample = true;
-    prev_sample_count = curr_sample_count;
+    length = motors[motor].open_sample_string();
+    prev_sample_count[motor] = curr_sample_count;
+
+    // Dropped frames have nothing to send
+    if (length == 0)
+      motors[motor].close_sample_string();
   }
-  return new_sample;
-}
\ No newline at end of file
+  return length;
+}
+
+uint32_t read_sample_stream(uint8_t motor, char *dest, uint32_t size)
+{
+  return motors[motor].read_sample_string(dest, size);
+}
+
+void close_sample_stream(uint8_t motor)
+{
+  motors[motor].close_sample_string();
+}
+
+uint32_t get_sample_summary(uint8_t motor, char *dest, uint32_t size)
+{
+  return motors[motor].get_summary_string(dest, size);
+}
+
+bool start_capture(uint8_t motor)
+{
+  return motors[motor].trigger_capture();
+}
+
+uint32_t get_capture_id(uint8_t motor)
+{
+  return motors[motor].get_capture_id();
+}
+
+uint32_t get_capture_metadata(uint8_t motor, char *dest, uint32_t size)
+{
+  return motors[motor].get_capture_metadata(dest, size);
+}
+
+uint32_t get_capture_length(uint8_t motor)
+{
+  return motors[motor].get_capture_length();
+}
+
+uint32_t read_capture(uint8_t motor, uint32_t offset, uint8_t *dest, uint32_t size)
+{
+  return motors[motor].read_capture(offset, dest, size);
+}
+
+void release_capture(uint8_t motor)
+{
+  motors[motor].release_capture();
+}
+
+uint32_t get_spectrum_features(uint8_t motor, char *dest, uint32_t size)
+{
+  return motors[motor].get_spectrum_string(dest, size);
+}
+
+esp_err_t start_system_id(uint8_t motor, int32_t excitation, int32_t order, float offset, float amplitude,
+                          float duration, float response, bool apply)
+{
+  recorder().add_parameter(motor, PARAMETER_SYSTEM_ID, {(float)excitation, (float)order, offset, amplitude,
+                                                        duration, response, (float)apply});
+
+  sysid_config config = {
+      .excitation = excitation,
+      .order = (uint8_t)order,
+      .offset = offset,
+      .amplitude = amplitude,
+      .duration = duration,
+      .response = response,
+      .apply = apply,
+  };
+
+  return motors[motor].run_system_id(config);
+}
+
+uint32_t get_system_id_report(uint8_t motor, char *dest, uint32_t size)
+{
+  return nest_report(motor, dest, motors[motor].get_system_id_string(dest, size), size);
+}
+
+esp_err_t start_autotune(uint8_t motor, float min_velocity, float max_velocity, int32_t points, float amplitude,
+                         float hysteresis, bool save)
+{
+  autotune_config config = {
+      .min_velocity = min_velocity,
+      .max_velocity = max_velocity,
+      .points = (uint8_t)points,
+      .amplitude = amplitude,
+      .hysteresis = hysteresis,
+      .save = save,
+  };
+
+  if (points <= 0 || points > GainSchedule::MAX_POINTS)
+    return ESP_ERR_INVALID_ARG;
+
+  recorder().add_parameter(motor, PARAMETER_AUTOTUNE, {min_velocity, max_velocity, (float)points, amplitude,
+                                                       hysteresis, (float)save});
+  return motors[motor].run_autotune(config);
+}
+
+void clear_gain_schedule(uint8_t motor)
+{
+  recorder().add_parameter(motor, PARAMETER_CLEAR_GAIN_SCHEDULE, {});
+  motors[motor].clear_gain_schedule();
+}
+
+uint32_t get_gain_schedule_report(uint8_t motor, char *dest, uint32_t size)
+{
+  return nest_report(motor, dest, motors[motor].get_gain_schedule_string(dest, size), size);
+}
+
+esp_err_t start_friction_calibration(uint8_t motor, bool save)
+{
+  recorder().add_parameter(motor, PARAMETER_FRICTION_CALIBRATION, {(float)save});
+  return motors[motor].run_friction_calibration(save);
+}
+
+void clear_friction_calibration(uint8_t motor)
+{
+  recorder().add_parameter(motor, PARAMETER_CLEAR_FRICTION_CALIBRATION, {});
+  motors[motor].clear_friction_calibration();
+}
+
+uint32_t get_actuator_report(uint8_t motor, char *dest, uint32_t size)
+{
+  return nest_report(motor, dest, motors[motor].get_actuator_string(dest, size), size);
+}
+
+esp_err_t clear_fault(uint8_t motor)
+{
+  recorder().add_parameter(motor, PARAMETER_CLEAR_FAULT, {});
+  return motors[motor].clear_fault();
+}
+
+uint32_t get_fault_report(uint8_t motor, char *dest, uint32_t size)
+{
+  return nest_report(motor, dest, motors[motor].get_fault_string(dest, size), size);
+}
+
+void safety_heartbeat()
+{
+  SafetySupervisor::heartbeat();
+}
+
+esp_err_t set_motion_profile(uint8_t motor, int32_t profile, float velocity, float acceleration, float jerk)
+{
+  recorder().add_parameter(motor, PARAMETER_PROFILE, {(float)profile, velocity, acceleration, jerk});
+  return motors[motor].set_profile(profile, velocity, acceleration, jerk);
+}
+
+esp_err_t set_motion_waveform(uint8_t motor, const float *points, uint32_t count)
+{
+  static_assert(Trajectory::MAX_WAVEFORM_POINTS <= MAX_RECORD_VALUES, "Waveforms exceed a recorded parameter");
+
+  if (count > Trajectory::MAX_WAVEFORM_POINTS)
+    return ESP_ERR_INVALID_ARG;
+
+  recorder().add_parameter(motor, PARAMETER_WAVEFORM, points, (uint8_t)count);
+  return motors[motor].set_waveform(points, (uint8_t)count);
+}
@@ -0,0 +1,195 @@
+// Includes
+#include "memory_arena.hpp"
+
+#include <stdlib.h>
+
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_sys.h"
+
+static constexpr char *TAG = "Memory";
+
+static constexpr uint8_t MAX_GUARDED_TASKS = 8;
+
+// Arena storage
+alignas(ARENA_ALIGNMENT) static uint8_t samples_storage[SAMPLES_ARENA_SIZE];
+alignas(ARENA_ALIGNMENT) static uint8_t format_storage[FORMAT_ARENA_SIZE];
+alignas(ARENA_ALIGNMENT) static uint8_t filters_storage[FILTERS_ARENA_SIZE];
+alignas(ARENA_ALIGNMENT) static uint8_t network_storage[NETWORK_ARENA_SIZE];
+alignas(ARENA_ALIGNMENT) static uint8_t ota_storage[OTA_ARENA_SIZE];
+alignas(ARENA_ALIGNMENT) static uint8_t capture_storage[CAPTURE_ARENA_SIZE];
+alignas(ARENA_ALIGNMENT) static uint8_t recorder_storage[RECORDER_ARENA_SIZE];
+alignas(ARENA_ALIGNMENT) static uint8_t spectrum_storage[SPECTRUM_ARENA_SIZE];
+alignas(ARENA_ALIGNMENT) static uint8_t live_storage[LIVE_ARENA_SIZE];
+
+static MemoryArena arenas[MEMORY_ARENA_COUNT] = {
+    MemoryArena("samples", samples_storage, sizeof(samples_storage)),
+    MemoryArena("format", format_storage, sizeof(format_storage)),
+    MemoryArena("filters", filters_storage, sizeof(filters_storage)),
+    MemoryArena("network", network_storage, sizeof(network_storage)),
+    MemoryArena("ota", ota_storage, sizeof(ota_storage)),
+    MemoryArena("capture", capture_storage, sizeof(capture_storage)),
+    MemoryArena("recorder", recorder_storage, sizeof(recorder_storage)),
+    MemoryArena("spectrum", spectrum_storage, sizeof(spectrum_storage)),
+    MemoryArena("live", live_storage, sizeof(live_storage)),
+};
+
+// Heap guard state, read from the allocator hook
+static DRAM_ATTR TaskHandle_t guarded_tasks[MAX_GUARDED_TASKS];
+static DRAM_ATTR volatile uint8_t guarded_task_count = 0;
+static DRAM_ATTR volatile bool heap_locked = false;
+
+MemoryArena::MemoryArena(const char *name, uint8_t *base, size_t capacity)
+{
+  this->name = name;
+  this->base = base;
+  this->capacity = capacity;
+
+  used = 0;
+  high_water = 0;
+  failures = 0;
+
+  portMUX_INITIALIZE(&lock);
+}
+
+void *MemoryArena::reserve(size_t size)
+{
+  void *block = nullptr;
+  size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+  portENTER_CRITICAL(&lock);
+  if (size <= capacity - used)
+  {
+    block = base + used;
+    used += size;
+    if (used > high_water)
+      high_water = used;
+  }
+  else
+    failures++;
+  portEXIT_CRITICAL(&lock);
+
+  if (block == nullptr)
+  {
+    ESP_LOGE(TAG, "Arena \"%s\" exhausted: %u bytes requested, %u of %u bytes used.",
+             name, (unsigned)size, (unsigned)used, (unsigned)capacity);
+    abort();
+  }
+
+  return block;
+}
+
+size_t MemoryArena::mark()
+{
+  return used;
+}
+
+void MemoryArena::release(size_t mark)
+{
+  portENTER_CRITICAL(&lock);
+  if (mark <= used)
+    used = mark;
+  portEXIT_CRITICAL(&lock);
+}
+
+const char *MemoryArena::get_name()
+{
+  return name;
+}
+
+size_t MemoryArena::get_capacity()
+{
+  return capacity;
+}
+
+size_t MemoryArena::get_used()
+{
+  return used;
+}
+
+size_t MemoryArena::get_high_water()
+{
+  return high_water;
+}
+
+uint32_t MemoryArena::get_failures()
+{
+  return failures;
+}
+
+MemoryArena &memory_arena(memory_arena_t arena)
+{
+  return arenas[arena];
+}
+
+void *memory_reserve(memory_arena_t arena, size_t size)
+{
+  return arenas[arena].reserve(size);
+}
+
+void memory_guard_task(TaskHandle_t task)
+{
+  if (guarded_task_count >= MAX_GUARDED_TASKS)
+  {
+    ESP_LOGW(TAG, "Too many guarded tasks, heap guard not applied.");
+    return;
+  }
+
+  guarded_tasks[guarded_task_count] = task;
+  guarded_task_count = guarded_task_count + 1;
+}
+
+void memory_lock(void)
+{
+  ESP_LOGI(TAG, "Locking heap for %u guarded tasks.", guarded_task_count);
+  heap_locked = true;
+}
+
+void memory_report(void)
+{
+  size_t total = 0;
+
+  for (auto &arena : arenas)
+  {
+    ESP_LOGI(TAG, "Arena %-8s: %6u / %6u bytes (high-water %6u, failures %lu)",
+             arena.get_name(),
+             (unsigned)arena.get_used(),
+             (unsigned)arena.get_capacity(),
+             (unsigned)arena.get_high_water(),
+             (unsigned long)arena.get_failures());
+    total += arena.get_capacity();
+  }
+
+  ESP_LOGI(TAG, "Arenas total: %u / %u bytes, TLS buffers: %u bytes",
+           (unsigned)total, (unsigned)STATIC_MEMORY_BUDGET, (unsigned)TLS_BUFFER_SIZE);
+  ESP_LOGI(TAG, "Heap free: %u bytes (minimum %u, largest block %u)",
+           (unsigned)heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT),
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+}
+
+#if CONFIG_HEAP_USE_HOOKS && CONFIG_DTMC_MEMORY_HEAP_GUARD
+// Called by the heap allocator on every successful allocation
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+  if (!heap_locked)
+    return;
+
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  for (uint8_t i = 0; i < guarded_task_count; i++)
+  {
+    if (guarded_tasks[i] == task)
+    {
+      esp_rom_printf("Heap allocation of %u bytes after memory lock in guarded task %p\n", size, task);
+      abort();
+    }
+  }
+}
+
+extern "C" IRAM_ATTR void esp_heap_trace_free_hook(void *ptr)
+{
+}
+#endif
@@ -0,0 +1,133 @@
+#ifndef MEMORY_ARENA_H_
+#define MEMORY_ARENA_H_
+
+// Includes
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "configuration.hpp"
+#include "compressor.hpp"
+#include "record_format.hpp"
+#include "condition_monitor.hpp"
+#include "live_server.hpp"
+#include "memory_budget.h"
+
+#include "freertos/FreeRTOS.h"
+
+// Arena budgets
+// Every buffer the firmware keeps for its lifetime is reserved from one of these arenas at boot,
+// so the steady state never touches the heap. Exceeding a budget fails the build. The
+// samples, format, filters, capture and spectrum arenas hold one set of buffers per motor.
+static constexpr size_t ARENA_ALIGNMENT = 8;
+
+static constexpr size_t SAMPLES_ARENA_SIZE = MOTOR_COUNT * SAMPLE_BUFFER_COUNT * SAMPLE_VECTOR_SIZE *
+                                             (sizeof(uint64_t) + 5 * sizeof(float));
+#ifdef CONFIG_DTMC_TELEMETRY_COMPRESSION
+static constexpr size_t FORMAT_ARENA_SIZE = MOTOR_COUNT * (SAMPLE_STRING_SIZE + StreamCompressor::BUFFER_SIZE + // Frame and compressor window
+                                                           ARENA_ALIGNMENT);
+#else
+static constexpr size_t FORMAT_ARENA_SIZE = MOTOR_COUNT * (SAMPLE_STRING_SIZE + ARENA_ALIGNMENT); // The frame is not a multiple of the alignment
+#endif
+static constexpr size_t FILTERS_ARENA_SIZE = MOTOR_COUNT * 1024;
+static constexpr size_t NETWORK_ARENA_SIZE = CONFIG_NETWORK_BUFFER_SIZE + // Telemetry is streamed out of the format arena
+                                             MEMORY_SUMMARY_BUFFER_SIZE;
+
+static constexpr size_t STATIC_MEMORY_BUDGET = (160 + (MOTOR_COUNT - 1) * 112) * 1024; // Total SRAM the application may hold in arenas
+
+#ifdef CONFIG_ENABLE_ADU_SAMPLE
+static constexpr size_t OTA_ARENA_SIZE = MEMORY_OTA_BUFFER_COUNT * MEMORY_OTA_BUFFER_SIZE + MEMORY_ADU_BUFFER_SIZE;
+#else
+static constexpr size_t OTA_ARENA_SIZE = ARENA_ALIGNMENT; // Unused without Device Update
+#endif
+
+#ifdef CONFIG_DTMC_CAPTURE
+static constexpr size_t CAPTURE_ARENA_SIZE = MOTOR_COUNT * (CONFIG_DTMC_CAPTURE_SAMPLES * sizeof(uint16_t) +
+                                                           CONFIG_DTMC_CAPTURE_EDGES * 2 * sizeof(uint32_t));
+#else
+static constexpr size_t CAPTURE_ARENA_SIZE = ARENA_ALIGNMENT; // Unused without capture
+#endif
+
+#ifdef CONFIG_DTMC_RECORDER
+static constexpr size_t RECORDER_BUFFER_SIZE = CONFIG_DTMC_RECORDER_BUFFER_KB * 1024;
+static constexpr size_t RECORDER_ARENA_SIZE = RECORDER_BUFFER_SIZE + MAX_RECORD_SIZE + MAX_RECORD_BLOCK_SIZE +
+                                              2 * ARENA_ALIGNMENT; // Ring, record scratch and block
+#else
+static constexpr size_t RECORDER_BUFFER_SIZE = 0;
+static constexpr size_t RECORDER_ARENA_SIZE = ARENA_ALIGNMENT; // Unused without recording
+#endif
+
+#ifdef CONFIG_DTMC_SPECTRUM
+static constexpr size_t SPECTRUM_MONITOR_SIZE = (2 * ConditionMonitor::HOP_COUNT * WelchEstimator::HOP_SIZE +   // Hop rings
+                                                 2 * (WelchEstimator::HOP_SIZE + WelchEstimator::SEGMENT_SIZE + // Estimators
+                                                      WelchEstimator::BIN_COUNT)) *
+                                                    sizeof(float) +
+                                                16 * ARENA_ALIGNMENT;
+static constexpr size_t SPECTRUM_ARENA_SIZE = MOTOR_COUNT * SPECTRUM_MONITOR_SIZE +
+                                              4 * WelchEstimator::SEGMENT_SIZE * sizeof(float) + // Window, twiddles and FFT buffer
+                                              3 * ARENA_ALIGNMENT;
+#else
+static constexpr size_t SPECTRUM_ARENA_SIZE = ARENA_ALIGNMENT; // Unused without condition monitoring
+#endif
+
+#ifdef CONFIG_DTMC_LIVE
+static constexpr size_t LIVE_ARENA_SIZE = (MOTOR_COUNT * LIVE_RING_SIZE + LiveServer::BATCH_SIZE) * sizeof(live_sample) +
+                                          CONFIG_DTMC_LIVE_MAX_CLIENTS * sizeof(live_client) +
+                                          (MOTOR_COUNT + 2) * ARENA_ALIGNMENT; // Rings, batch and connections
+#else
+static constexpr size_t LIVE_ARENA_SIZE = ARENA_ALIGNMENT; // Unused without live telemetry
+#endif
+
+// Buffers owned by other components, reported alongside the arenas
+static constexpr size_t TLS_BUFFER_SIZE = CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN + CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN;
+
+static_assert(SAMPLES_ARENA_SIZE +
+                      FORMAT_ARENA_SIZE +
+                      FILTERS_ARENA_SIZE +
+                      NETWORK_ARENA_SIZE +
+                      OTA_ARENA_SIZE +
+                      CAPTURE_ARENA_SIZE +
+                      RECORDER_ARENA_SIZE +
+                      SPECTRUM_ARENA_SIZE +
+                      LIVE_ARENA_SIZE <=
+                  STATIC_MEMORY_BUDGET,
+              "Static memory arenas exceed STATIC_MEMORY_BUDGET");
+
+class MemoryArena
+{
+private:
+  // Class variables
+  const char *name;
+  uint8_t *base;
+  size_t capacity;
+  size_t used;
+  size_t high_water;
+  uint32_t failures;
+
+  portMUX_TYPE lock;
+
+public:
+  MemoryArena(const char *name, uint8_t *base, size_t capacity);
+
+  void *reserve(size_t size);
+  size_t mark();
+  void release(size_t mark);
+
+  const char *get_name();
+  size_t get_capacity();
+  size_t get_used();
+  size_t get_high_water();
+  uint32_t get_failures();
+
+  template <typename T>
+  T *reserve_array(size_t count)
+  {
+    static_assert(alignof(T) <= ARENA_ALIGNMENT, "Type alignment exceeds arena alignment");
+    return static_cast<T *>(reserve(count * sizeof(T)));
+  }
+};
+
+MemoryArena &memory_arena(memory_arena_t arena);
+
+#endif // MEMORY_ARENA_H_
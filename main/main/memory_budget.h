@@ -0,0 +1,49 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <stddef.h>
+
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Named static arenas, sized at compile time in memory_arena.hpp
+    typedef enum
+    {
+        MEMORY_ARENA_SAMPLES = 0, // Double-buffered sample columns
+        MEMORY_ARENA_FORMAT,      // Formatted or compressed telemetry frame
+        MEMORY_ARENA_FILTERS,     // Moving average windows
+        MEMORY_ARENA_NETWORK,     // MQTT packet buffer and frame summary
+        MEMORY_ARENA_OTA,         // Firmware update download buffers and update agent messages
+        MEMORY_ARENA_CAPTURE,     // Triggered capture rings
+        MEMORY_ARENA_RECORDER,    // Input recording ring and its UART block
+        MEMORY_ARENA_SPECTRUM,    // Condition monitoring hops and Welch spectra
+        MEMORY_ARENA_LIVE,        // Live telemetry rings and connections
+        MEMORY_ARENA_COUNT,
+    } memory_arena_t;
+
+#define MEMORY_SUMMARY_BUFFER_SIZE 768 // Frame summary JSON, about 650 bytes at the widest values
+
+#ifdef CONFIG_ENABLE_ADU_SAMPLE
+// One range response is hashed while the other is written to flash
+#define MEMORY_OTA_BUFFER_COUNT 2
+#define MEMORY_OTA_BUFFER_SIZE (CONFIG_OTA_CHUNK_SIZE + 1024) // Chunk plus response headers
+#define MEMORY_ADU_BUFFER_SIZE 1536                          // Agent state and request responses
+#endif
+
+    extern void *memory_reserve(memory_arena_t arena, size_t size);
+    extern void memory_guard_task(TaskHandle_t task);
+    extern void memory_lock(void);
+    extern void memory_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMORY_BUDGET_H */
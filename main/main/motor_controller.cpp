@@ -1,35 +1,35 @@
 // Includes
 #include "motor_controller.hpp"
 
+#include <string.h>
+
+#include "esp_attr.h"
+
 static constexpr char *TAG = "Motor";
 
-static MotorController *motor_obj;
-static Communication comm;
-static CurrentSensor curr_sen;
+static Communication comm;     // Shared by every motor's TX task
+static CurrentSensor curr_sen; // Samples every motor's current sensor
 
-MotorController::MotorController()
-{
-  motor_obj = this;
+// Controllers sampled by the shared update task, in the order they were initialised
+static MotorController *controllers[MAX_MOTORS];
+static uint8_t controller_count = 0;
+static TaskHandle_t update_task_hdl = NULL;
 
-  // Allocate string stream memory
-  sample_ss.str().reserve(sample_size);
+// Capture trigger names, indexed by CaptureTrigger
+static const char *const CAPTURE_TRIGGER_NAMES[] = {"none", "setpoint", "mode", "overcurrent", "request"};
 
-  // Allocate vector memory
-  timestamp_vector[0].reserve(VECTOR_SIZE);
-  gain_vector[0].reserve(VECTOR_SIZE);
-  duty_cycle_vector[0].reserve(VECTOR_SIZE);
-  velocity_vector[0].reserve(VECTOR_SIZE);
-  position_vector[0].reserve(VECTOR_SIZE);
-  current_vector[0].reserve(VECTOR_SIZE);
+static constexpr uint32_t FRAME_COLUMNS_SIZE = frame_columns_size(SAMPLE_VECTOR_SIZE);
 
-  timestamp_vector[1].reserve(VECTOR_SIZE);
-  gain_vector[1].reserve(VECTOR_SIZE);
-  duty_cycle_vector[1].reserve(VECTOR_SIZE);
-  velocity_vector[1].reserve(VECTOR_SIZE);
-  position_vector[1].reserve(VECTOR_SIZE);
-  current_vector[1].reserve(VECTOR_SIZE);
+static_assert(FRAME_HEADER_SIZE + StreamCompressor::bound(FRAME_COLUMNS_SIZE) <= SAMPLE_STRING_SIZE,
+              "Compressed frame may exceed the sample string");
+
+MotorController::MotorController()
+{
+  index = 0;
+  config = &MOTOR_CONFIGS[0];
 
   sample_time = 0;
+  edge_time = 0;
   actual_direction = 0;
   duty_cycle_mag = 0;
   velocity_mag = 0;
@@ -39,9 +39,8 @@ MotorController::MotorController()
   gain_mag = 1;
   gain = 1;
   freq = 1;
-  position_sp = 0;
+  position_sp = 360; // The position mode's fixed reference before set points were used
   velocity_sp = 0;
-  position_dir = 1;
 
   timestamp = 0;
   direction = CLOCKWISE;
@@ -51,29 +50,109 @@ MotorController::MotorController()
   current = 0;
 
   curr_buffer = 0;
+  sample_index = 0;
   sample_count = 0;
 
+  for (uint8_t i = 0; i < SAMPLE_BUFFER_COUNT; i++)
+  {
+    timestamp_buffer[i] = nullptr;
+    gain_buffer[i] = nullptr;
+    duty_cycle_buffer[i] = nullptr;
+    velocity_buffer[i] = nullptr;
+    position_buffer[i] = nullptr;
+    current_buffer[i] = nullptr;
+  }
+
+  sample_string = nullptr;
+  sample_length = 0;
+  sample_readers = 0;
+  sample_offset = 0;
+  sample_callback = nullptr;
+
+  sensor_channel = 0;
+  capture_callback = nullptr;
+
+  pwm_duty = 0;
+  fault_reported = false;
+  fault_callback = nullptr;
+
+  kp = DEFAULT_KP;
+  ti = DEFAULT_TI;
+  td = DEFAULT_TD;
+  velocity_window = TUNED_VELOCITY_WINDOW;
+
+  memset(&velocity_pid, 0, sizeof(velocity_pid));
+  memset(&position_pid, 0, sizeof(position_pid));
+
+  memset(&sysid_settings, 0, sizeof(sysid_settings));
+  memset(&sysid, 0, sizeof(sysid));
+  sysid_applied = false;
+  sysid_time = 0;
+  sysid_input = 0;
+  sysid_position = 0;
+  sysid_callback = nullptr;
+
+  tune_time = 0;
+  autotune_callback = nullptr;
+
+  actuator.reset(MIN_DUTY_CYCLE);
+  calibrate_time = 0;
+  calibration_callback = nullptr;
+
+  trajectory_start = 0;
+  profile = PROFILE_SCURVE;
+  profile_velocity = DEFAULT_PROFILE_VELOCITY;
+  profile_acceleration = DEFAULT_PROFILE_ACCELERATION;
+  profile_jerk = DEFAULT_PROFILE_JERK;
+
   parameter_semaphore = xSemaphoreCreateMutex();
   buffer_semaphore = xSemaphoreCreateBinary();
   comm_semaphore = xSemaphoreCreateBinary();
+  sample_semaphore = xSemaphoreCreateMutex();
 
   cmpr_hdl = nullptr;
+  gen_hdl = nullptr;
   unit_hdl = nullptr;
 
-  update_task_hdl = NULL;
   format_task_hdl = NULL;
   pid_task_hdl = NULL;
   tx_data_task_hdl = NULL;
   display_task_hdl = NULL;
 }
 
-void MotorController::init()
+void MotorController::init(uint8_t index)
 {
+  this->index = index;
+  config = &MOTOR_CONFIGS[index];
+
+  ESP_LOGI(TAG, "Reserving sample buffers for motor %u.", index);
+  static_assert(VELOCITY_WINDOW_SIZE * sizeof(float) <= FILTERS_ARENA_SIZE / MOTOR_COUNT, "Velocity filter exceeds the filters arena");
+
+  for (uint8_t i = 0; i < SAMPLE_BUFFER_COUNT; i++)
+  {
+    timestamp_buffer[i] = memory_arena(MEMORY_ARENA_SAMPLES).reserve_array<uint64_t>(SAMPLE_VECTOR_SIZE);
+    gain_buffer[i] = memory_arena(MEMORY_ARENA_SAMPLES).reserve_array<float>(SAMPLE_VECTOR_SIZE);
+    duty_cycle_buffer[i] = memory_arena(MEMORY_ARENA_SAMPLES).reserve_array<float>(SAMPLE_VECTOR_SIZE);
+    velocity_buffer[i] = memory_arena(MEMORY_ARENA_SAMPLES).reserve_array<float>(SAMPLE_VECTOR_SIZE);
+    position_buffer[i] = memory_arena(MEMORY_ARENA_SAMPLES).reserve_array<float>(SAMPLE_VECTOR_SIZE);
+    current_buffer[i] = memory_arena(MEMORY_ARENA_SAMPLES).reserve_array<float>(SAMPLE_VECTOR_SIZE);
+  }
+  sample_string = memory_arena(MEMORY_ARENA_FORMAT).reserve_array<char>(SAMPLE_STRING_SIZE);
+  sample_string[0] = '\0';
+#ifdef CONFIG_DTMC_TELEMETRY_COMPRESSION
+  compressor.init(memory_arena(MEMORY_ARENA_FORMAT).reserve_array<uint8_t>(StreamCompressor::BUFFER_SIZE));
+#endif
+#ifdef CONFIG_DTMC_LIVE
+  live_ring.init(memory_arena(MEMORY_ARENA_LIVE).reserve_array<live_sample>(LIVE_RING_SIZE), LIVE_RING_SIZE);
+#endif
+  velocity_average.init(VELOCITY_WINDOW_SIZE);
+  velocity_average.resize(velocity_window);
+
   ESP_LOGI(TAG, "Setting up output to ENA.");
 
   mcpwm_timer_handle_t timer_hdl = nullptr;
   mcpwm_timer_config_t timer_config = {
-      .group_id = 0,
+      .group_id = config->mcpwm_group,
       .clk_src = MCPWM_TIMER_CLK_SRC_DEFAULT,
       .resolution_hz = TIMER_RES,
       .count_mode = MCPWM_TIMER_COUNT_MODE_UP,
@@ -83,7 +162,7 @@ void MotorController::init()
 
   mcpwm_oper_handle_t oper_hdl = nullptr;
   mcpwm_operator_config_t oper_config = {
-      .group_id = 0,
+      .group_id = config->mcpwm_group,
   };
   ESP_ERROR_CHECK(mcpwm_new_operator(&oper_config, &oper_hdl));
   ESP_ERROR_CHECK(mcpwm_operator_connect_timer(oper_hdl, timer_hdl));
@@ -95,9 +174,8 @@ void MotorController::init()
   };
   ESP_ERROR_CHECK(mcpwm_new_comparator(oper_hdl, &cmpr_config, &cmpr_hdl));
 
-  mcpwm_gen_handle_t gen_hdl = nullptr;
   mcpwm_generator_config_t gen_config = {
-      .gen_gpio_num = GPIO_ENA,
+      .gen_gpio_num = config->ena,
       .flags = {
           .pull_down = 1,
       },
@@ -113,13 +191,13 @@ void MotorController::init()
 
   ESP_LOGI(TAG, "Setting up outputs to IN1 and IN2.");
   gpio_config_t output_config = {
-      .pin_bit_mask = ((1ULL << GPIO_IN1) | (1ULL << GPIO_IN2)),
+      .pin_bit_mask = ((1ULL << config->in1) | (1ULL << config->in2)),
       .mode = GPIO_MODE_OUTPUT,
       .pull_down_en = GPIO_PULLDOWN_ENABLE,
   };
   gpio_config(&output_config);
-  gpio_set_level(GPIO_IN1, 0);
-  gpio_set_level(GPIO_IN2, 0);
+  gpio_set_level(config->in1, 0);
+  gpio_set_level(config->in2, 0);
 
   ESP_LOGI(TAG, "Setting up inputs for encoder A and B.");
   pcnt_unit_config_t unit_config = {
@@ -138,14 +216,14 @@ void MotorController::init()
 
   pcnt_channel_handle_t channel_a_hdl = nullptr;
   pcnt_chan_config_t channel_a_config = {
-      .edge_gpio_num = GPIO_C1,
-      .level_gpio_num = GPIO_C2,
+      .edge_gpio_num = config->encoder_a,
+      .level_gpio_num = config->encoder_b,
   };
   ESP_ERROR_CHECK(pcnt_new_channel(unit_hdl, &channel_a_config, &channel_a_hdl));
   pcnt_channel_handle_t channel_b_hdl = nullptr;
   pcnt_chan_config_t channel_b_config = {
-      .edge_gpio_num = GPIO_C2,
-      .level_gpio_num = GPIO_C1,
+      .edge_gpio_num = config->encoder_b,
+      .level_gpio_num = config->encoder_a,
   };
   ESP_ERROR_CHECK(pcnt_new_channel(unit_hdl, &channel_b_config, &channel_b_hdl));
 
@@ -160,59 +238,91 @@ void MotorController::init()
   pcnt_event_callbacks_t pcnt_cbs = {
       .on_reach = pcnt_callback,
   };
-  QueueHandle_t queue = xQueueCreate(10, sizeof(int));
-  ESP_ERROR_CHECK(pcnt_unit_register_event_callbacks(unit_hdl, &pcnt_cbs, queue));
+  ESP_ERROR_CHECK(pcnt_unit_register_event_callbacks(unit_hdl, &pcnt_cbs, this));
 
   ESP_ERROR_CHECK(pcnt_unit_enable(unit_hdl));
   ESP_ERROR_CHECK(pcnt_unit_clear_count(unit_hdl));
   ESP_ERROR_CHECK(pcnt_unit_start(unit_hdl));
 
   ESP_LOGI(TAG, "Initiate and zero current sensor.");
-  curr_sen.init();
+  sensor_channel = curr_sen.add_channel(config->adc, config->adc_channel);
+#ifdef CONFIG_DTMC_CAPTURE
+  capture.init(CONFIG_DTMC_CAPTURE_SAMPLES, CONFIG_DTMC_CAPTURE_EDGES, CONFIG_DTMC_CAPTURE_PRETRIGGER_PERCENT);
+  curr_sen.attach_capture(sensor_channel, &capture, CONFIG_DTMC_CAPTURE_OVERCURRENT_MA);
+#endif
+#ifdef CONFIG_DTMC_SPECTRUM
+  monitor.init(index, 1000.0 / (update_config.delay * portTICK_PERIOD_MS), REDUCTION_RATIO);
+  curr_sen.attach_monitor(sensor_channel, &monitor);
+#endif
+#ifdef CONFIG_DTMC_SAFETY
+  supervisor.init(index);
+  supervisor.set_output_callback(safety_output, this);
+  curr_sen.attach_supervisor(sensor_channel, &supervisor, CONFIG_DTMC_SAFETY_OVERCURRENT_MA);
+#endif
   stop_motor();
-  curr_sen.zero();
+  curr_sen.zero(sensor_channel);
 
-  ESP_LOGI(TAG, "Setting up update task.");
-  xTaskCreatePinnedToCore(update_trampoline, "Update Task", update_config.stack_size, nullptr, update_config.priority, &update_task_hdl, update_config.core);
+  // The first motor starts the update task, later ones join it between two periods
+  ESP_LOGI(TAG, "Adding motor %u to the update task.", index);
+  velocity_pid.prev_time = esp_timer_get_time();
+  position_pid.prev_time = velocity_pid.prev_time;
+  if (update_task_hdl == NULL)
+  {
+    controllers[controller_count++] = this;
+    xTaskCreatePinnedToCore(update_trampoline, "Update Task", update_config.stack_size, nullptr, update_config.priority, &update_task_hdl, update_config.core);
+    memory_guard_task(update_task_hdl);
+  }
+  else
+  {
+    vTaskSuspend(update_task_hdl);
+    controllers[controller_count++] = this;
+    vTaskResume(update_task_hdl);
+  }
+#ifdef CONFIG_DTMC_SPECTRUM
+  monitor.attach();
+#endif
 
   ESP_LOGI(TAG, "Setting up formatting task.");
-  xTaskCreatePinnedToCore(format_task, "Format Task", format_config.stack_size, nullptr, format_config.priority, &format_task_hdl, format_config.core);
+  xTaskCreatePinnedToCore(format_task, "Format Task", format_config.stack_size, this, format_config.priority, &format_task_hdl, format_config.core);
+  memory_guard_task(format_task_hdl);
 
   ESP_LOGI(TAG, "Setting up PID controller task.");
-  xTaskCreatePinnedToCore(pid_trampoline, "PID Controller Task", pid_config.stack_size, nullptr, pid_config.priority, &pid_task_hdl, pid_config.core);
+  xTaskCreatePinnedToCore(pid_trampoline, "PID Controller Task", pid_config.stack_size, this, pid_config.priority, &pid_task_hdl, pid_config.core);
+  memory_guard_task(pid_task_hdl);
   vTaskSuspend(pid_task_hdl);
 
   ESP_LOGI(TAG, "Setting up display task.");
-  xTaskCreatePinnedToCore(display_task, "Display Task", display_config.stack_size, nullptr, display_config.priority, &display_task_hdl, display_config.core);
+  xTaskCreatePinnedToCore(display_task, "Display Task", display_config.stack_size, this, display_config.priority, &display_task_hdl, display_config.core);
   vTaskSuspend(display_task_hdl);
 
   ESP_LOGI(TAG, "Initiate and set up communication task.");
   comm.init();
-  xTaskCreatePinnedToCore(tx_data_task, "TX Data Task", tx_config.stack_size, nullptr, tx_config.priority, &tx_data_task_hdl, tx_config.core);
+  xTaskCreatePinnedToCore(tx_data_task, "TX Data Task", tx_config.stack_size, this, tx_config.priority, &tx_data_task_hdl, tx_config.core);
+  memory_guard_task(tx_data_task_hdl);
   vTaskSuspend(tx_data_task_hdl);
 }
 
 bool MotorController::pcnt_callback(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *user_ctx)
 {
-  static uint64_t prev_time = 0;
+  MotorController *motor = static_cast<MotorController *>(user_ctx);
 
-  BaseType_t high_task_wakeup;
-  QueueHandle_t queue = (QueueHandle_t)user_ctx;
-  xQueueSendFromISR(queue, &(edata->watch_point_value), &high_task_wakeup);
+  motor->sample_time = esp_timer_get_time();
+  motor->actual_direction = -(edata->watch_point_value) / abs(edata->watch_point_value);
+  motor->velocity_mag = CALI_FACTOR * (VELOCITY_SAMPLE_SIZE / (motor->sample_time - motor->edge_time)) * PPUS_TO_RPM;
+  motor->capture.add_edge((uint32_t)motor->sample_time, motor->actual_direction);
+  recorder().add_edge(motor->index, motor->sample_time, edata->watch_point_value);
 
-  motor_obj->sample_time = esp_timer_get_time();
-  motor_obj->actual_direction = -(edata->watch_point_value) / abs(edata->watch_point_value);
-  motor_obj->velocity_mag = CALI_FACTOR * (VELOCITY_SAMPLE_SIZE / (esp_timer_get_time() - prev_time)) * PPUS_TO_RPM;
-
-  prev_time = motor_obj->sample_time;
-  return (high_task_wakeup == pdTRUE);
+  motor->edge_time = motor->sample_time;
+  return false;
 }
 
+// Samples every motor in one loop, so the frames of all motors share their sample times
 void MotorController::update_trampoline(void *arg)
 {
   while (1)
   {
-    motor_obj->update_task();
+    for (uint8_t i = 0; i < controller_count; i++)
+      controllers[i]->update_task();
 
     vTaskDelay(update_config.delay / portTICK_PERIOD_MS);
   }
@@ -220,32 +330,7 @@ void MotorController::update_trampoline(void *arg)
 
 void MotorController::update_task()
 {
-  static int pcnt = 0;
-  static MovingAverage velocity_average(VELOCITY_WINDOW_SIZE);
-
-  static uint64_t prev_time = esp_timer_get_time();
-  static uint64_t curr_time = esp_timer_get_time();
-
-  curr_time = esp_timer_get_time();
-  if (curr_time - prev_time > (US_TO_S / freq) && (mode != OFF))
-  {
-    if (mode == AUTO_VELOCITY)
-    {
-      if (direction == CLOCKWISE)
-        set_direction(COUNTERCLOCKWISE);
-      else if (direction == COUNTERCLOCKWISE)
-        set_direction(CLOCKWISE);
-    }
-    else if (mode == AUTO_POSITION)
-    {
-      if (position_dir == 1)
-        position_dir = -1;
-      else if (position_dir == -1)
-        position_dir = 1;
-    }
-
-    prev_time = curr_time;
-  }
+  int pcnt = 0;
 
   // Zero velocity if no counts for timeout interval
   if (esp_timer_get_time() - sample_time > (TIMEOUT * US_TO_MS))
@@ -257,48 +342,118 @@ void MotorController::update_task()
   timestamp = (uint64_t)unix_time;
   gain = direction * gain_mag;
   duty_cycle = direction * duty_cycle_mag;
+  if (velocity_window != velocity_average.get_window_size())
+    velocity_average.resize(velocity_window);
   velocity = velocity_average.next(actual_direction * velocity_mag);
+  monitor.add_velocity(actual_direction * velocity_mag);
+#ifdef CONFIG_DTMC_SAFETY
+  // A new trip wakes the PID task to stop the motor and report it
+  if (supervisor.update(esp_timer_get_time(), pwm_duty, edge_time, velocity_mag > 0 ? actual_direction : 0) &&
+      pid_task_hdl != NULL)
+    vTaskResume(pid_task_hdl);
+#endif
   ESP_ERROR_CHECK(pcnt_unit_get_count(unit_hdl, &pcnt));
+  recorder().add_count(index, pcnt);
+  recorder().add_output(index, duty_cycle);
   absolute_position = CALI_FACTOR * (float)pcnt * PULSE_TO_DEG;
   position = fmod(absolute_position, 360.0); // Use calibration factor to adjust position to true value
-  current = curr_sen.read_current();
+  current = curr_sen.read_current(sensor_channel);
 
-  // Push back data to vectors
-  timestamp_vector[curr_buffer].push_back(timestamp);
-  gain_vector[curr_buffer].push_back(gain);
-  duty_cycle_vector[curr_buffer].push_back(duty_cycle);
-  velocity_vector[curr_buffer].push_back(velocity);
-  position_vector[curr_buffer].push_back(position);
-  current_vector[curr_buffer].push_back(current);
-
-  if (timestamp_vector[curr_buffer].size() >= VECTOR_SIZE)
+  // Reduce the frame summary as samples arrive
+  frame_summary &frame = summary[curr_buffer];
+  if (sample_index == 0)
+  {
+    frame.start_time = timestamp;
+    frame.duty_cycle.reset();
+    frame.velocity.reset();
+    frame.position.reset();
+    frame.current.reset();
+  }
+  frame.duty_cycle.add(duty_cycle);
+  frame.velocity.add(velocity);
+  frame.position.add(position);
+  frame.current.add(current);
+
+  // Store data in the current sample buffer
+  timestamp_buffer[curr_buffer][sample_index] = timestamp;
+  gain_buffer[curr_buffer][sample_index] = gain;
+  duty_cycle_buffer[curr_buffer][sample_index] = duty_cycle;
+  velocity_buffer[curr_buffer][sample_index] = velocity;
+  position_buffer[curr_buffer][sample_index] = position;
+  current_buffer[curr_buffer][sample_index] = current;
+  sample_index++;
+#ifdef CONFIG_DTMC_LIVE
+  live_ring.push({timestamp, duty_cycle, velocity, position, current});
+#endif
+
+  if (sample_index >= SAMPLE_VECTOR_SIZE)
   {
-    curr_buffer = (curr_buffer + 1) % 2;
+    frame.end_time = timestamp;
+    frame.mode = mode;
+    frame.gain = gain_mag;
+    frame.freq = freq;
+    frame.position_sp = position_sp;
+    frame.velocity_sp = velocity_sp;
+
+    curr_buffer = (curr_buffer + 1) % SAMPLE_BUFFER_COUNT;
+    sample_index = 0;
     xSemaphoreGive(buffer_semaphore);
   }
 }
 
 void MotorController::format_task(void *arg)
 {
+  MotorController *motor = static_cast<MotorController *>(arg);
+
   while (1)
   {
-    xSemaphoreTake(motor_obj->buffer_semaphore, portMAX_DELAY);
-    motor_obj->format_samples();
-    xSemaphoreGive(motor_obj->comm_semaphore);
+    xSemaphoreTake(motor->buffer_semaphore, portMAX_DELAY);
+#ifdef CONFIG_DTMC_TELEMETRY_COMPRESSION
+    bool formatted = motor->compress_samples();
+#else
+    bool formatted = motor->format_samples();
+#endif
+    motor->store_summary();
+
+    // A frame still being sent is kept, its summary is published without it
+    if (formatted)
+    {
+      xSemaphoreGive(motor->comm_semaphore);
+      motor->sample_count++;
+    }
+    if (motor->sample_callback != nullptr)
+      motor->sample_callback(motor->index);
 
-    motor_obj->sample_count++;
     vTaskDelay(format_config.delay / portTICK_PERIOD_MS);
   }
 }
 
 void MotorController::pid_trampoline(void *arg)
 {
+  MotorController *motor = static_cast<MotorController *>(arg);
+
   while (1)
   {
-    if (motor_obj->mode == AUTO_VELOCITY)
-      motor_obj->pid_velocity_task();
-    else if (motor_obj->mode == AUTO_POSITION)
-      motor_obj->pid_position_task();
+    // The bridge is already forced, the mode follows it to OFF
+    if (motor->supervisor.is_tripped() && !motor->fault_reported)
+    {
+      motor->fault_reported = true;
+      if (motor->fault_callback != nullptr)
+        motor->fault_callback(motor->index);
+      motor->set_mode(OFF);
+      continue;
+    }
+
+    if (motor->mode == AUTO_VELOCITY)
+      motor->pid_velocity_task();
+    else if (motor->mode == AUTO_POSITION)
+      motor->pid_position_task();
+    else if (motor->mode == SYSTEM_ID)
+      motor->system_id_task();
+    else if (motor->mode == AUTO_TUNE)
+      motor->autotune_task();
+    else if (motor->mode == CALIBRATION)
+      motor->friction_calibration_task();
 
     vTaskDelay(pid_config.delay / portTICK_PERIOD_MS);
   }
@@ -306,32 +461,54 @@ void MotorController::pid_trampoline(void *arg)
 
 void MotorController::pid_velocity_task()
 {
-  static uint64_t prev_time = esp_timer_get_time();
-  static uint64_t curr_time = esp_timer_get_time();
-  static float diff_time = 0;
+  pid_state &pid = velocity_pid;
+  uint64_t curr_time;
+  float diff_time;
+  float error;
+  float derivative;
+  float output;
+
+  float kp = this->kp;
+  float ti = this->ti;
+  float td = this->td;
+  float windup;
+  float feedforward;
+  float time_constant;
+  float setpoint;
+  bool scheduled;
+  trajectory_point reference;
 
-  static float error_prev = 0;
-  static float error = 0;
-  static float integral = 0;
-  static float derivative = 0;
+  curr_time = esp_timer_get_time();
+  diff_time = (curr_time - pid.prev_time) / US_TO_S;
 
-  static float output_prev = 0;
-  static float output = 0;
+  // The reference's sign is the direction, reversals pass through zero rather than stepping
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  trajectory.sample(curr_time - trajectory_start, &reference);
+  setpoint = fabs(reference.value);
+  scheduled = schedule.interpolate(setpoint, &kp, &ti, &td);
+  time_constant = sysid.valid ? sysid.time_constant : 0;
+  xSemaphoreGive(parameter_semaphore);
 
-  curr_time = esp_timer_get_time();
-  diff_time = (curr_time - prev_time) / US_TO_S;
+  if (reference.value > 0 && direction != CLOCKWISE)
+    set_direction(CLOCKWISE);
+  else if (reference.value < 0 && direction != COUNTERCLOCKWISE)
+    set_direction(COUNTERCLOCKWISE);
+  feedforward = motion_feedforward(setpoint, reference.value < 0 ? -reference.rate : reference.rate, time_constant);
 
-  error = velocity_sp - abs(velocity);
-  integral += error * diff_time;
-  derivative = (error - error_prev) / diff_time;
+  error = setpoint - abs(velocity);
+  pid.integral += error * diff_time;
+  derivative = (error - pid.error_prev) / diff_time;
 
-  // Restrict integral to prevent integral windup
-  if (integral > PID_WINDUP / gain_mag)
-    integral = PID_WINDUP / gain_mag;
-  if (integral < -PID_WINDUP / gain_mag)
-    integral = -PID_WINDUP / gain_mag;
+  // Restrict integral to prevent integral windup. PID_WINDUP suits the fixed gains, scheduled
+  // gains have a smaller kp / ti and are limited to the full output range instead.
+  windup = scheduled ? PID_MAX_OUTPUT * ti / (kp * gain_mag) : PID_WINDUP / gain_mag;
+  if (pid.integral > windup)
+    pid.integral = windup;
+  if (pid.integral < -windup)
+    pid.integral = -windup;
 
-  output = gain_mag * (kp * (error + 1 / ti * integral + td * derivative));
+  // A calibrated actuator gives the command for the set point, the PID only corrects around it
+  output = feedforward + gain_mag * (kp * (error + 1 / ti * pid.integral + td * derivative));
 
   // Restrict output to duty cycle range
   if (output > PID_MAX_OUTPUT)
@@ -339,46 +516,54 @@ void MotorController::pid_velocity_task()
   else if (output < PID_MIN_OUTPUT)
     output = PID_MIN_OUTPUT;
 
-  // Controller only outputs a new value when error is outside oscillation threshold
-  if (fabs(error) <= (velocity_sp * PID_OSCILLATION))
-    output = output_prev;
+  // Fixed gains only output a new value when error is outside oscillation threshold, scheduled
+  // gains are tuned for the operating point and hold the set point without it
+  if (!scheduled && fabs(error) <= (setpoint * PID_OSCILLATION))
+    output = pid.output_prev;
 
   set_duty_cycle(output);
 
-  prev_time = curr_time;
-  error_prev = error;
-  output_prev = output;
+  pid.prev_time = curr_time;
+  pid.error_prev = error;
+  pid.output_prev = output;
 }
 
 void MotorController::pid_position_task()
 {
-  static uint64_t prev_time = esp_timer_get_time();
-  static uint64_t curr_time = esp_timer_get_time();
-  static float diff_time = 0;
+  pid_state &pid = position_pid;
+  uint64_t curr_time;
+  float diff_time;
+  float error;
+  float derivative;
+  float output;
+
+  float feedforward;
+  float time_constant;
+  float command;
+  trajectory_point reference;
 
-  static float error_prev = 0;
-  static float error = 0;
-  static float integral = 0;
-  static float derivative = 0;
+  curr_time = esp_timer_get_time();
+  diff_time = (curr_time - pid.prev_time) / US_TO_S;
 
-  static float output_prev = 0;
-  static float output = 0;
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  trajectory.sample(curr_time - trajectory_start, &reference);
+  time_constant = sysid.valid ? sysid.time_constant : 0;
+  xSemaphoreGive(parameter_semaphore);
 
-  curr_time = esp_timer_get_time();
-  diff_time = (curr_time - prev_time) / US_TO_S;
+  // Reference rates in deg/s to RPM, positive towards increasing position
+  feedforward = motion_feedforward(reference.rate / 6.0, reference.acceleration / 6.0, time_constant);
 
-  position_sp = 360;
-  error = (position_dir * position_sp) - absolute_position;
-  integral += error * diff_time;
-  derivative = (error - error_prev) / diff_time;
+  error = reference.value - absolute_position;
+  pid.integral += error * diff_time;
+  derivative = (error - pid.error_prev) / diff_time;
 
   // Restrict integral to prevent integral windup
-  if (integral > PID_WINDUP * 10.0 / gain_mag)
-    integral = PID_WINDUP * 10.0 / gain_mag;
-  if (integral < -PID_WINDUP * 10.0 / gain_mag)
-    integral = -PID_WINDUP * 10.0 / gain_mag;
+  if (pid.integral > PID_WINDUP * 10.0 / gain_mag)
+    pid.integral = PID_WINDUP * 10.0 / gain_mag;
+  if (pid.integral < -PID_WINDUP * 10.0 / gain_mag)
+    pid.integral = -PID_WINDUP * 10.0 / gain_mag;
 
-  output = gain_mag / 10.0 * (kp * (abs(error) + 1 / ti * abs(integral) + td * derivative));
+  output = gain_mag / 10.0 * (kp * (abs(error) + 1 / ti * abs(pid.integral) + td * derivative));
 
   // Restrict output to duty cycle range
   if (output > PID_MAX_OUTPUT)
@@ -386,37 +571,244 @@ void MotorController::pid_position_task()
   else if (output < PID_MIN_OUTPUT)
     output = PID_MIN_OUTPUT;
 
-  ESP_LOGI(TAG, "DIR: %.3f, SP: %.3f, ABSO: %.3f, E: %.3f, I: %.3f, D: %.3f, O: %.3f",
-           position_dir, position_sp, absolute_position, error, integral, derivative, output);
+  ESP_LOGI(TAG, "REF: %.3f, RATE: %.3f, ABSO: %.3f, E: %.3f, I: %.3f, D: %.3f, O: %.3f",
+           reference.value, reference.rate, absolute_position, error, pid.integral, derivative, output);
 
-  // Controller only outputs a new value when error is outside oscillation threshold
-  if (fabs(error) > 5)
+  // Controller only outputs a new value when error is outside oscillation threshold or the
+  // reference is moving, positive commands turn counter-clockwise
+  command = (error >= 0 ? output : -output) + feedforward;
+  if (fabs(error) > 5 || feedforward != 0)
   {
-    if (error > 0)
+    if (command > 0)
       set_direction(COUNTERCLOCKWISE);
-    else if (error < 0)
+    else if (command < 0)
       set_direction(CLOCKWISE);
-    set_duty_cycle(abs(output));
+    set_duty_cycle(fabs(command));
   }
   else
     set_duty_cycle(0);
 
-  prev_time = curr_time;
-  error_prev = error;
-  output_prev = output;
+  pid.prev_time = curr_time;
+  pid.error_prev = error;
+  pid.output_prev = output;
+}
+
+// Samples the mean velocity over each identification period from the encoder position, which
+// has none of the moving average's lag, then applies the next excitation value
+void MotorController::system_id_task()
+{
+  uint64_t curr_time = esp_timer_get_time();
+
+  // Left without run_system_id() or cancelled by a mode change
+  if (!identifier.is_running())
+  {
+    set_mode(OFF);
+    return;
+  }
+
+  if (sysid_time == 0)
+  {
+    sysid_position = absolute_position;
+    sysid_time = curr_time;
+    sysid_input = identifier.next_input();
+    set_duty_cycle(sysid_input);
+    return;
+  }
+
+  if (curr_time - sysid_time < SystemIdentifier::SAMPLE_PERIOD * US_TO_S)
+    return;
+
+  float period = (curr_time - sysid_time) / US_TO_S;
+  float velocity = fabs(absolute_position - sysid_position) / period / 6.0; // deg/s to RPM
+  sysid_position = absolute_position;
+  sysid_time = curr_time;
+
+  identifier.update(sysid_input, velocity);
+  if (identifier.is_complete())
+  {
+    finish_system_id();
+    return;
+  }
+
+  sysid_input = identifier.next_input();
+  set_duty_cycle(sysid_input);
+}
+
+void MotorController::finish_system_id()
+{
+  sysid_result result;
+  bool apply;
+
+  identifier.finish(&result);
+  apply = sysid_settings.apply && result.valid;
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  sysid = result;
+  sysid_applied = apply;
+  xSemaphoreGive(parameter_semaphore);
+
+  ESP_LOGI(TAG, "Identified K = %.3f RPM, T = %.4f s, T2 = %.4f s, residual %.3f RPM%s.",
+           result.gain, result.time_constant, result.time_constant_2, result.residual, result.valid ? "" : " (invalid)");
+  if (apply)
+    set_pid_gains(result.kp, result.ti, result.td);
+
+  if (sysid_callback != nullptr)
+    sysid_callback(index);
+
+  // Suspends this task, so it goes last
+  set_mode(OFF);
+}
+
+// Runs the relay on the same filtered velocity the PID controller sees, so the limit cycle
+// includes the moving average's lag and the gains suit the loop they are used in
+void MotorController::autotune_task()
+{
+  uint64_t curr_time = esp_timer_get_time();
+  float period;
+
+  // Left without run_autotune() or cancelled by a mode change
+  if (!tuner.is_running())
+  {
+    if (tuner.is_complete())
+      finish_autotune();
+    else
+      set_mode(OFF);
+    return;
+  }
+
+  if (tune_time == 0)
+  {
+    tune_time = curr_time;
+    return;
+  }
+
+  period = (curr_time - tune_time) / US_TO_S;
+  tune_time = curr_time;
+
+  set_duty_cycle(tuner.next_input(fabs(velocity), period));
+}
+
+void MotorController::finish_autotune()
+{
+  GainSchedule &result = tuner.get_schedule();
+  esp_err_t err = ESP_OK;
+
+  tuner.cancel();
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  schedule = result;
+  xSemaphoreGive(parameter_semaphore);
+
+  for (uint8_t i = 0; i < result.get_count(); i++)
+  {
+    const gain_point &point = result.get_point(i);
+    ESP_LOGI(TAG, "Tuned %.1f RPM: Ku = %.5f, Tu = %.4f s, kp = %.6f, ti = %.4f.",
+             point.velocity, point.ultimate_gain, point.ultimate_period, point.kp, point.ti);
+  }
+
+  if (result.get_count() == 0)
+    ESP_LOGW(TAG, "Auto-tuning found no limit cycle, using the fixed gains.");
+  else if (tuner.get_save())
+  {
+    err = result.save(index);
+    if (err != ESP_OK)
+      ESP_LOGW(TAG, "Failed to save the gain schedule: %s.", esp_err_to_name(err));
+  }
+
+  if (autotune_callback != nullptr)
+    autotune_callback(index);
+
+  // Suspends this task, so it goes last
+  set_mode(OFF);
+}
+
+// Drives the PWM duty directly, the map being measured must not shape it
+void MotorController::friction_calibration_task()
+{
+  uint64_t curr_time = esp_timer_get_time();
+  float period;
+
+  // Left without run_friction_calibration() or cancelled by a mode change
+  if (!calibrator.is_running())
+  {
+    if (calibrator.is_complete())
+      finish_friction_calibration();
+    else
+      set_mode(OFF);
+    return;
+  }
+
+  if (calibrate_time == 0)
+  {
+    calibrate_time = curr_time;
+    return;
+  }
+
+  period = (curr_time - calibrate_time) / US_TO_S;
+  calibrate_time = curr_time;
+
+  float duty_cycle = calibrator.next_input(absolute_position, period);
+  if (calibrator.get_direction() != direction)
+    set_direction(calibrator.get_direction());
+  set_pwm_duty_cycle(duty_cycle);
+}
+
+void MotorController::finish_friction_calibration()
+{
+  ActuatorMap &result = calibrator.get_map();
+  esp_err_t err;
+
+  calibrator.cancel();
+
+  if (result.is_calibrated())
+  {
+    // The schedule was tuned through the old map, its gains no longer match the plant
+    xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+    actuator = result;
+    schedule.clear();
+    xSemaphoreGive(parameter_semaphore);
+
+    for (int32_t dir : {CLOCKWISE, COUNTERCLOCKWISE})
+    {
+      const actuator_friction &friction = result.get_friction(dir);
+      ESP_LOGI(TAG, "Calibrated %s: breakaway %.3f, Coulomb %.3f, viscous %.5f per RPM, %.1f RPM at full duty.",
+               dir == CLOCKWISE ? "clockwise" : "counter-clockwise",
+               friction.breakaway, friction.coulomb, friction.viscous, friction.max_velocity);
+    }
+
+    if (calibrator.get_save())
+    {
+      err = result.save(index);
+      if (err == ESP_OK)
+        err = schedule.erase(index);
+      if (err != ESP_OK)
+        ESP_LOGW(TAG, "Failed to save the actuator calibration: %s.", esp_err_to_name(err));
+    }
+  }
+  else
+    ESP_LOGW(TAG, "Actuator calibration failed, keeping the previous map.");
+
+  if (calibration_callback != nullptr)
+    calibration_callback(index);
+
+  // Suspends this task, so it goes last
+  set_mode(OFF);
 }
 
 void MotorController::display_task(void *arg)
 {
+  MotorController *motor = static_cast<MotorController *>(arg);
+
   while (1)
   {
-    ESP_LOGI(TAG, "Timestamp: %llu, Gain: %.3f, Duty Cycle: %.3f, Velocity (RPM): %.3f, Position (Deg): %.3f, Current (mA): %.3f",
-             motor_obj->timestamp,
-             motor_obj->gain,
-             motor_obj->duty_cycle,
-             motor_obj->velocity,
-             motor_obj->position,
-             motor_obj->current);
+    ESP_LOGI(TAG, "Motor: %u, Timestamp: %llu, Gain: %.3f, Duty Cycle: %.3f, Velocity (RPM): %.3f, Position (Deg): %.3f, Current (mA): %.3f",
+             motor->index,
+             motor->timestamp,
+             motor->gain,
+             motor->duty_cycle,
+             motor->velocity,
+             motor->position,
+             motor->current);
 
     vTaskDelay(display_config.delay / portTICK_PERIOD_MS);
   }
@@ -424,10 +816,14 @@ void MotorController::display_task(void *arg)
 
 void MotorController::tx_data_task(void *arg)
 {
+  MotorController *motor = static_cast<MotorController *>(arg);
+
   while (1)
   {
-    xSemaphoreTake(motor_obj->comm_semaphore, portMAX_DELAY);
-    comm.send_data(motor_obj->sample_ss.str().c_str(), motor_obj->sample_ss.str().length());
+    xSemaphoreTake(motor->comm_semaphore, portMAX_DELAY);
+    uint32_t length = motor->hold_sample_string();
+    comm.send_data(motor->sample_string, length);
+    motor->release_sample_string();
 
     vTaskDelay(tx_config.delay / portTICK_PERIOD_MS);
   }
@@ -462,25 +858,67 @@ void MotorController::stop_motor()
   xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
   mode = OFF;
   xSemaphoreGive(parameter_semaphore);
+  identifier.cancel();
+  tuner.cancel();
+  calibrator.cancel();
 
   ESP_LOGI(TAG, "Stopping motor.");
-  gpio_set_level(GPIO_IN1, 0);
-  gpio_set_level(GPIO_IN2, 0);
+  gpio_set_level(config->in1, 0);
+  gpio_set_level(config->in2, 0);
   set_duty_cycle(0);
 }
 
 void MotorController::set_mode(int32_t mode)
 {
+  // A mode no case handles would leave the bridge driven with nothing controlling it
+  if (mode < OFF || mode > CALIBRATION)
+  {
+    ESP_LOGW(TAG, "Motor %u ignores unknown mode %ld.", index, (long)mode);
+    return;
+  }
+  if (mode != OFF && supervisor.is_tripped())
+  {
+    ESP_LOGW(TAG, "Motor %u holds a fault, clear it before driving.", index);
+    return;
+  }
+
   xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  bool changed = this->mode != mode;
   this->mode = mode;
   xSemaphoreGive(parameter_semaphore);
 
+  if (changed)
+    capture.trigger(TRIGGER_MODE);
+  if (mode != SYSTEM_ID)
+    identifier.cancel();
+  if (mode != AUTO_TUNE)
+    tuner.cancel();
+  if (mode != CALIBRATION)
+    calibrator.cancel();
+  if (mode == AUTO_POSITION || mode == AUTO_VELOCITY)
+  {
+    // A new mode profiles a different quantity, it starts again from the measured one
+    if (changed)
+    {
+      xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+      trajectory.stop();
+      xSemaphoreGive(parameter_semaphore);
+    }
+    restart_trajectory();
+  }
+  else
+  {
+    xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+    trajectory.stop();
+    xSemaphoreGive(parameter_semaphore);
+  }
+
   switch (mode)
   {
   case OFF:
     ESP_LOGI(TAG, "Stopping motor.");
-    gpio_set_level(GPIO_IN1, 0);
-    gpio_set_level(GPIO_IN2, 0);
+    gpio_set_level(config->in1, 0);
+    gpio_set_level(config->in2, 0);
     set_duty_cycle(0);
     vTaskSuspend(pid_task_hdl);
     break;
@@ -494,6 +932,20 @@ void MotorController::set_mode(int32_t mode)
     break;
   case AUTO_VELOCITY:
     ESP_LOGI(TAG, "Setting controller mode to automatic velocity.");
+    // The PID only sets the direction when it changes, drive the bridge that OFF left braked
+    set_direction(direction);
+    vTaskResume(pid_task_hdl);
+    break;
+  case SYSTEM_ID:
+    ESP_LOGI(TAG, "Setting controller mode to system identification.");
+    vTaskResume(pid_task_hdl);
+    break;
+  case AUTO_TUNE:
+    ESP_LOGI(TAG, "Setting controller mode to auto-tune.");
+    vTaskResume(pid_task_hdl);
+    break;
+  case CALIBRATION:
+    ESP_LOGI(TAG, "Setting controller mode to actuator calibration.");
     vTaskResume(pid_task_hdl);
     break;
   }
@@ -514,68 +966,504 @@ void MotorController::set_frequency(float freq)
   this->freq = freq;
   xSemaphoreGive(parameter_semaphore);
 
+  if (mode == AUTO_POSITION || mode == AUTO_VELOCITY)
+    restart_trajectory();
+
   ESP_LOGI(TAG, "Setting frequency to %.3f.", freq);
 }
 
 void MotorController::set_position(float position_sp)
 {
   xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  bool changed = this->position_sp != position_sp;
   this->position_sp = position_sp;
   xSemaphoreGive(parameter_semaphore);
 
+  if (changed)
+    capture.trigger(TRIGGER_SETPOINT);
+  if (changed && mode == AUTO_POSITION)
+    restart_trajectory();
+
   ESP_LOGI(TAG, "Setting position set point to %.3f.", position_sp);
 }
 
 void MotorController::set_velocity(float velocity_sp)
 {
   xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  bool changed = this->velocity_sp != velocity_sp;
   this->velocity_sp = velocity_sp;
   xSemaphoreGive(parameter_semaphore);
 
+  if (changed)
+    capture.trigger(TRIGGER_SETPOINT);
+  if (changed && mode == AUTO_VELOCITY)
+    restart_trajectory();
+
   ESP_LOGI(TAG, "Setting velocity set point to %.3f.", velocity_sp);
 }
 
+// Selects the reference profile and its S-curve limits for the automatic modes
+esp_err_t MotorController::set_profile(int32_t profile, float velocity, float acceleration, float jerk)
+{
+  if (profile < PROFILE_SQUARE || profile > PROFILE_TABLE || velocity <= 0 || acceleration <= 0 || jerk < 0)
+    return ESP_ERR_INVALID_ARG;
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  if (profile == PROFILE_TABLE && trajectory.get_waveform_count() == 0)
+  {
+    xSemaphoreGive(parameter_semaphore);
+    return ESP_ERR_INVALID_STATE;
+  }
+  this->profile = profile;
+  profile_velocity = velocity;
+  profile_acceleration = acceleration;
+  profile_jerk = jerk;
+  xSemaphoreGive(parameter_semaphore);
+
+  ESP_LOGI(TAG, "Setting profile to %ld, limits %.1f RPM, %.1f RPM/s, %.1f RPM/s^2.",
+           (long)profile, velocity, acceleration, jerk);
+
+  if (mode == AUTO_POSITION || mode == AUTO_VELOCITY)
+    restart_trajectory();
+
+  return ESP_OK;
+}
+
+// Stores one cycle of the table profile, normalised to [-1, 1] and scaled by the set point
+esp_err_t MotorController::set_waveform(const float *points, uint8_t count)
+{
+  bool stored;
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  stored = trajectory.set_waveform(points, count);
+  xSemaphoreGive(parameter_semaphore);
+
+  if (!stored)
+    return ESP_ERR_INVALID_ARG;
+
+  ESP_LOGI(TAG, "Stored a waveform of %u points.", count);
+  return ESP_OK;
+}
+
+// Starts the reference from where it is, or from the measurement when none is running, so
+// changing the set point, frequency or profile never steps it
+void MotorController::restart_trajectory()
+{
+  trajectory_config config;
+  trajectory_point reference;
+  uint64_t curr_time = esp_timer_get_time();
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  if (trajectory.is_running())
+    trajectory.sample(curr_time - trajectory_start, &reference);
+  else
+    reference.value = (mode == AUTO_VELOCITY) ? velocity : absolute_position;
+
+  config.profile = profile;
+  config.rate = freq;
+  if (mode == AUTO_VELOCITY)
+  {
+    // Keeps turning the way it is going, or the way it was set before the reference
+    float sign = (reference.value < 0 || (reference.value == 0 && direction == COUNTERCLOCKWISE)) ? -1 : 1;
+    config.amplitude = sign * velocity_sp;
+    config.rate_limit = profile_acceleration;
+    config.acceleration_limit = profile_jerk > 0 ? profile_jerk : INFINITY;
+    config.jerk_limit = 0;
+  }
+  else
+  {
+    config.amplitude = position_sp;
+    config.rate_limit = profile_velocity * 6.0;
+    config.acceleration_limit = profile_acceleration * 6.0;
+    config.jerk_limit = profile_jerk * 6.0;
+  }
+
+  if (!trajectory.begin(config, reference.value))
+  {
+    config.profile = PROFILE_SQUARE;
+    trajectory.begin(config, reference.value);
+    ESP_LOGW(TAG, "Profile %ld cannot run at %.3f reversals per second, using a square wave.", (long)profile, freq);
+  }
+  trajectory_start = curr_time;
+  xSemaphoreGive(parameter_semaphore);
+}
+
+// Command for a reference velocity and acceleration in RPM and RPM/s, signed by direction, from
+// the first order model the calibrated actuator map makes of the motor. 0 when uncalibrated.
+float MotorController::motion_feedforward(float velocity, float acceleration, float time_constant)
+{
+  float speed = fabs(velocity) + time_constant * (velocity < 0 ? -acceleration : acceleration);
+  float command;
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  command = actuator.feedforward(fmaxf(speed, 0));
+  xSemaphoreGive(parameter_semaphore);
+
+  return velocity < 0 ? -command : command;
+}
+
 void MotorController::set_direction(int32_t direction)
 {
   xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
   this->direction = direction;
   xSemaphoreGive(parameter_semaphore);
 
+  supervisor.set_drive_direction(direction);
+
+  // A braking bridge has both inputs low under a forced enable
+  if (supervisor.is_tripped())
+    return;
+
   switch (direction)
   {
   case CLOCKWISE:
     // ESP_LOGI(TAG, "Setting motor direction to clockwise.");
-    gpio_set_level(GPIO_IN1, 1);
-    gpio_set_level(GPIO_IN2, 0);
+    gpio_set_level(config->in1, 1);
+    gpio_set_level(config->in2, 0);
     break;
   case COUNTERCLOCKWISE:
     // ESP_LOGI(TAG, "Setting motor direction to counter-clockwise.");
-    gpio_set_level(GPIO_IN1, 0);
-    gpio_set_level(GPIO_IN2, 1);
+    gpio_set_level(config->in1, 0);
+    gpio_set_level(config->in2, 1);
     break;
   }
 }
 
 void MotorController::set_duty_cycle(float duty_cycle)
 {
+  float pwm_duty_cycle;
+
   if (duty_cycle > 1.0)
     duty_cycle = 1.0;
 
   xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
   this->duty_cycle_mag = duty_cycle;
+  pwm_duty_cycle = actuator.to_duty(duty_cycle, direction, velocity_mag == 0);
+  pwm_duty = duty_cycle > 0 ? pwm_duty_cycle : 0;
   xSemaphoreGive(parameter_semaphore);
 
   if (mode == MANUAL)
     ESP_LOGI(TAG, "Setting motor duty cycle to %.3f.", duty_cycle);
-  duty_cycle = (duty_cycle * (1 - MIN_DUTY_CYCLE)) + MIN_DUTY_CYCLE; // Changes scale
+  ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(cmpr_hdl, TIMER_PERIOD * pwm_duty_cycle));
+}
+
+// Bypasses the actuator map, the recorded duty cycle is the PWM duty itself
+void MotorController::set_pwm_duty_cycle(float duty_cycle)
+{
+  duty_cycle = fminf(fmaxf(duty_cycle, 0), 1);
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  this->duty_cycle_mag = duty_cycle;
+  pwm_duty = duty_cycle;
+  xSemaphoreGive(parameter_semaphore);
+
   ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(cmpr_hdl, TIMER_PERIOD * duty_cycle));
 }
 
+void MotorController::set_pid_gains(float kp, float ti, float td)
+{
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  this->kp = kp;
+  this->ti = ti;
+  this->td = td;
+  xSemaphoreGive(parameter_semaphore);
+
+  ESP_LOGI(TAG, "Setting PID gains to kp = %.6f, ti = %.6f, td = %.6f.", kp, ti, td);
+}
+
+// Length of the velocity moving average in update periods, restarting it. Longer than the
+// reserved window is refused.
+bool MotorController::set_velocity_window(uint16_t window)
+{
+  if (window == 0 || window > VELOCITY_WINDOW_SIZE)
+    return false;
+
+  velocity_window = window;
+  ESP_LOGI(TAG, "Setting the velocity window to %u samples.", window);
+  return true;
+}
+
+// Spins the motor clockwise through the excitation, then stops it and reports the model
+esp_err_t MotorController::run_system_id(const sysid_config &config)
+{
+  if (identifier.is_running() || tuner.is_running() || calibrator.is_running() || supervisor.is_tripped())
+    return ESP_ERR_INVALID_STATE;
+
+  if (!identifier.begin(config))
+    return ESP_ERR_INVALID_ARG;
+
+  sysid_settings = config;
+  sysid_time = 0;
+
+  ESP_LOGI(TAG, "Starting system identification: %s, order %u, %.2f +/- %.2f for %.1f s.",
+           config.excitation == EXCITATION_PRBS ? "PRBS" : "chirp", config.order, config.offset, config.amplitude, config.duration);
+  set_direction(CLOCKWISE);
+  set_mode(SYSTEM_ID);
+
+  return ESP_OK;
+}
+
+// Formats the last identification as a reported properties document, returns 0 if there is none
+uint32_t MotorController::get_system_id_string(char *dest, uint32_t size)
+{
+  sysid_result result;
+  bool applied;
+  float gains[3];
+  int length;
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  result = sysid;
+  applied = sysid_applied;
+  gains[0] = kp;
+  gains[1] = ti;
+  gains[2] = td;
+  xSemaphoreGive(parameter_semaphore);
+
+  if (result.samples == 0)
+    return 0;
+
+  // Gains are too small for the three decimals of the sample fields
+  length = snprintf(dest, size,
+                    "{\"system_id\":{\"valid\":%s,\"order\":%u,\"samples\":%lu,\"period\":%g,"
+                    "\"gain\":%g,\"time_constant\":%g,\"time_constant_2\":%g,\"residual\":%g,"
+                    "\"a1\":%g,\"a2\":%g,\"b0\":%g,\"b1\":%g,\"b2\":%g,\"bias\":%g,"
+                    "\"kp\":%g,\"ti\":%g,\"td\":%g,\"applied\":%s},"
+                    "\"pid\":{\"kp\":%g,\"ti\":%g,\"td\":%g}}",
+                    result.valid ? "true" : "false", result.order, (unsigned long)result.samples, result.sample_period,
+                    result.gain, result.time_constant, result.time_constant_2, result.residual,
+                    result.a1, result.a2, result.b0, result.b1, result.b2, result.bias,
+                    result.kp, result.ti, result.td, applied ? "true" : "false",
+                    gains[0], gains[1], gains[2]);
+
+  if (length < 0 || (uint32_t)length >= size)
+  {
+    ESP_LOGW(TAG, "System identification report exceeds %lu bytes.", (unsigned long)size);
+    return 0;
+  }
+
+  return length;
+}
+
+void MotorController::set_system_id_callback(void (*callback)(uint8_t motor))
+{
+  sysid_callback = callback;
+}
+
+// Loads the actuator map and gain schedule stored by previous calibration runs, needs NVS to be
+// initialised
+void MotorController::load_calibration()
+{
+  ActuatorMap stored_actuator;
+  GainSchedule stored;
+  controller_tuning tuning;
+  esp_err_t err = controller_tuning_load(index, &tuning);
+
+  if (err == ESP_OK)
+  {
+    set_pid_gains(tuning.kp, tuning.ti, tuning.td);
+    if (!set_velocity_window(tuning.velocity_window))
+      ESP_LOGW(TAG, "Stored velocity window of %u samples exceeds the filter, keeping %u.", tuning.velocity_window,
+               velocity_window);
+  }
+  else if (err == ESP_ERR_NOT_FOUND)
+    ESP_LOGI(TAG, "No controller tuning stored, using the tuned defaults.");
+  else
+    ESP_LOGW(TAG, "Failed to load the controller tuning: %s.", esp_err_to_name(err));
+
+  err = stored_actuator.load(index);
+
+  if (err == ESP_OK)
+  {
+    xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+    actuator = stored_actuator;
+    xSemaphoreGive(parameter_semaphore);
+    ESP_LOGI(TAG, "Loaded the actuator calibration, %.1f RPM at full command.", stored_actuator.get_max_velocity());
+  }
+  else if (err == ESP_ERR_NOT_FOUND)
+    ESP_LOGI(TAG, "No actuator calibration stored, using the fixed duty cycle remap.");
+  else
+    ESP_LOGW(TAG, "Failed to load the actuator calibration: %s.", esp_err_to_name(err));
+
+  err = stored.load(index);
+
+  if (err == ESP_ERR_NOT_FOUND)
+  {
+    ESP_LOGI(TAG, "No gain schedule stored, using the fixed gains.");
+    return;
+  }
+  if (err != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Failed to load the gain schedule: %s.", esp_err_to_name(err));
+    return;
+  }
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  schedule = stored;
+  xSemaphoreGive(parameter_semaphore);
+
+  ESP_LOGI(TAG, "Loaded a gain schedule of %u points.", stored.get_count());
+}
+
+// Tunes each operating point clockwise in turn, then stops the motor and reports the schedule
+esp_err_t MotorController::run_autotune(const autotune_config &config)
+{
+  if (tuner.is_running() || identifier.is_running() || calibrator.is_running() || supervisor.is_tripped())
+    return ESP_ERR_INVALID_STATE;
+
+  // Settling starts from the middle of the duty cycle range rather than a standstill
+  if (!tuner.begin(config, 0.5))
+    return ESP_ERR_INVALID_ARG;
+
+  tune_time = 0;
+
+  ESP_LOGI(TAG, "Starting auto-tune: %u points from %.1f to %.1f RPM, relay %.2f, hysteresis %.2f RPM.",
+           config.points, config.min_velocity, config.max_velocity, config.amplitude, config.hysteresis);
+  set_direction(CLOCKWISE);
+  set_mode(AUTO_TUNE);
+
+  return ESP_OK;
+}
+
+// Returns to the fixed gains and removes the stored schedule
+void MotorController::clear_gain_schedule()
+{
+  esp_err_t err;
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  schedule.clear();
+  xSemaphoreGive(parameter_semaphore);
+
+  err = schedule.erase(index);
+  if (err != ESP_OK && err != ESP_ERR_NOT_FOUND)
+    ESP_LOGW(TAG, "Failed to erase the gain schedule: %s.", esp_err_to_name(err));
+
+  ESP_LOGI(TAG, "Cleared the gain schedule.");
+}
+
+// Formats the schedule in use as a reported properties document, points keyed by index
+uint32_t MotorController::get_gain_schedule_string(char *dest, uint32_t size)
+{
+  GainSchedule current;
+  uint32_t length = 0;
+  int written;
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  current = schedule;
+  xSemaphoreGive(parameter_semaphore);
+
+  written = snprintf(dest, size, "{\"gain_schedule\":{\"count\":%u,\"points\":{", current.get_count());
+  for (uint8_t i = 0; i < current.get_count() && written >= 0 && length + written < size; i++)
+  {
+    const gain_point &point = current.get_point(i);
+
+    length += written;
+    written = snprintf(dest + length, size - length,
+                       "%s\"%u\":{\"velocity\":%g,\"kp\":%g,\"ti\":%g,\"td\":%g,\"ku\":%g,\"tu\":%g}",
+                       i > 0 ? "," : "", i, point.velocity, point.kp, point.ti, point.td,
+                       point.ultimate_gain, point.ultimate_period);
+  }
+  if (written >= 0 && length + written < size)
+  {
+    length += written;
+    written = snprintf(dest + length, size - length, "}}}");
+  }
+
+  if (written < 0 || length + written >= size)
+  {
+    ESP_LOGW(TAG, "Gain schedule report exceeds %lu bytes.", (unsigned long)size);
+    return 0;
+  }
+
+  return length + written;
+}
+
+void MotorController::set_autotune_callback(void (*callback)(uint8_t motor))
+{
+  autotune_callback = callback;
+}
+
+// Measures both directions in turn from rest, then stops the motor and reports the map
+esp_err_t MotorController::run_friction_calibration(bool save)
+{
+  if (calibrator.is_running() || identifier.is_running() || tuner.is_running() || supervisor.is_tripped())
+    return ESP_ERR_INVALID_STATE;
+
+  calibrator.begin(save);
+  calibrate_time = 0;
+
+  ESP_LOGI(TAG, "Starting actuator calibration.");
+  set_direction(calibrator.get_direction());
+  set_mode(CALIBRATION);
+
+  return ESP_OK;
+}
+
+// Returns to the fixed duty cycle remap and removes the stored map
+void MotorController::clear_friction_calibration()
+{
+  esp_err_t err;
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  actuator.reset(MIN_DUTY_CYCLE);
+  xSemaphoreGive(parameter_semaphore);
+
+  err = actuator.erase(index);
+  if (err != ESP_OK)
+    ESP_LOGW(TAG, "Failed to erase the actuator calibration: %s.", esp_err_to_name(err));
+
+  ESP_LOGI(TAG, "Cleared the actuator calibration.");
+}
+
+// Formats the map in use as a reported properties document
+uint32_t MotorController::get_actuator_string(char *dest, uint32_t size)
+{
+  ActuatorMap current;
+  int length;
+
+  xSemaphoreTake(parameter_semaphore, portMAX_DELAY);
+  current = actuator;
+  xSemaphoreGive(parameter_semaphore);
+
+  const actuator_friction &cw = current.get_friction(CLOCKWISE);
+  const actuator_friction &ccw = current.get_friction(COUNTERCLOCKWISE);
+
+  length = snprintf(dest, size,
+                    "{\"actuator\":{\"calibrated\":%s,\"max_velocity\":%g,"
+                    "\"clockwise\":{\"breakaway\":%g,\"coulomb\":%g,\"viscous\":%g,\"max_velocity\":%g},"
+                    "\"counterclockwise\":{\"breakaway\":%g,\"coulomb\":%g,\"viscous\":%g,\"max_velocity\":%g}}}",
+                    current.is_calibrated() ? "true" : "false", current.get_max_velocity(),
+                    cw.breakaway, cw.coulomb, cw.viscous, cw.max_velocity,
+                    ccw.breakaway, ccw.coulomb, ccw.viscous, ccw.max_velocity);
+
+  if (length < 0 || (uint32_t)length >= size)
+  {
+    ESP_LOGW(TAG, "Actuator report exceeds %lu bytes.", (unsigned long)size);
+    return 0;
+  }
+
+  return length;
+}
+
+void MotorController::set_calibration_callback(void (*callback)(uint8_t motor))
+{
+  calibration_callback = callback;
+}
+
+uint8_t MotorController::get_index()
+{
+  return index;
+}
+
 uint64_t MotorController::get_timestamp()
 {
   return timestamp;
 }
 
+int32_t MotorController::get_mode()
+{
+  return mode;
+}
+
 float MotorController::get_duty_cycle()
 {
   return duty_cycle;
@@ -601,67 +1489,297 @@ float MotorController::get_current()
   return current;
 }
 
-void MotorController::format_samples()
+// Takes the sample string unless a sender holds it open, then the new frame is dropped rather
+// than waiting on the link
+bool MotorController::lock_sample_string()
+{
+  xSemaphoreTake(sample_semaphore, portMAX_DELAY);
+  if (sample_readers == 0)
+    return true;
+
+  xSemaphoreGive(sample_semaphore);
+  ESP_LOGW(TAG, "Last frame is still being sent, dropping frame.");
+  return false;
+}
+
+// Returns true if the frame replaced the last one
+bool MotorController::format_samples()
+{
+  uint8_t prev_buffer = (curr_buffer + SAMPLE_BUFFER_COUNT - 1) % SAMPLE_BUFFER_COUNT;
+  frame_columns columns = get_frame_columns(prev_buffer);
+
+  if (!lock_sample_string())
+    return false;
+
+  // Frames that do not fit are dropped rather than sent as truncated JSON
+  sample_length = format_frame(sample_string, SAMPLE_STRING_SIZE, columns, SAMPLE_VECTOR_SIZE);
+  if (sample_length == 0)
+    ESP_LOGW(TAG, "Sample frame exceeds %lu bytes, dropping frame.", (unsigned long)SAMPLE_STRING_SIZE);
+
+  xSemaphoreGive(sample_semaphore);
+
+  // ESP_LOGI(TAG, "%s", sample_string);
+  return true;
+}
+
+bool MotorController::compress_samples()
+{
+  uint8_t prev_buffer = (curr_buffer + SAMPLE_BUFFER_COUNT - 1) % SAMPLE_BUFFER_COUNT;
+  frame_columns columns = get_frame_columns(prev_buffer);
+  uint64_t start_time = esp_timer_get_time();
+
+  if (!lock_sample_string())
+    return false;
+
+  sample_length = compress_frame(compressor, sample_string, SAMPLE_STRING_SIZE, columns, SAMPLE_VECTOR_SIZE);
+  if (sample_length == 0)
+    ESP_LOGW(TAG, "Compressed frame exceeds %lu bytes, dropping frame.", (unsigned long)SAMPLE_STRING_SIZE);
+
+  xSemaphoreGive(sample_semaphore);
+
+  ESP_LOGD(TAG, "Compressed %lu byte frame to %lu bytes in %llu us.",
+           (unsigned long)compressor.get_input_length(), (unsigned long)sample_length,
+           (unsigned long long)(esp_timer_get_time() - start_time));
+  return true;
+}
+
+// Columns of a finished sample buffer, in frame order
+frame_columns MotorController::get_frame_columns(uint8_t buffer)
 {
-  static uint8_t prev_buffer = 0;
-  prev_buffer = (curr_buffer + 1) % 2;
+  return {
+      .timestamp = timestamp_buffer[buffer],
+      .gain = gain_buffer[buffer],
+      .duty_cycle = duty_cycle_buffer[buffer],
+      .velocity = velocity_buffer[buffer],
+      .position = position_buffer[buffer],
+      .current = current_buffer[buffer],
+  };
+}
 
-  sample_ss.str("");
-  sample_ss.precision(3);
-  sample_ss << fixed;
+// Keeps the finished frame's summary until the next one, the update task reuses its slot
+void MotorController::store_summary()
+{
+  uint8_t prev_buffer = (curr_buffer + SAMPLE_BUFFER_COUNT - 1) % SAMPLE_BUFFER_COUNT;
 
-  sample_ss << "{\"timestamp\":[";
-  for (auto value : timestamp_vector[prev_buffer])
-    sample_ss << value << ",";
-  sample_ss.seekp(sample_ss.tellp() - 1);
-  sample_ss << "],";
+  xSemaphoreTake(sample_semaphore, portMAX_DELAY);
+  latest_summary = summary[prev_buffer];
+  xSemaphoreGive(sample_semaphore);
+}
 
-  sample_ss << "\"gain\":[";
-  for (auto value : gain_vector[prev_buffer])
-    sample_ss << value << ",";
-  sample_ss.seekp(sample_ss.tellp() - 1);
-  sample_ss << "],";
+// Formats the latest frame summary as JSON, returns 0 if it does not fit
+uint32_t MotorController::get_summary_string(char *dest, uint32_t size)
+{
+  xSemaphoreTake(sample_semaphore, portMAX_DELAY);
+  uint32_t length = format_summary(dest, size, latest_summary);
+  xSemaphoreGive(sample_semaphore);
 
-  sample_ss << "\"duty_cycle\":[";
-  for (auto value : duty_cycle_vector[prev_buffer])
-    sample_ss << value << ",";
-  sample_ss.seekp(sample_ss.tellp() - 1);
-  sample_ss << "],";
+  if (length == 0)
+    ESP_LOGW(TAG, "Frame summary exceeds %lu bytes, dropping summary.", (unsigned long)size);
 
-  sample_ss << "\"velocity\":[";
-  for (auto value : velocity_vector[prev_buffer])
-    sample_ss << value << ",";
-  sample_ss.seekp(sample_ss.tellp() - 1);
-  sample_ss << "],";
+  return length;
+}
 
-  sample_ss << "\"position\":[";
-  for (auto value : position_vector[prev_buffer])
-    sample_ss << value << ",";
-  sample_ss.seekp(sample_ss.tellp() - 1);
-  sample_ss << "],";
+// Keeps the frame from being reformatted until it is released. The semaphore is only taken to
+// count the sender in and out, a slow link drops frames rather than holding up the format task.
+uint32_t MotorController::hold_sample_string()
+{
+  xSemaphoreTake(sample_semaphore, portMAX_DELAY);
+  sample_readers++;
+  uint32_t length = sample_length;
+  xSemaphoreGive(sample_semaphore);
 
-  sample_ss << "\"current\":[";
-  for (auto value : current_vector[prev_buffer])
-    sample_ss << value << ",";
-  sample_ss.seekp(sample_ss.tellp() - 1);
-  sample_ss << "]}\n";
+  return length;
+}
 
-  timestamp_vector[prev_buffer].clear();
-  gain_vector[prev_buffer].clear();
-  duty_cycle_vector[prev_buffer].clear();
-  velocity_vector[prev_buffer].clear();
-  position_vector[prev_buffer].clear();
-  current_vector[prev_buffer].clear();
+void MotorController::release_sample_string()
+{
+  xSemaphoreTake(sample_semaphore, portMAX_DELAY);
+  sample_readers--;
+  xSemaphoreGive(sample_semaphore);
+}
 
-  // ESP_LOGI(TAG, "%s", sample_ss.str().c_str());
+// The network task's frame, held until close_sample_string() and read in chunks
+uint32_t MotorController::open_sample_string()
+{
+  sample_offset = 0;
+  return hold_sample_string();
 }
 
-string MotorController::get_sample_string()
+uint32_t MotorController::read_sample_string(char *dest, uint32_t size)
 {
-  return sample_ss.str();
+  uint32_t length = sample_length - sample_offset;
+
+  if (length > size)
+    length = size;
+
+  memcpy(dest, sample_string + sample_offset, length);
+  sample_offset += length;
+
+  return length;
+}
+
+void MotorController::close_sample_string()
+{
+  release_sample_string();
 }
 
 uint64_t MotorController::get_sample_count()
 {
   return sample_count;
-}
\ No newline at end of file
+}
+
+void MotorController::set_sample_callback(void (*callback)(uint8_t motor))
+{
+  sample_callback = callback;
+}
+
+// Returns false if a capture is already in progress or waiting to be uploaded
+bool MotorController::trigger_capture()
+{
+  return capture.trigger(TRIGGER_REQUEST);
+}
+
+uint32_t MotorController::get_capture_id()
+{
+  return capture.get_sequence();
+}
+
+// Formats what the host needs to rebuild the capture as JSON, returns 0 if none is complete
+uint32_t MotorController::get_capture_metadata(char *dest, uint32_t size)
+{
+  uint32_t length = 0;
+  bool complete = true;
+
+  if (capture.get_state() != CAPTURE_COMPLETE)
+    return 0;
+
+  complete &= append_text(dest, size, &length, "{\"capture\":{");
+  complete &= append_field(dest, size, &length, "motor", (uint64_t)index);
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "id", (uint64_t)get_capture_id());
+  complete &= append_text(dest, size, &length, ",\"trigger\":\"");
+  complete &= append_text(dest, size, &length, CAPTURE_TRIGGER_NAMES[capture.get_trigger()]);
+  complete &= append_text(dest, size, &length, "\",");
+  complete &= append_field(dest, size, &length, "trigger_time", capture.get_trigger_timestamp());
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "trigger_us", (uint64_t)capture.get_trigger_time());
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "sample_rate", (uint64_t)curr_sen.get_sample_freq());
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "samples", (uint64_t)capture.get_sample_count());
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "trigger_index", (uint64_t)capture.get_trigger_index());
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "edges", (uint64_t)capture.get_edge_count());
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "length", (uint64_t)capture.get_length());
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "zero_mv", (float)curr_sen.get_zero_voltage(sensor_channel));
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "offset_mv", curr_sen.get_offset_mv(sensor_channel));
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "mv_per_code", curr_sen.get_mv_per_code(sensor_channel));
+  complete &= append_text(dest, size, &length, ",");
+  complete &= append_field(dest, size, &length, "ma_per_mv", curr_sen.get_ma_per_mv());
+  complete &= append_text(dest, size, &length, "}}");
+
+  if (!complete)
+  {
+    ESP_LOGW(TAG, "Capture metadata exceeds %lu bytes.", (unsigned long)size);
+    return 0;
+  }
+  dest[length] = '\0';
+
+  return length;
+}
+
+uint32_t MotorController::get_capture_length()
+{
+  return capture.get_state() == CAPTURE_COMPLETE ? capture.get_length() : 0;
+}
+
+uint32_t MotorController::read_capture(uint32_t offset, uint8_t *dest, uint32_t size)
+{
+  return capture.read(offset, dest, size);
+}
+
+void MotorController::release_capture()
+{
+  capture.release();
+}
+
+void MotorController::set_capture_callback(void (*callback)(uint8_t motor))
+{
+  capture_callback = callback;
+  capture.set_complete_callback(capture_complete, this);
+}
+
+// Formats the features of the last condition window as JSON, returns 0 before the first completes
+uint32_t MotorController::get_spectrum_string(char *dest, uint32_t size)
+{
+  return monitor.get_features_string(dest, size);
+}
+
+// Called from the spectrum task when a condition window completes
+void MotorController::set_spectrum_callback(void (*callback)(uint8_t motor))
+{
+  monitor.set_features_callback(callback);
+}
+
+SafetyFault MotorController::get_fault()
+{
+  return supervisor.get_fault();
+}
+
+// Releases the bridge with the motor off, returns ESP_ERR_INVALID_STATE if no fault is latched
+esp_err_t MotorController::clear_fault()
+{
+  if (!supervisor.is_tripped())
+    return ESP_ERR_INVALID_STATE;
+
+  set_mode(OFF);
+  supervisor.clear();
+  fault_reported = false;
+  if (fault_callback != nullptr)
+    fault_callback(index);
+
+  return ESP_OK;
+}
+
+// Formats the latched fault, or the last one once cleared, as a reported properties document
+uint32_t MotorController::get_fault_string(char *dest, uint32_t size)
+{
+  return supervisor.get_report_string(dest, size);
+}
+
+void MotorController::set_fault_callback(void (*callback)(uint8_t motor))
+{
+  fault_callback = callback;
+}
+
+LiveRing *MotorController::get_live_ring()
+{
+  return &live_ring;
+}
+
+// Called from the ADC interrupt on overcurrent and the update task otherwise, the force holds
+// over whatever the comparator is set to until it is released
+IRAM_ATTR void MotorController::safety_output(void *context, SafetyOutput output)
+{
+  MotorController *motor = static_cast<MotorController *>(context);
+
+  if (output != OUTPUT_RELEASE)
+  {
+    gpio_set_level(motor->config->in1, 0);
+    gpio_set_level(motor->config->in2, 0);
+  }
+  mcpwm_generator_set_force_level(motor->gen_hdl, output == OUTPUT_RELEASE ? -1 : output == OUTPUT_BRAKE ? 1 : 0, true);
+}
+
+void MotorController::capture_complete(void *context)
+{
+  MotorController *motor = static_cast<MotorController *>(context);
+
+  if (motor->capture_callback != nullptr)
+    motor->capture_callback(motor->index);
+}
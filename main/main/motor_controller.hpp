@@ -6,13 +6,28 @@
 #include <chrono>
 #include <string>
 #include <cmath>
-#include <vector>
-#include <sstream>
 
 #include "configuration.hpp"
 #include "communication.hpp"
 #include "current_sensor.hpp"
 #include "moving_average.hpp"
+#include "compressor.hpp"
+#include "summary.hpp"
+#include "frame_format.hpp"
+#include "capture.hpp"
+#include "condition_monitor.hpp"
+#include "safety_supervisor.hpp"
+#include "live_server.hpp"
+#include "system_id.hpp"
+#include "relay_tuner.hpp"
+#include "gain_schedule.hpp"
+#include "controller_tuning.hpp"
+#include "tuned_gains.hpp"
+#include "actuator_map.hpp"
+#include "friction_calibrator.hpp"
+#include "trajectory.hpp"
+#include "memory_arena.hpp"
+#include "recorder.hpp"
 #include "azure_iot_freertos.h"
 
 #include "freertos/FreeRTOS.h"
@@ -35,6 +50,9 @@ enum ControllerMode : int32_t
   MANUAL = 1,
   AUTO_POSITION = 2,
   AUTO_VELOCITY = 3,
+  SYSTEM_ID = 4, // Set by run_system_id() for the length of the excitation
+  AUTO_TUNE = 5, // Set by run_autotune() until every operating point is tuned
+  CALIBRATION = 6, // Set by run_friction_calibration() until both directions are measured
 };
 
 enum MotorDirection : int32_t
@@ -43,11 +61,26 @@ enum MotorDirection : int32_t
   CLOCKWISE = 1
 };
 
+// PID state carried between control periods
+typedef struct
+{
+  uint64_t prev_time;
+  float error_prev;
+  float integral;
+  float output_prev;
+} pid_state;
+
+// One motor's controller. Every instance owns its state, pins and peripherals from
+// MOTOR_CONFIGS[index], while the sampling of all motors runs in one shared update task.
 class MotorController
 {
 private:
   // Class variables
+  uint8_t index;
+  const motor_config *config;
+
   uint64_t sample_time;
+  uint64_t edge_time; // Time of the previous encoder watch point
   int32_t actual_direction;
   float duty_cycle_mag;
   float velocity_mag;
@@ -59,7 +92,6 @@ private:
   float freq;
   float position_sp;
   float velocity_sp;
-  float position_dir;
 
   uint64_t timestamp;
   int32_t direction;
@@ -68,47 +100,65 @@ private:
   float position;
   float current;
 
-  // Sample strings
-  static constexpr uint16_t VECTOR_SIZE = 500;
-  static constexpr uint16_t MIN_STRING_SIZE = VECTOR_SIZE * 1.05;
-
+  // Sample buffers
   uint8_t curr_buffer;
+  uint16_t sample_index;
   uint64_t sample_count;
 
-  static constexpr uint32_t timestamp_size = MIN_STRING_SIZE * 14;
-  static constexpr uint32_t direction_size = MIN_STRING_SIZE * 8;
-  static constexpr uint32_t duty_cycle_size = MIN_STRING_SIZE * 6;
-  static constexpr uint32_t velocity_size = MIN_STRING_SIZE * 8;
-  static constexpr uint32_t position_size = MIN_STRING_SIZE * 8;
-  static constexpr uint32_t current_size = MIN_STRING_SIZE * 9;
-  static constexpr uint32_t sample_size = timestamp_size +
-                                          direction_size +
-                                          duty_cycle_size +
-                                          velocity_size +
-                                          position_size +
-                                          current_size + 83;
-
-  vector<uint64_t> timestamp_vector[2];
-  vector<float> gain_vector[2];
-  vector<float> duty_cycle_vector[2];
-  vector<float> velocity_vector[2];
-  vector<float> position_vector[2];
-  vector<float> current_vector[2];
-
-  stringstream sample_ss;
+  uint64_t *timestamp_buffer[SAMPLE_BUFFER_COUNT];
+  float *gain_buffer[SAMPLE_BUFFER_COUNT];
+  float *duty_cycle_buffer[SAMPLE_BUFFER_COUNT];
+  float *velocity_buffer[SAMPLE_BUFFER_COUNT];
+  float *position_buffer[SAMPLE_BUFFER_COUNT];
+  float *current_buffer[SAMPLE_BUFFER_COUNT];
+
+  char *sample_string;
+  uint32_t sample_length;
+  uint32_t sample_offset; // Read position of the open frame
+  uint8_t sample_readers; // Senders holding the frame open, guarded by sample_semaphore
+  void (*sample_callback)(uint8_t motor); // Called from the format task when a new frame is ready
+
+  StreamCompressor compressor;
+
+  // Per-frame summaries, reduced in the update task alongside the sample buffers
+  frame_summary summary[SAMPLE_BUFFER_COUNT];
+  frame_summary latest_summary; // Copy of the last complete frame, guarded by sample_semaphore
+
+  // Current sensor channel in the shared sampler, and the triggered capture of it
+  uint8_t sensor_channel;
+  Capture capture;
+  void (*capture_callback)(uint8_t motor); // Called from the ADC task when a capture completes
+  static void capture_complete(void *context);
+
+  // Spectral condition monitoring of the current and unfiltered velocity
+  ConditionMonitor monitor;
+
+  // Overcurrent, stall, encoder and link protection, forcing the bridge through gen_hdl
+  SafetySupervisor supervisor;
+  float pwm_duty;      // Duty on ENA after the actuator map, 0 while commanded off
+  bool fault_reported; // The PID task has stopped the motor for the latched fault
+  void (*fault_callback)(uint8_t motor); // Called from the PID task when a fault latches and on clear_fault()
+  static void safety_output(void *context, SafetyOutput output);
+
+  // Every sample for the live telemetry server, pushed by the update task
+  LiveRing live_ring;
+
+  MovingAverage velocity_average;
+  uint16_t velocity_window; // Set by set_velocity_window(), applied by the update task
 
   // ESP handles
   mcpwm_cmpr_handle_t cmpr_hdl;
+  mcpwm_gen_handle_t gen_hdl;
   pcnt_unit_handle_t unit_hdl;
 
   // System properties
   static constexpr float REDUCTION_RATIO = 65.0; // DC motor's reduction ratio
 
   static constexpr double VELOCITY_SAMPLE_SIZE = 2.0;  // Amount of counts to sample for velocity
-  static constexpr uint8_t VELOCITY_WINDOW_SIZE = 100; // Size of window for velocity moving average
+  static constexpr uint8_t VELOCITY_WINDOW_SIZE = 100; // Longest window of the velocity moving average
   static constexpr float CALI_FACTOR = 1.03798;        // Calibration factor to align velocity and position with reference
 
-  static constexpr float MIN_DUTY_CYCLE = 0.5; // Scales duty cycle
+  static constexpr float MIN_DUTY_CYCLE = 0.5; // Lowest PWM duty until the actuator is calibrated
   static constexpr uint8_t TIMEOUT = 50;       // Timeout before velocity zeros (in ms)
 
   // PID controller properties
@@ -117,9 +167,53 @@ private:
   static constexpr float PID_OSCILLATION = 0.02; // Percent allowed oscillation
   static constexpr uint8_t PID_WINDUP = 25;      // Maximum integral windup
 
-  static constexpr float kp = 0.00544;
-  static constexpr float ti = 0.11655;
-  static constexpr float td = 0;
+  // Defaults from the offline tuning (dtmc_gain_tuner), replaced by a unit's own tuning in NVS
+  // and by system identification
+  static constexpr float DEFAULT_KP = TUNED_KP;
+  static constexpr float DEFAULT_TI = TUNED_TI;
+  static constexpr float DEFAULT_TD = TUNED_TD;
+  static_assert(TUNED_VELOCITY_WINDOW <= VELOCITY_WINDOW_SIZE, "Tuned velocity window exceeds the filter");
+
+  float kp;
+  float ti;
+  float td;
+
+  pid_state velocity_pid;
+  pid_state position_pid;
+
+  // System identification, driven from the PID task
+  SystemIdentifier identifier;
+  sysid_config sysid_settings;
+  sysid_result sysid;           // Last finished run, guarded by parameter_semaphore
+  bool sysid_applied;
+  uint64_t sysid_time;          // esp_timer time of the last identification sample, 0 before the first
+  float sysid_input;            // Excitation applied since sysid_time
+  float sysid_position;         // Position at sysid_time
+  void (*sysid_callback)(uint8_t motor); // Called from the PID task when a run finishes
+
+  // Relay auto-tuning, driven from the PID task, and the velocity gains it schedules
+  RelayTuner tuner;
+  GainSchedule schedule;           // Used in place of kp, ti and td when not empty, guarded by parameter_semaphore
+  uint64_t tune_time;              // esp_timer time of the last relay sample, 0 before the first
+  void (*autotune_callback)(uint8_t motor); // Called from the PID task when tuning finishes
+
+  // Dead zone and friction calibration, driven from the PID task, and the command to PWM duty map
+  FrictionCalibrator calibrator;
+  ActuatorMap actuator;               // Guarded by parameter_semaphore
+  uint64_t calibrate_time;            // esp_timer time of the last calibration sample, 0 before the first
+  void (*calibration_callback)(uint8_t motor); // Called from the PID task when calibration finishes
+
+  // Reference for the automatic modes, reversing at freq, guarded by parameter_semaphore
+  Trajectory trajectory;
+  uint64_t trajectory_start; // esp_timer time the trajectory's times are relative to
+  int32_t profile;
+  float profile_velocity;     // S-curve limits in RPM, RPM/s and RPM/s^2, applied to
+  float profile_acceleration; // position as they are and to velocity shifted down one
+  float profile_jerk;         // derivative, 0 jerk is unlimited
+
+  static constexpr float DEFAULT_PROFILE_VELOCITY = 60;
+  static constexpr float DEFAULT_PROFILE_ACCELERATION = 300;
+  static constexpr float DEFAULT_PROFILE_JERK = 3000;
 
   // MCPWM properties
   static constexpr uint32_t TIMER_RES = 80000000; // 80 MHz
@@ -144,9 +238,9 @@ private:
   SemaphoreHandle_t parameter_semaphore;
   SemaphoreHandle_t buffer_semaphore;
   SemaphoreHandle_t comm_semaphore;
+  SemaphoreHandle_t sample_semaphore;
 
-  // Update task
-  TaskHandle_t update_task_hdl;
+  // Update task, shared by every motor
   static void update_trampoline(void *arg);
   void update_task();
 
@@ -159,6 +253,15 @@ private:
   static void pid_trampoline(void *arg);
   void pid_velocity_task();
   void pid_position_task();
+  void system_id_task();
+  void finish_system_id();
+  void autotune_task();
+  void finish_autotune();
+  void friction_calibration_task();
+  void finish_friction_calibration();
+  void set_pwm_duty_cycle(float duty_cycle);
+  void restart_trajectory();
+  float motion_feedforward(float velocity, float acceleration, float time_constant);
 
   // TX Data task
   TaskHandle_t tx_data_task_hdl;
@@ -171,7 +274,8 @@ private:
 public:
   MotorController();
 
-  void init();
+  void init(uint8_t index);
+  uint8_t get_index();
   void stop_motor();
 
   // Accessor and mutator functions
@@ -183,22 +287,70 @@ public:
   void set_frequency(float freq);
   void set_position(float position_sp);
   void set_velocity(float velocity_sp);
+  esp_err_t set_profile(int32_t profile, float velocity, float acceleration, float jerk);
+  esp_err_t set_waveform(const float *points, uint8_t count);
 
   uint64_t get_timestamp();
+  int32_t get_mode();
   int32_t get_direction();
   float get_duty_cycle();
   float get_velocity();
   float get_position();
   float get_current();
-  string get_sample_string();
+  uint32_t open_sample_string();
+  uint32_t read_sample_string(char *dest, uint32_t size);
+  void close_sample_string();
+  uint32_t get_summary_string(char *dest, uint32_t size);
   uint64_t get_sample_count();
+  void set_sample_callback(void (*callback)(uint8_t motor));
+
+  void set_pid_gains(float kp, float ti, float td);
+  bool set_velocity_window(uint16_t window);
+  esp_err_t run_system_id(const sysid_config &config);
+  uint32_t get_system_id_string(char *dest, uint32_t size);
+  void set_system_id_callback(void (*callback)(uint8_t motor));
+
+  void load_calibration();
+  esp_err_t run_autotune(const autotune_config &config);
+  void clear_gain_schedule();
+  uint32_t get_gain_schedule_string(char *dest, uint32_t size);
+  void set_autotune_callback(void (*callback)(uint8_t motor));
+
+  esp_err_t run_friction_calibration(bool save);
+  void clear_friction_calibration();
+  uint32_t get_actuator_string(char *dest, uint32_t size);
+  void set_calibration_callback(void (*callback)(uint8_t motor));
+
+  bool trigger_capture();
+  uint32_t get_capture_id();
+  uint32_t get_capture_metadata(char *dest, uint32_t size);
+  uint32_t get_capture_length();
+  uint32_t read_capture(uint32_t offset, uint8_t *dest, uint32_t size);
+  void release_capture();
+  void set_capture_callback(void (*callback)(uint8_t motor));
+
+  uint32_t get_spectrum_string(char *dest, uint32_t size);
+  void set_spectrum_callback(void (*callback)(uint8_t motor));
+
+  SafetyFault get_fault();
+  esp_err_t clear_fault();
+  uint32_t get_fault_string(char *dest, uint32_t size);
+  void set_fault_callback(void (*callback)(uint8_t motor));
+
+  LiveRing *get_live_ring();
 
   void enable_display();
   void disable_display();
   void enable_communication();
   void disable_communication();
 
-  void format_samples();
+  bool lock_sample_string();
+  uint32_t hold_sample_string();
+  void release_sample_string();
+  bool format_samples();
+  bool compress_samples();
+  frame_columns get_frame_columns(uint8_t buffer);
+  void store_summary();
 };
 
 #endif // MOTOR_CONTROLLER_H_
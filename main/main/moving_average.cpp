@@ -1,20 +1,54 @@
 // Includes
 #include "moving_average.hpp"
 
+MovingAverage::MovingAverage()
+{
+  window = nullptr;
+  capacity = 0;
+  window_size = 0;
+  count = 0;
+  sum = 0;
+  index = 0;
+}
+
 MovingAverage::MovingAverage(uint64_t window_size)
+{
+  init(window_size);
+}
+
+// Reserves the window, for filters that are members of an object constructed before the arenas
+void MovingAverage::init(uint64_t window_size)
 {
   this->window_size = window_size;
+  capacity = window_size;
+  window = (float *)memory_reserve(MEMORY_ARENA_FILTERS, window_size * sizeof(float));
+  count = 0;
   sum = 0;
   index = 0;
 }
 
+// Shortens or restores the window within its reserved length and restarts the average, returns
+// false if it does not fit
+bool MovingAverage::resize(uint64_t window_size)
+{
+  if (window_size == 0 || window_size > capacity)
+    return false;
+
+  this->window_size = window_size;
+  count = 0;
+  sum = 0;
+  index = 0;
+
+  return true;
+}
+
 float MovingAverage::next(float value)
 {
-  if (window.size() < window_size)
+  if (count < window_size)
   {
-    window.push_back(value);
+    window[count++] = value;
     sum += value;
-    return sum / (float)window.size();
+    return sum / (float)count;
   }
   else
   {
@@ -22,6 +56,10 @@ float MovingAverage::next(float value)
     sum += value;
     window[index] = value;
     index = (index + 1) % window_size;
-    return sum / (float)window.size();
+    return sum / (float)count;
   }
-}
\ No newline at end of file
+}
+uint64_t MovingAverage::get_window_size()
+{
+  return window_size;
+}
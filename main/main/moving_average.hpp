@@ -3,20 +3,28 @@
 
 // Includes
 #include <stdio.h>
-#include <vector>
+#include "memory_budget.h"
 #include "esp_log.h"
 
 class MovingAverage
 {
 private:
-  std::vector<float> window;
+  float *window;
+  uint64_t capacity; // Reserved length
   uint64_t window_size;
+  uint64_t count;
   float sum;
   uint64_t index;
 
 public:
+  MovingAverage();
   MovingAverage(uint64_t window_size);
+
+  void init(uint64_t window_size);
+  bool resize(uint64_t window_size);
   float next(float value);
+
+  uint64_t get_window_size();
 };
 
 #endif // MOVING_AVERAGE_H_
@@ -0,0 +1,492 @@
+// Includes
+#include "record_format.hpp"
+
+#include <string.h>
+
+static constexpr uint8_t BLOCK_MAGIC[2] = {'D', 'R'};
+
+static uint32_t put_varint(uint8_t *dest, uint64_t value)
+{
+  uint32_t length = 0;
+
+  while (value >= 0x80)
+  {
+    dest[length++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  dest[length++] = (uint8_t)value;
+
+  return length;
+}
+
+static uint32_t put_signed(uint8_t *dest, int64_t value)
+{
+  return put_varint(dest, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static uint32_t put_bits(uint8_t *dest, uint32_t bits)
+{
+  for (uint8_t i = 0; i < 4; i++)
+    dest[i] = (uint8_t)(bits >> (8 * i));
+  return 4;
+}
+
+static uint32_t float_bits(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static uint8_t tag(RecordType type, uint8_t index)
+{
+  return (uint8_t)(type << 4) | index;
+}
+
+RecordEncoder::RecordEncoder()
+{
+  tick = 0;
+  edge_time = 0;
+
+  for (uint8_t i = 0; i <= MAX_RECORD_INDEX; i++)
+  {
+    count[i] = 0;
+    code[i] = 0;
+    millivolts[i] = 0;
+    output[i] = 0;
+  }
+}
+
+// TICK record when the tick has moved on since the last stamped record
+uint32_t RecordEncoder::stamp(uint8_t *dest, uint32_t tick)
+{
+  if (tick == this->tick)
+    return 0;
+
+  uint32_t length = 0;
+  dest[length++] = tag(RECORD_TICK, 0);
+  length += put_varint(dest + length, tick - this->tick);
+  this->tick = tick;
+
+  return length;
+}
+
+// Starts a stream, every delta is against zero again
+uint32_t RecordEncoder::header(uint8_t *dest, uint32_t tick_rate, uint64_t time, uint32_t tick)
+{
+  uint32_t length = 0;
+
+  *this = RecordEncoder();
+  this->tick = tick;
+  edge_time = time;
+
+  dest[length++] = tag(RECORD_HEADER, 0);
+  dest[length++] = RECORD_VERSION;
+  length += put_varint(dest + length, tick_rate);
+  length += put_varint(dest + length, time);
+  length += put_varint(dest + length, tick);
+
+  return length;
+}
+
+// Edges carry their own time, interrupts are not tick-stamped
+uint32_t RecordEncoder::edge(uint8_t *dest, uint8_t motor, uint64_t time, int32_t watch_point)
+{
+  uint32_t length = 0;
+
+  if (motor > MAX_RECORD_INDEX)
+    return 0;
+
+  dest[length++] = tag(RECORD_EDGE, motor);
+  length += put_signed(dest + length, (int64_t)(time - edge_time));
+  length += put_signed(dest + length, watch_point);
+  edge_time = time;
+
+  return length;
+}
+
+uint32_t RecordEncoder::count_read(uint8_t *dest, uint32_t tick, uint8_t motor, int32_t count)
+{
+  uint32_t length = 0;
+
+  if (motor > MAX_RECORD_INDEX || count == this->count[motor])
+    return 0;
+
+  length += stamp(dest, tick);
+  dest[length++] = tag(RECORD_COUNT, motor);
+  length += put_signed(dest + length, (int64_t)count - this->count[motor]);
+  this->count[motor] = count;
+
+  return length;
+}
+
+uint32_t RecordEncoder::adc(uint8_t *dest, uint32_t tick, uint8_t channel, int32_t code, int32_t millivolts)
+{
+  uint32_t length = 0;
+
+  if (channel > MAX_RECORD_INDEX || (code == this->code[channel] && millivolts == this->millivolts[channel]))
+    return 0;
+
+  length += stamp(dest, tick);
+  dest[length++] = tag(RECORD_ADC, channel);
+  length += put_signed(dest + length, (int64_t)code - this->code[channel]);
+  length += put_signed(dest + length, (int64_t)millivolts - this->millivolts[channel]);
+  this->code[channel] = code;
+  this->millivolts[channel] = millivolts;
+
+  return length;
+}
+
+uint32_t RecordEncoder::zero(uint8_t *dest, uint32_t tick, uint8_t channel, int32_t millivolts)
+{
+  uint32_t length = 0;
+
+  if (channel > MAX_RECORD_INDEX)
+    return 0;
+
+  length += stamp(dest, tick);
+  dest[length++] = tag(RECORD_ZERO, channel);
+  length += put_signed(dest + length, millivolts);
+
+  return length;
+}
+
+uint32_t RecordEncoder::parameter(uint8_t *dest, uint32_t tick, uint8_t motor, uint8_t parameter,
+                                  const float *values, uint8_t count)
+{
+  uint32_t length = 0;
+
+  if (motor > MAX_RECORD_INDEX || count > MAX_RECORD_VALUES)
+    return 0;
+
+  length += stamp(dest, tick);
+  dest[length++] = tag(RECORD_PARAMETER, motor);
+  dest[length++] = parameter;
+  dest[length++] = count;
+  for (uint8_t i = 0; i < count; i++)
+    length += put_bits(dest + length, float_bits(values[i]));
+
+  return length;
+}
+
+// A null data records that nothing was loaded, so the replay finds nothing either
+uint32_t RecordEncoder::load(uint8_t *dest, uint32_t tick, uint8_t motor, const char *key, const void *data,
+                             uint32_t size)
+{
+  uint32_t length = 0;
+  size_t key_length = strlen(key);
+
+  if (data == nullptr)
+    size = 0;
+  if (motor > MAX_RECORD_INDEX || key_length >= MAX_RECORD_KEY_SIZE || size > MAX_RECORD_LOAD_SIZE)
+    return 0;
+
+  length += stamp(dest, tick);
+  dest[length++] = tag(RECORD_LOAD, motor);
+  dest[length++] = (uint8_t)key_length;
+  memcpy(dest + length, key, key_length);
+  length += key_length;
+  length += put_varint(dest + length, size);
+  if (size > 0)
+    memcpy(dest + length, data, size);
+  length += size;
+
+  return length;
+}
+
+uint32_t RecordEncoder::output_sample(uint8_t *dest, uint32_t tick, uint8_t motor, float duty_cycle)
+{
+  uint32_t length = 0;
+  uint32_t bits = float_bits(duty_cycle);
+
+  if (motor > MAX_RECORD_INDEX || bits == output[motor])
+    return 0;
+
+  length += stamp(dest, tick);
+  dest[length++] = tag(RECORD_OUTPUT, motor);
+  length += put_bits(dest + length, bits);
+  output[motor] = bits;
+
+  return length;
+}
+
+uint32_t RecordEncoder::end(uint8_t *dest, bool overflowed)
+{
+  dest[0] = tag(RECORD_END, overflowed ? 1 : 0);
+  return 1;
+}
+
+RecordDecoder::RecordDecoder(const uint8_t *stream, uint32_t length)
+{
+  this->stream = stream;
+  this->length = length;
+  offset = 0;
+  failed = false;
+
+  tick = 0;
+  edge_time = 0;
+
+  for (uint8_t i = 0; i <= MAX_RECORD_INDEX; i++)
+  {
+    count[i] = 0;
+    code[i] = 0;
+    millivolts[i] = 0;
+  }
+}
+
+bool RecordDecoder::read_byte(uint8_t *value)
+{
+  if (offset >= length)
+    return false;
+
+  *value = stream[offset++];
+  return true;
+}
+
+bool RecordDecoder::read_varint(uint64_t *value)
+{
+  uint8_t byte = 0x80;
+
+  *value = 0;
+  for (uint8_t shift = 0; byte & 0x80; shift += 7)
+  {
+    if (shift > 63 || !read_byte(&byte))
+      return false;
+    *value |= (uint64_t)(byte & 0x7F) << shift;
+  }
+
+  return true;
+}
+
+bool RecordDecoder::read_signed(int64_t *value)
+{
+  uint64_t coded;
+
+  if (!read_varint(&coded))
+    return false;
+
+  *value = (int64_t)(coded >> 1) ^ -(int64_t)(coded & 1);
+  return true;
+}
+
+bool RecordDecoder::read_float(float *value)
+{
+  uint32_t bits = 0;
+
+  if (length - offset < 4)
+    return false;
+
+  for (uint8_t i = 0; i < 4; i++)
+    bits |= (uint32_t)stream[offset++] << (8 * i);
+  memcpy(value, &bits, sizeof(bits));
+
+  return true;
+}
+
+bool RecordDecoder::next(record_entry *entry)
+{
+  uint8_t byte;
+  uint64_t unsigned_value;
+  int64_t signed_value = 0;
+  int64_t millivolts_value = 0;
+  bool complete = true;
+
+  while (true)
+  {
+    if (failed || !read_byte(&byte))
+      return false;
+
+    entry->type = (RecordType)(byte >> 4);
+    entry->index = byte & 0x0F;
+    entry->tick = tick;
+    if (entry->type != RECORD_TICK)
+      break;
+
+    if (!read_varint(&unsigned_value))
+    {
+      failed = true;
+      return false;
+    }
+    tick += (uint32_t)unsigned_value;
+  }
+
+  entry->time = 0;
+  entry->value = 0;
+  entry->millivolts = 0;
+  entry->parameter = 0;
+  entry->value_count = 0;
+  entry->key[0] = '\0';
+  entry->data = nullptr;
+  entry->size = 0;
+
+  switch (entry->type)
+  {
+  case RECORD_HEADER:
+    complete = read_byte(&byte) && byte == RECORD_VERSION && read_varint(&unsigned_value);
+    entry->value = (int32_t)unsigned_value;
+    complete = complete && read_varint(&entry->time) && read_varint(&unsigned_value);
+    if (complete)
+    {
+      // Every delta starts again, as it does in the encoder
+      uint32_t position = offset;
+      *this = RecordDecoder(stream, length);
+      offset = position;
+      tick = (uint32_t)unsigned_value;
+      edge_time = entry->time;
+      entry->tick = tick;
+    }
+    break;
+
+  case RECORD_EDGE:
+    complete = read_signed(&signed_value) && read_signed(&millivolts_value);
+    if (complete)
+    {
+      edge_time += signed_value;
+      entry->time = edge_time;
+      entry->value = (int32_t)millivolts_value;
+    }
+    break;
+
+  case RECORD_COUNT:
+    complete = read_signed(&signed_value);
+    if (complete)
+    {
+      count[entry->index] += (int32_t)signed_value;
+      entry->value = count[entry->index];
+    }
+    break;
+
+  case RECORD_ADC:
+    complete = read_signed(&signed_value) && read_signed(&millivolts_value);
+    if (complete)
+    {
+      code[entry->index] += (int32_t)signed_value;
+      millivolts[entry->index] += (int32_t)millivolts_value;
+      entry->value = code[entry->index];
+      entry->millivolts = millivolts[entry->index];
+    }
+    break;
+
+  case RECORD_ZERO:
+    complete = read_signed(&signed_value);
+    if (complete)
+      entry->value = (int32_t)signed_value;
+    break;
+
+  case RECORD_PARAMETER:
+    complete = read_byte(&entry->parameter) && read_byte(&entry->value_count) &&
+               entry->value_count <= MAX_RECORD_VALUES;
+    for (uint8_t i = 0; complete && i < entry->value_count; i++)
+      complete = read_float(&entry->values[i]);
+    break;
+
+  case RECORD_LOAD:
+    complete = read_byte(&byte) && byte < MAX_RECORD_KEY_SIZE && length - offset >= byte;
+    if (complete)
+    {
+      memcpy(entry->key, stream + offset, byte);
+      entry->key[byte] = '\0';
+      offset += byte;
+    }
+    complete = complete && read_varint(&unsigned_value) && unsigned_value <= MAX_RECORD_LOAD_SIZE &&
+               length - offset >= unsigned_value;
+    if (complete && unsigned_value > 0)
+    {
+      entry->data = stream + offset;
+      entry->size = (uint32_t)unsigned_value;
+      offset += entry->size;
+    }
+    break;
+
+  case RECORD_OUTPUT:
+    complete = read_float(&entry->values[0]);
+    entry->value_count = 1;
+    break;
+
+  case RECORD_END:
+    entry->value = entry->index;
+    entry->index = 0;
+    break;
+
+  default:
+    complete = false;
+    break;
+  }
+
+  failed = !complete;
+  return complete;
+}
+
+uint32_t RecordDecoder::get_offset()
+{
+  return offset;
+}
+
+bool RecordDecoder::get_failed()
+{
+  return failed;
+}
+
+static uint16_t fletcher16(const uint8_t *data, uint32_t length, uint16_t sum1, uint16_t sum2)
+{
+  for (uint32_t i = 0; i < length; i++)
+  {
+    sum1 = (sum1 + data[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+
+  return (uint16_t)(sum2 << 8 | sum1);
+}
+
+static uint16_t block_checksum(const uint8_t *block, uint32_t payload_length)
+{
+  // Sequence and payload follow each other in the block
+  return fletcher16(block + 4, 4 + payload_length, 0, 0);
+}
+
+uint32_t record_block_frame(uint8_t *block, uint32_t sequence, uint32_t payload_length)
+{
+  uint32_t length = RECORD_BLOCK_HEADER_SIZE + payload_length;
+
+  block[0] = BLOCK_MAGIC[0];
+  block[1] = BLOCK_MAGIC[1];
+  block[2] = (uint8_t)payload_length;
+  block[3] = (uint8_t)(payload_length >> 8);
+  put_bits(block + 4, sequence);
+
+  uint16_t checksum = block_checksum(block, payload_length);
+  block[length++] = (uint8_t)checksum;
+  block[length++] = (uint8_t)(checksum >> 8);
+
+  return length;
+}
+
+bool record_block_find(const uint8_t *stream, size_t length, size_t *offset, uint32_t *sequence,
+                       const uint8_t **payload, uint32_t *payload_length)
+{
+  for (size_t start = *offset; start + RECORD_BLOCK_HEADER_SIZE + RECORD_BLOCK_TRAILER_SIZE <= length; start++)
+  {
+    const uint8_t *block = stream + start;
+
+    if (block[0] != BLOCK_MAGIC[0] || block[1] != BLOCK_MAGIC[1])
+      continue;
+
+    uint32_t size = block[2] | (uint32_t)block[3] << 8;
+    if (size > MAX_RECORD_BLOCK_PAYLOAD ||
+        start + RECORD_BLOCK_HEADER_SIZE + size + RECORD_BLOCK_TRAILER_SIZE > length)
+      continue;
+
+    const uint8_t *trailer = block + RECORD_BLOCK_HEADER_SIZE + size;
+    if (block_checksum(block, size) != (trailer[0] | trailer[1] << 8))
+      continue;
+
+    *sequence = block[4] | (uint32_t)block[5] << 8 | (uint32_t)block[6] << 16 | (uint32_t)block[7] << 24;
+    *payload = block + RECORD_BLOCK_HEADER_SIZE;
+    *payload_length = size;
+    *offset = start + RECORD_BLOCK_HEADER_SIZE + size + RECORD_BLOCK_TRAILER_SIZE;
+    return true;
+  }
+
+  *offset = length;
+  return false;
+}
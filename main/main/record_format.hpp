@@ -0,0 +1,152 @@
+#ifndef RECORD_FORMAT_H_
+#define RECORD_FORMAT_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary log of the raw inputs the controller acts on, so a run on the board can be fed back into
+// the host build of the controller. Nothing here depends on the ESP-IDF, the recorder encodes with
+// it on the board and host/sim/replay.cpp decodes with it.
+//
+// A log is a stream of records, each a tag byte, the record type in the high nibble and the motor
+// or ADC channel in the low nibble, then its fields. Integers are LEB128 varints, signed ones zigzag
+// coded, and most values are deltas against the previous record of their kind, so a steady motor
+// costs a few bytes per tick. Records stamped with the FreeRTOS tick are preceded by a TICK record
+// whenever the tick moves on. The stream is cut into checksummed blocks, which a reader finds
+// even between other output on the same UART.
+
+static constexpr uint8_t RECORD_VERSION = 1;
+static constexpr uint8_t MAX_RECORD_INDEX = 15;    // Motors and ADC channels the tag can name
+static constexpr uint8_t MAX_RECORD_VALUES = 64;   // Values of one parameter change, a full waveform
+static constexpr uint8_t MAX_RECORD_KEY_SIZE = 16; // NVS key limit, including the terminator
+static constexpr uint32_t MAX_RECORD_LOAD_SIZE = 384;
+static constexpr uint32_t MAX_RECORD_SIZE = 512;   // Longest record, including its TICK record
+
+enum RecordType : uint8_t
+{
+  RECORD_HEADER = 0,    // Version, tick rate, esp_timer time and tick when recording started
+  RECORD_TICK = 1,      // Ticks since the previous tick-stamped record
+  RECORD_EDGE = 2,      // Encoder watch point: us since the previous edge, watch point value
+  RECORD_COUNT = 3,     // Pulse count the update task read, as a change
+  RECORD_ADC = 4,       // Conversion the ADC task filtered: raw code and calibrated mV, as changes
+  RECORD_ZERO = 5,      // Zero voltage a current sensor channel measured
+  RECORD_PARAMETER = 6, // External command: parameter, value count, float values
+  RECORD_LOAD = 7,      // Calibration read from NVS: key, size and bytes, size 0 if none was read
+  RECORD_OUTPUT = 8,    // Duty cycle the update task sampled, as float bits
+  RECORD_END = 15,      // Recording stopped, value 1 if the buffer overflowed
+};
+
+// External commands, applied the way main.cpp's bridge functions apply them
+enum RecordParameter : uint8_t
+{
+  PARAMETER_MODE = 0,                        // mode
+  PARAMETER_GAIN = 1,                        // gain
+  PARAMETER_FREQUENCY = 2,                   // frequency
+  PARAMETER_POSITION = 3,                    // position set point
+  PARAMETER_VELOCITY = 4,                    // velocity set point
+  PARAMETER_PROFILE = 5,                     // profile, velocity, acceleration, jerk
+  PARAMETER_WAVEFORM = 6,                    // waveform points
+  PARAMETER_SYSTEM_ID = 7,                   // excitation, order, offset, amplitude, duration, response, apply
+  PARAMETER_AUTOTUNE = 8,                    // min velocity, max velocity, points, amplitude, hysteresis, save
+  PARAMETER_FRICTION_CALIBRATION = 9,        // save
+  PARAMETER_CLEAR_GAIN_SCHEDULE = 10,        // none
+  PARAMETER_CLEAR_FRICTION_CALIBRATION = 11, // none
+  PARAMETER_CLEAR_FAULT = 12,                // none
+};
+
+typedef struct
+{
+  RecordType type;
+  uint8_t index;  // Motor or ADC channel
+  uint32_t tick;  // Tick of the record, the start tick of a header
+  uint64_t time;  // esp_timer time of an edge or a header in us
+  int32_t value;  // Count, raw code, zero mV, watch point, tick rate or end reason
+  int32_t millivolts;
+
+  uint8_t parameter;
+  uint8_t value_count;
+  float values[MAX_RECORD_VALUES];
+
+  char key[MAX_RECORD_KEY_SIZE];
+  const uint8_t *data; // Into the decoded stream, nullptr if nothing was loaded
+  uint32_t size;
+} record_entry;
+
+// Writes records into caller buffers of at least MAX_RECORD_SIZE bytes and returns their length,
+// 0 if there is nothing to record because the value has not changed or it does not fit
+class RecordEncoder
+{
+private:
+  // Class variables
+  uint32_t tick;
+  uint64_t edge_time;
+  int32_t count[MAX_RECORD_INDEX + 1];
+  int32_t code[MAX_RECORD_INDEX + 1];
+  int32_t millivolts[MAX_RECORD_INDEX + 1];
+  uint32_t output[MAX_RECORD_INDEX + 1];
+
+  uint32_t stamp(uint8_t *dest, uint32_t tick);
+
+public:
+  RecordEncoder();
+
+  uint32_t header(uint8_t *dest, uint32_t tick_rate, uint64_t time, uint32_t tick);
+  uint32_t edge(uint8_t *dest, uint8_t motor, uint64_t time, int32_t watch_point);
+  uint32_t count_read(uint8_t *dest, uint32_t tick, uint8_t motor, int32_t count);
+  uint32_t adc(uint8_t *dest, uint32_t tick, uint8_t channel, int32_t code, int32_t millivolts);
+  uint32_t zero(uint8_t *dest, uint32_t tick, uint8_t channel, int32_t millivolts);
+  uint32_t parameter(uint8_t *dest, uint32_t tick, uint8_t motor, uint8_t parameter, const float *values,
+                     uint8_t count);
+  uint32_t load(uint8_t *dest, uint32_t tick, uint8_t motor, const char *key, const void *data, uint32_t size);
+  uint32_t output_sample(uint8_t *dest, uint32_t tick, uint8_t motor, float duty_cycle);
+  uint32_t end(uint8_t *dest, bool overflowed);
+};
+
+// Reads the records of a stream joined from its blocks, in order
+class RecordDecoder
+{
+private:
+  // Class variables
+  const uint8_t *stream;
+  uint32_t length;
+  uint32_t offset;
+  bool failed;
+
+  uint32_t tick;
+  uint64_t edge_time;
+  int32_t count[MAX_RECORD_INDEX + 1];
+  int32_t code[MAX_RECORD_INDEX + 1];
+  int32_t millivolts[MAX_RECORD_INDEX + 1];
+
+  bool read_byte(uint8_t *value);
+  bool read_varint(uint64_t *value);
+  bool read_signed(int64_t *value);
+  bool read_float(float *value);
+
+public:
+  RecordDecoder(const uint8_t *stream, uint32_t length);
+
+  // False at the end of the stream, or at a record that does not decode
+  bool next(record_entry *entry);
+
+  uint32_t get_offset();
+  bool get_failed();
+};
+
+// Blocks: "DR", payload length (u16), sequence (u32), payload, Fletcher-16 of the sequence and
+// payload, little endian
+static constexpr uint32_t RECORD_BLOCK_HEADER_SIZE = 8;
+static constexpr uint32_t RECORD_BLOCK_TRAILER_SIZE = 2;
+static constexpr uint32_t MAX_RECORD_BLOCK_PAYLOAD = 1024;
+static constexpr uint32_t MAX_RECORD_BLOCK_SIZE = RECORD_BLOCK_HEADER_SIZE + MAX_RECORD_BLOCK_PAYLOAD +
+                                                  RECORD_BLOCK_TRAILER_SIZE;
+
+// Frames the payload already written at block + RECORD_BLOCK_HEADER_SIZE, returns the block length
+uint32_t record_block_frame(uint8_t *block, uint32_t sequence, uint32_t payload_length);
+
+// Finds the next intact block at or after *offset, skipping anything else, and moves *offset past it
+bool record_block_find(const uint8_t *stream, size_t length, size_t *offset, uint32_t *sequence,
+                       const uint8_t **payload, uint32_t *payload_length);
+
+#endif // RECORD_FORMAT_H_
@@ -0,0 +1,310 @@
+// Includes
+#include "recorder.hpp"
+#include "memory_arena.hpp"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static constexpr char *TAG = "Recorder";
+
+static Recorder input_recorder;
+
+Recorder &recorder()
+{
+  return input_recorder;
+}
+
+Recorder::Recorder()
+{
+  scratch = nullptr;
+
+  ring = nullptr;
+  capacity = 0;
+  head = 0;
+  fill = 0;
+
+  block = nullptr;
+  sequence = 0;
+  sent = 0;
+
+  recording = false;
+  overflowed = false;
+  ending = false;
+
+  portMUX_INITIALIZE(&lock);
+
+  drain_task_hdl = NULL;
+}
+
+// Buffers come from the recorder arena, so the first start must be before memory_lock()
+void Recorder::start()
+{
+  if (RECORDER_BUFFER_SIZE == 0)
+  {
+    ESP_LOGW(TAG, "Recording is not configured, CONFIG_DTMC_RECORDER is off.");
+    return;
+  }
+
+  if (ring == nullptr)
+  {
+    capacity = RECORDER_BUFFER_SIZE;
+    ring = memory_arena(MEMORY_ARENA_RECORDER).reserve_array<uint8_t>(capacity);
+    scratch = memory_arena(MEMORY_ARENA_RECORDER).reserve_array<uint8_t>(MAX_RECORD_SIZE);
+    block = memory_arena(MEMORY_ARENA_RECORDER).reserve_array<uint8_t>(MAX_RECORD_BLOCK_SIZE);
+  }
+
+  comm.init();
+  if (drain_task_hdl == NULL)
+  {
+    xTaskCreatePinnedToCore(drain_task, "Recorder Task", recorder_config.stack_size, this, recorder_config.priority, &drain_task_hdl, recorder_config.core);
+    memory_guard_task(drain_task_hdl);
+  }
+
+  uint64_t time = esp_timer_get_time();
+  uint32_t tick = xTaskGetTickCount();
+
+  portENTER_CRITICAL(&lock);
+  if (!recording)
+  {
+    overflowed = false;
+    ending = false;
+    append(encoder.header(scratch, configTICK_RATE_HZ, time, tick));
+    recording = true;
+  }
+  portEXIT_CRITICAL(&lock);
+
+  ESP_LOGI(TAG, "Recording controller inputs into %lu bytes.", (unsigned long)capacity);
+}
+
+void Recorder::stop()
+{
+  portENTER_CRITICAL(&lock);
+  if (recording)
+    finish(false);
+  portEXIT_CRITICAL(&lock);
+}
+
+// Sends every waiting block from the calling task, to empty the ring before a stop or reset
+void Recorder::flush()
+{
+  while (send_block() > 0)
+    ;
+}
+
+// Copies the record in scratch to the ring, under the lock. A record which does not fit ends
+// the log, so a replay stops where the inputs stop.
+bool Recorder::append(uint32_t length)
+{
+  if (length == 0)
+    return true;
+
+  if (capacity - fill < length + END_SIZE)
+  {
+    finish(true);
+    return false;
+  }
+
+  uint32_t first = length < capacity - head ? length : capacity - head;
+  memcpy(ring + head, scratch, first);
+  memcpy(ring, scratch + first, length - first);
+  head = (head + length) % capacity;
+  fill += length;
+
+  return true;
+}
+
+// Under the lock, END_SIZE is always left free for it
+void Recorder::finish(bool overflowed)
+{
+  uint32_t length = encoder.end(scratch, overflowed);
+
+  for (uint32_t i = 0; i < length; i++)
+  {
+    ring[head] = scratch[i];
+    head = (head + 1) % capacity;
+  }
+  fill += length;
+
+  this->overflowed = overflowed;
+  recording = false;
+  ending = true;
+}
+
+// Moves up to one block from the ring, the UART write is outside the lock
+uint32_t Recorder::send_block()
+{
+  uint32_t length;
+  uint32_t block_sequence;
+
+  portENTER_CRITICAL(&lock);
+  length = fill < MAX_RECORD_BLOCK_PAYLOAD ? fill : MAX_RECORD_BLOCK_PAYLOAD;
+  if (length > 0)
+  {
+    uint32_t tail = (head + capacity - fill) % capacity;
+    uint32_t first = length < capacity - tail ? length : capacity - tail;
+
+    memcpy(block + RECORD_BLOCK_HEADER_SIZE, ring + tail, first);
+    memcpy(block + RECORD_BLOCK_HEADER_SIZE + first, ring, length - first);
+    fill -= length;
+  }
+  block_sequence = sequence;
+  if (length > 0)
+    sequence++;
+  portEXIT_CRITICAL(&lock);
+
+  if (length == 0)
+    return 0;
+
+  uint32_t block_length = record_block_frame(block, block_sequence, length);
+  comm.send_data((const char *)block, block_length);
+  sent += block_length;
+
+  return length;
+}
+
+void Recorder::drain_task(void *arg)
+{
+  Recorder *rec = static_cast<Recorder *>(arg);
+  bool reported = false;
+
+  while (1)
+  {
+    rec->flush();
+
+    if (rec->ending && !reported)
+    {
+      if (rec->overflowed)
+        ESP_LOGW(TAG, "Recording buffer overflowed after %llu bytes sent, recording stopped.", (unsigned long long)rec->sent);
+      else
+        ESP_LOGI(TAG, "Recording stopped after %llu bytes sent.", (unsigned long long)rec->sent);
+      reported = true;
+    }
+    if (rec->recording)
+      reported = false;
+
+    vTaskDelay(recorder_config.delay / portTICK_PERIOD_MS);
+  }
+}
+
+// Called from the encoder ISR, edges carry their esp_timer time rather than a tick
+void Recorder::add_edge(uint8_t motor, uint64_t time, int32_t watch_point)
+{
+  if (!recording)
+    return;
+
+  portENTER_CRITICAL_ISR(&lock);
+  if (recording)
+    append(encoder.edge(scratch, motor, time, watch_point));
+  portEXIT_CRITICAL_ISR(&lock);
+}
+
+void Recorder::add_count(uint8_t motor, int32_t count)
+{
+  if (!recording)
+    return;
+
+  uint32_t tick = xTaskGetTickCount();
+
+  portENTER_CRITICAL(&lock);
+  if (recording)
+    append(encoder.count_read(scratch, tick, motor, count));
+  portEXIT_CRITICAL(&lock);
+}
+
+void Recorder::add_adc(uint8_t channel, int32_t code, int32_t millivolts)
+{
+  if (!recording)
+    return;
+
+  uint32_t tick = xTaskGetTickCount();
+
+  portENTER_CRITICAL(&lock);
+  if (recording)
+    append(encoder.adc(scratch, tick, channel, code, millivolts));
+  portEXIT_CRITICAL(&lock);
+}
+
+void Recorder::add_zero(uint8_t channel, int32_t millivolts)
+{
+  if (!recording)
+    return;
+
+  uint32_t tick = xTaskGetTickCount();
+
+  portENTER_CRITICAL(&lock);
+  if (recording)
+    append(encoder.zero(scratch, tick, channel, millivolts));
+  portEXIT_CRITICAL(&lock);
+}
+
+void Recorder::add_parameter(uint8_t motor, RecordParameter parameter, const float *values, uint8_t count)
+{
+  if (!recording)
+    return;
+
+  uint32_t tick = xTaskGetTickCount();
+
+  portENTER_CRITICAL(&lock);
+  if (recording)
+    append(encoder.parameter(scratch, tick, motor, parameter, values, count));
+  portEXIT_CRITICAL(&lock);
+}
+
+void Recorder::add_parameter(uint8_t motor, RecordParameter parameter, std::initializer_list<float> values)
+{
+  add_parameter(motor, parameter, values.begin(), (uint8_t)values.size());
+}
+
+// A load too large to record is left out with a warning, the replay then runs on the defaults
+void Recorder::add_load(uint8_t motor, const char *key, const void *data, uint32_t size)
+{
+  bool too_large = false;
+
+  if (!recording)
+    return;
+
+  uint32_t tick = xTaskGetTickCount();
+
+  portENTER_CRITICAL(&lock);
+  if (recording)
+  {
+    uint32_t length = encoder.load(scratch, tick, motor, key, data, size);
+    too_large = length == 0;
+    append(length);
+  }
+  portEXIT_CRITICAL(&lock);
+
+  if (too_large)
+    ESP_LOGW(TAG, "Calibration %s of %lu bytes is too large to record.", key, (unsigned long)size);
+}
+
+void Recorder::add_output(uint8_t motor, float duty_cycle)
+{
+  if (!recording)
+    return;
+
+  uint32_t tick = xTaskGetTickCount();
+
+  portENTER_CRITICAL(&lock);
+  if (recording)
+    append(encoder.output_sample(scratch, tick, motor, duty_cycle));
+  portEXIT_CRITICAL(&lock);
+}
+
+bool Recorder::is_recording()
+{
+  return recording;
+}
+
+bool Recorder::has_overflowed()
+{
+  return overflowed;
+}
+
+// Bytes written to the UART, block framing included
+uint64_t Recorder::get_sent()
+{
+  return sent;
+}
@@ -0,0 +1,77 @@
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+// Includes
+#include <stdint.h>
+#include <initializer_list>
+
+#include "sdkconfig.h"
+#include "communication.hpp"
+#include "record_format.hpp"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Records the raw inputs of every controller, encoder edges, pulse counts, ADC conversions,
+// calibration loads and external commands, with the ticks they arrived on, so host/sim/replay.cpp
+// can run the same inputs through the host build of the controller. The controller's duty cycle
+// is recorded alongside, for the replay to compare against. Records are appended from the tasks
+// and the encoder ISR to a ring, which a low priority task sends out in blocks over the UART.
+// If the ring fills, recording stops and the log ends with an overflow record rather than a gap.
+class Recorder
+{
+private:
+  // Class variables
+  RecordEncoder encoder;
+  uint8_t *scratch; // One encoded record, used under the lock
+
+  uint8_t *ring;
+  uint32_t capacity;
+  uint32_t head; // Next byte to write
+  uint32_t fill; // Bytes waiting to be sent
+
+  uint8_t *block;
+  uint32_t sequence;
+  uint64_t sent;
+
+  volatile bool recording;
+  bool overflowed;
+  bool ending;   // END record appended, the drain task stops once it is sent
+
+  portMUX_TYPE lock;
+
+  Communication comm;
+  TaskHandle_t drain_task_hdl;
+
+  static constexpr uint8_t END_SIZE = 1; // Kept free so an overflow can still be recorded
+
+  bool append(uint32_t length);
+  void finish(bool overflowed);
+  uint32_t send_block();
+  static void drain_task(void *arg);
+
+public:
+  Recorder();
+
+  void start();
+  void stop();
+  void flush();
+
+  // Motor and channel indices as the controller and current sensor number them
+  void add_edge(uint8_t motor, uint64_t time, int32_t watch_point);
+  void add_count(uint8_t motor, int32_t count);
+  void add_adc(uint8_t channel, int32_t code, int32_t millivolts);
+  void add_zero(uint8_t channel, int32_t millivolts);
+  void add_parameter(uint8_t motor, RecordParameter parameter, const float *values, uint8_t count);
+  void add_parameter(uint8_t motor, RecordParameter parameter, std::initializer_list<float> values);
+  void add_load(uint8_t motor, const char *key, const void *data, uint32_t size);
+  void add_output(uint8_t motor, float duty_cycle);
+
+  bool is_recording();
+  bool has_overflowed();
+  uint64_t get_sent();
+};
+
+Recorder &recorder();
+
+#endif // RECORDER_H_
@@ -0,0 +1,201 @@
+// Includes
+#include "relay_tuner.hpp"
+
+#include <string.h>
+#include <cmath>
+
+RelayTuner::RelayTuner()
+{
+  memset(&config, 0, sizeof(config));
+  state = TUNER_IDLE;
+
+  point = 0;
+  setpoint = 0;
+  bias = 0;
+  elapsed = 0;
+  cycle_time = 0;
+
+  relay_high = true;
+  cycles = 0;
+  high_time = 0;
+  low_time = 0;
+  peak_high = 0;
+  peak_low = 0;
+
+  period_sum = 0;
+  amplitude_sum = 0;
+  measured = 0;
+}
+
+// Returns false if the configuration cannot be run, bias is the duty cycle to start settling from
+bool RelayTuner::begin(const autotune_config &config, float bias)
+{
+  if (config.points == 0 || config.points > GainSchedule::MAX_POINTS ||
+      config.min_velocity <= 0 || config.max_velocity < config.min_velocity ||
+      config.amplitude <= 0 || config.amplitude > 0.5 || config.hysteresis < 0)
+    return false;
+
+  this->config = config;
+  this->bias = bias;
+  point = 0;
+  schedule.clear();
+  start_point();
+
+  return true;
+}
+
+void RelayTuner::cancel()
+{
+  if (state != TUNER_COMPLETE)
+    state = TUNER_IDLE;
+}
+
+bool RelayTuner::is_running()
+{
+  return state == TUNER_SETTLING || state == TUNER_RELAY;
+}
+
+bool RelayTuner::is_complete()
+{
+  return state == TUNER_COMPLETE;
+}
+
+void RelayTuner::start_point()
+{
+  if (config.points == 1)
+    setpoint = config.min_velocity;
+  else
+    setpoint = config.min_velocity + (config.max_velocity - config.min_velocity) * point / (config.points - 1);
+
+  elapsed = 0;
+  cycles = 0;
+  measured = 0;
+  period_sum = 0;
+  amplitude_sum = 0;
+  state = TUNER_SETTLING;
+}
+
+// Gains from the averaged limit cycle, the point is left out of the schedule if none formed
+void RelayTuner::finish_point()
+{
+  if (measured > 0)
+  {
+    float amplitude = amplitude_sum / measured;
+    float period = period_sum / measured;
+
+    if (amplitude > config.hysteresis)
+    {
+      gain_point result;
+
+      result.velocity = setpoint;
+      result.ultimate_gain = 4 * config.amplitude / ((float)M_PI * sqrtf(amplitude * amplitude - config.hysteresis * config.hysteresis));
+      result.ultimate_period = period;
+      result.kp = result.ultimate_gain * TL_GAIN;
+      result.ti = period * TL_INTEGRAL;
+      result.td = 0;
+      schedule.add(result);
+    }
+  }
+
+  point++;
+  if (point >= config.points)
+    state = TUNER_COMPLETE;
+  else
+    start_point();
+}
+
+// Called on each upward switch, the cycle since the previous one is complete
+void RelayTuner::finish_cycle()
+{
+  cycles++;
+
+  if (cycles >= 2)
+  {
+    // Re-centre so high and low halves last equally long at the set point
+    bias += config.amplitude * (high_time - low_time) / (high_time + low_time);
+
+    if (cycles > SKIP_CYCLES)
+    {
+      period_sum += cycle_time;
+      amplitude_sum += (peak_high - peak_low) / 2;
+      measured++;
+    }
+  }
+
+  cycle_time = 0;
+  high_time = 0;
+  low_time = 0;
+  peak_high = setpoint;
+  peak_low = setpoint;
+
+  if (measured >= MEASURE_CYCLES)
+    finish_point();
+}
+
+// Duty cycle for the next period given the velocity the controller sees and the time since the
+// last call in s
+float RelayTuner::next_input(float velocity, float period)
+{
+  float error = setpoint - velocity;
+  float input;
+
+  if (state == TUNER_SETTLING)
+  {
+    elapsed += period;
+    bias += SETTLE_RATE * error * period;
+    bias = fminf(fmaxf(bias, 0), 1);
+
+    if (elapsed >= SETTLE_TIME)
+    {
+      relay_high = error > 0;
+      cycle_time = 0;
+      high_time = 0;
+      low_time = 0;
+      peak_high = velocity;
+      peak_low = velocity;
+      state = TUNER_RELAY;
+    }
+    return bias;
+  }
+
+  if (state != TUNER_RELAY)
+    return 0;
+
+  elapsed += period;
+  cycle_time += period;
+  if (relay_high)
+    high_time += period;
+  else
+    low_time += period;
+  peak_high = fmaxf(peak_high, velocity);
+  peak_low = fminf(peak_low, velocity);
+
+  if (relay_high && error < -config.hysteresis)
+    relay_high = false;
+  else if (!relay_high && error > config.hysteresis)
+  {
+    relay_high = true;
+    finish_cycle();
+  }
+
+  if (state == TUNER_RELAY && elapsed > SETTLE_TIME + POINT_TIMEOUT)
+    finish_point();
+
+  input = relay_high ? bias + config.amplitude : bias - config.amplitude;
+  return fminf(fmaxf(input, 0), 1);
+}
+
+float RelayTuner::get_setpoint()
+{
+  return setpoint;
+}
+
+GainSchedule &RelayTuner::get_schedule()
+{
+  return schedule;
+}
+
+bool RelayTuner::get_save()
+{
+  return config.save;
+}
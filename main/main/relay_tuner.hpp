@@ -0,0 +1,88 @@
+#ifndef RELAY_TUNER_H_
+#define RELAY_TUNER_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gain_schedule.hpp"
+
+typedef struct
+{
+  float min_velocity; // First operating point in RPM
+  float max_velocity; // Last operating point in RPM
+  uint8_t points;     // Operating points, evenly spaced, up to GainSchedule::MAX_POINTS
+  float amplitude;    // Relay duty cycle swing either side of the bias
+  float hysteresis;   // Relay switching band in RPM, above the velocity noise
+  bool save;          // Store the schedule in NVS
+} autotune_config;
+
+// Relay feedback (Astrom-Hagglund) auto-tuner. At each operating point the duty cycle is first
+// brought to the set point with a slow integrator, then switched between bias +/- amplitude on
+// the sign of the error, which settles into a limit cycle at the loop's ultimate frequency.
+// The bias is re-centred each cycle so the oscillation stays symmetric about the set point.
+// The ultimate gain 4d / (pi sqrt(a^2 - e^2)) and period give Tyreus-Luyben PI gains, which
+// trade a little speed for far less overshoot than Ziegler-Nichols.
+class RelayTuner
+{
+public:
+  static constexpr float SETTLE_TIME = 2.0;      // s holding the set point before the relay starts
+  static constexpr float SETTLE_RATE = 0.02;     // Integrator gain while settling, duty cycle per RPM s
+  static constexpr uint8_t SKIP_CYCLES = 2;      // Cycles left for the limit cycle to form
+  static constexpr uint8_t MEASURE_CYCLES = 4;   // Cycles averaged
+  static constexpr float POINT_TIMEOUT = 15.0;   // s before a point without a limit cycle is skipped
+
+  static constexpr float TL_GAIN = 1 / 3.2;  // Tyreus-Luyben PI kp / Ku
+  static constexpr float TL_INTEGRAL = 2.2;  // Tyreus-Luyben PI ti / Tu
+
+private:
+  enum TunerState : uint8_t
+  {
+    TUNER_IDLE = 0,
+    TUNER_SETTLING = 1,
+    TUNER_RELAY = 2,
+    TUNER_COMPLETE = 3,
+  };
+
+  // Class variables
+  autotune_config config;
+  volatile TunerState state;
+
+  uint8_t point;
+  float setpoint;
+  float bias;
+  float elapsed;    // s at this point
+  float cycle_time; // s since the last upward switch
+
+  bool relay_high;
+  uint8_t cycles;   // Upward switches seen at this point
+  float high_time;
+  float low_time;
+  float peak_high;
+  float peak_low;
+
+  float period_sum;
+  float amplitude_sum;
+  uint8_t measured;
+
+  GainSchedule schedule;
+
+  void start_point();
+  void finish_point();
+  void finish_cycle();
+
+public:
+  RelayTuner();
+
+  bool begin(const autotune_config &config, float bias);
+  void cancel();
+  bool is_running();
+  bool is_complete();
+
+  float next_input(float velocity, float period);
+  float get_setpoint();
+  GainSchedule &get_schedule();
+  bool get_save();
+};
+
+#endif // RELAY_TUNER_H_
@@ -0,0 +1,292 @@
+// Includes
+#include "safety_supervisor.hpp"
+
+#include <string.h>
+#include <chrono>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static constexpr char *TAG = "Safety";
+
+// Fault names and what each forces the bridge to, indexed by SafetyFault. An overcurrent may
+// be a short, so its winding is left floating rather than shorted again.
+static const char *const FAULT_NAMES[] = {"none", "overcurrent", "stall", "encoder", "link"};
+static DRAM_ATTR const SafetyOutput FAULT_OUTPUTS[] = {OUTPUT_RELEASE, OUTPUT_COAST, OUTPUT_BRAKE, OUTPUT_BRAKE, OUTPUT_BRAKE};
+
+volatile uint32_t SafetySupervisor::heartbeat_ms = 0;
+
+SafetySupervisor::SafetySupervisor()
+{
+  index = 0;
+
+  overcurrent_low = 0;
+  overcurrent_high = UINT16_MAX;
+  zero_code = 0;
+  conversion_ns = 0;
+  over_limit = 1;
+  plug_limit = 1;
+  conversions = 0;
+  onset = 0;
+  over_count = 0;
+  over_run = false;
+  frame_sum = 0;
+  frame_count = 0;
+  current_sum = 0;
+  current_count = 0;
+  drive_direction = 0;
+  motion_direction = 0;
+
+  ma_per_code = 0;
+
+  drive_since = 0;
+  run_since = 0;
+  current_ma = 0;
+
+  fault = FAULT_NONE;
+  trip_time = 0;
+  announced = true;
+  memset(&report, 0, sizeof(report));
+
+  output_callback = nullptr;
+  output_context = nullptr;
+
+  portMUX_INITIALIZE(&lock);
+}
+
+void SafetySupervisor::init(uint8_t index)
+{
+  this->index = index;
+}
+
+// Forces the bridge, called from the ADC interrupt for overcurrent
+void SafetySupervisor::set_output_callback(void (*callback)(void *context, SafetyOutput output), void *context)
+{
+  output_callback = callback;
+  output_context = context;
+}
+
+void SafetySupervisor::set_conversion_rate(uint32_t sample_rate)
+{
+  conversion_ns = sample_rate > 0 ? 1000000000 / sample_rate : 0;
+  over_limit = conversion_ns > 0 ? (CONFIG_DTMC_SAFETY_OVERCURRENT_US * 1000 + conversion_ns - 1) / conversion_ns : 1;
+  plug_limit = conversion_ns > 0 ? (CONFIG_DTMC_SAFETY_PLUGGING_US * 1000ULL + conversion_ns - 1) / conversion_ns : 1;
+}
+
+// Raw ADC codes outside [low, high] are beyond the overcurrent limit
+void SafetySupervisor::set_overcurrent(uint16_t low, uint16_t high, uint16_t zero_code, float ma_per_code)
+{
+  portENTER_CRITICAL(&lock);
+  overcurrent_low = low;
+  overcurrent_high = high;
+  this->zero_code = zero_code;
+  this->ma_per_code = ma_per_code;
+  portEXIT_CRITICAL(&lock);
+}
+
+IRAM_ATTR void SafetySupervisor::add_conversion(uint16_t code)
+{
+  uint32_t number = conversions++;
+
+  frame_sum += code > zero_code ? code - zero_code : zero_code - code;
+  frame_count++;
+
+  if (code < overcurrent_low || code > overcurrent_high)
+  {
+    if (over_count == 0)
+      onset = number;
+    if (over_count < UINT32_MAX)
+      over_count++;
+
+    // Plugging, the motion may be an update period stale
+    if (over_count >= (motion_direction != 0 && drive_direction != motion_direction ? plug_limit : over_limit))
+      over_run = true;
+  }
+  else
+    over_count = 0;
+}
+
+// The bridge is forced before the interrupt returns, the fault is announced by the update task
+IRAM_ATTR void SafetySupervisor::end_frame()
+{
+  bool tripped = false;
+
+  portENTER_CRITICAL_ISR(&lock);
+  current_sum += frame_sum;
+  current_count += frame_count;
+  if (fault == FAULT_NONE && over_run)
+  {
+    // From the start of the first conversion beyond the limit, the frame's last has just ended
+    latch(FAULT_OVERCURRENT, esp_timer_get_time(), (uint64_t)(conversions - onset) * conversion_ns / 1000);
+    tripped = true;
+  }
+  portEXIT_CRITICAL_ISR(&lock);
+
+  frame_sum = 0;
+  frame_count = 0;
+  if (tripped)
+    output(FAULT_OVERCURRENT);
+}
+
+// Called with lock held
+IRAM_ATTR void SafetySupervisor::latch(SafetyFault fault, uint64_t time, uint32_t latency_us)
+{
+  this->fault = fault;
+  trip_time = time;
+  announced = false;
+  report.active = true;
+  report.fault = fault;
+  report.latency_us = latency_us;
+  report.trips++;
+}
+
+IRAM_ATTR void SafetySupervisor::output(SafetyFault fault)
+{
+  if (output_callback != nullptr)
+    output_callback(output_context, FAULT_OUTPUTS[fault]);
+}
+
+void SafetySupervisor::set_drive_direction(int32_t direction)
+{
+  drive_direction = direction;
+}
+
+bool SafetySupervisor::update(uint64_t now, float pwm_duty, uint64_t edge_time, int32_t motion_direction)
+{
+  SafetyFault detected = FAULT_NONE;
+  uint32_t latency_us = 0;
+  uint32_t sum;
+  uint32_t count;
+  bool tripped = false;
+  bool announce = false;
+
+  portENTER_CRITICAL(&lock);
+  sum = current_sum;
+  count = current_count;
+  current_sum = 0;
+  current_count = 0;
+  portEXIT_CRITICAL(&lock);
+
+  if (count > 0)
+    current_ma = ma_per_code * sum / count;
+  this->motion_direction = motion_direction;
+
+  if (pwm_duty < STALL_DUTY)
+    drive_since = 0;
+  else if (drive_since == 0)
+    drive_since = now;
+
+  if (pwm_duty <= 0)
+    run_since = 0;
+  else if (run_since == 0)
+    run_since = now;
+
+  // Edges and heartbeats land while the period runs, those after now are not late
+  uint64_t quiet = edge_time > drive_since ? edge_time : drive_since;
+  uint64_t heard = (uint64_t)heartbeat_ms * 1000 > run_since ? (uint64_t)heartbeat_ms * 1000 : run_since;
+
+  if (fault == FAULT_NONE && drive_since != 0 && now > quiet &&
+      now - quiet >= CONFIG_DTMC_SAFETY_STALL_TIMEOUT_MS * 1000)
+  {
+    detected = current_ma >= CONFIG_DTMC_SAFETY_STALL_MA ? FAULT_STALL : FAULT_ENCODER;
+    latency_us = now - quiet - CONFIG_DTMC_SAFETY_STALL_TIMEOUT_MS * 1000;
+  }
+  else if (fault == FAULT_NONE && CONFIG_DTMC_SAFETY_LINK_TIMEOUT_MS > 0 && heartbeat_ms != 0 && run_since != 0 &&
+           now > heard && now - heard >= CONFIG_DTMC_SAFETY_LINK_TIMEOUT_MS * 1000)
+  {
+    detected = FAULT_LINK;
+    latency_us = now - heard - CONFIG_DTMC_SAFETY_LINK_TIMEOUT_MS * 1000;
+  }
+
+  auto clock = std::chrono::system_clock::now();
+  uint64_t timestamp = std::chrono::time_point_cast<std::chrono::milliseconds>(clock).time_since_epoch().count();
+
+  portENTER_CRITICAL(&lock);
+  if (detected != FAULT_NONE && fault == FAULT_NONE)
+  {
+    latch(detected, now, latency_us);
+    tripped = true;
+  }
+  if (fault != FAULT_NONE && !announced)
+  {
+    uint64_t elapsed_ms = now > trip_time ? (now - trip_time) / 1000 : 0;
+    report.time = timestamp - elapsed_ms;
+    report.current_ma = current_ma;
+    announced = true;
+    announce = true;
+  }
+  portEXIT_CRITICAL(&lock);
+
+  if (tripped)
+    output(detected);
+  if (announce)
+    ESP_LOGW(TAG, "Motor %u tripped on %s after %lu us.", index, FAULT_NAMES[report.fault],
+             (unsigned long)report.latency_us);
+
+  return announce;
+}
+
+void SafetySupervisor::heartbeat()
+{
+  uint32_t now_ms = esp_timer_get_time() / 1000;
+
+  heartbeat_ms = now_ms != 0 ? now_ms : 1;
+}
+
+bool SafetySupervisor::is_tripped()
+{
+  return fault != FAULT_NONE;
+}
+
+SafetyFault SafetySupervisor::get_fault()
+{
+  return fault;
+}
+
+// Releases the bridge, a fault still present trips again
+void SafetySupervisor::clear()
+{
+  portENTER_CRITICAL(&lock);
+  fault = FAULT_NONE;
+  over_count = 0;
+  over_run = false;
+  drive_since = 0;
+  run_since = 0;
+  announced = true;
+  report.active = false;
+  portEXIT_CRITICAL(&lock);
+
+  ESP_LOGI(TAG, "Motor %u fault cleared.", index);
+  output(FAULT_NONE);
+}
+
+void SafetySupervisor::get_report(safety_report *report)
+{
+  portENTER_CRITICAL(&lock);
+  *report = this->report;
+  portEXIT_CRITICAL(&lock);
+}
+
+// Formats the latched fault as JSON, the last trip's details stay once it is cleared
+uint32_t SafetySupervisor::get_report_string(char *dest, uint32_t size)
+{
+  safety_report result;
+  int length;
+
+  get_report(&result);
+  length = snprintf(dest, size,
+                    "{\"fault\":{\"active\":%s,\"code\":\"%s\",\"time\":%llu,\"latency_us\":%lu,\"current_ma\":%.1f,"
+                    "\"trips\":%lu}}",
+                    result.active ? "true" : "false", FAULT_NAMES[result.fault],
+                    (unsigned long long)result.time, (unsigned long)result.latency_us, result.current_ma,
+                    (unsigned long)result.trips);
+
+  if (length < 0 || (uint32_t)length >= size)
+  {
+    ESP_LOGW(TAG, "Fault report exceeds %lu bytes.", (unsigned long)size);
+    return 0;
+  }
+
+  return length;
+}
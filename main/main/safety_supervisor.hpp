@@ -0,0 +1,136 @@
+#ifndef SAFETY_SUPERVISOR_H_
+#define SAFETY_SUPERVISOR_H_
+
+// Includes
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+
+// Faults, in the order of their names in the fault report
+enum SafetyFault : uint8_t
+{
+  FAULT_NONE = 0,
+  FAULT_OVERCURRENT = 1, // Conversions beyond the overcurrent limit
+  FAULT_STALL = 2,       // Driven hard without encoder edges, drawing stall current
+  FAULT_ENCODER = 3,     // Driven hard without encoder edges, drawing little current
+  FAULT_LINK = 4,        // Driven without hearing from the hub
+};
+
+// What the bridge is forced to on a trip
+enum SafetyOutput : uint8_t
+{
+  OUTPUT_RELEASE = 0, // The controller drives the bridge again
+  OUTPUT_COAST = 1,   // Enable low, the winding floats
+  OUTPUT_BRAKE = 2,   // Enable high with both inputs low, the winding is shorted
+};
+
+// Latched fault of one motor, the last trip's once cleared
+typedef struct
+{
+  bool active;
+  SafetyFault fault;   // FAULT_NONE before the first trip
+  uint64_t time;       // Unix time in ms of the trip
+  uint32_t latency_us; // From the limit being crossed to the bridge being forced
+  float current_ma;    // Mean over the update period the trip was taken in
+  uint32_t trips;      // Since boot
+} safety_report;
+
+// Protection of one motor in two paths. The fast path runs in the ADC's frame interrupt: every
+// conversion of the motor's channel is compared against the overcurrent codes, and a run of
+// them lasting CONFIG_DTMC_SAFETY_OVERCURRENT_US forces the bridge through the output callback
+// before the interrupt returns. A bridge driving against the motion plugs the motor beyond the
+// sensor's range until it slows, so while the two are opposed the run may last up to
+// CONFIG_DTMC_SAFETY_PLUGGING_US instead.
+//
+// The slow path runs in the update task every period: a motor driven at
+// CONFIG_DTMC_SAFETY_STALL_DUTY_PERCENT or more without an encoder edge for
+// CONFIG_DTMC_SAFETY_STALL_TIMEOUT_MS is stalled or has lost its encoder, told apart by its
+// current, and a driven motor is stopped once the hub has been silent for
+// CONFIG_DTMC_SAFETY_LINK_TIMEOUT_MS. A trip latches until clear() and the controller refuses
+// to drive meanwhile.
+class SafetySupervisor
+{
+public:
+  static constexpr float STALL_DUTY = CONFIG_DTMC_SAFETY_STALL_DUTY_PERCENT / 100.0f;
+
+private:
+  // Class variables
+  uint8_t index;
+
+  // Fast path, written by the ADC interrupt
+  uint16_t overcurrent_low;
+  uint16_t overcurrent_high;
+  uint16_t zero_code;
+  uint32_t conversion_ns; // Between two conversions of the channel
+  uint32_t over_limit;    // Conversions in a row that trip, CONFIG_DTMC_SAFETY_OVERCURRENT_US long
+  uint32_t plug_limit;    // Likewise while plugging, CONFIG_DTMC_SAFETY_PLUGGING_US long
+  uint32_t conversions;   // Since boot, wraps
+  uint32_t onset;         // Conversion that started the current run beyond the limits
+  uint32_t over_count;
+  bool over_run;          // over_count reached its limit, tripped at the end of the frame
+  uint32_t frame_sum;     // |code - zero_code| over the frame
+  uint32_t frame_count;
+  uint32_t current_sum;   // Frames since the last update, guarded by lock
+  uint32_t current_count;
+  volatile int8_t drive_direction;  // Of the bridge, set with its pins
+  volatile int8_t motion_direction; // Of the encoder, 0 at rest
+
+  // Calibration, code to mA about the zero
+  float ma_per_code;
+
+  // Slow path, in the update task
+  uint64_t drive_since; // esp_timer time the duty reached STALL_DUTY, 0 below it
+  uint64_t run_since;   // esp_timer time the duty rose above 0, 0 while off
+  float current_ma;     // Mean over the last update period
+
+  // Latched fault, guarded by lock
+  volatile SafetyFault fault;
+  uint64_t trip_time; // esp_timer time
+  bool announced;     // update() has returned the trip
+  safety_report report;
+
+  void (*output_callback)(void *context, SafetyOutput output);
+  void *output_context;
+
+  portMUX_TYPE lock;
+
+  static volatile uint32_t heartbeat_ms; // esp_timer time in ms the hub was last heard from, 0 before
+
+  void latch(SafetyFault fault, uint64_t time, uint32_t latency_us);
+  void output(SafetyFault fault);
+
+public:
+  SafetySupervisor();
+
+  void init(uint8_t index);
+  void set_output_callback(void (*callback)(void *context, SafetyOutput output), void *context);
+
+  // Called by the current sensor when the pattern changes and when its channel is zeroed
+  void set_conversion_rate(uint32_t sample_rate);
+  void set_overcurrent(uint16_t low, uint16_t high, uint16_t zero_code, float ma_per_code);
+
+  // Called from the ADC interrupt, each conversion of the channel and then once per frame
+  void add_conversion(uint16_t code);
+  void end_frame();
+
+  // Called by the controller whenever it sets the bridge's pins
+  void set_drive_direction(int32_t direction);
+
+  // Called from the update task, returns true once for every trip from either path
+  bool update(uint64_t now, float pwm_duty, uint64_t edge_time, int32_t motion_direction);
+
+  // The network task heard from the hub
+  static void heartbeat();
+
+  bool is_tripped();
+  SafetyFault get_fault();
+  void clear();
+
+  void get_report(safety_report *report);
+  uint32_t get_report_string(char *dest, uint32_t size);
+};
+
+#endif // SAFETY_SUPERVISOR_H_
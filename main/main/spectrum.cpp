@@ -0,0 +1,300 @@
+// Includes
+#include "spectrum.hpp"
+
+#include <math.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "memory_budget.h"
+
+#ifdef CONFIG_DTMC_SPECTRUM_ESP_DSP
+#include "dsps_fft2r.h"
+#endif
+
+static constexpr uint16_t SEGMENT_SIZE = WelchEstimator::SEGMENT_SIZE;
+static constexpr float WINDOW_POWER = 3.0f * SEGMENT_SIZE / 8; // Sum of the Hann window squared
+
+// Shared by every estimator, reserved by the first
+static float *window = nullptr;
+static float *twiddles = nullptr; // cos and -sin of 2 pi k / SEGMENT_SIZE, k below half
+static float *buffer = nullptr;   // Interleaved complex FFT input and output
+
+// In place forward FFT of SEGMENT_SIZE interleaved complex values, in natural order
+static void fft(float *data)
+{
+#ifdef CONFIG_DTMC_SPECTRUM_ESP_DSP
+  dsps_fft2r_fc32(data, SEGMENT_SIZE);
+  dsps_bit_rev_fc32(data, SEGMENT_SIZE);
+#else
+  for (uint16_t i = 1, j = 0; i < SEGMENT_SIZE; i++)
+  {
+    uint16_t bit = SEGMENT_SIZE >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+
+    if (i < j)
+    {
+      float re = data[2 * i];
+      float im = data[2 * i + 1];
+      data[2 * i] = data[2 * j];
+      data[2 * i + 1] = data[2 * j + 1];
+      data[2 * j] = re;
+      data[2 * j + 1] = im;
+    }
+  }
+
+  for (uint16_t length = 2; length <= SEGMENT_SIZE; length <<= 1)
+  {
+    uint16_t half = length >> 1;
+    uint16_t stride = SEGMENT_SIZE / length;
+
+    for (uint16_t start = 0; start < SEGMENT_SIZE; start += length)
+    {
+      for (uint16_t k = 0; k < half; k++)
+      {
+        float w_re = twiddles[2 * k * stride];
+        float w_im = twiddles[2 * k * stride + 1];
+        float *a = &data[2 * (start + k)];
+        float *b = &data[2 * (start + k + half)];
+        float t_re = b[0] * w_re - b[1] * w_im;
+        float t_im = b[0] * w_im + b[1] * w_re;
+
+        b[0] = a[0] - t_re;
+        b[1] = a[1] - t_im;
+        a[0] += t_re;
+        a[1] += t_im;
+      }
+    }
+  }
+#endif
+}
+
+WelchEstimator::WelchEstimator()
+{
+  sample_rate = 0;
+  previous = nullptr;
+  has_previous = false;
+  pending = nullptr;
+  has_pending = false;
+  psd = nullptr;
+  segments = 0;
+}
+
+void WelchEstimator::init()
+{
+  if (window == nullptr)
+  {
+    window = (float *)memory_reserve(MEMORY_ARENA_SPECTRUM, SEGMENT_SIZE * sizeof(float));
+    buffer = (float *)memory_reserve(MEMORY_ARENA_SPECTRUM, 2 * SEGMENT_SIZE * sizeof(float));
+
+    for (uint16_t i = 0; i < SEGMENT_SIZE; i++)
+      window[i] = 0.5f - 0.5f * cosf(2 * (float)M_PI * i / SEGMENT_SIZE);
+
+#ifdef CONFIG_DTMC_SPECTRUM_ESP_DSP
+    // ESP-DSP keeps its own table, allocated before the heap is locked
+    dsps_fft2r_init_fc32(nullptr, CONFIG_DSP_MAX_FFT_SIZE);
+#else
+    twiddles = (float *)memory_reserve(MEMORY_ARENA_SPECTRUM, SEGMENT_SIZE * sizeof(float));
+    for (uint16_t k = 0; k < SEGMENT_SIZE / 2; k++)
+    {
+      twiddles[2 * k] = cosf(2 * (float)M_PI * k / SEGMENT_SIZE);
+      twiddles[2 * k + 1] = -sinf(2 * (float)M_PI * k / SEGMENT_SIZE);
+    }
+#endif
+  }
+
+  previous = (float *)memory_reserve(MEMORY_ARENA_SPECTRUM, HOP_SIZE * sizeof(float));
+  pending = (float *)memory_reserve(MEMORY_ARENA_SPECTRUM, SEGMENT_SIZE * sizeof(float));
+  psd = (float *)memory_reserve(MEMORY_ARENA_SPECTRUM, BIN_COUNT * sizeof(float));
+  reset(1);
+}
+
+// Discards the estimate, the next hops are sampled at sample_rate
+void WelchEstimator::reset(float sample_rate)
+{
+  this->sample_rate = sample_rate;
+  has_previous = false;
+  has_pending = false;
+  segments = 0;
+  memset(psd, 0, BIN_COUNT * sizeof(float));
+}
+
+void WelchEstimator::add_hop(const float *hop)
+{
+  if (has_previous)
+  {
+    // The segment is the previous hop and this one, less their mean and windowed
+    float mean = 0;
+    for (uint16_t i = 0; i < HOP_SIZE; i++)
+      mean += previous[i] + hop[i];
+    mean /= SEGMENT_SIZE;
+
+    if (!has_pending)
+    {
+      for (uint16_t i = 0; i < HOP_SIZE; i++)
+      {
+        pending[i] = (previous[i] - mean) * window[i];
+        pending[HOP_SIZE + i] = (hop[i] - mean) * window[HOP_SIZE + i];
+      }
+      has_pending = true;
+    }
+    else
+    {
+      for (uint16_t i = 0; i < HOP_SIZE; i++)
+      {
+        buffer[2 * i] = pending[i];
+        buffer[2 * i + 1] = (previous[i] - mean) * window[i];
+        buffer[2 * (HOP_SIZE + i)] = pending[HOP_SIZE + i];
+        buffer[2 * (HOP_SIZE + i) + 1] = (hop[i] - mean) * window[HOP_SIZE + i];
+      }
+      transform(pending, buffer);
+      has_pending = false;
+    }
+  }
+
+  memcpy(previous, hop, HOP_SIZE * sizeof(float));
+  has_previous = true;
+}
+
+void WelchEstimator::complete()
+{
+  if (!has_pending)
+    return;
+
+  transform(pending, nullptr);
+  has_pending = false;
+}
+
+void WelchEstimator::restart()
+{
+  complete();
+  has_previous = false;
+}
+
+// first alone, or first and second packed into buffer by add_hop() as real and imaginary parts.
+// For real a and b in z = a + ib, A[k] = (Z[k] + conj(Z[N-k])) / 2 and
+// B[k] = (Z[k] - conj(Z[N-k])) / 2i.
+void WelchEstimator::transform(const float *first, const float *second)
+{
+  if (second == nullptr)
+  {
+    for (uint16_t i = 0; i < SEGMENT_SIZE; i++)
+    {
+      buffer[2 * i] = first[i];
+      buffer[2 * i + 1] = 0;
+    }
+  }
+
+  fft(buffer);
+
+  for (uint16_t k = 0; k < BIN_COUNT; k++)
+  {
+    uint16_t mirror = (SEGMENT_SIZE - k) % SEGMENT_SIZE;
+    float z_re = buffer[2 * k];
+    float z_im = buffer[2 * k + 1];
+    float m_re = buffer[2 * mirror];
+    float m_im = buffer[2 * mirror + 1];
+    float a_re = (z_re + m_re) / 2;
+    float a_im = (z_im - m_im) / 2;
+
+    psd[k] += a_re * a_re + a_im * a_im;
+    if (second != nullptr)
+    {
+      float b_re = (z_im + m_im) / 2;
+      float b_im = (m_re - z_re) / 2;
+      psd[k] += b_re * b_re + b_im * b_im;
+    }
+  }
+
+  segments += second != nullptr ? 2 : 1;
+}
+
+uint32_t WelchEstimator::get_segments()
+{
+  return segments;
+}
+
+float WelchEstimator::get_sample_rate()
+{
+  return sample_rate;
+}
+
+float WelchEstimator::get_resolution()
+{
+  return sample_rate / SEGMENT_SIZE;
+}
+
+// Both sides folded into one, except at DC and the Nyquist frequency
+float WelchEstimator::get_density(uint16_t bin)
+{
+  float sides = (bin == 0 || bin == BIN_COUNT - 1) ? 1 : 2;
+
+  if (segments == 0 || bin >= BIN_COUNT)
+    return 0;
+  return sides * psd[bin] / (sample_rate * WINDOW_POWER * segments);
+}
+
+float WelchEstimator::find_peak(float low, float high)
+{
+  float resolution = get_resolution();
+  int32_t first = ceilf(low / resolution);
+  int32_t last = floorf(high / resolution);
+  int32_t peak = -1;
+
+  if (first < 1)
+    first = 1;
+  if (last > BIN_COUNT - 2)
+    last = BIN_COUNT - 2;
+
+  for (int32_t k = first; k <= last; k++)
+  {
+    if (peak < 0 || psd[k] > psd[peak])
+      peak = k;
+  }
+  if (peak < 0 || psd[peak] <= 0)
+    return 0;
+
+  // Vertex of the parabola through the peak's magnitude and its neighbours'
+  float left = sqrtf(psd[peak - 1]);
+  float centre = sqrtf(psd[peak]);
+  float right = sqrtf(psd[peak + 1]);
+  float curvature = left - 2 * centre + right;
+  float offset = curvature < 0 ? 0.5f * (left - right) / curvature : 0;
+
+  return (peak + offset) * resolution;
+}
+
+// RMS over bins [first, last], clamped to the spectrum
+float WelchEstimator::bins_rms(int32_t first, int32_t last)
+{
+  float power = 0;
+
+  if (first < 0)
+    first = 0;
+  if (last > BIN_COUNT - 1)
+    last = BIN_COUNT - 1;
+
+  for (int32_t k = first; k <= last; k++)
+    power += get_density(k);
+
+  return sqrtf(power * get_resolution());
+}
+
+float WelchEstimator::band_rms(float low, float high)
+{
+  float resolution = get_resolution();
+
+  return bins_rms(ceilf(low / resolution), floorf(high / resolution));
+}
+
+float WelchEstimator::tone_rms(float frequency)
+{
+  float resolution = get_resolution();
+
+  if (frequency <= 0 || frequency >= sample_rate / 2)
+    return 0;
+
+  int32_t bin = lroundf(frequency / resolution);
+  return bins_rms(bin - PEAK_BINS, bin + PEAK_BINS);
+}
@@ -0,0 +1,60 @@
+#ifndef SPECTRUM_H_
+#define SPECTRUM_H_
+
+// Includes
+#include <stdint.h>
+
+// Welch estimate of a signal's one-sided power spectral density, in the signal's units squared
+// per Hz. The signal arrives in hops of half a segment, each hop closes a segment overlapping the
+// last by half, which has its mean removed so the DC level does not leak into the lowest bins,
+// and is Hann-windowed. Segments are transformed two at a time as the real and imaginary parts of
+// one complex FFT. The FFT is ESP-DSP's with CONFIG_DTMC_SPECTRUM_ESP_DSP and a portable radix-2
+// one otherwise, as on the host. Buffers come from the spectrum arena, the window, twiddles and
+// FFT buffer are shared by every estimator since the spectrum task runs them one at a time.
+class WelchEstimator
+{
+public:
+  static constexpr uint16_t SEGMENT_SIZE = 512;
+  static constexpr uint16_t HOP_SIZE = SEGMENT_SIZE / 2;
+  static constexpr uint16_t BIN_COUNT = SEGMENT_SIZE / 2 + 1;
+  static constexpr uint8_t PEAK_BINS = 3; // Either side of a peak, a Hann window's main lobe and a bin of drift
+
+private:
+  // Class variables
+  float sample_rate;
+  float *previous; // Last hop, the first half of the next segment
+  bool has_previous;
+  float *pending;  // Windowed segment waiting for a partner to share an FFT with
+  bool has_pending;
+  float *psd;      // Sum of the segments' |X|^2, scaled on read
+  uint32_t segments;
+
+  void transform(const float *first, const float *second);
+  float bins_rms(int32_t first, int32_t last);
+
+public:
+  WelchEstimator();
+
+  void init();
+  void reset(float sample_rate);
+  void add_hop(const float *hop);
+  // Transforms a segment still waiting for a partner, before the spectrum is read
+  void complete();
+  // A gap in the signal, the next hop starts a new segment
+  void restart();
+
+  uint32_t get_segments();
+  float get_sample_rate();
+  float get_resolution(); // Hz per bin
+  float get_density(uint16_t bin);
+
+  // Frequency of the highest bin in [low, high] Hz refined to between bins, 0 if the band is
+  // outside the spectrum
+  float find_peak(float low, float high);
+  // RMS of the signal over [low, high] Hz, from the integrated density
+  float band_rms(float low, float high);
+  // RMS of a tone at frequency, from its main lobe, 0 beyond the spectrum
+  float tone_rms(float frequency);
+};
+
+#endif // SPECTRUM_H_
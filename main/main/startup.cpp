@@ -0,0 +1,141 @@
+// Includes
+#include "startup.h"
+#include "configuration.hpp"
+
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static constexpr char *TAG = "Startup";
+
+static const char *stage_names[STARTUP_STAGE_COUNT] = {
+    "control",
+    "storage",
+    "calibration",
+    "wifi",
+    "time",
+    "provisioning",
+    "mqtt",
+    "telemetry",
+};
+
+typedef struct
+{
+  startup_function_t function;
+  uint32_t dependencies;
+  int64_t begin_time; // Time since boot in us, 0 if not started
+  int64_t end_time;   // Time since boot in us, 0 if not completed
+} startup_stage_info;
+
+static startup_stage_info stages[STARTUP_STAGE_COUNT];
+
+static StaticEventGroup_t startup_group_buffer;
+static EventGroupHandle_t startup_group = nullptr;
+static portMUX_TYPE startup_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void launch_task(void *arg)
+{
+  startup_stage_t stage = (startup_stage_t)(uintptr_t)arg;
+
+  if (stages[stage].dependencies != 0)
+    xEventGroupWaitBits(startup_group, stages[stage].dependencies, pdFALSE, pdTRUE, portMAX_DELAY);
+
+  startup_begin(stage);
+  stages[stage].function();
+
+  vTaskDelete(NULL);
+}
+
+void startup_init(void)
+{
+  for (auto &stage : stages)
+  {
+    stage.function = nullptr;
+    stage.dependencies = 0;
+    stage.begin_time = 0;
+    stage.end_time = 0;
+  }
+
+  startup_group = xEventGroupCreateStatic(&startup_group_buffer);
+}
+
+void startup_launch(startup_stage_t stage, startup_function_t function, uint32_t dependencies)
+{
+  stages[stage].function = function;
+  stages[stage].dependencies = dependencies;
+
+  xTaskCreatePinnedToCore(launch_task, stage_names[stage], startup_config.stack_size, (void *)(uintptr_t)stage,
+                          startup_config.priority, NULL, startup_config.core);
+}
+
+void startup_begin(startup_stage_t stage)
+{
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&startup_lock);
+  if (stages[stage].begin_time == 0)
+    stages[stage].begin_time = now;
+  portEXIT_CRITICAL(&startup_lock);
+}
+
+void startup_complete(startup_stage_t stage)
+{
+  int64_t now = esp_timer_get_time();
+  bool first = false;
+
+  portENTER_CRITICAL(&startup_lock);
+  if (stages[stage].end_time == 0)
+  {
+    if (stages[stage].begin_time == 0)
+      stages[stage].begin_time = now;
+    stages[stage].end_time = now;
+    first = true;
+  }
+  portEXIT_CRITICAL(&startup_lock);
+
+  if (first)
+  {
+    ESP_LOGI(TAG, "Stage %s ready at %lld ms.", stage_names[stage], now / 1000);
+    xEventGroupSetBits(startup_group, STARTUP_BIT(stage));
+  }
+}
+
+bool startup_wait(uint32_t stages, TickType_t timeout)
+{
+  EventBits_t bits = xEventGroupWaitBits(startup_group, stages, pdFALSE, pdTRUE, timeout);
+  return (bits & stages) == stages;
+}
+
+void startup_report(void)
+{
+  EventBits_t bits = xEventGroupGetBits(startup_group);
+
+  for (uint8_t i = 0; i < STARTUP_STAGE_COUNT; i++)
+  {
+    if (bits & STARTUP_BIT(i))
+      ESP_LOGI(TAG, "%-12s: %6lld -> %6lld ms (%lld ms)", stage_names[i],
+               stages[i].begin_time / 1000, stages[i].end_time / 1000,
+               (stages[i].end_time - stages[i].begin_time) / 1000);
+    else
+      ESP_LOGI(TAG, "%-12s: pending", stage_names[i]);
+  }
+
+  // Control does not wait on the network, its time is reported even if telemetry never comes up
+  if (bits & STARTUP_BIT(STARTUP_STAGE_CONTROL))
+    ESP_LOGI(TAG, "Time to first control: %lld ms.", stages[STARTUP_STAGE_CONTROL].end_time / 1000);
+  if (bits & STARTUP_BIT(STARTUP_STAGE_TELEMETRY))
+    ESP_LOGI(TAG, "Time to first telemetry: %lld ms.", stages[STARTUP_STAGE_TELEMETRY].end_time / 1000);
+}
+
+int64_t startup_ready_time(startup_stage_t stage)
+{
+  int64_t time;
+
+  portENTER_CRITICAL(&startup_lock);
+  time = stages[stage].end_time;
+  portEXIT_CRITICAL(&startup_lock);
+
+  return time;
+}
@@ -0,0 +1,46 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Boot stages, each completes once and sets its bit in the startup event group
+    typedef enum
+    {
+        STARTUP_STAGE_CONTROL = 0,  // Motor control and local UART streaming
+        STARTUP_STAGE_STORAGE,      // NVS, network interface and default event loop
+        STARTUP_STAGE_CALIBRATION,  // Per-unit calibration loaded from NVS
+        STARTUP_STAGE_WIFI,         // Station connected with an IP address
+        STARTUP_STAGE_TIME,         // SNTP synchronized
+        STARTUP_STAGE_PROVISIONING, // IoT Hub endpoint known (DPS or configured)
+        STARTUP_STAGE_MQTT,         // IoT Hub connected and subscribed
+        STARTUP_STAGE_TELEMETRY,    // First telemetry frame published
+        STARTUP_STAGE_COUNT,
+    } startup_stage_t;
+
+#define STARTUP_BIT(stage) (1UL << (stage))
+
+    typedef void (*startup_function_t)(void);
+
+    extern void startup_init(void);
+    extern void startup_launch(startup_stage_t stage, startup_function_t function, uint32_t dependencies);
+    extern void startup_begin(startup_stage_t stage);
+    extern void startup_complete(startup_stage_t stage);
+    extern bool startup_wait(uint32_t stages, TickType_t timeout);
+    extern void startup_report(void);
+
+    // Time since boot in us at which the stage completed, 0 while it is pending
+    extern int64_t startup_ready_time(startup_stage_t stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STARTUP_H */
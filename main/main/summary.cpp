@@ -0,0 +1,60 @@
+// Includes
+#include "summary.hpp"
+
+ChannelSummary::ChannelSummary()
+{
+  reset();
+}
+
+void ChannelSummary::reset()
+{
+  count = 0;
+  min = 0;
+  max = 0;
+  sum = 0;
+  sum_squares = 0;
+  last = 0;
+}
+
+void ChannelSummary::add(float value)
+{
+  if (count == 0 || value < min)
+    min = value;
+  if (count == 0 || value > max)
+    max = value;
+
+  sum += value;
+  sum_squares += value * value;
+  last = value;
+  count++;
+}
+
+uint32_t ChannelSummary::get_count()
+{
+  return count;
+}
+
+float ChannelSummary::get_min()
+{
+  return min;
+}
+
+float ChannelSummary::get_max()
+{
+  return max;
+}
+
+float ChannelSummary::get_mean()
+{
+  return count > 0 ? sum / (float)count : 0;
+}
+
+float ChannelSummary::get_rms()
+{
+  return count > 0 ? sqrtf(sum_squares / (float)count) : 0;
+}
+
+float ChannelSummary::get_last()
+{
+  return last;
+}
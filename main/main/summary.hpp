@@ -0,0 +1,53 @@
+#ifndef SUMMARY_H_
+#define SUMMARY_H_
+
+// Includes
+#include <stdio.h>
+#include <stdint.h>
+#include <cmath>
+
+// Running min, max, mean, RMS and last value of one channel over a frame,
+// updated one sample at a time so no second pass over the columns is needed
+class ChannelSummary
+{
+private:
+  uint32_t count;
+  float min;
+  float max;
+  float sum;
+  float sum_squares;
+  float last;
+
+public:
+  ChannelSummary();
+
+  void reset();
+  void add(float value);
+
+  uint32_t get_count();
+  float get_min();
+  float get_max();
+  float get_mean();
+  float get_rms();
+  float get_last();
+};
+
+// Summary of one sample frame with the controller state at its end
+typedef struct
+{
+  uint64_t start_time;
+  uint64_t end_time;
+
+  int32_t mode;
+  float gain;
+  float freq;
+  float position_sp;
+  float velocity_sp;
+
+  ChannelSummary duty_cycle;
+  ChannelSummary velocity;
+  ChannelSummary position;
+  ChannelSummary current;
+} frame_summary;
+
+#endif // SUMMARY_H_
@@ -0,0 +1,235 @@
+// Includes
+#include "system_id.hpp"
+
+#include <string.h>
+#include <cmath>
+
+SystemIdentifier::SystemIdentifier()
+{
+  memset(&config, 0, sizeof(config));
+  running = false;
+
+  step = 0;
+  settle_steps = 0;
+  total_steps = 0;
+  lfsr = 1;
+  phase = 0;
+
+  parameter_count = 0;
+  residual_count = 0;
+  residual_sum_squares = 0;
+}
+
+// Returns false if the configuration cannot be run
+bool SystemIdentifier::begin(const sysid_config &config)
+{
+  if ((config.order != 1 && config.order != 2) ||
+      (config.excitation != EXCITATION_PRBS && config.excitation != EXCITATION_CHIRP) ||
+      config.amplitude <= 0 || config.offset - config.amplitude < 0 || config.offset + config.amplitude > 1 ||
+      config.duration <= 0)
+    return false;
+
+  this->config = config;
+
+  step = 0;
+  settle_steps = SETTLE_TIME / SAMPLE_PERIOD;
+  total_steps = settle_steps + (uint32_t)(config.duration / SAMPLE_PERIOD);
+  lfsr = 0x7F;
+  phase = 0;
+
+  memset(input_history, 0, sizeof(input_history));
+  memset(output_history, 0, sizeof(output_history));
+
+  parameter_count = 2 * config.order + 2;
+  memset(theta, 0, sizeof(theta));
+  memset(covariance, 0, sizeof(covariance));
+  for (uint8_t i = 0; i < parameter_count; i++)
+    covariance[i][i] = INITIAL_COVARIANCE;
+
+  residual_count = 0;
+  residual_sum_squares = 0;
+
+  running = true;
+  return true;
+}
+
+void SystemIdentifier::cancel()
+{
+  running = false;
+}
+
+bool SystemIdentifier::is_running()
+{
+  return running;
+}
+
+bool SystemIdentifier::is_complete()
+{
+  return running && step >= total_steps;
+}
+
+// Duty cycle to apply for the next sample period
+float SystemIdentifier::next_input()
+{
+  float input = config.offset;
+
+  if (step >= settle_steps)
+  {
+    uint32_t excitation_step = step - settle_steps;
+
+    if (config.excitation == EXCITATION_PRBS)
+    {
+      if (excitation_step > 0 && excitation_step % PRBS_HOLD == 0)
+        lfsr = ((lfsr << 1) | (((lfsr >> 6) ^ (lfsr >> 5)) & 1)) & 0x7F;
+      input += (lfsr & 1) ? config.amplitude : -config.amplitude;
+    }
+    else
+    {
+      float elapsed = excitation_step * SAMPLE_PERIOD;
+      float freq = CHIRP_START_FREQ + (CHIRP_END_FREQ - CHIRP_START_FREQ) * elapsed / config.duration;
+      input += config.amplitude * sinf(phase);
+      phase = fmodf(phase + 2 * (float)M_PI * freq * SAMPLE_PERIOD, 2 * (float)M_PI);
+    }
+  }
+
+  step++;
+  return input;
+}
+
+// Regressor for the sample being added, returns its length
+uint8_t SystemIdentifier::regressors(double *phi)
+{
+  uint8_t count = 0;
+
+  phi[count++] = output_history[0];
+  if (config.order == 2)
+    phi[count++] = output_history[1];
+  for (uint8_t i = 0; i <= config.order; i++)
+    phi[count++] = input_history[i];
+  phi[count++] = 1;
+
+  return count;
+}
+
+// Adds the input held over the last sample period and the velocity at its end
+void SystemIdentifier::update(float input, float output)
+{
+  double phi[MAX_PARAMETERS];
+  double gain[MAX_PARAMETERS];
+  double denominator = 1;
+  double error = output;
+
+  if (!running)
+    return;
+
+  input_history[2] = input_history[1];
+  input_history[1] = input_history[0];
+  input_history[0] = input;
+
+  // The spin-up to the offset is not part of the model
+  if (step > settle_steps)
+  {
+    regressors(phi);
+
+    for (uint8_t i = 0; i < parameter_count; i++)
+    {
+      gain[i] = 0;
+      for (uint8_t j = 0; j < parameter_count; j++)
+        gain[i] += covariance[i][j] * phi[j];
+      denominator += phi[i] * gain[i];
+      error -= theta[i] * phi[i];
+    }
+
+    for (uint8_t i = 0; i < parameter_count; i++)
+      theta[i] += gain[i] / denominator * error;
+
+    // P = P - P phi phi' P / (1 + phi' P phi), kept symmetric
+    for (uint8_t i = 0; i < parameter_count; i++)
+    {
+      for (uint8_t j = i; j < parameter_count; j++)
+      {
+        covariance[i][j] -= gain[i] * gain[j] / denominator;
+        covariance[j][i] = covariance[i][j];
+      }
+    }
+
+    if (step > settle_steps + (total_steps - settle_steps) / 2)
+    {
+      residual_sum_squares += error * error;
+      residual_count++;
+    }
+  }
+
+  output_history[1] = output_history[0];
+  output_history[0] = output;
+}
+
+// Time constants from the discrete poles, 0 where a pole is not a decaying real one
+void SystemIdentifier::solve_time_constants(float *time_constant, float *time_constant_2)
+{
+  double poles[2] = {theta[0], 0};
+
+  if (config.order == 2)
+  {
+    double a1 = theta[0];
+    double a2 = theta[1];
+    double discriminant = a1 * a1 + 4 * a2;
+
+    if (discriminant >= 0)
+    {
+      poles[0] = (a1 + sqrt(discriminant)) / 2;
+      poles[1] = (a1 - sqrt(discriminant)) / 2;
+    }
+    else
+    {
+      // Underdamped, both decay with the pole magnitude
+      poles[0] = sqrt(-a2);
+      poles[1] = poles[0];
+    }
+  }
+
+  *time_constant = (poles[0] > 0 && poles[0] < 1) ? -SAMPLE_PERIOD / log(poles[0]) : 0;
+  *time_constant_2 = (poles[1] > 0 && poles[1] < 1) ? -SAMPLE_PERIOD / log(poles[1]) : 0;
+}
+
+// Model and IMC tuning: PI for K / (T s + 1), PID for K / ((T1 s + 1)(T2 s + 1))
+void SystemIdentifier::finish(sysid_result *result)
+{
+  uint8_t input_index = config.order;
+  double a_sum = 0;
+  double b_sum = 0;
+
+  for (uint8_t i = 0; i < config.order; i++)
+    a_sum += theta[i];
+  for (uint8_t i = 0; i <= config.order; i++)
+    b_sum += theta[input_index + i];
+
+  memset(result, 0, sizeof(*result));
+  result->order = config.order;
+  result->samples = step > settle_steps ? step - settle_steps : 0;
+  result->sample_period = SAMPLE_PERIOD;
+
+  result->a1 = theta[0];
+  result->a2 = config.order == 2 ? theta[1] : 0;
+  result->b0 = theta[input_index];
+  result->b1 = theta[input_index + 1];
+  result->b2 = config.order == 2 ? theta[input_index + 2] : 0;
+  result->bias = theta[parameter_count - 1];
+
+  result->gain = (a_sum < 1) ? b_sum / (1 - a_sum) : 0;
+  solve_time_constants(&result->time_constant, &result->time_constant_2);
+  result->residual = residual_count > 0 ? sqrt(residual_sum_squares / residual_count) : 0;
+
+  result->valid = result->gain > 0 && result->time_constant > 0 && std::isfinite(result->gain);
+  if (result->valid)
+  {
+    float time_constant_sum = result->time_constant + result->time_constant_2;
+    float response = config.response > 0 ? config.response : result->time_constant;
+
+    result->kp = time_constant_sum / (result->gain * response);
+    result->ti = time_constant_sum;
+    result->td = result->time_constant * result->time_constant_2 / time_constant_sum;
+  }
+
+  running = false;
+}
@@ -0,0 +1,107 @@
+#ifndef SYSTEM_ID_H_
+#define SYSTEM_ID_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+enum Excitation : int32_t
+{
+  EXCITATION_PRBS = 0,  // Pseudo-random binary sequence around the offset
+  EXCITATION_CHIRP = 1, // Linear frequency sweep around the offset
+};
+
+typedef struct
+{
+  int32_t excitation;
+  uint8_t order;    // Model order, 1 or 2
+  float offset;     // Duty cycle the excitation is centred on
+  float amplitude;  // Duty cycle swing either side of the offset
+  float duration;   // Excitation time in s, after settling at the offset
+  float response;   // Closed-loop time constant for the derived gains in s, 0 uses the model's
+  bool apply;       // Switch the controller to the derived gains if the model is valid
+} sysid_config;
+
+// Discrete ARX model y[k] = a1 y[k-1] + a2 y[k-2] + b0 u[k] + b1 u[k-1] + b2 u[k-2] + bias of
+// velocity (RPM) from duty cycle, its continuous equivalent and the PID gains derived from it.
+// y[k] is the mean velocity over the period u[k] is held, hence the extra input term.
+typedef struct
+{
+  bool valid;
+  uint8_t order;
+  uint32_t samples;
+  float sample_period;
+
+  float a1;
+  float a2;
+  float b0;
+  float b1;
+  float b2;
+  float bias;
+
+  float gain;            // Steady-state RPM per duty cycle
+  float time_constant;   // Dominant time constant in s
+  float time_constant_2; // Second time constant in s, 0 for first order
+  float residual;        // RMS one step prediction error over the second half of the run in RPM
+
+  float kp;
+  float ti;
+  float td;
+} sysid_result;
+
+// Generates the excitation and fits the model with recursive least squares as samples arrive,
+// so memory is fixed whatever the run length. Called at SAMPLE_PERIOD from the PID task.
+class SystemIdentifier
+{
+public:
+  static constexpr float SAMPLE_PERIOD = 0.01;  // s
+  static constexpr float SETTLE_TIME = 1.0;     // s at the offset before fitting starts
+  static constexpr uint8_t MAX_PARAMETERS = 6;  // a1, a2, b0, b1, b2 and bias
+
+  // PRBS from a 7 bit maximal LFSR (x^7 + x^6 + 1), each bit held for a few samples so the
+  // power sits below the motor's bandwidth
+  static constexpr uint8_t PRBS_HOLD = 5;
+
+  static constexpr float CHIRP_START_FREQ = 0.2; // Hz
+  static constexpr float CHIRP_END_FREQ = 5.0;   // Hz
+
+private:
+  // Class variables
+  sysid_config config;
+  bool running;
+
+  uint32_t step;
+  uint32_t settle_steps;
+  uint32_t total_steps;
+  uint8_t lfsr;
+  float phase;
+
+  float input_history[3];
+  float output_history[2];
+
+  // The covariance is kept in double, float loses its symmetry over a long run
+  uint8_t parameter_count;
+  double theta[MAX_PARAMETERS];
+  double covariance[MAX_PARAMETERS][MAX_PARAMETERS];
+  static constexpr double INITIAL_COVARIANCE = 1e4;
+
+  uint32_t residual_count;
+  double residual_sum_squares;
+
+  uint8_t regressors(double *phi);
+  void solve_time_constants(float *time_constant, float *time_constant_2);
+
+public:
+  SystemIdentifier();
+
+  bool begin(const sysid_config &config);
+  void cancel();
+  bool is_running();
+  bool is_complete();
+
+  float next_input();
+  void update(float input, float output);
+  void finish(sysid_result *result);
+};
+
+#endif // SYSTEM_ID_H_
@@ -0,0 +1,311 @@
+// Includes
+#include "trajectory.hpp"
+
+#include <string.h>
+#include <cmath>
+
+static constexpr float US_TO_S = 1000000.0;
+
+Trajectory::Trajectory()
+{
+  memset(&config, 0, sizeof(config));
+  running = false;
+
+  memset(segments, 0, sizeof(segments));
+  move_duration = 0;
+  move_start = 0;
+  move_origin = 0;
+  move_sign = 1;
+  move_target = 0;
+  next_reversal = 0;
+  phase_start = 0;
+
+  memset(waveform, 0, sizeof(waveform));
+  memset(waveform_slope, 0, sizeof(waveform_slope));
+  waveform_count = 0;
+}
+
+// Returns false if the configuration cannot be run, start_value is the reference to move from
+bool Trajectory::begin(const trajectory_config &config, float start_value)
+{
+  if (config.profile < PROFILE_SQUARE || config.profile > PROFILE_TABLE || config.rate <= 0 ||
+      (config.profile != PROFILE_SQUARE && (config.rate_limit <= 0 || config.acceleration_limit <= 0 || config.jerk_limit < 0)) ||
+      (config.profile == PROFILE_TABLE && waveform_count < 2))
+    return false;
+
+  this->config = config;
+  next_reversal = US_TO_S / config.rate;
+
+  // The periodic waveforms start at their value at zero phase
+  switch (config.profile)
+  {
+  case PROFILE_SCURVE:
+    plan_move(start_value, config.amplitude, 0);
+    phase_start = 0;
+    break;
+  case PROFILE_SINE:
+  case PROFILE_TRIANGLE:
+    plan_move(start_value, 0, 0);
+    phase_start = move_duration * US_TO_S;
+    break;
+  case PROFILE_TABLE:
+    plan_move(start_value, config.amplitude * waveform[0], 0);
+    phase_start = move_duration * US_TO_S;
+    break;
+  default:
+    phase_start = 0;
+    break;
+  }
+
+  running = true;
+  return true;
+}
+
+void Trajectory::stop()
+{
+  running = false;
+}
+
+bool Trajectory::is_running()
+{
+  return running;
+}
+
+// Stores one cycle of a waveform, values outside [-1, 1] are clamped
+bool Trajectory::set_waveform(const float *points, uint8_t count)
+{
+  if (count < 2 || count > MAX_WAVEFORM_POINTS)
+    return false;
+
+  for (uint8_t i = 0; i < count; i++)
+    waveform[i] = fminf(fmaxf(points[i], -1), 1);
+  for (uint8_t i = 0; i < count; i++)
+    waveform_slope[i] = waveform[(i + 1) % count] - waveform[i];
+  waveform_count = count;
+
+  // A running table profile picks it up on its next cycle
+  return true;
+}
+
+uint8_t Trajectory::get_waveform_count()
+{
+  return waveform_count;
+}
+
+// Plans the time-optimal move between two values at rest within the limits, as jerk up, constant
+// acceleration, jerk down, cruise and the mirror image
+void Trajectory::plan_move(float from, float to, uint64_t time)
+{
+  float distance = fabsf(to - from);
+  float rate = config.rate_limit;
+  float acceleration = config.acceleration_limit;
+  float jerk = config.jerk_limit;
+  float jerk_time;
+  float acceleration_time;
+  float cruise_time;
+  float peak_acceleration;
+  float durations[SEGMENT_COUNT];
+  float jerks[SEGMENT_COUNT];
+
+  move_start = time;
+  move_origin = from;
+  move_target = to;
+  move_sign = to >= from ? 1 : -1;
+  memset(segments, 0, sizeof(segments));
+  move_duration = 0;
+
+  if (distance <= 0)
+    return;
+
+  // Peak rate the move can reach, lowered when the distance is too short to cruise
+  if (jerk > 0 && rate * jerk < acceleration * acceleration)
+    acceleration_time = 2 * sqrtf(rate / jerk);
+  else
+    acceleration_time = rate / acceleration + (jerk > 0 ? acceleration / jerk : 0);
+
+  if (rate * acceleration_time > distance)
+  {
+    if (jerk > 0)
+    {
+      rate = acceleration * (-acceleration / jerk + sqrtf(acceleration * acceleration / (jerk * jerk) + 4 * distance / acceleration)) / 2;
+      if (rate * jerk < acceleration * acceleration)
+        rate = powf(distance * sqrtf(jerk) / 2, 2.0f / 3.0f);
+    }
+    else
+      rate = sqrtf(distance * acceleration);
+
+    if (jerk > 0 && rate * jerk < acceleration * acceleration)
+      acceleration_time = 2 * sqrtf(rate / jerk);
+    else
+      acceleration_time = rate / acceleration + (jerk > 0 ? acceleration / jerk : 0);
+  }
+
+  cruise_time = fmaxf(distance / rate - acceleration_time, 0);
+  if (jerk > 0)
+  {
+    jerk_time = fminf(acceleration / jerk, acceleration_time / 2);
+    peak_acceleration = jerk * jerk_time;
+  }
+  else
+  {
+    // An infinite acceleration limit leaves a constant rate ramp
+    jerk_time = 0;
+    peak_acceleration = acceleration_time > 0 ? rate / acceleration_time : 0;
+  }
+
+  durations[0] = jerk_time;
+  durations[1] = acceleration_time - 2 * jerk_time;
+  durations[2] = jerk_time;
+  durations[3] = cruise_time;
+  durations[4] = jerk_time;
+  durations[5] = acceleration_time - 2 * jerk_time;
+  durations[6] = jerk_time;
+
+  // Without a jerk limit the acceleration steps at the segment boundaries instead
+  jerks[0] = jerk;
+  jerks[1] = 0;
+  jerks[2] = -jerk;
+  jerks[3] = 0;
+  jerks[4] = -jerk;
+  jerks[5] = 0;
+  jerks[6] = jerk;
+
+  float start = 0;
+  float value = 0;
+  float value_rate = 0;
+  float value_acceleration = 0;
+
+  for (uint8_t i = 0; i < SEGMENT_COUNT; i++)
+  {
+    float duration = durations[i];
+
+    if (jerk <= 0)
+      value_acceleration = (i == 1) ? peak_acceleration : (i == 5) ? -peak_acceleration : 0;
+    if (acceleration_time <= 0)
+      value_rate = (i == 3) ? rate : 0; // The ramp's rate steps instead
+
+    segments[i].start = start;
+    segments[i].jerk = jerks[i];
+    segments[i].value = value;
+    segments[i].rate = value_rate;
+    segments[i].acceleration = value_acceleration;
+
+    value += value_rate * duration + value_acceleration * duration * duration / 2 + jerks[i] * duration * duration * duration / 6;
+    value_rate += value_acceleration * duration + jerks[i] * duration * duration / 2;
+    value_acceleration += jerks[i] * duration;
+    start += duration;
+  }
+
+  move_duration = start;
+}
+
+void Trajectory::sample_move(uint64_t time, trajectory_point *point)
+{
+  float elapsed = time > move_start ? (time - move_start) / US_TO_S : 0;
+  uint8_t index = SEGMENT_COUNT - 1;
+
+  if (elapsed >= move_duration)
+  {
+    point->value = move_target;
+    point->rate = 0;
+    point->acceleration = 0;
+    return;
+  }
+
+  while (index > 0 && segments[index].start > elapsed)
+    index--;
+
+  const profile_segment &segment = segments[index];
+  float dt = elapsed - segment.start;
+
+  point->value = move_origin + move_sign * (segment.value + segment.rate * dt + segment.acceleration * dt * dt / 2 +
+                                            segment.jerk * dt * dt * dt / 6);
+  point->rate = move_sign * (segment.rate + segment.acceleration * dt + segment.jerk * dt * dt / 2);
+  point->acceleration = move_sign * (segment.acceleration + segment.jerk * dt);
+}
+
+// Periodic waveforms with zero crossings, or table points, spaced by the reversal interval
+void Trajectory::sample_waveform(uint64_t time, trajectory_point *point)
+{
+  uint64_t period_us = 2 * US_TO_S / config.rate;
+  float period = period_us / US_TO_S;
+  float phase = ((time - phase_start) % period_us) / (float)period_us;
+  float amplitude = config.amplitude;
+
+  switch (config.profile)
+  {
+  case PROFILE_SINE:
+  {
+    float omega = 2 * (float)M_PI / period;
+    point->value = amplitude * sinf(2 * (float)M_PI * phase);
+    point->rate = amplitude * omega * cosf(2 * (float)M_PI * phase);
+    point->acceleration = -amplitude * omega * omega * sinf(2 * (float)M_PI * phase);
+    break;
+  }
+  case PROFILE_TRIANGLE:
+  {
+    float slope = 4 * amplitude / period;
+    if (phase < 0.25f)
+      point->value = slope * phase * period;
+    else if (phase < 0.75f)
+    {
+      point->value = amplitude - slope * (phase - 0.25f) * period;
+      slope = -slope;
+    }
+    else
+      point->value = -amplitude + slope * (phase - 0.75f) * period;
+    point->rate = slope;
+    point->acceleration = 0;
+    break;
+  }
+  case PROFILE_TABLE:
+  {
+    float position = phase * waveform_count;
+    uint8_t index = (uint8_t)position;
+    if (index >= waveform_count)
+      index = waveform_count - 1;
+    point->value = amplitude * (waveform[index] + waveform_slope[index] * (position - index));
+    point->rate = amplitude * waveform_slope[index] * waveform_count / period;
+    point->acceleration = 0;
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Reference at a time in us since begin()
+void Trajectory::sample(uint64_t time, trajectory_point *point)
+{
+  point->value = 0;
+  point->rate = 0;
+  point->acceleration = 0;
+
+  if (!running)
+    return;
+
+  switch (config.profile)
+  {
+  case PROFILE_SQUARE:
+    point->value = ((time / (uint64_t)(US_TO_S / config.rate)) % 2 == 0) ? config.amplitude : -config.amplitude;
+    break;
+
+  case PROFILE_SCURVE:
+    // Reverses once the interval is up and the last move has finished, so limits too low for
+    // the rate slow the reversals rather than cutting moves short
+    if (time >= next_reversal && time >= move_start + (uint64_t)(move_duration * US_TO_S))
+    {
+      plan_move(move_target, -move_target, time);
+      next_reversal = time + US_TO_S / config.rate;
+    }
+    sample_move(time, point);
+    break;
+
+  default:
+    if (time < phase_start)
+      sample_move(time, point);
+    else
+      sample_waveform(time, point);
+    break;
+  }
+}
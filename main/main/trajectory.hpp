@@ -0,0 +1,90 @@
+#ifndef TRAJECTORY_H_
+#define TRAJECTORY_H_
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+enum Profile : int32_t
+{
+  PROFILE_SQUARE = 0,   // Steps between +/- amplitude, the original reference
+  PROFILE_SCURVE = 1,   // Jerk-limited moves between +/- amplitude, dwelling at each end
+  PROFILE_SINE = 2,     // Sine of amplitude
+  PROFILE_TRIANGLE = 3, // Constant rate ramps between +/- amplitude
+  PROFILE_TABLE = 4,    // Uploaded waveform scaled by amplitude
+};
+
+typedef struct
+{
+  int32_t profile;
+  float amplitude;          // Signed, the first move is towards it
+  float rate;               // Reversals per s, a full cycle is two
+  float rate_limit;         // Limits on the reference's first three derivatives for S-curve
+  float acceleration_limit; // moves, a jerk limit of 0 is unlimited
+  float jerk_limit;
+} trajectory_config;
+
+// Reference value and its derivatives, in the units of whatever is being profiled
+typedef struct
+{
+  float value;
+  float rate;
+  float acceleration;
+} trajectory_point;
+
+// Motion profile evaluated at control rate, times are in us since begin() so a long run keeps
+// its resolution. S-curve moves are planned once per move as seven
+// constant-jerk segments, so each sample is a segment lookup and a cubic. Every profile except
+// the square wave starts with an S-curve move from the start value, so switching mode or set
+// point never steps the reference.
+class Trajectory
+{
+public:
+  static constexpr uint8_t MAX_WAVEFORM_POINTS = 64;
+
+private:
+  typedef struct
+  {
+    float start; // s from the start of the move
+    float jerk;
+    float value; // State at the start of the segment
+    float rate;
+    float acceleration;
+  } profile_segment;
+
+  static constexpr uint8_t SEGMENT_COUNT = 7;
+
+  // Class variables
+  trajectory_config config;
+  bool running;
+
+  profile_segment segments[SEGMENT_COUNT];
+  float move_duration;
+  uint64_t move_start; // us since begin()
+  float move_origin;
+  float move_sign;
+  float move_target;
+  uint64_t next_reversal; // us since begin()
+  uint64_t phase_start;   // us since begin() the periodic waveform starts
+
+  float waveform[MAX_WAVEFORM_POINTS];       // Normalised to [-1, 1] over one cycle
+  float waveform_slope[MAX_WAVEFORM_POINTS]; // Change to the next point
+  uint8_t waveform_count;
+
+  void plan_move(float from, float to, uint64_t time);
+  void sample_move(uint64_t time, trajectory_point *point);
+  void sample_waveform(uint64_t time, trajectory_point *point);
+
+public:
+  Trajectory();
+
+  bool begin(const trajectory_config &config, float start_value);
+  void stop();
+  bool is_running();
+
+  bool set_waveform(const float *points, uint8_t count);
+  uint8_t get_waveform_count();
+  void sample(uint64_t time, trajectory_point *point);
+};
+
+#endif // TRAJECTORY_H_
@@ -0,0 +1,16 @@
+#ifndef TUNED_GAINS_H_
+#define TUNED_GAINS_H_
+
+// Includes
+#include <stdint.h>
+
+// Fixed controller constants, written by host/sim's dtmc_gain_tuner --header. Regenerate rather
+// than edit. A unit with its own tuning in NVS loads that instead.
+// Tuned by DC_Motor_Tuner.mlx, before there was a tuner run to replace them.
+
+static constexpr float TUNED_KP = 0.00544;
+static constexpr float TUNED_TI = 0.11655;
+static constexpr float TUNED_TD = 0;
+static constexpr uint8_t TUNED_VELOCITY_WINDOW = 100;
+
+#endif // TUNED_GAINS_H_
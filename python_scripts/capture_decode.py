@@ -0,0 +1,105 @@
+"""Rebuild a triggered capture (CONFIG_DTMC_CAPTURE) from its IoT Hub messages.
+
+A capture is one JSON metadata message followed by binary chunks, all with the message
+properties type=capture, motor=<index> and capture=<id>; the chunks also carry
+offset=<byte offset>. Each motor numbers its captures on its own.
+The data is the raw ADC codes (u16) in time order followed by the encoder watch points,
+each a u32 esp_timer time in us and an i32 direction. All integers are little-endian.
+
+Messages exported one per line as {"properties": {...}, "body": <base64>}:
+    python capture_decode.py messages.jsonl capture.csv
+"""
+
+import base64
+import csv
+import json
+import struct
+import sys
+
+
+def assemble(metadata, chunks):
+    """Join the data chunks, given as (offset, bytes), checking none are missing."""
+    data = bytearray(metadata["length"])
+    received = 0
+    for offset, chunk in sorted(chunks):
+        if offset != received:
+            raise ValueError("Capture %d is missing bytes %d to %d" % (metadata["id"], received, offset))
+        data[offset:offset + len(chunk)] = chunk
+        received = offset + len(chunk)
+
+    if received != metadata["length"]:
+        raise ValueError("Capture %d is missing bytes %d to %d" % (metadata["id"], received, metadata["length"]))
+    return bytes(data)
+
+
+def decode(metadata, data):
+    """Convert the conversions to time and current around the trigger, and the edges to time."""
+    count = metadata["samples"]
+    codes = struct.unpack_from("<%dH" % count, data, 0)
+    period_us = 1e6 / metadata["sample_rate"]
+
+    # The calibration is a linear fit of the ADC curve, good to a few mV over the range
+    samples = []
+    for index, code in enumerate(codes):
+        voltage = metadata["offset_mv"] + code * metadata["mv_per_code"]
+        samples.append({
+            "time_us": (index - metadata["trigger_index"]) * period_us,
+            "code": code,
+            "current_ma": (voltage - metadata["zero_mv"]) * metadata["ma_per_mv"],
+        })
+
+    # Edge times wrap at 32 bits like the trigger time they are relative to
+    edges = []
+    for index in range(metadata["edges"]):
+        time, direction = struct.unpack_from("<Ii", data, count * 2 + index * 8)
+        delta = (time - metadata["trigger_us"]) & 0xFFFFFFFF
+        if delta >= 1 << 31:
+            delta -= 1 << 32
+        edges.append({"time_us": delta, "direction": direction})
+
+    return samples, edges
+
+
+def load(path):
+    """Read exported messages, returns {(motor, id): (metadata, data)} for every complete capture."""
+    metadata = {}
+    chunks = {}
+
+    with open(path) as messages:
+        for line in messages:
+            line = line.strip()
+            if not line:
+                continue
+            message = json.loads(line)
+            properties = message.get("properties", {})
+            if properties.get("type") != "capture":
+                continue
+
+            # Messages from before there were several motors have no motor property
+            capture_id = (int(properties.get("motor", 0)), int(properties["capture"]))
+            body = base64.b64decode(message["body"])
+            if "offset" in properties:
+                chunks.setdefault(capture_id, []).append((int(properties["offset"]), body))
+            else:
+                metadata[capture_id] = json.loads(body)["capture"]
+
+    return {capture_id: (metadata[capture_id], assemble(metadata[capture_id], chunks.get(capture_id, [])))
+            for capture_id in metadata}
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("Usage: python capture_decode.py <messages.jsonl> <capture.csv>")
+        sys.exit(1)
+
+    captures = load(sys.argv[1])
+    with open(sys.argv[2], "w", newline="") as output:
+        writer = csv.writer(output)
+        writer.writerow(["motor", "capture", "trigger", "kind", "time_us", "value"])
+        for (motor, capture_id), (metadata, data) in sorted(captures.items()):
+            samples, edges = decode(metadata, data)
+            for sample in samples:
+                writer.writerow([motor, capture_id, metadata["trigger"], "current_ma", "%.1f" % sample["time_us"], "%.3f" % sample["current_ma"]])
+            for edge in edges:
+                writer.writerow([motor, capture_id, metadata["trigger"], "edge", edge["time_us"], edge["direction"]])
+            print("Motor %d capture %d (%s): %d conversions, %d edges" % (motor, capture_id, metadata["trigger"], len(samples), len(edges)))
@@ -0,0 +1,376 @@
+"""Host model of the relay feedback auto-tuner and gain schedule (main/main/relay_tuner.cpp).
+
+The firmware tunes the velocity controller at several set points by switching the duty cycle on
+the sign of the velocity error and measuring the limit cycle, then interpolates the gains from
+the set point at runtime. This script runs the same tuner and velocity controller against a
+simulated motor read back through the firmware's encoder edge timing and moving average:
+    python relay_tuner.py tune --gain 250 --saturation 250
+    python relay_tuner.py regression
+
+regression tunes a linear motor and one whose gain falls with speed, step tests each set point
+with the tuned schedule and with the fixed gains, and exits non-zero if a scheduled step misses
+the steady-state tolerance or overshoots more than allowed.
+"""
+
+import argparse
+import math
+import sys
+from collections import deque
+
+# Tuner constants, as in relay_tuner.hpp
+SETTLE_TIME = 2.0
+SETTLE_RATE = 0.02
+SKIP_CYCLES = 2
+MEASURE_CYCLES = 4
+POINT_TIMEOUT = 15.0
+TL_GAIN = 1 / 3.2
+TL_INTEGRAL = 2.2
+MAX_POINTS = 8
+
+# Velocity controller, as in motor_controller.hpp
+PID_PERIOD = 0.001
+PID_MAX_OUTPUT = 1.0
+PID_MIN_OUTPUT = 0.0
+PID_OSCILLATION = 0.02
+PID_WINDUP = 25
+DEFAULT_KP = 0.00544
+DEFAULT_TI = 0.11655
+DEFAULT_TD = 0.0
+
+# Encoder as wired on the bench and the firmware's velocity estimate
+REDUCTION_RATIO = 65.0
+PULSE_TO_DEG = 360 / (REDUCTION_RATIO * 11.0 * 4.0)
+VELOCITY_SAMPLE_SIZE = 2
+VELOCITY_WINDOW_SIZE = 100
+VELOCITY_TIMEOUT = 0.05
+
+
+class GainSchedule:
+    """Gains by set point, linear between points and held at the ends."""
+
+    def __init__(self):
+        self.points = []
+
+    def add(self, point):
+        if len(self.points) >= MAX_POINTS:
+            return False
+        self.points.append(point)
+        self.points.sort(key=lambda p: p["velocity"])
+        return True
+
+    def interpolate(self, velocity):
+        if not self.points:
+            return None
+
+        upper = 0
+        while upper < len(self.points) and self.points[upper]["velocity"] < velocity:
+            upper += 1
+
+        if upper == 0 or upper == len(self.points):
+            end = self.points[0 if upper == 0 else -1]
+            return end["kp"], end["ti"], end["td"]
+
+        low = self.points[upper - 1]
+        high = self.points[upper]
+        fraction = (velocity - low["velocity"]) / (high["velocity"] - low["velocity"])
+        return tuple(low[key] + fraction * (high[key] - low[key]) for key in ("kp", "ti", "td"))
+
+
+class RelayTuner:
+    """Line for line port of the firmware tuner."""
+
+    def __init__(self, min_velocity, max_velocity, points, amplitude, hysteresis, bias=0.5):
+        if points <= 0 or points > MAX_POINTS or min_velocity <= 0 or max_velocity < min_velocity \
+                or amplitude <= 0 or amplitude > 0.5 or hysteresis < 0:
+            raise ValueError("Invalid auto-tune configuration")
+
+        self.min_velocity = min_velocity
+        self.max_velocity = max_velocity
+        self.points = points
+        self.amplitude = amplitude
+        self.hysteresis = hysteresis
+        self.bias = bias
+
+        self.point = 0
+        self.schedule = GainSchedule()
+        self.complete = False
+        self.start_point()
+
+    def start_point(self):
+        if self.points == 1:
+            self.setpoint = self.min_velocity
+        else:
+            self.setpoint = self.min_velocity + (self.max_velocity - self.min_velocity) * self.point / (self.points - 1)
+
+        self.settling = True
+        self.elapsed = 0.0
+        self.cycles = 0
+        self.measured = 0
+        self.period_sum = 0.0
+        self.amplitude_sum = 0.0
+
+    def finish_point(self):
+        if self.measured > 0:
+            amplitude = self.amplitude_sum / self.measured
+            period = self.period_sum / self.measured
+            if amplitude > self.hysteresis:
+                ultimate_gain = 4 * self.amplitude / (math.pi * math.sqrt(amplitude ** 2 - self.hysteresis ** 2))
+                self.schedule.add({
+                    "velocity": self.setpoint,
+                    "kp": ultimate_gain * TL_GAIN,
+                    "ti": period * TL_INTEGRAL,
+                    "td": 0.0,
+                    "ku": ultimate_gain,
+                    "tu": period,
+                })
+
+        self.point += 1
+        if self.point >= self.points:
+            self.complete = True
+        else:
+            self.start_point()
+
+    def finish_cycle(self):
+        self.cycles += 1
+        if self.cycles >= 2:
+            self.bias += self.amplitude * (self.high_time - self.low_time) / (self.high_time + self.low_time)
+            if self.cycles > SKIP_CYCLES:
+                self.period_sum += self.cycle_time
+                self.amplitude_sum += (self.peak_high - self.peak_low) / 2
+                self.measured += 1
+
+        self.cycle_time = 0.0
+        self.high_time = 0.0
+        self.low_time = 0.0
+        self.peak_high = self.setpoint
+        self.peak_low = self.setpoint
+
+        if self.measured >= MEASURE_CYCLES:
+            self.finish_point()
+
+    def next_input(self, velocity, period):
+        error = self.setpoint - velocity
+
+        if self.complete:
+            return 0.0
+
+        if self.settling:
+            self.elapsed += period
+            self.bias = min(max(self.bias + SETTLE_RATE * error * period, 0.0), 1.0)
+            if self.elapsed >= SETTLE_TIME:
+                self.relay_high = error > 0
+                self.cycle_time = 0.0
+                self.high_time = 0.0
+                self.low_time = 0.0
+                self.peak_high = velocity
+                self.peak_low = velocity
+                self.settling = False
+            return self.bias
+
+        self.elapsed += period
+        self.cycle_time += period
+        if self.relay_high:
+            self.high_time += period
+        else:
+            self.low_time += period
+        self.peak_high = max(self.peak_high, velocity)
+        self.peak_low = min(self.peak_low, velocity)
+
+        if self.relay_high and error < -self.hysteresis:
+            self.relay_high = False
+        elif not self.relay_high and error > self.hysteresis:
+            self.relay_high = True
+            self.finish_cycle()
+
+        if not self.complete and not self.settling and self.elapsed > SETTLE_TIME + POINT_TIMEOUT:
+            self.finish_point()
+
+        value = self.bias + self.amplitude if self.relay_high else self.bias - self.amplitude
+        return min(max(value, 0.0), 1.0)
+
+
+class MotorSimulator:
+    """First order motor from duty cycle to RPM, with an optional tanh saturation so the gain falls
+    with speed, read back like the firmware: the time between encoder watch points, zeroed after
+    a timeout, through the moving average the PID task reads."""
+
+    def __init__(self, gain, tau=0.12, offset_rpm=-40.0, saturation=0.0, step=1e-4):
+        self.gain = gain
+        self.tau = tau
+        self.offset_rpm = offset_rpm
+        self.saturation = saturation
+        self.step = step
+
+        self.time = 0.0
+        self.velocity = 0.0
+        self.position = 0.0
+        self.edges = 0
+        self.last_edge = None
+        self.edge_velocity = 0.0
+        self.window = deque(maxlen=VELOCITY_WINDOW_SIZE)
+        self.window_sum = 0.0
+
+    def target(self, duty_cycle):
+        target = max(self.gain * duty_cycle + self.offset_rpm, 0.0)
+        if self.saturation > 0:
+            target = self.saturation * math.tanh(target / self.saturation)
+        return target
+
+    def run(self, duty_cycle, period=PID_PERIOD):
+        spacing = VELOCITY_SAMPLE_SIZE * PULSE_TO_DEG
+        target = self.target(duty_cycle)
+
+        for _ in range(int(round(period / self.step))):
+            self.velocity += self.step * (target - self.velocity) / self.tau
+            self.position += self.velocity * 6 * self.step
+            self.time += self.step
+
+            edges = math.floor(self.position / spacing)
+            if edges != self.edges:
+                # Edge time interpolated inside the step, then truncated to the esp_timer's us
+                edge_time = self.time - (self.position - edges * spacing) / (self.velocity * 6)
+                edge_time = math.floor(edge_time * 1e6) / 1e6
+                if self.last_edge is not None:
+                    self.edge_velocity = spacing / 6 / (edge_time - self.last_edge)
+                self.last_edge = edge_time
+                self.edges = edges
+
+        if self.last_edge is not None and self.time - self.last_edge > VELOCITY_TIMEOUT:
+            self.edge_velocity = 0.0
+
+        if len(self.window) == self.window.maxlen:
+            self.window_sum -= self.window[0]
+        self.window.append(self.edge_velocity)
+        self.window_sum += self.edge_velocity
+        return self.window_sum / len(self.window)
+
+
+class VelocityController:
+    """pid_velocity_task(), with the dead band and PID_WINDUP only applied to the fixed gains."""
+
+    def __init__(self, schedule=None, gain_mag=1.0):
+        self.schedule = schedule
+        self.gain_mag = gain_mag
+        self.integral = 0.0
+        self.error_prev = 0.0
+        self.output_prev = 0.0
+
+    def next_output(self, setpoint, velocity, period=PID_PERIOD):
+        gains = self.schedule.interpolate(setpoint) if self.schedule else None
+        kp, ti, td = gains if gains else (DEFAULT_KP, DEFAULT_TI, DEFAULT_TD)
+
+        error = setpoint - abs(velocity)
+        self.integral += error * period
+        derivative = (error - self.error_prev) / period
+
+        limit = PID_MAX_OUTPUT * ti / (kp * self.gain_mag) if gains else PID_WINDUP / self.gain_mag
+        self.integral = min(max(self.integral, -limit), limit)
+
+        output = self.gain_mag * (kp * (error + 1 / ti * self.integral + td * derivative))
+        output = min(max(output, PID_MIN_OUTPUT), PID_MAX_OUTPUT)
+
+        if gains is None and abs(error) <= setpoint * PID_OSCILLATION:
+            output = self.output_prev
+
+        self.error_prev = error
+        self.output_prev = output
+        return output
+
+
+def tune(simulator, tuner, limit=120.0):
+    duty_cycle = 0.0
+    elapsed = 0.0
+    while not tuner.complete and elapsed < limit:
+        velocity = simulator.run(duty_cycle)
+        duty_cycle = tuner.next_input(velocity, PID_PERIOD)
+        elapsed += PID_PERIOD
+    return tuner.schedule
+
+
+def step_test(simulator, controller, setpoint, duration=4.0, window=1.0):
+    """Step from standstill, returns the overshoot and the mean and peak error over the last
+    window, all relative to the set point."""
+    duty_cycle = 0.0
+    steps = int(round(duration / PID_PERIOD))
+    tail = int(round(window / PID_PERIOD))
+    peak = 0.0
+    errors = []
+
+    for index in range(steps):
+        velocity = simulator.run(duty_cycle)
+        duty_cycle = controller.next_output(setpoint, velocity)
+        peak = max(peak, velocity)
+        if index >= steps - tail:
+            errors.append(velocity - setpoint)
+
+    return {
+        "overshoot": max(peak - setpoint, 0.0) / setpoint,
+        "mean_error": sum(errors) / len(errors) / setpoint,
+        "peak_error": max(abs(error) for error in errors) / setpoint,
+    }
+
+
+def print_schedule(schedule):
+    print("%8s %10s %8s %10s %8s" % ("RPM", "Ku", "Tu (s)", "kp", "ti (s)"))
+    for point in schedule.points:
+        print("%8.1f %10.5f %8.4f %10.6f %8.4f" % (point["velocity"], point["ku"], point["tu"], point["kp"], point["ti"]))
+
+
+def regression(args):
+    motors = [
+        ("linear", dict(gain=250.0)),
+        ("saturating", dict(gain=250.0, saturation=250.0)),
+    ]
+    setpoints = [40.0, 60.0, 100.0, 140.0, 160.0]
+    failures = 0
+
+    for name, parameters in motors:
+        tuner = RelayTuner(args.min, args.max, args.points, args.amplitude, args.hysteresis)
+        schedule = tune(MotorSimulator(**parameters), tuner)
+        print("%s motor %s" % (name, parameters))
+        print_schedule(schedule)
+        if len(schedule.points) != args.points:
+            print("FAIL: %d of %d points tuned" % (len(schedule.points), args.points))
+            failures += 1
+
+        print("%8s %-9s %10s %10s %10s" % ("RPM", "gains", "overshoot", "mean err", "peak err"))
+        for setpoint in setpoints:
+            for label, gains in (("fixed", None), ("scheduled", schedule)):
+                result = step_test(MotorSimulator(**parameters), VelocityController(gains), setpoint)
+                status = ""
+                if gains is not None and (abs(result["mean_error"]) > args.tolerance or result["overshoot"] > args.overshoot):
+                    status = "FAIL"
+                    failures += 1
+                print("%8.1f %-9s %9.1f%% %9.2f%% %9.2f%% %s" % (setpoint, label, result["overshoot"] * 100,
+                                                              result["mean_error"] * 100, result["peak_error"] * 100, status))
+        print()
+
+    print("%d failures" % failures)
+    return failures == 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("command", choices=["tune", "regression"])
+    parser.add_argument("--gain", type=float, default=250.0, help="RPM per duty cycle")
+    parser.add_argument("--tau", type=float, default=0.12, help="mechanical time constant in s")
+    parser.add_argument("--saturation", type=float, default=0.0, help="speed the gain saturates towards in RPM, 0 for linear")
+    parser.add_argument("--min", type=float, default=40.0)
+    parser.add_argument("--max", type=float, default=160.0)
+    parser.add_argument("--points", type=int, default=4)
+    parser.add_argument("--amplitude", type=float, default=0.1)
+    parser.add_argument("--hysteresis", type=float, default=1.0)
+    parser.add_argument("--tolerance", type=float, default=0.02, help="allowed steady-state mean error")
+    parser.add_argument("--overshoot", type=float, default=0.25, help="allowed step overshoot")
+    args = parser.parse_args()
+
+    if args.command == "tune":
+        tuner = RelayTuner(args.min, args.max, args.points, args.amplitude, args.hysteresis)
+        print_schedule(tune(MotorSimulator(args.gain, args.tau, saturation=args.saturation), tuner))
+        return
+
+    sys.exit(0 if regression(args) else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,307 @@
+"""Browse sample stores written by the host store library (host/store/sample_store.hpp).
+
+A store holds a recorded session with a min/max/mean pyramid per channel, so any window is read
+at about the plot's width in points however long the session is. Record frames into a store and
+browse it, zooming with the matplotlib toolbar, which reads each new view from the store:
+    dtmc_store_record session.dtms lab_frames.jsonl
+    python sample_store.py browse session.dtms --channels velocity current
+
+The library is libdtmc_store from the host build (cmake -S host -B build/host), found in
+build/host/store or at DTMC_STORE_LIBRARY. Windows are numpy arrays if numpy is installed and
+lists otherwise.
+"""
+
+import argparse
+import ctypes
+import math
+import os
+import shutil
+import sys
+import tempfile
+
+try:
+    import numpy as np
+except ImportError:
+    np = None
+
+LIBRARY_NAMES = ["libdtmc_store.so", "libdtmc_store.dylib"]
+DEFAULT_POINTS = 2000
+
+
+def _load_library():
+    path = os.environ.get("DTMC_STORE_LIBRARY")
+    if not path:
+        build_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "build", "host", "store")
+        candidates = [os.path.join(build_dir, name) for name in LIBRARY_NAMES]
+        path = next((candidate for candidate in candidates if os.path.exists(candidate)), candidates[0])
+
+    library = ctypes.CDLL(path)
+    store = ctypes.c_void_p
+    u64_pointer = ctypes.POINTER(ctypes.c_uint64)
+    float_pointer = ctypes.POINTER(ctypes.c_float)
+
+    signatures = {
+        "dtmc_store_create": (store, [ctypes.c_char_p, ctypes.c_uint8, ctypes.POINTER(ctypes.c_char_p)]),
+        "dtmc_store_open": (store, [ctypes.c_char_p]),
+        "dtmc_store_close": (None, [store]),
+        "dtmc_store_append": (ctypes.c_int, [store, u64_pointer, float_pointer, ctypes.c_uint32]),
+        "dtmc_store_flush": (ctypes.c_int, [store]),
+        "dtmc_store_refresh": (ctypes.c_int, [store]),
+        "dtmc_store_channel_count": (ctypes.c_uint8, [store]),
+        "dtmc_store_channel_name": (ctypes.c_char_p, [store, ctypes.c_uint8]),
+        "dtmc_store_samples": (ctypes.c_uint64, [store]),
+        "dtmc_store_time_range": (ctypes.c_int, [store, u64_pointer, u64_pointer]),
+        "dtmc_store_query": (ctypes.c_int64, [store, ctypes.c_uint8, ctypes.c_uint64, ctypes.c_uint64,
+                                              ctypes.c_uint32, u64_pointer, float_pointer, float_pointer,
+                                              float_pointer]),
+    }
+    for name, (result, arguments) in signatures.items():
+        function = getattr(library, name)
+        function.restype = result
+        function.argtypes = arguments
+
+    return library
+
+
+_library = None
+
+
+def _get_library():
+    global _library
+    if _library is None:
+        _library = _load_library()
+    return _library
+
+
+class SampleStore:
+    """A store opened for browsing, or created for recording with SampleStore.create()."""
+
+    def __init__(self, path, handle=None):
+        self._library = _get_library()
+        self._handle = handle if handle is not None else self._library.dtmc_store_open(path.encode())
+        if not self._handle:
+            raise IOError("Cannot open sample store %s" % path)
+
+    @classmethod
+    def create(cls, path, channels):
+        library = _get_library()
+        names = (ctypes.c_char_p * len(channels))(*[name.encode() for name in channels])
+        handle = library.dtmc_store_create(path.encode(), len(channels), names)
+        if not handle:
+            raise IOError("Cannot create sample store %s" % path)
+        return cls(path, handle)
+
+    def close(self):
+        if self._handle:
+            self._library.dtmc_store_close(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exception):
+        self.close()
+
+    @property
+    def channels(self):
+        count = self._library.dtmc_store_channel_count(self._handle)
+        return [self._library.dtmc_store_channel_name(self._handle, i).decode() for i in range(count)]
+
+    @property
+    def samples(self):
+        return self._library.dtmc_store_samples(self._handle)
+
+    def time_range(self):
+        """First and last timestamps in ms, None for an empty store."""
+        start = ctypes.c_uint64()
+        end = ctypes.c_uint64()
+        if not self._library.dtmc_store_time_range(self._handle, ctypes.byref(start), ctypes.byref(end)):
+            return None
+        return start.value, end.value
+
+    def append(self, times, values):
+        """Appends samples, values holding a sequence per channel of the same length as times."""
+        count = len(times)
+        if len(values) != len(self.channels) or any(len(column) != count for column in values):
+            raise ValueError("Need a column of %d values per channel" % count)
+
+        time_array = (ctypes.c_uint64 * count)(*times)
+        value_array = (ctypes.c_float * (count * len(values)))(*[value for column in values for value in column])
+        if not self._library.dtmc_store_append(self._handle, time_array, value_array, count):
+            raise IOError("Cannot append to sample store")
+
+    def flush(self):
+        if not self._library.dtmc_store_flush(self._handle):
+            raise IOError("Cannot flush sample store")
+
+    def refresh(self):
+        """Picks up what a recorder has flushed since the store was opened."""
+        if not self._library.dtmc_store_refresh(self._handle):
+            raise IOError("Cannot reread sample store")
+
+    def window(self, channel, start=0, end=2 ** 64 - 1, points=DEFAULT_POINTS):
+        """Times, minimums, maximums and means of at most points points covering [start, end] ms."""
+        index = self.channels.index(channel) if isinstance(channel, str) else channel
+        times = (ctypes.c_uint64 * points)()
+        minimum = (ctypes.c_float * points)()
+        maximum = (ctypes.c_float * points)()
+        mean = (ctypes.c_float * points)()
+
+        count = self._library.dtmc_store_query(self._handle, index, int(max(start, 0)), int(min(end, 2 ** 64 - 1)),
+                                               points, times, minimum, maximum, mean)
+        if count < 0:
+            raise IOError("Cannot read sample store")
+
+        columns = (times, minimum, maximum, mean)
+        if np is not None:
+            return tuple(np.ctypeslib.as_array(column)[:count].copy() for column in columns)
+        return tuple(list(column[:count]) for column in columns)
+
+
+def info(path):
+    with SampleStore(path) as store:
+        time_range = store.time_range()
+        print("%s: %d samples of %s" % (path, store.samples, ", ".join(store.channels)))
+        if time_range:
+            print("%d to %d ms, %.1f s" % (time_range[0], time_range[1], (time_range[1] - time_range[0]) / 1000))
+
+
+def print_window(path, channel, start, end, points):
+    with SampleStore(path) as store:
+        times, minimum, maximum, mean = store.window(channel, start, end, points)
+        print("time,min,max,mean")
+        for row in zip(times, minimum, maximum, mean):
+            print("%d,%g,%g,%g" % row)
+
+
+def browse(path, channels, points, follow_ms):
+    import matplotlib.pyplot as plt  # pip install matplotlib
+
+    store = SampleStore(path)
+    channels = channels or store.channels
+    time_range = store.time_range()
+    if time_range is None:
+        raise SystemExit("%s has no samples yet" % path)
+
+    figure, axes = plt.subplots(len(channels), 1, sharex=True, squeeze=False)
+    axes = [row[0] for row in axes]
+    lines = []
+    for axis, channel in zip(axes, channels):
+        axis.set_ylabel(channel)
+        band = axis.fill_between([], [], [], alpha=0.3, step="post")
+        (line,) = axis.plot([], [], linewidth=0.8, drawstyle="steps-post")
+        lines.append([band, line])
+    axes[-1].set_xlabel("time (s)")
+
+    origin = time_range[0]
+    drawing = [False]
+
+    # Reads the visible window at the plot's width, min/max as a band and the mean as a line
+    def redraw(axis=None):
+        if drawing[0]:
+            return
+        drawing[0] = True
+        low, high = axes[0].get_xlim()
+        width = min(points, int(figure.get_figwidth() * figure.dpi))
+        for axis, channel, artists in zip(axes, channels, lines):
+            times, minimum, maximum, mean = store.window(channel, origin + low * 1000, origin + high * 1000, width)
+            seconds = [(time - origin) / 1000 for time in times]
+            artists[0].remove()
+            artists[0] = axis.fill_between(seconds, minimum, maximum, alpha=0.3, step="post")
+            artists[1].set_data(seconds, mean)
+            if len(seconds):
+                axis.set_ylim(min(minimum) - 1e-3, max(maximum) + 1e-3)
+        figure.canvas.draw_idle()
+        drawing[0] = False
+
+    axes[0].set_xlim(0, (time_range[1] - origin) / 1000)
+    axes[0].callbacks.connect("xlim_changed", redraw)
+    redraw()
+
+    # Follows a store being recorded, keeping the view's width at the end of the session
+    if follow_ms:
+        def follow():
+            store.refresh()
+            end = (store.time_range()[1] - origin) / 1000
+            low, high = axes[0].get_xlim()
+            axes[0].set_xlim(max(0, end - (high - low)), end)
+
+        timer = figure.canvas.new_timer(interval=follow_ms)
+        timer.add_callback(follow)
+        timer.start()
+
+    plt.show()
+    store.close()
+
+
+# Writes a store through the binding and checks a few windows against the samples
+def selftest():
+    directory = tempfile.mkdtemp()
+    path = os.path.join(directory, "selftest.dtms")
+    count = 100000
+    times = [1700000000000 + i for i in range(count)]
+    velocity = [100 * math.sin(i * 0.001) for i in range(count)]
+    current = [float(i % 100) for i in range(count)]
+    failures = 0
+
+    def check(condition, description):
+        nonlocal failures
+        print("%s: %s" % ("PASS" if condition else "FAIL", description))
+        failures += 0 if condition else 1
+
+    try:
+        with SampleStore.create(path, ["velocity", "current"]) as recorder:
+            recorder.append(times[: count // 2], [velocity[: count // 2], current[: count // 2]])
+            recorder.flush()
+            with SampleStore(path) as reader:
+                check(reader.samples == count // 2, "a browser sees a flushed recording")
+                recorder.append(times[count // 2:], [velocity[count // 2:], current[count // 2:]])
+                recorder.flush()
+                reader.refresh()
+                check(reader.samples == count, "refresh picks up later samples")
+
+        with SampleStore(path) as store:
+            check(store.channels == ["velocity", "current"], "channel names round trip")
+            check(store.time_range() == (times[0], times[-1]), "the time range spans the recording")
+
+            window_times, minimum, maximum, mean = store.window("velocity", points=500)
+            check(0 < len(window_times) <= 500, "a whole-session window fits its points")
+            check(abs(min(minimum) - min(velocity)) < 1e-3 and abs(max(maximum) - max(velocity)) < 1e-3,
+                  "the whole-session window keeps the extremes")
+
+            window_times, minimum, maximum, mean = store.window("current", times[1000], times[1199], 500)
+            check(list(window_times) == times[1000:1200] and list(mean) == current[1000:1200],
+                  "a short window gives raw samples")
+    finally:
+        shutil.rmtree(directory)
+
+    return failures == 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("command", choices=["info", "window", "browse", "selftest"])
+    parser.add_argument("store", nargs="?")
+    parser.add_argument("--channel", default="velocity", help="channel of a window")
+    parser.add_argument("--channels", nargs="*", help="channels to browse, all by default")
+    parser.add_argument("--start", type=int, default=0, help="window start in ms")
+    parser.add_argument("--end", type=int, default=2 ** 64 - 1, help="window end in ms")
+    parser.add_argument("--points", type=int, default=DEFAULT_POINTS)
+    parser.add_argument("--follow-ms", type=int, default=0, help="reread a store being recorded this often")
+    args = parser.parse_args()
+
+    if args.command == "selftest":
+        sys.exit(0 if selftest() else 1)
+    if args.store is None:
+        parser.error("%s needs a store" % args.command)
+
+    if args.command == "info":
+        info(args.store)
+    elif args.command == "window":
+        print_window(args.store, args.channel, args.start, args.end, args.points)
+    else:
+        browse(args.store, args.channels, args.points, args.follow_ms)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,207 @@
+"""Host model of the on-device system identification (main/main/system_id.cpp).
+
+The firmware drives the motor with PRBS or chirp duty cycle excitation and fits an ARX model of
+velocity with recursive least squares. This script runs the same excitation and estimator on a
+simulated motor with a known gain and time constants, so the estimator and the tuning derived
+from it can be checked before a run on hardware:
+    python system_id.py simulate --gain 180 --tau 0.12 --excitation prbs --order 2
+
+A run on hardware reports the model as the system_id reported property; its discrete
+coefficients can be simulated here with the same command by passing them to step_response().
+"""
+
+import argparse
+import math
+import sys
+
+SAMPLE_PERIOD = 0.01
+SETTLE_TIME = 1.0
+PRBS_HOLD = 5
+CHIRP_START_FREQ = 0.2
+CHIRP_END_FREQ = 5.0
+INITIAL_COVARIANCE = 1e4
+
+EXCITATION_PRBS = 0
+EXCITATION_CHIRP = 1
+
+# Motor and encoder as wired on the bench
+REDUCTION_RATIO = 65.0
+PULSE_TO_DEG = 360 / (REDUCTION_RATIO * 11.0 * 4.0)
+
+
+class SystemIdentifier:
+    """Line for line port of the firmware estimator, in double precision throughout."""
+
+    def __init__(self, excitation, order, offset, amplitude, duration, response=0.0):
+        if order not in (1, 2) or amplitude <= 0 or offset - amplitude < 0 or offset + amplitude > 1:
+            raise ValueError("Invalid identification configuration")
+
+        self.excitation = excitation
+        self.order = order
+        self.offset = offset
+        self.amplitude = amplitude
+        self.duration = duration
+        self.response = response
+
+        self.step = 0
+        self.settle_steps = int(SETTLE_TIME / SAMPLE_PERIOD)
+        self.total_steps = self.settle_steps + int(duration / SAMPLE_PERIOD)
+        self.lfsr = 0x7F
+        self.phase = 0.0
+
+        self.inputs = [0.0, 0.0, 0.0]
+        self.outputs = [0.0, 0.0]
+
+        self.count = 2 * order + 2
+        self.theta = [0.0] * self.count
+        self.covariance = [[INITIAL_COVARIANCE if i == j else 0.0 for j in range(self.count)] for i in range(self.count)]
+
+        self.residual_sum_squares = 0.0
+        self.residual_count = 0
+
+    def is_complete(self):
+        return self.step >= self.total_steps
+
+    def next_input(self):
+        value = self.offset
+        if self.step >= self.settle_steps:
+            excitation_step = self.step - self.settle_steps
+            if self.excitation == EXCITATION_PRBS:
+                if excitation_step > 0 and excitation_step % PRBS_HOLD == 0:
+                    self.lfsr = ((self.lfsr << 1) | (((self.lfsr >> 6) ^ (self.lfsr >> 5)) & 1)) & 0x7F
+                value += self.amplitude if self.lfsr & 1 else -self.amplitude
+            else:
+                elapsed = excitation_step * SAMPLE_PERIOD
+                freq = CHIRP_START_FREQ + (CHIRP_END_FREQ - CHIRP_START_FREQ) * elapsed / self.duration
+                value += self.amplitude * math.sin(self.phase)
+                self.phase = math.fmod(self.phase + 2 * math.pi * freq * SAMPLE_PERIOD, 2 * math.pi)
+
+        self.step += 1
+        return value
+
+    def update(self, value, output):
+        self.inputs = [value] + self.inputs[:2]
+
+        if self.step > self.settle_steps:
+            phi = self.outputs[:self.order] + self.inputs[:self.order + 1] + [1.0]
+            gain = [sum(self.covariance[i][j] * phi[j] for j in range(self.count)) for i in range(self.count)]
+            denominator = 1 + sum(phi[i] * gain[i] for i in range(self.count))
+            error = output - sum(self.theta[i] * phi[i] for i in range(self.count))
+
+            for i in range(self.count):
+                self.theta[i] += gain[i] / denominator * error
+                for j in range(self.count):
+                    self.covariance[i][j] -= gain[i] * gain[j] / denominator
+
+            if self.step > self.settle_steps + (self.total_steps - self.settle_steps) // 2:
+                self.residual_sum_squares += error * error
+                self.residual_count += 1
+
+        self.outputs = [output, self.outputs[0]]
+
+    def finish(self):
+        a = self.theta[:self.order]
+        b = self.theta[self.order:2 * self.order + 1]
+
+        if self.order == 2:
+            discriminant = a[0] * a[0] + 4 * a[1]
+            if discriminant >= 0:
+                poles = [(a[0] + math.sqrt(discriminant)) / 2, (a[0] - math.sqrt(discriminant)) / 2]
+            else:
+                poles = [math.sqrt(-a[1])] * 2
+        else:
+            poles = [a[0], 0.0]
+        time_constants = [-SAMPLE_PERIOD / math.log(pole) if 0 < pole < 1 else 0.0 for pole in poles]
+
+        result = {
+            "order": self.order,
+            "gain": sum(b) / (1 - sum(a)) if sum(a) < 1 else 0.0,
+            "time_constant": time_constants[0],
+            "time_constant_2": time_constants[1],
+            "residual": math.sqrt(self.residual_sum_squares / self.residual_count) if self.residual_count else 0.0,
+            "a": a,
+            "b": b,
+            "bias": self.theta[-1],
+        }
+        result["valid"] = result["gain"] > 0 and result["time_constant"] > 0
+
+        if result["valid"]:
+            total = time_constants[0] + time_constants[1]
+            response = self.response if self.response > 0 else time_constants[0]
+            result["kp"] = total / (result["gain"] * response)
+            result["ti"] = total
+            result["td"] = time_constants[0] * time_constants[1] / total
+        return result
+
+
+class MotorSimulator:
+    """Velocity K u + offset through one or two lags, clamped at standstill, read back as
+    mean velocity from quantised encoder counts like the firmware."""
+
+    def __init__(self, gain, tau, tau_2=0.0, offset_rpm=-40.0, step=1e-4):
+        self.gain = gain
+        self.tau = tau
+        self.tau_2 = tau_2
+        self.offset_rpm = offset_rpm
+        self.step = step
+        self.velocity = 0.0
+        self.inner = 0.0
+        self.position = 0.0
+        self.counts = 0
+
+    def run(self, duty_cycle, period=SAMPLE_PERIOD):
+        for _ in range(int(round(period / self.step))):
+            target = max(self.gain * duty_cycle + self.offset_rpm, 0.0)
+            if self.tau_2 > 0:
+                self.inner += self.step * (target - self.inner) / self.tau_2
+                self.velocity += self.step * (self.inner - self.velocity) / self.tau
+            else:
+                self.velocity += self.step * (target - self.velocity) / self.tau
+            self.position += self.velocity * 6 * self.step
+
+        counts = math.floor(self.position / PULSE_TO_DEG)
+        velocity = (counts - self.counts) * PULSE_TO_DEG / period / 6
+        self.counts = counts
+        return velocity
+
+
+def identify(simulator, identifier):
+    duty_cycle = 0.0
+    while True:
+        identifier.update(duty_cycle, simulator.run(duty_cycle))
+        if identifier.is_complete():
+            return identifier.finish()
+        duty_cycle = identifier.next_input()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("command", choices=["simulate"])
+    parser.add_argument("--gain", type=float, default=180.0, help="RPM per duty cycle")
+    parser.add_argument("--tau", type=float, default=0.12, help="mechanical time constant in s")
+    parser.add_argument("--tau2", type=float, default=0.0, help="electrical time constant in s")
+    parser.add_argument("--excitation", choices=["prbs", "chirp"], default="prbs")
+    parser.add_argument("--order", type=int, default=2)
+    parser.add_argument("--offset", type=float, default=0.5)
+    parser.add_argument("--amplitude", type=float, default=0.2)
+    parser.add_argument("--duration", type=float, default=10.0)
+    parser.add_argument("--tolerance", type=float, default=0.1, help="allowed relative error in gain and tau")
+    args = parser.parse_args()
+
+    excitation = EXCITATION_PRBS if args.excitation == "prbs" else EXCITATION_CHIRP
+    identifier = SystemIdentifier(excitation, args.order, args.offset, args.amplitude, args.duration)
+    result = identify(MotorSimulator(args.gain, args.tau, args.tau2), identifier)
+
+    for key in ("valid", "gain", "time_constant", "time_constant_2", "residual", "kp", "ti", "td"):
+        if key in result:
+            print("%-16s %s" % (key, result[key]))
+
+    gain_error = abs(result["gain"] - args.gain) / args.gain
+    tau_error = abs(result["time_constant"] - args.tau) / args.tau
+    print("gain error       %.1f%%" % (gain_error * 100))
+    print("tau error        %.1f%%" % (tau_error * 100))
+    sys.exit(0 if result["valid"] and gain_error <= args.tolerance and tau_error <= args.tolerance else 1)
+
+
+if __name__ == "__main__":
+    main()
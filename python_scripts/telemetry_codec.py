@@ -0,0 +1,347 @@
+"""Encode and decode compressed telemetry frames (CONFIG_DTMC_TELEMETRY_COMPRESSION).
+
+A frame is "DT", a version byte and a byte holding the window bits << 4 | lookahead bits,
+followed by a heatshrink stream of: sample count (u16), column count (u8) and for each column
+its key length (u8), key, type (0 = u64, 1 = f32), filter (0 = none, 1 = delta, 2 = XOR) and
+its values. All integers are little-endian.
+
+An edge gateway batch is "DB", a version byte and the same window byte, followed by a heatshrink
+stream of: frame count (u16) and for each frame its device id length (u8), device id, motor (u8)
+and the frame's columns as above, sample count onwards.
+
+A live message, sent uncompressed over the local WebSocket (CONFIG_DTMC_LIVE), is "DL", a version
+byte, motor (u8), decimation (u16), sample count (u16), sequence of the first sample (u32) and
+samples skipped for this client so far (u32), followed by each sample's timestamp (u64) and duty
+cycle, velocity, position and current (f32).
+
+Benchmark on recorded frames, one JSON frame per line as sent over UART or IoT Hub:
+    python telemetry_codec.py benchmark lab_frames.jsonl
+"""
+
+import json
+import struct
+import sys
+import time
+
+FRAME_MAGIC = b"DT"
+FRAME_VERSION = 1
+BATCH_MAGIC = b"DB"
+BATCH_VERSION = 1
+LIVE_MAGIC = b"DL"
+LIVE_VERSION = 1
+
+COLUMN_UINT64 = 0
+COLUMN_FLOAT32 = 1
+
+FILTER_NONE = 0
+FILTER_DELTA = 1
+FILTER_XOR = 2
+
+WINDOW_BITS = 8
+LOOKAHEAD_BITS = 4
+
+# Column order, types and filters used by the firmware
+FIRMWARE_COLUMNS = [
+    ("timestamp", COLUMN_UINT64, FILTER_DELTA),
+    ("gain", COLUMN_FLOAT32, FILTER_XOR),
+    ("duty_cycle", COLUMN_FLOAT32, FILTER_XOR),
+    ("velocity", COLUMN_FLOAT32, FILTER_XOR),
+    ("position", COLUMN_FLOAT32, FILTER_XOR),
+    ("current", COLUMN_FLOAT32, FILTER_XOR),
+]
+
+_FORMATS = {COLUMN_UINT64: "<Q", COLUMN_FLOAT32: "<I"}
+_MASKS = {COLUMN_UINT64: (1 << 64) - 1, COLUMN_FLOAT32: (1 << 32) - 1}
+
+
+class _BitWriter:
+    def __init__(self):
+        self.output = bytearray()
+        self.bits = 0
+        self.count = 0
+
+    def push(self, count, value):
+        for shift in range(count - 1, -1, -1):
+            self.bits = (self.bits << 1) | ((value >> shift) & 1)
+            self.count += 1
+            if self.count == 8:
+                self.output.append(self.bits)
+                self.bits = 0
+                self.count = 0
+
+    def finish(self):
+        if self.count > 0:
+            self.output.append((self.bits << (8 - self.count)) & 0xFF)
+        return bytes(self.output)
+
+
+class _BitReader:
+    def __init__(self, data):
+        self.data = data
+        self.position = 0
+
+    def remaining(self):
+        return len(self.data) * 8 - self.position
+
+    def read(self, count):
+        value = 0
+        for _ in range(count):
+            byte = self.data[self.position >> 3]
+            value = (value << 1) | ((byte >> (7 - (self.position & 7))) & 1)
+            self.position += 1
+        return value
+
+
+def compress(data, window_bits=WINDOW_BITS, lookahead_bits=LOOKAHEAD_BITS):
+    """Greedy LZSS in the heatshrink format, byte for byte what the firmware produces."""
+    window_size = 1 << window_bits
+    lookahead_size = 1 << lookahead_bits
+    literal_bits = 1 + 8
+    reference_bits = 1 + window_bits + lookahead_bits
+
+    writer = _BitWriter()
+    position = 0
+    while position < len(data):
+        max_length = min(lookahead_size, len(data) - position)
+        best_length = 0
+        best_distance = 0
+        for distance in range(1, min(position, window_size) + 1):
+            length = 0
+            while length < max_length and data[position - distance + length] == data[position + length]:
+                length += 1
+            if length > best_length:
+                best_length = length
+                best_distance = distance
+                if length == max_length:
+                    break
+
+        if best_length * literal_bits > reference_bits:
+            writer.push(1, 0)
+            writer.push(window_bits, best_distance - 1)
+            writer.push(lookahead_bits, best_length - 1)
+            position += best_length
+        else:
+            writer.push(1, 1)
+            writer.push(8, data[position])
+            position += 1
+
+    return writer.finish()
+
+
+def decompress(data, window_bits=WINDOW_BITS, lookahead_bits=LOOKAHEAD_BITS):
+    reader = _BitReader(data)
+    output = bytearray()
+
+    while reader.remaining() >= 1 + 8:
+        if reader.read(1):
+            output.append(reader.read(8))
+            continue
+
+        # Trailing zero padding is shorter than a back-reference
+        if reader.remaining() < window_bits + lookahead_bits:
+            break
+        distance = reader.read(window_bits) + 1
+        length = reader.read(lookahead_bits) + 1
+        if distance > len(output):
+            raise ValueError("Back-reference before the start of the stream")
+        for _ in range(length):
+            output.append(output[-distance])
+
+    return bytes(output)
+
+
+def _filter(values, column_type, column_filter):
+    mask = _MASKS[column_type]
+    if column_type == COLUMN_FLOAT32:
+        values = [struct.unpack("<I", struct.pack("<f", value))[0] for value in values]
+    else:
+        values = [int(value) for value in values]
+
+    previous = 0
+    filtered = []
+    for value in values:
+        if column_filter == FILTER_DELTA:
+            filtered.append((value - previous) & mask)
+        elif column_filter == FILTER_XOR:
+            filtered.append(value ^ previous)
+        else:
+            filtered.append(value)
+        previous = value
+    return filtered
+
+
+def _unfilter(values, column_type, column_filter):
+    mask = _MASKS[column_type]
+    previous = 0
+    restored = []
+    for value in values:
+        if column_filter == FILTER_DELTA:
+            value = (value + previous) & mask
+        elif column_filter == FILTER_XOR:
+            value ^= previous
+        restored.append(value)
+        previous = value
+
+    if column_type == COLUMN_FLOAT32:
+        return [struct.unpack("<f", struct.pack("<I", value))[0] for value in restored]
+    return restored
+
+
+def encode_frame(frame, columns=FIRMWARE_COLUMNS):
+    """Encode a dict of equal length columns as the firmware would."""
+    count = len(frame[columns[0][0]])
+    body = bytearray(struct.pack("<HB", count, len(columns)))
+
+    for key, column_type, column_filter in columns:
+        encoded_key = key.encode()
+        body += struct.pack("<B", len(encoded_key)) + encoded_key + struct.pack("<BB", column_type, column_filter)
+        for value in _filter(frame[key], column_type, column_filter):
+            body += struct.pack(_FORMATS[column_type], value)
+
+    header = FRAME_MAGIC + bytes([FRAME_VERSION, (WINDOW_BITS << 4) | LOOKAHEAD_BITS])
+    return header + compress(bytes(body))
+
+
+def is_frame(data):
+    return len(data) >= 4 and data[:2] == FRAME_MAGIC
+
+
+def _decode_columns(body, offset):
+    count, column_count = struct.unpack_from("<HB", body, offset)
+    offset += 3
+    frame = {}
+
+    for _ in range(column_count):
+        key_length = body[offset]
+        key = body[offset + 1:offset + 1 + key_length].decode()
+        offset += 1 + key_length
+        column_type, column_filter = body[offset], body[offset + 1]
+        offset += 2
+
+        value_format = _FORMATS[column_type]
+        size = struct.calcsize(value_format)
+        values = [struct.unpack_from(value_format, body, offset + i * size)[0] for i in range(count)]
+        offset += count * size
+        frame[key] = _unfilter(values, column_type, column_filter)
+
+    return frame, offset
+
+
+def decode_frame(data):
+    """Decode a compressed frame into the same dict of columns as the JSON frame."""
+    if not is_frame(data) or data[2] != FRAME_VERSION:
+        raise ValueError("Not a version %d telemetry frame" % FRAME_VERSION)
+
+    body = decompress(data[4:], data[3] >> 4, data[3] & 0x0F)
+    return _decode_columns(body, 0)[0]
+
+
+def is_batch(data):
+    return len(data) >= 4 and data[:2] == BATCH_MAGIC
+
+
+def decode_batch(data):
+    """Decode an edge gateway batch into a list of frames, each with its device and motor."""
+    if not is_batch(data) or data[2] != BATCH_VERSION:
+        raise ValueError("Not a version %d gateway batch" % BATCH_VERSION)
+
+    body = decompress(data[4:], data[3] >> 4, data[3] & 0x0F)
+    (count,) = struct.unpack_from("<H", body, 0)
+    offset = 2
+    frames = []
+
+    for _ in range(count):
+        id_length = body[offset]
+        device = body[offset + 1:offset + 1 + id_length].decode()
+        motor = body[offset + 1 + id_length]
+        frame, offset = _decode_columns(body, offset + 2 + id_length)
+        frames.append({"device": device, "motor": motor, "frame": frame})
+
+    return frames
+
+
+def is_live(data):
+    return len(data) >= 16 and data[:2] == LIVE_MAGIC
+
+
+def decode_live(data):
+    """Decode a live WebSocket message into its header fields and a list of samples."""
+    if not is_live(data) or data[2] != LIVE_VERSION:
+        raise ValueError("Not a version %d live message" % LIVE_VERSION)
+
+    _, version, motor, decimation, count, sequence, skipped = struct.unpack_from("<2sBBHHII", data, 0)
+    samples = []
+
+    for i in range(count):
+        timestamp, duty_cycle, velocity, position, current = struct.unpack_from("<Qffff", data, 16 + i * 24)
+        samples.append({"timestamp": timestamp, "duty_cycle": duty_cycle, "velocity": velocity,
+                        "position": position, "current": current})
+
+    return {"version": version, "motor": motor, "decimation": decimation, "sequence": sequence,
+            "skipped": skipped, "samples": samples}
+
+
+def decode(data):
+    """Decode a telemetry message body, compressed, batched, live or JSON."""
+    if is_frame(data):
+        return decode_frame(data)
+    if is_batch(data):
+        return decode_batch(data)
+    if is_live(data):
+        return decode_live(data)
+    return json.loads(data)
+
+
+def benchmark(path):
+    json_bytes = 0
+    text_bytes = 0
+    frame_bytes = 0
+    encode_time = 0.0
+    decode_time = 0.0
+    frames = 0
+
+    with open(path, "rb") as recording:
+        for line in recording:
+            line = line.strip()
+            if not line:
+                continue
+            frame = json.loads(line)
+
+            start = time.perf_counter()
+            encoded = encode_frame(frame)
+            encode_time += time.perf_counter() - start
+
+            start = time.perf_counter()
+            decoded = decode_frame(encoded)
+            decode_time += time.perf_counter() - start
+
+            # Floats are sent as float32, compare at that precision
+            expected = decode_frame(encode_frame(decoded))
+            if expected != decoded or decoded["timestamp"] != [int(value) for value in frame["timestamp"]]:
+                raise ValueError("Frame %d did not round trip" % frames)
+
+            json_bytes += len(line) + 1
+            text_bytes += len(compress(line + b"\n"))
+            frame_bytes += len(encoded)
+            frames += 1
+
+    if frames == 0:
+        print("No frames in %s" % path)
+        return
+
+    print("Frames:                     %d" % frames)
+    print("JSON bytes per frame:       %.0f" % (json_bytes / frames))
+    print("JSON + heatshrink:          %.0f (%.1fx)" % (text_bytes / frames, json_bytes / text_bytes))
+    print("Filtered columns + heatshrink: %.0f (%.1fx)" % (frame_bytes / frames, json_bytes / frame_bytes))
+    print("Host decode:                %.1f MB/s of JSON" % (json_bytes / decode_time / 1e6))
+    print("Host encode (reference):    %.1f ms per frame" % (encode_time / frames * 1e3))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) == 3 and sys.argv[1] == "benchmark":
+        benchmark(sys.argv[2])
+    elif len(sys.argv) == 3 and sys.argv[1] == "decode":
+        with open(sys.argv[2], "rb") as message:
+            print(json.dumps(decode(message.read())))
+    else:
+        print("Usage: python telemetry_codec.py benchmark <frames.jsonl> | decode <message.bin>")